@@ -31,6 +31,7 @@ enum {
 	STARLARK_ERROR_OOM = -2,
 	STARLARK_ERROR_TOOBIG = -3,
 	STARLARK_ERROR_NOTSUPPORTED = -4,
+	STARLARK_ERROR_IO = -5,
 };
 
 enum starlark_ErrorCode {
@@ -58,23 +59,111 @@ enum starlark_ErrorCode {
 	STARLARK_ERRORCODE_INT_INVALID,
 	STARLARK_ERRORCODE_FLOAT_TOO_BIG,
 	STARLARK_ERRORCODE_INVALID_ESCAPE,
+	STARLARK_ERRORCODE_INVALID_UNICODE_ESCAPE,
+	STARLARK_ERRORCODE_DIVISION_BY_ZERO,
+	STARLARK_ERRORCODE_NEGATIVE_SHIFT,
+	STARLARK_ERRORCODE_SHIFT_TOO_BIG,
+	STARLARK_ERRORCODE_UNHASHABLE,
+	STARLARK_ERRORCODE_KEY_NOT_FOUND,
+	STARLARK_ERRORCODE_UNEXPECTED_TOKEN,
+	STARLARK_ERRORCODE_UNEXPECTED_NEWLINE,
+	STARLARK_ERRORCODE_UNEXPECTED_EOF,
+	STARLARK_ERRORCODE_EXPECTED_INDENT,
+	STARLARK_ERRORCODE_UNEXPECTED_INDENT,
+	STARLARK_ERRORCODE_INCONSISTENT_DEDENT,
+	STARLARK_ERRORCODE_INVALID_TARGET,
+	STARLARK_ERRORCODE_CHAINED_COMPARISON,
+	STARLARK_ERRORCODE_ARG_ORDER,
+	STARLARK_ERRORCODE_PARAM_ORDER,
+	STARLARK_ERRORCODE_DUPLICATE_PARAM,
+	STARLARK_ERRORCODE_UNDEFINED_NAME,
+	STARLARK_ERRORCODE_OUTSIDE_LOOP,
+	STARLARK_ERRORCODE_RETURN_OUTSIDE_FUNCTION,
+	STARLARK_ERRORCODE_LOAD_NOT_AT_TOP,
+	STARLARK_ERRORCODE_TOO_MANY_ARGS,
+
+	// Errors which happen while the program runs.
+	STARLARK_ERRORCODE_UNSUPPORTED_BINARY,
+	STARLARK_ERRORCODE_UNSUPPORTED_UNARY,
+	STARLARK_ERRORCODE_FLOAT_DIVISION_BY_ZERO,
+	STARLARK_ERRORCODE_UNBOUND_GLOBAL,
+	STARLARK_ERRORCODE_UNBOUND_LOCAL,
+	STARLARK_ERRORCODE_NOT_CALLABLE,
+	STARLARK_ERRORCODE_NOT_ITERABLE,
+	STARLARK_ERRORCODE_NOT_INDEXABLE,
+	STARLARK_ERRORCODE_INDEX_OUT_OF_RANGE,
+	STARLARK_ERRORCODE_NO_ATTR,
+	STARLARK_ERRORCODE_UNPACK_COUNT,
+	STARLARK_ERRORCODE_ARGS,
+	STARLARK_ERRORCODE_UNEXPECTED_KWARG,
+	STARLARK_ERRORCODE_DUPLICATE_KWARG,
+	STARLARK_ERRORCODE_MISSING_ARG,
+	STARLARK_ERRORCODE_INVALID_ARG,
+	STARLARK_ERRORCODE_MUTATED_DURING_ITERATION,
+	STARLARK_ERRORCODE_RECURSION,
+	STARLARK_ERRORCODE_STACK_OVERFLOW,
+	STARLARK_ERRORCODE_LOAD_UNSUPPORTED,
+	STARLARK_ERRORCODE_FAIL,
+};
+
+// The forms of bytecode a program can be compiled to, which are chosen with
+// the "vm" configuration key.
+enum starlark_VmKind {
+	// Every operand is passed on a stack. This is the default.
+	STARLARK_VM_STACK = 0,
+	// Arithmetic, comparisons and moves between locals name the locals
+	// and constants they use directly, which takes fewer instructions.
+	STARLARK_VM_REGISTER,
+};
+
+// When functions are compiled to machine code, which is chosen with the "jit"
+// configuration key. This only has an effect where the JIT is built in, which
+// is on x86-64 Linux.
+enum starlark_JitMode {
+	// Functions are compiled once they've been called often enough. This
+	// is the default.
+	STARLARK_JIT_ON = 0,
+	// Everything is interpreted, for hosts which don't allow executable
+	// memory to be mapped.
+	STARLARK_JIT_OFF,
+	// Everything is compiled the first time it runs, including the top
+	// level of each module, so that tests cover the machine code.
+	STARLARK_JIT_EAGER,
 };
 
 struct starlark_Int;
 
-// A starlark_Error consists of an error code, line and column, and a message.
-// For example, an error message like this:
+// Extra information about an error. Which member is used depends on the
+// error's code.
+union starlark_ErrorArg {
+	// A range of the source which is quoted in the error message, such as
+	// an unexpected character or an invalid number literal.
+	struct {
+		size_t start;
+		size_t len;
+	} span;
+	// A single character which is quoted in the error message.
+	uint8_t c;
+	// A handle into the context's strpool of a string describing what went
+	// wrong, such as the types of the operands of a binary operator. Only
+	// errors which happen while the program runs use these.
+	int64_t str;
+};
+
+// A starlark_Error consists of an error code, the position in the source where
+// the error occurred, and an argument used to build the error message.
 //
-// msg is heap allocated.
-// Use starlark_errors_free to free all error messages.
+// No text is produced until the error is printed with starlark_error_dump, so
+// recording an error never allocates.
 struct starlark_Error {
 	enum starlark_ErrorCode code;
 	size_t start;
-	const char *msg;
+	union starlark_ErrorArg arg;
 };
 
-// TODO: implement this
 struct starlark_Dict;
+struct starlark_Module;
+struct starlark_Scratch;
 
 struct starlark_Context {
 	struct starlark_Strpool strpool;
@@ -88,28 +177,58 @@ struct starlark_Context {
 	size_t errs_cap;
 
 	size_t srcs_len;
+	// The globals of the last module executed, by name.
 	struct starlark_Dict *globals;
+
+	// Where print() writes to, which is stdout if it's NULL.
+	FILE *out;
+	// The form programs are compiled to, as an enum starlark_VmKind.
+	uint8_t vm;
+	// When functions are compiled to machine code, as an enum
+	// starlark_JitMode.
+	uint8_t jit;
+
+	// Every module which has been executed. Functions defined by a module
+	// refer to its code, so it's kept until the context is finished.
+	size_t modules_len;
+	size_t modules_cap;
+	struct starlark_Module **modules;
 	struct {
 		enum starlark_ErrorCode *codes;
 		size_t *starts;
-		// handle into strpool
-		int64_t *msgs;
+		union starlark_ErrorArg *args;
 	} errs;
+
+	// The lexer, parser and resolver programs are read with, and the
+	// compiler's arrays, kept so that their memory is reused by the next
+	// program. Made by the first call to starlark_parse or starlark_exec.
+	struct starlark_Scratch *scratch;
 };
 
-// Attempts to set the configuration key to the given value.
+// Attempts to set the configuration key to the given value. The keys are:
+//
+// - "vm": "stack" or "register", the form programs executed afterwards are
+//   compiled to. See enum starlark_VmKind.
+// - "jit": "on", "off" or "eager", when functions are compiled to machine
+//   code. See enum starlark_JitMode.
+//
 // Returns 0 if set successfully, and a nonzero error code otherwise.
 STARLARK_PUBLIC
 int starlark_config_set(struct starlark_Context *ctx, const char *key,
 			const char *value);
 
-// Initializes a starlark_Context with the given name from the starlark source
-// contained in the first src_len bytes of src.
+// Executes the starlark source contained in the first src_len bytes of src,
+// with the given name. src must outlive ctx. The module's globals are put in
+// ctx->globals afterwards.
+// Returns 0 on success, a negative STARLARK_ERROR_* code if the interpreter
+// failed, or the code of the first error in the program otherwise. Every
+// error in the program is appended to ctx's errors.
 STARLARK_PUBLIC
 int starlark_exec(struct starlark_Context *ctx, const char *name,
 		  const size_t src_len, const uint8_t *src);
 
-// Initializes a starlark_Context from the file with the given filename.
+// Executes the file with the given filename, as starlark_exec does.
+// Returns STARLARK_ERROR_IO, with errno set, if the file couldn't be read.
 STARLARK_PUBLIC
 int starlark_execfile(struct starlark_Context *ctx, const char *filename);
 
@@ -120,6 +239,21 @@ void starlark_error_dump(FILE *f, const char *filename, const size_t buf_len,
 STARLARK_PUBLIC
 void starlark_errors_dump(struct starlark_Context *ctx, FILE *f);
 
+// Prints how many times each pair of instructions ran one right after the
+// other, in every program executed so far, most frequent first. The pairs are
+// only counted when clark is built with the opcode-pairs option, since
+// counting them slows down every instruction.
+STARLARK_PUBLIC
+void starlark_opcode_pairs_dump(FILE *f);
+
+// Clears everything stored in ctx so that it can be used for another call to
+// starlark_lex or starlark_parse, without freeing the memory backing its
+// strpool, error list, or the lexer, parser, resolver and compiler it reads
+// programs with. A context which is reset between uses stops allocating once
+// it has grown large enough for the biggest source seen.
+STARLARK_PUBLIC
+void starlark_Context_reset(struct starlark_Context *ctx);
+
 STARLARK_PUBLIC
 void starlark_Context_finish(struct starlark_Context *ctx);
 
@@ -86,6 +86,9 @@ struct starlark_Lexer {
 	} toks;
 };
 
+// Splits the first src_len bytes of src into tokens, which are stored in out.
+// out must either be zeroed or have been passed to starlark_Lexer_reset, in
+// which case the memory it already holds is reused.
 STARLARK_PUBLIC
 int starlark_lex(struct starlark_Context *ctx, const char *name,
 		 const size_t src_len, const uint8_t *src,
@@ -97,6 +100,11 @@ void starlark_token_dump(FILE *f, const struct starlark_Token t);
 STARLARK_PUBLIC
 void starlark_tokens_dump(struct starlark_Lexer *ctx, FILE *f);
 
+// Forgets every token in l, keeping the memory they were stored in for the next
+// call to starlark_lex.
+STARLARK_PUBLIC
+void starlark_Lexer_reset(struct starlark_Lexer *l);
+
 STARLARK_PUBLIC
 void starlark_Lexer_finish(struct starlark_Lexer *l);
 
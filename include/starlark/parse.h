@@ -1,5 +1,6 @@
 #ifndef STARLARK_PARSE_H
 #define STARLARK_PARSE_H
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -7,14 +8,147 @@
 #include "starlark/common.h"
 #include "starlark/lex.h"
 
-// All the ast nodes.
+// All the ast nodes. The comment on each says which member of
+// starlark_AstNode it uses.
 enum starlark_AstTag {
 	STARLARK_NODE_ERROR = 0,
+	// as_identifier
 	STARLARK_NODE_IDENTIFIER,
+	// as_int
 	STARLARK_NODE_INT,
+	// as_float
 	STARLARK_NODE_FLOAT,
+	// as_str
 	STARLARK_NODE_STRING,
 	STARLARK_NODE_OPERAND,
+
+	// Expressions
+
+	// as_list
+	STARLARK_NODE_TUPLE,
+	// as_list
+	STARLARK_NODE_LIST,
+	// as_list, each of which is a STARLARK_NODE_DICT_ENTRY.
+	STARLARK_NODE_DICT,
+	// as_binary, with the key in lhs and the value in rhs.
+	STARLARK_NODE_DICT_ENTRY,
+	// as_comp
+	STARLARK_NODE_LIST_COMP,
+	// as_comp, with a STARLARK_NODE_DICT_ENTRY as the body.
+	STARLARK_NODE_DICT_COMP,
+	// as_for, with no body. The clause 'for vars in iterable'.
+	STARLARK_NODE_COMP_FOR,
+	// as_unary. The clause 'if operand'.
+	STARLARK_NODE_COMP_IF,
+	// as_unary
+	STARLARK_NODE_UNARY,
+	// as_binary
+	STARLARK_NODE_BINARY,
+	// as_cond. 'then if cond else otherwise'.
+	STARLARK_NODE_COND,
+	// as_func, with an expression as the body.
+	STARLARK_NODE_LAMBDA,
+	// as_call
+	STARLARK_NODE_CALL,
+	// as_named. The argument 'name=value' in a call.
+	STARLARK_NODE_ARG_NAMED,
+	// as_unary. The argument '*operand' in a call.
+	STARLARK_NODE_ARG_STAR,
+	// as_unary. The argument '**operand' in a call.
+	STARLARK_NODE_ARG_STARSTAR,
+	// as_dot. 'operand.name'.
+	STARLARK_NODE_DOT,
+	// as_binary, with the indexed value in lhs and the index in rhs.
+	STARLARK_NODE_INDEX,
+	// as_slice
+	STARLARK_NODE_SLICE,
+
+	// Statements
+
+	// as_unary
+	STARLARK_NODE_EXPR_STMT,
+	// as_binary, with the op unused.
+	STARLARK_NODE_ASSIGN,
+	// as_binary. 'lhs op= rhs'.
+	STARLARK_NODE_AUG_ASSIGN,
+	// as_binary, with the function's name as a STARLARK_NODE_IDENTIFIER
+	// in lhs and a STARLARK_NODE_FUNCTION in rhs.
+	STARLARK_NODE_DEF,
+	// as_func, with a STARLARK_NODE_BLOCK as the body.
+	STARLARK_NODE_FUNCTION,
+	// as_binary, with a STARLARK_NODE_IDENTIFIER in lhs and the default
+	// value in rhs, or STARLARK_NODE_NONE if there isn't one.
+	STARLARK_NODE_PARAM,
+	// as_unary. '*operand', or just '*' if operand is STARLARK_NODE_NONE.
+	STARLARK_NODE_PARAM_STAR,
+	// as_unary. '**operand'.
+	STARLARK_NODE_PARAM_STARSTAR,
+	// as_cond. otherwise is a STARLARK_NODE_BLOCK, a STARLARK_NODE_IF for
+	// an elif, or STARLARK_NODE_NONE.
+	STARLARK_NODE_IF,
+	// as_for
+	STARLARK_NODE_FOR,
+	// as_unary, where operand may be STARLARK_NODE_NONE.
+	STARLARK_NODE_RETURN,
+	STARLARK_NODE_BREAK,
+	STARLARK_NODE_CONTINUE,
+	STARLARK_NODE_PASS,
+	// as_load
+	STARLARK_NODE_LOAD,
+	// as_binary, with the local name as a STARLARK_NODE_IDENTIFIER in lhs
+	// and the name in the loaded module as a STARLARK_NODE_STRING in rhs.
+	STARLARK_NODE_LOAD_BINDING,
+	// as_list of statements. The whole file is a block.
+	STARLARK_NODE_BLOCK,
+};
+
+// Stands for a missing child, such as the default value of a parameter which
+// doesn't have one.
+#define STARLARK_NODE_NONE UINT32_MAX
+
+// The operators of unary, binary and augmented assignment nodes.
+enum starlark_Op {
+	STARLARK_OP_ADD = 0,
+	STARLARK_OP_SUB,
+	STARLARK_OP_MUL,
+	STARLARK_OP_DIV,
+	STARLARK_OP_FLOORDIV,
+	STARLARK_OP_MOD,
+	STARLARK_OP_BITAND,
+	STARLARK_OP_BITOR,
+	STARLARK_OP_XOR,
+	STARLARK_OP_LSHIFT,
+	STARLARK_OP_RSHIFT,
+	STARLARK_OP_EQ,
+	STARLARK_OP_NOTEQ,
+	STARLARK_OP_LESS,
+	STARLARK_OP_LEQ,
+	STARLARK_OP_GREATER,
+	STARLARK_OP_GEQ,
+	STARLARK_OP_IN,
+	STARLARK_OP_NOT_IN,
+	STARLARK_OP_AND,
+	STARLARK_OP_OR,
+	// The unary operators. + and - are STARLARK_OP_ADD and STARLARK_OP_SUB.
+	STARLARK_OP_NOT,
+	STARLARK_OP_BITNOT,
+};
+
+// Where a name is bound, which is filled in by the resolver.
+enum starlark_Scope {
+	STARLARK_SCOPE_UNRESOLVED = 0,
+	// A slot in the frame of the function using it.
+	STARLARK_SCOPE_LOCAL,
+	// A local which a nested function refers to, so its slot holds a cell
+	// shared with that function.
+	STARLARK_SCOPE_CELL,
+	// A local of an enclosing function, held in one of the function's
+	// free variable cells.
+	STARLARK_SCOPE_FREE,
+	// A slot in the module's table of globals.
+	STARLARK_SCOPE_GLOBAL,
+	// A slot in the fixed table of builtins, such as len or None.
+	STARLARK_SCOPE_BUILTIN,
 };
 
 // A single ast node.
@@ -28,37 +162,136 @@ struct starlark_String {
 	char *ptr;
 };
 
+// Children of a node are stored as node indices. A node with a variable number
+// of children stores them in the parser's extra array instead.
 union starlark_AstNode {
 	struct {
-		// This will eventually be a handle into a strpool.
-		char *str;
+		// A handle into the context's strpool.
+		int64_t name;
+		// The slot the name refers to in its scope.
+		uint32_t index;
+		enum starlark_Scope scope;
 	} as_identifier;
 	struct starlark_String as_str;
 	struct starlark_Int *as_int;
 	double as_float;
+	// len children, starting at extra[start].
+	struct {
+		uint32_t start;
+		uint32_t len;
+	} as_list;
+	struct {
+		enum starlark_Op op;
+		uint32_t operand;
+	} as_unary;
+	struct {
+		enum starlark_Op op;
+		uint32_t lhs;
+		uint32_t rhs;
+	} as_binary;
+	struct {
+		uint32_t cond;
+		uint32_t then;
+		uint32_t otherwise;
+	} as_cond;
+	// vars is a single target, or a STARLARK_NODE_TUPLE of them.
+	struct {
+		uint32_t vars;
+		uint32_t iterable;
+		uint32_t body;
+	} as_for;
+	// The clauses are STARLARK_NODE_COMP_FOR and STARLARK_NODE_COMP_IF
+	// nodes, starting at extra[clauses].
+	struct {
+		uint32_t body;
+		uint32_t clauses;
+		uint32_t clauses_len;
+	} as_comp;
+	// The arguments start at extra[args].
+	struct {
+		uint32_t fn;
+		uint32_t args;
+		uint32_t args_len;
+	} as_call;
+	struct {
+		int64_t name;
+		uint32_t value;
+	} as_named;
+	struct {
+		uint32_t operand;
+		int64_t name;
+	} as_dot;
+	// Missing parts of the slice are STARLARK_NODE_NONE.
+	struct {
+		uint32_t operand;
+		uint32_t lo;
+		uint32_t hi;
+		uint32_t step;
+	} as_slice;
+	// The parameters start at extra[params]. function is the index the
+	// resolver gives the function.
+	struct {
+		uint32_t params;
+		uint32_t params_len;
+		uint32_t body;
+		uint32_t function;
+	} as_func;
+	// The bindings are STARLARK_NODE_LOAD_BINDING nodes, starting at
+	// extra[bindings].
+	struct {
+		uint32_t module;
+		uint32_t bindings;
+		uint32_t bindings_len;
+	} as_load;
 };
 
 struct starlark_Parser {
 	struct starlark_Context *ctx;
 	struct starlark_Lexer *l;
 	size_t idx;
+	// How many brackets the parser is inside of. Newlines inside brackets
+	// are ignored.
+	size_t depth;
+	// Whether an error has been reported in the current statement, which
+	// is skipped over instead of reporting any more.
+	bool recovering;
+
+	// The STARLARK_NODE_BLOCK holding the file's statements.
+	uint32_t root;
 
 	size_t ast_len;
 	size_t ast_cap;
 	struct {
 		enum starlark_AstTag *tags;
 		size_t *idxs;
+		// The position in the source the node starts at, which is where
+		// errors about it are reported.
+		size_t *starts;
 		union starlark_AstNode *nodes;
 	} ast;
+
+	// The children of nodes which have a variable number of them.
+	size_t extra_len;
+	size_t extra_cap;
+	uint32_t *extra;
+
+	// Children which have been parsed, but whose parent hasn't yet, so
+	// their number isn't known.
+	size_t scratch_len;
+	size_t scratch_cap;
+	uint32_t *scratch;
 };
 
-// Parses the tokens from a call to starlark_lex into the parser out.
+// Parses the tokens from a call to starlark_lex into the parser out. out must
+// either be zeroed or have been passed to starlark_Parser_reset, in which case
+// the memory it already holds is reused.
 STARLARK_PUBLIC
 int starlark_parse_tokens(struct starlark_Context *ctx,
 			  struct starlark_Lexer *l,
 			  struct starlark_Parser *out);
 
-// Parses the file given into the parser out.
+// Parses the file given into the parser out, as starlark_parse_tokens does.
+// The tokens are kept in ctx's own lexer, which is reused by the next call.
 STARLARK_PUBLIC
 int starlark_parse(struct starlark_Context *ctx, const char *name,
 		   const size_t src_len, const uint8_t *src,
@@ -71,6 +304,11 @@ void starlark_node_dump(struct starlark_Parser *in,
 STARLARK_PUBLIC
 void starlark_ast_dump(struct starlark_Parser *in, FILE *f);
 
+// Frees the values held by every node in the parser, keeping the memory the
+// nodes were stored in for the next call to starlark_parse_tokens.
+STARLARK_PUBLIC
+void starlark_Parser_reset(struct starlark_Parser *in);
+
 // Disposes of the parser and its associated Lexer.
 STARLARK_PUBLIC
 void starlark_Parser_finish(struct starlark_Parser *in);
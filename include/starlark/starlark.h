@@ -12,14 +12,7 @@ struct starlark_Context starlark_init();
 STARLARK_PUBLIC
 void starlark_finish(struct starlark_Context *ctx);
 
-// Executes src in the starlark context given.
-STARLARK_PUBLIC
-int starlark_exec(struct starlark_Context *ctx, const size_t src_len,
-		  const uint8_t *src);
-
-// Executes the contents of f in the starlark context ctx.
-STARLARK_PUBLIC
-int starlark_execfile(struct starlark_Context *ctx, FILE *f);
+// starlark_exec and starlark_execfile are declared in starlark/common.h.
 
 // Executes src in the starlark context given.
 STARLARK_PUBLIC
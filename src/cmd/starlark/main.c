@@ -1,4 +1,5 @@
 #include "starlark/parse.h"
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
@@ -11,29 +12,21 @@
 #include "starlark/parse.h"
 #include "util/panic.h"
 #include "util/io.h"
+#include "util/loader.h"
 
-// Currently this just dumps the tokens.
+// Runs each file given, or stdin if there are none. With --dump, the tokens,
+// syntax tree and errors of each file are printed instead. With
+// --opcode-pairs, how often each pair of instructions ran in a row is printed
+// to stderr afterwards. --vm=stack or --vm=register picks the form the files
+// are compiled to, see enum starlark_VmKind, and --jit=on, --jit=off or
+// --jit=eager when they're compiled to machine code, see enum
+// starlark_JitMode.
 
-int main(int argc, char **argv)
+static void dump(const char *name, const struct MappedFile src)
 {
-	FILE *f = stdin;
-	if (argc > 1) {
-		f = fopen(argv[1], "rb");
-		if (f == NULL) {
-			panic("error opening '%s': %s", argv[1],
-			      strerror(errno));
-		}
-	}
-
-	uint8_t *buf = readfull(f);
-	size_t len = strlen((char *)buf);
-	if (buf == NULL || len > SIZE_MAX) {
-		exit(EXIT_FAILURE);
-	}
-
 	struct starlark_Context ctx = { 0 };
 	struct starlark_Lexer l = { 0 };
-	int ret = starlark_lex(&ctx, "<stdin>", len, buf, &l);
+	int ret = starlark_lex(&ctx, name, src.len, src.ptr, &l);
 	if (ret != 0) {
 		panic("starlark_lex returned: %d", ret);
 	}
@@ -50,8 +43,119 @@ int main(int argc, char **argv)
 	puts("===ERRORS===");
 	starlark_errors_dump(&ctx, stdout);
 
-	free(buf);
 	starlark_Parser_finish(&p);
 	starlark_Lexer_finish(&l);
 	starlark_Context_finish(&ctx);
 }
+
+// Runs src, printing any errors to stderr. If vm or jit isn't NULL, it's the
+// value of the configuration key of the same name.
+// Returns false if the program failed.
+static bool run(const char *name, const struct MappedFile src, const char *vm,
+		const char *jit)
+{
+	struct starlark_Context ctx = { 0 };
+	if (vm != NULL && starlark_config_set(&ctx, "vm", vm) != 0) {
+		panic("unknown vm '%s', want stack or register", vm);
+	}
+
+	if (jit != NULL && starlark_config_set(&ctx, "jit", jit) != 0) {
+		panic("unknown jit mode '%s', want on, off or eager", jit);
+	}
+
+	const int ret = starlark_exec(&ctx, name, src.len, src.ptr);
+	if (ret < 0) {
+		panic("starlark_exec returned: %d", ret);
+	}
+
+	starlark_errors_dump(&ctx, stderr);
+	starlark_Context_finish(&ctx);
+	return ret == 0;
+}
+
+struct files {
+	char **paths;
+	bool many;
+	bool dump;
+	const char *vm;
+	const char *jit;
+	bool ok;
+};
+
+// Each file is dumped or run as soon as it has been read, while the others
+// are still loading, so files run in the order they finish loading.
+static void file_loaded(void *data, const size_t i, const int err,
+			struct MappedFile file)
+{
+	struct files *files = data;
+	if (err != 0) {
+		panic("error reading '%s': %s", files->paths[i],
+		      strerror(err));
+	}
+
+	if (files->dump) {
+		if (files->many) {
+			printf("=== %s ===\n", files->paths[i]);
+		}
+		dump(files->paths[i], file);
+	} else {
+		files->ok = run(files->paths[i], file, files->vm, files->jit) &&
+			    files->ok;
+	}
+	mapfile_finish(&file);
+}
+
+int main(int argc, char **argv)
+{
+	bool dump_only = false;
+	bool opcode_pairs = false;
+	const char *vm = NULL;
+	const char *jit = NULL;
+	while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+		if (strcmp(argv[1], "--dump") == 0) {
+			dump_only = true;
+		} else if (strcmp(argv[1], "--opcode-pairs") == 0) {
+			opcode_pairs = true;
+		} else if (strncmp(argv[1], "--vm=", 5) == 0) {
+			vm = &argv[1][5];
+		} else if (strncmp(argv[1], "--jit=", 6) == 0) {
+			jit = &argv[1][6];
+		} else {
+			panic("unknown option '%s'", argv[1]);
+		}
+
+		argc -= 1;
+		argv += 1;
+	}
+
+	struct files files = {
+		.paths = &argv[1],
+		.many = argc > 2,
+		.dump = dump_only,
+		.vm = vm,
+		.jit = jit,
+		.ok = true,
+	};
+	if (argc <= 1) {
+		struct MappedFile src = { 0 };
+		if (!mapfile(stdin, &src)) {
+			panic("error reading '<stdin>': %s", strerror(errno));
+		}
+
+		if (dump_only) {
+			dump("<stdin>", src);
+		} else {
+			files.ok = run("<stdin>", src, vm, jit);
+		}
+		mapfile_finish(&src);
+	} else if (!loadfiles(argc - 1, (const char *const *)&argv[1],
+			      file_loaded, &files)) {
+		panic("couldn't start loading files: %s", strerror(errno));
+	}
+
+	if (opcode_pairs) {
+		starlark_opcode_pairs_dump(stderr);
+	}
+
+	return files.ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
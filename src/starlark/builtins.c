@@ -0,0 +1,2362 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "starlark/builtins.h"
+#include "starlark/common.h"
+#include "starlark/dict.h"
+#include "starlark/function.h"
+#include "starlark/int.h"
+#include "starlark/list.h"
+#include "starlark/ops.h"
+#include "starlark/str.h"
+#include "starlark/util.h"
+#include "starlark/value.h"
+#include "starlark/vm.h"
+#include "utf8/utf8.h"
+#include "util/common.h"
+
+const char *const Builtin_names[BUILTIN_COUNT] = {
+	[BUILTIN_NONE] = u8"None",
+	[BUILTIN_TRUE] = u8"True",
+	[BUILTIN_FALSE] = u8"False",
+	[BUILTIN_ABS] = u8"abs",
+	[BUILTIN_ALL] = u8"all",
+	[BUILTIN_ANY] = u8"any",
+	[BUILTIN_BOOL] = u8"bool",
+	[BUILTIN_BYTES] = u8"bytes",
+	[BUILTIN_CHR] = u8"chr",
+	[BUILTIN_DICT] = u8"dict",
+	[BUILTIN_DIR] = u8"dir",
+	[BUILTIN_ENUMERATE] = u8"enumerate",
+	[BUILTIN_FAIL] = u8"fail",
+	[BUILTIN_FLOAT] = u8"float",
+	[BUILTIN_GETATTR] = u8"getattr",
+	[BUILTIN_HASATTR] = u8"hasattr",
+	[BUILTIN_HASH] = u8"hash",
+	[BUILTIN_INT] = u8"int",
+	[BUILTIN_LEN] = u8"len",
+	[BUILTIN_LIST] = u8"list",
+	[BUILTIN_MAX] = u8"max",
+	[BUILTIN_MIN] = u8"min",
+	[BUILTIN_ORD] = u8"ord",
+	[BUILTIN_PRINT] = u8"print",
+	[BUILTIN_RANGE] = u8"range",
+	[BUILTIN_REPR] = u8"repr",
+	[BUILTIN_REVERSED] = u8"reversed",
+	[BUILTIN_SORTED] = u8"sorted",
+	[BUILTIN_STR] = u8"str",
+	[BUILTIN_TUPLE] = u8"tuple",
+	[BUILTIN_TYPE] = u8"type",
+	[BUILTIN_ZIP] = u8"zip",
+};
+
+// The arguments and named arguments of the builtins below are checked with
+// these, which describe what was wrong in vm->detail.
+
+#define BUILTIN_ERROR(vm, code, ...) \
+	((vm)->detail = err_string((vm)->ctx, __VA_ARGS__), (code))
+
+// Refcounts of builtins which live for the whole program start here, so they
+// never drop to 0.
+#define IMMORTAL (UINT32_MAX / 2)
+
+static struct starlark_Str *as_str(const struct starlark_Value v)
+{
+	return (struct starlark_Str *)Value_as_object(v);
+}
+
+// Returns true if the string value v holds exactly the bytes of name.
+static bool str_is(const struct starlark_Value v, const char *name)
+{
+	const size_t len = strlen(name);
+	return Str_len(as_str(v)) == len &&
+	       memcmp(Str_data(as_str(v)), name, len) == 0;
+}
+
+// Checks that a builtin which takes no named arguments was called with between
+// min and max positional ones.
+static int check_args(struct starlark_Vm *vm, const struct starlark_Args *args,
+		      const char *fname, const size_t min, const size_t max)
+{
+	if (args->named_len != 0) {
+		const struct starlark_Str *name = as_str(args->named[0]);
+		return BUILTIN_ERROR(vm, STARLARK_ERRORCODE_UNEXPECTED_KWARG,
+				     "%.*s", (int)Str_len(name),
+				     Str_data(name));
+	}
+
+	if (args->len < min) {
+		return BUILTIN_ERROR(vm, STARLARK_ERRORCODE_ARGS,
+				     "%s: got %zu arguments, want at least %zu",
+				     fname, args->len, min);
+	}
+
+	if (args->len > max) {
+		return BUILTIN_ERROR(vm, STARLARK_ERRORCODE_ARGS,
+				     "%s: got %zu arguments, want at most %zu",
+				     fname, args->len, max);
+	}
+
+	return 0;
+}
+
+// Stores the named arguments of a builtin which takes the n names in names in
+// out, leaving those which weren't passed alone.
+static int named_args(struct starlark_Vm *vm, const struct starlark_Args *args,
+		      const size_t n, const char *const *names,
+		      struct starlark_Value *out)
+{
+	for (size_t i = 0; i < args->named_len; i += 1) {
+		const struct starlark_Value name = args->named[2 * i];
+		size_t j = 0;
+		while (j < n && !str_is(name, names[j])) {
+			j += 1;
+		}
+
+		if (j == n) {
+			return BUILTIN_ERROR(
+				vm, STARLARK_ERRORCODE_UNEXPECTED_KWARG, "%.*s",
+				(int)Str_len(as_str(name)),
+				Str_data(as_str(name)));
+		}
+
+		out[j] = args->named[2 * i + 1];
+	}
+
+	return 0;
+}
+
+static int want_type(struct starlark_Vm *vm, const char *fname,
+		     const struct starlark_Value v, const enum starlark_Type t,
+		     const char *want)
+{
+	if (Value_type(v) == t) {
+		return 0;
+	}
+
+	return BUILTIN_ERROR(vm, STARLARK_ERRORCODE_INVALID_ARG,
+			     "%s: got %s, want %s", fname, Value_type_name(v),
+			     want);
+}
+
+// Stores the int v in *out, which must fit in 64 bits.
+static int want_i64(struct starlark_Vm *vm, const char *fname,
+		    const struct starlark_Value v, int64_t *out)
+{
+	int ret = want_type(vm, fname, v, STARLARK_TYPE_INT, u8"int");
+	if (ret != 0) {
+		return ret;
+	}
+
+	if (!Value_is_small_int(v)) {
+		return BUILTIN_ERROR(vm, STARLARK_ERRORCODE_INVALID_ARG,
+				     "%s: int too large", fname);
+	}
+
+	*out = Value_as_small_int(v);
+	return 0;
+}
+
+// Points *items at the elements of the iterable v. Unless v is a list or
+// tuple, they're collected into a new list stored in *tmp, which the caller
+// releases.
+static int iterable_items(struct starlark_Vm *vm, const char *fname,
+			  const struct starlark_Value v,
+			  struct starlark_Value *tmp,
+			  const struct starlark_Value **items, size_t *len)
+{
+	*tmp = VALUE_NONE;
+	if (Value_items(v, items, len)) {
+		return 0;
+	}
+
+	const int ret = List_from_iterable(v, tmp);
+	if (ret == STARLARK_ERRORCODE_NOT_ITERABLE) {
+		return BUILTIN_ERROR(vm, STARLARK_ERRORCODE_INVALID_ARG,
+				     "%s: got %s, want iterable", fname,
+				     Value_type_name(v));
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	Value_items(*tmp, items, len);
+	return 0;
+}
+
+// Stores a new list or tuple holding the len values in items, which it adds a
+// reference to, in *out.
+static int new_items(const enum starlark_Type t, const size_t len,
+		     const struct starlark_Value *items,
+		     struct starlark_Value *out)
+{
+	struct starlark_Value *dst = NULL;
+	if (t == STARLARK_TYPE_LIST) {
+		struct starlark_List *l = List_create(len);
+		if (l == NULL) {
+			return STARLARK_ERROR_OOM;
+		}
+
+		l->len = len;
+		dst = l->items;
+		*out = Value_object(&l->obj);
+	} else {
+		struct starlark_Tuple *t = Tuple_create(len);
+		if (t == NULL) {
+			return STARLARK_ERROR_OOM;
+		}
+
+		dst = t->items;
+		*out = Value_object(&t->obj);
+	}
+
+	for (size_t i = 0; i < len; i += 1) {
+		dst[i] = items[i];
+		Value_retain(items[i]);
+	}
+
+	return 0;
+}
+
+static int new_str(const size_t len, const char *bytes,
+		   struct starlark_Value *out)
+{
+	*out = Value_str(len, bytes);
+	return Value_is_none(*out) ? STARLARK_ERROR_OOM : 0;
+}
+
+static int builtin_abs(struct starlark_Vm *vm, const struct starlark_Args *args,
+		       struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, u8"abs", 1, 1);
+	if (ret != 0) {
+		return ret;
+	}
+
+	const struct starlark_Value x = args->args[0];
+	if (Value_type(x) == STARLARK_TYPE_FLOAT) {
+		*out = Value_float(fabs(Value_as_float(x)));
+		return Value_is_none(*out) ? STARLARK_ERROR_OOM : 0;
+	}
+
+	ret = want_type(vm, u8"abs", x, STARLARK_TYPE_INT, u8"int or float");
+	if (ret != 0) {
+		return ret;
+	}
+
+	if (Value_int_cmp(x, Value_small_int(0)) < 0) {
+		return Value_int_neg(x, out);
+	}
+
+	Value_retain(x);
+	*out = x;
+	return 0;
+}
+
+// Implements any and all, which stop at the first element whose truth is stop.
+static int any_all(struct starlark_Vm *vm, const struct starlark_Args *args,
+		   const char *fname, const bool stop,
+		   struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, fname, 1, 1);
+	const struct starlark_Value *items = NULL;
+	size_t len = 0;
+	struct starlark_Value tmp = VALUE_NONE;
+	if (ret == 0) {
+		ret = iterable_items(vm, fname, args->args[0], &tmp, &items,
+				     &len);
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	bool result = !stop;
+	for (size_t i = 0; i < len; i += 1) {
+		if (Value_truth(items[i]) == stop) {
+			result = stop;
+			break;
+		}
+	}
+
+	Value_release(tmp);
+	*out = Value_bool(result);
+	return 0;
+}
+
+static int builtin_all(struct starlark_Vm *vm, const struct starlark_Args *args,
+		       struct starlark_Value *out)
+{
+	return any_all(vm, args, u8"all", false, out);
+}
+
+static int builtin_any(struct starlark_Vm *vm, const struct starlark_Args *args,
+		       struct starlark_Value *out)
+{
+	return any_all(vm, args, u8"any", true, out);
+}
+
+static int builtin_bool(struct starlark_Vm *vm,
+			const struct starlark_Args *args,
+			struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, u8"bool", 0, 1);
+	if (ret != 0) {
+		return ret;
+	}
+
+	*out = Value_bool(args->len == 1 && Value_truth(args->args[0]));
+	return 0;
+}
+
+static int builtin_bytes(struct starlark_Vm *vm,
+			 const struct starlark_Args *args,
+			 struct starlark_Value *out)
+{
+	(void)args;
+	(void)out;
+	return BUILTIN_ERROR(vm, STARLARK_ERRORCODE_INVALID_ARG,
+			     "bytes: not supported");
+}
+
+static int builtin_chr(struct starlark_Vm *vm, const struct starlark_Args *args,
+		       struct starlark_Value *out)
+{
+	int64_t i = 0;
+	int ret = check_args(vm, args, u8"chr", 1, 1);
+	if (ret == 0) {
+		ret = want_i64(vm, u8"chr", args->args[0], &i);
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	if (i < 0 || i > 0x10ffff || !utf8_codepoint_valid((uint32_t)i)) {
+		return BUILTIN_ERROR(vm, STARLARK_ERRORCODE_INVALID_ARG,
+				     "chr: %" PRId64
+				     " is not a valid codepoint",
+				     i);
+	}
+
+	uint8_t buf[4] = { 0 };
+	const size_t len = utf8_codepoint_size((uint32_t)i);
+	utf8_codepoint_encode((uint32_t)i, sizeof(buf), buf);
+	return new_str(len, (char *)buf, out);
+}
+
+// Adds the key and value pairs in the iterable pairs to d.
+static int dict_add_pairs(struct starlark_Vm *vm, const char *fname,
+			  struct starlark_Dict *d,
+			  const struct starlark_Value pairs)
+{
+	if (Value_type(pairs) == STARLARK_TYPE_DICT) {
+		size_t pos = 0;
+		struct starlark_Value key = { 0 };
+		struct starlark_Value value = { 0 };
+		while (Dict_next((void *)Value_as_object(pairs), &pos, &key,
+				 &value)) {
+			int ret = Dict_set(d, key, value);
+			if (ret != 0) {
+				return ret;
+			}
+		}
+
+		return 0;
+	}
+
+	const struct starlark_Value *items = NULL;
+	size_t len = 0;
+	struct starlark_Value tmp = VALUE_NONE;
+	int ret = iterable_items(vm, fname, pairs, &tmp, &items, &len);
+	for (size_t i = 0; i < len && ret == 0; i += 1) {
+		const struct starlark_Value *pair = NULL;
+		size_t pair_len = 0;
+		if (!Value_items(items[i], &pair, &pair_len) || pair_len != 2) {
+			ret = BUILTIN_ERROR(vm, STARLARK_ERRORCODE_INVALID_ARG,
+					    "%s: element %zu is not a pair",
+					    fname, i);
+			break;
+		}
+
+		ret = Dict_set(d, pair[0], pair[1]);
+	}
+
+	Value_release(tmp);
+	return ret;
+}
+
+// Adds the named arguments of args to d.
+static int dict_add_named(struct starlark_Dict *d,
+			  const struct starlark_Args *args)
+{
+	for (size_t i = 0; i < args->named_len; i += 1) {
+		int ret = Dict_set(d, args->named[2 * i],
+				   args->named[2 * i + 1]);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+static int builtin_dict(struct starlark_Vm *vm,
+			const struct starlark_Args *args,
+			struct starlark_Value *out)
+{
+	if (args->len > 1) {
+		return BUILTIN_ERROR(vm, STARLARK_ERRORCODE_ARGS,
+				     "dict: got %zu arguments, want at most 1",
+				     args->len);
+	}
+
+	struct starlark_Dict *d = Dict_create();
+	if (d == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	int ret = 0;
+	if (args->len == 1) {
+		ret = dict_add_pairs(vm, u8"dict", d, args->args[0]);
+	}
+
+	if (ret == 0) {
+		ret = dict_add_named(d, args);
+	}
+
+	if (ret != 0) {
+		Dict_destroy(d);
+		return ret;
+	}
+
+	*out = Value_object((struct starlark_Object *)d);
+	return 0;
+}
+
+static const struct starlark_Method *methods_of(const enum starlark_Type t,
+						 size_t *len);
+
+static int builtin_dir(struct starlark_Vm *vm, const struct starlark_Args *args,
+		       struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, u8"dir", 1, 1);
+	if (ret != 0) {
+		return ret;
+	}
+
+	size_t len = 0;
+	const struct starlark_Method *methods =
+		methods_of(Value_type(args->args[0]), &len);
+	struct starlark_List *l = List_create(len);
+	if (l == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	for (size_t i = 0; i < len; i += 1) {
+		ret = new_str(strlen(methods[i].name), methods[i].name,
+			      &l->items[i]);
+		if (ret != 0) {
+			List_destroy(l);
+			return ret;
+		}
+
+		l->len += 1;
+	}
+
+	*out = Value_object(&l->obj);
+	return 0;
+}
+
+static int builtin_enumerate(struct starlark_Vm *vm,
+			     const struct starlark_Args *args,
+			     struct starlark_Value *out)
+{
+	static const char *const names[] = { u8"start" };
+	struct starlark_Value start = Value_small_int(0);
+	int64_t first = 0;
+	int ret = named_args(vm, args, 1, names, &start);
+	if (ret == 0 && args->len != 1) {
+		ret = BUILTIN_ERROR(vm, STARLARK_ERRORCODE_ARGS,
+				    "enumerate: got %zu arguments, want 1",
+				    args->len);
+	}
+
+	if (ret == 0) {
+		ret = want_i64(vm, u8"enumerate", start, &first);
+	}
+
+	const struct starlark_Value *items = NULL;
+	size_t len = 0;
+	struct starlark_Value tmp = VALUE_NONE;
+	if (ret == 0) {
+		ret = iterable_items(vm, u8"enumerate", args->args[0], &tmp,
+				     &items, &len);
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	struct starlark_List *l = List_create(len);
+	for (size_t i = 0; l != NULL && i < len; i += 1) {
+		struct starlark_Tuple *t = Tuple_create(2);
+		if (t == NULL || Value_from_i64(first + (int64_t)i,
+						&t->items[0]) != 0) {
+			Tuple_destroy(t);
+			List_destroy(l);
+			l = NULL;
+			break;
+		}
+
+		t->items[1] = items[i];
+		Value_retain(items[i]);
+		l->items[i] = Value_object(&t->obj);
+		l->len += 1;
+	}
+
+	Value_release(tmp);
+	if (l == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	*out = Value_object(&l->obj);
+	return 0;
+}
+
+// Joins the str() of each of the len values in items with sep between them.
+static int join_values(const size_t len, const struct starlark_Value *items,
+		       const struct starlark_Value sep,
+		       struct starlark_Value *out)
+{
+	struct starlark_Str *result = Str_create(0, "");
+	for (size_t i = 0; result != NULL && i < len; i += 1) {
+		if (i != 0) {
+			result = Str_append(result, as_str(sep));
+		}
+
+		const struct starlark_Value s = Value_to_str(items[i], false);
+		if (result == NULL || Value_is_none(s)) {
+			Value_release(s);
+			Str_destroy(result);
+			return STARLARK_ERROR_OOM;
+		}
+
+		result = Str_append(result, as_str(s));
+		Value_release(s);
+	}
+
+	if (result == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	*out = Value_object((struct starlark_Object *)result);
+	return 0;
+}
+
+static int builtin_fail(struct starlark_Vm *vm,
+			const struct starlark_Args *args,
+			struct starlark_Value *out)
+{
+	(void)out;
+	static const char *const names[] = { u8"sep" };
+	struct starlark_Value sep = VALUE_NONE;
+	int ret = named_args(vm, args, 1, names, &sep);
+	if (ret != 0) {
+		return ret;
+	}
+
+	struct starlark_Value space = VALUE_NONE;
+	if (Value_is_none(sep)) {
+		ret = new_str(1, u8" ", &space);
+		sep = space;
+	} else {
+		ret = want_type(vm, u8"fail", sep, STARLARK_TYPE_STRING,
+				u8"string");
+	}
+
+	struct starlark_Value msg = VALUE_NONE;
+	if (ret == 0) {
+		ret = join_values(args->len, args->args, sep, &msg);
+	}
+
+	Value_release(space);
+	if (ret != 0) {
+		return ret;
+	}
+
+	vm->detail = err_string(vm->ctx, "%.*s", (int)Str_len(as_str(msg)),
+				Str_data(as_str(msg)));
+	Value_release(msg);
+	return STARLARK_ERRORCODE_FAIL;
+}
+
+// Copies the len bytes at s into a new NUL terminated string.
+static char *cstr(const size_t len, const char *s)
+{
+	char *result = malloc(len + 1);
+	if (result != NULL) {
+		memcpy(result, s, len);
+		result[len] = '\0';
+	}
+
+	return result;
+}
+
+static int builtin_float(struct starlark_Vm *vm,
+			 const struct starlark_Args *args,
+			 struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, u8"float", 0, 1);
+	if (ret != 0) {
+		return ret;
+	}
+
+	double f = 0;
+	const struct starlark_Value x =
+		args->len == 0 ? Value_small_int(0) : args->args[0];
+	switch (Value_type(x)) {
+	case STARLARK_TYPE_BOOL:
+		f = Value_truth(x) ? 1 : 0;
+		break;
+	case STARLARK_TYPE_INT:
+	case STARLARK_TYPE_FLOAT:
+		ret = Value_to_double(x, &f);
+		break;
+	case STARLARK_TYPE_STRING: {
+		char *s = cstr(Str_len(as_str(x)), Str_data(as_str(x)));
+		if (s == NULL) {
+			return STARLARK_ERROR_OOM;
+		}
+
+		char *end = NULL;
+		f = strtod(s, &end);
+		if (s[0] == '\0' || *end != '\0') {
+			ret = BUILTIN_ERROR(vm, STARLARK_ERRORCODE_INVALID_ARG,
+					    "float: invalid syntax: %s", s);
+		}
+
+		free(s);
+		break;
+	}
+	default:
+		return want_type(vm, u8"float", x, STARLARK_TYPE_FLOAT,
+				 u8"int, float, bool or string");
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	*out = Value_float(f);
+	return Value_is_none(*out) ? STARLARK_ERROR_OOM : 0;
+}
+
+static int builtin_getattr(struct starlark_Vm *vm,
+			   const struct starlark_Args *args,
+			   struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, u8"getattr", 2, 3);
+	if (ret == 0) {
+		ret = want_type(vm, u8"getattr", args->args[1],
+				STARLARK_TYPE_STRING, u8"string");
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	const struct starlark_Str *name = as_str(args->args[1]);
+	char *s = cstr(Str_len(name), Str_data(name));
+	if (s == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	ret = Builtin_attr(args->args[0], s, out);
+	if (ret == STARLARK_ERRORCODE_NO_ATTR && args->len == 3) {
+		Value_retain(args->args[2]);
+		*out = args->args[2];
+		ret = 0;
+	} else if (ret == STARLARK_ERRORCODE_NO_ATTR) {
+		ret = BUILTIN_ERROR(vm, ret, "%s has no .%s field or method",
+				    Value_type_name(args->args[0]), s);
+	}
+
+	free(s);
+	return ret;
+}
+
+static int builtin_hasattr(struct starlark_Vm *vm,
+			   const struct starlark_Args *args,
+			   struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, u8"hasattr", 2, 2);
+	if (ret == 0) {
+		ret = want_type(vm, u8"hasattr", args->args[1],
+				STARLARK_TYPE_STRING, u8"string");
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	size_t len = 0;
+	const struct starlark_Method *methods =
+		methods_of(Value_type(args->args[0]), &len);
+	bool found = false;
+	for (size_t i = 0; i < len && !found; i += 1) {
+		found = str_is(args->args[1], methods[i].name);
+	}
+
+	*out = Value_bool(found);
+	return 0;
+}
+
+static int builtin_hash(struct starlark_Vm *vm,
+			const struct starlark_Args *args,
+			struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, u8"hash", 1, 1);
+	if (ret != 0) {
+		return ret;
+	}
+
+	uint64_t h = 0;
+	if (!Value_hash(args->args[0], &h)) {
+		return BUILTIN_ERROR(vm, STARLARK_ERRORCODE_INVALID_ARG,
+				     "hash: unhashable type: %s",
+				     Value_type_name(args->args[0]));
+	}
+
+	// Like starlark-go, hashes are 32 bit ints.
+	*out = Value_small_int((int32_t)(uint32_t)h);
+	return 0;
+}
+
+static int digit_value(const char c)
+{
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+
+	if (c >= 'a' && c <= 'z') {
+		return c - 'a' + 10;
+	}
+
+	if (c >= 'A' && c <= 'Z') {
+		return c - 'A' + 10;
+	}
+
+	return 99;
+}
+
+// Parses the string s as an int in the given base, where base 0 means the base
+// is given by the prefix of s, such as 0x.
+static int parse_int(struct starlark_Vm *vm, const struct starlark_Str *s,
+		     int64_t base, struct starlark_Value *out)
+{
+	const char *data = Str_data(s);
+	size_t len = Str_len(s);
+	const bool neg = len > 0 && data[0] == '-';
+	if (len > 0 && (data[0] == '-' || data[0] == '+')) {
+		data += 1;
+		len -= 1;
+	}
+
+	if (len >= 2 && data[0] == '0') {
+		const char c = (char)(data[1] | 0x20);
+		const int64_t prefix = c == 'x' ? 16 :
+				       c == 'o' ? 8 :
+				       c == 'b' ? 2 :
+						  0;
+		if (prefix != 0 && (base == 0 || base == prefix)) {
+			base = prefix;
+			data += 2;
+			len -= 2;
+		}
+	}
+
+	if (base == 0) {
+		base = 10;
+	}
+
+	bool valid = len > 0;
+	for (size_t i = 0; i < len && valid; i += 1) {
+		valid = digit_value(data[i]) < base;
+	}
+
+	if (!valid) {
+		return BUILTIN_ERROR(vm, STARLARK_ERRORCODE_INVALID_ARG,
+				     "int: invalid literal with base %" PRId64
+				     ": %.*s",
+				     base, (int)Str_len(s), Str_data(s));
+	}
+
+	char *digits = malloc(len + 2);
+	if (digits == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	digits[0] = '-';
+	memcpy(digits + 1, data, len);
+	digits[len + 1] = '\0';
+	// The digits were checked above, so this can only run out of memory.
+	struct starlark_Int *i = NULL;
+	const int ret = Int_from_str(neg ? digits : digits + 1, (int)base, &i);
+	free(digits);
+	if (ret != 0) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	*out = Value_from_Int(i);
+	return 0;
+}
+
+static int builtin_int(struct starlark_Vm *vm, const struct starlark_Args *args,
+		       struct starlark_Value *out)
+{
+	static const char *const names[] = { u8"base" };
+	struct starlark_Value base = VALUE_NONE;
+	int ret = named_args(vm, args, 1, names, &base);
+	if (ret == 0 && args->len > 2) {
+		ret = BUILTIN_ERROR(vm, STARLARK_ERRORCODE_ARGS,
+				    "int: got %zu arguments, want at most 2",
+				    args->len);
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	if (args->len == 2) {
+		base = args->args[1];
+	}
+
+	const struct starlark_Value x =
+		args->len == 0 ? Value_small_int(0) : args->args[0];
+	if (!Value_is_none(base)) {
+		int64_t b = 0;
+		ret = want_type(vm, u8"int", x, STARLARK_TYPE_STRING,
+				u8"string");
+		if (ret == 0) {
+			ret = want_i64(vm, u8"int", base, &b);
+		}
+
+		if (ret == 0 && (b == 1 || b < 0 || b > 36)) {
+			ret = BUILTIN_ERROR(vm, STARLARK_ERRORCODE_INVALID_ARG,
+					    "int: base must be 0 or between "
+					    "2 and 36");
+		}
+
+		return ret != 0 ? ret : parse_int(vm, as_str(x), b, out);
+	}
+
+	switch (Value_type(x)) {
+	case STARLARK_TYPE_BOOL:
+		*out = Value_small_int(Value_truth(x) ? 1 : 0);
+		return 0;
+	case STARLARK_TYPE_INT:
+		Value_retain(x);
+		*out = x;
+		return 0;
+	case STARLARK_TYPE_STRING:
+		return parse_int(vm, as_str(x), 10, out);
+	case STARLARK_TYPE_FLOAT: {
+		const double f = trunc(Value_as_float(x));
+		if (!isfinite(f)) {
+			return BUILTIN_ERROR(vm, STARLARK_ERRORCODE_INVALID_ARG,
+					     "int: can't convert %s to int",
+					     isnan(f) ? "nan" : "inf");
+		}
+
+		if (fabs(f) < 0x1p62) {
+			return Value_from_i64((int64_t)f, out);
+		}
+
+		char buf[400] = { 0 };
+		snprintf(buf, sizeof(buf), "%.0f", f);
+		struct starlark_Int *i = NULL;
+		if (Int_from_str(buf, 10, &i) != 0) {
+			return STARLARK_ERROR_OOM;
+		}
+
+		*out = Value_from_Int(i);
+		return 0;
+	}
+	default:
+		return want_type(vm, u8"int", x, STARLARK_TYPE_INT,
+				 u8"int, float, bool or string");
+	}
+}
+
+static int builtin_len(struct starlark_Vm *vm, const struct starlark_Args *args,
+		       struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, u8"len", 1, 1);
+	if (ret != 0) {
+		return ret;
+	}
+
+	size_t len = 0;
+	if (!Value_len(args->args[0], &len)) {
+		return BUILTIN_ERROR(vm, STARLARK_ERRORCODE_INVALID_ARG,
+				     "len: value of type %s has no len",
+				     Value_type_name(args->args[0]));
+	}
+
+	return Value_from_i64((int64_t)len, out);
+}
+
+// Implements list and tuple, which make a new sequence of type t from an
+// iterable.
+static int sequence_of(struct starlark_Vm *vm, const struct starlark_Args *args,
+		       const char *fname, const enum starlark_Type t,
+		       struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, fname, 0, 1);
+	if (ret != 0) {
+		return ret;
+	}
+
+	if (args->len == 0) {
+		return new_items(t, 0, NULL, out);
+	}
+
+	const struct starlark_Value *items = NULL;
+	size_t len = 0;
+	struct starlark_Value tmp = VALUE_NONE;
+	ret = iterable_items(vm, fname, args->args[0], &tmp, &items, &len);
+	if (ret != 0) {
+		return ret;
+	}
+
+	if (Value_type(tmp) == t) {
+		// The list collected from the iterable is already new.
+		*out = tmp;
+		return 0;
+	}
+
+	ret = new_items(t, len, items, out);
+	Value_release(tmp);
+	return ret;
+}
+
+static int builtin_list(struct starlark_Vm *vm,
+			const struct starlark_Args *args,
+			struct starlark_Value *out)
+{
+	return sequence_of(vm, args, u8"list", STARLARK_TYPE_LIST, out);
+}
+
+static int builtin_tuple(struct starlark_Vm *vm,
+			 const struct starlark_Args *args,
+			 struct starlark_Value *out)
+{
+	return sequence_of(vm, args, u8"tuple", STARLARK_TYPE_TUPLE, out);
+}
+
+// Stores the key which x is sorted or compared by in *out, which is x itself
+// unless there's a key function.
+static int sort_key(struct starlark_Vm *vm, const struct starlark_Value key,
+		    const struct starlark_Value x, struct starlark_Value *out)
+{
+	if (Value_is_none(key)) {
+		Value_retain(x);
+		*out = x;
+		return 0;
+	}
+
+	return Vm_call(vm, key, 1, &x, 0, NULL, out);
+}
+
+static int compare(struct starlark_Vm *vm, const char *fname,
+		   const struct starlark_Value a, const struct starlark_Value b,
+		   int *out)
+{
+	int ret = Value_compare(a, b, out);
+	if (ret == STARLARK_ERRORCODE_UNSUPPORTED_BINARY) {
+		return BUILTIN_ERROR(vm, STARLARK_ERRORCODE_INVALID_ARG,
+				     "%s: can't compare %s with %s", fname,
+				     Value_type_name(a), Value_type_name(b));
+	}
+
+	return ret;
+}
+
+// Implements min and max, which keep the first element for which cmp has the
+// sign of want.
+static int min_max(struct starlark_Vm *vm, const struct starlark_Args *args,
+		   const char *fname, const int want,
+		   struct starlark_Value *out)
+{
+	static const char *const names[] = { u8"key" };
+	struct starlark_Value key = VALUE_NONE;
+	int ret = named_args(vm, args, 1, names, &key);
+	if (ret == 0 && args->len == 0) {
+		ret = BUILTIN_ERROR(vm, STARLARK_ERRORCODE_ARGS,
+				    "%s: got 0 arguments, want at least 1",
+				    fname);
+	}
+
+	const struct starlark_Value *items = args->args;
+	size_t len = args->len;
+	struct starlark_Value tmp = VALUE_NONE;
+	if (ret == 0 && args->len == 1) {
+		ret = iterable_items(vm, fname, args->args[0], &tmp, &items,
+				     &len);
+	}
+
+	if (ret == 0 && len == 0) {
+		ret = BUILTIN_ERROR(vm, STARLARK_ERRORCODE_INVALID_ARG,
+				    "%s: argument is an empty sequence", fname);
+	}
+
+	size_t best = 0;
+	struct starlark_Value best_key = VALUE_NONE;
+	if (ret == 0) {
+		ret = sort_key(vm, key, items[0], &best_key);
+	}
+
+	for (size_t i = 1; i < len && ret == 0; i += 1) {
+		struct starlark_Value k = { 0 };
+		ret = sort_key(vm, key, items[i], &k);
+		int cmp = 0;
+		if (ret == 0) {
+			ret = compare(vm, fname, k, best_key, &cmp);
+		}
+
+		if (ret == 0 && (cmp > 0) - (cmp < 0) == want) {
+			best = i;
+			Value_release(best_key);
+			best_key = k;
+		} else if (ret == 0) {
+			Value_release(k);
+		}
+	}
+
+	Value_release(best_key);
+	if (ret == 0) {
+		Value_retain(items[best]);
+		*out = items[best];
+	}
+
+	Value_release(tmp);
+	return ret;
+}
+
+static int builtin_max(struct starlark_Vm *vm, const struct starlark_Args *args,
+		       struct starlark_Value *out)
+{
+	return min_max(vm, args, u8"max", 1, out);
+}
+
+static int builtin_min(struct starlark_Vm *vm, const struct starlark_Args *args,
+		       struct starlark_Value *out)
+{
+	return min_max(vm, args, u8"min", -1, out);
+}
+
+static int builtin_ord(struct starlark_Vm *vm, const struct starlark_Args *args,
+		       struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, u8"ord", 1, 1);
+	if (ret == 0) {
+		ret = want_type(vm, u8"ord", args->args[0],
+				STARLARK_TYPE_STRING, u8"string");
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	const struct starlark_Str *s = as_str(args->args[0]);
+	size_t size = 0;
+	const uint32_t c = utf8_codepoint_decode(
+		Str_len(s), (const uint8_t *)Str_data(s), 0, &size);
+	if (c == UTF8_ERROR || c == UTF8_EOF || size != Str_len(s)) {
+		return BUILTIN_ERROR(vm, STARLARK_ERRORCODE_INVALID_ARG,
+				     "ord: string must be a single codepoint");
+	}
+
+	*out = Value_small_int(c);
+	return 0;
+}
+
+static int builtin_print(struct starlark_Vm *vm,
+			 const struct starlark_Args *args,
+			 struct starlark_Value *out)
+{
+	static const char *const names[] = { u8"sep" };
+	struct starlark_Value sep = VALUE_NONE;
+	int ret = named_args(vm, args, 1, names, &sep);
+	if (ret == 0 && !Value_is_none(sep)) {
+		ret = want_type(vm, u8"print", sep, STARLARK_TYPE_STRING,
+				u8"string");
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	FILE *f = vm->ctx->out != NULL ? vm->ctx->out : stdout;
+	for (size_t i = 0; i < args->len; i += 1) {
+		if (i != 0 && Value_is_none(sep)) {
+			fputc(' ', f);
+		} else if (i != 0) {
+			fwrite(Str_data(as_str(sep)), 1, Str_len(as_str(sep)),
+			       f);
+		}
+
+		Value_dump(args->args[i], f);
+	}
+
+	fputc('\n', f);
+	*out = VALUE_NONE;
+	return 0;
+}
+
+static int builtin_range(struct starlark_Vm *vm,
+			 const struct starlark_Args *args,
+			 struct starlark_Value *out)
+{
+	int64_t parts[3] = { 0, 0, 1 };
+	int ret = check_args(vm, args, u8"range", 1, 3);
+	for (size_t i = 0; i < args->len && ret == 0; i += 1) {
+		// range(stop) is the same as range(0, stop).
+		const size_t part = args->len == 1 ? 1 : i;
+		ret = want_i64(vm, u8"range", args->args[i], &parts[part]);
+	}
+
+	if (ret == 0 && parts[2] == 0) {
+		ret = BUILTIN_ERROR(vm, STARLARK_ERRORCODE_INVALID_ARG,
+				    "range: step argument must not be zero");
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	struct starlark_Range *r = Range_create(parts[0], parts[1], parts[2]);
+	if (r == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	*out = Value_object(&r->obj);
+	return 0;
+}
+
+// Implements str and repr.
+static int to_str(struct starlark_Vm *vm, const struct starlark_Args *args,
+		  const char *fname, const bool repr,
+		  struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, fname, 1, 1);
+	if (ret != 0) {
+		return ret;
+	}
+
+	*out = Value_to_str(args->args[0], repr);
+	return Value_is_none(*out) ? STARLARK_ERROR_OOM : 0;
+}
+
+static int builtin_repr(struct starlark_Vm *vm,
+			const struct starlark_Args *args,
+			struct starlark_Value *out)
+{
+	return to_str(vm, args, u8"repr", true, out);
+}
+
+static int builtin_str(struct starlark_Vm *vm, const struct starlark_Args *args,
+		       struct starlark_Value *out)
+{
+	return to_str(vm, args, u8"str", false, out);
+}
+
+static int builtin_reversed(struct starlark_Vm *vm,
+			    const struct starlark_Args *args,
+			    struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, u8"reversed", 1, 1);
+	const struct starlark_Value *items = NULL;
+	size_t len = 0;
+	struct starlark_Value tmp = VALUE_NONE;
+	if (ret == 0) {
+		ret = iterable_items(vm, u8"reversed", args->args[0], &tmp,
+				     &items, &len);
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	struct starlark_List *l = List_create(len);
+	if (l == NULL) {
+		Value_release(tmp);
+		return STARLARK_ERROR_OOM;
+	}
+
+	for (size_t i = 0; i < len; i += 1) {
+		l->items[i] = items[len - 1 - i];
+		Value_retain(l->items[i]);
+	}
+
+	l->len = len;
+	Value_release(tmp);
+	*out = Value_object(&l->obj);
+	return 0;
+}
+
+// Sorts the len indices in idx by the keys at those indices, keeping elements
+// with equal keys in their original order. The order is reversed if reverse is
+// true. tmp must have room for len indices.
+static int merge_sort(struct starlark_Vm *vm, const struct starlark_Value *keys,
+		      const bool reverse, const size_t len, size_t *idx,
+		      size_t *tmp)
+{
+	if (len < 2) {
+		return 0;
+	}
+
+	const size_t half = len / 2;
+	int ret = merge_sort(vm, keys, reverse, half, idx, tmp);
+	if (ret == 0) {
+		ret = merge_sort(vm, keys, reverse, len - half, idx + half,
+				 tmp);
+	}
+
+	size_t i = 0;
+	size_t j = half;
+	size_t n = 0;
+	while (ret == 0 && i < half && j < len) {
+		int cmp = 0;
+		// Comparing the right element first keeps equal elements in
+		// order when reversing.
+		ret = reverse ? compare(vm, u8"sorted", keys[idx[i]],
+					keys[idx[j]], &cmp) :
+				compare(vm, u8"sorted", keys[idx[j]],
+					keys[idx[i]], &cmp);
+		if (cmp < 0) {
+			tmp[n++] = idx[j++];
+		} else {
+			tmp[n++] = idx[i++];
+		}
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	while (i < half) {
+		tmp[n++] = idx[i++];
+	}
+
+	while (j < len) {
+		tmp[n++] = idx[j++];
+	}
+
+	memcpy(idx, tmp, len * sizeof(idx[0]));
+	return 0;
+}
+
+static int builtin_sorted(struct starlark_Vm *vm,
+			  const struct starlark_Args *args,
+			  struct starlark_Value *out)
+{
+	static const char *const names[] = { u8"key", u8"reverse" };
+	struct starlark_Value named[] = { VALUE_NONE, VALUE_FALSE };
+	int ret = named_args(vm, args, 2, names, named);
+	if (ret == 0 && args->len != 1) {
+		ret = BUILTIN_ERROR(vm, STARLARK_ERRORCODE_ARGS,
+				    "sorted: got %zu arguments, want 1",
+				    args->len);
+	}
+
+	const struct starlark_Value *items = NULL;
+	size_t len = 0;
+	struct starlark_Value tmp = VALUE_NONE;
+	if (ret == 0) {
+		ret = iterable_items(vm, u8"sorted", args->args[0], &tmp,
+				     &items, &len);
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	struct starlark_Value *keys = calloc(MAX(len, 1), sizeof(keys[0]));
+	size_t *idx = calloc(MAX(len, 1), 2 * sizeof(idx[0]));
+	size_t keys_len = 0;
+	ret = keys == NULL || idx == NULL ? STARLARK_ERROR_OOM : 0;
+	for (; keys_len < len && ret == 0; keys_len += 1) {
+		idx[keys_len] = keys_len;
+		ret = sort_key(vm, named[0], items[keys_len], &keys[keys_len]);
+		if (ret != 0) {
+			break;
+		}
+	}
+
+	if (ret == 0) {
+		ret = merge_sort(vm, keys, Value_truth(named[1]), len, idx,
+				 idx + len);
+	}
+
+	struct starlark_List *l = NULL;
+	if (ret == 0) {
+		l = List_create(len);
+		ret = l == NULL ? STARLARK_ERROR_OOM : 0;
+	}
+
+	for (size_t i = 0; ret == 0 && i < len; i += 1) {
+		l->items[i] = items[idx[i]];
+		Value_retain(l->items[i]);
+		l->len += 1;
+	}
+
+	for (size_t i = 0; i < keys_len; i += 1) {
+		Value_release(keys[i]);
+	}
+
+	free(keys);
+	free(idx);
+	Value_release(tmp);
+	if (ret == 0) {
+		*out = Value_object(&l->obj);
+	}
+
+	return ret;
+}
+
+static int builtin_type(struct starlark_Vm *vm,
+			const struct starlark_Args *args,
+			struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, u8"type", 1, 1);
+	if (ret != 0) {
+		return ret;
+	}
+
+	const char *name = Value_type_name(args->args[0]);
+	return new_str(strlen(name), name, out);
+}
+
+static int builtin_zip(struct starlark_Vm *vm, const struct starlark_Args *args,
+		       struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, u8"zip", 0, SIZE_MAX);
+	if (ret != 0) {
+		return ret;
+	}
+
+	const size_t n = args->len;
+	struct starlark_Value *tmps = calloc(MAX(n, 1), sizeof(tmps[0]));
+	const struct starlark_Value **items =
+		calloc(MAX(n, 1), sizeof(items[0]));
+	size_t len = n == 0 ? 0 : SIZE_MAX;
+	size_t done = 0;
+	ret = tmps == NULL || items == NULL ? STARLARK_ERROR_OOM : 0;
+	for (; done < n && ret == 0; done += 1) {
+		size_t l = 0;
+		ret = iterable_items(vm, u8"zip", args->args[done],
+				     &tmps[done], &items[done], &l);
+		len = MIN(len, l);
+	}
+
+	struct starlark_List *result = NULL;
+	if (ret == 0) {
+		result = List_create(len);
+		ret = result == NULL ? STARLARK_ERROR_OOM : 0;
+	}
+
+	for (size_t i = 0; i < len && ret == 0; i += 1) {
+		struct starlark_Tuple *t = Tuple_create(n);
+		if (t == NULL) {
+			ret = STARLARK_ERROR_OOM;
+			break;
+		}
+
+		for (size_t j = 0; j < n; j += 1) {
+			t->items[j] = items[j][i];
+			Value_retain(t->items[j]);
+		}
+
+		result->items[i] = Value_object(&t->obj);
+		result->len += 1;
+	}
+
+	for (size_t i = 0; i < done; i += 1) {
+		Value_release(tmps[i]);
+	}
+
+	free(tmps);
+	free(items);
+	if (ret != 0) {
+		if (result != NULL) {
+			List_destroy(result);
+		}
+
+		return ret;
+	}
+
+	*out = Value_object(&result->obj);
+	return 0;
+}
+
+// The methods of lists.
+
+static struct starlark_List *self_list(const struct starlark_Args *args)
+{
+	return (struct starlark_List *)Value_as_object(args->self);
+}
+
+static int method_list_append(struct starlark_Vm *vm,
+			      const struct starlark_Args *args,
+			      struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, u8"append", 1, 1);
+	if (ret == 0) {
+		ret = List_append(self_list(args), args->args[0]);
+	}
+
+	*out = VALUE_NONE;
+	return ret;
+}
+
+static int method_list_clear(struct starlark_Vm *vm,
+			     const struct starlark_Args *args,
+			     struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, u8"clear", 0, 0);
+	struct starlark_List *l = self_list(args);
+	if (ret == 0 && l->iterators != 0) {
+		ret = STARLARK_ERRORCODE_MUTATED_DURING_ITERATION;
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	// The items are released last, since they might refer to l.
+	const size_t len = l->len;
+	struct starlark_Value *items = l->items;
+	*l = (struct starlark_List){ .obj = l->obj };
+	for (size_t i = 0; i < len; i += 1) {
+		Value_release(items[i]);
+	}
+
+	free(items);
+	*out = VALUE_NONE;
+	return 0;
+}
+
+static int method_list_extend(struct starlark_Vm *vm,
+			      const struct starlark_Args *args,
+			      struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, u8"extend", 1, 1);
+	struct starlark_List *l = self_list(args);
+	const struct starlark_Value *items = NULL;
+	size_t len = 0;
+	struct starlark_Value tmp = VALUE_NONE;
+	if (ret == 0) {
+		ret = iterable_items(vm, u8"extend", args->args[0], &tmp,
+				     &items, &len);
+	}
+
+	if (ret == 0 && l->iterators != 0) {
+		ret = STARLARK_ERRORCODE_MUTATED_DURING_ITERATION;
+	}
+
+	if (ret == 0) {
+		ret = List_reserve(l, len);
+	}
+
+	// The list might be extended with itself, whose items have just been
+	// moved.
+	if (ret == 0 && Value_is_none(tmp)) {
+		Value_items(args->args[0], &items, &(size_t){ 0 });
+	}
+
+	for (size_t i = 0; i < len && ret == 0; i += 1) {
+		ret = List_append(l, items[i]);
+	}
+
+	Value_release(tmp);
+	*out = VALUE_NONE;
+	return ret;
+}
+
+// Stores the position of the first element of l equal to x in *out.
+static int list_find(struct starlark_Vm *vm, const char *fname,
+		     const struct starlark_List *l,
+		     const struct starlark_Value x, size_t *out)
+{
+	for (size_t i = 0; i < l->len; i += 1) {
+		if (Value_equal(l->items[i], x)) {
+			*out = i;
+			return 0;
+		}
+	}
+
+	return BUILTIN_ERROR(vm, STARLARK_ERRORCODE_INVALID_ARG,
+			     "%s: value not in list", fname);
+}
+
+static int method_list_index(struct starlark_Vm *vm,
+			     const struct starlark_Args *args,
+			     struct starlark_Value *out)
+{
+	size_t i = 0;
+	int ret = check_args(vm, args, u8"index", 1, 1);
+	if (ret == 0) {
+		ret = list_find(vm, u8"index", self_list(args), args->args[0],
+				&i);
+	}
+
+	return ret != 0 ? ret : Value_from_i64((int64_t)i, out);
+}
+
+static int method_list_insert(struct starlark_Vm *vm,
+			      const struct starlark_Args *args,
+			      struct starlark_Value *out)
+{
+	struct starlark_List *l = self_list(args);
+	int64_t i = 0;
+	int ret = check_args(vm, args, u8"insert", 2, 2);
+	if (ret == 0) {
+		ret = want_i64(vm, u8"insert", args->args[0], &i);
+	}
+
+	if (ret == 0 && l->iterators != 0) {
+		ret = STARLARK_ERRORCODE_MUTATED_DURING_ITERATION;
+	}
+
+	if (ret == 0) {
+		ret = List_reserve(l, 1);
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	// Like Python, the index is clamped to the list.
+	const int64_t len = (int64_t)l->len;
+	i = i < 0 ? MAX(i + len, 0) : MIN(i, len);
+	memmove(&l->items[i + 1], &l->items[i],
+		(size_t)(len - i) * sizeof(l->items[0]));
+	l->items[i] = args->args[1];
+	Value_retain(args->args[1]);
+	l->len += 1;
+	*out = VALUE_NONE;
+	return 0;
+}
+
+// Removes the element at position i of l, storing it in *out.
+static void list_remove_at(struct starlark_List *l, const size_t i,
+			   struct starlark_Value *out)
+{
+	*out = l->items[i];
+	memmove(&l->items[i], &l->items[i + 1],
+		(l->len - i - 1) * sizeof(l->items[0]));
+	l->len -= 1;
+}
+
+static int method_list_pop(struct starlark_Vm *vm,
+			   const struct starlark_Args *args,
+			   struct starlark_Value *out)
+{
+	struct starlark_List *l = self_list(args);
+	int64_t i = -1;
+	int ret = check_args(vm, args, u8"pop", 0, 1);
+	if (ret == 0 && args->len == 1) {
+		ret = want_i64(vm, u8"pop", args->args[0], &i);
+	}
+
+	if (ret == 0 && l->iterators != 0) {
+		ret = STARLARK_ERRORCODE_MUTATED_DURING_ITERATION;
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	if (i < 0) {
+		i += (int64_t)l->len;
+	}
+
+	if (i < 0 || (uint64_t)i >= l->len) {
+		return BUILTIN_ERROR(vm, STARLARK_ERRORCODE_INDEX_OUT_OF_RANGE,
+				     "pop: index %" PRId64 ", length %zu", i,
+				     l->len);
+	}
+
+	list_remove_at(l, (size_t)i, out);
+	return 0;
+}
+
+static int method_list_remove(struct starlark_Vm *vm,
+			      const struct starlark_Args *args,
+			      struct starlark_Value *out)
+{
+	struct starlark_List *l = self_list(args);
+	size_t i = 0;
+	int ret = check_args(vm, args, u8"remove", 1, 1);
+	if (ret == 0 && l->iterators != 0) {
+		ret = STARLARK_ERRORCODE_MUTATED_DURING_ITERATION;
+	}
+
+	if (ret == 0) {
+		ret = list_find(vm, u8"remove", l, args->args[0], &i);
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	struct starlark_Value removed = { 0 };
+	list_remove_at(l, i, &removed);
+	Value_release(removed);
+	*out = VALUE_NONE;
+	return 0;
+}
+
+// The methods of dicts.
+
+static struct starlark_Dict *self_dict(const struct starlark_Args *args)
+{
+	return (struct starlark_Dict *)Value_as_object(args->self);
+}
+
+static int method_dict_clear(struct starlark_Vm *vm,
+			     const struct starlark_Args *args,
+			     struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, u8"clear", 0, 0);
+	if (ret == 0 && Dict_iterating(self_dict(args))) {
+		ret = STARLARK_ERRORCODE_MUTATED_DURING_ITERATION;
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	Dict_clear(self_dict(args));
+	*out = VALUE_NONE;
+	return 0;
+}
+
+// Implements get, pop and setdefault, which look up a key and fall back to a
+// default value if it isn't there. pop removes the key, and setdefault inserts
+// the default.
+static int dict_lookup(struct starlark_Vm *vm, const struct starlark_Args *args,
+		       const char *fname, struct starlark_Value *out)
+{
+	const bool pop = strcmp(fname, u8"pop") == 0;
+	int ret = check_args(vm, args, fname, 1, 2);
+	struct starlark_Dict *d = self_dict(args);
+	// pop can't be used on a dict being iterated over even if the key
+	// isn't there, like starlark-go.
+	if (ret == 0 && pop && Dict_iterating(d)) {
+		ret = STARLARK_ERRORCODE_MUTATED_DURING_ITERATION;
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	struct starlark_Value value = { 0 };
+	ret = Dict_get(d, args->args[0], &value);
+	if (ret == STARLARK_ERRORCODE_KEY_NOT_FOUND) {
+		if (pop && args->len == 1) {
+			return ret;
+		}
+
+		value = args->len == 2 ? args->args[1] : VALUE_NONE;
+		if (strcmp(fname, u8"setdefault") == 0) {
+			ret = Dict_set(d, args->args[0], value);
+			if (ret != 0) {
+				return ret;
+			}
+		}
+	} else if (ret != 0) {
+		return ret;
+	} else if (pop) {
+		// The value is about to be released by the dict.
+		Value_retain(value);
+		*out = value;
+		return Dict_delete(d, args->args[0]);
+	}
+
+	Value_retain(value);
+	*out = value;
+	return 0;
+}
+
+static int method_dict_get(struct starlark_Vm *vm,
+			   const struct starlark_Args *args,
+			   struct starlark_Value *out)
+{
+	return dict_lookup(vm, args, u8"get", out);
+}
+
+static int method_dict_pop(struct starlark_Vm *vm,
+			   const struct starlark_Args *args,
+			   struct starlark_Value *out)
+{
+	return dict_lookup(vm, args, u8"pop", out);
+}
+
+static int method_dict_setdefault(struct starlark_Vm *vm,
+				  const struct starlark_Args *args,
+				  struct starlark_Value *out)
+{
+	return dict_lookup(vm, args, u8"setdefault", out);
+}
+
+// Implements items, keys and values, which list the entries of a dict. which
+// is 0 for items, 1 for keys and 2 for values.
+static int dict_list(struct starlark_Vm *vm, const struct starlark_Args *args,
+		     const char *fname, const int which,
+		     struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, fname, 0, 0);
+	if (ret != 0) {
+		return ret;
+	}
+
+	const struct starlark_Dict *d = self_dict(args);
+	struct starlark_List *l = List_create(Dict_len(d));
+	if (l == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	size_t pos = 0;
+	struct starlark_Value entry[2] = { { 0 } };
+	while (Dict_next(d, &pos, &entry[0], &entry[1])) {
+		struct starlark_Value v = { 0 };
+		if (which == 0) {
+			ret = new_items(STARLARK_TYPE_TUPLE, 2, entry, &v);
+		} else {
+			v = entry[which - 1];
+			Value_retain(v);
+		}
+
+		if (ret != 0) {
+			List_destroy(l);
+			return ret;
+		}
+
+		l->items[l->len] = v;
+		l->len += 1;
+	}
+
+	*out = Value_object(&l->obj);
+	return 0;
+}
+
+static int method_dict_items(struct starlark_Vm *vm,
+			     const struct starlark_Args *args,
+			     struct starlark_Value *out)
+{
+	return dict_list(vm, args, u8"items", 0, out);
+}
+
+static int method_dict_keys(struct starlark_Vm *vm,
+			    const struct starlark_Args *args,
+			    struct starlark_Value *out)
+{
+	return dict_list(vm, args, u8"keys", 1, out);
+}
+
+static int method_dict_values(struct starlark_Vm *vm,
+			      const struct starlark_Args *args,
+			      struct starlark_Value *out)
+{
+	return dict_list(vm, args, u8"values", 2, out);
+}
+
+static int method_dict_update(struct starlark_Vm *vm,
+			      const struct starlark_Args *args,
+			      struct starlark_Value *out)
+{
+	if (args->len > 1) {
+		return BUILTIN_ERROR(vm, STARLARK_ERRORCODE_ARGS,
+				     "update: got %zu arguments, want at "
+				     "most 1",
+				     args->len);
+	}
+
+	int ret = 0;
+	if (args->len == 1) {
+		ret = dict_add_pairs(vm, u8"update", self_dict(args),
+				     args->args[0]);
+	}
+
+	if (ret == 0) {
+		ret = dict_add_named(self_dict(args), args);
+	}
+
+	*out = VALUE_NONE;
+	return ret;
+}
+
+// The methods of strings.
+
+static struct starlark_Str *self_str(const struct starlark_Args *args)
+{
+	return as_str(args->self);
+}
+
+// Implements lower and upper, which map every ASCII letter between from and
+// from + 25 to the other case.
+static int str_case(struct starlark_Vm *vm, const struct starlark_Args *args,
+		    const char *fname, const char from,
+		    struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, fname, 0, 0);
+	if (ret != 0) {
+		return ret;
+	}
+
+	const struct starlark_Str *s = self_str(args);
+	char *bytes = cstr(Str_len(s), Str_data(s));
+	if (bytes == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	for (size_t i = 0; i < Str_len(s); i += 1) {
+		if (bytes[i] >= from && bytes[i] <= from + 25) {
+			bytes[i] ^= 0x20;
+		}
+	}
+
+	ret = new_str(Str_len(s), bytes, out);
+	free(bytes);
+	return ret;
+}
+
+static int method_str_lower(struct starlark_Vm *vm,
+			    const struct starlark_Args *args,
+			    struct starlark_Value *out)
+{
+	return str_case(vm, args, u8"lower", 'A', out);
+}
+
+static int method_str_upper(struct starlark_Vm *vm,
+			    const struct starlark_Args *args,
+			    struct starlark_Value *out)
+{
+	return str_case(vm, args, u8"upper", 'a', out);
+}
+
+// Returns the position of the first sub in s at or after start, or SIZE_MAX if
+// there isn't one.
+static size_t str_find(const struct starlark_Str *s, const size_t start,
+		       const struct starlark_Str *sub)
+{
+	const size_t len = Str_len(s);
+	const size_t sub_len = Str_len(sub);
+	for (size_t i = start; sub_len <= len && i <= len - sub_len; i += 1) {
+		if (memcmp(Str_data(s) + i, Str_data(sub), sub_len) == 0) {
+			return i;
+		}
+	}
+
+	return SIZE_MAX;
+}
+
+// Implements startswith and endswith, whose argument is a string or a tuple of
+// them.
+static int str_affix(struct starlark_Vm *vm, const struct starlark_Args *args,
+		     const char *fname, const bool end,
+		     struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, fname, 1, 1);
+	if (ret != 0) {
+		return ret;
+	}
+
+	const struct starlark_Value *affixes = args->args;
+	size_t len = 1;
+	if (Value_type(args->args[0]) == STARLARK_TYPE_TUPLE) {
+		Value_items(args->args[0], &affixes, &len);
+	}
+
+	const struct starlark_Str *s = self_str(args);
+	bool found = false;
+	for (size_t i = 0; i < len && !found; i += 1) {
+		ret = want_type(vm, fname, affixes[i], STARLARK_TYPE_STRING,
+				u8"string or tuple of strings");
+		if (ret != 0) {
+			return ret;
+		}
+
+		const struct starlark_Str *a = as_str(affixes[i]);
+		const size_t start = end ? Str_len(s) - Str_len(a) : 0;
+		found = Str_len(a) <= Str_len(s) &&
+			memcmp(Str_data(s) + start, Str_data(a),
+			       Str_len(a)) == 0;
+	}
+
+	*out = Value_bool(found);
+	return 0;
+}
+
+static int method_str_endswith(struct starlark_Vm *vm,
+			       const struct starlark_Args *args,
+			       struct starlark_Value *out)
+{
+	return str_affix(vm, args, u8"endswith", true, out);
+}
+
+static int method_str_startswith(struct starlark_Vm *vm,
+				 const struct starlark_Args *args,
+				 struct starlark_Value *out)
+{
+	return str_affix(vm, args, u8"startswith", false, out);
+}
+
+// Implements count and find, which both look for a substring.
+static int str_search(struct starlark_Vm *vm, const struct starlark_Args *args,
+		      const char *fname, const bool count,
+		      struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, fname, 1, 1);
+	if (ret == 0) {
+		ret = want_type(vm, fname, args->args[0], STARLARK_TYPE_STRING,
+				u8"string");
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	const struct starlark_Str *s = self_str(args);
+	const struct starlark_Str *sub = as_str(args->args[0]);
+	size_t i = str_find(s, 0, sub);
+	if (!count) {
+		return Value_from_i64(i == SIZE_MAX ? -1 : (int64_t)i, out);
+	}
+
+	int64_t n = 0;
+	for (; i != SIZE_MAX; n += 1) {
+		i = str_find(s, i + MAX(Str_len(sub), 1), sub);
+	}
+
+	return Value_from_i64(n, out);
+}
+
+static int method_str_count(struct starlark_Vm *vm,
+			    const struct starlark_Args *args,
+			    struct starlark_Value *out)
+{
+	return str_search(vm, args, u8"count", true, out);
+}
+
+static int method_str_find(struct starlark_Vm *vm,
+			   const struct starlark_Args *args,
+			   struct starlark_Value *out)
+{
+	return str_search(vm, args, u8"find", false, out);
+}
+
+static int method_str_join(struct starlark_Vm *vm,
+			   const struct starlark_Args *args,
+			   struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, u8"join", 1, 1);
+	const struct starlark_Value *items = NULL;
+	size_t len = 0;
+	struct starlark_Value tmp = VALUE_NONE;
+	if (ret == 0) {
+		ret = iterable_items(vm, u8"join", args->args[0], &tmp, &items,
+				     &len);
+	}
+
+	for (size_t i = 0; i < len && ret == 0; i += 1) {
+		ret = want_type(vm, u8"join", items[i], STARLARK_TYPE_STRING,
+				u8"string");
+	}
+
+	const struct starlark_Str **parts = NULL;
+	if (ret == 0) {
+		parts = calloc(MAX(len, 1), sizeof(parts[0]));
+		ret = parts == NULL ? STARLARK_ERROR_OOM : 0;
+	}
+
+	for (size_t i = 0; i < len && ret == 0; i += 1) {
+		parts[i] = as_str(items[i]);
+	}
+
+	if (ret == 0) {
+		struct starlark_Str *s = Str_join(self_str(args), len,
+						  (const struct starlark_Str *
+							   const *)parts);
+		ret = s == NULL ? STARLARK_ERROR_OOM : 0;
+		if (s != NULL) {
+			*out = Value_object((struct starlark_Object *)s);
+		}
+	}
+
+	free(parts);
+	Value_release(tmp);
+	return ret;
+}
+
+static int method_str_replace(struct starlark_Vm *vm,
+			      const struct starlark_Args *args,
+			      struct starlark_Value *out)
+{
+	int64_t count = -1;
+	int ret = check_args(vm, args, u8"replace", 2, 3);
+	for (size_t i = 0; i < 2 && ret == 0; i += 1) {
+		ret = want_type(vm, u8"replace", args->args[i],
+				STARLARK_TYPE_STRING, u8"string");
+	}
+
+	if (ret == 0 && args->len == 3) {
+		ret = want_i64(vm, u8"replace", args->args[2], &count);
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	struct starlark_Str *s = self_str(args);
+	const struct starlark_Str *old = as_str(args->args[0]);
+	struct starlark_Str *result = Str_create(0, "");
+	size_t start = 0;
+	for (int64_t n = 0; result != NULL && (count < 0 || n < count);
+	     n += 1) {
+		// An empty string matches between every byte.
+		const size_t from = start + (n > 0 && Str_len(old) == 0);
+		const size_t i = from > Str_len(s) ? SIZE_MAX :
+						     str_find(s, from, old);
+		if (i == SIZE_MAX) {
+			break;
+		}
+
+		struct starlark_Str *before = Str_slice(s, start, i - start);
+		if (before == NULL) {
+			Str_destroy(result);
+			return STARLARK_ERROR_OOM;
+		}
+
+		result = Str_append(result, before);
+		Value_release(Value_object((struct starlark_Object *)before));
+		if (result != NULL) {
+			result = Str_append(result, as_str(args->args[1]));
+		}
+
+		start = i + Str_len(old);
+	}
+
+	struct starlark_Str *rest =
+		Str_slice(s, MIN(start, Str_len(s)),
+			  Str_len(s) - MIN(start, Str_len(s)));
+	if (result != NULL && rest != NULL) {
+		result = Str_append(result, rest);
+	} else {
+		Str_destroy(result);
+		result = NULL;
+	}
+
+	if (rest != NULL) {
+		Value_release(Value_object((struct starlark_Object *)rest));
+	}
+
+	if (result == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	*out = Value_object((struct starlark_Object *)result);
+	return 0;
+}
+
+static bool is_space(const char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+	       c == '\f';
+}
+
+// Implements split. Without a separator, runs of whitespace separate the parts
+// and whitespace at either end is dropped.
+static int method_str_split(struct starlark_Vm *vm,
+			    const struct starlark_Args *args,
+			    struct starlark_Value *out)
+{
+	int64_t max = -1;
+	struct starlark_Value sep = VALUE_NONE;
+	int ret = check_args(vm, args, u8"split", 0, 2);
+	if (ret == 0 && args->len > 0) {
+		sep = args->args[0];
+	}
+
+	if (ret == 0 && !Value_is_none(sep)) {
+		ret = want_type(vm, u8"split", sep, STARLARK_TYPE_STRING,
+				u8"string");
+	}
+
+	if (ret == 0 && !Value_is_none(sep) && Str_len(as_str(sep)) == 0) {
+		ret = BUILTIN_ERROR(vm, STARLARK_ERRORCODE_INVALID_ARG,
+				    "split: empty separator");
+	}
+
+	if (ret == 0 && args->len == 2) {
+		ret = want_i64(vm, u8"split", args->args[1], &max);
+	}
+
+	struct starlark_List *l = NULL;
+	if (ret == 0) {
+		l = List_create(0);
+		ret = l == NULL ? STARLARK_ERROR_OOM : 0;
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	struct starlark_Str *s = self_str(args);
+	const char *data = Str_data(s);
+	const size_t len = Str_len(s);
+	size_t i = 0;
+	while (ret == 0) {
+		size_t start = i;
+		size_t end = len;
+		size_t next = len + 1;
+		if (Value_is_none(sep)) {
+			while (start < len && is_space(data[start])) {
+				start += 1;
+			}
+
+			if (start == len) {
+				break;
+			}
+
+			end = start;
+			while (max != 0 && end < len && !is_space(data[end])) {
+				end += 1;
+			}
+
+			next = end;
+		} else if (max != 0) {
+			const size_t found = str_find(s, start, as_str(sep));
+			if (found != SIZE_MAX) {
+				end = found;
+				next = found + Str_len(as_str(sep));
+			}
+		}
+
+		struct starlark_Str *part = Str_slice(s, start, end - start);
+		if (part == NULL) {
+			ret = STARLARK_ERROR_OOM;
+			break;
+		}
+
+		const struct starlark_Value v =
+			Value_object((struct starlark_Object *)part);
+		ret = List_append(l, v);
+		Value_release(v);
+		if (next > len) {
+			break;
+		}
+
+		i = next;
+		max -= max > 0;
+	}
+
+	if (ret != 0) {
+		List_destroy(l);
+		return ret;
+	}
+
+	*out = Value_object(&l->obj);
+	return 0;
+}
+
+static int method_str_strip(struct starlark_Vm *vm,
+			    const struct starlark_Args *args,
+			    struct starlark_Value *out)
+{
+	int ret = check_args(vm, args, u8"strip", 0, 0);
+	if (ret != 0) {
+		return ret;
+	}
+
+	struct starlark_Str *s = self_str(args);
+	size_t start = 0;
+	size_t end = Str_len(s);
+	while (start < end && is_space(Str_data(s)[start])) {
+		start += 1;
+	}
+
+	while (end > start && is_space(Str_data(s)[end - 1])) {
+		end -= 1;
+	}
+
+	struct starlark_Str *result = Str_slice(s, start, end - start);
+	if (result == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	*out = Value_object((struct starlark_Object *)result);
+	return 0;
+}
+
+// The methods of each type, sorted by name, so dir() lists them in order.
+
+static const struct starlark_Method list_methods[] = {
+	{ u8"append", method_list_append }, { u8"clear", method_list_clear },
+	{ u8"extend", method_list_extend }, { u8"index", method_list_index },
+	{ u8"insert", method_list_insert }, { u8"pop", method_list_pop },
+	{ u8"remove", method_list_remove },
+};
+
+static const struct starlark_Method dict_methods[] = {
+	{ u8"clear", method_dict_clear },
+	{ u8"get", method_dict_get },
+	{ u8"items", method_dict_items },
+	{ u8"keys", method_dict_keys },
+	{ u8"pop", method_dict_pop },
+	{ u8"setdefault", method_dict_setdefault },
+	{ u8"update", method_dict_update },
+	{ u8"values", method_dict_values },
+};
+
+static const struct starlark_Method str_methods[] = {
+	{ u8"count", method_str_count },
+	{ u8"endswith", method_str_endswith },
+	{ u8"find", method_str_find },
+	{ u8"join", method_str_join },
+	{ u8"lower", method_str_lower },
+	{ u8"replace", method_str_replace },
+	{ u8"split", method_str_split },
+	{ u8"startswith", method_str_startswith },
+	{ u8"strip", method_str_strip },
+	{ u8"upper", method_str_upper },
+};
+
+#define LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+static const struct starlark_Method *methods_of(const enum starlark_Type t,
+						 size_t *len)
+{
+	switch (t) {
+	case STARLARK_TYPE_LIST:
+		*len = LEN(list_methods);
+		return list_methods;
+	case STARLARK_TYPE_DICT:
+		*len = LEN(dict_methods);
+		return dict_methods;
+	case STARLARK_TYPE_STRING:
+		*len = LEN(str_methods);
+		return str_methods;
+	default:
+		*len = 0;
+		return NULL;
+	}
+}
+
+const struct starlark_Method *Builtin_method(const enum starlark_Type t,
+					     const char *name)
+{
+	size_t len = 0;
+	const struct starlark_Method *methods = methods_of(t, &len);
+	for (size_t i = 0; i < len; i += 1) {
+		if (strcmp(methods[i].name, name) == 0) {
+			return &methods[i];
+		}
+	}
+
+	return NULL;
+}
+
+int Builtin_bind(const struct starlark_Method *m, const struct starlark_Value x,
+		 struct starlark_Value *out)
+{
+	assert(m != NULL);
+
+	struct starlark_Builtin *b = Builtin_create(m->name, m->fn, x);
+	if (b == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	*out = Value_object(&b->obj);
+	return 0;
+}
+
+int Builtin_attr(const struct starlark_Value x, const char *name,
+		 struct starlark_Value *out)
+{
+	const struct starlark_Method *m = Builtin_method(Value_type(x), name);
+	if (m == NULL) {
+		return STARLARK_ERRORCODE_NO_ATTR;
+	}
+
+	return Builtin_bind(m, x, out);
+}
+
+#define BUILTIN(b, n, f)                                            \
+	[b] = {                                                     \
+		.obj = { .type = STARLARK_TYPE_BUILTIN,             \
+			 .refs = IMMORTAL },                        \
+		.name = n,                                          \
+		.fn = f,                                            \
+		.self = { (0 << VALUE_TAG_BITS) | VALUE_TAG_SPECIAL }, \
+	}
+
+// None, True and False are values rather than functions, so they're left out.
+static struct starlark_Builtin builtins[BUILTIN_COUNT] = {
+	BUILTIN(BUILTIN_ABS, u8"abs", builtin_abs),
+	BUILTIN(BUILTIN_ALL, u8"all", builtin_all),
+	BUILTIN(BUILTIN_ANY, u8"any", builtin_any),
+	BUILTIN(BUILTIN_BOOL, u8"bool", builtin_bool),
+	BUILTIN(BUILTIN_BYTES, u8"bytes", builtin_bytes),
+	BUILTIN(BUILTIN_CHR, u8"chr", builtin_chr),
+	BUILTIN(BUILTIN_DICT, u8"dict", builtin_dict),
+	BUILTIN(BUILTIN_DIR, u8"dir", builtin_dir),
+	BUILTIN(BUILTIN_ENUMERATE, u8"enumerate", builtin_enumerate),
+	BUILTIN(BUILTIN_FAIL, u8"fail", builtin_fail),
+	BUILTIN(BUILTIN_FLOAT, u8"float", builtin_float),
+	BUILTIN(BUILTIN_GETATTR, u8"getattr", builtin_getattr),
+	BUILTIN(BUILTIN_HASATTR, u8"hasattr", builtin_hasattr),
+	BUILTIN(BUILTIN_HASH, u8"hash", builtin_hash),
+	BUILTIN(BUILTIN_INT, u8"int", builtin_int),
+	BUILTIN(BUILTIN_LEN, u8"len", builtin_len),
+	BUILTIN(BUILTIN_LIST, u8"list", builtin_list),
+	BUILTIN(BUILTIN_MAX, u8"max", builtin_max),
+	BUILTIN(BUILTIN_MIN, u8"min", builtin_min),
+	BUILTIN(BUILTIN_ORD, u8"ord", builtin_ord),
+	BUILTIN(BUILTIN_PRINT, u8"print", builtin_print),
+	BUILTIN(BUILTIN_RANGE, u8"range", builtin_range),
+	BUILTIN(BUILTIN_REPR, u8"repr", builtin_repr),
+	BUILTIN(BUILTIN_REVERSED, u8"reversed", builtin_reversed),
+	BUILTIN(BUILTIN_SORTED, u8"sorted", builtin_sorted),
+	BUILTIN(BUILTIN_STR, u8"str", builtin_str),
+	BUILTIN(BUILTIN_TUPLE, u8"tuple", builtin_tuple),
+	BUILTIN(BUILTIN_TYPE, u8"type", builtin_type),
+	BUILTIN(BUILTIN_ZIP, u8"zip", builtin_zip),
+};
+
+struct starlark_Value Builtin_value(const enum Builtin b)
+{
+	assert(b < BUILTIN_COUNT);
+
+	switch (b) {
+	case BUILTIN_NONE:
+		return VALUE_NONE;
+	case BUILTIN_TRUE:
+		return VALUE_TRUE;
+	case BUILTIN_FALSE:
+		return VALUE_FALSE;
+	default:
+		return Value_object(&builtins[b].obj);
+	}
+}
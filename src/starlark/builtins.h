@@ -0,0 +1,78 @@
+#ifndef STARLARK_BUILTINS_H
+#define STARLARK_BUILTINS_H
+
+#include "starlark/function.h"
+#include "starlark/value.h"
+
+// The names predeclared in every module. The resolver binds each of them to
+// its slot in this fixed table, so that they're found by index at runtime
+// instead of by name.
+enum Builtin {
+	BUILTIN_NONE = 0,
+	BUILTIN_TRUE,
+	BUILTIN_FALSE,
+	BUILTIN_ABS,
+	BUILTIN_ALL,
+	BUILTIN_ANY,
+	BUILTIN_BOOL,
+	BUILTIN_BYTES,
+	BUILTIN_CHR,
+	BUILTIN_DICT,
+	BUILTIN_DIR,
+	BUILTIN_ENUMERATE,
+	BUILTIN_FAIL,
+	BUILTIN_FLOAT,
+	BUILTIN_GETATTR,
+	BUILTIN_HASATTR,
+	BUILTIN_HASH,
+	BUILTIN_INT,
+	BUILTIN_LEN,
+	BUILTIN_LIST,
+	BUILTIN_MAX,
+	BUILTIN_MIN,
+	BUILTIN_ORD,
+	BUILTIN_PRINT,
+	BUILTIN_RANGE,
+	BUILTIN_REPR,
+	BUILTIN_REVERSED,
+	BUILTIN_SORTED,
+	BUILTIN_STR,
+	BUILTIN_TUPLE,
+	BUILTIN_TYPE,
+	BUILTIN_ZIP,
+
+	BUILTIN_COUNT,
+};
+
+// The name each builtin is bound to.
+extern const char *const Builtin_names[BUILTIN_COUNT];
+
+// Returns the value of the builtin b. Builtins are never freed, so the value
+// doesn't need to be released.
+struct starlark_Value Builtin_value(const enum Builtin b);
+
+// A method of one of the builtin types, such as list.append.
+struct starlark_Method {
+	const char *name;
+	starlark_BuiltinFn fn;
+};
+
+// Returns the method called name of values of type t, or NULL if they don't
+// have one. Methods are never freed, so the result can be kept around, such as
+// in an OP_ATTR's inline cache.
+const struct starlark_Method *Builtin_method(const enum starlark_Type t,
+					     const char *name);
+
+// Stores the method m bound to x in *out.
+// Returns 0 on success, or STARLARK_ERROR_OOM if we couldn't allocate enough
+// memory.
+int Builtin_bind(const struct starlark_Method *m, const struct starlark_Value x,
+		 struct starlark_Value *out);
+
+// Looks up the method called name of x, storing it in *out, bound to x.
+// Returns 0 on success, STARLARK_ERROR_OOM if we couldn't allocate enough
+// memory, or STARLARK_ERRORCODE_NO_ATTR if x doesn't have the method.
+int Builtin_attr(const struct starlark_Value x, const char *name,
+		 struct starlark_Value *out);
+
+#endif // STARLARK_BUILTINS_H
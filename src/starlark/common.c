@@ -6,11 +6,16 @@
 #include <string.h>
 
 #include "starlark/common.h"
+#include "starlark/dict.h"
+#include "starlark/function.h"
 #include "starlark/parse.h"
 #include "starlark/int.h"
+#include "starlark/scratch.h"
 #include "starlark/strpool.h"
+#include "util/common.h"
 #include "util/panic.h"
 #include "util/lineno.h"
+#include "utf8/utf8.h"
 
 // TODO: i18n
 // These are the 'reason' part of an error message. For example, given the
@@ -60,8 +65,192 @@ static const char *ErrorCode_strs[] = {
 	[STARLARK_ERRORCODE_INT_INVALID] = "invalid int:",
 	[STARLARK_ERRORCODE_FLOAT_TOO_BIG] = "float too big for 64 bits:",
 	[STARLARK_ERRORCODE_INVALID_ESCAPE] = "invalid escape:",
+	[STARLARK_ERRORCODE_INVALID_UNICODE_ESCAPE] =
+		("invalid escape: unicode escape must be in the form \\uXXXX "
+		 "or \\UXXXXXXXX, where the Xs are a valid Unicode codepoint"),
+	[STARLARK_ERRORCODE_DIVISION_BY_ZERO] = "integer division by zero",
+	[STARLARK_ERRORCODE_NEGATIVE_SHIFT] = "negative shift count",
+	[STARLARK_ERRORCODE_SHIFT_TOO_BIG] = "shift count too large",
+	[STARLARK_ERRORCODE_UNHASHABLE] = "unhashable type",
+	[STARLARK_ERRORCODE_KEY_NOT_FOUND] = "key not found",
+	[STARLARK_ERRORCODE_UNEXPECTED_TOKEN] = "unexpected token:",
+	[STARLARK_ERRORCODE_UNEXPECTED_NEWLINE] = "unexpected newline",
+	[STARLARK_ERRORCODE_UNEXPECTED_EOF] = "unexpected end of file",
+	[STARLARK_ERRORCODE_EXPECTED_INDENT] = "expected an indented block",
+	[STARLARK_ERRORCODE_UNEXPECTED_INDENT] = "unexpected indentation",
+	[STARLARK_ERRORCODE_INCONSISTENT_DEDENT] =
+		"unindent does not match any outer indentation level",
+	[STARLARK_ERRORCODE_INVALID_TARGET] =
+		"expression cannot be assigned to",
+	[STARLARK_ERRORCODE_CHAINED_COMPARISON] =
+		"comparison operators cannot be chained:",
+	[STARLARK_ERRORCODE_ARG_ORDER] =
+		"arguments must be positional, then named, then *args, "
+		"then **kwargs",
+	[STARLARK_ERRORCODE_PARAM_ORDER] =
+		"parameters must be required, then optional, then *args, "
+		"then **kwargs",
+	[STARLARK_ERRORCODE_DUPLICATE_PARAM] = "duplicate parameter:",
+	[STARLARK_ERRORCODE_UNDEFINED_NAME] = "undefined:",
+	[STARLARK_ERRORCODE_OUTSIDE_LOOP] = "not within a loop:",
+	[STARLARK_ERRORCODE_RETURN_OUTSIDE_FUNCTION] =
+		"return statement not within a function",
+	[STARLARK_ERRORCODE_LOAD_NOT_AT_TOP] =
+		"load statement not at top level",
+	[STARLARK_ERRORCODE_TOO_MANY_ARGS] =
+		"too many positional or named arguments in call",
+	[STARLARK_ERRORCODE_UNSUPPORTED_BINARY] =
+		"unsupported binary operation:",
+	[STARLARK_ERRORCODE_UNSUPPORTED_UNARY] = "unsupported unary operation:",
+	[STARLARK_ERRORCODE_FLOAT_DIVISION_BY_ZERO] =
+		"floating-point division by zero",
+	[STARLARK_ERRORCODE_UNBOUND_GLOBAL] = "global variable",
+	[STARLARK_ERRORCODE_UNBOUND_LOCAL] = "local variable",
+	[STARLARK_ERRORCODE_NOT_CALLABLE] = "value is not callable:",
+	[STARLARK_ERRORCODE_NOT_ITERABLE] = "value is not iterable:",
+	[STARLARK_ERRORCODE_NOT_INDEXABLE] = "value can't be indexed:",
+	[STARLARK_ERRORCODE_INDEX_OUT_OF_RANGE] = "index out of range:",
+	[STARLARK_ERRORCODE_NO_ATTR] = "no such attribute:",
+	[STARLARK_ERRORCODE_UNPACK_COUNT] = "wrong number of values to unpack:",
+	[STARLARK_ERRORCODE_ARGS] = "wrong number of arguments:",
+	[STARLARK_ERRORCODE_UNEXPECTED_KWARG] = "unexpected keyword argument:",
+	[STARLARK_ERRORCODE_DUPLICATE_KWARG] =
+		"got multiple values for parameter:",
+	[STARLARK_ERRORCODE_MISSING_ARG] = "missing argument for parameter:",
+	[STARLARK_ERRORCODE_INVALID_ARG] = "invalid argument:",
+	[STARLARK_ERRORCODE_MUTATED_DURING_ITERATION] =
+		"collection changed while it was being iterated over",
+	[STARLARK_ERRORCODE_RECURSION] = "function called recursively:",
+	[STARLARK_ERRORCODE_STACK_OVERFLOW] = "call stack too deep",
+	[STARLARK_ERRORCODE_LOAD_UNSUPPORTED] = "load is not supported",
+	[STARLARK_ERRORCODE_FAIL] = "fail:",
 };
 
+// How the starlark_ErrorArg of an error is turned into the 'message' part of
+// the error.
+enum error_arg_kind {
+	// The error has no message.
+	ERROR_ARG_NONE = 0,
+	// The span is quoted, with any invalid UTF-8 escaped as \xXX.
+	ERROR_ARG_QUOTED_SPAN,
+	// The span is printed as-is.
+	ERROR_ARG_SPAN,
+	// The character is quoted.
+	ERROR_ARG_QUOTED_CHAR,
+	// The string from the strpool is printed as-is.
+	ERROR_ARG_STRING,
+	// The string from the strpool is quoted.
+	ERROR_ARG_QUOTED_STRING,
+};
+
+// Codes missing from here have no message. The array has an entry for every
+// code, so that it can be indexed by any of them.
+static const enum error_arg_kind
+	ErrorCode_args[sizeof(ErrorCode_strs) / sizeof(ErrorCode_strs[0])] = {
+	[STARLARK_ERRORCODE_BINARY_NUMBER_INVALID_DIGIT] =
+		ERROR_ARG_QUOTED_SPAN,
+	[STARLARK_ERRORCODE_OCTAL_NUMBER_INVALID_DIGIT] = ERROR_ARG_QUOTED_SPAN,
+	[STARLARK_ERRORCODE_HEX_NUMBER_INVALID_DIGIT] = ERROR_ARG_QUOTED_SPAN,
+	[STARLARK_ERRORCODE_UNEXPECTED_SYMBOL] = ERROR_ARG_QUOTED_SPAN,
+	[STARLARK_ERRORCODE_INVALID_UTF8] = ERROR_ARG_QUOTED_SPAN,
+	[STARLARK_ERRORCODE_INVALID_BYTES_CHAR] = ERROR_ARG_QUOTED_SPAN,
+	[STARLARK_ERRORCODE_EXPECTED_IDENT] = ERROR_ARG_QUOTED_SPAN,
+	[STARLARK_ERRORCODE_FLOAT_INVALID] = ERROR_ARG_SPAN,
+	[STARLARK_ERRORCODE_INT_INVALID] = ERROR_ARG_QUOTED_SPAN,
+	[STARLARK_ERRORCODE_FLOAT_TOO_BIG] = ERROR_ARG_SPAN,
+	[STARLARK_ERRORCODE_INVALID_ESCAPE] = ERROR_ARG_QUOTED_CHAR,
+	[STARLARK_ERRORCODE_UNEXPECTED_TOKEN] = ERROR_ARG_QUOTED_SPAN,
+	[STARLARK_ERRORCODE_CHAINED_COMPARISON] = ERROR_ARG_QUOTED_SPAN,
+	[STARLARK_ERRORCODE_DUPLICATE_PARAM] = ERROR_ARG_QUOTED_SPAN,
+	[STARLARK_ERRORCODE_UNDEFINED_NAME] = ERROR_ARG_QUOTED_SPAN,
+	[STARLARK_ERRORCODE_OUTSIDE_LOOP] = ERROR_ARG_QUOTED_SPAN,
+	[STARLARK_ERRORCODE_UNSUPPORTED_BINARY] = ERROR_ARG_STRING,
+	[STARLARK_ERRORCODE_UNSUPPORTED_UNARY] = ERROR_ARG_STRING,
+	[STARLARK_ERRORCODE_UNBOUND_GLOBAL] = ERROR_ARG_STRING,
+	[STARLARK_ERRORCODE_UNBOUND_LOCAL] = ERROR_ARG_STRING,
+	[STARLARK_ERRORCODE_NOT_CALLABLE] = ERROR_ARG_STRING,
+	[STARLARK_ERRORCODE_NOT_ITERABLE] = ERROR_ARG_STRING,
+	[STARLARK_ERRORCODE_NOT_INDEXABLE] = ERROR_ARG_STRING,
+	[STARLARK_ERRORCODE_INDEX_OUT_OF_RANGE] = ERROR_ARG_STRING,
+	[STARLARK_ERRORCODE_NO_ATTR] = ERROR_ARG_STRING,
+	[STARLARK_ERRORCODE_UNPACK_COUNT] = ERROR_ARG_STRING,
+	[STARLARK_ERRORCODE_ARGS] = ERROR_ARG_STRING,
+	[STARLARK_ERRORCODE_UNEXPECTED_KWARG] = ERROR_ARG_QUOTED_STRING,
+	[STARLARK_ERRORCODE_DUPLICATE_KWARG] = ERROR_ARG_QUOTED_STRING,
+	[STARLARK_ERRORCODE_MISSING_ARG] = ERROR_ARG_QUOTED_STRING,
+	[STARLARK_ERRORCODE_INVALID_ARG] = ERROR_ARG_STRING,
+	[STARLARK_ERRORCODE_RECURSION] = ERROR_ARG_QUOTED_STRING,
+	[STARLARK_ERRORCODE_FAIL] = ERROR_ARG_STRING,
+};
+
+// The rest of the message of the errors whose argument goes in the middle of
+// it, which is printed after the argument.
+static const char *const ErrorCode_suffixes[sizeof(ErrorCode_strs) /
+					    sizeof(ErrorCode_strs[0])] = {
+	[STARLARK_ERRORCODE_UNBOUND_GLOBAL] = "referenced before assignment",
+	[STARLARK_ERRORCODE_UNBOUND_LOCAL] = "referenced before assignment",
+};
+
+int starlark_config_set(struct starlark_Context *ctx, const char *key,
+			const char *value)
+{
+	assert(ctx != NULL);
+	assert(key != NULL);
+	assert(value != NULL);
+
+	if (strcmp(key, "vm") == 0) {
+		if (strcmp(value, "stack") == 0) {
+			ctx->vm = STARLARK_VM_STACK;
+		} else if (strcmp(value, "register") == 0) {
+			ctx->vm = STARLARK_VM_REGISTER;
+		} else {
+			return STARLARK_ERROR_NOTSUPPORTED;
+		}
+
+		return 0;
+	}
+
+	if (strcmp(key, "jit") == 0) {
+		if (strcmp(value, "on") == 0) {
+			ctx->jit = STARLARK_JIT_ON;
+		} else if (strcmp(value, "off") == 0) {
+			ctx->jit = STARLARK_JIT_OFF;
+		} else if (strcmp(value, "eager") == 0) {
+			ctx->jit = STARLARK_JIT_EAGER;
+		} else {
+			return STARLARK_ERROR_NOTSUPPORTED;
+		}
+
+		return 0;
+	}
+
+	return STARLARK_ERROR_NOTSUPPORTED;
+}
+
+void starlark_Context_reset(struct starlark_Context *ctx)
+{
+	assert(ctx != NULL);
+
+	strpool_reset(&ctx->strpool);
+	ctx->name = 0;
+	ctx->src_len = 0;
+	ctx->src = NULL;
+	ctx->err = 0;
+	ctx->errs_len = 0;
+	ctx->srcs_len = 0;
+	if (ctx->globals != NULL) {
+		Dict_clear(ctx->globals);
+	}
+
+	for (size_t i = 0; i < ctx->modules_len; i += 1) {
+		Module_destroy(ctx->modules[i]);
+	}
+	ctx->modules_len = 0;
+	if (ctx->scratch != NULL) {
+		Scratch_reset(ctx->scratch);
+	}
+}
+
 void starlark_Context_finish(struct starlark_Context *ctx)
 {
 	if (ctx == NULL) {
@@ -69,7 +258,92 @@ void starlark_Context_finish(struct starlark_Context *ctx)
 	}
 
 	free(ctx->errs.codes);
+	ctx->errs.codes = NULL;
+	ctx->errs_len = 0;
+	ctx->errs_cap = 0;
+	Dict_destroy(ctx->globals);
+	ctx->globals = NULL;
+	for (size_t i = 0; i < ctx->modules_len; i += 1) {
+		Module_destroy(ctx->modules[i]);
+	}
+	free(ctx->modules);
+	ctx->modules = NULL;
+	ctx->modules_len = 0;
+	ctx->modules_cap = 0;
+	Scratch_destroy(ctx->scratch);
+	ctx->scratch = NULL;
 	strpool_finish(&ctx->strpool);
+	Int_trim();
+}
+
+static void quoted_span_dump(FILE *f, const size_t buf_len,
+			     const uint8_t *buf, const size_t start,
+			     const size_t len)
+{
+	const size_t end = MIN(buf_len, start + len);
+	fputc('\'', f);
+	for (size_t i = start; i < end;) {
+		size_t size = 0;
+		uint32_t c = utf8_codepoint_decode(end, buf, i, &size);
+		if (c == UTF8_ERROR) {
+			fprintf(f, "\\x%x", buf[i]);
+		} else {
+			fwrite(&buf[i], 1, size, f);
+		}
+		i += size;
+	}
+	fputc('\'', f);
+}
+
+// Prints err, which occurred at the given line and line position. strings is
+// the strpool holding the string arguments of errors, if there is one.
+static void error_dump_at(FILE *f, struct starlark_Strpool *strings,
+			  const char *filename, const size_t buf_len,
+			  const uint8_t *buf, const size_t line,
+			  const size_t line_pos, const struct starlark_Error err)
+{
+	fprintf(f, "%s:%zu:%zu: %s", filename, line, line_pos,
+		ErrorCode_strs[err.code]);
+
+	const size_t start = MIN(buf_len, err.arg.span.start);
+	switch (ErrorCode_args[err.code]) {
+	case ERROR_ARG_NONE:
+		break;
+	case ERROR_ARG_QUOTED_SPAN:
+		fputc(' ', f);
+		quoted_span_dump(f, buf_len, buf, start, err.arg.span.len);
+		break;
+	case ERROR_ARG_SPAN:
+		fprintf(f, " %.*s",
+			(int)MIN(buf_len - start, err.arg.span.len),
+			&buf[start]);
+		break;
+	case ERROR_ARG_QUOTED_CHAR:
+		fprintf(f, " '%c'", err.arg.c);
+		break;
+	case ERROR_ARG_STRING:
+	case ERROR_ARG_QUOTED_STRING: {
+		const char *str = strings == NULL ?
+					  NULL :
+					  strpool_get(strings, err.arg.str);
+		if (str == NULL || str[0] == '\0') {
+			break;
+		}
+
+		if (ErrorCode_args[err.code] == ERROR_ARG_STRING) {
+			fprintf(f, " %s", str);
+		} else {
+			fprintf(f, " '%s'", str);
+		}
+		break;
+	}
+	}
+
+	if (ErrorCode_suffixes[err.code] != NULL) {
+		fprintf(f, " %s", ErrorCode_suffixes[err.code]);
+	}
+
+	fprintf(f, "\n");
 }
 
 void starlark_error_dump(FILE *f, const char *filename, const size_t buf_len,
@@ -77,36 +351,40 @@ void starlark_error_dump(FILE *f, const char *filename, const size_t buf_len,
 {
 	size_t line_pos = 0;
 	size_t line = lineno(buf_len, buf, err.start, &line_pos);
-	fprintf(f, "%s:%zu:%zu: %s", filename, line, line_pos,
-		ErrorCode_strs[err.code]);
-	if (strcmp("", err.msg) != 0) {
-		fprintf(f, " %s\n", err.msg);
-	} else {
-		fprintf(f, "\n");
-	}
+	error_dump_at(f, NULL, filename, buf_len, buf, line, line_pos, err);
 }
 
 void starlark_errors_dump(struct starlark_Context *ctx, FILE *f)
 {
+	if (ctx->errs_len == 0) {
+		return;
+	}
+
+	const char *name = strpool_get(&ctx->strpool, ctx->name);
+	if (name == NULL) {
+		panic("starlark_errors_dump has invalid "
+		      "name: %" PRId64,
+		      ctx->name);
+	}
+
+	// Every error needs its line number, so index the lines once instead
+	// of scanning the source for each error.
+	struct LineIndex lines = { 0 };
+	if (!lineindex_init(&lines, ctx->src_len, ctx->src)) {
+		panic("starlark_errors_dump: couldn't allocate line index");
+	}
+
 	struct starlark_Error err = { 0 };
 	for (size_t i = 0; i < ctx->errs_len; i += 1) {
 		err.code = ctx->errs.codes[i];
-		err.msg = strpool_get(&ctx->strpool, ctx->errs.msgs[i]);
-		if (err.msg == NULL) {
-			panic("starlark_errors_dump got invalid "
-			      "handle: %" PRId64,
-			      ctx->errs.msgs[i]);
-		}
-
 		err.start = ctx->errs.starts[i];
-		// printf("err msg handle = %lu\n", ctx->errs.msgs[i]);
-		const char *name = strpool_get(&ctx->strpool, ctx->name);
-		if (name == NULL) {
-			panic("starlark_errors_dump has invalid "
-			      "name: %" PRId64,
-			      ctx->name);
-		}
+		err.arg = ctx->errs.args[i];
 
-		starlark_error_dump(f, name, ctx->src_len, ctx->src, err);
+		size_t line_pos = 0;
+		size_t line = lineindex_lineno(&lines, err.start, &line_pos);
+		error_dump_at(f, &ctx->strpool, name, ctx->src_len, ctx->src,
+			      line, line_pos, err);
 	}
+
+	lineindex_finish(&lines);
 }
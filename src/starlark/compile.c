@@ -0,0 +1,2750 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "starlark/compile.h"
+#include "starlark/builtins.h"
+#include "starlark/common.h"
+#include "starlark/int.h"
+#include "starlark/jit.h"
+#include "starlark/list.h"
+#include "starlark/ops.h"
+#include "starlark/parse.h"
+#include "starlark/resolve.h"
+#include "starlark/str.h"
+#include "starlark/strpool.h"
+#include "starlark/util.h"
+#include "starlark/value.h"
+#include "util/common.h"
+#include "util/lineno.h"
+
+const char *const Opcode_names[OP_COUNT] = {
+	[OP_NOP] = "NOP",
+	[OP_POP] = "POP",
+	[OP_DUP] = "DUP",
+	[OP_DUP2] = "DUP2",
+	[OP_EXCH] = "EXCH",
+	[OP_NONE] = "NONE",
+	[OP_TRUE] = "TRUE",
+	[OP_FALSE] = "FALSE",
+	[OP_CONSTANT] = "CONSTANT",
+	[OP_LOAD_LOCAL] = "LOAD_LOCAL",
+	[OP_STORE_LOCAL] = "STORE_LOCAL",
+	[OP_LOAD_CELL] = "LOAD_CELL",
+	[OP_STORE_CELL] = "STORE_CELL",
+	[OP_LOAD_FREE] = "LOAD_FREE",
+	[OP_LOAD_GLOBAL] = "LOAD_GLOBAL",
+	[OP_STORE_GLOBAL] = "STORE_GLOBAL",
+	[OP_LOAD_BUILTIN] = "LOAD_BUILTIN",
+	[OP_ADD] = "ADD",
+	[OP_SUB] = "SUB",
+	[OP_MUL] = "MUL",
+	[OP_DIV] = "DIV",
+	[OP_FLOORDIV] = "FLOORDIV",
+	[OP_MOD] = "MOD",
+	[OP_BITAND] = "BITAND",
+	[OP_BITOR] = "BITOR",
+	[OP_XOR] = "XOR",
+	[OP_LSHIFT] = "LSHIFT",
+	[OP_RSHIFT] = "RSHIFT",
+	[OP_EQ] = "EQ",
+	[OP_NOTEQ] = "NOTEQ",
+	[OP_LESS] = "LESS",
+	[OP_LEQ] = "LEQ",
+	[OP_GREATER] = "GREATER",
+	[OP_GEQ] = "GEQ",
+	[OP_IN] = "IN",
+	[OP_NOT_IN] = "NOT_IN",
+	[OP_INPLACE_ADD] = "INPLACE_ADD",
+	[OP_PLUS] = "PLUS",
+	[OP_NEG] = "NEG",
+	[OP_BITNOT] = "BITNOT",
+	[OP_NOT] = "NOT",
+	[OP_JUMP] = "JUMP",
+	[OP_JUMP_IF_FALSE] = "JUMP_IF_FALSE",
+	[OP_JUMP_IF_TRUE] = "JUMP_IF_TRUE",
+	[OP_JUMP_IF_FALSE_OR_POP] = "JUMP_IF_FALSE_OR_POP",
+	[OP_JUMP_IF_TRUE_OR_POP] = "JUMP_IF_TRUE_OR_POP",
+	[OP_ITER] = "ITER",
+	[OP_FOR_ITER] = "FOR_ITER",
+	[OP_MAKE_TUPLE] = "MAKE_TUPLE",
+	[OP_MAKE_LIST] = "MAKE_LIST",
+	[OP_MAKE_DICT] = "MAKE_DICT",
+	[OP_LIST_APPEND] = "LIST_APPEND",
+	[OP_DICT_SET] = "DICT_SET",
+	[OP_RESERVE] = "RESERVE",
+	[OP_UNPACK] = "UNPACK",
+	[OP_INDEX] = "INDEX",
+	[OP_SET_INDEX] = "SET_INDEX",
+	[OP_SLICE] = "SLICE",
+	[OP_ATTR] = "ATTR",
+	[OP_SET_ATTR] = "SET_ATTR",
+	[OP_CALL] = "CALL",
+	[OP_MAKE_FUNCTION] = "MAKE_FUNCTION",
+	[OP_LOAD] = "LOAD",
+	[OP_RETURN] = "RETURN",
+	[OP_ADD_CONSTANT] = "ADD_CONSTANT",
+	[OP_SUB_CONSTANT] = "SUB_CONSTANT",
+	[OP_INDEX_CONSTANT] = "INDEX_CONSTANT",
+	[OP_JUMP_UNLESS_EQ] = "JUMP_UNLESS_EQ",
+	[OP_JUMP_UNLESS_NOTEQ] = "JUMP_UNLESS_NOTEQ",
+	[OP_JUMP_UNLESS_LESS] = "JUMP_UNLESS_LESS",
+	[OP_JUMP_UNLESS_LEQ] = "JUMP_UNLESS_LEQ",
+	[OP_JUMP_UNLESS_GREATER] = "JUMP_UNLESS_GREATER",
+	[OP_JUMP_UNLESS_GEQ] = "JUMP_UNLESS_GEQ",
+	[OP_CALL_METHOD] = "CALL_METHOD",
+	[OP_MOVE] = "MOVE",
+	[OP_ADD_REG] = "ADD_REG",
+	[OP_SUB_REG] = "SUB_REG",
+	[OP_MUL_REG] = "MUL_REG",
+	[OP_DIV_REG] = "DIV_REG",
+	[OP_FLOORDIV_REG] = "FLOORDIV_REG",
+	[OP_MOD_REG] = "MOD_REG",
+	[OP_BITAND_REG] = "BITAND_REG",
+	[OP_BITOR_REG] = "BITOR_REG",
+	[OP_XOR_REG] = "XOR_REG",
+	[OP_LSHIFT_REG] = "LSHIFT_REG",
+	[OP_RSHIFT_REG] = "RSHIFT_REG",
+	[OP_EQ_REG] = "EQ_REG",
+	[OP_NOTEQ_REG] = "NOTEQ_REG",
+	[OP_LESS_REG] = "LESS_REG",
+	[OP_LEQ_REG] = "LEQ_REG",
+	[OP_GREATER_REG] = "GREATER_REG",
+	[OP_GEQ_REG] = "GEQ_REG",
+	[OP_IN_REG] = "IN_REG",
+	[OP_NOT_IN_REG] = "NOT_IN_REG",
+	[OP_INPLACE_ADD_REG] = "INPLACE_ADD_REG",
+	[OP_JUMP_UNLESS_EQ_REG] = "JUMP_UNLESS_EQ_REG",
+	[OP_JUMP_UNLESS_NOTEQ_REG] = "JUMP_UNLESS_NOTEQ_REG",
+	[OP_JUMP_UNLESS_LESS_REG] = "JUMP_UNLESS_LESS_REG",
+	[OP_JUMP_UNLESS_LEQ_REG] = "JUMP_UNLESS_LEQ_REG",
+	[OP_JUMP_UNLESS_GREATER_REG] = "JUMP_UNLESS_GREATER_REG",
+	[OP_JUMP_UNLESS_GEQ_REG] = "JUMP_UNLESS_GEQ_REG",
+};
+
+const bool Opcode_has_arg[OP_COUNT] = {
+	[OP_CONSTANT] = true,
+	[OP_LOAD_LOCAL] = true,
+	[OP_STORE_LOCAL] = true,
+	[OP_LOAD_CELL] = true,
+	[OP_STORE_CELL] = true,
+	[OP_LOAD_FREE] = true,
+	[OP_LOAD_GLOBAL] = true,
+	[OP_STORE_GLOBAL] = true,
+	[OP_LOAD_BUILTIN] = true,
+	[OP_JUMP] = true,
+	[OP_JUMP_IF_FALSE] = true,
+	[OP_JUMP_IF_TRUE] = true,
+	[OP_JUMP_IF_FALSE_OR_POP] = true,
+	[OP_JUMP_IF_TRUE_OR_POP] = true,
+	[OP_ITER] = true,
+	[OP_FOR_ITER] = true,
+	[OP_MAKE_TUPLE] = true,
+	[OP_MAKE_LIST] = true,
+	[OP_MAKE_DICT] = true,
+	[OP_LIST_APPEND] = true,
+	[OP_DICT_SET] = true,
+	[OP_UNPACK] = true,
+	[OP_ATTR] = true,
+	[OP_SET_ATTR] = true,
+	[OP_CALL] = true,
+	[OP_MAKE_FUNCTION] = true,
+	[OP_LOAD] = true,
+	[OP_ADD_CONSTANT] = true,
+	[OP_SUB_CONSTANT] = true,
+	[OP_INDEX_CONSTANT] = true,
+	[OP_JUMP_UNLESS_EQ] = true,
+	[OP_JUMP_UNLESS_NOTEQ] = true,
+	[OP_JUMP_UNLESS_LESS] = true,
+	[OP_JUMP_UNLESS_LEQ] = true,
+	[OP_JUMP_UNLESS_GREATER] = true,
+	[OP_JUMP_UNLESS_GEQ] = true,
+	[OP_CALL_METHOD] = true,
+	[OP_MOVE] = true,
+	[OP_ADD_REG] = true,
+	[OP_SUB_REG] = true,
+	[OP_MUL_REG] = true,
+	[OP_DIV_REG] = true,
+	[OP_FLOORDIV_REG] = true,
+	[OP_MOD_REG] = true,
+	[OP_BITAND_REG] = true,
+	[OP_BITOR_REG] = true,
+	[OP_XOR_REG] = true,
+	[OP_LSHIFT_REG] = true,
+	[OP_RSHIFT_REG] = true,
+	[OP_EQ_REG] = true,
+	[OP_NOTEQ_REG] = true,
+	[OP_LESS_REG] = true,
+	[OP_LEQ_REG] = true,
+	[OP_GREATER_REG] = true,
+	[OP_GEQ_REG] = true,
+	[OP_IN_REG] = true,
+	[OP_NOT_IN_REG] = true,
+	[OP_INPLACE_ADD_REG] = true,
+	[OP_JUMP_UNLESS_EQ_REG] = true,
+	[OP_JUMP_UNLESS_NOTEQ_REG] = true,
+	[OP_JUMP_UNLESS_LESS_REG] = true,
+	[OP_JUMP_UNLESS_LEQ_REG] = true,
+	[OP_JUMP_UNLESS_GREATER_REG] = true,
+	[OP_JUMP_UNLESS_GEQ_REG] = true,
+};
+
+const uint8_t Opcode_regs[OP_COUNT] = {
+	[OP_MOVE] = 1,
+	[OP_ADD_REG] = 2,
+	[OP_SUB_REG] = 2,
+	[OP_MUL_REG] = 2,
+	[OP_DIV_REG] = 2,
+	[OP_FLOORDIV_REG] = 2,
+	[OP_MOD_REG] = 2,
+	[OP_BITAND_REG] = 2,
+	[OP_BITOR_REG] = 2,
+	[OP_XOR_REG] = 2,
+	[OP_LSHIFT_REG] = 2,
+	[OP_RSHIFT_REG] = 2,
+	[OP_EQ_REG] = 2,
+	[OP_NOTEQ_REG] = 2,
+	[OP_LESS_REG] = 2,
+	[OP_LEQ_REG] = 2,
+	[OP_GREATER_REG] = 2,
+	[OP_GEQ_REG] = 2,
+	[OP_IN_REG] = 2,
+	[OP_NOT_IN_REG] = 2,
+	[OP_INPLACE_ADD_REG] = 2,
+	[OP_JUMP_UNLESS_EQ_REG] = 2,
+	[OP_JUMP_UNLESS_NOTEQ_REG] = 2,
+	[OP_JUMP_UNLESS_LESS_REG] = 2,
+	[OP_JUMP_UNLESS_LEQ_REG] = 2,
+	[OP_JUMP_UNLESS_GREATER_REG] = 2,
+	[OP_JUMP_UNLESS_GEQ_REG] = 2,
+};
+
+const uint8_t Opcode_base[OP_COUNT] = {
+	[OP_ADD_CONSTANT] = OP_ADD,
+	[OP_SUB_CONSTANT] = OP_SUB,
+	[OP_INDEX_CONSTANT] = OP_INDEX,
+	[OP_JUMP_UNLESS_EQ] = OP_EQ,
+	[OP_JUMP_UNLESS_NOTEQ] = OP_NOTEQ,
+	[OP_JUMP_UNLESS_LESS] = OP_LESS,
+	[OP_JUMP_UNLESS_LEQ] = OP_LEQ,
+	[OP_JUMP_UNLESS_GREATER] = OP_GREATER,
+	[OP_JUMP_UNLESS_GEQ] = OP_GEQ,
+	[OP_CALL_METHOD] = OP_CALL,
+	[OP_ADD_REG] = OP_ADD,
+	[OP_SUB_REG] = OP_SUB,
+	[OP_MUL_REG] = OP_MUL,
+	[OP_DIV_REG] = OP_DIV,
+	[OP_FLOORDIV_REG] = OP_FLOORDIV,
+	[OP_MOD_REG] = OP_MOD,
+	[OP_BITAND_REG] = OP_BITAND,
+	[OP_BITOR_REG] = OP_BITOR,
+	[OP_XOR_REG] = OP_XOR,
+	[OP_LSHIFT_REG] = OP_LSHIFT,
+	[OP_RSHIFT_REG] = OP_RSHIFT,
+	[OP_EQ_REG] = OP_EQ,
+	[OP_NOTEQ_REG] = OP_NOTEQ,
+	[OP_LESS_REG] = OP_LESS,
+	[OP_LEQ_REG] = OP_LEQ,
+	[OP_GREATER_REG] = OP_GREATER,
+	[OP_GEQ_REG] = OP_GEQ,
+	[OP_IN_REG] = OP_IN,
+	[OP_NOT_IN_REG] = OP_NOT_IN,
+	[OP_INPLACE_ADD_REG] = OP_INPLACE_ADD,
+	[OP_JUMP_UNLESS_EQ_REG] = OP_EQ,
+	[OP_JUMP_UNLESS_NOTEQ_REG] = OP_NOTEQ,
+	[OP_JUMP_UNLESS_LESS_REG] = OP_LESS,
+	[OP_JUMP_UNLESS_LEQ_REG] = OP_LEQ,
+	[OP_JUMP_UNLESS_GREATER_REG] = OP_GREATER,
+	[OP_JUMP_UNLESS_GEQ_REG] = OP_GEQ,
+};
+
+// A function is first compiled into a list of instructions, whose jumps refer
+// to labels instead of offsets in the code. Once the whole function has been
+// compiled, the labels are resolved and the instructions are encoded as bytes.
+struct instr {
+	uint8_t op;
+	// For jumps, the label jumped to.
+	uint32_t arg;
+	// The sources of a register instruction.
+	uint32_t regs[2];
+	// Where in the source the instruction was compiled from.
+	size_t start;
+	// For OP_CALL_METHOD, where the ATTR it stands for was compiled from.
+	size_t attr_start;
+};
+
+// The labels a break or continue in a loop jumps to.
+struct loop {
+	uint32_t brk;
+	uint32_t cont;
+};
+
+// A function which is being compiled.
+struct function {
+	uint32_t index;
+
+	size_t instrs_len;
+	size_t instrs_cap;
+	struct instr *instrs;
+
+	// The instruction each label is placed at.
+	size_t labels_len;
+	size_t labels_cap;
+	uint32_t *labels;
+
+	size_t constants_len;
+	size_t constants_cap;
+	struct starlark_Value *constants;
+
+	size_t names_len;
+	size_t names_cap;
+	int64_t *names;
+
+	// The loops the statement being compiled is inside of, innermost
+	// last, and the most there have been at once.
+	size_t loops_len;
+	size_t loops_cap;
+	struct loop *loops;
+	size_t loops_max;
+};
+
+// The arrays of a function which aren't part of its code once it's finished.
+struct function_arrays {
+	size_t instrs_cap;
+	struct instr *instrs;
+	size_t labels_cap;
+	uint32_t *labels;
+	size_t loops_cap;
+	struct loop *loops;
+};
+
+struct compiler {
+	struct starlark_Context *ctx;
+	struct starlark_Parser *p;
+	const struct starlark_Resolver *r;
+	struct starlark_CompileScratch *scratch;
+	struct starlark_Program *out;
+
+	// The innermost function being compiled.
+	struct function *f;
+};
+
+// Returns ptr, an array of cap elements of size bytes each, grown to have room
+// for more than len of them.
+// Returns NULL if we couldn't allocate enough memory, leaving ptr as it was.
+static void *grow(struct compiler *c, void *ptr, size_t *cap, const size_t len,
+		  const size_t size)
+{
+	if (len < *cap) {
+		return ptr;
+	}
+
+	if (*cap >= UINT32_MAX / 2) {
+		c->ctx->err = STARLARK_ERROR_TOOBIG;
+		return NULL;
+	}
+
+	const size_t new_cap = (*cap + 16) * 2;
+	void *result = realloc(ptr, new_cap * size);
+	if (result == NULL) {
+		c->ctx->err = STARLARK_ERROR_OOM;
+		return NULL;
+	}
+
+	*cap = new_cap;
+	return result;
+}
+
+static union starlark_AstNode *node_at(struct compiler *c, const uint32_t node)
+{
+	return &c->p->ast.nodes[c->p->ast.idxs[node]];
+}
+
+static enum starlark_AstTag tag_at(struct compiler *c, const uint32_t node)
+{
+	return c->p->ast.tags[node];
+}
+
+static uint32_t child(struct compiler *c, const uint32_t start,
+		      const uint32_t i)
+{
+	return c->p->extra[start + i];
+}
+
+static void report(struct compiler *c, const enum starlark_ErrorCode code,
+		   const uint32_t node)
+{
+	struct starlark_Error err = {
+		.code = code,
+		.start = c->p->ast.starts[node],
+	};
+	if (!err_append(c->ctx, err)) {
+		c->ctx->err = STARLARK_ERROR_OOM;
+	}
+}
+
+// Appends an instruction compiled from node to the current function.
+static void emit(struct compiler *c, const uint8_t op, const uint32_t arg,
+		 const uint32_t node)
+{
+	struct function *f = c->f;
+	struct instr *instrs = grow(c, f->instrs, &f->instrs_cap,
+				    f->instrs_len, sizeof(f->instrs[0]));
+	if (instrs == NULL) {
+		return;
+	}
+
+	f->instrs = instrs;
+	f->instrs[f->instrs_len] = (struct instr){
+		.op = op,
+		.arg = arg,
+		.start = c->p->ast.starts[node],
+	};
+	f->instrs_len += 1;
+}
+
+// Returns a new label, which is placed with place_label.
+static uint32_t new_label(struct compiler *c)
+{
+	struct function *f = c->f;
+	uint32_t *labels = grow(c, f->labels, &f->labels_cap, f->labels_len,
+				sizeof(f->labels[0]));
+	if (labels == NULL) {
+		return 0;
+	}
+
+	f->labels = labels;
+	f->labels[f->labels_len] = UINT32_MAX;
+	f->labels_len += 1;
+	return (uint32_t)(f->labels_len - 1);
+}
+
+// Places label before the next instruction emitted.
+static void place_label(struct compiler *c, const uint32_t label)
+{
+	if (c->ctx->err) {
+		return;
+	}
+
+	c->f->labels[label] = (uint32_t)c->f->instrs_len;
+}
+
+// Returns whether the constants a and b can be used in place of each other.
+// 1 and 1.0 are equal, but aren't the same constant, and neither are 0.0 and
+// -0.0, or tuples holding them.
+static bool same_constant(const struct starlark_Value a,
+			  const struct starlark_Value b)
+{
+	const enum starlark_Type type = Value_type(a);
+	if (Value_type(b) != type) {
+		return false;
+	}
+
+	if (type == STARLARK_TYPE_FLOAT) {
+		const double x = Value_as_float(a);
+		const double y = Value_as_float(b);
+		return memcmp(&x, &y, sizeof(x)) == 0;
+	}
+
+	if (type != STARLARK_TYPE_TUPLE) {
+		return Value_equal(a, b);
+	}
+
+	const struct starlark_Tuple *x = (void *)Value_as_object(a);
+	const struct starlark_Tuple *y = (void *)Value_as_object(b);
+	if (x->len != y->len) {
+		return false;
+	}
+
+	for (size_t i = 0; i < x->len; i += 1) {
+		if (!same_constant(x->items[i], y->items[i])) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Returns the index of v in the current function's constants, adding it if it
+// isn't there yet. Takes ownership of v.
+static uint32_t add_constant(struct compiler *c, const struct starlark_Value v)
+{
+	struct function *f = c->f;
+	for (size_t i = 0; i < f->constants_len; i += 1) {
+		if (same_constant(f->constants[i], v)) {
+			Value_release(v);
+			return (uint32_t)i;
+		}
+	}
+
+	struct starlark_Value *constants =
+		grow(c, f->constants, &f->constants_cap, f->constants_len,
+		     sizeof(f->constants[0]));
+	if (constants == NULL) {
+		Value_release(v);
+		return 0;
+	}
+
+	f->constants = constants;
+	f->constants[f->constants_len] = v;
+	f->constants_len += 1;
+	return (uint32_t)(f->constants_len - 1);
+}
+
+// Returns the index of the strpool handle name in the current function's
+// names, adding it if it isn't there yet.
+static uint32_t add_name(struct compiler *c, const int64_t name)
+{
+	struct function *f = c->f;
+	for (size_t i = 0; i < f->names_len; i += 1) {
+		if (f->names[i] == name) {
+			return (uint32_t)i;
+		}
+	}
+
+	int64_t *names = grow(c, f->names, &f->names_cap, f->names_len,
+			      sizeof(f->names[0]));
+	if (names == NULL) {
+		return 0;
+	}
+
+	f->names = names;
+	f->names[f->names_len] = name;
+	f->names_len += 1;
+	return (uint32_t)(f->names_len - 1);
+}
+
+// Returns the index of a new entry in the current function's names for an
+// OP_ATTR looking up name. Unlike add_name, it never reuses an entry, since
+// each OP_ATTR needs an inline cache of its own.
+static uint32_t add_attr(struct compiler *c, const int64_t name)
+{
+	struct function *f = c->f;
+	int64_t *names = grow(c, f->names, &f->names_cap, f->names_len,
+			      sizeof(f->names[0]));
+	if (names == NULL) {
+		return 0;
+	}
+
+	f->names = names;
+	f->names[f->names_len] = name;
+	f->names_len += 1;
+	return (uint32_t)(f->names_len - 1);
+}
+
+// Emits an OP_CONSTANT for the string constant with the given strpool handle.
+static void emit_string(struct compiler *c, const int64_t name,
+			const uint32_t node)
+{
+	const char *str = strpool_get(&c->ctx->strpool, name);
+	const struct starlark_Value v = Value_str(strlen(str), str);
+	if (Value_is_none(v)) {
+		c->ctx->err = STARLARK_ERROR_OOM;
+		return;
+	}
+
+	emit(c, OP_CONSTANT, add_constant(c, v), node);
+}
+
+static void compile_expr(struct compiler *c, const uint32_t node);
+static void compile_stmt(struct compiler *c, const uint32_t node);
+
+static void compile_list(struct compiler *c, const uint32_t start,
+			 const uint32_t len)
+{
+	for (uint32_t i = 0; i < len; i += 1) {
+		compile_expr(c, child(c, start, i));
+	}
+}
+
+static void compile_literal(struct compiler *c, const uint32_t node)
+{
+	const union starlark_AstNode *n = node_at(c, node);
+	struct starlark_Value v = VALUE_NONE;
+	switch (tag_at(c, node)) {
+	case STARLARK_NODE_INT: {
+		struct starlark_Int *i = Int_copy(n->as_int);
+		if (i != NULL) {
+			v = Value_from_Int(i);
+		}
+		break;
+	}
+	case STARLARK_NODE_FLOAT:
+		v = Value_float(n->as_float);
+		break;
+	default:
+		v = Value_str(n->as_str.len, n->as_str.ptr);
+		break;
+	}
+
+	if (Value_is_none(v)) {
+		c->ctx->err = STARLARK_ERROR_OOM;
+		return;
+	}
+
+	emit(c, OP_CONSTANT, add_constant(c, v), node);
+}
+
+static void compile_name(struct compiler *c, const uint32_t node)
+{
+	const union starlark_AstNode *n = node_at(c, node);
+	const uint32_t index = n->as_identifier.index;
+	switch (n->as_identifier.scope) {
+	case STARLARK_SCOPE_LOCAL:
+		emit(c, OP_LOAD_LOCAL, index, node);
+		break;
+	case STARLARK_SCOPE_CELL:
+		emit(c, OP_LOAD_CELL, index, node);
+		break;
+	case STARLARK_SCOPE_FREE:
+		emit(c, OP_LOAD_FREE, index, node);
+		break;
+	case STARLARK_SCOPE_GLOBAL:
+		emit(c, OP_LOAD_GLOBAL, index, node);
+		break;
+	case STARLARK_SCOPE_BUILTIN:
+		if (index == BUILTIN_NONE) {
+			emit(c, OP_NONE, 0, node);
+		} else if (index == BUILTIN_TRUE) {
+			emit(c, OP_TRUE, 0, node);
+		} else if (index == BUILTIN_FALSE) {
+			emit(c, OP_FALSE, 0, node);
+		} else {
+			emit(c, OP_LOAD_BUILTIN, index, node);
+		}
+		break;
+	default:
+		assert(false && "identifier wasn't resolved");
+		break;
+	}
+}
+
+// Pops the value on top of the stack and assigns it to the target node.
+static void compile_assign(struct compiler *c, const uint32_t node)
+{
+	if (c->ctx->err) {
+		return;
+	}
+
+	const union starlark_AstNode n = *node_at(c, node);
+	switch (tag_at(c, node)) {
+	case STARLARK_NODE_IDENTIFIER: {
+		const uint32_t index = n.as_identifier.index;
+		if (n.as_identifier.scope == STARLARK_SCOPE_CELL) {
+			emit(c, OP_STORE_CELL, index, node);
+		} else if (n.as_identifier.scope == STARLARK_SCOPE_GLOBAL) {
+			emit(c, OP_STORE_GLOBAL, index, node);
+		} else {
+			assert(n.as_identifier.scope == STARLARK_SCOPE_LOCAL);
+			emit(c, OP_STORE_LOCAL, index, node);
+		}
+		break;
+	}
+	case STARLARK_NODE_TUPLE:
+	case STARLARK_NODE_LIST:
+		emit(c, OP_UNPACK, n.as_list.len, node);
+		for (uint32_t i = 0; i < n.as_list.len; i += 1) {
+			compile_assign(c, child(c, n.as_list.start, i));
+		}
+		break;
+	case STARLARK_NODE_DOT:
+		compile_expr(c, n.as_dot.operand);
+		emit(c, OP_EXCH, 0, node);
+		emit(c, OP_SET_ATTR, add_name(c, n.as_dot.name), node);
+		break;
+	case STARLARK_NODE_INDEX:
+		compile_expr(c, n.as_binary.lhs);
+		emit(c, OP_EXCH, 0, node);
+		compile_expr(c, n.as_binary.rhs);
+		emit(c, OP_EXCH, 0, node);
+		emit(c, OP_SET_INDEX, 0, node);
+		break;
+	default:
+		assert(false && "the parser only allows valid targets");
+		break;
+	}
+}
+
+// Returns whether the call node has *args or **kwargs.
+static bool has_spread(struct compiler *c, const uint32_t node)
+{
+	const union starlark_AstNode n = *node_at(c, node);
+	for (uint32_t i = 0; i < n.as_call.args_len; i += 1) {
+		const enum starlark_AstTag tag =
+			tag_at(c, child(c, n.as_call.args, i));
+		if (tag == STARLARK_NODE_ARG_STAR ||
+		    tag == STARLARK_NODE_ARG_STARSTAR) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void compile_call(struct compiler *c, const uint32_t node)
+{
+	const union starlark_AstNode n = *node_at(c, node);
+
+	// Calling a method looked up with x.name is done by OP_CALL_METHOD
+	// instead of an OP_ATTR and OP_CALL, so the method isn't bound to x
+	// first. The arguments come between the two, so it's emitted here
+	// rather than by the peephole optimizer.
+	uint32_t method = UINT32_MAX;
+	if (tag_at(c, n.as_call.fn) == STARLARK_NODE_DOT &&
+	    !has_spread(c, node) && c->f->names_len <= METHOD_MAX_NAME) {
+		const union starlark_AstNode dot = *node_at(c, n.as_call.fn);
+		compile_expr(c, dot.as_dot.operand);
+		method = add_attr(c, dot.as_dot.name);
+	} else {
+		compile_expr(c, n.as_call.fn);
+	}
+
+	// The parser makes sure positional arguments come first, then named
+	// ones, then *args and **kwargs.
+	uint32_t positional = 0;
+	uint32_t named = 0;
+	uint32_t flags = 0;
+	for (uint32_t i = 0; i < n.as_call.args_len; i += 1) {
+		const uint32_t arg = child(c, n.as_call.args, i);
+		const union starlark_AstNode a = *node_at(c, arg);
+		switch (tag_at(c, arg)) {
+		case STARLARK_NODE_ARG_NAMED:
+			emit_string(c, a.as_named.name, arg);
+			compile_expr(c, a.as_named.value);
+			named += 1;
+			break;
+		case STARLARK_NODE_ARG_STAR:
+			compile_expr(c, a.as_unary.operand);
+			flags |= CALL_VARARGS;
+			break;
+		case STARLARK_NODE_ARG_STARSTAR:
+			compile_expr(c, a.as_unary.operand);
+			flags |= CALL_KWARGS;
+			break;
+		default:
+			compile_expr(c, arg);
+			positional += 1;
+			break;
+		}
+	}
+
+	if (positional > CALL_MAX_ARGS || named > CALL_MAX_ARGS) {
+		report(c, STARLARK_ERRORCODE_TOO_MANY_ARGS, node);
+		return;
+	}
+
+	if (method == UINT32_MAX) {
+		emit(c, OP_CALL, CALL_ARG(positional, named, flags), node);
+		return;
+	}
+
+	emit(c, OP_CALL_METHOD, METHOD_ARG(method, positional, named), node);
+	if (!c->ctx->err) {
+		c->f->instrs[c->f->instrs_len - 1].attr_start =
+			c->p->ast.starts[n.as_call.fn];
+	}
+}
+
+// Pushes a loop whose labels break and continue jump to.
+// Returns false if we couldn't allocate enough memory.
+static bool push_loop(struct compiler *c, const struct loop loop)
+{
+	struct function *f = c->f;
+	struct loop *loops = grow(c, f->loops, &f->loops_cap, f->loops_len,
+				  sizeof(f->loops[0]));
+	if (loops == NULL) {
+		return false;
+	}
+
+	f->loops = loops;
+	f->loops[f->loops_len] = loop;
+	f->loops_len += 1;
+	f->loops_max = MAX(f->loops_max, f->loops_len);
+	return true;
+}
+
+// Compiles a list or dict comprehension. Each for clause is a loop which
+// leaves its iterator on the stack above the list or dict being built, so
+// appending to it has to reach past them. An if clause skips to the next
+// value of the innermost loop.
+static void compile_comprehension(struct compiler *c, const uint32_t node)
+{
+	const union starlark_AstNode n = *node_at(c, node);
+	const bool is_dict = tag_at(c, node) == STARLARK_NODE_DICT_COMP;
+	emit(c, is_dict ? OP_MAKE_DICT : OP_MAKE_LIST, 0, node);
+
+	const size_t loops_start = c->f->loops_len;
+	for (uint32_t i = 0; i < n.as_comp.clauses_len; i += 1) {
+		const uint32_t clause = child(c, n.as_comp.clauses, i);
+		const union starlark_AstNode cl = *node_at(c, clause);
+		if (tag_at(c, clause) == STARLARK_NODE_COMP_IF) {
+			compile_expr(c, cl.as_unary.operand);
+			if (c->ctx->err) {
+				return;
+			}
+
+			// The parser makes sure a comprehension starts with a
+			// for clause.
+			const struct function *f = c->f;
+			const uint32_t next = f->loops[f->loops_len - 1].cont;
+			emit(c, OP_JUMP_IF_FALSE, next, clause);
+			continue;
+		}
+
+		compile_expr(c, cl.as_for.iterable);
+		emit(c, OP_ITER, (uint32_t)c->f->loops_len, clause);
+		if (n.as_comp.clauses_len == 1) {
+			// Every value of a lone for clause adds an entry, so
+			// there are at most as many entries as values.
+			emit(c, OP_RESERVE, 0, clause);
+		}
+
+		const struct loop loop = {
+			.cont = new_label(c),
+			.brk = new_label(c),
+		};
+		if (!push_loop(c, loop)) {
+			return;
+		}
+
+		place_label(c, loop.cont);
+		emit(c, OP_FOR_ITER, loop.brk, clause);
+		compile_assign(c, cl.as_for.vars);
+	}
+
+	const uint32_t depth = (uint32_t)(c->f->loops_len - loops_start);
+	if (is_dict) {
+		const uint32_t entry = n.as_comp.body;
+		compile_expr(c, node_at(c, entry)->as_binary.lhs);
+		compile_expr(c, node_at(c, entry)->as_binary.rhs);
+		emit(c, OP_DICT_SET, depth, node);
+	} else {
+		compile_expr(c, n.as_comp.body);
+		emit(c, OP_LIST_APPEND, depth, node);
+	}
+
+	// Close the loops, innermost first.
+	while (c->f->loops_len > loops_start) {
+		const struct loop loop = c->f->loops[c->f->loops_len - 1];
+		emit(c, OP_JUMP, loop.cont, node);
+		place_label(c, loop.brk);
+		c->f->loops_len -= 1;
+	}
+}
+
+static void compile_function(struct compiler *c, const uint32_t node,
+			     const int64_t name);
+
+static void compile_expr(struct compiler *c, const uint32_t node)
+{
+	if (node == STARLARK_NODE_NONE || c->ctx->err) {
+		return;
+	}
+
+	const union starlark_AstNode n = *node_at(c, node);
+	switch (tag_at(c, node)) {
+	case STARLARK_NODE_IDENTIFIER:
+		compile_name(c, node);
+		break;
+	case STARLARK_NODE_INT:
+	case STARLARK_NODE_FLOAT:
+	case STARLARK_NODE_STRING:
+		compile_literal(c, node);
+		break;
+	case STARLARK_NODE_TUPLE:
+		compile_list(c, n.as_list.start, n.as_list.len);
+		emit(c, OP_MAKE_TUPLE, n.as_list.len, node);
+		break;
+	case STARLARK_NODE_LIST:
+		compile_list(c, n.as_list.start, n.as_list.len);
+		emit(c, OP_MAKE_LIST, n.as_list.len, node);
+		break;
+	case STARLARK_NODE_DICT:
+		compile_list(c, n.as_list.start, n.as_list.len);
+		emit(c, OP_MAKE_DICT, n.as_list.len, node);
+		break;
+	case STARLARK_NODE_DICT_ENTRY:
+		compile_expr(c, n.as_binary.lhs);
+		compile_expr(c, n.as_binary.rhs);
+		break;
+	case STARLARK_NODE_LIST_COMP:
+	case STARLARK_NODE_DICT_COMP:
+		compile_comprehension(c, node);
+		break;
+	case STARLARK_NODE_UNARY: {
+		compile_expr(c, n.as_unary.operand);
+		uint8_t op = OP_NOT;
+		if (n.as_unary.op == STARLARK_OP_ADD) {
+			op = OP_PLUS;
+		} else if (n.as_unary.op == STARLARK_OP_SUB) {
+			op = OP_NEG;
+		} else if (n.as_unary.op == STARLARK_OP_BITNOT) {
+			op = OP_BITNOT;
+		}
+
+		emit(c, op, 0, node);
+		break;
+	}
+	case STARLARK_NODE_BINARY:
+		compile_expr(c, n.as_binary.lhs);
+		if (n.as_binary.op == STARLARK_OP_AND ||
+		    n.as_binary.op == STARLARK_OP_OR) {
+			const uint32_t end = new_label(c);
+			emit(c,
+			     n.as_binary.op == STARLARK_OP_AND ?
+				     OP_JUMP_IF_FALSE_OR_POP :
+				     OP_JUMP_IF_TRUE_OR_POP,
+			     end, node);
+			compile_expr(c, n.as_binary.rhs);
+			place_label(c, end);
+			break;
+		}
+
+		compile_expr(c, n.as_binary.rhs);
+		emit(c, (uint8_t)(OP_ADD + n.as_binary.op), 0, node);
+		break;
+	case STARLARK_NODE_COND: {
+		const uint32_t otherwise = new_label(c);
+		const uint32_t end = new_label(c);
+		compile_expr(c, n.as_cond.cond);
+		emit(c, OP_JUMP_IF_FALSE, otherwise, node);
+		compile_expr(c, n.as_cond.then);
+		emit(c, OP_JUMP, end, node);
+		place_label(c, otherwise);
+		compile_expr(c, n.as_cond.otherwise);
+		place_label(c, end);
+		break;
+	}
+	case STARLARK_NODE_LAMBDA: {
+		const int64_t name =
+			strpool_add(&c->ctx->strpool, strlen(u8"lambda"),
+				    u8"lambda");
+		if (name < 0) {
+			c->ctx->err = STARLARK_ERROR_OOM;
+			return;
+		}
+
+		compile_function(c, node, name);
+		break;
+	}
+	case STARLARK_NODE_CALL:
+		compile_call(c, node);
+		break;
+	case STARLARK_NODE_DOT:
+		compile_expr(c, n.as_dot.operand);
+		emit(c, OP_ATTR, add_attr(c, n.as_dot.name), node);
+		break;
+	case STARLARK_NODE_INDEX:
+		compile_expr(c, n.as_binary.lhs);
+		compile_expr(c, n.as_binary.rhs);
+		emit(c, OP_INDEX, 0, node);
+		break;
+	case STARLARK_NODE_SLICE: {
+		compile_expr(c, n.as_slice.operand);
+		const uint32_t parts[] = {
+			n.as_slice.lo,
+			n.as_slice.hi,
+			n.as_slice.step,
+		};
+		for (size_t i = 0; i < 3; i += 1) {
+			if (parts[i] == STARLARK_NODE_NONE) {
+				emit(c, OP_NONE, 0, node);
+			} else {
+				compile_expr(c, parts[i]);
+			}
+		}
+
+		emit(c, OP_SLICE, 0, node);
+		break;
+	}
+	default:
+		assert(false && "not an expression");
+		break;
+	}
+}
+
+// Compiles 'lhs op= rhs'. The operand of lhs is only evaluated once, so for
+// a.b or a[i] it's duplicated on the stack to be used again by the store.
+static void compile_aug_assign(struct compiler *c, const uint32_t node)
+{
+	const union starlark_AstNode n = *node_at(c, node);
+	const uint32_t lhs = n.as_binary.lhs;
+	const union starlark_AstNode target = *node_at(c, lhs);
+	const uint8_t op = n.as_binary.op == STARLARK_OP_ADD ?
+				   OP_INPLACE_ADD :
+				   (uint8_t)(OP_ADD + n.as_binary.op);
+	switch (tag_at(c, lhs)) {
+	case STARLARK_NODE_DOT: {
+		compile_expr(c, target.as_dot.operand);
+		emit(c, OP_DUP, 0, node);
+		emit(c, OP_ATTR, add_attr(c, target.as_dot.name), lhs);
+		compile_expr(c, n.as_binary.rhs);
+		emit(c, op, 0, node);
+		emit(c, OP_SET_ATTR, add_name(c, target.as_dot.name), node);
+		break;
+	}
+	case STARLARK_NODE_INDEX:
+		compile_expr(c, target.as_binary.lhs);
+		compile_expr(c, target.as_binary.rhs);
+		emit(c, OP_DUP2, 0, node);
+		emit(c, OP_INDEX, 0, lhs);
+		compile_expr(c, n.as_binary.rhs);
+		emit(c, op, 0, node);
+		emit(c, OP_SET_INDEX, 0, node);
+		break;
+	default:
+		compile_expr(c, lhs);
+		compile_expr(c, n.as_binary.rhs);
+		emit(c, op, 0, node);
+		compile_assign(c, lhs);
+		break;
+	}
+}
+
+static void compile_for(struct compiler *c, const uint32_t node)
+{
+	const union starlark_AstNode n = *node_at(c, node);
+	compile_expr(c, n.as_for.iterable);
+	emit(c, OP_ITER, (uint32_t)c->f->loops_len, node);
+	const struct loop loop = {
+		.cont = new_label(c),
+		.brk = new_label(c),
+	};
+	if (!push_loop(c, loop)) {
+		return;
+	}
+
+	place_label(c, loop.cont);
+	emit(c, OP_FOR_ITER, loop.brk, node);
+	compile_assign(c, n.as_for.vars);
+	compile_stmt(c, n.as_for.body);
+	emit(c, OP_JUMP, loop.cont, node);
+	place_label(c, loop.brk);
+	c->f->loops_len -= 1;
+}
+
+static void compile_load(struct compiler *c, const uint32_t node)
+{
+	const union starlark_AstNode n = *node_at(c, node);
+	compile_expr(c, n.as_load.module);
+	for (uint32_t i = 0; i < n.as_load.bindings_len; i += 1) {
+		const uint32_t b = child(c, n.as_load.bindings, i);
+		compile_expr(c, node_at(c, b)->as_binary.rhs);
+	}
+
+	emit(c, OP_LOAD, n.as_load.bindings_len, node);
+
+	// The last value loaded is on top of the stack.
+	for (uint32_t i = n.as_load.bindings_len; i > 0; i -= 1) {
+		const uint32_t b = child(c, n.as_load.bindings, i - 1);
+		compile_assign(c, node_at(c, b)->as_binary.lhs);
+	}
+}
+
+static void compile_stmt(struct compiler *c, const uint32_t node)
+{
+	if (node == STARLARK_NODE_NONE || c->ctx->err) {
+		return;
+	}
+
+	const union starlark_AstNode n = *node_at(c, node);
+	switch (tag_at(c, node)) {
+	case STARLARK_NODE_BLOCK:
+		for (uint32_t i = 0; i < n.as_list.len; i += 1) {
+			compile_stmt(c, child(c, n.as_list.start, i));
+		}
+		break;
+	case STARLARK_NODE_EXPR_STMT:
+		compile_expr(c, n.as_unary.operand);
+		emit(c, OP_POP, 0, node);
+		break;
+	case STARLARK_NODE_ASSIGN:
+		compile_expr(c, n.as_binary.rhs);
+		compile_assign(c, n.as_binary.lhs);
+		break;
+	case STARLARK_NODE_AUG_ASSIGN:
+		compile_aug_assign(c, node);
+		break;
+	case STARLARK_NODE_DEF: {
+		const uint32_t ident = n.as_binary.lhs;
+		compile_function(c, n.as_binary.rhs,
+				 node_at(c, ident)->as_identifier.name);
+		compile_assign(c, ident);
+		break;
+	}
+	case STARLARK_NODE_IF: {
+		const uint32_t otherwise = new_label(c);
+		compile_expr(c, n.as_cond.cond);
+		emit(c, OP_JUMP_IF_FALSE, otherwise, node);
+		compile_stmt(c, n.as_cond.then);
+		if (n.as_cond.otherwise == STARLARK_NODE_NONE) {
+			place_label(c, otherwise);
+			break;
+		}
+
+		const uint32_t end = new_label(c);
+		emit(c, OP_JUMP, end, node);
+		place_label(c, otherwise);
+		compile_stmt(c, n.as_cond.otherwise);
+		place_label(c, end);
+		break;
+	}
+	case STARLARK_NODE_FOR:
+		compile_for(c, node);
+		break;
+	case STARLARK_NODE_RETURN:
+		if (n.as_unary.operand == STARLARK_NODE_NONE) {
+			emit(c, OP_NONE, 0, node);
+		} else {
+			compile_expr(c, n.as_unary.operand);
+		}
+
+		emit(c, OP_RETURN, 0, node);
+		break;
+	case STARLARK_NODE_BREAK: {
+		// The loop's iterator is still on the stack.
+		const struct loop loop = c->f->loops[c->f->loops_len - 1];
+		emit(c, OP_POP, 0, node);
+		emit(c, OP_JUMP, loop.brk, node);
+		break;
+	}
+	case STARLARK_NODE_CONTINUE: {
+		const struct loop loop = c->f->loops[c->f->loops_len - 1];
+		emit(c, OP_JUMP, loop.cont, node);
+		break;
+	}
+	case STARLARK_NODE_LOAD:
+		compile_load(c, node);
+		break;
+	default:
+		// pass
+		break;
+	}
+}
+
+static bool is_jump(const uint8_t op)
+{
+	return (op >= OP_JUMP && op <= OP_JUMP_IF_TRUE_OR_POP) ||
+	       op == OP_FOR_ITER ||
+	       (op >= OP_JUMP_UNLESS_EQ && op <= OP_JUMP_UNLESS_GEQ) ||
+	       (op >= OP_JUMP_UNLESS_EQ_REG && op <= OP_JUMP_UNLESS_GEQ_REG);
+}
+
+// Returns the number of locals of the current function, which is also the
+// first register naming one of its constants.
+static uint32_t locals_len(struct compiler *c)
+{
+	return c->r->functions[c->f->index].locals_len;
+}
+
+// Returns how an instruction which doesn't jump changes the height of the
+// stack.
+static int64_t stack_effect(struct compiler *c, const struct instr in)
+{
+	switch (in.op) {
+	case OP_NOP:
+	case OP_EXCH:
+	case OP_ATTR:
+	case OP_ADD_CONSTANT:
+	case OP_SUB_CONSTANT:
+	case OP_INDEX_CONSTANT:
+	case OP_ITER:
+	case OP_RESERVE:
+	case OP_PLUS:
+	case OP_NEG:
+	case OP_BITNOT:
+	case OP_NOT:
+	case OP_JUMP:
+		return 0;
+	case OP_DUP:
+	case OP_NONE:
+	case OP_TRUE:
+	case OP_FALSE:
+	case OP_CONSTANT:
+	case OP_LOAD_LOCAL:
+	case OP_LOAD_CELL:
+	case OP_LOAD_FREE:
+	case OP_LOAD_GLOBAL:
+	case OP_LOAD_BUILTIN:
+	case OP_FOR_ITER:
+		return 1;
+	case OP_DUP2:
+		return 2;
+	case OP_MAKE_TUPLE:
+	case OP_MAKE_LIST:
+		return 1 - (int64_t)in.arg;
+	case OP_MAKE_DICT:
+		return 1 - 2 * (int64_t)in.arg;
+	case OP_UNPACK:
+		return (int64_t)in.arg - 1;
+	case OP_DICT_SET:
+	case OP_SET_ATTR:
+		return -2;
+	case OP_JUMP_UNLESS_EQ:
+	case OP_JUMP_UNLESS_NOTEQ:
+	case OP_JUMP_UNLESS_LESS:
+	case OP_JUMP_UNLESS_LEQ:
+	case OP_JUMP_UNLESS_GREATER:
+	case OP_JUMP_UNLESS_GEQ:
+		return -2;
+	case OP_SET_INDEX:
+	case OP_SLICE:
+		return -3;
+	case OP_MOVE:
+	case OP_JUMP_UNLESS_EQ_REG:
+	case OP_JUMP_UNLESS_NOTEQ_REG:
+	case OP_JUMP_UNLESS_LESS_REG:
+	case OP_JUMP_UNLESS_LEQ_REG:
+	case OP_JUMP_UNLESS_GREATER_REG:
+	case OP_JUMP_UNLESS_GEQ_REG:
+		return 0;
+	case OP_CALL:
+		return -(int64_t)CALL_POSITIONAL(in.arg) -
+		       2 * (int64_t)CALL_NAMED(in.arg) -
+		       (in.arg >> 16 & CALL_VARARGS ? 1 : 0) -
+		       (in.arg >> 16 & CALL_KWARGS ? 1 : 0);
+	case OP_CALL_METHOD:
+		return -(int64_t)CALL_POSITIONAL(in.arg) -
+		       2 * (int64_t)CALL_NAMED(in.arg);
+	case OP_MAKE_FUNCTION:
+		return 1 - (int64_t)c->out->codes[in.arg].defaults_len;
+	default:
+		if (in.op >= OP_ADD_REG && in.op <= OP_INPLACE_ADD_REG) {
+			return in.arg == locals_len(c) ? 1 : 0;
+		}
+
+		// Binary operators, stores, conditional jumps, LIST_APPEND,
+		// LOAD and RETURN.
+		return -1;
+	}
+}
+
+// Once a function has been compiled, the peephole optimizer rewrites short
+// sequences of its instructions which aren't split by a jump target: it fuses
+// common ones into superinstructions, removes ones which cancel out, and makes
+// jumps which land on other jumps go straight to where those lead. Deleted
+// instructions are first turned into OP_NOP, which the compiler never emits
+// itself, and then removed at the end of each pass. Passes are repeated while
+// they change anything, since each can uncover more for the next.
+
+// The most passes made over a function, which only matters for jumps which
+// form a cycle.
+#define PEEPHOLE_MAX_PASSES 8
+
+// Returns whether op only pushes a value, so that pushing it and then popping
+// it right away does nothing.
+static bool is_pure_push(const uint8_t op)
+{
+	return op == OP_NONE || op == OP_TRUE || op == OP_FALSE ||
+	       op == OP_CONSTANT || op == OP_DUP || op == OP_LOAD_BUILTIN;
+}
+
+// Returns a label placed at instruction i of the current function.
+static uint32_t label_at(struct compiler *c, const uint32_t i)
+{
+	struct function *f = c->f;
+	for (size_t l = 0; l < f->labels_len; l += 1) {
+		if (f->labels[l] == i) {
+			return (uint32_t)l;
+		}
+	}
+
+	const uint32_t result = new_label(c);
+	if (c->ctx->err) {
+		return 0;
+	}
+
+	f->labels[result] = i;
+	return result;
+}
+
+// Returns the label a jump of kind *op to label can go to instead, by following
+// the jumps it lands on, changing *op if it has to become another kind of jump.
+static uint32_t thread_jump(struct compiler *c, uint8_t *op, uint32_t label)
+{
+	struct function *f = c->f;
+	for (size_t hops = 0; hops < f->instrs_len && !c->ctx->err; hops += 1) {
+		const uint32_t target = f->labels[label];
+		if (target >= f->instrs_len) {
+			break;
+		}
+
+		const struct instr next = f->instrs[target];
+		if (next.op == OP_JUMP) {
+			label = next.arg;
+			continue;
+		}
+
+		// JUMP_IF_FALSE_OR_POP only jumps with a false value, so where
+		// the conditional jump it lands on goes is already known, and
+		// likewise for JUMP_IF_TRUE_OR_POP.
+		if (*op != OP_JUMP_IF_FALSE_OR_POP &&
+		    *op != OP_JUMP_IF_TRUE_OR_POP) {
+			break;
+		}
+
+		const bool on_false = *op == OP_JUMP_IF_FALSE_OR_POP;
+		const uint8_t pop =
+			on_false ? OP_JUMP_IF_FALSE : OP_JUMP_IF_TRUE;
+		if (next.op == *op) {
+			label = next.arg;
+		} else if (next.op == pop) {
+			*op = pop;
+			label = next.arg;
+		} else if (next.op == OP_JUMP_IF_FALSE ||
+			   next.op == OP_JUMP_IF_TRUE ||
+			   next.op == OP_JUMP_IF_FALSE_OR_POP ||
+			   next.op == OP_JUMP_IF_TRUE_OR_POP) {
+			// The jump landed on pops the value and falls through.
+			*op = pop;
+			label = label_at(c, target + 1);
+		} else {
+			break;
+		}
+	}
+
+	return label;
+}
+
+// Stores the value the instruction in pushes in *out, if it only ever pushes
+// the same one. The value is borrowed.
+static bool constant_value(const struct function *f, const struct instr in,
+			   struct starlark_Value *out)
+{
+	switch (in.op) {
+	case OP_NONE:
+		*out = VALUE_NONE;
+		return true;
+	case OP_TRUE:
+		*out = VALUE_TRUE;
+		return true;
+	case OP_FALSE:
+		*out = VALUE_FALSE;
+		return true;
+	case OP_CONSTANT:
+		*out = f->constants[in.arg];
+		return true;
+	default:
+		return false;
+	}
+}
+
+// The longest string or tuple constant folding can create, so that something
+// like "x" * 1000000 doesn't bloat the code even though it might never run.
+#define FOLD_MAX_LEN 256
+
+// Returns whether computing a op b at compile time is cheap enough, when a and
+// b are constants.
+static bool worth_folding(const uint8_t op, const struct starlark_Value a,
+			  const struct starlark_Value b)
+{
+	size_t len = 0;
+	if (op == OP_MUL && Value_type(a) != STARLARK_TYPE_INT &&
+	    Value_type(a) != STARLARK_TYPE_FLOAT) {
+		return Value_len(a, &len) && Value_is_small_int(b) &&
+		       Value_as_small_int(b) <=
+			       (int64_t)(FOLD_MAX_LEN / MAX(len, 1));
+	}
+
+	if (op == OP_MUL && Value_type(b) != STARLARK_TYPE_INT &&
+	    Value_type(b) != STARLARK_TYPE_FLOAT) {
+		return worth_folding(op, b, a);
+	}
+
+	if (op == OP_LSHIFT) {
+		return Value_is_small_int(b) && Value_as_small_int(b) <= 64;
+	}
+
+	return true;
+}
+
+// Stores the index of the first of the n instructions before instruction i of
+// f which push its operands in *first, if they're all constants and nothing
+// jumps to any of them but the first. Deleted instructions are skipped over.
+static bool constant_operands(const struct function *f, const bool *targets,
+			      const size_t i, const uint32_t n, size_t *first)
+{
+	size_t j = i;
+	for (uint32_t found = 0; found < n;) {
+		if (j == 0 || targets[j]) {
+			return false;
+		}
+
+		j -= 1;
+		struct starlark_Value v = { 0 };
+		if (f->instrs[j].op == OP_NOP) {
+			continue;
+		}
+
+		if (!constant_value(f, f->instrs[j], &v)) {
+			return false;
+		}
+
+		found += 1;
+	}
+
+	*first = j;
+	return true;
+}
+
+// Computes the instruction at i ahead of time if all of its operands are
+// constants, replacing it and the instructions pushing its operands with one
+// pushing the result. Errors are left for when the code runs, since it might
+// never run.
+// Returns whether anything changed.
+static bool fold(struct compiler *c, const bool *targets, const size_t i)
+{
+	struct function *f = c->f;
+	struct instr *in = f->instrs;
+	const uint8_t op = in[i].op;
+	uint32_t n = 0;
+	if ((op >= OP_ADD && op <= OP_NOT_IN) || op == OP_INPLACE_ADD) {
+		n = 2;
+	} else if (op >= OP_PLUS && op <= OP_NOT) {
+		n = 1;
+	} else if (op == OP_MAKE_TUPLE) {
+		n = in[i].arg;
+	} else if (op == OP_MAKE_LIST && i + 1 < f->instrs_len &&
+		   !targets[i + 1] &&
+		   (in[i + 1].op == OP_ITER || in[i + 1].op == OP_IN ||
+		    in[i + 1].op == OP_NOT_IN)) {
+		// A list which is only iterated over or searched can't be
+		// changed, so it can be a constant tuple instead.
+		n = in[i].arg;
+	} else {
+		return false;
+	}
+
+	size_t first = 0;
+	if (!constant_operands(f, targets, i, n, &first)) {
+		return false;
+	}
+
+	struct starlark_Value args[2] = { 0 };
+	for (size_t j = first, k = 0; n <= 2 && j < i; j += 1) {
+		if (constant_value(f, in[j], &args[k])) {
+			k += 1;
+		}
+	}
+
+	struct starlark_Value result = VALUE_NONE;
+	int ret = 0;
+	if (op == OP_MAKE_TUPLE || op == OP_MAKE_LIST) {
+		struct starlark_Tuple *t = Tuple_create(n);
+		if (t == NULL) {
+			c->ctx->err = STARLARK_ERROR_OOM;
+			return false;
+		}
+
+		for (size_t j = first, k = 0; j < i; j += 1) {
+			if (constant_value(f, in[j], &t->items[k])) {
+				Value_retain(t->items[k]);
+				k += 1;
+			}
+		}
+
+		result = Value_object(&t->obj);
+	} else if (op == OP_NOT) {
+		result = Value_bool(!Value_truth(args[0]));
+	} else if (n == 1) {
+		ret = Value_unary(op == OP_PLUS ? STARLARK_OP_ADD :
+				  op == OP_NEG	? STARLARK_OP_SUB :
+						  STARLARK_OP_BITNOT,
+				  args[0], &result);
+	} else if (worth_folding(op, args[0], args[1])) {
+		// Constants are never lists, so x += y is just x + y.
+		const enum starlark_Op binop =
+			op == OP_INPLACE_ADD ? STARLARK_OP_ADD :
+					       (enum starlark_Op)(op - OP_ADD);
+		ret = Value_binary(binop, args[0], args[1], &result);
+	} else {
+		return false;
+	}
+
+	if (ret < 0) {
+		c->ctx->err = ret;
+	}
+
+	size_t len = 0;
+	if (ret != 0 || (Value_type(result) != STARLARK_TYPE_TUPLE &&
+			 Value_len(result, &len) && len > FOLD_MAX_LEN)) {
+		Value_release(result);
+		return false;
+	}
+
+	for (size_t j = first; j < i; j += 1) {
+		in[j].op = OP_NOP;
+	}
+
+	in[i].arg = 0;
+	if (Value_is_none(result)) {
+		in[i].op = OP_NONE;
+	} else if (Value_type(result) == STARLARK_TYPE_BOOL) {
+		in[i].op = Value_truth(result) ? OP_TRUE : OP_FALSE;
+	} else {
+		in[i].op = OP_CONSTANT;
+		in[i].arg = add_constant(c, result);
+	}
+
+	return true;
+}
+
+// Rewrites the pair of instructions at in, where in[1] isn't a jump target.
+// Returns whether anything changed.
+static bool peephole_pair(struct compiler *c, struct instr *in)
+{
+	struct function *f = c->f;
+	const uint8_t op = in[1].op;
+	if (in[0].op == OP_NOT &&
+	    (op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE)) {
+		in[0].op = OP_NOP;
+		in[1].op = op == OP_JUMP_IF_FALSE ? OP_JUMP_IF_TRUE :
+						    OP_JUMP_IF_FALSE;
+		return true;
+	}
+
+	if (in[0].op >= OP_EQ && in[0].op <= OP_GEQ &&
+	    op == OP_JUMP_IF_FALSE) {
+		in[1] = (struct instr){
+			.op = (uint8_t)(OP_JUMP_UNLESS_EQ + in[0].op - OP_EQ),
+			.arg = in[1].arg,
+			.start = in[0].start,
+		};
+		in[0].op = OP_NOP;
+		return true;
+	}
+
+	if (in[0].op == OP_CONSTANT) {
+		// x += y only differs from x + y when y is a list or tuple.
+		const enum starlark_Type t =
+			Value_type(f->constants[in[0].arg]);
+		uint8_t fused = OP_NOP;
+		if (op == OP_ADD || (op == OP_INPLACE_ADD &&
+				     t != STARLARK_TYPE_LIST &&
+				     t != STARLARK_TYPE_TUPLE)) {
+			fused = OP_ADD_CONSTANT;
+		} else if (op == OP_SUB) {
+			fused = OP_SUB_CONSTANT;
+		} else if (op == OP_INDEX) {
+			fused = OP_INDEX_CONSTANT;
+		}
+
+		if (fused != OP_NOP) {
+			in[1].op = fused;
+			in[1].arg = in[0].arg;
+			in[0].op = OP_NOP;
+			return true;
+		}
+	}
+
+	// A conditional jump on a constant always goes the same way.
+	struct starlark_Value v = { 0 };
+	if (constant_value(f, in[0], &v) && op >= OP_JUMP_IF_FALSE &&
+	    op <= OP_JUMP_IF_TRUE_OR_POP) {
+		const bool on_true =
+			op == OP_JUMP_IF_TRUE || op == OP_JUMP_IF_TRUE_OR_POP;
+		const bool pops =
+			op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE;
+		if (Value_truth(v) != on_true) {
+			// It never jumps, and only pops.
+			in[0].op = OP_NOP;
+			in[1].op = OP_NOP;
+		} else {
+			in[0].op = pops ? OP_NOP : in[0].op;
+			in[1].op = OP_JUMP;
+		}
+
+		return true;
+	}
+
+	if (is_pure_push(in[0].op) && op == OP_POP) {
+		in[0].op = OP_NOP;
+		in[1].op = OP_NOP;
+		return true;
+	}
+
+	// A variable which was just stored can't be unbound, so it doesn't
+	// need to be loaded again.
+	if ((in[0].op == OP_STORE_LOCAL && op == OP_LOAD_LOCAL) ||
+	    (in[0].op == OP_STORE_GLOBAL && op == OP_LOAD_GLOBAL)) {
+		if (in[0].arg == in[1].arg) {
+			in[1] = in[0];
+			in[0].op = OP_DUP;
+			in[0].arg = 0;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// When the context's vm is STARLARK_VM_REGISTER, the peephole optimizer also
+// turns the instructions which pass locals and constants through the stack to
+// an operator, or from one local to another, into a single register
+// instruction naming them. In either mode, it does so for a local which has a
+// constant added to or subtracted from it and is stored back to, so x += 1 is
+// one instruction rather than four. A local is only named once it's certainly
+// bound, so that reading it can't fail, which is found by following what each
+// path through the function stores to.
+
+// Returns the local the instruction in sets, or UINT32_MAX if it doesn't set
+// one.
+static uint32_t stored_local(struct compiler *c, const struct instr in)
+{
+	if (in.op == OP_STORE_LOCAL || in.op == OP_MOVE ||
+	    (in.op >= OP_ADD_REG && in.op <= OP_INPLACE_ADD_REG &&
+	     in.arg != locals_len(c))) {
+		return in.arg;
+	}
+
+	return UINT32_MAX;
+}
+
+static bool is_bound(const uint64_t *set, const uint32_t local)
+{
+	return set[local / 64] >> (local % 64) & 1;
+}
+
+// Removes every local which isn't in src from dst, which are sets of words
+// words.
+// Returns whether dst changed.
+static bool intersect(uint64_t *dst, const uint64_t *src, const size_t words)
+{
+	bool changed = false;
+	for (size_t i = 0; i < words; i += 1) {
+		changed = changed || (dst[i] & ~src[i]) != 0;
+		dst[i] &= src[i];
+	}
+
+	return changed;
+}
+
+// Fills in bound, which has room for a set of words words for each instruction
+// of the current function and one more, with the locals which are bound
+// whenever that instruction runs. The parameters are bound from the start,
+// and a local stays bound once it's been stored to, since nothing unbinds one.
+static void find_bound(struct compiler *c, uint64_t *bound, const size_t words)
+{
+	struct function *f = c->f;
+	const struct starlark_Code *code = &c->out->codes[f->index];
+	const uint32_t params = code->params_len + code->varargs + code->kwargs;
+	uint64_t *out = &bound[f->instrs_len * words];
+	memset(bound, 0xff, f->instrs_len * words * sizeof(bound[0]));
+	memset(bound, 0, words * sizeof(bound[0]));
+	for (uint32_t i = 0; i < params; i += 1) {
+		bound[i / 64] |= (uint64_t)1 << (i % 64);
+	}
+
+	// Each pass can only remove locals from the sets, so this stops.
+	for (bool changed = f->instrs_len != 0; changed;) {
+		changed = false;
+		for (size_t i = 0; i < f->instrs_len; i += 1) {
+			const struct instr in = f->instrs[i];
+			memcpy(out, &bound[i * words], words * sizeof(out[0]));
+			const uint32_t local = stored_local(c, in);
+			if (local != UINT32_MAX) {
+				out[local / 64] |= (uint64_t)1 << (local % 64);
+			}
+
+			const uint32_t target =
+				is_jump(in.op) ? f->labels[in.arg] : UINT32_MAX;
+			if (target < f->instrs_len) {
+				changed = intersect(&bound[target * words], out,
+						    words) ||
+					  changed;
+			}
+
+			if (in.op != OP_JUMP && in.op != OP_RETURN &&
+			    i + 1 < f->instrs_len) {
+				changed = intersect(&bound[(i + 1) * words],
+						    out, words) ||
+					  changed;
+			}
+		}
+	}
+}
+
+// Stores the source naming the value instruction i of the current function
+// pushes in *out, if it's a constant or a local which is bound there.
+static bool source(struct compiler *c, const uint64_t *bound,
+		   const size_t words, const size_t i, uint32_t *out)
+{
+	const struct instr in = c->f->instrs[i];
+	if (in.op == OP_CONSTANT) {
+		*out = locals_len(c) + in.arg;
+		return true;
+	}
+
+	if (in.op == OP_LOAD_LOCAL && is_bound(&bound[i * words], in.arg)) {
+		*out = in.arg;
+		return true;
+	}
+
+	return false;
+}
+
+// Turns the instructions starting at i of the current function into a
+// register instruction, where none of them but the first are jump targets, and
+// bound is filled in by find_bound.
+// Returns whether anything changed.
+static bool to_register(struct compiler *c, const bool *targets,
+			const uint64_t *bound, const size_t words,
+			const size_t i)
+{
+	struct function *f = c->f;
+	struct instr *in = &f->instrs[i];
+	const size_t left = f->instrs_len - i;
+	uint32_t a = 0;
+	uint32_t b = 0;
+	if (left < 2 || targets[i + 1] || !source(c, bound, words, i, &a)) {
+		return false;
+	}
+
+	const bool registers = c->ctx->vm == STARLARK_VM_REGISTER;
+	if (registers && in[1].op == OP_STORE_LOCAL) {
+		in[1] = (struct instr){
+			.op = OP_MOVE,
+			.arg = in[1].arg,
+			.regs = { a },
+			.start = in[1].start,
+		};
+		in[0].op = OP_NOP;
+		return true;
+	}
+
+	// The number of instructions the operator and its sources take up.
+	size_t n = 0;
+	uint8_t op = OP_NOP;
+	if (in[1].op == OP_ADD_CONSTANT || in[1].op == OP_SUB_CONSTANT) {
+		b = locals_len(c) + in[1].arg;
+		op = Opcode_base[in[1].op];
+		n = 2;
+	} else if (left >= 3 && !targets[i + 2] &&
+		   source(c, bound, words, i + 1, &b) &&
+		   ((in[2].op >= OP_ADD && in[2].op <= OP_INPLACE_ADD) ||
+		    (in[2].op >= OP_JUMP_UNLESS_EQ &&
+		     in[2].op <= OP_JUMP_UNLESS_GEQ))) {
+		op = in[2].op;
+		n = 3;
+	}
+
+	if (n == 0) {
+		return false;
+	}
+
+	const bool next = n < left && !targets[i + n];
+	if (!registers &&
+	    (in[0].op != OP_LOAD_LOCAL || b < locals_len(c) ||
+	     (op != OP_ADD && op != OP_SUB && op != OP_INPLACE_ADD) || !next ||
+	     in[n].op != OP_STORE_LOCAL || in[n].arg != a)) {
+		return false;
+	}
+
+	// A comparison which is only jumped on becomes a conditional jump, and
+	// the result of anything else is stored straight into the local it's
+	// stored to next, if there is one.
+	struct instr result = {
+		.arg = locals_len(c),
+		.regs = { a, b },
+		.start = in[n - 1].start,
+	};
+	if (op >= OP_JUMP_UNLESS_EQ && op <= OP_JUMP_UNLESS_GEQ) {
+		result.op = (uint8_t)(OP_JUMP_UNLESS_EQ_REG + op -
+				      OP_JUMP_UNLESS_EQ);
+		result.arg = in[n - 1].arg;
+	} else if (op >= OP_EQ && op <= OP_GEQ && next &&
+		   in[n].op == OP_JUMP_IF_FALSE) {
+		result.op = (uint8_t)(OP_JUMP_UNLESS_EQ_REG + op - OP_EQ);
+		result.arg = in[n].arg;
+		n += 1;
+	} else {
+		result.op = (uint8_t)(OP_ADD_REG + op - OP_ADD);
+		if (next && in[n].op == OP_STORE_LOCAL) {
+			result.arg = in[n].arg;
+			n += 1;
+		}
+	}
+
+	for (size_t j = 0; j + 1 < n; j += 1) {
+		in[j].op = OP_NOP;
+	}
+
+	in[n - 1] = result;
+	return true;
+}
+
+// Makes one pass of the peephole optimizer over the current function, where
+// targets has room for a flag for each of its instructions and one more, and
+// index and bound have room for as many offsets and sets of words words for
+// find_bound.
+// Returns whether anything changed.
+static bool peephole_pass(struct compiler *c, bool *targets, uint32_t *index,
+			  uint64_t *bound, const size_t words)
+{
+	struct function *f = c->f;
+	struct instr *in = f->instrs;
+	const size_t len = f->instrs_len;
+	memset(targets, 0, (len + 1) * sizeof(targets[0]));
+	for (size_t i = 0; i < len; i += 1) {
+		if (is_jump(in[i].op)) {
+			targets[f->labels[in[i].arg]] = true;
+		}
+	}
+
+	// Folding goes first, so that constants are all folded before any of
+	// them are fused into superinstructions.
+	bool changed = false;
+	for (size_t i = 0; i < len && !c->ctx->err; i += 1) {
+		changed = fold(c, targets, i) || changed;
+	}
+
+	find_bound(c, bound, words);
+
+	for (size_t i = 0; i < len && !c->ctx->err; i += 1) {
+		if (is_jump(in[i].op)) {
+			uint8_t op = in[i].op;
+			const uint32_t label = thread_jump(c, &op, in[i].arg);
+			if (op != in[i].op || label != in[i].arg) {
+				in[i].op = op;
+				in[i].arg = label;
+				targets[f->labels[label]] = true;
+				changed = true;
+			}
+		}
+
+		if (in[i].op == OP_JUMP && f->labels[in[i].arg] == i + 1) {
+			in[i].op = OP_NOP;
+			changed = true;
+			continue;
+		}
+
+		// Nothing reaches the instructions after an unconditional jump
+		// until the next jump target.
+		if (in[i].op == OP_JUMP || in[i].op == OP_RETURN) {
+			for (size_t j = i + 1; j < len && !targets[j]; j += 1) {
+				changed = changed || in[j].op != OP_NOP;
+				in[j].op = OP_NOP;
+			}
+
+			continue;
+		}
+
+		if (i + 1 == len || targets[i + 1] || in[i].op == OP_NOP) {
+			continue;
+		}
+
+		// A conditional jump over an unconditional one is the opposite
+		// conditional jump to where that one goes.
+		if ((in[i].op == OP_JUMP_IF_FALSE ||
+		     in[i].op == OP_JUMP_IF_TRUE) &&
+		    in[i + 1].op == OP_JUMP && f->labels[in[i].arg] == i + 2) {
+			in[i].op = in[i].op == OP_JUMP_IF_FALSE ?
+					   OP_JUMP_IF_TRUE :
+					   OP_JUMP_IF_FALSE;
+			in[i].arg = in[i + 1].arg;
+			in[i + 1].op = OP_NOP;
+			changed = true;
+			continue;
+		}
+
+		if (to_register(c, targets, bound, words, i)) {
+			changed = true;
+			continue;
+		}
+
+		changed = peephole_pair(c, &in[i]) || changed;
+	}
+
+	// Remove the deleted instructions, moving the labels placed at them
+	// to the next instruction which is left.
+	size_t n = 0;
+	for (size_t i = 0; i < len; i += 1) {
+		index[i] = (uint32_t)n;
+		if (in[i].op != OP_NOP) {
+			in[n] = in[i];
+			n += 1;
+		}
+	}
+
+	index[len] = (uint32_t)n;
+	for (size_t l = 0; l < f->labels_len; l += 1) {
+		if (f->labels[l] != UINT32_MAX) {
+			f->labels[l] = index[f->labels[l]];
+		}
+	}
+
+	f->instrs_len = n;
+	return changed;
+}
+
+// Returns whether op's operand is an index into the constants.
+static bool uses_constant(const uint8_t op)
+{
+	return op == OP_CONSTANT || op == OP_ADD_CONSTANT ||
+	       op == OP_SUB_CONSTANT || op == OP_INDEX_CONSTANT;
+}
+
+// Removes the constants of the current function which no instruction uses
+// anymore, such as the operands of folded instructions, where index has room
+// for an offset for each constant.
+static void prune_constants(struct compiler *c, uint32_t *index)
+{
+	struct function *f = c->f;
+	for (size_t i = 0; i < f->constants_len; i += 1) {
+		index[i] = UINT32_MAX;
+	}
+
+	const uint32_t locals = locals_len(c);
+	for (size_t i = 0; i < f->instrs_len; i += 1) {
+		const struct instr in = f->instrs[i];
+		if (uses_constant(in.op)) {
+			index[in.arg] = 0;
+		}
+
+		for (uint8_t j = 0; j < Opcode_regs[in.op]; j += 1) {
+			if (in.regs[j] >= locals) {
+				index[in.regs[j] - locals] = 0;
+			}
+		}
+	}
+
+	size_t n = 0;
+	for (size_t i = 0; i < f->constants_len; i += 1) {
+		if (index[i] == UINT32_MAX) {
+			Value_release(f->constants[i]);
+			continue;
+		}
+
+		index[i] = (uint32_t)n;
+		f->constants[n] = f->constants[i];
+		n += 1;
+	}
+
+	f->constants_len = n;
+	for (size_t i = 0; i < f->instrs_len; i += 1) {
+		struct instr *in = &f->instrs[i];
+		if (uses_constant(in->op)) {
+			in->arg = index[in->arg];
+		}
+
+		for (uint8_t j = 0; j < Opcode_regs[in->op]; j += 1) {
+			const uint32_t r = in->regs[j];
+			if (r >= locals) {
+				in->regs[j] = locals + index[r - locals];
+			}
+		}
+	}
+}
+
+// Runs the peephole optimizer over the current function.
+static void optimize(struct compiler *c)
+{
+	struct function *f = c->f;
+	const size_t words = (locals_len(c) + 63) / 64;
+	bool *targets = malloc((f->instrs_len + 1) * sizeof(targets[0]));
+	uint32_t *index = malloc((f->instrs_len + 1) * sizeof(index[0]));
+	uint64_t *bound = malloc((f->instrs_len + 1) * MAX(words, 1) *
+				 sizeof(bound[0]));
+	if (targets == NULL || index == NULL || bound == NULL) {
+		free(targets);
+		free(index);
+		free(bound);
+		c->ctx->err = STARLARK_ERROR_OOM;
+		return;
+	}
+
+	for (int i = 0; i < PEEPHOLE_MAX_PASSES && !c->ctx->err; i += 1) {
+		if (!peephole_pass(c, targets, index, bound, words)) {
+			break;
+		}
+	}
+
+	free(targets);
+	free(index);
+	free(bound);
+	index = malloc(MAX(f->constants_len, 1) * sizeof(index[0]));
+	if (index == NULL) {
+		c->ctx->err = STARLARK_ERROR_OOM;
+		return;
+	}
+
+	prune_constants(c, index);
+	free(index);
+}
+
+// Returns the most values f ever has on its stack, by following the height of
+// the stack through every instruction. Since loops are only ever entered from
+// the top, each instruction is reached by a jump or falling through from the
+// instruction before it before a backwards jump can reach it.
+static uint32_t max_stack(struct compiler *c, struct function *f)
+{
+	int64_t *depths = malloc((f->instrs_len + 1) * sizeof(depths[0]));
+	if (depths == NULL) {
+		c->ctx->err = STARLARK_ERROR_OOM;
+		return 0;
+	}
+
+	for (size_t i = 0; i <= f->instrs_len; i += 1) {
+		depths[i] = -1;
+	}
+
+	depths[0] = 0;
+	int64_t result = 0;
+	for (size_t i = 0; i < f->instrs_len; i += 1) {
+		if (depths[i] < 0) {
+			// Nothing reaches this instruction.
+			continue;
+		}
+
+		const struct instr in = f->instrs[i];
+		const int64_t after = depths[i] + stack_effect(c, in);
+		result = MAX(result, MAX(after, depths[i]));
+		if (in.op == OP_ADD_CONSTANT || in.op == OP_SUB_CONSTANT ||
+		    in.op == OP_INDEX_CONSTANT) {
+			// These push their constant if they fail, so that it's
+			// reported like it would be without them.
+			result = MAX(result, depths[i] + 1);
+		} else if (Opcode_regs[in.op] == 2) {
+			// Likewise, these push both of their sources.
+			result = MAX(result, depths[i] + 2);
+		}
+
+		if (is_jump(in.op)) {
+			int64_t taken = depths[i];
+			if (in.op == OP_JUMP_IF_FALSE ||
+			    in.op == OP_JUMP_IF_TRUE || in.op == OP_FOR_ITER) {
+				taken -= 1;
+			} else if (in.op >= OP_JUMP_UNLESS_EQ &&
+				   in.op <= OP_JUMP_UNLESS_GEQ) {
+				taken -= 2;
+			}
+
+			const uint32_t target = f->labels[in.arg];
+			assert(depths[target] < 0 || depths[target] == taken);
+			depths[target] = taken;
+		}
+
+		if (in.op != OP_JUMP && in.op != OP_RETURN) {
+			depths[i + 1] = after;
+		}
+	}
+
+	free(depths);
+	return (uint32_t)result;
+}
+
+static size_t varint_len(uint64_t v)
+{
+	size_t result = 1;
+	while (v >= 0x80) {
+		v >>= 7;
+		result += 1;
+	}
+
+	return result;
+}
+
+static uint8_t *varint_put(uint8_t *out, uint64_t v)
+{
+	while (v >= 0x80) {
+		*out = (uint8_t)(v | 0x80);
+		out += 1;
+		v >>= 7;
+	}
+
+	*out = (uint8_t)v;
+	return out + 1;
+}
+
+static uint64_t varint64_read(const uint8_t **p)
+{
+	uint64_t result = 0;
+	for (int shift = 0;; shift += 7) {
+		const uint8_t byte = **p;
+		*p += 1;
+		result |= (uint64_t)(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0) {
+			return result;
+		}
+	}
+}
+
+static uint64_t zigzag(const int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(const uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+// Returns the operand instruction i of f is encoded with, given where each
+// instruction starts.
+static uint32_t encoded_arg(const struct function *f, const size_t *offsets,
+			    const size_t i)
+{
+	const struct instr in = f->instrs[i];
+	if (is_jump(in.op)) {
+		return (uint32_t)offsets[f->labels[in.arg]];
+	}
+
+	return in.arg;
+}
+
+// Appends an entry to the line table at lines saying the code from offset pc
+// on was compiled from pos, where *line_pc and *line_pos are those of the entry
+// before it, and are updated to pc and pos.
+// Returns where the next entry goes.
+static uint8_t *line_put(uint8_t *lines, size_t *line_pc, size_t *line_pos,
+			 const size_t pc, const size_t pos)
+{
+	lines = varint_put(lines, pc - *line_pc);
+	lines = varint_put(lines, zigzag((int64_t)pos - (int64_t)*line_pos));
+	*line_pc = pc;
+	*line_pos = pos;
+	return lines;
+}
+
+// Encodes the instructions of f into code, along with the table of their
+// source positions.
+static void encode(struct compiler *c, struct function *f,
+		   struct starlark_Code *code)
+{
+	// A jump's operand is the offset of its target, whose varint might
+	// need more bytes once the code before it has grown, so the offsets
+	// are recomputed until none of them change. They only ever grow, so
+	// this always stops.
+	size_t *offsets = calloc(f->instrs_len + 1, sizeof(offsets[0]));
+	if (offsets == NULL) {
+		c->ctx->err = STARLARK_ERROR_OOM;
+		return;
+	}
+
+	for (bool changed = true; changed;) {
+		changed = false;
+		size_t pos = 0;
+		for (size_t i = 0; i <= f->instrs_len; i += 1) {
+			changed = changed || offsets[i] != pos;
+			offsets[i] = pos;
+			if (i == f->instrs_len) {
+				break;
+			}
+
+			const struct instr in = f->instrs[i];
+			pos += 1;
+			if (Opcode_has_arg[in.op]) {
+				pos += varint_len(encoded_arg(f, offsets, i));
+			}
+
+			for (uint8_t j = 0; j < Opcode_regs[in.op]; j += 1) {
+				pos += varint_len(in.regs[j]);
+			}
+		}
+	}
+
+	const size_t code_len = offsets[f->instrs_len];
+	if (code_len > UINT32_MAX) {
+		free(offsets);
+		c->ctx->err = STARLARK_ERROR_TOOBIG;
+		return;
+	}
+
+	// Each instruction has at most two entries in the line table, which
+	// are at most two varints of 10 bytes.
+	code->code = malloc(MAX(code_len, 1));
+	code->lines = malloc(MAX(f->instrs_len * 40, 1));
+	if (code->code == NULL || code->lines == NULL) {
+		free(offsets);
+		c->ctx->err = STARLARK_ERROR_OOM;
+		return;
+	}
+
+	uint8_t *out = code->code;
+	uint8_t *lines = code->lines;
+	size_t line_pc = 0;
+	size_t line_pos = 0;
+	for (size_t i = 0; i < f->instrs_len; i += 1) {
+		const struct instr in = f->instrs[i];
+		*out = in.op;
+		out += 1;
+		if (Opcode_has_arg[in.op]) {
+			out = varint_put(out, encoded_arg(f, offsets, i));
+		}
+
+		for (uint8_t j = 0; j < Opcode_regs[in.op]; j += 1) {
+			out = varint_put(out, in.regs[j]);
+		}
+
+		if (i == 0 || in.start != line_pos) {
+			lines = line_put(lines, &line_pc, &line_pos, offsets[i],
+					 in.start);
+		}
+
+		if (in.op == OP_CALL_METHOD && in.attr_start != line_pos) {
+			lines = line_put(lines, &line_pc, &line_pos,
+					 offsets[i] + 1, in.attr_start);
+		}
+	}
+
+	code->code_len = code_len;
+	code->lines_len = (size_t)(lines - code->lines);
+	free(offsets);
+}
+
+// Fills in what a call needs to know about the parameters of the function
+// node, which is a STARLARK_NODE_FUNCTION or STARLARK_NODE_LAMBDA.
+static void describe_params(struct compiler *c, const uint32_t node,
+			    struct starlark_Code *code)
+{
+	const union starlark_AstNode n = *node_at(c, node);
+	uint32_t named = 0;
+	for (uint32_t i = 0; i < n.as_func.params_len; i += 1) {
+		if (tag_at(c, child(c, n.as_func.params, i)) ==
+		    STARLARK_NODE_PARAM) {
+			named += 1;
+		}
+	}
+
+	code->param_names = calloc(MAX(named, 1), sizeof(code->param_names[0]));
+	code->defaults = calloc(MAX(named, 1), sizeof(code->defaults[0]));
+	if (code->param_names == NULL || code->defaults == NULL) {
+		c->ctx->err = STARLARK_ERROR_OOM;
+		return;
+	}
+
+	bool after_star = false;
+	for (uint32_t i = 0; i < n.as_func.params_len; i += 1) {
+		const uint32_t param = child(c, n.as_func.params, i);
+		const union starlark_AstNode *p = node_at(c, param);
+		switch (tag_at(c, param)) {
+		case STARLARK_NODE_PARAM_STAR:
+			after_star = true;
+			code->varargs =
+				p->as_unary.operand != STARLARK_NODE_NONE;
+			continue;
+		case STARLARK_NODE_PARAM_STARSTAR:
+			code->kwargs = true;
+			continue;
+		default:
+			break;
+		}
+
+		const int64_t name =
+			node_at(c, p->as_binary.lhs)->as_identifier.name;
+		const char *str = strpool_get(&c->ctx->strpool, name);
+		const struct starlark_Value v = Value_str(strlen(str), str);
+		if (Value_is_none(v)) {
+			c->ctx->err = STARLARK_ERROR_OOM;
+			return;
+		}
+
+		code->param_names[code->params_len] = v;
+		code->defaults[code->params_len] = UINT32_MAX;
+		if (p->as_binary.rhs != STARLARK_NODE_NONE) {
+			code->defaults[code->params_len] = code->defaults_len;
+			code->defaults_len += 1;
+		}
+
+		code->params_len += 1;
+		code->kwonly_len += after_star ? 1 : 0;
+	}
+}
+
+// Turns the compiled function f into code, whose function node is node, or
+// STARLARK_NODE_NONE for the top level.
+static void finish_function(struct compiler *c, struct function *f,
+			    const uint32_t node, const int64_t name)
+{
+	const struct starlark_ResolvedFunction *rf = &c->r->functions[f->index];
+	struct starlark_Code *code = &c->out->codes[f->index];
+	code->name = name;
+	code->start = node == STARLARK_NODE_NONE ? 0 : c->p->ast.starts[node];
+	code->locals_len = rf->locals_len;
+	optimize(c);
+	code->max_stack = max_stack(c, f);
+	code->loops_len = (uint32_t)f->loops_max;
+	encode(c, f, code);
+
+	code->constants_len = f->constants_len;
+	code->constants = f->constants;
+	f->constants = NULL;
+	code->names_len = f->names_len;
+	code->names = f->names;
+	f->names = NULL;
+	code->attr_caches = calloc(MAX(f->names_len, 1),
+				   sizeof(code->attr_caches[0]));
+	code->jit = calloc(1, sizeof(*code->jit));
+	if (code->attr_caches == NULL || code->jit == NULL) {
+		c->ctx->err = STARLARK_ERROR_OOM;
+		return;
+	}
+
+	code->cells = malloc(MAX(rf->cells_len, 1) * sizeof(code->cells[0]));
+	code->frees = malloc(MAX(rf->frees_len, 1) * sizeof(code->frees[0]));
+	code->local_names = malloc(MAX(rf->locals_len, 1) *
+				   sizeof(code->local_names[0]));
+	if (code->cells == NULL || code->frees == NULL ||
+	    code->local_names == NULL) {
+		c->ctx->err = STARLARK_ERROR_OOM;
+		return;
+	}
+
+	if (rf->locals_len != 0) {
+		memcpy(code->local_names, &c->r->local_names[rf->locals_start],
+		       rf->locals_len * sizeof(code->local_names[0]));
+	}
+
+	code->cells_len = rf->cells_len;
+	if (rf->cells_len != 0) {
+		memcpy(code->cells, &c->r->cells[rf->cells_start],
+		       rf->cells_len * sizeof(code->cells[0]));
+	}
+
+	code->frees_len = rf->frees_len;
+	if (rf->frees_len != 0) {
+		memcpy(code->frees, &c->r->frees[rf->frees_start],
+		       rf->frees_len * sizeof(code->frees[0]));
+	}
+}
+
+// Starts compiling the function at index into f, with the arrays most recently
+// put back in c's scratch, if there are any.
+static void function_init(struct compiler *c, struct function *f,
+			  const uint32_t index)
+{
+	*f = (struct function){ .index = index };
+	struct starlark_CompileScratch *s = c->scratch;
+	if (s->len == 0) {
+		return;
+	}
+
+	s->len -= 1;
+	const struct function_arrays a = s->arrays[s->len];
+	f->instrs_cap = a.instrs_cap;
+	f->instrs = a.instrs;
+	f->labels_cap = a.labels_cap;
+	f->labels = a.labels;
+	f->loops_cap = a.loops_cap;
+	f->loops = a.loops;
+}
+
+static void function_free(struct compiler *c, struct function *f)
+{
+	for (size_t i = 0; i < f->constants_len && f->constants != NULL;
+	     i += 1) {
+		Value_release(f->constants[i]);
+	}
+
+	free(f->constants);
+	free(f->names);
+
+	// The other arrays go back to c's scratch, unless it can't hold them.
+	struct starlark_CompileScratch *s = c->scratch;
+	if (s->len == s->cap) {
+		const size_t cap = (s->cap + 4) * 2;
+		struct function_arrays *arrays =
+			realloc(s->arrays, cap * sizeof(arrays[0]));
+		if (arrays == NULL) {
+			free(f->instrs);
+			free(f->labels);
+			free(f->loops);
+			return;
+		}
+
+		s->arrays = arrays;
+		s->cap = cap;
+	}
+
+	s->arrays[s->len] = (struct function_arrays){
+		.instrs_cap = f->instrs_cap,
+		.instrs = f->instrs,
+		.labels_cap = f->labels_cap,
+		.labels = f->labels,
+		.loops_cap = f->loops_cap,
+		.loops = f->loops,
+	};
+	s->len += 1;
+}
+
+// Compiles the body of the function node into its own code, then emits the
+// instructions creating it in the enclosing function. The default values of
+// its parameters are evaluated in the enclosing function, in order.
+static void compile_function(struct compiler *c, const uint32_t node,
+			     const int64_t name)
+{
+	const union starlark_AstNode n = *node_at(c, node);
+	for (uint32_t i = 0; i < n.as_func.params_len; i += 1) {
+		const uint32_t param = child(c, n.as_func.params, i);
+		if (tag_at(c, param) == STARLARK_NODE_PARAM) {
+			compile_expr(c, node_at(c, param)->as_binary.rhs);
+		}
+	}
+
+	if (c->ctx->err) {
+		return;
+	}
+
+	struct function *parent = c->f;
+	struct function f;
+	function_init(c, &f, n.as_func.function);
+	c->f = &f;
+	describe_params(c, node, &c->out->codes[f.index]);
+	if (tag_at(c, node) == STARLARK_NODE_LAMBDA) {
+		compile_expr(c, n.as_func.body);
+	} else {
+		compile_stmt(c, n.as_func.body);
+		emit(c, OP_NONE, 0, node);
+	}
+
+	emit(c, OP_RETURN, 0, node);
+	if (!c->ctx->err) {
+		finish_function(c, &f, node, name);
+	}
+
+	function_free(c, &f);
+	c->f = parent;
+	emit(c, OP_MAKE_FUNCTION, n.as_func.function, node);
+}
+
+int compile(struct starlark_Context *ctx, struct starlark_Parser *p,
+	    const struct starlark_Resolver *r,
+	    struct starlark_CompileScratch *scratch,
+	    struct starlark_Program *out)
+{
+	assert(ctx != NULL);
+	assert(p != NULL);
+	assert(r != NULL);
+	assert(scratch != NULL);
+	assert(out != NULL);
+
+	*out = (struct starlark_Program){ 0 };
+	struct compiler c = {
+		.ctx = ctx,
+		.p = p,
+		.r = r,
+		.scratch = scratch,
+		.out = out,
+	};
+
+	out->codes = calloc(r->functions_len, sizeof(out->codes[0]));
+	out->globals = malloc(MAX(r->globals_len, 1) * sizeof(out->globals[0]));
+	if (out->codes == NULL || out->globals == NULL) {
+		Program_finish(out);
+		ctx->err = STARLARK_ERROR_OOM;
+		return ctx->err;
+	}
+
+	out->codes_len = r->functions_len;
+	out->globals_len = r->globals_len;
+	if (r->globals_len != 0) {
+		memcpy(out->globals, r->globals,
+		       r->globals_len * sizeof(out->globals[0]));
+	}
+
+	const int64_t name = strpool_add(&ctx->strpool, strlen(u8"<toplevel>"),
+					 u8"<toplevel>");
+	if (name < 0) {
+		Program_finish(out);
+		ctx->err = STARLARK_ERROR_OOM;
+		return ctx->err;
+	}
+
+	struct function f;
+	function_init(&c, &f, 0);
+	c.f = &f;
+	compile_stmt(&c, p->root);
+	emit(&c, OP_NONE, 0, p->root);
+	emit(&c, OP_RETURN, 0, p->root);
+	if (!ctx->err) {
+		finish_function(&c, &f, STARLARK_NODE_NONE, name);
+	}
+
+	function_free(&c, &f);
+	if (ctx->err) {
+		Program_finish(out);
+		return ctx->err;
+	}
+
+	return 0;
+}
+
+void CompileScratch_finish(struct starlark_CompileScratch *s)
+{
+	if (s == NULL) {
+		return;
+	}
+
+	for (size_t i = 0; i < s->len; i += 1) {
+		free(s->arrays[i].instrs);
+		free(s->arrays[i].labels);
+		free(s->arrays[i].loops);
+	}
+
+	free(s->arrays);
+	*s = (struct starlark_CompileScratch){ 0 };
+}
+
+void Program_finish(struct starlark_Program *prog)
+{
+	if (prog == NULL) {
+		return;
+	}
+
+	for (size_t i = 0; i < prog->codes_len; i += 1) {
+		struct starlark_Code *code = &prog->codes[i];
+		for (size_t j = 0; j < code->constants_len; j += 1) {
+			Value_release(code->constants[j]);
+		}
+
+		for (size_t j = 0; j < code->params_len; j += 1) {
+			Value_release(code->param_names[j]);
+		}
+
+		free(code->code);
+		free(code->constants);
+		free(code->names);
+		free(code->attr_caches);
+		Jit_finish(code->jit);
+		free(code->jit);
+		free(code->lines);
+		free(code->param_names);
+		free(code->defaults);
+		free(code->cells);
+		free(code->frees);
+		free(code->local_names);
+	}
+
+	free(prog->codes);
+	free(prog->globals);
+	*prog = (struct starlark_Program){ 0 };
+}
+
+size_t Code_position(const struct starlark_Code *code, const size_t pc)
+{
+	assert(code != NULL);
+
+	const uint8_t *p = code->lines;
+	const uint8_t *end = code->lines + code->lines_len;
+	size_t at = 0;
+	size_t pos = 0;
+	while (p < end) {
+		const uint64_t delta = varint64_read(&p);
+		if (at + delta > pc) {
+			break;
+		}
+
+		at += delta;
+		pos = (size_t)((int64_t)pos + unzigzag(varint64_read(&p)));
+	}
+
+	return pos;
+}
+
+// Prints a constant the way it's written in starlark source.
+static void constant_dump(const struct starlark_Value v, FILE *f)
+{
+	if (Value_type(v) == STARLARK_TYPE_TUPLE) {
+		const struct starlark_Tuple *t = (void *)Value_as_object(v);
+		fputc('(', f);
+		for (size_t i = 0; i < t->len; i += 1) {
+			fputs(i == 0 ? "" : ", ", f);
+			constant_dump(t->items[i], f);
+		}
+		fputs(t->len == 1 ? ",)" : ")", f);
+		return;
+	}
+
+	if (Value_type(v) != STARLARK_TYPE_STRING) {
+		Value_dump(v, f);
+		return;
+	}
+
+	const struct starlark_Str *s = (void *)Value_as_object(v);
+	const char *data = Str_data(s);
+	fputc('"', f);
+	for (size_t i = 0; i < Str_len(s); i += 1) {
+		switch (data[i]) {
+		case '"':
+		case '\\':
+			fprintf(f, "\\%c", data[i]);
+			break;
+		case '\n':
+			fputs("\\n", f);
+			break;
+		case '\t':
+			fputs("\\t", f);
+			break;
+		default:
+			fputc(data[i], f);
+			break;
+		}
+	}
+	fputc('"', f);
+}
+
+// Prints what the operand of the instruction at pc refers to, if anything.
+static void operand_dump(struct starlark_Context *ctx,
+			 const struct starlark_Program *prog,
+			 const struct starlark_Code *code, const uint8_t op,
+			 const uint32_t arg, FILE *f)
+{
+	struct starlark_Strpool *pool = &ctx->strpool;
+	switch (op) {
+	case OP_CONSTANT:
+	case OP_ADD_CONSTANT:
+	case OP_SUB_CONSTANT:
+	case OP_INDEX_CONSTANT:
+		fputs("  ; ", f);
+		constant_dump(code->constants[arg], f);
+		break;
+	case OP_LOAD_GLOBAL:
+	case OP_STORE_GLOBAL:
+		fprintf(f, "  ; %s", strpool_get(pool, prog->globals[arg]));
+		break;
+	case OP_LOAD_FREE:
+		fprintf(f, "  ; %s", strpool_get(pool, code->frees[arg].name));
+		break;
+	case OP_LOAD_BUILTIN:
+		fprintf(f, "  ; %s", Builtin_names[arg]);
+		break;
+	case OP_ATTR:
+	case OP_SET_ATTR:
+		fprintf(f, "  ; %s", strpool_get(pool, code->names[arg]));
+		break;
+	case OP_CALL_METHOD:
+		fprintf(f,
+			"  ; %s, %" PRIu32 " positional, %" PRIu32 " named",
+			strpool_get(pool, code->names[METHOD_NAME(arg)]),
+			CALL_POSITIONAL(arg), CALL_NAMED(arg));
+		break;
+	case OP_MAKE_FUNCTION:
+		fprintf(f, "  ; %s", strpool_get(pool, prog->codes[arg].name));
+		break;
+	case OP_CALL:
+		fprintf(f, "  ; %" PRIu32 " positional, %" PRIu32 " named",
+			CALL_POSITIONAL(arg), CALL_NAMED(arg));
+		if (arg >> 16 & CALL_VARARGS) {
+			fputs(", *args", f);
+		}
+		if (arg >> 16 & CALL_KWARGS) {
+			fputs(", **kwargs", f);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+// Prints the constants among the sources of a register instruction.
+static void sources_dump(const struct starlark_Code *code, const uint8_t op,
+			 const uint32_t *regs, FILE *f)
+{
+	const char *sep = "  ; ";
+	for (uint8_t i = 0; i < Opcode_regs[op]; i += 1) {
+		if (regs[i] < code->locals_len) {
+			continue;
+		}
+
+		fputs(sep, f);
+		constant_dump(code->constants[regs[i] - code->locals_len], f);
+		sep = ", ";
+	}
+}
+
+static void code_dump(struct starlark_Context *ctx,
+		      const struct starlark_Program *prog,
+		      const struct starlark_Code *code,
+		      const struct LineIndex *lines, FILE *f)
+{
+	struct starlark_Strpool *pool = &ctx->strpool;
+	fprintf(f, "function %s\n", strpool_get(pool, code->name));
+	fprintf(f,
+		"  params %" PRIu32 ", kwonly %" PRIu32 ", locals %" PRIu32
+		", stack %" PRIu32 "%s%s\n",
+		code->params_len, code->kwonly_len, code->locals_len,
+		code->max_stack, code->varargs ? ", *args" : "",
+		code->kwargs ? ", **kwargs" : "");
+
+	if (code->cells_len != 0) {
+		fputs("  cells", f);
+		for (size_t i = 0; i < code->cells_len; i += 1) {
+			fprintf(f, " %" PRIu32, code->cells[i]);
+		}
+		fputc('\n', f);
+	}
+
+	for (size_t i = 0; i < code->frees_len; i += 1) {
+		const struct starlark_FreeVar fv = code->frees[i];
+		fprintf(f, "  free %zu %s from %s %" PRIu32 "\n", i,
+			strpool_get(pool, fv.name),
+			fv.scope == STARLARK_SCOPE_CELL ? "cell" : "free",
+			fv.index);
+	}
+
+	size_t last_line = 0;
+	const uint8_t *pc = code->code;
+	const uint8_t *end = code->code + code->code_len;
+	while (pc < end) {
+		const size_t offset = (size_t)(pc - code->code);
+		const size_t line = lineindex_lineno(
+			lines, Code_position(code, offset), NULL);
+		if (line != last_line) {
+			fprintf(f, "%4zu", line);
+			last_line = line;
+		} else {
+			fputs("    ", f);
+		}
+
+		const uint8_t op = *pc;
+		pc += 1;
+		fprintf(f, " %6zu %s", offset, Opcode_names[op]);
+		if (!Opcode_has_arg[op]) {
+			fputc('\n', f);
+			continue;
+		}
+
+		const uint32_t arg = varint_read(&pc);
+		fprintf(f, " %" PRIu32, arg);
+		uint32_t regs[2] = { 0 };
+		for (uint8_t j = 0; j < Opcode_regs[op]; j += 1) {
+			regs[j] = varint_read(&pc);
+			fprintf(f, " %" PRIu32, regs[j]);
+		}
+
+		if (Opcode_regs[op] != 0) {
+			sources_dump(code, op, regs, f);
+		} else {
+			operand_dump(ctx, prog, code, op, arg, f);
+		}
+		fputc('\n', f);
+	}
+}
+
+void Program_dump(struct starlark_Context *ctx,
+		  const struct starlark_Program *prog, FILE *f)
+{
+	assert(ctx != NULL);
+	assert(prog != NULL);
+
+	struct LineIndex lines = { 0 };
+	if (!lineindex_init(&lines, ctx->src_len, ctx->src)) {
+		fprintf(f, "out of memory\n");
+		return;
+	}
+
+	for (size_t i = 0; i < prog->codes_len; i += 1) {
+		if (i != 0) {
+			fputc('\n', f);
+		}
+
+		code_dump(ctx, prog, &prog->codes[i], &lines, f);
+	}
+
+	lineindex_finish(&lines);
+}
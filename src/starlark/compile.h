@@ -0,0 +1,413 @@
+#ifndef STARLARK_COMPILE_H
+#define STARLARK_COMPILE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "starlark/common.h"
+#include "starlark/parse.h"
+#include "starlark/resolve.h"
+#include "starlark/value.h"
+
+// The instructions of the bytecode. Each is a single byte, followed by an
+// operand encoded as a varint if Opcode_has_arg says it has one.
+//
+// The comment on each shows what it does to the operand stack, with the top of
+// the stack on the right.
+enum Opcode {
+	OP_NOP = 0,
+	// x -> .
+	OP_POP,
+	// x -> x x
+	OP_DUP,
+	// x y -> x y x y
+	OP_DUP2,
+	// x y -> y x
+	OP_EXCH,
+	// . -> None
+	OP_NONE,
+	// . -> True
+	OP_TRUE,
+	// . -> False
+	OP_FALSE,
+	// . -> constants[arg]
+	OP_CONSTANT,
+
+	// . -> locals[arg]
+	OP_LOAD_LOCAL,
+	// x -> ., setting locals[arg] to x
+	OP_STORE_LOCAL,
+	// . -> the value in the cell held by locals[arg]
+	OP_LOAD_CELL,
+	// x -> ., setting the cell held by locals[arg] to x
+	OP_STORE_CELL,
+	// . -> the value in the cell held by free variable arg
+	OP_LOAD_FREE,
+	// . -> globals[arg]
+	OP_LOAD_GLOBAL,
+	// x -> ., setting globals[arg] to x
+	OP_STORE_GLOBAL,
+	// . -> the builtin at index arg of builtins.h
+	OP_LOAD_BUILTIN,
+
+	// x y -> x op y. These are in the same order as the binary operators of
+	// starlark_Op, so the opcode for op is OP_ADD + op.
+	OP_ADD,
+	OP_SUB,
+	OP_MUL,
+	OP_DIV,
+	OP_FLOORDIV,
+	OP_MOD,
+	OP_BITAND,
+	OP_BITOR,
+	OP_XOR,
+	OP_LSHIFT,
+	OP_RSHIFT,
+	OP_EQ,
+	OP_NOTEQ,
+	OP_LESS,
+	OP_LEQ,
+	OP_GREATER,
+	OP_GEQ,
+	OP_IN,
+	OP_NOT_IN,
+	// x y -> x + y, except that a list x is extended in place, as x += y
+	// does.
+	OP_INPLACE_ADD,
+
+	// x -> +x
+	OP_PLUS,
+	// x -> -x
+	OP_NEG,
+	// x -> ~x
+	OP_BITNOT,
+	// x -> not x
+	OP_NOT,
+
+	// The operand of a jump is the offset in the code it jumps to.
+
+	// . -> .
+	OP_JUMP,
+	// x -> ., jumping if x is false
+	OP_JUMP_IF_FALSE,
+	// x -> ., jumping if x is true
+	OP_JUMP_IF_TRUE,
+	// x -> x if x is false, which is jumped with, and x -> . otherwise
+	OP_JUMP_IF_FALSE_OR_POP,
+	// x -> x if x is true, which is jumped with, and x -> . otherwise
+	OP_JUMP_IF_TRUE_OR_POP,
+
+	// iterable -> iterator, where arg is the number of loops the loop is
+	// inside of, which picks out the slots at the end of the frame the
+	// iterator is kept in.
+	OP_ITER,
+	// iterator -> iterator x, where x is the iterator's next value. Once
+	// the iterator is exhausted, iterator -> . and jumps instead.
+	OP_FOR_ITER,
+
+	// x1 ... xn -> (x1, ..., xn), where n is arg
+	OP_MAKE_TUPLE,
+	// x1 ... xn -> [x1, ..., xn], where n is arg
+	OP_MAKE_LIST,
+	// k1 v1 ... kn vn -> {k1: v1, ..., kn: vn}, where n is arg
+	OP_MAKE_DICT,
+	// list y1 ... yn x -> list y1 ... yn, appending x to list, where n is
+	// arg
+	OP_LIST_APPEND,
+	// dict y1 ... yn k v -> dict y1 ... yn, setting dict[k] to v, where n
+	// is arg
+	OP_DICT_SET,
+	// collection iterator -> collection iterator, making room in the list
+	// or dict collection for as many entries as iterator has values left
+	OP_RESERVE,
+	// x -> x[n-1] ... x[0], where x must have exactly n elements, and n is
+	// arg
+	OP_UNPACK,
+
+	// x k -> x[k]
+	OP_INDEX,
+	// x k v -> ., setting x[k] to v
+	OP_SET_INDEX,
+	// x lo hi step -> x[lo:hi:step], where None stands for a missing part
+	OP_SLICE,
+	// x -> x.name, where name is names[arg]. Each OP_ATTR has its own
+	// entry in names, so that arg also picks out its inline cache in
+	// attr_caches.
+	OP_ATTR,
+	// x v -> ., setting x.name to v, where name is names[arg]
+	OP_SET_ATTR,
+
+	// fn p1 ... pn k1 v1 ... km vm [args] [kwargs] -> fn(...), where n, m
+	// and whether there are *args and **kwargs are packed into arg, see
+	// CALL_ARG.
+	OP_CALL,
+	// d1 ... dn -> a new function for the code of function arg, where the
+	// d are the values of its default parameters
+	OP_MAKE_FUNCTION,
+	// module n1 ... nk -> v1 ... vk, where k is arg, loading the names n
+	// from the module
+	OP_LOAD,
+	// x -> ., returning x
+	OP_RETURN,
+
+	// Superinstructions, which the peephole optimizer fuses out of common
+	// sequences of the instructions above. Only one of the instructions
+	// making up each of them can fail, so errors are still reported where
+	// that one was compiled from, as Opcode_base describes. OP_CALL_METHOD
+	// is the exception, see below.
+
+	// x -> x + constants[arg], for CONSTANT ADD or CONSTANT INPLACE_ADD
+	OP_ADD_CONSTANT,
+	// x -> x - constants[arg], for CONSTANT SUB
+	OP_SUB_CONSTANT,
+	// x -> x[constants[arg]], for CONSTANT INDEX
+	OP_INDEX_CONSTANT,
+	// x y -> ., jumping unless x op y, for a comparison followed by
+	// JUMP_IF_FALSE. These are in the same order as OP_EQ to OP_GEQ.
+	OP_JUMP_UNLESS_EQ,
+	OP_JUMP_UNLESS_NOTEQ,
+	OP_JUMP_UNLESS_LESS,
+	OP_JUMP_UNLESS_LEQ,
+	OP_JUMP_UNLESS_GREATER,
+	OP_JUMP_UNLESS_GEQ,
+	// x p1 ... pn k1 v1 ... km vm -> x.name(...), for ATTR followed by a
+	// CALL of the method it looks up, which the compiler emits itself.
+	// Rather than binding the method to x, it calls the one in the inline
+	// cache of names[METHOD_NAME(arg)] with x directly. A missing method
+	// is reported where the ATTR was compiled from, which is the position
+	// of the byte after the opcode, and anything else like OP_CALL.
+	OP_CALL_METHOD,
+
+	// Register instructions, which the peephole optimizer uses in place of
+	// the instructions above when the context's vm is STARLARK_VM_REGISTER,
+	// and in either mode for a local which has a constant added to or
+	// subtracted from it, as in x += 1.
+	// They name the values they work on directly instead of passing them
+	// on the stack, as a destination, which is their operand, followed by
+	// Opcode_regs[op] sources, which are varints after it.
+	//
+	// A source r is locals[r] if r is less than locals_len, and
+	// constants[r - locals_len] otherwise. Every local a source names is
+	// bound wherever the instruction runs. A destination d sets locals[d],
+	// or pushes the result when d is locals_len. Like a superinstruction,
+	// only the operator can fail, and then both sources are pushed so the
+	// error is described like it would be for Opcode_base.
+
+	// . -> ., setting locals[arg] to a, for LOAD_LOCAL or CONSTANT
+	// followed by STORE_LOCAL
+	OP_MOVE,
+	// . -> ., setting destination arg to a op b. These are in the same
+	// order as OP_ADD to OP_INPLACE_ADD.
+	OP_ADD_REG,
+	OP_SUB_REG,
+	OP_MUL_REG,
+	OP_DIV_REG,
+	OP_FLOORDIV_REG,
+	OP_MOD_REG,
+	OP_BITAND_REG,
+	OP_BITOR_REG,
+	OP_XOR_REG,
+	OP_LSHIFT_REG,
+	OP_RSHIFT_REG,
+	OP_EQ_REG,
+	OP_NOTEQ_REG,
+	OP_LESS_REG,
+	OP_LEQ_REG,
+	OP_GREATER_REG,
+	OP_GEQ_REG,
+	OP_IN_REG,
+	OP_NOT_IN_REG,
+	OP_INPLACE_ADD_REG,
+	// . -> ., jumping to arg unless a op b. These are in the same order as
+	// OP_EQ to OP_GEQ.
+	OP_JUMP_UNLESS_EQ_REG,
+	OP_JUMP_UNLESS_NOTEQ_REG,
+	OP_JUMP_UNLESS_LESS_REG,
+	OP_JUMP_UNLESS_LEQ_REG,
+	OP_JUMP_UNLESS_GREATER_REG,
+	OP_JUMP_UNLESS_GEQ_REG,
+
+	OP_COUNT,
+};
+
+// The operand of OP_CALL for a call with the given number of positional and
+// named arguments, and flags from enum call_flags.
+#define CALL_ARG(positional, named, flags) \
+	((uint32_t)(positional) | ((uint32_t)(named) << 8) | ((flags) << 16))
+#define CALL_POSITIONAL(arg) ((arg)&0xff)
+#define CALL_NAMED(arg) (((arg) >> 8) & 0xff)
+
+// The operand of OP_CALL_METHOD calling the method names[name] with the given
+// number of positional and named arguments, which are picked out of it the
+// same way as for OP_CALL.
+#define METHOD_ARG(name, positional, named) \
+	(CALL_ARG(positional, named, 0) | ((uint32_t)(name) << 16))
+#define METHOD_NAME(arg) ((arg) >> 16)
+
+// The most entries in names an OP_CALL_METHOD can refer to.
+#define METHOD_MAX_NAME 0xffff
+
+enum call_flags {
+	CALL_VARARGS = 1 << 0,
+	CALL_KWARGS = 1 << 1,
+};
+
+// The most positional or named arguments a call can have.
+#define CALL_MAX_ARGS 255
+
+// The number of types an OP_ATTR's or OP_CALL_METHOD's inline cache remembers
+// the method of.
+#define ATTR_CACHE_WAYS 2
+
+// The methods an OP_ATTR or OP_CALL_METHOD found on the last types it ran on,
+// so that it only looks a method up by name the first time it sees a type.
+// Unused entries have the type STARLARK_TYPE_NONE, which doesn't have any
+// methods.
+struct starlark_AttrCache {
+	uint8_t types[ATTR_CACHE_WAYS];
+	const struct starlark_Method *methods[ATTR_CACHE_WAYS];
+};
+
+extern const char *const Opcode_names[OP_COUNT];
+extern const bool Opcode_has_arg[OP_COUNT];
+// The number of sources of each register instruction, and 0 for every other
+// instruction.
+extern const uint8_t Opcode_regs[OP_COUNT];
+// For each superinstruction and register instruction, the instruction whose
+// errors it reports, which is the part of it that can fail, and OP_NOP for
+// every other instruction. One which fails leaves the operands that
+// instruction would have had on the stack.
+extern const uint8_t Opcode_base[OP_COUNT];
+
+struct starlark_Jit;
+
+// The compiled form of a function, or of the top level of a module.
+struct starlark_Code {
+	// The function's name, as a handle into the context's strpool.
+	int64_t name;
+	// Where the function's definition starts in the source.
+	size_t start;
+
+	size_t code_len;
+	uint8_t *code;
+
+	// The values used by OP_CONSTANT, which the code holds a reference
+	// to.
+	size_t constants_len;
+	struct starlark_Value *constants;
+
+	// The names used by OP_ATTR, OP_SET_ATTR and OP_CALL_METHOD, as
+	// strpool handles, and the inline cache of the OP_ATTR or
+	// OP_CALL_METHOD using each of them. The caches are filled in as the
+	// code runs.
+	size_t names_len;
+	int64_t *names;
+	struct starlark_AttrCache *attr_caches;
+	// What the JIT has compiled the code to so far, see jit.h.
+	struct starlark_Jit *jit;
+
+	// Maps offsets in the code to the source they were compiled from, as
+	// a pair of varints for each instruction whose position differs from
+	// the one before it: the number of bytes of code since the previous
+	// pair, and the change in source offset, zigzag encoded. See
+	// Code_position.
+	size_t lines_len;
+	uint8_t *lines;
+
+	// The most values the code ever has on its operand stack, and the
+	// number of slots in its frame, so a frame can be allocated once when
+	// the function is called.
+	uint32_t max_stack;
+	uint32_t locals_len;
+	// The name of each local, as a handle into the context's strpool, so
+	// that reading one before it's assigned can say which it was.
+	int64_t *local_names;
+	// The most loops which are ever inside each other. The iterator of
+	// each of them takes up ITERATOR_SLOTS slots after the operand stack.
+	uint32_t loops_len;
+
+	// The number of named parameters, which are the first locals. The
+	// last kwonly_len of them come after a * and can only be passed by
+	// name.
+	uint32_t params_len;
+	uint32_t kwonly_len;
+	// Whether there are *args and **kwargs parameters, which are the
+	// locals following the named parameters.
+	bool varargs;
+	bool kwargs;
+	// The name of each named parameter, as a string value.
+	struct starlark_Value *param_names;
+	// For each named parameter, the index of its default value among the
+	// defaults_len values OP_MAKE_FUNCTION takes, or UINT32_MAX if it
+	// doesn't have one.
+	uint32_t *defaults;
+	uint32_t defaults_len;
+
+	// The locals which hold cells, and the free variables the function
+	// takes from the function which defines it. See starlark_Resolver.
+	uint32_t cells_len;
+	uint32_t *cells;
+	uint32_t frees_len;
+	struct starlark_FreeVar *frees;
+};
+
+// A compiled module.
+struct starlark_Program {
+	// The code of every function in the module, in the same order as the
+	// resolver's functions. codes[0] is the module's top level.
+	size_t codes_len;
+	struct starlark_Code *codes;
+
+	// The name of each global, as a strpool handle.
+	size_t globals_len;
+	int64_t *globals;
+};
+
+struct function_arrays;
+
+// The arrays the instructions of each function are built in while it's being
+// compiled, which are kept for the next function once it's finished with them
+// rather than freed.
+struct starlark_CompileScratch {
+	size_t len;
+	size_t cap;
+	struct function_arrays *arrays;
+};
+
+// Compiles the ast of p, which r must have resolved, into out, taking the
+// arrays it works in from scratch and putting them back afterwards.
+// Returns 0 on success, or a negative STARLARK_ERROR_* code. Errors in the
+// program are appended to ctx's errors.
+int compile(struct starlark_Context *ctx, struct starlark_Parser *p,
+	    const struct starlark_Resolver *r,
+	    struct starlark_CompileScratch *scratch,
+	    struct starlark_Program *out);
+
+void CompileScratch_finish(struct starlark_CompileScratch *s);
+
+void Program_finish(struct starlark_Program *prog);
+
+// Returns the offset in the source which the instruction at offset pc in code
+// was compiled from.
+size_t Code_position(const struct starlark_Code *code, const size_t pc);
+
+// Prints the bytecode of every function in prog.
+void Program_dump(struct starlark_Context *ctx,
+		  const struct starlark_Program *prog, FILE *f);
+
+// Returns the varint at *pc, and moves *pc past it.
+static inline uint32_t varint_read(const uint8_t **pc)
+{
+	uint32_t result = 0;
+	for (int shift = 0;; shift += 7) {
+		const uint8_t byte = **pc;
+		*pc += 1;
+		result |= (uint32_t)(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0) {
+			return result;
+		}
+	}
+}
+
+#endif // STARLARK_COMPILE_H
@@ -0,0 +1,678 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "starlark/dict.h"
+#include "starlark/common.h"
+#include "starlark/value.h"
+#include "util/common.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// Slots in the index which don't point to an entry.
+#define SLOT_EMPTY (-1)
+#define SLOT_DELETED (-2)
+
+// The smallest index a dict with any keys has.
+#define MIN_INDEX_BITS 3
+
+// Dicts whose index has at least this many bits use a swiss table for their
+// index instead of the compact one. Each probe of the compact index needs to
+// load an entry's hash, which is a cache miss once the entries no longer fit in
+// cache. A swiss table filters most of those out with a 7-bit fragment of the
+// hash, 16 slots at a time, and can be kept fuller, so it costs about the same
+// memory per entry. Below this size, the compact index's single byte slots keep
+// small dicts smaller.
+#define LARGE_INDEX_BITS 8
+
+// Large dicts keep a control byte for each slot, which holds the top 7 bits of
+// the slot's hash, or one of these.
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xfe
+
+// Large dicts probe for slots in groups of this many control bytes.
+#define GROUP_SIZE 16
+
+// Stored as the key of deleted entries. It has the special tag, so no
+// starlark value can be equal to it.
+#define ENTRY_DELETED ((struct starlark_Value){ (3 << 4) | VALUE_TAG_SPECIAL })
+
+struct starlark_Dict {
+	struct starlark_Object obj;
+
+	// The number of keys in the dict.
+	size_t len;
+	// The number of entries in use, including deleted ones.
+	size_t used;
+	// The number of entries there's room for before the index needs to
+	// grow. See index_cap.
+	size_t cap;
+
+	// The index has 1 << index_bits slots. Each one holds SLOT_EMPTY,
+	// SLOT_DELETED, or the position of an entry, and is 1, 2, 4 or 8 bytes
+	// wide depending on how many entries there can be.
+	uint8_t index_bits;
+	void *index;
+	// The control bytes of large dicts, one for each slot, or NULL if the
+	// dict is small. A large dict only stores entry positions in its
+	// slots, and uses the control bytes to tell which are empty.
+	uint8_t *ctrl;
+
+	// How many iterators are going over the dict. Keys can't be added,
+	// replaced or removed while there are any.
+	uint32_t iterators;
+
+	struct {
+		uint64_t *hashes;
+		struct starlark_Value *keys;
+		struct starlark_Value *values;
+	} entries;
+};
+
+static size_t slot_width(const uint8_t index_bits)
+{
+	// A slot has to hold every entry position below index_cap, as a signed
+	// integer.
+	if (index_bits <= 7) {
+		return 1;
+	} else if (index_bits <= 15) {
+		return 2;
+	} else if (index_bits <= 31) {
+		return 4;
+	}
+
+	return 8;
+}
+
+static bool is_large(const uint8_t index_bits)
+{
+	return index_bits >= LARGE_INDEX_BITS;
+}
+
+// Returns how many entries an index with 1 << index_bits slots has room for.
+// Swiss tables stay fast when they're fuller than the compact index does.
+static size_t index_cap(const uint8_t index_bits)
+{
+	const size_t slots = (size_t)1 << index_bits;
+	if (is_large(index_bits)) {
+		return slots / 8 * 7;
+	}
+
+	return slots / 3 * 2;
+}
+
+static int64_t slot_get(const struct starlark_Dict *d, const size_t slot)
+{
+	switch (slot_width(d->index_bits)) {
+	case 1:
+		return ((const int8_t *)d->index)[slot];
+	case 2:
+		return ((const int16_t *)d->index)[slot];
+	case 4:
+		return ((const int32_t *)d->index)[slot];
+	default:
+		return ((const int64_t *)d->index)[slot];
+	}
+}
+
+static void slot_set(struct starlark_Dict *d, const size_t slot,
+		     const int64_t entry)
+{
+	switch (slot_width(d->index_bits)) {
+	case 1:
+		((int8_t *)d->index)[slot] = (int8_t)entry;
+		break;
+	case 2:
+		((int16_t *)d->index)[slot] = (int16_t)entry;
+		break;
+	case 4:
+		((int32_t *)d->index)[slot] = (int32_t)entry;
+		break;
+	default:
+		((int64_t *)d->index)[slot] = entry;
+		break;
+	}
+}
+
+// Visits the slots a hash can be stored in, in the same order as CPython. The
+// upper bits of the hash are mixed in gradually, so keys whose hashes only
+// differ in their upper bits don't probe the same slots.
+struct Probe {
+	size_t mask;
+	size_t slot;
+	uint64_t perturb;
+};
+
+static struct Probe probe_start(const struct starlark_Dict *d,
+				const uint64_t hash)
+{
+	const size_t mask = ((size_t)1 << d->index_bits) - 1;
+	return (struct Probe){
+		.mask = mask,
+		.slot = (size_t)hash & mask,
+		.perturb = hash,
+	};
+}
+
+static void probe_next(struct Probe *p)
+{
+	p->perturb >>= 5;
+	p->slot = (p->slot * 5 + (size_t)p->perturb + 1) & p->mask;
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+
+// Returns a mask with bit i set if the ith control byte of the group starting
+// at ctrl is b.
+static uint32_t group_match(const uint8_t *ctrl, const uint8_t b)
+{
+	const __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+	return (uint32_t)_mm_movemask_epi8(
+		_mm_cmpeq_epi8(group, _mm_set1_epi8((char)b)));
+}
+
+// Returns a mask with bit i set if the ith slot of the group starting at ctrl
+// is empty or deleted, which are the only control bytes with the top bit set.
+static uint32_t group_match_free(const uint8_t *ctrl)
+{
+	const __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+	return (uint32_t)_mm_movemask_epi8(group);
+}
+
+#else
+
+static uint32_t group_match(const uint8_t *ctrl, const uint8_t b)
+{
+	uint32_t result = 0;
+	for (uint32_t i = 0; i < GROUP_SIZE; i += 1) {
+		result |= (uint32_t)(ctrl[i] == b) << i;
+	}
+
+	return result;
+}
+
+static uint32_t group_match_free(const uint8_t *ctrl)
+{
+	uint32_t result = 0;
+	for (uint32_t i = 0; i < GROUP_SIZE; i += 1) {
+		result |= (uint32_t)(ctrl[i] >> 7) << i;
+	}
+
+	return result;
+}
+
+#endif
+
+// The control byte for a hash. The top bits are used, since the bottom bits
+// pick the group.
+static uint8_t hash_ctrl(const uint64_t hash)
+{
+	return (uint8_t)(hash >> 57);
+}
+
+// Visits the groups of a large dict's index. Each group is visited once, since
+// the number of groups is a power of two.
+struct GroupProbe {
+	size_t mask;
+	size_t group;
+	size_t step;
+};
+
+static struct GroupProbe group_probe_start(const struct starlark_Dict *d,
+					   const uint64_t hash)
+{
+	const size_t mask = (((size_t)1 << d->index_bits) / GROUP_SIZE) - 1;
+	return (struct GroupProbe){
+		.mask = mask,
+		.group = (size_t)hash & mask,
+		.step = 0,
+	};
+}
+
+static void group_probe_next(struct GroupProbe *p)
+{
+	p->step += 1;
+	p->group = (p->group + p->step) & p->mask;
+}
+
+// Like find, for large dicts.
+static size_t find_large(const struct starlark_Dict *d,
+			 const struct starlark_Value key, const uint64_t hash,
+			 size_t *insert_slot)
+{
+	const uint8_t h2 = hash_ctrl(hash);
+	size_t free_slot = SIZE_MAX;
+	for (struct GroupProbe p = group_probe_start(d, hash);;
+	     group_probe_next(&p)) {
+		const size_t start = p.group * GROUP_SIZE;
+		const uint8_t *ctrl = &d->ctrl[start];
+		for (uint32_t m = group_match(ctrl, h2); m != 0; m &= m - 1) {
+			const size_t slot = start + (size_t)__builtin_ctz(m);
+			const int64_t entry = slot_get(d, slot);
+			const struct starlark_Value k = d->entries.keys[entry];
+			if (k.bits == key.bits ||
+			    (d->entries.hashes[entry] == hash &&
+			     Value_equal(k, key))) {
+				return slot;
+			}
+		}
+
+		const uint32_t free_mask = group_match_free(ctrl);
+		if (free_slot == SIZE_MAX && free_mask != 0) {
+			free_slot = start + (size_t)__builtin_ctz(free_mask);
+		}
+
+		if (group_match(ctrl, CTRL_EMPTY) != 0) {
+			if (insert_slot != NULL) {
+				*insert_slot = free_slot;
+			}
+
+			return SIZE_MAX;
+		}
+	}
+}
+
+// Stores entry in slot, which must be empty or deleted.
+static void slot_fill(struct starlark_Dict *d, const size_t slot,
+		      const uint64_t hash, const size_t entry)
+{
+	if (d->ctrl != NULL) {
+		d->ctrl[slot] = hash_ctrl(hash);
+	}
+
+	slot_set(d, slot, (int64_t)entry);
+}
+
+// Returns the first empty slot for hash, in a dict with no deleted slots.
+static size_t find_empty(const struct starlark_Dict *d, const uint64_t hash)
+{
+	if (d->ctrl == NULL) {
+		struct Probe p = probe_start(d, hash);
+		while (slot_get(d, p.slot) != SLOT_EMPTY) {
+			probe_next(&p);
+		}
+
+		return p.slot;
+	}
+
+	for (struct GroupProbe p = group_probe_start(d, hash);;
+	     group_probe_next(&p)) {
+		const size_t start = p.group * GROUP_SIZE;
+		const uint32_t empty = group_match(&d->ctrl[start], CTRL_EMPTY);
+		if (empty != 0) {
+			return start + (size_t)__builtin_ctz(empty);
+		}
+	}
+}
+
+// Returns the slot holding key, or SIZE_MAX if it isn't in d. If insert_slot
+// isn't NULL, the slot a new entry for key should go in is stored in it.
+static size_t find(const struct starlark_Dict *d,
+		   const struct starlark_Value key, const uint64_t hash,
+		   size_t *insert_slot)
+{
+	if (d->ctrl != NULL) {
+		return find_large(d, key, hash, insert_slot);
+	}
+
+	size_t free_slot = SIZE_MAX;
+	for (struct Probe p = probe_start(d, hash);; probe_next(&p)) {
+		const int64_t entry = slot_get(d, p.slot);
+		if (entry == SLOT_EMPTY) {
+			if (insert_slot != NULL) {
+				*insert_slot =
+					free_slot != SIZE_MAX ? free_slot : p.slot;
+			}
+
+			return SIZE_MAX;
+		}
+
+		if (entry == SLOT_DELETED) {
+			if (free_slot == SIZE_MAX) {
+				free_slot = p.slot;
+			}
+
+			continue;
+		}
+
+		const struct starlark_Value k = d->entries.keys[entry];
+		if (k.bits == key.bits ||
+		    (d->entries.hashes[entry] == hash && Value_equal(k, key))) {
+			return p.slot;
+		}
+	}
+}
+
+// Rebuilds d with room for at least len entries, dropping deleted ones.
+static bool resize(struct starlark_Dict *d, const size_t len)
+{
+	uint8_t index_bits = MIN_INDEX_BITS;
+	while (index_cap(index_bits) < len) {
+		if (index_bits >= 62) {
+			return false;
+		}
+
+		index_bits += 1;
+	}
+
+	const size_t slots = (size_t)1 << index_bits;
+	const size_t cap = index_cap(index_bits);
+	const size_t entry_size = sizeof(d->entries.hashes[0]) +
+				  sizeof(d->entries.keys[0]) +
+				  sizeof(d->entries.values[0]);
+	if (cap > SIZE_MAX / entry_size) {
+		return false;
+	}
+
+	// The entries go first, since they need the strictest alignment.
+	const size_t hashes_len = cap * sizeof(d->entries.hashes[0]);
+	const size_t keys_len = cap * sizeof(d->entries.keys[0]);
+	const size_t values_len = cap * sizeof(d->entries.values[0]);
+	const size_t index_len = slots * slot_width(index_bits);
+	const size_t ctrl_len = is_large(index_bits) ? slots : 0;
+	uint8_t *memory = malloc(hashes_len + keys_len + values_len +
+				 index_len + ctrl_len);
+	if (memory == NULL) {
+		return false;
+	}
+
+	struct starlark_Dict old = *d;
+	d->entries.hashes = (void *)memory;
+	d->entries.keys = (void *)(memory + hashes_len);
+	d->entries.values = (void *)(memory + hashes_len + keys_len);
+	d->index = memory + hashes_len + keys_len + values_len;
+	d->ctrl = NULL;
+	if (is_large(index_bits)) {
+		d->ctrl = memory + hashes_len + keys_len + values_len +
+			  index_len;
+		memset(d->ctrl, CTRL_EMPTY, ctrl_len);
+	} else {
+		// Every bit set is SLOT_EMPTY, whatever the width.
+		memset(d->index, 0xff, index_len);
+	}
+
+	d->index_bits = index_bits;
+	d->cap = cap;
+	d->used = 0;
+
+	for (size_t i = 0; i < old.used; i += 1) {
+		if (old.entries.keys[i].bits == ENTRY_DELETED.bits) {
+			continue;
+		}
+
+		const uint64_t hash = old.entries.hashes[i];
+		d->entries.hashes[d->used] = hash;
+		d->entries.keys[d->used] = old.entries.keys[i];
+		d->entries.values[d->used] = old.entries.values[i];
+		slot_fill(d, find_empty(d, hash), hash, d->used);
+		d->used += 1;
+	}
+
+	assert(d->used == d->len);
+	free(old.entries.hashes);
+	return true;
+}
+
+struct starlark_Dict *Dict_create(void)
+{
+	struct starlark_Dict *result = malloc(sizeof(*result));
+	if (result == NULL) {
+		return NULL;
+	}
+
+	*result = (struct starlark_Dict){
+		.obj = {
+			.type = STARLARK_TYPE_DICT,
+			.refs = 1,
+		},
+	};
+	return result;
+}
+
+void Dict_clear(struct starlark_Dict *d)
+{
+	assert(d != NULL);
+
+	for (size_t i = 0; i < d->used; i += 1) {
+		if (d->entries.keys[i].bits == ENTRY_DELETED.bits) {
+			continue;
+		}
+
+		Value_release(d->entries.keys[i]);
+		Value_release(d->entries.values[i]);
+	}
+
+	if (d->ctrl != NULL) {
+		memset(d->ctrl, CTRL_EMPTY, (size_t)1 << d->index_bits);
+	} else if (d->index != NULL) {
+		memset(d->index, 0xff,
+		       ((size_t)1 << d->index_bits) * slot_width(d->index_bits));
+	}
+
+	d->len = 0;
+	d->used = 0;
+}
+
+void Dict_destroy(struct starlark_Dict *d)
+{
+	if (d == NULL) {
+		return;
+	}
+
+	Dict_clear(d);
+	free(d->entries.hashes);
+	free(d);
+}
+
+void Dict_start_iterating(struct starlark_Dict *d)
+{
+	assert(d != NULL);
+	d->iterators += 1;
+}
+
+void Dict_stop_iterating(struct starlark_Dict *d)
+{
+	assert(d != NULL);
+	assert(d->iterators != 0);
+	d->iterators -= 1;
+}
+
+bool Dict_iterating(const struct starlark_Dict *d)
+{
+	assert(d != NULL);
+	return d->iterators != 0;
+}
+
+size_t Dict_len(const struct starlark_Dict *d)
+{
+	assert(d != NULL);
+	return d->len;
+}
+
+int Dict_get(const struct starlark_Dict *d, const struct starlark_Value key,
+	     struct starlark_Value *out)
+{
+	assert(d != NULL);
+	assert(out != NULL);
+
+	uint64_t hash = 0;
+	if (!Value_hash(key, &hash)) {
+		return STARLARK_ERRORCODE_UNHASHABLE;
+	}
+
+	if (d->len == 0) {
+		return STARLARK_ERRORCODE_KEY_NOT_FOUND;
+	}
+
+	const size_t slot = find(d, key, hash, NULL);
+	if (slot == SIZE_MAX) {
+		return STARLARK_ERRORCODE_KEY_NOT_FOUND;
+	}
+
+	*out = d->entries.values[slot_get(d, slot)];
+	return 0;
+}
+
+int Dict_set(struct starlark_Dict *d, const struct starlark_Value key,
+	     const struct starlark_Value value)
+{
+	assert(d != NULL);
+
+	if (d->iterators != 0) {
+		return STARLARK_ERRORCODE_MUTATED_DURING_ITERATION;
+	}
+
+	uint64_t hash = 0;
+	if (!Value_hash(key, &hash)) {
+		return STARLARK_ERRORCODE_UNHASHABLE;
+	}
+
+	size_t insert_slot = 0;
+	if (d->index != NULL) {
+		const size_t slot = find(d, key, hash, &insert_slot);
+		if (slot != SIZE_MAX) {
+			const int64_t entry = slot_get(d, slot);
+			Value_retain(value);
+			Value_release(d->entries.values[entry]);
+			d->entries.values[entry] = value;
+			return 0;
+		}
+	}
+
+	if (d->used == d->cap) {
+		// Deleted entries are dropped when resizing, so a dict which
+		// has had a lot of keys removed might not grow at all.
+		if (!resize(d, MAX(d->len * 2, d->len + 1))) {
+			return STARLARK_ERROR_OOM;
+		}
+
+		find(d, key, hash, &insert_slot);
+	}
+
+	Value_retain(key);
+	Value_retain(value);
+	d->entries.hashes[d->used] = hash;
+	d->entries.keys[d->used] = key;
+	d->entries.values[d->used] = value;
+	slot_fill(d, insert_slot, hash, d->used);
+	d->used += 1;
+	d->len += 1;
+	return 0;
+}
+
+int Dict_reserve(struct starlark_Dict *d, const size_t n)
+{
+	assert(d != NULL);
+
+	if (n <= d->cap - d->used) {
+		return 0;
+	}
+
+	if (n > SIZE_MAX - d->len || !resize(d, d->len + n)) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	return 0;
+}
+
+int Dict_delete(struct starlark_Dict *d, const struct starlark_Value key)
+{
+	assert(d != NULL);
+
+	if (d->iterators != 0) {
+		return STARLARK_ERRORCODE_MUTATED_DURING_ITERATION;
+	}
+
+	uint64_t hash = 0;
+	if (!Value_hash(key, &hash)) {
+		return STARLARK_ERRORCODE_UNHASHABLE;
+	}
+
+	if (d->len == 0) {
+		return STARLARK_ERRORCODE_KEY_NOT_FOUND;
+	}
+
+	const size_t slot = find(d, key, hash, NULL);
+	if (slot == SIZE_MAX) {
+		return STARLARK_ERRORCODE_KEY_NOT_FOUND;
+	}
+
+	const int64_t entry = slot_get(d, slot);
+	Value_release(d->entries.keys[entry]);
+	Value_release(d->entries.values[entry]);
+	d->entries.keys[entry] = ENTRY_DELETED;
+	d->entries.values[entry] = VALUE_NONE;
+	if (d->ctrl != NULL) {
+		d->ctrl[slot] = CTRL_DELETED;
+	} else {
+		slot_set(d, slot, SLOT_DELETED);
+	}
+	d->len -= 1;
+
+	// Once the dict is empty, start filling the entries from the
+	// beginning again.
+	if (d->len == 0) {
+		Dict_clear(d);
+	}
+
+	return 0;
+}
+
+bool Dict_next(const struct starlark_Dict *d, size_t *pos,
+	       struct starlark_Value *key, struct starlark_Value *value)
+{
+	assert(d != NULL);
+	assert(pos != NULL);
+
+	while (*pos < d->used) {
+		const size_t i = *pos;
+		*pos += 1;
+		if (d->entries.keys[i].bits == ENTRY_DELETED.bits) {
+			continue;
+		}
+
+		if (key != NULL) {
+			*key = d->entries.keys[i];
+		}
+
+		if (value != NULL) {
+			*value = d->entries.values[i];
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+bool Dict_equal(const struct starlark_Dict *a, const struct starlark_Dict *b)
+{
+	assert(a != NULL);
+	assert(b != NULL);
+
+	if (a == b) {
+		return true;
+	}
+
+	if (a->len != b->len) {
+		return false;
+	}
+
+	size_t pos = 0;
+	struct starlark_Value key = { 0 };
+	struct starlark_Value value = { 0 };
+	while (Dict_next(a, &pos, &key, &value)) {
+		struct starlark_Value other = { 0 };
+		if (Dict_get(b, key, &other) != 0 ||
+		    !Value_equal(value, other)) {
+			return false;
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,78 @@
+#ifndef STARLARK_DICT_H
+#define STARLARK_DICT_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "starlark/common.h"
+#include "starlark/value.h"
+
+// A starlark dict, which remembers the order its keys were inserted in.
+//
+// Entries are stored densely in insertion order, and a separate index of
+// open-addressed slots maps hashes to positions in the entries. Each slot is
+// only as wide as it needs to be to hold a position, so small dicts stay small,
+// and iterating is a linear scan over the entries. Larger dicts index their
+// entries with a swiss table instead, which probes 16 slots at a time.
+//
+// Every starlark_Dict starts with a starlark_Object header, so a pointer to one
+// can be stored in a starlark_Value.
+
+// Returns a new, empty dict. Nothing is allocated for its entries until the
+// first key is inserted.
+// Returns NULL if we couldn't allocate enough memory.
+struct starlark_Dict *Dict_create(void);
+
+// Releases every key and value in d, and frees it.
+void Dict_destroy(struct starlark_Dict *d);
+
+// Removes every key from d, keeping the memory allocated for them so that it
+// can be reused.
+void Dict_clear(struct starlark_Dict *d);
+
+size_t Dict_len(const struct starlark_Dict *d);
+
+// Records that an iterator has started going over d. Until as many calls to
+// Dict_stop_iterating have been made, d is frozen: Dict_set and Dict_delete
+// fail with STARLARK_ERRORCODE_MUTATED_DURING_ITERATION.
+void Dict_start_iterating(struct starlark_Dict *d);
+
+void Dict_stop_iterating(struct starlark_Dict *d);
+
+// Returns whether any iterators are going over d, so that it can't be changed.
+bool Dict_iterating(const struct starlark_Dict *d);
+
+// Looks up key in d, storing its value in *out. The value is borrowed from d.
+// Returns 0 on success, STARLARK_ERRORCODE_KEY_NOT_FOUND if key isn't in d, or
+// STARLARK_ERRORCODE_UNHASHABLE if key can't be hashed.
+int Dict_get(const struct starlark_Dict *d, const struct starlark_Value key,
+	     struct starlark_Value *out);
+
+// Maps key to value in d. If key is already in d, it keeps its position and
+// only its value is replaced. d adds its own reference to key and value.
+// Returns 0 on success, STARLARK_ERROR_OOM if we couldn't allocate enough
+// memory, STARLARK_ERRORCODE_UNHASHABLE if key can't be hashed, or
+// STARLARK_ERRORCODE_MUTATED_DURING_ITERATION if d is being iterated over.
+int Dict_set(struct starlark_Dict *d, const struct starlark_Value key,
+	     const struct starlark_Value value);
+
+// Makes sure n more keys can be inserted into d without it having to grow.
+// Returns 0 on success, or STARLARK_ERROR_OOM.
+int Dict_reserve(struct starlark_Dict *d, const size_t n);
+
+// Removes key from d.
+// Returns 0 on success, STARLARK_ERRORCODE_KEY_NOT_FOUND if key isn't in d,
+// STARLARK_ERRORCODE_UNHASHABLE if key can't be hashed, or
+// STARLARK_ERRORCODE_MUTATED_DURING_ITERATION if d is being iterated over.
+int Dict_delete(struct starlark_Dict *d, const struct starlark_Value key);
+
+// Iterates over d in insertion order. *pos must be 0 on the first call.
+// Returns false once every entry has been visited. The key and value are
+// borrowed from d, and d must not be changed while iterating.
+bool Dict_next(const struct starlark_Dict *d, size_t *pos,
+	       struct starlark_Value *key, struct starlark_Value *value);
+
+// Returns true if a and b have the same keys, mapped to equal values.
+bool Dict_equal(const struct starlark_Dict *a, const struct starlark_Dict *b);
+
+#endif // STARLARK_DICT_H
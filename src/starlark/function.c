@@ -0,0 +1,179 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "starlark/function.h"
+#include "starlark/common.h"
+#include "starlark/compile.h"
+#include "starlark/strpool.h"
+#include "starlark/value.h"
+#include "util/common.h"
+#include "util/io.h"
+
+struct starlark_Module *Module_create(struct starlark_Context *ctx,
+				      struct starlark_Program *prog)
+{
+	assert(ctx != NULL);
+	assert(prog != NULL);
+
+	struct starlark_Module *result = malloc(sizeof(*result));
+	if (result == NULL) {
+		return NULL;
+	}
+
+	*result = (struct starlark_Module){
+		.ctx = ctx,
+		.globals = calloc(MAX(prog->globals_len, 1),
+				  sizeof(result->globals[0])),
+		.running = calloc(MAX(prog->codes_len, 1),
+				  sizeof(result->running[0])),
+	};
+	if (result->globals == NULL || result->running == NULL) {
+		free(result->globals);
+		free(result->running);
+		free(result);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < prog->globals_len; i += 1) {
+		result->globals[i] = VALUE_UNBOUND;
+	}
+
+	result->program = *prog;
+	*prog = (struct starlark_Program){ 0 };
+	return result;
+}
+
+void Module_destroy(struct starlark_Module *m)
+{
+	if (m == NULL) {
+		return;
+	}
+
+	for (size_t i = 0; i < m->program.globals_len; i += 1) {
+		Value_release(m->globals[i]);
+	}
+
+	Program_finish(&m->program);
+	if (m->has_file) {
+		mapfile_finish(&m->file);
+	}
+
+	free(m->globals);
+	free(m->running);
+	free(m);
+}
+
+struct starlark_Function *Function_create(struct starlark_Module *module,
+					  const struct starlark_Code *code)
+{
+	assert(module != NULL);
+	assert(code != NULL);
+
+	const size_t len = (size_t)code->defaults_len + code->frees_len;
+	struct starlark_Function *result =
+		malloc(sizeof(*result) + len * sizeof(result->values[0]));
+	if (result == NULL) {
+		return NULL;
+	}
+
+	*result = (struct starlark_Function){
+		.obj.type = STARLARK_TYPE_FUNCTION,
+		.obj.refs = 1,
+		.module = module,
+		.code = code,
+		.defaults_len = code->defaults_len,
+		.frees_len = code->frees_len,
+	};
+	for (size_t i = 0; i < len; i += 1) {
+		result->values[i] = VALUE_NONE;
+	}
+
+	return result;
+}
+
+void Function_destroy(struct starlark_Function *fn)
+{
+	if (fn == NULL) {
+		return;
+	}
+
+	const size_t len = (size_t)fn->defaults_len + fn->frees_len;
+	for (size_t i = 0; i < len; i += 1) {
+		Value_release(fn->values[i]);
+	}
+
+	free(fn);
+}
+
+struct starlark_Cell *Cell_create(const struct starlark_Value v)
+{
+	struct starlark_Cell *result = malloc(sizeof(*result));
+	if (result == NULL) {
+		return NULL;
+	}
+
+	*result = (struct starlark_Cell){
+		.obj.type = STARLARK_TYPE_CELL,
+		.obj.refs = 1,
+		.value = v,
+	};
+	Value_retain(v);
+	return result;
+}
+
+void Cell_destroy(struct starlark_Cell *c)
+{
+	if (c == NULL) {
+		return;
+	}
+
+	Value_release(c->value);
+	free(c);
+}
+
+struct starlark_Builtin *Builtin_create(const char *name, starlark_BuiltinFn fn,
+					const struct starlark_Value self)
+{
+	assert(name != NULL);
+	assert(fn != NULL);
+
+	struct starlark_Builtin *result = malloc(sizeof(*result));
+	if (result == NULL) {
+		return NULL;
+	}
+
+	*result = (struct starlark_Builtin){
+		.obj.type = STARLARK_TYPE_BUILTIN,
+		.obj.refs = 1,
+		.name = name,
+		.fn = fn,
+		.self = self,
+	};
+	Value_retain(self);
+	return result;
+}
+
+void Builtin_destroy(struct starlark_Builtin *b)
+{
+	if (b == NULL) {
+		return;
+	}
+
+	Value_release(b->self);
+	free(b);
+}
+
+const char *Function_name(const struct starlark_Value fn)
+{
+	struct starlark_Object *o = Value_as_object(fn);
+	if (o->type == STARLARK_TYPE_BUILTIN) {
+		return ((struct starlark_Builtin *)o)->name;
+	}
+
+	assert(o->type == STARLARK_TYPE_FUNCTION);
+	const struct starlark_Function *f = (struct starlark_Function *)o;
+	return strpool_get(&f->module->ctx->strpool, f->code->name);
+}
@@ -0,0 +1,124 @@
+#ifndef STARLARK_FUNCTION_H
+#define STARLARK_FUNCTION_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "starlark/common.h"
+#include "starlark/compile.h"
+#include "starlark/value.h"
+#include "util/io.h"
+
+// The callable values of starlark, and the modules their code belongs to.
+
+// Marks a local or global which hasn't been assigned yet. It's never seen by
+// starlark code, since reading it is an error.
+#define VALUE_UNBOUND ((struct starlark_Value){ (3 << 4) | VALUE_TAG_SPECIAL })
+
+// A compiled module, along with the values of its globals.
+struct starlark_Module {
+	struct starlark_Context *ctx;
+	struct starlark_Program program;
+
+	// The value of each of the program's globals, which is VALUE_UNBOUND
+	// until it's assigned.
+	struct starlark_Value *globals;
+
+	// Whether each of the program's codes is being run. Starlark doesn't
+	// allow a function to call itself, even indirectly.
+	bool *running;
+
+	// The file the module's source was read from, which the source points
+	// into, if it was read from one.
+	bool has_file;
+	struct MappedFile file;
+};
+
+// A function defined by a def statement or a lambda.
+struct starlark_Function {
+	struct starlark_Object obj;
+	// The module the function was defined in, which outlives it.
+	struct starlark_Module *module;
+	const struct starlark_Code *code;
+	// The values of the function's default parameters, followed by the
+	// cells of its free variables.
+	uint32_t defaults_len;
+	uint32_t frees_len;
+	struct starlark_Value values[];
+};
+
+// Holds a local which a nested function refers to, so both functions can see
+// it being assigned.
+struct starlark_Cell {
+	struct starlark_Object obj;
+	struct starlark_Value value;
+};
+
+struct starlark_Vm;
+
+// The arguments a builtin function is called with. Every value is borrowed
+// from the caller.
+struct starlark_Args {
+	// The value a method was looked up on, or VALUE_NONE for a function.
+	struct starlark_Value self;
+	size_t len;
+	const struct starlark_Value *args;
+	// The named arguments, as pairs of a string name and a value.
+	size_t named_len;
+	const struct starlark_Value *named;
+};
+
+// Implements a builtin function, storing the value it returns in *out, which
+// the caller owns.
+// Returns 0 on success, a negative STARLARK_ERROR_* code, or a positive
+// starlark_ErrorCode if the call is invalid, such as when it's passed the
+// wrong types.
+typedef int (*starlark_BuiltinFn)(struct starlark_Vm *vm,
+				  const struct starlark_Args *args,
+				  struct starlark_Value *out);
+
+// A function implemented in C, such as len, or a method bound to the value it
+// was looked up on, such as [].append.
+struct starlark_Builtin {
+	struct starlark_Object obj;
+	const char *name;
+	starlark_BuiltinFn fn;
+	// The value the method is bound to, or VALUE_NONE for a function.
+	struct starlark_Value self;
+};
+
+// Returns a new module running prog, which it takes ownership of. Every global
+// starts out unbound.
+// Returns NULL if we couldn't allocate enough memory, in which case prog is
+// left alone.
+struct starlark_Module *Module_create(struct starlark_Context *ctx,
+				      struct starlark_Program *prog);
+
+void Module_destroy(struct starlark_Module *m);
+
+// Returns a new function running code, whose defaults_len defaults and
+// frees_len free variables are None until the caller fills them in, giving the
+// function a reference to each.
+// Returns NULL if we couldn't allocate enough memory.
+struct starlark_Function *Function_create(struct starlark_Module *module,
+					  const struct starlark_Code *code);
+
+void Function_destroy(struct starlark_Function *fn);
+
+// Returns a new cell holding v, which it adds a reference to.
+// Returns NULL if we couldn't allocate enough memory.
+struct starlark_Cell *Cell_create(const struct starlark_Value v);
+
+void Cell_destroy(struct starlark_Cell *c);
+
+// Returns a new method called name, which calls fn with self bound to it.
+// Returns NULL if we couldn't allocate enough memory.
+struct starlark_Builtin *Builtin_create(const char *name, starlark_BuiltinFn fn,
+					const struct starlark_Value self);
+
+void Builtin_destroy(struct starlark_Builtin *b);
+
+// Returns the name of the function fn, which must be a function or builtin.
+const char *Function_name(const struct starlark_Value fn);
+
+#endif // STARLARK_FUNCTION_H
@@ -1,81 +1,222 @@
 #include <stdbool.h>
 #include <assert.h>
+#include <limits.h>
+#include <math.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include "tommath.h"
-
+#include "util/common.h"
 #include "util/panic.h"
+#include "util/slab.h"
 #include "starlark/int.h"
+#include "starlark/value.h"
 #include "starlark/common.h"
 
+#if CLARK_USE_LIBTOMMATH
+
+#include "tommath.h"
+
 static_assert(MP_DIGIT_BIT >= 60, "MP_DIGIT_BIT is too small. Clark only "
 				  "supports libtommath configurations with at "
 				  "least 61-bit exponents");
 
+// Ints which fit in INLINE_DIGITS digits keep them inside the starlark_Int, so
+// creating one only takes a single allocation.
+#define INLINE_DIGITS 4
+
 struct starlark_Int {
+	struct starlark_Object obj;
 	mp_int value;
+	mp_digit digits[INLINE_DIGITS];
 };
 
-struct starlark_Int *Int_create()
+static void init_header(struct starlark_Int *i)
 {
-	struct starlark_Int *result = malloc(sizeof(mp_int));
-	if (result == NULL) {
+	i->obj = (struct starlark_Object){
+		.type = STARLARK_TYPE_INT,
+		.refs = 1,
+	};
+}
+
+// Ints are created and destroyed constantly while running starlark code, so
+// their headers and small digit buffers come from slabs instead of malloc.
+// libtommath's allocation hooks don't take a context, so the slabs are per
+// thread. An int destroyed on another thread is handed back to the slabs of
+// the thread which made it, so ints mustn't outlive that thread. The tags tell
+// clark_mp_free which slab a digit buffer came from.
+#define HEADER_TAG 1
+#define DIGITS_TAG 2
+static _Thread_local struct Slab header_slab = { .tag = HEADER_TAG };
+static _Thread_local struct Slab digits_slab = { .tag = DIGITS_TAG };
+
+// The allocation hooks libtommath is built with, see
+// third-party/libtommath-1.2.0/meson.build. Buffers larger than SLAB_MAX_SIZE
+// go to malloc, and buffers pointing at an Int's inline digits are freed along
+// with the Int.
+
+void *clark_mp_malloc(size_t size)
+{
+	if (size > SLAB_MAX_SIZE) {
+		return malloc(size);
+	}
+
+	return slab_alloc(&digits_slab, size);
+}
+
+void *clark_mp_calloc(size_t nmemb, size_t size)
+{
+	if (size != 0 && nmemb > SIZE_MAX / size) {
 		return NULL;
 	}
 
-	int ret = mp_init(&result->value);
-	if (ret != MP_OKAY) {
-		free(result);
+	if (nmemb * size > SLAB_MAX_SIZE) {
+		return calloc(nmemb, size);
+	}
+
+	void *result = slab_alloc(&digits_slab, nmemb * size);
+	if (result != NULL) {
+		memset(result, 0, nmemb * size);
+	}
+
+	return result;
+}
+
+void clark_mp_free(void *mem, size_t size)
+{
+	if (mem == NULL) {
+		return;
+	}
+
+	if (size > SLAB_MAX_SIZE) {
+		free(mem);
+		return;
+	}
+
+	if (slab_tag(mem) == DIGITS_TAG) {
+		slab_free(&digits_slab, mem, size);
+	}
+}
+
+void *clark_mp_realloc(void *mem, size_t oldsize, size_t newsize)
+{
+	if (mem == NULL) {
+		return clark_mp_malloc(newsize);
+	}
+
+	if (oldsize > SLAB_MAX_SIZE && newsize > SLAB_MAX_SIZE) {
+		return realloc(mem, newsize);
+	}
+
+	void *result = clark_mp_malloc(newsize);
+	if (result == NULL) {
 		return NULL;
 	}
 
+	memcpy(result, mem, MIN(oldsize, newsize));
+	clark_mp_free(mem, oldsize);
 	return result;
 }
 
-void Int_set_u32(struct starlark_Int *a, const uint32_t b)
+// Returns a new int with room for at least digits digits, which is 0.
+static struct starlark_Int *alloc_int(const size_t digits)
 {
-	assert(a != NULL);
+	struct starlark_Int *result =
+		slab_alloc(&header_slab, sizeof(struct starlark_Int));
+	if (result == NULL) {
+		return NULL;
+	}
 
-	mp_set_u32(&a->value, b);
+	init_header(result);
+	if (digits > INLINE_DIGITS) {
+		if (mp_init_size(&result->value, (int)digits) != MP_OKAY) {
+			slab_free(&header_slab, result, sizeof(*result));
+			return NULL;
+		}
+
+		return result;
+	}
+
+	memset(result->digits, 0, sizeof(result->digits));
+	result->value = (mp_int){
+		.used = 0,
+		.alloc = INLINE_DIGITS,
+		.sign = MP_ZPOS,
+		.dp = result->digits,
+	};
+	return result;
 }
 
-struct starlark_Int *Int_create_digits(const size_t digits)
+struct starlark_Int *Int_create()
+{
+	return alloc_int(0);
+}
+
+struct starlark_Int *Int_copy(const struct starlark_Int *i)
 {
-	struct starlark_Int *result = malloc(sizeof(mp_int));
+	assert(i != NULL);
+	struct starlark_Int *result = alloc_int((size_t)i->value.used);
 	if (result == NULL) {
 		return NULL;
 	}
 
-	int ret = mp_init_size(&result->value, digits);
-	if (ret != MP_OKAY) {
-		free(result);
+	if (mp_copy(&i->value, &result->value) != MP_OKAY) {
+		Int_destroy(result);
 		return NULL;
 	}
 
 	return result;
 }
 
+void Int_set_u32(struct starlark_Int *a, const uint32_t b)
+{
+	assert(a != NULL);
+
+	mp_set_u32(&a->value, b);
+}
+
+int Int_set_i64(struct starlark_Int *a, const int64_t b)
+{
+	assert(a != NULL);
+
+	// mp_set_i64 can't fail since every mp_int has room for a 64-bit
+	// number, given MP_DIGIT_BIT >= 60.
+	mp_set_i64(&a->value, b);
+	return 0;
+}
+
+bool Int_to_i64(const struct starlark_Int *i, int64_t *out)
+{
+	assert(i != NULL);
+	assert(out != NULL);
+
+	// Only 63 bits of magnitude are guaranteed to fit, which leaves out
+	// INT64_MIN, but that's too big for a small int anyway.
+	if (mp_count_bits(&i->value) > 63) {
+		return false;
+	}
+
+	*out = mp_get_i64(&i->value);
+	return true;
+}
+
+struct starlark_Int *Int_create_digits(const size_t digits)
+{
+	return alloc_int(digits);
+}
+
 int Int_add_u32(const struct starlark_Int *a, const uint32_t b,
 		struct starlark_Int *c)
 {
 	assert(a != NULL);
 	assert(c != NULL);
-	mp_int tmp;
-	if (mp_init(&tmp) != MP_OKAY) {
-		return STARLARK_ERROR_OOM;
-	}
-
-	mp_set_u32(&tmp, b);
 
-	if (mp_add(&a->value, &tmp, &c->value) != MP_OKAY) {
-		mp_clear(&tmp);
+	// A single digit is always at least 60 bits, so b always fits in one.
+	if (mp_add_d(&a->value, b, &c->value) != MP_OKAY) {
 		return STARLARK_ERROR_OOM;
 	}
 
-	mp_clear(&tmp);
 	return 0;
 }
 
@@ -86,24 +227,368 @@ void Int_destroy(const struct starlark_Int *i)
 	}
 
 	mp_clear((mp_int *)&i->value);
-	free((struct starlark_Int *)i);
+	slab_free(&header_slab, (struct starlark_Int *)i, sizeof(*i));
+}
+
+void Int_trim(void)
+{
+	slab_trim(&header_slab);
+	slab_trim(&digits_slab);
+}
+
+// Radix conversion
+//
+// libtommath converts to and from strings one digit at a time, which takes
+// time quadratic in the length of the number. Instead, numbers are split in
+// half around a power of the base, and each half is converted separately. The
+// powers are squares of each other, so only a logarithmic number of them are
+// needed, and they're computed once per conversion.
+//
+// Bases which are powers of two don't need any arithmetic at all, since each
+// character is just a slice of the number's bits.
+
+// The characters used for each digit, the same as libtommath uses.
+static const char radix_digits[] =
+	"0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz+/";
+
+// Numbers with at most this many mp_digits are converted a chunk of
+// characters at a time instead of being split any further.
+#define RADIX_CUTOFF 32
+
+// The most levels of powers a conversion can need, since each level has twice
+// as many characters as the one before it.
+#define RADIX_LEVELS 64
+
+// Returns the value of the character c in the given base, or -1 if c isn't a
+// digit in that base.
+static int digit_value(const char c, const int base)
+{
+	// Bases up to 36 are case insensitive.
+	char upper = c;
+	if (base <= 36 && c >= 'a' && c <= 'z') {
+		upper = c - 'a' + 'A';
+	}
+
+	const char *pos = memchr(radix_digits, upper, base);
+	if (c == '\0' || pos == NULL) {
+		return -1;
+	}
+
+	return (int)(pos - radix_digits);
+}
+
+// Returns log2(base) if base is a power of two, and 0 otherwise.
+static int pow2_shift(const int base)
+{
+	if ((base & (base - 1)) != 0) {
+		return 0;
+	}
+
+	int shift = 0;
+	while ((1 << shift) != base) {
+		shift += 1;
+	}
+
+	return shift;
+}
+
+// The powers of a base used to split numbers in half. Level k holds
+// base^(chunk * 2^k), along with its reciprocal for dividing by it quickly.
+struct RadixPowers {
+	int base;
+	// The number of characters which fit in a single mp_digit.
+	int chunk;
+	mp_digit chunk_pow;
+
+	int len;
+	mp_int pows[RADIX_LEVELS];
+	// recips[k] = floor(2^(2 * bits[k]) / pows[k]), or 0 if it hasn't been
+	// computed yet.
+	mp_int recips[RADIX_LEVELS];
+	int bits[RADIX_LEVELS];
+};
+
+static void radix_powers_init(struct RadixPowers *p, const int base)
+{
+	p->base = base;
+	p->chunk = 0;
+	p->chunk_pow = 1;
+	while (p->chunk_pow <= MP_MASK / (mp_digit)base) {
+		p->chunk_pow *= base;
+		p->chunk += 1;
+	}
+
+	p->len = 0;
+}
+
+// Returns the number of characters in level k.
+static size_t radix_width(const struct RadixPowers *p, const int k)
+{
+	return (size_t)p->chunk << k;
+}
+
+// Makes sure levels 0 through k exist.
+static mp_err radix_powers_grow(struct RadixPowers *p, const int k)
+{
+	assert(k < RADIX_LEVELS);
+	while (p->len <= k) {
+		mp_int *pow = &p->pows[p->len];
+		if (mp_init_multi(pow, &p->recips[p->len], NULL) != MP_OKAY) {
+			return MP_MEM;
+		}
+
+		mp_err err = MP_OKAY;
+		if (p->len == 0) {
+			mp_set(pow, p->chunk_pow);
+		} else {
+			err = mp_sqr(&p->pows[p->len - 1], pow);
+		}
+
+		p->len += 1;
+		if (err != MP_OKAY) {
+			return err;
+		}
+
+		p->bits[p->len - 1] = mp_count_bits(pow);
+	}
+
+	return MP_OKAY;
+}
+
+static void radix_powers_finish(struct RadixPowers *p)
+{
+	for (int k = 0; k < p->len; k += 1) {
+		mp_clear_multi(&p->pows[k], &p->recips[k], NULL);
+	}
+
+	p->len = 0;
+}
+
+// Computes r = floor(2^(2n) / d), where d has n bits, using Newton's method.
+// Each step only needs multiplications, which libtommath does in subquadratic
+// time, unlike division.
+static mp_err reciprocal(const mp_int *d, const int n, mp_int *r)
+{
+	mp_int one;
+	mp_int e;
+	mp_int t;
+	mp_err err = mp_init_multi(&one, &e, &t, NULL);
+	if (err != MP_OKAY) {
+		return err;
+	}
+
+	if ((err = mp_2expt(&one, 2 * n)) != MP_OKAY) {
+		goto done;
+	}
+
+	if (n <= RADIX_CUTOFF * MP_DIGIT_BIT) {
+		err = mp_div(&one, d, r, NULL);
+		goto done;
+	}
+
+	// The reciprocal of the top half of d's bits is already correct to
+	// about half of the bits we need, so a step or two of Newton's
+	// method finishes it off, each of which doubles the correct bits.
+	const int half = n / 2 + 8;
+	if ((err = mp_div_2d(d, n - half, &t, NULL)) != MP_OKAY ||
+	    (err = reciprocal(&t, half, r)) != MP_OKAY ||
+	    (err = mp_mul_2d(r, n - half, r)) != MP_OKAY) {
+		goto done;
+	}
+
+	for (;;) {
+		// r += r * (2^(2n) - d * r) / 2^(2n)
+		if ((err = mp_mul(d, r, &e)) != MP_OKAY ||
+		    (err = mp_sub(&one, &e, &e)) != MP_OKAY ||
+		    (err = mp_mul(r, &e, &t)) != MP_OKAY ||
+		    (err = mp_signed_rsh(&t, 2 * n, &t)) != MP_OKAY) {
+			goto done;
+		}
+
+		if (mp_iszero(&t)) {
+			break;
+		}
+
+		if ((err = mp_add(r, &t, r)) != MP_OKAY) {
+			goto done;
+		}
+	}
+
+	// The floors along the way can leave r slightly off.
+	for (;;) {
+		if ((err = mp_mul(d, r, &e)) != MP_OKAY) {
+			goto done;
+		}
+
+		if (mp_cmp(&e, &one) == MP_GT) {
+			err = mp_sub_d(r, 1, r);
+		} else if ((err = mp_add(&e, d, &e)) == MP_OKAY &&
+			   mp_cmp(&e, &one) != MP_GT) {
+			err = mp_add_d(r, 1, r);
+		} else {
+			break;
+		}
+
+		if (err != MP_OKAY) {
+			goto done;
+		}
+	}
+
+done:
+	mp_clear_multi(&one, &e, &t, NULL);
+	return err;
+}
+
+// Computes q = x / pows[k] and r = x % pows[k], where 0 <= x < pows[k]^2,
+// using the level's reciprocal.
+static mp_err radix_divmod(struct RadixPowers *p, const int k, const mp_int *x,
+			   mp_int *q, mp_int *r)
+{
+	const mp_int *d = &p->pows[k];
+	mp_err err = MP_OKAY;
+	if (mp_iszero(&p->recips[k])) {
+		err = reciprocal(d, p->bits[k], &p->recips[k]);
+		if (err != MP_OKAY) {
+			return err;
+		}
+	}
+
+	// Since x < 2^(2n), this q is at most 2 less than the real quotient.
+	if ((err = mp_mul(x, &p->recips[k], q)) != MP_OKAY ||
+	    (err = mp_div_2d(q, 2 * p->bits[k], q, NULL)) != MP_OKAY ||
+	    (err = mp_mul(q, d, r)) != MP_OKAY ||
+	    (err = mp_sub(x, r, r)) != MP_OKAY) {
+		return err;
+	}
+
+	while (mp_cmp(r, d) != MP_LT) {
+		if ((err = mp_sub(r, d, r)) != MP_OKAY ||
+		    (err = mp_add_d(q, 1, q)) != MP_OKAY) {
+			return err;
+		}
+	}
+
+	return MP_OKAY;
+}
+
+// Writes the digits of x backwards, ending just before *end, and moves *end to
+// the first digit written. If width isn't 0, the number is padded with zeros
+// to exactly width characters. Otherwise it has no leading zeros. x is
+// destroyed.
+static mp_err write_digits_small(struct RadixPowers *p, mp_int *x,
+				 const size_t width, char **end)
+{
+	char *ptr = *end;
+	while (!mp_iszero(x)) {
+		mp_digit chunk = 0;
+		mp_err err = mp_div_d(x, p->chunk_pow, x, &chunk);
+		if (err != MP_OKAY) {
+			return err;
+		}
+
+		for (int i = 0; i < p->chunk; i += 1) {
+			ptr -= 1;
+			*ptr = radix_digits[chunk % (mp_digit)p->base];
+			chunk /= (mp_digit)p->base;
+		}
+	}
+
+	if (width == 0) {
+		while (ptr < *end && *ptr == '0') {
+			ptr += 1;
+		}
+	} else {
+		assert((size_t)(*end - ptr) <= width);
+		while ((size_t)(*end - ptr) < width) {
+			ptr -= 1;
+			*ptr = '0';
+		}
+	}
+
+	*end = ptr;
+	return MP_OKAY;
+}
+
+// The same as write_digits_small, where 0 <= x < pows[k]^2.
+static mp_err write_digits(struct RadixPowers *p, const int k, mp_int *x,
+			   const size_t width, char **end)
+{
+	if (k < 0 || x->used <= RADIX_CUTOFF) {
+		return write_digits_small(p, x, width, end);
+	}
+
+	// Leading zeros are left off, so there's nothing to split.
+	if (width == 0 && mp_cmp(x, &p->pows[k]) == MP_LT) {
+		return write_digits(p, k - 1, x, width, end);
+	}
+
+	mp_int q;
+	mp_int r;
+	mp_err err = mp_init_multi(&q, &r, NULL);
+	if (err != MP_OKAY) {
+		return err;
+	}
+
+	const size_t half = radix_width(p, k);
+	if ((err = radix_divmod(p, k, x, &q, &r)) != MP_OKAY) {
+		goto done;
+	}
+
+	mp_zero(x);
+	if ((err = write_digits(p, k - 1, &r, half, end)) != MP_OKAY) {
+		goto done;
+	}
+
+	err = write_digits(p, k - 1, &q, width == 0 ? 0 : width - half, end);
+
+done:
+	mp_clear_multi(&q, &r, NULL);
+	return err;
+}
+
+// Writes the digits of the nonnegative number a, in a base which is a power of
+// two, by slicing its bits directly.
+static char *write_digits_pow2(const mp_int *a, const int shift, char *ptr)
+{
+	const int bits = mp_count_bits(a);
+	const size_t len = bits == 0 ? 1 : ((size_t)bits + shift - 1) / shift;
+	const mp_digit mask = ((mp_digit)1 << shift) - 1;
+
+	for (size_t i = 0; i < len; i += 1) {
+		const size_t pos = (len - 1 - i) * shift;
+		const size_t idx = pos / MP_DIGIT_BIT;
+		const size_t off = pos % MP_DIGIT_BIT;
+		mp_digit d = 0;
+		if ((int)idx < a->used) {
+			d = a->dp[idx] >> off;
+		}
+
+		if (off + shift > MP_DIGIT_BIT && (int)idx + 1 < a->used) {
+			d |= a->dp[idx + 1] << (MP_DIGIT_BIT - off);
+		}
+
+		ptr[i] = radix_digits[d & mask];
+	}
+
+	return ptr + len;
 }
 
 char *Int_to_str(const struct starlark_Int *i, const int base)
 {
 	assert(i != NULL);
-	assert(base > 2);
+	assert(base >= 2);
 	assert(base < 64);
-	int str_len = 0;
-	mp_err ret = mp_radix_size(&i->value, base, &str_len);
-	if (ret != MP_OKAY) {
-		return NULL;
-	}
 
-	size_t len = str_len;
-	if (base == 16 || base == 8 || base == 2) {
-		len += 2;
-	}
+	const mp_int *a = &i->value;
+	const int shift = pow2_shift(base);
+
+	// Each character holds log2(base) bits. The extra room is for the
+	// sign, the prefix, the null terminator, rounding, and the leading
+	// zeros of the first chunk written by write_digits_small before
+	// they're removed.
+	const double bits_per_char = log2(base);
+	const size_t len = (size_t)(mp_count_bits(a) / bits_per_char) + 8 +
+			   MP_DIGIT_BIT;
 
 	char *result = malloc(len);
 	if (result == NULL) {
@@ -111,42 +596,222 @@ char *Int_to_str(const struct starlark_Int *i, const int base)
 	}
 
 	char *ptr = result;
+	if (mp_isneg(a)) {
+		*ptr++ = '-';
+	}
 
 	if (base == 16) {
-		memcpy(result, u8"0x", 2);
+		memcpy(ptr, u8"0x", 2);
 		ptr += 2;
 	} else if (base == 8) {
-		memcpy(result, u8"0o", 2);
+		memcpy(ptr, u8"0o", 2);
 		ptr += 2;
 	} else if (base == 2) {
-		memcpy(result, u8"0b", 2);
+		memcpy(ptr, u8"0b", 2);
 		ptr += 2;
 	}
 
-	size_t written = 0;
-	ret = mp_to_radix(&i->value, ptr, str_len, &written, base);
-	if (ret != MP_OKAY || written != (size_t)str_len) {
+	if (shift != 0) {
+		ptr = write_digits_pow2(a, shift, ptr);
+		*ptr = '\0';
+		return result;
+	}
+
+	if (mp_iszero(a)) {
+		memcpy(ptr, "0", 2);
+		return result;
+	}
+
+	// The digits are written backwards from the end of the buffer, then
+	// moved into place.
+	struct RadixPowers p;
+	radix_powers_init(&p, base);
+
+	mp_int x;
+	mp_err err = mp_init_copy(&x, a);
+	if (err != MP_OKAY) {
+		free(result);
+		return NULL;
+	}
+
+	x.sign = MP_ZPOS;
+
+	// Find the smallest power whose square is bigger than x.
+	int k = -1;
+	if (x.used > RADIX_CUTOFF) {
+		const int bits = mp_count_bits(&x);
+		do {
+			k += 1;
+			err = radix_powers_grow(&p, k);
+		} while (err == MP_OKAY && 2 * (p.bits[k] - 1) < bits);
+	}
+
+	char *end = result + len;
+	if (err == MP_OKAY) {
+		err = write_digits(&p, k, &x, 0, &end);
+	}
+
+	mp_clear(&x);
+	radix_powers_finish(&p);
+	if (err != MP_OKAY) {
 		free(result);
 		return NULL;
 	}
 
+	const size_t digits = result + len - end;
+	memmove(ptr, end, digits);
+	ptr[digits] = '\0';
 	return result;
 }
 
-struct starlark_Int *Int_from_str(const char *str, const int base)
+// Reads the len digits starting at str a chunk of characters at a time.
+static mp_err read_digits_small(const struct RadixPowers *p, const char *str,
+				size_t len, mp_int *a)
+{
+	mp_zero(a);
+	while (len > 0) {
+		mp_digit chunk = 0;
+		mp_digit scale = 1;
+		for (int i = 0; i < p->chunk && len > 0; i += 1) {
+			chunk = chunk * p->base + digit_value(*str, p->base);
+			scale *= p->base;
+			str += 1;
+			len -= 1;
+		}
+
+		mp_err err = mp_mul_d(a, scale, a);
+		if (err != MP_OKAY) {
+			return err;
+		}
+
+		if ((err = mp_add_d(a, chunk, a)) != MP_OKAY) {
+			return err;
+		}
+	}
+
+	return MP_OKAY;
+}
+
+// Reads the len digits starting at str by splitting them in half, so that
+// a = high * base^(low digits) + low.
+static mp_err read_digits(struct RadixPowers *p, const char *str,
+			  const size_t len, mp_int *a)
+{
+	if (len <= radix_width(p, 0) * RADIX_CUTOFF) {
+		return read_digits_small(p, str, len, a);
+	}
+
+	// The biggest level which leaves some digits in the high half.
+	int k = 0;
+	while (radix_width(p, k + 1) < len) {
+		k += 1;
+	}
+
+	mp_err err = radix_powers_grow(p, k);
+	if (err != MP_OKAY) {
+		return err;
+	}
+
+	mp_int low;
+	if ((err = mp_init(&low)) != MP_OKAY) {
+		return err;
+	}
+
+	const size_t low_len = radix_width(p, k);
+	if ((err = read_digits(p, str, len - low_len, a)) != MP_OKAY ||
+	    (err = read_digits(p, str + len - low_len, low_len, &low)) !=
+		    MP_OKAY ||
+	    (err = mp_mul(a, &p->pows[k], a)) != MP_OKAY) {
+		goto done;
+	}
+
+	err = mp_add(a, &low, a);
+
+done:
+	mp_clear(&low);
+	return err;
+}
+
+// Reads the len digits starting at str, in a base which is a power of two, by
+// placing each one's bits directly.
+static mp_err read_digits_pow2(const char *str, const size_t len,
+			       const int base, const int shift, mp_int *a)
+{
+	const size_t bits = len * shift;
+	const int used = (int)((bits + MP_DIGIT_BIT - 1) / MP_DIGIT_BIT);
+	mp_zero(a);
+	mp_err err = mp_grow(a, used);
+	if (err != MP_OKAY) {
+		return err;
+	}
+
+	for (size_t i = 0; i < len; i += 1) {
+		const mp_digit d = digit_value(str[len - 1 - i], base);
+		const size_t pos = i * shift;
+		const size_t idx = pos / MP_DIGIT_BIT;
+		const size_t off = pos % MP_DIGIT_BIT;
+		a->dp[idx] |= (d << off) & MP_MASK;
+		if (off + shift > MP_DIGIT_BIT) {
+			a->dp[idx + 1] |= d >> (MP_DIGIT_BIT - off);
+		}
+	}
+
+	a->used = used;
+	mp_clamp(a);
+	return MP_OKAY;
+}
+
+int Int_from_str(const char *str, const int base, struct starlark_Int **out)
 {
 	assert(str != NULL);
+	assert(out != NULL);
+	assert(base >= 2);
+	assert(base < 64);
+
+	bool neg = false;
+	if (*str == '-') {
+		neg = true;
+		str += 1;
+	}
+
+	// Like mp_read_radix, the digits may only be followed by a newline.
+	size_t len = 0;
+	while (digit_value(str[len], base) >= 0) {
+		len += 1;
+	}
+
+	if (len == 0 ||
+	    (str[len] != '\0' && str[len] != '\r' && str[len] != '\n')) {
+		return STARLARK_ERRORCODE_INT_INVALID;
+	}
+
 	struct starlark_Int *result = Int_create();
 	if (result == NULL) {
-		return NULL;
+		return STARLARK_ERROR_OOM;
 	}
 
-	mp_err ret = mp_read_radix(&result->value, str, base);
-	if (ret != MP_OKAY) {
-		return NULL;
+	mp_err err = MP_OKAY;
+	const int shift = pow2_shift(base);
+	if (shift != 0) {
+		err = read_digits_pow2(str, len, base, shift, &result->value);
+	} else {
+		struct RadixPowers p;
+		radix_powers_init(&p, base);
+		err = read_digits(&p, str, len, &result->value);
+		radix_powers_finish(&p);
 	}
 
-	return result;
+	if (err != MP_OKAY) {
+		Int_destroy(result);
+		return STARLARK_ERROR_OOM;
+	}
+
+	if (neg && !mp_iszero(&result->value)) {
+		result->value.sign = MP_NEG;
+	}
+
+	*out = result;
+	return 0;
 }
 
 int Int_add(const struct starlark_Int *a, const struct starlark_Int *b,
@@ -186,3 +851,580 @@ int Int_pow_u32(const struct starlark_Int *a, const uint32_t b,
 
 	return 0;
 }
+
+int Int_sub(const struct starlark_Int *a, const struct starlark_Int *b,
+	    struct starlark_Int *c)
+{
+	assert(a != NULL);
+	assert(b != NULL);
+	assert(c != NULL);
+	if (mp_sub(&a->value, &b->value, &c->value) != MP_OKAY) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	return 0;
+}
+
+int Int_divmod(const struct starlark_Int *a, const struct starlark_Int *b,
+	       struct starlark_Int *q, struct starlark_Int *r)
+{
+	assert(a != NULL);
+	assert(b != NULL);
+	assert(!mp_iszero(&b->value));
+
+	// mp_div rounds towards zero, so the results need fixing up whenever
+	// the remainder and divisor have different signs.
+	mp_int tq;
+	mp_int tr;
+	if (mp_init_multi(&tq, &tr, NULL) != MP_OKAY) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	int result = STARLARK_ERROR_OOM;
+	if (mp_div(&a->value, &b->value, &tq, &tr) != MP_OKAY) {
+		goto done;
+	}
+
+	if (!mp_iszero(&tr) && mp_isneg(&tr) != mp_isneg(&b->value)) {
+		if (mp_sub_d(&tq, 1, &tq) != MP_OKAY ||
+		    mp_add(&tr, &b->value, &tr) != MP_OKAY) {
+			goto done;
+		}
+	}
+
+	if (q != NULL) {
+		mp_exch(&q->value, &tq);
+	}
+
+	if (r != NULL) {
+		mp_exch(&r->value, &tr);
+	}
+
+	result = 0;
+done:
+	mp_clear_multi(&tq, &tr, NULL);
+	return result;
+}
+
+int Int_neg(const struct starlark_Int *a, struct starlark_Int *c)
+{
+	assert(a != NULL);
+	assert(c != NULL);
+	if (mp_neg(&a->value, &c->value) != MP_OKAY) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	return 0;
+}
+
+int Int_not(const struct starlark_Int *a, struct starlark_Int *c)
+{
+	assert(a != NULL);
+	assert(c != NULL);
+	if (mp_complement(&a->value, &c->value) != MP_OKAY) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	return 0;
+}
+
+int Int_and(const struct starlark_Int *a, const struct starlark_Int *b,
+	    struct starlark_Int *c)
+{
+	assert(a != NULL);
+	assert(b != NULL);
+	assert(c != NULL);
+	if (mp_and(&a->value, &b->value, &c->value) != MP_OKAY) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	return 0;
+}
+
+int Int_or(const struct starlark_Int *a, const struct starlark_Int *b,
+	   struct starlark_Int *c)
+{
+	assert(a != NULL);
+	assert(b != NULL);
+	assert(c != NULL);
+	if (mp_or(&a->value, &b->value, &c->value) != MP_OKAY) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	return 0;
+}
+
+int Int_xor(const struct starlark_Int *a, const struct starlark_Int *b,
+	    struct starlark_Int *c)
+{
+	assert(a != NULL);
+	assert(b != NULL);
+	assert(c != NULL);
+	if (mp_xor(&a->value, &b->value, &c->value) != MP_OKAY) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	return 0;
+}
+
+int Int_lshift(const struct starlark_Int *a, const uint32_t b,
+	       struct starlark_Int *c)
+{
+	assert(a != NULL);
+	assert(c != NULL);
+	assert(b <= INT_MAX);
+	if (mp_mul_2d(&a->value, (int)b, &c->value) != MP_OKAY) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	return 0;
+}
+
+int Int_rshift(const struct starlark_Int *a, const uint32_t b,
+	       struct starlark_Int *c)
+{
+	assert(a != NULL);
+	assert(c != NULL);
+	assert(b <= INT_MAX);
+	if (mp_signed_rsh(&a->value, (int)b, &c->value) != MP_OKAY) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	return 0;
+}
+
+int Int_cmp(const struct starlark_Int *a, const struct starlark_Int *b)
+{
+	assert(a != NULL);
+	assert(b != NULL);
+	switch (mp_cmp(&a->value, &b->value)) {
+	case MP_LT:
+		return -1;
+	case MP_GT:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+bool Int_is_zero(const struct starlark_Int *a)
+{
+	assert(a != NULL);
+	return mp_iszero(&a->value);
+}
+
+int Int_sign(const struct starlark_Int *a)
+{
+	assert(a != NULL);
+	if (mp_iszero(&a->value)) {
+		return 0;
+	}
+
+	return mp_isneg(&a->value) ? -1 : 1;
+}
+
+uint64_t Int_low_u64(const struct starlark_Int *a)
+{
+	assert(a != NULL);
+	return mp_get_mag_u64(&a->value);
+}
+
+size_t Int_bit_len(const struct starlark_Int *a)
+{
+	assert(a != NULL);
+	return (size_t)mp_count_bits(&a->value);
+}
+
+// Enough digits to hold any finite double, with room for mp_mul_2d to not need
+// to grow the result.
+#define DOUBLE_DIGITS ((1024 + MP_DIGIT_BIT - 1) / MP_DIGIT_BIT + 3)
+
+bool Int_eq_double(const struct starlark_Int *a, const double b)
+{
+	assert(a != NULL);
+	assert(isfinite(b) && b == trunc(b));
+
+	// The digits are on the stack, so tmp is never grown or cleared,
+	// which would pass them to clark_mp_free.
+	mp_digit digits[DOUBLE_DIGITS] = { 0 };
+	mp_int tmp = {
+		.used = 0,
+		.alloc = DOUBLE_DIGITS,
+		.sign = MP_ZPOS,
+		.dp = digits,
+	};
+	if (mp_set_double(&tmp, b) != MP_OKAY) {
+		return false;
+	}
+
+	return mp_cmp(&a->value, &tmp) == MP_EQ;
+}
+
+#elif CLARK_USE_LIBGMP
+
+#include <gmp.h>
+
+// GMP calls abort() when it runs out of memory instead of returning an error,
+// so none of these can fail.
+
+struct starlark_Int {
+	struct starlark_Object obj;
+	mpz_t value;
+};
+
+// Ints are created and destroyed constantly while running starlark code, so
+// their headers come from a slab instead of malloc. GMP's allocation functions
+// are process wide and set with mp_set_memory_functions, so the limbs are left
+// to GMP. As with libtommath, the slab is per thread, and ints mustn't outlive
+// the thread which made them.
+static _Thread_local struct Slab header_slab;
+
+static void init_header(struct starlark_Int *i)
+{
+	i->obj = (struct starlark_Object){
+		.type = STARLARK_TYPE_INT,
+		.refs = 1,
+	};
+}
+
+struct starlark_Int *Int_create()
+{
+	struct starlark_Int *result =
+		slab_alloc(&header_slab, sizeof(*result));
+	if (result == NULL) {
+		return NULL;
+	}
+
+	init_header(result);
+	mpz_init(result->value);
+	return result;
+}
+
+struct starlark_Int *Int_create_digits(const size_t digits)
+{
+	struct starlark_Int *result =
+		slab_alloc(&header_slab, sizeof(*result));
+	if (result == NULL) {
+		return NULL;
+	}
+
+	init_header(result);
+	mpz_init2(result->value, digits * GMP_NUMB_BITS);
+	return result;
+}
+
+struct starlark_Int *Int_copy(const struct starlark_Int *i)
+{
+	assert(i != NULL);
+	struct starlark_Int *result =
+		slab_alloc(&header_slab, sizeof(*result));
+	if (result == NULL) {
+		return NULL;
+	}
+
+	init_header(result);
+	mpz_init_set(result->value, i->value);
+	return result;
+}
+
+void Int_set_u32(struct starlark_Int *a, const uint32_t b)
+{
+	assert(a != NULL);
+
+	mpz_set_ui(a->value, b);
+}
+
+int Int_set_i64(struct starlark_Int *a, const int64_t b)
+{
+	assert(a != NULL);
+
+	// long is only 32 bits on some platforms, so go through mpz_import.
+	uint64_t magnitude = b < 0 ? -(uint64_t)b : (uint64_t)b;
+	mpz_import(a->value, 1, 1, sizeof(magnitude), 0, 0, &magnitude);
+	if (b < 0) {
+		mpz_neg(a->value, a->value);
+	}
+
+	return 0;
+}
+
+bool Int_to_i64(const struct starlark_Int *i, int64_t *out)
+{
+	assert(i != NULL);
+	assert(out != NULL);
+
+	// Only 63 bits of magnitude are guaranteed to fit, which leaves out
+	// INT64_MIN, but that's too big for a small int anyway.
+	if (mpz_sizeinbase(i->value, 2) > 63) {
+		return false;
+	}
+
+	uint64_t magnitude = 0;
+	mpz_export(&magnitude, NULL, 1, sizeof(magnitude), 0, 0, i->value);
+	*out = mpz_sgn(i->value) < 0 ? -(int64_t)magnitude :
+				       (int64_t)magnitude;
+	return true;
+}
+
+int Int_add_u32(const struct starlark_Int *a, const uint32_t b,
+		struct starlark_Int *c)
+{
+	assert(a != NULL);
+	assert(c != NULL);
+	mpz_add_ui(c->value, a->value, b);
+	return 0;
+}
+
+void Int_destroy(const struct starlark_Int *i)
+{
+	if (i == NULL) {
+		return;
+	}
+
+	mpz_clear((mpz_ptr)i->value);
+	slab_free(&header_slab, (struct starlark_Int *)i, sizeof(*i));
+}
+
+void Int_trim(void)
+{
+	slab_trim(&header_slab);
+}
+
+char *Int_to_str(const struct starlark_Int *i, const int base)
+{
+	assert(i != NULL);
+	assert(base >= 2);
+	assert(base <= 62);
+
+	// mpz_sizeinbase can be one too big, and doesn't count the sign or
+	// the null terminator.
+	size_t len = mpz_sizeinbase(i->value, base) + 2;
+	if (base == 16 || base == 8 || base == 2) {
+		len += 2;
+	}
+
+	char *result = malloc(len);
+	if (result == NULL) {
+		return NULL;
+	}
+
+	char *ptr = result;
+	if (mpz_sgn(i->value) < 0) {
+		*ptr++ = '-';
+	}
+
+	if (base == 16) {
+		memcpy(ptr, u8"0x", 2);
+		ptr += 2;
+	} else if (base == 8) {
+		memcpy(ptr, u8"0o", 2);
+		ptr += 2;
+	} else if (base == 2) {
+		memcpy(ptr, u8"0b", 2);
+		ptr += 2;
+	}
+
+	// A negative base gives upper case digits, which matches libtommath.
+	// The sign has already been written, so convert the magnitude.
+	mpz_t magnitude;
+	mpz_roinit_n(magnitude, mpz_limbs_read(i->value),
+		     mpz_size(i->value));
+	mpz_get_str(ptr, base <= 36 ? -base : base, magnitude);
+	return result;
+}
+
+int Int_from_str(const char *str, const int base, struct starlark_Int **out)
+{
+	assert(str != NULL);
+	assert(out != NULL);
+	struct starlark_Int *result = Int_create();
+	if (result == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	if (mpz_set_str(result->value, str, base) != 0) {
+		Int_destroy(result);
+		return STARLARK_ERRORCODE_INT_INVALID;
+	}
+
+	*out = result;
+	return 0;
+}
+
+int Int_add(const struct starlark_Int *a, const struct starlark_Int *b,
+	    struct starlark_Int *c)
+{
+	assert(a != NULL);
+	assert(b != NULL);
+	assert(c != NULL);
+	mpz_add(c->value, a->value, b->value);
+	return 0;
+}
+
+int Int_mul(const struct starlark_Int *a, const struct starlark_Int *b,
+	    struct starlark_Int *c)
+{
+	assert(a != NULL);
+	assert(b != NULL);
+	assert(c != NULL);
+	mpz_mul(c->value, a->value, b->value);
+	return 0;
+}
+
+int Int_pow_u32(const struct starlark_Int *a, const uint32_t b,
+		struct starlark_Int *c)
+{
+	assert(a != NULL);
+	assert(c != NULL);
+	mpz_pow_ui(c->value, a->value, b);
+	return 0;
+}
+
+int Int_sub(const struct starlark_Int *a, const struct starlark_Int *b,
+	    struct starlark_Int *c)
+{
+	assert(a != NULL);
+	assert(b != NULL);
+	assert(c != NULL);
+	mpz_sub(c->value, a->value, b->value);
+	return 0;
+}
+
+int Int_divmod(const struct starlark_Int *a, const struct starlark_Int *b,
+	       struct starlark_Int *q, struct starlark_Int *r)
+{
+	assert(a != NULL);
+	assert(b != NULL);
+	assert(mpz_sgn(b->value) != 0);
+
+	if (q != NULL && r != NULL) {
+		mpz_fdiv_qr(q->value, r->value, a->value, b->value);
+	} else if (q != NULL) {
+		mpz_fdiv_q(q->value, a->value, b->value);
+	} else if (r != NULL) {
+		mpz_fdiv_r(r->value, a->value, b->value);
+	}
+
+	return 0;
+}
+
+int Int_neg(const struct starlark_Int *a, struct starlark_Int *c)
+{
+	assert(a != NULL);
+	assert(c != NULL);
+	mpz_neg(c->value, a->value);
+	return 0;
+}
+
+int Int_not(const struct starlark_Int *a, struct starlark_Int *c)
+{
+	assert(a != NULL);
+	assert(c != NULL);
+	mpz_com(c->value, a->value);
+	return 0;
+}
+
+int Int_and(const struct starlark_Int *a, const struct starlark_Int *b,
+	    struct starlark_Int *c)
+{
+	assert(a != NULL);
+	assert(b != NULL);
+	assert(c != NULL);
+	mpz_and(c->value, a->value, b->value);
+	return 0;
+}
+
+int Int_or(const struct starlark_Int *a, const struct starlark_Int *b,
+	   struct starlark_Int *c)
+{
+	assert(a != NULL);
+	assert(b != NULL);
+	assert(c != NULL);
+	mpz_ior(c->value, a->value, b->value);
+	return 0;
+}
+
+int Int_xor(const struct starlark_Int *a, const struct starlark_Int *b,
+	    struct starlark_Int *c)
+{
+	assert(a != NULL);
+	assert(b != NULL);
+	assert(c != NULL);
+	mpz_xor(c->value, a->value, b->value);
+	return 0;
+}
+
+int Int_lshift(const struct starlark_Int *a, const uint32_t b,
+	       struct starlark_Int *c)
+{
+	assert(a != NULL);
+	assert(c != NULL);
+	mpz_mul_2exp(c->value, a->value, b);
+	return 0;
+}
+
+int Int_rshift(const struct starlark_Int *a, const uint32_t b,
+	       struct starlark_Int *c)
+{
+	assert(a != NULL);
+	assert(c != NULL);
+	mpz_fdiv_q_2exp(c->value, a->value, b);
+	return 0;
+}
+
+int Int_cmp(const struct starlark_Int *a, const struct starlark_Int *b)
+{
+	assert(a != NULL);
+	assert(b != NULL);
+	int result = mpz_cmp(a->value, b->value);
+	return (result > 0) - (result < 0);
+}
+
+bool Int_is_zero(const struct starlark_Int *a)
+{
+	assert(a != NULL);
+	return mpz_sgn(a->value) == 0;
+}
+
+int Int_sign(const struct starlark_Int *a)
+{
+	assert(a != NULL);
+	return mpz_sgn(a->value);
+}
+
+uint64_t Int_low_u64(const struct starlark_Int *a)
+{
+	assert(a != NULL);
+
+	uint64_t result = 0;
+	const size_t limbs = mpz_size(a->value);
+	for (size_t i = 0; i < limbs && i * GMP_NUMB_BITS < 64; i += 1) {
+		result |= (uint64_t)mpz_getlimbn(a->value, (mp_size_t)i)
+			  << (i * GMP_NUMB_BITS);
+	}
+
+	return result;
+}
+
+size_t Int_bit_len(const struct starlark_Int *a)
+{
+	assert(a != NULL);
+
+	// mpz_sizeinbase says 0 needs 1 bit.
+	if (mpz_sgn(a->value) == 0) {
+		return 0;
+	}
+
+	return mpz_sizeinbase(a->value, 2);
+}
+
+bool Int_eq_double(const struct starlark_Int *a, const double b)
+{
+	assert(a != NULL);
+	assert(isfinite(b) && b == trunc(b));
+	return mpz_cmp_d(a->value, b) == 0;
+}
+
+#else
+#error "no bigint library was selected"
+#endif // CLARK_USE_LIBTOMMATH
@@ -1,5 +1,6 @@
 #ifndef STARLARK_INT_H
 #define STARLARK_INT_H
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 
@@ -7,6 +8,9 @@
 
 // This only exists to allow switching out the bigint library used without
 // needing too many code changes.
+//
+// Every starlark_Int starts with a starlark_Object header, so a pointer to one
+// can be stored in a starlark_Value.
 
 #define INT60_MAX INT64_C(576460752303423487)
 #define INT60_MIN INT64_C(-576460752303423488)
@@ -15,8 +19,23 @@ struct starlark_Int *Int_create();
 struct starlark_Int *Int_create_digits(const size_t digits);
 void Int_destroy(const struct starlark_Int *i);
 
+// Gives the memory this thread keeps for making ints back to malloc, once every
+// int made on it has been destroyed. Ints are made and destroyed constantly
+// while a program runs, so this is only done when a context is finished.
+void Int_trim(void);
+
+// Returns a new int with the same value as i, or NULL on failure.
+struct starlark_Int *Int_copy(const struct starlark_Int *i);
+
 void Int_set_u32(struct starlark_Int *a, const uint32_t b);
 
+// Returns nonzero on failure.
+int Int_set_i64(struct starlark_Int *a, const int64_t b);
+
+// Stores i in out if it fits in an int64_t.
+// Returns false if it doesn't fit.
+bool Int_to_i64(const struct starlark_Int *i, int64_t *out);
+
 // Computes c = a + b
 // Returns nonzero on failure.
 int Int_add_u32(const struct starlark_Int *a, const uint32_t b,
@@ -27,6 +46,73 @@ int Int_add_u32(const struct starlark_Int *a, const uint32_t b,
 int Int_add(const struct starlark_Int *a, const struct starlark_Int *b,
 	    struct starlark_Int *c);
 
+// Computes c = a - b
+// Returns nonzero on failure.
+int Int_sub(const struct starlark_Int *a, const struct starlark_Int *b,
+	    struct starlark_Int *c);
+
+// Computes q = a // b and r = a % b, rounding towards negative infinity so
+// that r has the same sign as b. Either of q or r can be NULL. b must not be
+// zero.
+// Returns nonzero on failure.
+int Int_divmod(const struct starlark_Int *a, const struct starlark_Int *b,
+	       struct starlark_Int *q, struct starlark_Int *r);
+
+// Computes c = -a
+// Returns nonzero on failure.
+int Int_neg(const struct starlark_Int *a, struct starlark_Int *c);
+
+// Computes c = ~a, which is -a - 1.
+// Returns nonzero on failure.
+int Int_not(const struct starlark_Int *a, struct starlark_Int *c);
+
+// The bitwise operations treat negative numbers as though they were stored in
+// two's complement with infinitely many sign bits.
+
+// Computes c = a & b
+// Returns nonzero on failure.
+int Int_and(const struct starlark_Int *a, const struct starlark_Int *b,
+	    struct starlark_Int *c);
+
+// Computes c = a | b
+// Returns nonzero on failure.
+int Int_or(const struct starlark_Int *a, const struct starlark_Int *b,
+	   struct starlark_Int *c);
+
+// Computes c = a ^ b
+// Returns nonzero on failure.
+int Int_xor(const struct starlark_Int *a, const struct starlark_Int *b,
+	    struct starlark_Int *c);
+
+// Computes c = a << b
+// Returns nonzero on failure.
+int Int_lshift(const struct starlark_Int *a, const uint32_t b,
+	       struct starlark_Int *c);
+
+// Computes c = a >> b, rounding towards negative infinity.
+// Returns nonzero on failure.
+int Int_rshift(const struct starlark_Int *a, const uint32_t b,
+	       struct starlark_Int *c);
+
+// Returns a negative number if a < b, 0 if a == b and a positive number if
+// a > b.
+int Int_cmp(const struct starlark_Int *a, const struct starlark_Int *b);
+
+bool Int_is_zero(const struct starlark_Int *a);
+
+// Returns -1 if a is negative, 0 if it's zero and 1 if it's positive.
+int Int_sign(const struct starlark_Int *a);
+
+// Returns the low 64 bits of the magnitude of a.
+uint64_t Int_low_u64(const struct starlark_Int *a);
+
+// Returns the number of bits needed to store the magnitude of a, which is 0 if
+// a is 0.
+size_t Int_bit_len(const struct starlark_Int *a);
+
+// Returns true if a is exactly equal to b, which must be a whole number.
+bool Int_eq_double(const struct starlark_Int *a, const double b);
+
 // Computes c = a ** b.
 // Returns nonzero on failure.
 int Int_pow_u32(const struct starlark_Int *a, const uint32_t b,
@@ -40,7 +126,10 @@ int Int_mul(const struct starlark_Int *a, const struct starlark_Int *b,
 // Returns NULL on failure.
 char *Int_to_str(const struct starlark_Int *i, const int base);
 
-// Returns NULL on failure.
-struct starlark_Int *Int_from_str(const char *str, const int base);
+// Puts the int written as str in out. str is an optional '-' followed by one or
+// more digits in base.
+// Returns 0 on success, STARLARK_ERRORCODE_INT_INVALID if str isn't an int in
+// base, or STARLARK_ERROR_OOM if there wasn't enough memory.
+int Int_from_str(const char *str, const int base, struct starlark_Int **out);
 
 #endif // STARLARK_INT_H
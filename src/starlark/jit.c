@@ -0,0 +1,1271 @@
+// For MAP_ANONYMOUS.
+#define _DEFAULT_SOURCE
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "starlark/jit.h"
+#include "starlark/builtins.h"
+#include "starlark/common.h"
+#include "starlark/compile.h"
+#include "starlark/dict.h"
+#include "starlark/function.h"
+#include "starlark/list.h"
+#include "starlark/ops.h"
+#include "starlark/value.h"
+#include "starlark/vm.h"
+
+#if CLARK_JIT
+#include <sys/mman.h>
+
+// The general purpose registers, numbered as the instruction encoding does.
+enum {
+	RAX,
+	RCX,
+	RDX,
+	RBX,
+	RSP,
+	RBP,
+	RSI,
+	RDI,
+	R8,
+	R9,
+	R10,
+	R11,
+	R12,
+	R13,
+	R14,
+	R15,
+};
+
+// The registers which live across the whole of the machine code. They're all
+// callee-saved, so calls into the runtime leave them alone.
+#define FRAME RBX
+#define SP R12
+#define STATE R13
+// Holds a value across a call. R15 is also saved, for a truth value.
+#define SAVED R14
+
+// The condition codes of Jcc and SETcc.
+enum {
+	CC_O = 0x0,
+	CC_E = 0x4,
+	CC_NE = 0x5,
+	CC_L = 0xc,
+	CC_GE = 0xd,
+	CC_LE = 0xe,
+	CC_G = 0xf,
+};
+
+// The condition under which each comparison from OP_EQ to OP_GEQ holds. Small
+// ints all have the same tag, so the tagged values compare the same way as
+// the ints.
+static const uint8_t compare_ccs[] = {
+	[OP_EQ - OP_EQ] = CC_E,	     [OP_NOTEQ - OP_EQ] = CC_NE,
+	[OP_LESS - OP_EQ] = CC_L,    [OP_LEQ - OP_EQ] = CC_LE,
+	[OP_GREATER - OP_EQ] = CC_G, [OP_GEQ - OP_EQ] = CC_GE,
+};
+
+// The /digit of the group 1 instructions, which take an immediate operand.
+enum {
+	ALU_ADD = 0,
+	ALU_OR = 1,
+	ALU_SUB = 5,
+	ALU_CMP = 7,
+};
+
+// The opcodes of the instructions taking two registers, or a register and
+// memory.
+enum {
+	MOV_STORE = 0x89,
+	MOV_LOAD = 0x8b,
+	LEA = 0x8d,
+	ADD_RR = 0x01,
+	SUB_RR = 0x29,
+	CMP_RR = 0x39,
+};
+
+// A rel32 which has to be patched to point at the exit stub for an
+// instruction, once the stubs have been emitted after everything else.
+struct exit {
+	uint32_t at;
+	uint32_t pc;
+	enum JitExit kind;
+	// How many bytes the instruction has pushed onto the stack on its way
+	// to the exit.
+	int32_t pushed;
+};
+
+// A rel32 which has to be patched to point at the machine code of the
+// instruction at offset target in the bytecode.
+struct jump {
+	uint32_t at;
+	uint32_t target;
+};
+
+struct emitter {
+	const struct starlark_Module *m;
+	const struct starlark_Code *code;
+	// The offset of the instruction being compiled.
+	uint32_t pc;
+	// The offset of the common exit path, which every stub jumps to.
+	uint32_t epilogue;
+
+	size_t len;
+	size_t cap;
+	uint8_t *buf;
+	bool oom;
+
+	// The offset in buf of the machine code for each offset in the code.
+	uint32_t *offsets;
+
+	size_t exits_len;
+	size_t exits_cap;
+	struct exit *exits;
+
+	size_t jumps_len;
+	size_t jumps_cap;
+	struct jump *jumps;
+};
+
+// Makes room for one more element of size size in *items.
+static bool grow(void **items, size_t *cap, const size_t len,
+		 const size_t size)
+{
+	if (len < *cap) {
+		return true;
+	}
+
+	const size_t new_cap = *cap == 0 ? 64 : *cap * 2;
+	void *new_items = realloc(*items, new_cap * size);
+	if (new_items == NULL) {
+		return false;
+	}
+
+	*items = new_items;
+	*cap = new_cap;
+	return true;
+}
+
+static void emit(struct emitter *e, const uint8_t b)
+{
+	if (!grow((void **)&e->buf, &e->cap, e->len, 1)) {
+		e->oom = true;
+		return;
+	}
+
+	e->buf[e->len] = b;
+	e->len += 1;
+}
+
+static void emit32(struct emitter *e, const uint32_t v)
+{
+	for (int i = 0; i < 32; i += 8) {
+		emit(e, (uint8_t)(v >> i));
+	}
+}
+
+static void emit64(struct emitter *e, const uint64_t v)
+{
+	for (int i = 0; i < 64; i += 8) {
+		emit(e, (uint8_t)(v >> i));
+	}
+}
+
+// Patches the rel32 at offset at to point at offset to.
+static void patch(struct emitter *e, const uint32_t at, const size_t to)
+{
+	if (e->oom) {
+		return;
+	}
+
+	const uint32_t rel = (uint32_t)((int64_t)to - (int64_t)(at + 4));
+	for (int i = 0; i < 4; i += 1) {
+		e->buf[at + i] = (uint8_t)(rel >> (8 * i));
+	}
+}
+
+static bool fits_int8(const int64_t v)
+{
+	return v >= INT8_MIN && v <= INT8_MAX;
+}
+
+static bool fits_int32(const int64_t v)
+{
+	return v >= INT32_MIN && v <= INT32_MAX;
+}
+
+// Emits the REX prefix for an instruction whose ModRM reg field is reg and
+// whose r/m field is rm, if it needs one.
+static void rex(struct emitter *e, const bool wide, const int reg,
+		const int rm)
+{
+	const uint8_t b = (uint8_t)(0x40 | (wide ? 0x08 : 0) |
+				    ((reg >> 3) << 2) | (rm >> 3));
+	if (b != 0x40) {
+		emit(e, b);
+	}
+}
+
+// Emits the ModRM byte, and whatever follows it, for [base + disp].
+static void mem(struct emitter *e, const int reg, const int base,
+		const int32_t disp)
+{
+	const uint8_t r = (uint8_t)((reg & 7) << 3);
+	const uint8_t b = (uint8_t)(base & 7);
+	if (disp == 0 && b != RBP) {
+		emit(e, r | b);
+	} else if (fits_int8(disp)) {
+		emit(e, 0x40 | r | b);
+	} else {
+		emit(e, 0x80 | r | b);
+	}
+
+	// RSP and R12 can only be used as a base through a SIB byte.
+	if (b == RSP) {
+		emit(e, 0x24);
+	}
+
+	if (disp != 0 || b == RBP) {
+		if (fits_int8(disp)) {
+			emit(e, (uint8_t)disp);
+		} else {
+			emit32(e, (uint32_t)disp);
+		}
+	}
+}
+
+// op reg, [base + disp], or the other way around, for 64-bit operands.
+static void op_mem(struct emitter *e, const uint8_t op, const int reg,
+		   const int base, const int32_t disp)
+{
+	rex(e, true, reg, base);
+	emit(e, op);
+	mem(e, reg, base, disp);
+}
+
+static void load(struct emitter *e, const int dst, const int base,
+		 const int32_t disp)
+{
+	op_mem(e, MOV_LOAD, dst, base, disp);
+}
+
+static void store(struct emitter *e, const int base, const int32_t disp,
+		  const int src)
+{
+	op_mem(e, MOV_STORE, src, base, disp);
+}
+
+// Stores the 32-bit imm, sign extended to 64 bits, at [base + disp].
+static void store_imm(struct emitter *e, const int base, const int32_t disp,
+		      const int32_t imm)
+{
+	rex(e, true, 0, base);
+	emit(e, 0xc7);
+	mem(e, 0, base, disp);
+	emit32(e, (uint32_t)imm);
+}
+
+// Stores the 32 bits of imm at [base + disp].
+static void store_imm32(struct emitter *e, const int base, const int32_t disp,
+			const uint32_t imm)
+{
+	rex(e, false, 0, base);
+	emit(e, 0xc7);
+	mem(e, 0, base, disp);
+	emit32(e, imm);
+}
+
+// op dst, src, for 64-bit operands.
+static void op_rr(struct emitter *e, const uint8_t op, const int dst,
+		  const int src)
+{
+	rex(e, true, src, dst);
+	emit(e, op);
+	emit(e, (uint8_t)(0xc0 | ((src & 7) << 3) | (dst & 7)));
+}
+
+// alu r, imm, for 64-bit operands.
+static void op_ri(struct emitter *e, const int alu, const int r,
+		  const int32_t imm)
+{
+	rex(e, true, 0, r);
+	if (fits_int8(imm)) {
+		emit(e, 0x83);
+		emit(e, (uint8_t)(0xc0 | (alu << 3) | (r & 7)));
+		emit(e, (uint8_t)imm);
+	} else {
+		emit(e, 0x81);
+		emit(e, (uint8_t)(0xc0 | (alu << 3) | (r & 7)));
+		emit32(e, (uint32_t)imm);
+	}
+}
+
+static void mov_imm(struct emitter *e, const int r, const uint64_t imm)
+{
+	if (imm <= UINT32_MAX) {
+		// Writing the low 32 bits clears the rest.
+		rex(e, false, 0, r);
+		emit(e, (uint8_t)(0xb8 + (r & 7)));
+		emit32(e, (uint32_t)imm);
+	} else {
+		rex(e, true, 0, r);
+		emit(e, (uint8_t)(0xb8 + (r & 7)));
+		emit64(e, imm);
+	}
+}
+
+// Calls the function at fn, whose arguments have already been put in RDI, RSI,
+// RDX, RCX and R8. The code always takes up 12 bytes.
+static void call(struct emitter *e, const uintptr_t fn)
+{
+	emit(e, 0x48);
+	emit(e, 0xb8);
+	emit64(e, fn);
+	// call rax
+	emit(e, 0xff);
+	emit(e, 0xd0);
+}
+
+#define CALL(e, fn) call((e), (uintptr_t)&(fn))
+
+// Calls fn, which is Value_retain or Value_release, with the value in RDI,
+// unless it isn't an object and there's nothing to count.
+static void refcount(struct emitter *e, const uintptr_t fn)
+{
+	// test dil, 1
+	emit(e, 0x40);
+	emit(e, 0xf6);
+	emit(e, 0xc7);
+	emit(e, 0x01);
+	// jnz over the call
+	emit(e, 0x75);
+	emit(e, 12);
+	call(e, fn);
+}
+
+#define RETAIN(e) refcount((e), (uintptr_t)&Value_retain)
+#define RELEASE(e) refcount((e), (uintptr_t)&Value_release)
+
+// Emits a jcc, or a jmp if cc is negative, with a rel32 to be patched later.
+// Returns the offset of the rel32.
+static uint32_t jcc(struct emitter *e, const int cc)
+{
+	if (cc < 0) {
+		emit(e, 0xe9);
+	} else {
+		emit(e, 0x0f);
+		emit(e, (uint8_t)(0x80 | cc));
+	}
+
+	const uint32_t at = (uint32_t)e->len;
+	emit32(e, 0);
+	return at;
+}
+
+// Points the rel32 at offset at, from jcc, at the code emitted next.
+static void land(struct emitter *e, const uint32_t at)
+{
+	patch(e, at, e->len);
+}
+
+// Leaves the machine code for the given reason if cc holds, or always if cc
+// is negative.
+static void exit_if(struct emitter *e, const int cc, const enum JitExit kind,
+		    const int32_t pushed)
+{
+	const uint32_t at = jcc(e, cc);
+	if (!grow((void **)&e->exits, &e->exits_cap, e->exits_len,
+		  sizeof(e->exits[0]))) {
+		e->oom = true;
+		return;
+	}
+
+	e->exits[e->exits_len] = (struct exit){
+		.at = at,
+		.pc = e->pc,
+		.kind = kind,
+		.pushed = pushed,
+	};
+	e->exits_len += 1;
+}
+
+// Deoptimizes if cc holds.
+static void deopt_if(struct emitter *e, const int cc)
+{
+	exit_if(e, cc, JIT_DEOPT, 0);
+}
+
+// Jumps to the instruction at offset target in the code if cc holds, or always
+// if cc is negative.
+static void jump_if(struct emitter *e, const int cc, const uint32_t target)
+{
+	const uint32_t at = jcc(e, cc);
+	if (!grow((void **)&e->jumps, &e->jumps_cap, e->jumps_len,
+		  sizeof(e->jumps[0]))) {
+		e->oom = true;
+		return;
+	}
+
+	e->jumps[e->jumps_len] = (struct jump){ .at = at, .target = target };
+	e->jumps_len += 1;
+}
+
+// Fails with the error code a runtime function returned in EAX, unless it's 0.
+static void check(struct emitter *e, const int32_t pushed)
+{
+	// test eax, eax
+	emit(e, 0x85);
+	emit(e, 0xc0);
+	exit_if(e, CC_NE, JIT_ERROR, pushed);
+}
+
+// Deoptimizes unless the value in r is a small int.
+static void guard_int(struct emitter *e, const int r)
+{
+	// mov edx, r32
+	rex(e, false, r, RDX);
+	emit(e, MOV_STORE);
+	emit(e, (uint8_t)(0xc0 | ((r & 7) << 3) | RDX));
+	// and edx, 15
+	emit(e, 0x83);
+	emit(e, 0xe2);
+	emit(e, VALUE_TAG_MASK);
+	// cmp edx, 1
+	emit(e, 0x83);
+	emit(e, 0xfa);
+	emit(e, VALUE_TAG_INT);
+	deopt_if(e, CC_NE);
+}
+
+// Pushes the value with the given bits, without retaining it.
+static void push_bits(struct emitter *e, const uint64_t bits)
+{
+	if (fits_int32((int64_t)bits)) {
+		store_imm(e, SP, 0, (int32_t)bits);
+	} else {
+		mov_imm(e, RAX, bits);
+		store(e, SP, 0, RAX);
+	}
+
+	op_ri(e, ALU_ADD, SP, 8);
+}
+
+// Loads the source r of a register instruction into dst.
+static void load_source(struct emitter *e, const int dst, const uint32_t r)
+{
+	const struct starlark_Code *code = e->code;
+	if (r < code->locals_len) {
+		load(e, dst, FRAME, (int32_t)(8 * r));
+	} else {
+		mov_imm(e, dst, code->constants[r - code->locals_len].bits);
+	}
+}
+
+// Loads the source r of a register instruction into dst, deoptimizing unless
+// it's a small int.
+static void load_int_source(struct emitter *e, const int dst, const uint32_t r)
+{
+	const struct starlark_Code *code = e->code;
+	load_source(e, dst, r);
+	if (r < code->locals_len) {
+		guard_int(e, dst);
+	} else if (!Value_is_small_int(code->constants[r - code->locals_len])) {
+		deopt_if(e, -1);
+	}
+}
+
+// Stores the value in src, which isn't RDI, in the destination d of a register
+// instruction.
+static void store_dest(struct emitter *e, const uint32_t d, const int src)
+{
+	if (d < e->code->locals_len) {
+		load(e, RDI, FRAME, (int32_t)(8 * d));
+		store(e, FRAME, (int32_t)(8 * d), src);
+		RELEASE(e);
+	} else {
+		store(e, SP, 0, src);
+		op_ri(e, ALU_ADD, SP, 8);
+	}
+}
+
+// Computes RAX op RCX into RAX, for small ints and an op of OP_ADD, OP_SUB,
+// OP_INPLACE_ADD, or a comparison.
+static void int_binary(struct emitter *e, const uint8_t op)
+{
+	switch (op) {
+	case OP_ADD:
+	case OP_INPLACE_ADD:
+		// Taking the tag off one of them leaves the sum tagged.
+		op_ri(e, ALU_SUB, RAX, VALUE_TAG_INT);
+		op_rr(e, ADD_RR, RAX, RCX);
+		deopt_if(e, CC_O);
+		break;
+	case OP_SUB:
+		op_rr(e, SUB_RR, RAX, RCX);
+		deopt_if(e, CC_O);
+		op_ri(e, ALU_OR, RAX, VALUE_TAG_INT);
+		break;
+	default:
+		op_rr(e, CMP_RR, RAX, RCX);
+		// setcc al
+		emit(e, 0x0f);
+		emit(e, (uint8_t)(0x90 | compare_ccs[op - OP_EQ]));
+		emit(e, 0xc0);
+		// movzx eax, al
+		emit(e, 0x0f);
+		emit(e, 0xb6);
+		emit(e, 0xc0);
+		// False and True differ only in the bit above the tag.
+		// shl eax, 4
+		emit(e, 0xc1);
+		emit(e, 0xe0);
+		emit(e, 4);
+		op_ri(e, ALU_ADD, RAX, (int32_t)VALUE_FALSE.bits);
+		break;
+	}
+}
+
+// Jumps to target unless RAX op RCX, where op is a comparison of small ints.
+static void int_compare_jump(struct emitter *e, const uint8_t op,
+			     const uint32_t target)
+{
+	op_rr(e, CMP_RR, RAX, RCX);
+	// Flipping the low bit of a condition code negates it.
+	jump_if(e, compare_ccs[op - OP_EQ] ^ 1, target);
+}
+
+// The runtime functions which the machine code calls for the instructions it
+// doesn't do inline. Each takes the stack pointer, and does the same as the
+// interpreter does for the instruction, including what it leaves on the stack
+// when it fails.
+
+static int binary(struct starlark_Value *sp, const uint32_t op)
+{
+	struct starlark_Value result = { 0 };
+	const int ret = Value_binary((enum starlark_Op)(op - OP_ADD), sp[-2],
+				     sp[-1], &result);
+	if (ret != 0) {
+		return ret;
+	}
+
+	Value_release(sp[-2]);
+	Value_release(sp[-1]);
+	sp[-2] = result;
+	return 0;
+}
+
+// Stores a op b in *dst, or pushes it if dst is NULL.
+static int binary_reg(struct starlark_Value *sp, const uint32_t op,
+		      const struct starlark_Value a,
+		      const struct starlark_Value b, struct starlark_Value *dst)
+{
+	struct starlark_Value result = { 0 };
+	const int ret = Value_binary(
+		(enum starlark_Op)(Opcode_base[op] - OP_ADD), a, b, &result);
+	if (ret != 0) {
+		Value_retain(a);
+		Value_retain(b);
+		sp[0] = a;
+		sp[1] = b;
+		return ret;
+	}
+
+	if (dst == NULL) {
+		sp[0] = result;
+	} else {
+		const struct starlark_Value old = *dst;
+		*dst = result;
+		Value_release(old);
+	}
+
+	return 0;
+}
+
+static void negate(struct starlark_Value *sp)
+{
+	const bool truth = Value_truth(sp[-1]);
+	Value_release(sp[-1]);
+	sp[-1] = Value_bool(!truth);
+}
+
+static int iterate(struct starlark_Value *sp, struct starlark_Iterator *it)
+{
+	const int ret = Iterator_init(it, sp[-1]);
+	if (ret != 0) {
+		return ret;
+	}
+
+	Value_release(sp[-1]);
+	sp[-1] = Value_object(&it->obj);
+	return 0;
+}
+
+static int list_append(struct starlark_Value *sp, const uint32_t arg)
+{
+	const ptrdiff_t depth = 2 + (ptrdiff_t)arg;
+	struct starlark_List *l =
+		(struct starlark_List *)Value_as_object(sp[-depth]);
+	if (l->len < l->cap) {
+		l->items[l->len] = sp[-1];
+		l->len += 1;
+		return 0;
+	}
+
+	const int ret = List_append(l, sp[-1]);
+	if (ret != 0) {
+		return ret;
+	}
+
+	Value_release(sp[-1]);
+	return 0;
+}
+
+static void reserve(struct starlark_Value *sp)
+{
+	const struct starlark_Iterator *it =
+		(struct starlark_Iterator *)Value_as_object(sp[-1]);
+	const size_t len = Iterator_len(it);
+	if (Value_type(sp[-2]) == STARLARK_TYPE_LIST) {
+		(void)List_reserve(
+			(struct starlark_List *)Value_as_object(sp[-2]), len);
+	} else {
+		(void)Dict_reserve(
+			(struct starlark_Dict *)Value_as_object(sp[-2]), len);
+	}
+}
+
+static int index_value(struct starlark_Value *sp)
+{
+	struct starlark_Value result = { 0 };
+	const int ret = Value_index(sp[-2], sp[-1], &result);
+	if (ret != 0) {
+		return ret;
+	}
+
+	Value_release(sp[-2]);
+	Value_release(sp[-1]);
+	sp[-2] = result;
+	return 0;
+}
+
+static int index_constant(struct starlark_Value *sp,
+			  const struct starlark_Value key)
+{
+	struct starlark_Value result = { 0 };
+	const int ret = Value_index(sp[-1], key, &result);
+	if (ret != 0) {
+		Value_retain(key);
+		sp[0] = key;
+		return ret;
+	}
+
+	Value_release(sp[-1]);
+	sp[-1] = result;
+	return 0;
+}
+
+// Only used for calls without *args or **kwargs.
+static int call_value(struct starlark_Vm *vm, struct starlark_Value *sp,
+		      const uint32_t arg)
+{
+	const uint32_t positional = CALL_POSITIONAL(arg);
+	const uint32_t named = CALL_NAMED(arg);
+	struct starlark_Value *base = sp - (1 + positional + 2 * named);
+	struct starlark_Value result = { 0 };
+	const int ret = Vm_call(vm, base[0], positional, &base[1], named,
+				&base[1 + positional], &result);
+	if (ret != 0) {
+		return ret;
+	}
+
+	while (sp > base) {
+		sp -= 1;
+		Value_release(*sp);
+	}
+
+	base[0] = result;
+	return 0;
+}
+
+// Emits a call to one of the runtime functions above, with the stack pointer
+// as its first argument, and then fails if it did.
+static void call_sp(struct emitter *e, const uintptr_t fn,
+		    const int32_t pushed)
+{
+	op_rr(e, MOV_STORE, RDI, SP);
+	call(e, fn);
+	check(e, pushed);
+}
+
+// Jumps to target if the value in RDI is true, or false if truth is false, and
+// leaves it in RDI otherwise. The value isn't released.
+static void jump_if_truth(struct emitter *e, const bool truth,
+			  const uint32_t target)
+{
+	const struct starlark_Value jump = Value_bool(truth);
+	const struct starlark_Value stay = Value_bool(!truth);
+	op_ri(e, ALU_CMP, RDI, (int32_t)jump.bits);
+	jump_if(e, CC_E, target);
+	op_ri(e, ALU_CMP, RDI, (int32_t)stay.bits);
+	const uint32_t done = jcc(e, CC_E);
+	op_rr(e, MOV_STORE, SAVED, RDI);
+	CALL(e, Value_truth);
+	op_rr(e, MOV_STORE, RDI, SAVED);
+	// test al, al
+	emit(e, 0x84);
+	emit(e, 0xc0);
+	jump_if(e, truth ? CC_NE : CC_E, target);
+	land(e, done);
+}
+
+// Emits the template for one instruction.
+// Returns false if the instruction doesn't have one, and the machine code
+// deoptimizes there instead.
+static bool instr(struct emitter *e, const uint8_t op, const uint32_t arg,
+		  const uint32_t *regs)
+{
+	const struct starlark_Code *code = e->code;
+	switch ((enum Opcode)op) {
+	case OP_NOP:
+		return true;
+	case OP_POP:
+		op_ri(e, ALU_SUB, SP, 8);
+		load(e, RDI, SP, 0);
+		RELEASE(e);
+		return true;
+	case OP_DUP:
+		load(e, RDI, SP, -8);
+		store(e, SP, 0, RDI);
+		op_ri(e, ALU_ADD, SP, 8);
+		RETAIN(e);
+		return true;
+	case OP_DUP2:
+		load(e, RAX, SP, -16);
+		store(e, SP, 0, RAX);
+		load(e, RAX, SP, -8);
+		store(e, SP, 8, RAX);
+		op_ri(e, ALU_ADD, SP, 16);
+		load(e, RDI, SP, -16);
+		RETAIN(e);
+		load(e, RDI, SP, -8);
+		RETAIN(e);
+		return true;
+	case OP_EXCH:
+		load(e, RAX, SP, -8);
+		load(e, RCX, SP, -16);
+		store(e, SP, -8, RCX);
+		store(e, SP, -16, RAX);
+		return true;
+	case OP_NONE:
+		push_bits(e, VALUE_NONE.bits);
+		return true;
+	case OP_TRUE:
+		push_bits(e, VALUE_TRUE.bits);
+		return true;
+	case OP_FALSE:
+		push_bits(e, VALUE_FALSE.bits);
+		return true;
+	case OP_CONSTANT: {
+		const struct starlark_Value v = code->constants[arg];
+		push_bits(e, v.bits);
+		if (Value_is_object(v)) {
+			mov_imm(e, RDI, v.bits);
+			CALL(e, Value_retain);
+		}
+		return true;
+	}
+	case OP_LOAD_LOCAL:
+		load(e, RDI, FRAME, (int32_t)(8 * arg));
+		op_ri(e, ALU_CMP, RDI, (int32_t)VALUE_UNBOUND.bits);
+		deopt_if(e, CC_E);
+		store(e, SP, 0, RDI);
+		op_ri(e, ALU_ADD, SP, 8);
+		RETAIN(e);
+		return true;
+	case OP_STORE_LOCAL:
+		op_ri(e, ALU_SUB, SP, 8);
+		load(e, RAX, SP, 0);
+		load(e, RDI, FRAME, (int32_t)(8 * arg));
+		store(e, FRAME, (int32_t)(8 * arg), RAX);
+		RELEASE(e);
+		return true;
+	case OP_LOAD_GLOBAL:
+		mov_imm(e, RAX, (uintptr_t)&e->m->globals[arg]);
+		load(e, RDI, RAX, 0);
+		op_ri(e, ALU_CMP, RDI, (int32_t)VALUE_UNBOUND.bits);
+		deopt_if(e, CC_E);
+		store(e, SP, 0, RDI);
+		op_ri(e, ALU_ADD, SP, 8);
+		RETAIN(e);
+		return true;
+	case OP_STORE_GLOBAL:
+		op_ri(e, ALU_SUB, SP, 8);
+		load(e, RCX, SP, 0);
+		mov_imm(e, RAX, (uintptr_t)&e->m->globals[arg]);
+		load(e, RDI, RAX, 0);
+		store(e, RAX, 0, RCX);
+		RELEASE(e);
+		return true;
+	case OP_LOAD_BUILTIN:
+		// Builtins are never freed, so they aren't counted.
+		push_bits(e, Builtin_value(arg).bits);
+		return true;
+	case OP_ADD:
+	case OP_SUB:
+	case OP_EQ:
+	case OP_NOTEQ:
+	case OP_LESS:
+	case OP_LEQ:
+	case OP_GREATER:
+	case OP_GEQ:
+	case OP_INPLACE_ADD:
+		load(e, RAX, SP, -16);
+		load(e, RCX, SP, -8);
+		guard_int(e, RAX);
+		guard_int(e, RCX);
+		int_binary(e, op);
+		store(e, SP, -16, RAX);
+		op_ri(e, ALU_SUB, SP, 8);
+		return true;
+	case OP_MUL:
+	case OP_DIV:
+	case OP_FLOORDIV:
+	case OP_MOD:
+	case OP_BITAND:
+	case OP_BITOR:
+	case OP_XOR:
+	case OP_LSHIFT:
+	case OP_RSHIFT:
+	case OP_IN:
+	case OP_NOT_IN:
+		mov_imm(e, RSI, op);
+		call_sp(e, (uintptr_t)&binary, 0);
+		op_ri(e, ALU_SUB, SP, 8);
+		return true;
+	case OP_NOT:
+		op_rr(e, MOV_STORE, RDI, SP);
+		CALL(e, negate);
+		return true;
+	case OP_JUMP:
+		jump_if(e, -1, arg);
+		return true;
+	case OP_JUMP_IF_FALSE:
+	case OP_JUMP_IF_TRUE: {
+		const bool truth = op == OP_JUMP_IF_TRUE;
+		op_ri(e, ALU_SUB, SP, 8);
+		load(e, RDI, SP, 0);
+		op_ri(e, ALU_CMP, RDI, (int32_t)Value_bool(truth).bits);
+		jump_if(e, CC_E, arg);
+		op_ri(e, ALU_CMP, RDI, (int32_t)Value_bool(!truth).bits);
+		const uint32_t done = jcc(e, CC_E);
+		op_rr(e, MOV_STORE, SAVED, RDI);
+		CALL(e, Value_truth);
+		// movzx r15d, al
+		emit(e, 0x44);
+		emit(e, 0x0f);
+		emit(e, 0xb6);
+		emit(e, 0xf8);
+		op_rr(e, MOV_STORE, RDI, SAVED);
+		RELEASE(e);
+		// test r15d, r15d
+		emit(e, 0x45);
+		emit(e, 0x85);
+		emit(e, 0xff);
+		jump_if(e, truth ? CC_NE : CC_E, arg);
+		land(e, done);
+		return true;
+	}
+	case OP_JUMP_IF_FALSE_OR_POP:
+	case OP_JUMP_IF_TRUE_OR_POP:
+		load(e, RDI, SP, -8);
+		jump_if_truth(e, op == OP_JUMP_IF_TRUE_OR_POP, arg);
+		op_ri(e, ALU_SUB, SP, 8);
+		load(e, RDI, SP, 0);
+		RELEASE(e);
+		return true;
+	case OP_ITER:
+		op_mem(e, LEA, RSI, FRAME,
+		       (int32_t)(8 * Vm_iterator_slot(code, arg)));
+		call_sp(e, (uintptr_t)&iterate, 0);
+		return true;
+	case OP_FOR_ITER: {
+		load(e, RDI, SP, -8);
+		op_rr(e, MOV_STORE, RSI, SP);
+		CALL(e, Iterator_next);
+		// cmp eax, 1
+		emit(e, 0x83);
+		emit(e, 0xf8);
+		emit(e, 1);
+		const uint32_t exhausted = jcc(e, CC_NE);
+		op_ri(e, ALU_ADD, SP, 8);
+		const uint32_t done = jcc(e, -1);
+		land(e, exhausted);
+		check(e, 0);
+		op_ri(e, ALU_SUB, SP, 8);
+		load(e, RDI, SP, 0);
+		RELEASE(e);
+		jump_if(e, -1, arg);
+		land(e, done);
+		return true;
+	}
+	case OP_RESERVE:
+		op_rr(e, MOV_STORE, RDI, SP);
+		CALL(e, reserve);
+		return true;
+	case OP_LIST_APPEND:
+		mov_imm(e, RSI, arg);
+		call_sp(e, (uintptr_t)&list_append, 0);
+		op_ri(e, ALU_SUB, SP, 8);
+		return true;
+	case OP_INDEX:
+		call_sp(e, (uintptr_t)&index_value, 0);
+		op_ri(e, ALU_SUB, SP, 8);
+		return true;
+	case OP_CALL: {
+		if ((arg >> 16) != 0) {
+			return false;
+		}
+
+		const uint32_t len =
+			1 + CALL_POSITIONAL(arg) + 2 * CALL_NAMED(arg);
+		load(e, RDI, STATE, offsetof(struct JitFrame, vm));
+		op_rr(e, MOV_STORE, RSI, SP);
+		mov_imm(e, RDX, arg);
+		CALL(e, call_value);
+		check(e, 0);
+		op_ri(e, ALU_SUB, SP, (int32_t)(8 * (len - 1)));
+		return true;
+	}
+	case OP_CALL_METHOD: {
+		const uint32_t len = CALL_POSITIONAL(arg) + 2 * CALL_NAMED(arg);
+		load(e, RDI, STATE, offsetof(struct JitFrame, vm));
+		mov_imm(e, RSI, (uintptr_t)code);
+		op_rr(e, MOV_STORE, RDX, SP);
+		mov_imm(e, RCX, arg);
+		CALL(e, Vm_call_method);
+		check(e, 0);
+		op_ri(e, ALU_SUB, SP, (int32_t)(8 * len));
+		return true;
+	}
+	case OP_RETURN:
+		op_ri(e, ALU_SUB, SP, 8);
+		load(e, RAX, SP, 0);
+		load(e, RCX, STATE, offsetof(struct JitFrame, out));
+		store(e, RCX, 0, RAX);
+		mov_imm(e, RAX, JIT_RETURN);
+		patch(e, jcc(e, -1), e->epilogue);
+		return true;
+	case OP_ADD_CONSTANT:
+	case OP_SUB_CONSTANT: {
+		const struct starlark_Value k = code->constants[arg];
+		// The constant's int shifted into place, which adding or
+		// subtracting leaves the other operand's tag alone.
+		const int64_t shifted = (int64_t)(k.bits - VALUE_TAG_INT);
+		if (!Value_is_small_int(k) || !fits_int32(shifted)) {
+			return false;
+		}
+
+		load(e, RAX, SP, -8);
+		guard_int(e, RAX);
+		op_ri(e, op == OP_ADD_CONSTANT ? ALU_ADD : ALU_SUB, RAX,
+		      (int32_t)shifted);
+		deopt_if(e, CC_O);
+		store(e, SP, -8, RAX);
+		return true;
+	}
+	case OP_INDEX_CONSTANT:
+		mov_imm(e, RSI, code->constants[arg].bits);
+		call_sp(e, (uintptr_t)&index_constant, 8);
+		return true;
+	case OP_JUMP_UNLESS_EQ:
+	case OP_JUMP_UNLESS_NOTEQ:
+	case OP_JUMP_UNLESS_LESS:
+	case OP_JUMP_UNLESS_LEQ:
+	case OP_JUMP_UNLESS_GREATER:
+	case OP_JUMP_UNLESS_GEQ:
+		load(e, RAX, SP, -16);
+		load(e, RCX, SP, -8);
+		guard_int(e, RAX);
+		guard_int(e, RCX);
+		op_ri(e, ALU_SUB, SP, 16);
+		int_compare_jump(e, Opcode_base[op], arg);
+		return true;
+	case OP_MOVE: {
+		const uint32_t r = regs[0];
+		if (r < code->locals_len) {
+			load(e, RDI, FRAME, (int32_t)(8 * r));
+			RETAIN(e);
+		} else if (Value_is_object(
+				   code->constants[r - code->locals_len])) {
+			load_source(e, RDI, r);
+			CALL(e, Value_retain);
+		}
+
+		load_source(e, RCX, r);
+		store_dest(e, arg, RCX);
+		return true;
+	}
+	case OP_ADD_REG:
+	case OP_SUB_REG:
+	case OP_EQ_REG:
+	case OP_NOTEQ_REG:
+	case OP_LESS_REG:
+	case OP_LEQ_REG:
+	case OP_GREATER_REG:
+	case OP_GEQ_REG:
+	case OP_INPLACE_ADD_REG:
+		load_int_source(e, RAX, regs[0]);
+		load_int_source(e, RCX, regs[1]);
+		int_binary(e, Opcode_base[op]);
+		store_dest(e, arg, RAX);
+		return true;
+	case OP_MUL_REG:
+	case OP_DIV_REG:
+	case OP_FLOORDIV_REG:
+	case OP_MOD_REG:
+	case OP_BITAND_REG:
+	case OP_BITOR_REG:
+	case OP_XOR_REG:
+	case OP_LSHIFT_REG:
+	case OP_RSHIFT_REG:
+	case OP_IN_REG:
+	case OP_NOT_IN_REG:
+		mov_imm(e, RSI, op);
+		load_source(e, RDX, regs[0]);
+		load_source(e, RCX, regs[1]);
+		if (arg < code->locals_len) {
+			op_mem(e, LEA, R8, FRAME, (int32_t)(8 * arg));
+		} else {
+			mov_imm(e, R8, 0);
+		}
+		call_sp(e, (uintptr_t)&binary_reg, 16);
+		if (arg >= code->locals_len) {
+			op_ri(e, ALU_ADD, SP, 8);
+		}
+		return true;
+	case OP_JUMP_UNLESS_EQ_REG:
+	case OP_JUMP_UNLESS_NOTEQ_REG:
+	case OP_JUMP_UNLESS_LESS_REG:
+	case OP_JUMP_UNLESS_LEQ_REG:
+	case OP_JUMP_UNLESS_GREATER_REG:
+	case OP_JUMP_UNLESS_GEQ_REG:
+		load_int_source(e, RAX, regs[0]);
+		load_int_source(e, RCX, regs[1]);
+		int_compare_jump(e, Opcode_base[op], arg);
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Emits the way out of the machine code, which every exit ends with. EAX holds
+// the enum JitExit.
+static void epilogue(struct emitter *e)
+{
+	store(e, STATE, offsetof(struct JitFrame, sp), SP);
+	// pop r15, r14, r13, r12, rbx
+	static const uint8_t pops[] = { 0x41, 0x5f, 0x41, 0x5e, 0x41,
+					0x5d, 0x41, 0x5c, 0x5b };
+	for (size_t i = 0; i < sizeof(pops); i += 1) {
+		emit(e, pops[i]);
+	}
+
+	emit(e, 0xc3);
+}
+
+static void prologue(struct emitter *e)
+{
+	// push rbx, r12, r13, r14, r15, which also aligns the stack for calls.
+	static const uint8_t pushes[] = { 0x53, 0x41, 0x54, 0x41, 0x55,
+					  0x41, 0x56, 0x41, 0x57 };
+	for (size_t i = 0; i < sizeof(pushes); i += 1) {
+		emit(e, pushes[i]);
+	}
+
+	op_rr(e, MOV_STORE, STATE, RDI);
+	load(e, FRAME, STATE, offsetof(struct JitFrame, frame));
+	load(e, SP, STATE, offsetof(struct JitFrame, sp));
+}
+
+// Emits the stub each exit jumps to, which records where the machine code
+// stopped and why.
+static void stubs(struct emitter *e)
+{
+	for (size_t i = 0; i < e->exits_len; i += 1) {
+		const struct exit x = e->exits[i];
+		patch(e, x.at, e->len);
+		if (x.pushed != 0) {
+			op_ri(e, ALU_ADD, SP, x.pushed);
+		}
+
+		if (x.kind == JIT_ERROR) {
+			// mov [r13 + ret], eax
+			rex(e, false, RAX, STATE);
+			emit(e, MOV_STORE);
+			mem(e, RAX, STATE, offsetof(struct JitFrame, ret));
+		}
+
+		store_imm32(e, STATE, offsetof(struct JitFrame, pc), x.pc);
+		mov_imm(e, RAX, x.kind);
+		patch(e, jcc(e, -1), e->epilogue);
+	}
+}
+
+// Compiles code, and maps the machine code into jit.
+// Returns false if we couldn't allocate enough memory, or map it executable.
+static bool compile_code(struct starlark_Jit *jit,
+			 const struct starlark_Module *m,
+			 const struct starlark_Code *code)
+{
+	struct emitter e = {
+		.m = m,
+		.code = code,
+		.offsets = malloc((code->code_len + 1) *
+				  sizeof(e.offsets[0])),
+	};
+	if (e.offsets == NULL) {
+		return false;
+	}
+
+	// The epilogue goes first, so that returning can jump straight back
+	// to it.
+	epilogue(&e);
+	const size_t entry = e.len;
+	prologue(&e);
+
+	const uint8_t *pc = code->code;
+	const uint8_t *end = &code->code[code->code_len];
+	while (pc < end && !e.oom) {
+		e.pc = (uint32_t)(pc - code->code);
+		e.offsets[e.pc] = (uint32_t)e.len;
+		const uint8_t op = *pc++;
+		const uint32_t arg = Opcode_has_arg[op] ? varint_read(&pc) : 0;
+		uint32_t regs[2] = { 0 };
+		for (uint8_t i = 0; i < Opcode_regs[op]; i += 1) {
+			regs[i] = varint_read(&pc);
+		}
+
+		if (!instr(&e, op, arg, regs)) {
+			deopt_if(&e, -1);
+		}
+	}
+
+	stubs(&e);
+	for (size_t i = 0; i < e.jumps_len; i += 1) {
+		patch(&e, e.jumps[i].at, e.offsets[e.jumps[i].target]);
+	}
+
+	bool ok = !e.oom;
+	void *map = MAP_FAILED;
+	if (ok) {
+		map = mmap(NULL, e.len, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		ok = map != MAP_FAILED;
+	}
+
+	if (ok) {
+		memcpy(map, e.buf, e.len);
+		// The memory is never writable and executable at once.
+		ok = mprotect(map, e.len, PROT_READ | PROT_EXEC) == 0;
+		if (!ok) {
+			munmap(map, e.len);
+		}
+	}
+
+	if (ok) {
+		jit->mem = map;
+		jit->mem_len = e.len;
+		jit->entry = (JitEntry)((uintptr_t)map + entry);
+	}
+
+	free(e.buf);
+	free(e.offsets);
+	free(e.exits);
+	free(e.jumps);
+	return ok;
+}
+
+JitEntry Jit_entry(struct starlark_Context *ctx,
+		   const struct starlark_Module *m,
+		   const struct starlark_Code *code)
+{
+	assert(ctx != NULL);
+	assert(m != NULL);
+	assert(code != NULL);
+
+	struct starlark_Jit *jit = code->jit;
+	if (ctx->jit == STARLARK_JIT_OFF || jit->failed) {
+		return NULL;
+	}
+
+	if (jit->entry != NULL) {
+		return jit->entry;
+	}
+
+	if (ctx->jit != STARLARK_JIT_EAGER) {
+		jit->calls += 1;
+		if (jit->calls < JIT_THRESHOLD) {
+			return NULL;
+		}
+	}
+
+	if (!compile_code(jit, m, code)) {
+		jit->failed = true;
+	}
+
+	return jit->entry;
+}
+
+void Jit_deopted(const struct starlark_Code *code)
+{
+	assert(code != NULL);
+
+	struct starlark_Jit *jit = code->jit;
+	jit->deopts += 1;
+	if (jit->deopts >= JIT_MAX_DEOPTS) {
+		Jit_finish(jit);
+		jit->failed = true;
+	}
+}
+
+void Jit_finish(struct starlark_Jit *jit)
+{
+	if (jit == NULL) {
+		return;
+	}
+
+	if (jit->mem != NULL) {
+		munmap(jit->mem, jit->mem_len);
+	}
+
+	*jit = (struct starlark_Jit){ 0 };
+}
+
+#else
+
+JitEntry Jit_entry(struct starlark_Context *ctx,
+		   const struct starlark_Module *m,
+		   const struct starlark_Code *code)
+{
+	(void)ctx;
+	(void)m;
+	(void)code;
+	return NULL;
+}
+
+void Jit_deopted(const struct starlark_Code *code)
+{
+	(void)code;
+}
+
+void Jit_finish(struct starlark_Jit *jit)
+{
+	(void)jit;
+}
+
+#endif // CLARK_JIT
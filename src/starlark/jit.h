@@ -0,0 +1,88 @@
+#ifndef STARLARK_JIT_H
+#define STARLARK_JIT_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "starlark/common.h"
+#include "starlark/compile.h"
+#include "starlark/function.h"
+#include "starlark/value.h"
+
+// A baseline compiler from bytecode to x86-64 machine code, used for functions
+// which are called often. Each instruction is translated on its own, by
+// copying a fixed template of machine code for it, so compiling is about as
+// fast as copying the bytecode.
+//
+// The templates keep the frame and the stack pointer in registers, do small
+// int arithmetic and comparisons inline, and call back into the runtime for
+// everything else. Arithmetic on anything but small ints fails a type guard,
+// which deoptimizes: the machine code stops and the interpreter carries on
+// from the same instruction, with the same frame. Instructions without a
+// template deoptimize too. Code which keeps deoptimizing is thrown away, and
+// its function stays in the interpreter from then on.
+//
+// The compiler is only built for x86-64 Linux, where CLARK_JIT is set. It can
+// be turned off at runtime with the "jit" configuration key, for hosts which
+// don't allow executable memory to be mapped.
+
+// The number of calls after which a function is compiled.
+#define JIT_THRESHOLD 1000
+
+// The number of times a function's machine code can deoptimize before it's
+// thrown away.
+#define JIT_MAX_DEOPTS 100
+
+// What machine code stopped for.
+enum JitExit {
+	// The code returned, and its result is in *out.
+	JIT_RETURN,
+	// The interpreter has to carry on from pc.
+	JIT_DEOPT,
+	// The instruction at pc failed with ret, with its operands left on
+	// the stack as the interpreter would have left them.
+	JIT_ERROR,
+};
+
+// The state of a call running in machine code, which it reads on entry and
+// writes on exit.
+struct JitFrame {
+	struct starlark_Vm *vm;
+	struct starlark_Value *frame;
+	struct starlark_Value *sp;
+	struct starlark_Value *out;
+	uint32_t pc;
+	int32_t ret;
+};
+
+typedef enum JitExit (*JitEntry)(struct JitFrame *f);
+
+// The state of the compilation of a function's code, which is kept alongside
+// the code, since the code itself is immutable.
+struct starlark_Jit {
+	uint32_t calls;
+	uint32_t deopts;
+	// Set once compiling has failed, or the machine code has been thrown
+	// away, so that it isn't tried again.
+	bool failed;
+	// The machine code, which is mapped executable, or NULL if there isn't
+	// any yet.
+	JitEntry entry;
+	void *mem;
+	size_t mem_len;
+};
+
+// Returns the machine code to run code with, compiling it first if it's now
+// been called often enough, or NULL if it should be interpreted.
+JitEntry Jit_entry(struct starlark_Context *ctx,
+		   const struct starlark_Module *m,
+		   const struct starlark_Code *code);
+
+// Records that code's machine code deoptimized, and throws it away if it has
+// done so too often.
+void Jit_deopted(const struct starlark_Code *code);
+
+// Unmaps any machine code compiled for jit.
+void Jit_finish(struct starlark_Jit *jit);
+
+#endif // STARLARK_JIT_H
@@ -11,8 +11,6 @@
 #include "starlark/util.h"
 #include "starlark/strpool.h"
 #include "utf8/utf8.h"
-#include "util/fmt.h"
-#include "util/polyfill.h"
 #include "util/common.h"
 
 static bool lexer_append(struct starlark_Lexer *in,
@@ -22,6 +20,18 @@ static bool lexer_append(struct starlark_Lexer *in,
 	if (in->toks_len + 1 >= in->toks_cap) {
 		// TODO: check for overflow
 		const size_t cap = (in->toks_cap + 16) * 1.5;
+		// The arrays after the first one move when the capacity
+		// changes, so remember where they were.
+		const size_t old_cap = in->toks_cap;
+		size_t old_starts = 0;
+		size_t old_ends = 0;
+		if (old_cap != 0) {
+			old_starts = (uint8_t *)in->toks.starts -
+				     (uint8_t *)in->toks.tags;
+			old_ends = (uint8_t *)in->toks.ends -
+				   (uint8_t *)in->toks.tags;
+		}
+
 		size_t tags_len = cap * sizeof(in->toks.tags[0]);
 		size_t starts_len = cap * sizeof(in->toks.starts[0]);
 		size_t ends_len = cap * sizeof(in->toks.ends[0]);
@@ -39,6 +49,12 @@ static bool lexer_append(struct starlark_Lexer *in,
 			(size_t *)ALIGN_UP(ptr + tags_len, alignof(size_t));
 		in->toks.ends = (size_t *)ALIGN_UP(ptr + tags_len + starts_len,
 						   alignof(size_t));
+		if (old_cap != 0) {
+			memmove(in->toks.ends, ptr + old_ends,
+				old_cap * sizeof(in->toks.ends[0]));
+			memmove(in->toks.starts, ptr + old_starts,
+				old_cap * sizeof(in->toks.starts[0]));
+		}
 		in->toks_cap = cap;
 	}
 
@@ -119,24 +135,15 @@ static bool consume(struct starlark_Lexer *l, const char *next)
 	return true;
 }
 
-static char *quoted_char_string(struct starlark_Lexer *in)
+// Returns an error argument which quotes the character at in->idx + 1.
+static union starlark_ErrorArg char_span(struct starlark_Lexer *in)
 {
-	size_t len2 = 0;
-	uint32_t tmp = peek_impl(in, &len2);
-	if (tmp == UTF8_ERROR) {
-		char buf[30] = { 0 };
-		buf[0] = '\'';
-
-		for (size_t i = 0; i < len2; i += 1) {
-			snprintf(&buf[1 + 4 * i], 5 - i, "\\x%x",
-				 in->ctx->src[in->idx + 1]);
-		}
-
-		buf[len2 * 4 + 1] = '\'';
-		return strdup(buf);
-	}
-
-	return format("'%.*s'", len2, &in->ctx->src[in->idx + 1]);
+	size_t len = 0;
+	(void)peek_impl(in, &len);
+	return (union starlark_ErrorArg){
+		.span.start = in->idx + 1,
+		.span.len = len,
+	};
 }
 
 // Consumes any of the characters in str, returning true if one was next.
@@ -148,11 +155,11 @@ static bool consume_one(struct starlark_Lexer *l, const char *str)
 	if (c == UTF8_ERROR) {
 		struct starlark_Error err = {
 			.code = STARLARK_ERRORCODE_INVALID_UTF8,
-			.msg = quoted_char_string(l),
+			.arg = char_span(l),
 			.start = l->idx + 1,
 		};
 		if (!err_append(l->ctx, err) ||
-		    !lexer_append(l, STARLARK_TOKEN_ERROR, l->idx + len)) {
+		    !lexer_append(l, STARLARK_TOKEN_ERROR, len)) {
 			l->ctx->err = STARLARK_ERROR_OOM;
 		}
 		advance(l);
@@ -235,7 +242,7 @@ static void skip_whitespace(struct starlark_Lexer *l)
 				if (c == UTF8_ERROR) {
 					struct starlark_Error err = {
 						.code = STARLARK_ERRORCODE_INVALID_UTF8,
-						.msg = quoted_char_string(l),
+						.arg = char_span(l),
 						.start = l->idx + 1,
 					};
 					if (!err_append(l->ctx, err)) {
@@ -344,7 +351,7 @@ static struct StateFn identifier_or_keyword(struct starlark_Lexer *l)
 			l,
 			(struct starlark_Error){
 				.code = STARLARK_ERRORCODE_INVALID_UTF8,
-				.msg = quoted_char_string(l),
+				.arg = char_span(l),
 				.start = l->idx + 1,
 			},
 			0);
@@ -410,7 +417,7 @@ static struct StateFn string(struct starlark_Lexer *l)
 		if (bytes && !starlark_isbytes(c)) {
 			struct starlark_Error err = {
 				.code = STARLARK_ERRORCODE_INVALID_BYTES_CHAR,
-				.msg = quoted_char_string(l),
+				.arg = char_span(l),
 				.start = l->idx + 1,
 			};
 			if (!err_append(l->ctx, err)) {
@@ -443,7 +450,6 @@ static struct StateFn string(struct starlark_Lexer *l)
 		// Unclosed string.
 		struct starlark_Error err = {
 			.code = STARLARK_ERRORCODE_NEWLINE_IN_STRING,
-			.msg = NULL,
 			.start = l->idx + 1,
 		};
 		if (bytes && raw) {
@@ -458,7 +464,6 @@ static struct StateFn string(struct starlark_Lexer *l)
 		// Unclosed string.
 		struct starlark_Error err = {
 			.code = STARLARK_ERRORCODE_STRING_EOF,
-			.msg = NULL,
 			.start = l->idx + 1,
 		};
 		if (bytes && raw) {
@@ -669,7 +674,7 @@ static struct StateFn symbol(struct starlark_Lexer *l)
 			l,
 			(struct starlark_Error){
 				.code = STARLARK_ERRORCODE_UNEXPECTED_SYMBOL,
-				.msg = quoted_char_string(l),
+				.arg = char_span(l),
 				.start = l->idx + 1,
 			},
 			1);
@@ -696,7 +701,7 @@ static struct StateFn symbol(struct starlark_Lexer *l)
 			l,
 			(struct starlark_Error){
 				.code = STARLARK_ERRORCODE_UNEXPECTED_SYMBOL,
-				.msg = quoted_char_string(l),
+				.arg = char_span(l),
 				.start = l->idx + 1,
 			},
 			1);
@@ -720,7 +725,7 @@ static struct StateFn text(struct starlark_Lexer *l)
 			l,
 			(struct starlark_Error){
 				.code = STARLARK_ERRORCODE_INVALID_UTF8,
-				.msg = quoted_char_string(l),
+				.arg = char_span(l),
 				.start = l->idx + 1,
 			},
 			len);
@@ -796,7 +801,8 @@ int starlark_lex(struct starlark_Context *ctx, const char *name,
 		return STARLARK_ERROR_TOOBIG;
 	}
 
-	if (!strpool_init(&ctx->strpool)) {
+	// A context which has been reset keeps its strpool around.
+	if (ctx->strpool.buffer.ptr == NULL && !strpool_init(&ctx->strpool)) {
 		ctx->err = STARLARK_ERROR_OOM;
 		return STARLARK_ERROR_OOM;
 	}
@@ -818,14 +824,14 @@ int starlark_lex(struct starlark_Context *ctx, const char *name,
 		.func = text,
 	};
 
+	// Reuse whatever token arrays out already has, so that a lexer which
+	// was reset doesn't need to allocate them again.
 	*out = (struct starlark_Lexer){
 		.ctx = ctx,
 		.idx = SIZE_MAX,
-		.toks.tags = NULL,
-		.toks.starts = NULL,
-		.toks.ends = NULL,
+		.toks = out->toks,
 		.toks_len = 0,
-		.toks_cap = 0,
+		.toks_cap = out->toks_cap,
 	};
 
 	while (state.func != NULL) {
@@ -837,6 +843,8 @@ int starlark_lex(struct starlark_Context *ctx, const char *name,
 			ctx->errs_len = 0;
 			free(out->toks.tags);
 			free(ctx->errs.codes);
+			out->toks.tags = NULL;
+			ctx->errs.codes = NULL;
 			return ctx->err;
 		}
 	}
@@ -922,6 +930,15 @@ void starlark_tokens_dump(struct starlark_Lexer *in, FILE *f)
 	}
 }
 
+void starlark_Lexer_reset(struct starlark_Lexer *l)
+{
+	assert(l != NULL);
+
+	l->ctx = NULL;
+	l->idx = SIZE_MAX;
+	l->toks_len = 0;
+}
+
 void starlark_Lexer_finish(struct starlark_Lexer *l)
 {
 	if (l == NULL) {
@@ -930,4 +947,7 @@ void starlark_Lexer_finish(struct starlark_Lexer *l)
 
 	l->ctx = NULL;
 	free(l->toks.tags);
+	l->toks.tags = NULL;
+	l->toks_len = 0;
+	l->toks_cap = 0;
 }
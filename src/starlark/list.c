@@ -0,0 +1,377 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "starlark/list.h"
+#include "starlark/common.h"
+#include "starlark/dict.h"
+#include "starlark/ops.h"
+#include "starlark/value.h"
+#include "util/common.h"
+
+struct starlark_List *List_create(const size_t cap)
+{
+	struct starlark_List *result = malloc(sizeof(*result));
+	if (result == NULL) {
+		return NULL;
+	}
+
+	*result = (struct starlark_List){
+		.obj.type = STARLARK_TYPE_LIST,
+		.obj.refs = 1,
+	};
+	if (cap != 0 && List_reserve(result, cap) != 0) {
+		free(result);
+		return NULL;
+	}
+
+	return result;
+}
+
+void List_destroy(struct starlark_List *l)
+{
+	if (l == NULL) {
+		return;
+	}
+
+	for (size_t i = 0; i < l->len; i += 1) {
+		Value_release(l->items[i]);
+	}
+
+	free(l->items);
+	free(l);
+}
+
+int List_reserve(struct starlark_List *l, const size_t n)
+{
+	assert(l != NULL);
+
+	if (n <= l->cap - l->len) {
+		return 0;
+	}
+
+	if (n > SIZE_MAX / sizeof(l->items[0]) - l->len) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	size_t cap = l->cap > SIZE_MAX / sizeof(l->items[0]) / 2 ?
+			     l->len + n :
+			     MAX(l->cap * 2, 4);
+	cap = MAX(cap, l->len + n);
+
+	struct starlark_Value *items =
+		realloc(l->items, cap * sizeof(items[0]));
+	if (items == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	l->items = items;
+	l->cap = cap;
+	return 0;
+}
+
+int List_append(struct starlark_List *l, const struct starlark_Value v)
+{
+	assert(l != NULL);
+
+	if (l->iterators != 0) {
+		return STARLARK_ERRORCODE_MUTATED_DURING_ITERATION;
+	}
+
+	if (l->len == l->cap) {
+		int ret = List_reserve(l, 1);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	Value_retain(v);
+	l->items[l->len] = v;
+	l->len += 1;
+	return 0;
+}
+
+int List_from_iterable(const struct starlark_Value v,
+		       struct starlark_Value *out)
+{
+	struct starlark_Value it = { 0 };
+	int ret = Value_iterate(v, &it);
+	if (ret != 0) {
+		return ret;
+	}
+
+	size_t len = 0;
+	struct starlark_List *l = List_create(Value_len(v, &len) ? len : 0);
+	if (l == NULL) {
+		Value_release(it);
+		return STARLARK_ERROR_OOM;
+	}
+
+	struct starlark_Value x = { 0 };
+	while ((ret = Iterator_next((void *)Value_as_object(it), &x)) == 1) {
+		ret = List_append(l, x);
+		Value_release(x);
+		if (ret != 0) {
+			break;
+		}
+	}
+
+	Value_release(it);
+	if (ret != 0) {
+		List_destroy(l);
+		return ret;
+	}
+
+	*out = Value_object(&l->obj);
+	return 0;
+}
+
+struct starlark_Tuple *Tuple_create(const size_t len)
+{
+	if (len > (SIZE_MAX - sizeof(struct starlark_Tuple)) /
+			  sizeof(struct starlark_Value)) {
+		return NULL;
+	}
+
+	struct starlark_Tuple *result =
+		malloc(sizeof(*result) + len * sizeof(result->items[0]));
+	if (result == NULL) {
+		return NULL;
+	}
+
+	result->obj = (struct starlark_Object){
+		.type = STARLARK_TYPE_TUPLE,
+		.refs = 1,
+	};
+	result->len = len;
+	for (size_t i = 0; i < len; i += 1) {
+		result->items[i] = VALUE_NONE;
+	}
+
+	return result;
+}
+
+void Tuple_destroy(struct starlark_Tuple *t)
+{
+	if (t == NULL) {
+		return;
+	}
+
+	for (size_t i = 0; i < t->len; i += 1) {
+		Value_release(t->items[i]);
+	}
+
+	free(t);
+}
+
+struct starlark_Range *Range_create(const int64_t start, const int64_t stop,
+				    const int64_t step)
+{
+	assert(step != 0);
+
+	struct starlark_Range *result = malloc(sizeof(*result));
+	if (result == NULL) {
+		return NULL;
+	}
+
+	*result = (struct starlark_Range){
+		.obj.type = STARLARK_TYPE_RANGE,
+		.obj.refs = 1,
+		.start = start,
+		.stop = stop,
+		.step = step,
+	};
+	return result;
+}
+
+size_t Range_len(const struct starlark_Range *r)
+{
+	assert(r != NULL);
+
+	// The distance is computed in unsigned arithmetic, since it might not
+	// fit in an int64_t.
+	if (r->step > 0 && r->start < r->stop) {
+		const uint64_t distance =
+			(uint64_t)r->stop - (uint64_t)r->start;
+		return (size_t)((distance - 1) / (uint64_t)r->step + 1);
+	}
+
+	if (r->step < 0 && r->start > r->stop) {
+		const uint64_t distance =
+			(uint64_t)r->start - (uint64_t)r->stop;
+		return (size_t)((distance - 1) / -(uint64_t)r->step + 1);
+	}
+
+	return 0;
+}
+
+int64_t Range_at(const struct starlark_Range *r, const size_t i)
+{
+	assert(r != NULL);
+	assert(i < Range_len(r));
+
+	return (int64_t)((uint64_t)r->start + (uint64_t)i * (uint64_t)r->step);
+}
+
+struct starlark_Iterator *Iterator_create(const struct starlark_Value seq)
+{
+	struct starlark_Iterator *result = malloc(sizeof(*result));
+	if (result == NULL) {
+		return NULL;
+	}
+
+	const int ret = Iterator_init(result, seq);
+	assert(ret == 0 && "can't iterate over this type");
+	(void)ret;
+	result->borrowed = false;
+	return result;
+}
+
+int Iterator_init(struct starlark_Iterator *it, const struct starlark_Value seq)
+{
+	assert(it != NULL);
+
+	*it = (struct starlark_Iterator){
+		.obj.type = STARLARK_TYPE_ITERATOR,
+		.obj.refs = 1,
+		.seq = seq,
+		.borrowed = true,
+	};
+	switch (Value_type(seq)) {
+	case STARLARK_TYPE_LIST: {
+		struct starlark_List *l =
+			(struct starlark_List *)Value_as_object(seq);
+		l->iterators += 1;
+		it->kind = ITERATOR_ITEMS;
+		Value_items(seq, &it->items, &it->len);
+		break;
+	}
+	case STARLARK_TYPE_TUPLE:
+		it->kind = ITERATOR_ITEMS;
+		Value_items(seq, &it->items, &it->len);
+		break;
+	case STARLARK_TYPE_RANGE: {
+		const struct starlark_Range *r =
+			(struct starlark_Range *)Value_as_object(seq);
+		it->kind = ITERATOR_RANGE;
+		it->len = Range_len(r);
+		it->next = r->start;
+		it->step = r->step;
+		break;
+	}
+	case STARLARK_TYPE_DICT:
+		Dict_start_iterating(
+			(struct starlark_Dict *)Value_as_object(seq));
+		it->kind = ITERATOR_DICT;
+		break;
+	default:
+		return STARLARK_ERRORCODE_NOT_ITERABLE;
+	}
+
+	Value_retain(seq);
+	return 0;
+}
+
+void Iterator_destroy(struct starlark_Iterator *it)
+{
+	if (it == NULL) {
+		return;
+	}
+
+	if (Value_type(it->seq) == STARLARK_TYPE_LIST) {
+		struct starlark_List *l =
+			(struct starlark_List *)Value_as_object(it->seq);
+		l->iterators -= 1;
+	} else if (Value_type(it->seq) == STARLARK_TYPE_DICT) {
+		Dict_stop_iterating(
+			(struct starlark_Dict *)Value_as_object(it->seq));
+	}
+
+	Value_release(it->seq);
+	if (!it->borrowed) {
+		free(it);
+	}
+}
+
+size_t Iterator_len(const struct starlark_Iterator *it)
+{
+	assert(it != NULL);
+
+	if (it->kind == ITERATOR_DICT) {
+		return Dict_len(
+			(struct starlark_Dict *)Value_as_object(it->seq));
+	}
+
+	return it->len - it->pos;
+}
+
+int Iterator_next(struct starlark_Iterator *it, struct starlark_Value *out)
+{
+	assert(it != NULL);
+	assert(out != NULL);
+
+	switch ((enum IteratorKind)it->kind) {
+	case ITERATOR_ITEMS:
+		if (it->pos >= it->len) {
+			return 0;
+		}
+
+		*out = it->items[it->pos];
+		Value_retain(*out);
+		it->pos += 1;
+		return 1;
+	case ITERATOR_RANGE:
+		if (it->pos >= it->len) {
+			return 0;
+		}
+
+		if (Value_from_i64(it->next, out) != 0) {
+			return STARLARK_ERROR_OOM;
+		}
+
+		// Stepping past the last int can overflow, which is harmless
+		// since it's never used.
+		it->next = (int64_t)((uint64_t)it->next + (uint64_t)it->step);
+		it->pos += 1;
+		return 1;
+	case ITERATOR_DICT: {
+		struct starlark_Value value = { 0 };
+		if (!Dict_next((struct starlark_Dict *)Value_as_object(it->seq),
+			       &it->pos, out, &value)) {
+			return 0;
+		}
+
+		Value_retain(*out);
+		return 1;
+	}
+	}
+
+	assert(false && "invalid iterator kind");
+	return 0;
+}
+
+bool Value_items(const struct starlark_Value v,
+		 const struct starlark_Value **items, size_t *len)
+{
+	if (!Value_is_object(v)) {
+		return false;
+	}
+
+	struct starlark_Object *o = Value_as_object(v);
+	if (o->type == STARLARK_TYPE_LIST) {
+		*items = ((struct starlark_List *)o)->items;
+		*len = ((struct starlark_List *)o)->len;
+		return true;
+	}
+
+	if (o->type == STARLARK_TYPE_TUPLE) {
+		*items = ((struct starlark_Tuple *)o)->items;
+		*len = ((struct starlark_Tuple *)o)->len;
+		return true;
+	}
+
+	return false;
+}
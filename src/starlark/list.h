@@ -0,0 +1,150 @@
+#ifndef STARLARK_LIST_H
+#define STARLARK_LIST_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "starlark/common.h"
+#include "starlark/value.h"
+
+// The sequence types of starlark, and the iterators the interpreter uses to
+// loop over them and over dicts.
+//
+// Their fields are public, since the interpreter reads them directly in its
+// hottest instructions. Each of them starts with a starlark_Object header, so a
+// pointer to one can be stored in a starlark_Value.
+
+// A mutable sequence of values, which holds a reference to each of them.
+struct starlark_List {
+	struct starlark_Object obj;
+	size_t len;
+	size_t cap;
+	struct starlark_Value *items;
+	// How many iterators are going over the list. The list can't be
+	// changed at all while there are any.
+	uint32_t iterators;
+};
+
+// An immutable sequence of values, stored in the same allocation as the tuple.
+struct starlark_Tuple {
+	struct starlark_Object obj;
+	size_t len;
+	struct starlark_Value items[];
+};
+
+// The sequence of ints start, start + step, ..., up to but not including stop.
+// step is never 0.
+struct starlark_Range {
+	struct starlark_Object obj;
+	int64_t start;
+	int64_t stop;
+	int64_t step;
+};
+
+// What an iterator goes over, which says which of its fields are used.
+enum IteratorKind {
+	// The items of a list or tuple.
+	ITERATOR_ITEMS,
+	ITERATOR_RANGE,
+	// The keys of a dict, which are found with Dict_next.
+	ITERATOR_DICT,
+};
+
+// Goes over the elements of a list, tuple or range, or the keys of a dict.
+//
+// Everything needed to step over a list, tuple or range is kept in the
+// iterator itself, so that the interpreter can do it inline. A list can't
+// change length while it's being iterated over, so its items and length are
+// read once, when the iterator is made.
+struct starlark_Iterator {
+	struct starlark_Object obj;
+	struct starlark_Value seq;
+	uint8_t kind;
+	// Set if the iterator lives in memory it doesn't own, such as the
+	// frame of the loop using it, so it isn't freed when it's released.
+	bool borrowed;
+	// The index of the next value, and the number of values, for lists,
+	// tuples and ranges.
+	size_t pos;
+	size_t len;
+	const struct starlark_Value *items;
+	// The next int of a range, and the difference to the one after it.
+	int64_t next;
+	int64_t step;
+};
+
+// The number of slots an iterator takes up in a frame. It has fields as wide
+// as a slot, so its size is a multiple of one.
+#define ITERATOR_SLOTS \
+	(sizeof(struct starlark_Iterator) / sizeof(struct starlark_Value))
+
+// Returns a new, empty list with room for cap values.
+// Returns NULL if we couldn't allocate enough memory.
+struct starlark_List *List_create(const size_t cap);
+
+void List_destroy(struct starlark_List *l);
+
+// Appends v to l, which adds its own reference to v.
+// Returns 0 on success, STARLARK_ERROR_OOM if we couldn't allocate enough
+// memory, or STARLARK_ERRORCODE_MUTATED_DURING_ITERATION if l is being
+// iterated over.
+int List_append(struct starlark_List *l, const struct starlark_Value v);
+
+// Makes sure l has room for n more values. If it has to grow, it at least
+// doubles, so that appending one value at a time stays cheap, and otherwise
+// gets exactly as much room as was asked for.
+// Returns 0 on success, or STARLARK_ERROR_OOM.
+int List_reserve(struct starlark_List *l, const size_t n);
+
+// Stores a new list of the values of the iterable v in *out.
+// Returns 0 on success, STARLARK_ERROR_OOM if we couldn't allocate enough
+// memory, or STARLARK_ERRORCODE_NOT_ITERABLE if v isn't iterable.
+int List_from_iterable(const struct starlark_Value v,
+		       struct starlark_Value *out);
+
+// Returns a new tuple of len values, which are all None. The caller fills
+// them in, giving the tuple a reference to each.
+// Returns NULL if we couldn't allocate enough memory.
+struct starlark_Tuple *Tuple_create(const size_t len);
+
+void Tuple_destroy(struct starlark_Tuple *t);
+
+// Returns a new range. step must not be 0.
+// Returns NULL if we couldn't allocate enough memory.
+struct starlark_Range *Range_create(const int64_t start, const int64_t stop,
+				    const int64_t step);
+
+// Returns the number of ints in r.
+size_t Range_len(const struct starlark_Range *r);
+
+// Returns the int at index i of r, which must be less than Range_len(r).
+int64_t Range_at(const struct starlark_Range *r, const size_t i);
+
+// Returns a new iterator over seq, which must be a list, tuple, range or dict.
+// Returns NULL if we couldn't allocate enough memory.
+struct starlark_Iterator *Iterator_create(const struct starlark_Value seq);
+
+// Makes a new iterator over seq in *it, which is borrowed, so that no memory
+// has to be allocated for it.
+// Returns 0 on success, or STARLARK_ERRORCODE_NOT_ITERABLE if seq isn't a list,
+// tuple, range or dict.
+int Iterator_init(struct starlark_Iterator *it,
+		  const struct starlark_Value seq);
+
+void Iterator_destroy(struct starlark_Iterator *it);
+
+// Returns the number of values it has left. For a dict, this can be more than
+// there are once it has started, if keys have been deleted since.
+size_t Iterator_len(const struct starlark_Iterator *it);
+
+// Stores the next value of it in *out, which the caller owns.
+// Returns 1 if there was one, 0 once it is exhausted, or STARLARK_ERROR_OOM.
+int Iterator_next(struct starlark_Iterator *it, struct starlark_Value *out);
+
+// If v is a list or tuple, points *items at its values and stores how many
+// there are in *len, which are borrowed from v.
+// Returns false if v isn't a list or tuple.
+bool Value_items(const struct starlark_Value v,
+		 const struct starlark_Value **items, size_t *len);
+
+#endif // STARLARK_LIST_H
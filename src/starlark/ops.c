@@ -0,0 +1,1046 @@
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "starlark/ops.h"
+#include "starlark/common.h"
+#include "starlark/dict.h"
+#include "starlark/int.h"
+#include "starlark/list.h"
+#include "starlark/parse.h"
+#include "starlark/str.h"
+#include "starlark/value.h"
+#include "util/common.h"
+
+static const char *const Op_symbols[] = {
+	[STARLARK_OP_ADD] = u8"+",	   [STARLARK_OP_SUB] = u8"-",
+	[STARLARK_OP_MUL] = u8"*",	   [STARLARK_OP_DIV] = u8"/",
+	[STARLARK_OP_FLOORDIV] = u8"//",   [STARLARK_OP_MOD] = u8"%",
+	[STARLARK_OP_BITAND] = u8"&",	   [STARLARK_OP_BITOR] = u8"|",
+	[STARLARK_OP_XOR] = u8"^",	   [STARLARK_OP_LSHIFT] = u8"<<",
+	[STARLARK_OP_RSHIFT] = u8">>",	   [STARLARK_OP_EQ] = u8"==",
+	[STARLARK_OP_NOTEQ] = u8"!=",	   [STARLARK_OP_LESS] = u8"<",
+	[STARLARK_OP_LEQ] = u8"<=",	   [STARLARK_OP_GREATER] = u8">",
+	[STARLARK_OP_GEQ] = u8">=",	   [STARLARK_OP_IN] = u8"in",
+	[STARLARK_OP_NOT_IN] = u8"not in", [STARLARK_OP_AND] = u8"and",
+	[STARLARK_OP_OR] = u8"or",	   [STARLARK_OP_NOT] = u8"not",
+	[STARLARK_OP_BITNOT] = u8"~",
+};
+
+const char *Op_symbol(const enum starlark_Op op)
+{
+	assert(op < sizeof(Op_symbols) / sizeof(Op_symbols[0]));
+	return Op_symbols[op];
+}
+
+static struct starlark_Str *as_str(const struct starlark_Value v)
+{
+	return (struct starlark_Str *)Value_as_object(v);
+}
+
+static bool is_number(const enum starlark_Type t)
+{
+	return t == STARLARK_TYPE_INT || t == STARLARK_TYPE_FLOAT;
+}
+
+int Value_to_double(const struct starlark_Value v, double *out)
+{
+	if (Value_type(v) == STARLARK_TYPE_FLOAT) {
+		*out = Value_as_float(v);
+		return 0;
+	}
+
+	assert(Value_type(v) == STARLARK_TYPE_INT);
+	if (Value_is_small_int(v)) {
+		*out = (double)Value_as_small_int(v);
+		return 0;
+	}
+
+	// strtod rounds correctly, which converting the digits ourselves
+	// wouldn't.
+	char *str = Int_to_str((struct starlark_Int *)Value_as_object(v), 10);
+	if (str == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	*out = strtod(str, NULL);
+	free(str);
+	return 0;
+}
+
+static int float_result(const double x, struct starlark_Value *out)
+{
+	const struct starlark_Value v = Value_float(x);
+	if (Value_is_none(v)) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	*out = v;
+	return 0;
+}
+
+static int int_binary(const enum starlark_Op op, const struct starlark_Value a,
+		      const struct starlark_Value b, struct starlark_Value *out)
+{
+	switch (op) {
+	case STARLARK_OP_ADD:
+		return Value_int_add(a, b, out);
+	case STARLARK_OP_SUB:
+		return Value_int_sub(a, b, out);
+	case STARLARK_OP_MUL:
+		return Value_int_mul(a, b, out);
+	case STARLARK_OP_FLOORDIV:
+		return Value_int_floordiv(a, b, out);
+	case STARLARK_OP_MOD:
+		return Value_int_mod(a, b, out);
+	case STARLARK_OP_BITAND:
+		return Value_int_and(a, b, out);
+	case STARLARK_OP_BITOR:
+		return Value_int_or(a, b, out);
+	case STARLARK_OP_XOR:
+		return Value_int_xor(a, b, out);
+	case STARLARK_OP_LSHIFT:
+		return Value_int_lshift(a, b, out);
+	case STARLARK_OP_RSHIFT:
+		return Value_int_rshift(a, b, out);
+	default:
+		return STARLARK_ERRORCODE_UNSUPPORTED_BINARY;
+	}
+}
+
+// Computes a op b where at least one of them is a float. Dividing ints also
+// ends up here, since / always gives a float.
+static int float_binary(const enum starlark_Op op,
+			const struct starlark_Value a,
+			const struct starlark_Value b,
+			struct starlark_Value *out)
+{
+	double x = 0;
+	double y = 0;
+	int ret = Value_to_double(a, &x);
+	if (ret == 0) {
+		ret = Value_to_double(b, &y);
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	switch (op) {
+	case STARLARK_OP_ADD:
+		return float_result(x + y, out);
+	case STARLARK_OP_SUB:
+		return float_result(x - y, out);
+	case STARLARK_OP_MUL:
+		return float_result(x * y, out);
+	case STARLARK_OP_DIV:
+		if (y == 0) {
+			return STARLARK_ERRORCODE_FLOAT_DIVISION_BY_ZERO;
+		}
+
+		return float_result(x / y, out);
+	case STARLARK_OP_FLOORDIV:
+		if (y == 0) {
+			return STARLARK_ERRORCODE_FLOAT_DIVISION_BY_ZERO;
+		}
+
+		return float_result(floor(x / y), out);
+	case STARLARK_OP_MOD: {
+		if (y == 0) {
+			return STARLARK_ERRORCODE_FLOAT_DIVISION_BY_ZERO;
+		}
+
+		// Like ints, the result has the same sign as y.
+		double r = fmod(x, y);
+		if (r != 0 && (r < 0) != (y < 0)) {
+			r += y;
+		}
+
+		return float_result(r, out);
+	}
+	default:
+		return STARLARK_ERRORCODE_UNSUPPORTED_BINARY;
+	}
+}
+
+// Stores how many times a sequence is repeated when multiplied by the int n.
+static int repeat_count(const struct starlark_Value n, size_t *out)
+{
+	if (!Value_is_small_int(n)) {
+		if (Value_int_cmp(n, Value_small_int(0)) < 0) {
+			*out = 0;
+			return 0;
+		}
+
+		return STARLARK_ERROR_TOOBIG;
+	}
+
+	const int64_t count = Value_as_small_int(n);
+	*out = count < 0 ? 0 : (size_t)count;
+	return 0;
+}
+
+static int str_repeat(struct starlark_Str *s, const size_t n,
+		      struct starlark_Value *out)
+{
+	const size_t len = Str_len(s);
+	if (len != 0 && n > SIZE_MAX / len) {
+		return STARLARK_ERROR_TOOBIG;
+	}
+
+	char *bytes = malloc(MAX(len * n, 1));
+	if (bytes == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	for (size_t i = 0; i < n; i += 1) {
+		memcpy(bytes + i * len, Str_data(s), len);
+	}
+
+	const struct starlark_Value result = Value_str(len * n, bytes);
+	free(bytes);
+	if (Value_is_none(result)) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	*out = result;
+	return 0;
+}
+
+// Computes a + b, repeated n times, where a and b are both lists or both
+// tuples. b is ignored if it's VALUE_NONE.
+static int items_concat(const struct starlark_Value a,
+			const struct starlark_Value b, const size_t n,
+			struct starlark_Value *out)
+{
+	const struct starlark_Value *x = NULL;
+	const struct starlark_Value *y = NULL;
+	size_t x_len = 0;
+	size_t y_len = 0;
+	Value_items(a, &x, &x_len);
+	Value_items(b, &y, &y_len);
+
+	const size_t per = x_len + y_len;
+	if (per != 0 && n > SIZE_MAX / sizeof(x[0]) / per) {
+		return STARLARK_ERROR_TOOBIG;
+	}
+
+	struct starlark_Value *items = NULL;
+	struct starlark_Object *o = NULL;
+	if (Value_type(a) == STARLARK_TYPE_LIST) {
+		struct starlark_List *l = List_create(per * n);
+		if (l == NULL) {
+			return STARLARK_ERROR_OOM;
+		}
+
+		l->len = per * n;
+		items = l->items;
+		o = &l->obj;
+	} else {
+		struct starlark_Tuple *t = Tuple_create(per * n);
+		if (t == NULL) {
+			return STARLARK_ERROR_OOM;
+		}
+
+		items = t->items;
+		o = &t->obj;
+	}
+
+	for (size_t i = 0; i < n; i += 1) {
+		for (size_t j = 0; j < x_len; j += 1) {
+			items[i * per + j] = x[j];
+			Value_retain(x[j]);
+		}
+
+		for (size_t j = 0; j < y_len; j += 1) {
+			items[i * per + x_len + j] = y[j];
+			Value_retain(y[j]);
+		}
+	}
+
+	*out = Value_object(o);
+	return 0;
+}
+
+static int dict_union(struct starlark_Dict *a, struct starlark_Dict *b,
+		      struct starlark_Value *out)
+{
+	struct starlark_Dict *result = Dict_create();
+	if (result == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	const struct starlark_Dict *dicts[] = { a, b };
+	for (size_t i = 0; i < 2; i += 1) {
+		size_t pos = 0;
+		struct starlark_Value key = { 0 };
+		struct starlark_Value value = { 0 };
+		while (Dict_next(dicts[i], &pos, &key, &value)) {
+			int ret = Dict_set(result, key, value);
+			if (ret != 0) {
+				Dict_destroy(result);
+				return ret;
+			}
+		}
+	}
+
+	*out = Value_object((struct starlark_Object *)result);
+	return 0;
+}
+
+// Appends the n bytes at bytes to *s, which is created if it's NULL.
+// Returns false if we couldn't allocate enough memory, in which case *s is
+// released.
+static bool str_append_bytes(struct starlark_Str **s, const size_t n,
+			     const char *bytes)
+{
+	struct starlark_Str *b = Str_create(n, bytes);
+	if (b == NULL) {
+		Str_destroy(*s);
+		*s = NULL;
+		return false;
+	}
+
+	if (*s == NULL) {
+		*s = b;
+		return true;
+	}
+
+	*s = Str_append(*s, b);
+	Str_destroy(b);
+	return *s != NULL;
+}
+
+// Computes fmt % args, which supports the %s, %r, %d and %% directives. args
+// is a tuple of the values used by each directive, or the only one.
+static int str_format(struct starlark_Str *fmt,
+		      const struct starlark_Value args,
+		      struct starlark_Value *out)
+{
+	const struct starlark_Value *items = &args;
+	size_t items_len = 1;
+	if (Value_type(args) == STARLARK_TYPE_TUPLE) {
+		Value_items(args, &items, &items_len);
+	}
+
+	const char *data = Str_data(fmt);
+	const size_t len = Str_len(fmt);
+	struct starlark_Str *result = NULL;
+	size_t used = 0;
+	size_t start = 0;
+	int ret = 0;
+	for (size_t i = 0; i < len && ret == 0; i += 1) {
+		if (data[i] != '%') {
+			continue;
+		}
+
+		if (!str_append_bytes(&result, i - start, data + start)) {
+			return STARLARK_ERROR_OOM;
+		}
+
+		if (i + 1 == len) {
+			ret = STARLARK_ERRORCODE_INVALID_ARG;
+			break;
+		}
+
+		i += 1;
+		start = i + 1;
+		const char c = data[i];
+		if (c == '%') {
+			start = i;
+			continue;
+		}
+
+		if (used == items_len ||
+		    (c != 's' && c != 'r' && c != 'd' && c != 'i')) {
+			ret = STARLARK_ERRORCODE_INVALID_ARG;
+			break;
+		}
+
+		const struct starlark_Value v = items[used];
+		used += 1;
+		if ((c == 'd' || c == 'i') && Value_type(v) != STARLARK_TYPE_INT) {
+			ret = STARLARK_ERRORCODE_INVALID_ARG;
+			break;
+		}
+
+		const struct starlark_Value s = Value_to_str(v, c == 'r');
+		if (Value_is_none(s)) {
+			ret = STARLARK_ERROR_OOM;
+			break;
+		}
+
+		result = Str_append(result, as_str(s));
+		Value_release(s);
+		if (result == NULL) {
+			return STARLARK_ERROR_OOM;
+		}
+	}
+
+	if (ret == 0 && used != items_len) {
+		ret = STARLARK_ERRORCODE_INVALID_ARG;
+	}
+
+	if (ret == 0 &&
+	    !str_append_bytes(&result, len - start, data + start)) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	if (ret != 0) {
+		Str_destroy(result);
+		return ret;
+	}
+
+	*out = Value_object((struct starlark_Object *)result);
+	return 0;
+}
+
+int Value_binary(const enum starlark_Op op, const struct starlark_Value a,
+		 const struct starlark_Value b, struct starlark_Value *out)
+{
+	switch (op) {
+	case STARLARK_OP_EQ:
+		*out = Value_bool(Value_equal(a, b));
+		return 0;
+	case STARLARK_OP_NOTEQ:
+		*out = Value_bool(!Value_equal(a, b));
+		return 0;
+	case STARLARK_OP_LESS:
+	case STARLARK_OP_LEQ:
+	case STARLARK_OP_GREATER:
+	case STARLARK_OP_GEQ: {
+		int cmp = 0;
+		int ret = Value_compare(a, b, &cmp);
+		if (ret != 0) {
+			return ret;
+		}
+
+		*out = Value_bool(op == STARLARK_OP_LESS    ? cmp < 0 :
+				  op == STARLARK_OP_LEQ	    ? cmp <= 0 :
+				  op == STARLARK_OP_GREATER ? cmp > 0 :
+							      cmp >= 0);
+		return 0;
+	}
+	case STARLARK_OP_IN:
+	case STARLARK_OP_NOT_IN: {
+		bool in = false;
+		int ret = Value_contains(b, a, &in);
+		if (ret != 0) {
+			return ret;
+		}
+
+		*out = Value_bool(in == (op == STARLARK_OP_IN));
+		return 0;
+	}
+	default:
+		break;
+	}
+
+	const enum starlark_Type ta = Value_type(a);
+	const enum starlark_Type tb = Value_type(b);
+	if (ta == STARLARK_TYPE_INT && tb == STARLARK_TYPE_INT) {
+		if (op == STARLARK_OP_DIV) {
+			return float_binary(op, a, b, out);
+		}
+
+		return int_binary(op, a, b, out);
+	}
+
+	if (is_number(ta) && is_number(tb)) {
+		return float_binary(op, a, b, out);
+	}
+
+	size_t n = 0;
+	int ret = 0;
+	switch (op) {
+	case STARLARK_OP_ADD:
+		if (ta == STARLARK_TYPE_STRING && tb == STARLARK_TYPE_STRING) {
+			Value_retain(a);
+			struct starlark_Value copy = a;
+			return Value_add_move(&copy, b, out);
+		}
+
+		if (ta == tb && (ta == STARLARK_TYPE_LIST ||
+				 ta == STARLARK_TYPE_TUPLE)) {
+			return items_concat(a, b, 1, out);
+		}
+
+		break;
+	case STARLARK_OP_MUL:
+		if (ta == STARLARK_TYPE_INT) {
+			// n * x is the same as x * n.
+			return Value_binary(op, b, a, out);
+		}
+
+		if (tb != STARLARK_TYPE_INT) {
+			break;
+		}
+
+		ret = repeat_count(b, &n);
+		if (ret != 0) {
+			return ret;
+		}
+
+		if (ta == STARLARK_TYPE_STRING) {
+			return str_repeat(as_str(a), n, out);
+		}
+
+		if (ta == STARLARK_TYPE_LIST || ta == STARLARK_TYPE_TUPLE) {
+			return items_concat(a, VALUE_NONE, n, out);
+		}
+
+		break;
+	case STARLARK_OP_MOD:
+		if (ta == STARLARK_TYPE_STRING) {
+			return str_format(as_str(a), b, out);
+		}
+
+		break;
+	case STARLARK_OP_BITOR:
+		if (ta == STARLARK_TYPE_DICT && tb == STARLARK_TYPE_DICT) {
+			return dict_union((void *)Value_as_object(a),
+					  (void *)Value_as_object(b), out);
+		}
+
+		break;
+	default:
+		break;
+	}
+
+	return STARLARK_ERRORCODE_UNSUPPORTED_BINARY;
+}
+
+int Value_add_move(struct starlark_Value *a, const struct starlark_Value b,
+		   struct starlark_Value *out)
+{
+	if (Value_type(*a) != STARLARK_TYPE_STRING ||
+	    Value_type(b) != STARLARK_TYPE_STRING) {
+		const int ret = Value_binary(STARLARK_OP_ADD, *a, b, out);
+		if (ret == 0) {
+			Value_release(*a);
+			*a = VALUE_NONE;
+		}
+
+		return ret;
+	}
+
+	// Str_append releases a even when it fails.
+	struct starlark_Str *s = Str_append(as_str(*a), as_str(b));
+	*a = VALUE_NONE;
+	if (s == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	*out = Value_object((struct starlark_Object *)s);
+	return 0;
+}
+
+int Value_unary(const enum starlark_Op op, const struct starlark_Value a,
+		struct starlark_Value *out)
+{
+	const enum starlark_Type t = Value_type(a);
+	switch (op) {
+	case STARLARK_OP_NOT:
+		*out = Value_bool(!Value_truth(a));
+		return 0;
+	case STARLARK_OP_ADD:
+		if (is_number(t)) {
+			Value_retain(a);
+			*out = a;
+			return 0;
+		}
+
+		break;
+	case STARLARK_OP_SUB:
+		if (t == STARLARK_TYPE_INT) {
+			return Value_int_neg(a, out);
+		}
+
+		if (t == STARLARK_TYPE_FLOAT) {
+			return float_result(-Value_as_float(a), out);
+		}
+
+		break;
+	case STARLARK_OP_BITNOT:
+		if (t == STARLARK_TYPE_INT) {
+			return Value_int_not(a, out);
+		}
+
+		break;
+	default:
+		break;
+	}
+
+	return STARLARK_ERRORCODE_UNSUPPORTED_UNARY;
+}
+
+// Orders floats so that NaN is greater than every other float, and equal to
+// itself, which keeps sorting well defined.
+static int float_cmp(const double x, const double y)
+{
+	if (isnan(x) || isnan(y)) {
+		return (int)isnan(x) - (int)isnan(y);
+	}
+
+	return (x > y) - (x < y);
+}
+
+int Value_compare(const struct starlark_Value a, const struct starlark_Value b,
+		  int *out)
+{
+	const enum starlark_Type ta = Value_type(a);
+	const enum starlark_Type tb = Value_type(b);
+	if (ta == STARLARK_TYPE_INT && tb == STARLARK_TYPE_INT) {
+		*out = Value_int_cmp(a, b);
+		return 0;
+	}
+
+	if (is_number(ta) && is_number(tb)) {
+		double x = 0;
+		double y = 0;
+		int ret = Value_to_double(a, &x);
+		if (ret == 0) {
+			ret = Value_to_double(b, &y);
+		}
+
+		if (ret != 0) {
+			return ret;
+		}
+
+		*out = float_cmp(x, y);
+		return 0;
+	}
+
+	if (ta != tb) {
+		return STARLARK_ERRORCODE_UNSUPPORTED_BINARY;
+	}
+
+	switch (ta) {
+	case STARLARK_TYPE_BOOL:
+		*out = (int)Value_truth(a) - (int)Value_truth(b);
+		return 0;
+	case STARLARK_TYPE_STRING: {
+		const struct starlark_Str *x = as_str(a);
+		const struct starlark_Str *y = as_str(b);
+		const int cmp = memcmp(Str_data(x), Str_data(y),
+				       MIN(Str_len(x), Str_len(y)));
+		*out = cmp != 0 ? cmp :
+				  (Str_len(x) > Str_len(y)) -
+					  (Str_len(x) < Str_len(y));
+		return 0;
+	}
+	case STARLARK_TYPE_LIST:
+	case STARLARK_TYPE_TUPLE: {
+		// Sequences are ordered by their first elements which differ.
+		const struct starlark_Value *x = NULL;
+		const struct starlark_Value *y = NULL;
+		size_t x_len = 0;
+		size_t y_len = 0;
+		Value_items(a, &x, &x_len);
+		Value_items(b, &y, &y_len);
+		for (size_t i = 0; i < x_len && i < y_len; i += 1) {
+			if (!Value_equal(x[i], y[i])) {
+				return Value_compare(x[i], y[i], out);
+			}
+		}
+
+		*out = (x_len > y_len) - (x_len < y_len);
+		return 0;
+	}
+	default:
+		return STARLARK_ERRORCODE_UNSUPPORTED_BINARY;
+	}
+}
+
+static bool range_contains(const struct starlark_Range *r,
+			   const struct starlark_Value x)
+{
+	if (!Value_is_small_int(x) || Range_len(r) == 0) {
+		return false;
+	}
+
+	const int64_t i = Value_as_small_int(x);
+	const int64_t last = Range_at(r, Range_len(r) - 1);
+	if (r->step > 0 ? (i < r->start || i > last) :
+			  (i > r->start || i < last)) {
+		return false;
+	}
+
+	const uint64_t distance = r->step > 0 ? (uint64_t)i - (uint64_t)r->start :
+						(uint64_t)r->start - (uint64_t)i;
+	const uint64_t step = r->step > 0 ? (uint64_t)r->step :
+					    -(uint64_t)r->step;
+	return distance % step == 0;
+}
+
+static bool str_contains(const struct starlark_Str *s,
+			 const struct starlark_Str *sub)
+{
+	const size_t len = Str_len(s);
+	const size_t sub_len = Str_len(sub);
+	if (sub_len > len) {
+		return false;
+	}
+
+	for (size_t i = 0; i <= len - sub_len; i += 1) {
+		if (memcmp(Str_data(s) + i, Str_data(sub), sub_len) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int Value_contains(const struct starlark_Value container,
+		   const struct starlark_Value x, bool *out)
+{
+	switch (Value_type(container)) {
+	case STARLARK_TYPE_STRING:
+		if (Value_type(x) != STARLARK_TYPE_STRING) {
+			return STARLARK_ERRORCODE_UNSUPPORTED_BINARY;
+		}
+
+		*out = str_contains(as_str(container), as_str(x));
+		return 0;
+	case STARLARK_TYPE_LIST:
+	case STARLARK_TYPE_TUPLE: {
+		const struct starlark_Value *items = NULL;
+		size_t len = 0;
+		Value_items(container, &items, &len);
+		*out = false;
+		for (size_t i = 0; i < len && !*out; i += 1) {
+			*out = Value_equal(items[i], x);
+		}
+
+		return 0;
+	}
+	case STARLARK_TYPE_DICT: {
+		struct starlark_Value value = { 0 };
+		int ret = Dict_get((void *)Value_as_object(container), x,
+				   &value);
+		if (ret != 0 && ret != STARLARK_ERRORCODE_KEY_NOT_FOUND) {
+			return ret;
+		}
+
+		*out = ret == 0;
+		return 0;
+	}
+	case STARLARK_TYPE_RANGE:
+		*out = range_contains((void *)Value_as_object(container), x);
+		return 0;
+	default:
+		return STARLARK_ERRORCODE_UNSUPPORTED_BINARY;
+	}
+}
+
+bool Value_len(const struct starlark_Value v, size_t *out)
+{
+	switch (Value_type(v)) {
+	case STARLARK_TYPE_STRING:
+		*out = Str_len(as_str(v));
+		return true;
+	case STARLARK_TYPE_LIST:
+	case STARLARK_TYPE_TUPLE: {
+		const struct starlark_Value *items = NULL;
+		Value_items(v, &items, out);
+		return true;
+	}
+	case STARLARK_TYPE_DICT:
+		*out = Dict_len((void *)Value_as_object(v));
+		return true;
+	case STARLARK_TYPE_RANGE:
+		*out = Range_len((void *)Value_as_object(v));
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Stores the position in a sequence of len elements which key refers to, where
+// negative keys count from the end.
+static int seq_index(const struct starlark_Value key, const size_t len,
+		     size_t *out)
+{
+	if (Value_type(key) != STARLARK_TYPE_INT) {
+		return STARLARK_ERRORCODE_INVALID_ARG;
+	}
+
+	if (!Value_is_small_int(key)) {
+		return STARLARK_ERRORCODE_INDEX_OUT_OF_RANGE;
+	}
+
+	int64_t i = Value_as_small_int(key);
+	if (i < 0) {
+		i += (int64_t)len;
+	}
+
+	if (i < 0 || (uint64_t)i >= len) {
+		return STARLARK_ERRORCODE_INDEX_OUT_OF_RANGE;
+	}
+
+	*out = (size_t)i;
+	return 0;
+}
+
+int Value_index(const struct starlark_Value x, const struct starlark_Value key,
+		struct starlark_Value *out)
+{
+	size_t len = 0;
+	size_t i = 0;
+	const enum starlark_Type t = Value_type(x);
+	if (t == STARLARK_TYPE_DICT) {
+		struct starlark_Value value = { 0 };
+		int ret = Dict_get((void *)Value_as_object(x), key, &value);
+		if (ret != 0) {
+			return ret;
+		}
+
+		Value_retain(value);
+		*out = value;
+		return 0;
+	}
+
+	if (!Value_len(x, &len)) {
+		return STARLARK_ERRORCODE_NOT_INDEXABLE;
+	}
+
+	int ret = seq_index(key, len, &i);
+	if (ret != 0) {
+		return ret;
+	}
+
+	switch (t) {
+	case STARLARK_TYPE_LIST:
+	case STARLARK_TYPE_TUPLE: {
+		const struct starlark_Value *items = NULL;
+		Value_items(x, &items, &len);
+		Value_retain(items[i]);
+		*out = items[i];
+		return 0;
+	}
+	case STARLARK_TYPE_STRING: {
+		// Like starlark-go, strings are indexed by bytes.
+		struct starlark_Str *s = Str_slice(as_str(x), i, 1);
+		if (s == NULL) {
+			return STARLARK_ERROR_OOM;
+		}
+
+		*out = Value_object((struct starlark_Object *)s);
+		return 0;
+	}
+	case STARLARK_TYPE_RANGE:
+		return Value_from_i64(Range_at((void *)Value_as_object(x), i),
+				      out);
+	default:
+		return STARLARK_ERRORCODE_NOT_INDEXABLE;
+	}
+}
+
+int Value_set_index(const struct starlark_Value x,
+		    const struct starlark_Value key,
+		    const struct starlark_Value v)
+{
+	switch (Value_type(x)) {
+	case STARLARK_TYPE_DICT:
+		return Dict_set((void *)Value_as_object(x), key, v);
+	case STARLARK_TYPE_LIST: {
+		struct starlark_List *l = (void *)Value_as_object(x);
+		if (l->iterators != 0) {
+			return STARLARK_ERRORCODE_MUTATED_DURING_ITERATION;
+		}
+
+		size_t i = 0;
+		int ret = seq_index(key, l->len, &i);
+		if (ret != 0) {
+			return ret;
+		}
+
+		Value_retain(v);
+		Value_release(l->items[i]);
+		l->items[i] = v;
+		return 0;
+	}
+	default:
+		return STARLARK_ERRORCODE_NOT_INDEXABLE;
+	}
+}
+
+// Stores the value of one part of a slice in *out, which is def if the part
+// was left out. Ints too big for 64 bits are clamped, since every sequence is
+// shorter than that.
+static int slice_part(const struct starlark_Value v, const int64_t def,
+		      int64_t *out)
+{
+	if (Value_is_none(v)) {
+		*out = def;
+		return 0;
+	}
+
+	if (Value_type(v) != STARLARK_TYPE_INT) {
+		return STARLARK_ERRORCODE_INVALID_ARG;
+	}
+
+	if (Value_is_small_int(v)) {
+		*out = Value_as_small_int(v);
+	} else {
+		*out = Value_int_cmp(v, Value_small_int(0)) < 0 ? INT60_MIN :
+								  INT60_MAX;
+	}
+
+	return 0;
+}
+
+// Clamps the index i of a sequence of len elements to where a slice with the
+// given step can start or stop, counting negative indices from the end.
+static int64_t slice_clamp(int64_t i, const int64_t len, const int64_t step)
+{
+	if (i < 0) {
+		i += len;
+		if (i < 0) {
+			return step < 0 ? -1 : 0;
+		}
+	}
+
+	if (i >= len) {
+		return step < 0 ? len - 1 : len;
+	}
+
+	return i;
+}
+
+int Value_slice(const struct starlark_Value x, const struct starlark_Value lo,
+		const struct starlark_Value hi, const struct starlark_Value step,
+		struct starlark_Value *out)
+{
+	size_t size = 0;
+	if (Value_type(x) == STARLARK_TYPE_DICT || !Value_len(x, &size)) {
+		return STARLARK_ERRORCODE_NOT_INDEXABLE;
+	}
+
+	const int64_t len = (int64_t)size;
+	int64_t s = 1;
+	int64_t start = 0;
+	int64_t stop = 0;
+	int ret = slice_part(step, 1, &s);
+	if (ret == 0 && s == 0) {
+		ret = STARLARK_ERRORCODE_INVALID_ARG;
+	}
+
+	if (ret == 0) {
+		ret = slice_part(lo, s < 0 ? len - 1 : 0, &start);
+	}
+
+	if (ret == 0) {
+		ret = slice_part(hi, s < 0 ? -len - 1 : len, &stop);
+	}
+
+	if (ret != 0) {
+		return ret;
+	}
+
+	start = slice_clamp(start, len, s);
+	stop = slice_clamp(stop, len, s);
+	size_t n = 0;
+	if (s > 0 && start < stop) {
+		n = (size_t)((stop - start - 1) / s + 1);
+	} else if (s < 0 && start > stop) {
+		n = (size_t)((start - stop - 1) / -s + 1);
+	}
+
+	switch (Value_type(x)) {
+	case STARLARK_TYPE_STRING: {
+		struct starlark_Str *str = as_str(x);
+		if (s == 1) {
+			str = Str_slice(str, (size_t)start, n);
+			if (str == NULL) {
+				return STARLARK_ERROR_OOM;
+			}
+
+			*out = Value_object((struct starlark_Object *)str);
+			return 0;
+		}
+
+		char *bytes = malloc(MAX(n, 1));
+		if (bytes == NULL) {
+			return STARLARK_ERROR_OOM;
+		}
+
+		for (size_t i = 0; i < n; i += 1) {
+			bytes[i] = Str_data(str)[start + (int64_t)i * s];
+		}
+
+		*out = Value_str(n, bytes);
+		free(bytes);
+		return Value_is_none(*out) ? STARLARK_ERROR_OOM : 0;
+	}
+	case STARLARK_TYPE_RANGE: {
+		const struct starlark_Range *r = (void *)Value_as_object(x);
+		const int64_t first = r->start + start * r->step;
+		struct starlark_Range *result = Range_create(
+			first, first + (int64_t)n * s * r->step, s * r->step);
+		if (result == NULL) {
+			return STARLARK_ERROR_OOM;
+		}
+
+		*out = Value_object(&result->obj);
+		return 0;
+	}
+	default:
+		break;
+	}
+
+	const struct starlark_Value *items = NULL;
+	Value_items(x, &items, &size);
+	struct starlark_Value *dst = NULL;
+	struct starlark_Object *o = NULL;
+	if (Value_type(x) == STARLARK_TYPE_LIST) {
+		struct starlark_List *l = List_create(n);
+		if (l == NULL) {
+			return STARLARK_ERROR_OOM;
+		}
+
+		l->len = n;
+		dst = l->items;
+		o = &l->obj;
+	} else {
+		struct starlark_Tuple *t = Tuple_create(n);
+		if (t == NULL) {
+			return STARLARK_ERROR_OOM;
+		}
+
+		dst = t->items;
+		o = &t->obj;
+	}
+
+	for (size_t i = 0; i < n; i += 1) {
+		dst[i] = items[start + (int64_t)i * s];
+		Value_retain(dst[i]);
+	}
+
+	*out = Value_object(o);
+	return 0;
+}
+
+int Value_iterate(const struct starlark_Value v, struct starlark_Value *out)
+{
+	switch (Value_type(v)) {
+	case STARLARK_TYPE_LIST:
+	case STARLARK_TYPE_TUPLE:
+	case STARLARK_TYPE_RANGE:
+	case STARLARK_TYPE_DICT: {
+		struct starlark_Iterator *it = Iterator_create(v);
+		if (it == NULL) {
+			return STARLARK_ERROR_OOM;
+		}
+
+		*out = Value_object(&it->obj);
+		return 0;
+	}
+	default:
+		return STARLARK_ERRORCODE_NOT_ITERABLE;
+	}
+}
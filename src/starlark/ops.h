@@ -0,0 +1,74 @@
+#ifndef STARLARK_OPS_H
+#define STARLARK_OPS_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "starlark/common.h"
+#include "starlark/parse.h"
+#include "starlark/value.h"
+
+// The semantics of starlark's operators, which don't depend on the interpreter
+// running them, so that the compiler can use them too.
+//
+// Every value passed in is borrowed. Each function returns 0 on success,
+// STARLARK_ERROR_OOM if we couldn't allocate enough memory, or a positive
+// starlark_ErrorCode if starlark doesn't allow the operation, such as adding an
+// int to a string. *out is only written on success, and the caller owns the
+// value stored there.
+
+// Returns how op is written in the source, such as "+" or "not in".
+const char *Op_symbol(const enum starlark_Op op);
+
+// Computes a op b, where op is a binary operator other than and and or.
+int Value_binary(const enum starlark_Op op, const struct starlark_Value a,
+		 const struct starlark_Value b, struct starlark_Value *out);
+
+// Computes *a + b like Value_binary, but takes over the caller's reference to
+// the value in *a, so that a string which nothing else refers to can be
+// extended in place rather than copied. Afterwards the caller owns whatever *a
+// holds, which is None once its reference has been taken. That happens on
+// success, and when adding two strings runs out of memory.
+int Value_add_move(struct starlark_Value *a, const struct starlark_Value b,
+		   struct starlark_Value *out);
+
+// Computes op a, where op is STARLARK_OP_ADD for +, STARLARK_OP_SUB for -,
+// STARLARK_OP_BITNOT or STARLARK_OP_NOT.
+int Value_unary(const enum starlark_Op op, const struct starlark_Value a,
+		struct starlark_Value *out);
+
+// Stores a negative number in *out if a < b, 0 if a == b and a positive number
+// if a > b.
+int Value_compare(const struct starlark_Value a, const struct starlark_Value b,
+		  int *out);
+
+// Stores whether x is in container in *out.
+int Value_contains(const struct starlark_Value container,
+		   const struct starlark_Value x, bool *out);
+
+// Stores the number of elements of v in *out.
+// Returns false if v doesn't have a length.
+bool Value_len(const struct starlark_Value v, size_t *out);
+
+// Computes x[key].
+int Value_index(const struct starlark_Value x, const struct starlark_Value key,
+		struct starlark_Value *out);
+
+// Sets x[key] to v, which x adds its own reference to.
+int Value_set_index(const struct starlark_Value x,
+		    const struct starlark_Value key,
+		    const struct starlark_Value v);
+
+// Computes x[lo:hi:step], where None stands for a part which was left out.
+int Value_slice(const struct starlark_Value x, const struct starlark_Value lo,
+		const struct starlark_Value hi, const struct starlark_Value step,
+		struct starlark_Value *out);
+
+// Stores a new iterator over v in *out.
+int Value_iterate(const struct starlark_Value v, struct starlark_Value *out);
+
+// Converts the int or float v to a double, which is rounded if v is an int
+// which doesn't fit exactly.
+int Value_to_double(const struct starlark_Value v, double *out);
+
+#endif // STARLARK_OPS_H
@@ -12,6 +12,7 @@
 #include "starlark/common.h"
 #include "starlark/lex.h"
 #include "starlark/parse.h"
+#include "starlark/scratch.h"
 #include "starlark/util.h"
 #include "starlark/int.h"
 #include "starlark/strpool.h"
@@ -44,73 +45,166 @@ static uint8_t char_tohex(const uint8_t c)
 	}
 }
 
-static void end_parse(struct starlark_Parser *p)
-{
-	p->idx = p->l->toks_len - 1;
-}
-
-// Returns the index of the ast node or -1 on error.
-static void new_node_with_value(struct starlark_Parser *p,
-				const enum starlark_AstTag tag,
-				const union starlark_AstNode node)
+// Adds a node to the ast, which starts at the given position in the source.
+// Returns the index of the node, or STARLARK_NODE_NONE if we couldn't allocate
+// enough memory.
+static uint32_t new_node_with_value(struct starlark_Parser *p,
+				    const enum starlark_AstTag tag,
+				    const size_t start,
+				    const union starlark_AstNode node)
 {
 	assert(p != NULL);
 	if (p->ctx->err) {
-		return;
+		return STARLARK_NODE_NONE;
 	}
 
 	if (p->ast_len + 1 >= p->ast_cap) {
-		// TODO: check for overflow
+		// Node indices are 32 bits, and STARLARK_NODE_NONE is never a
+		// valid index.
+		if (p->ast_cap >= STARLARK_NODE_NONE / 2) {
+			p->ctx->err = STARLARK_ERROR_TOOBIG;
+			return STARLARK_NODE_NONE;
+		}
+
 		const size_t cap = (p->ast_cap + 16) * 1.5;
+		// The arrays after the first one move when the capacity
+		// changes, so remember where they were.
+		const size_t old_cap = p->ast_cap;
+		size_t old_idxs = 0;
+		size_t old_starts = 0;
+		size_t old_nodes = 0;
+		if (old_cap != 0) {
+			old_idxs = (uint8_t *)p->ast.idxs - (uint8_t *)p->ast.tags;
+			old_starts =
+				(uint8_t *)p->ast.starts - (uint8_t *)p->ast.tags;
+			old_nodes =
+				(uint8_t *)p->ast.nodes - (uint8_t *)p->ast.tags;
+		}
+
 		size_t tags_len = cap * sizeof(p->ast.tags[0]);
 		size_t idxs_len = cap * sizeof(p->ast.idxs[0]);
+		size_t starts_len = cap * sizeof(p->ast.starts[0]);
 		size_t nodes_len = cap * sizeof(p->ast.nodes[0]);
 		uint8_t *ptr = realloc(p->ast.tags,
-				       tags_len + idxs_len + nodes_len +
+				       tags_len + idxs_len + starts_len +
+					       nodes_len +
 					       alignof(enum starlark_AstTag) +
-					       alignof(size_t) +
+					       alignof(size_t) + alignof(size_t) +
 					       alignof(union starlark_AstNode));
 		if (ptr == NULL) {
 			p->ctx->err = STARLARK_ERROR_OOM;
-			return;
+			return STARLARK_NODE_NONE;
 		}
 
 		p->ast.tags = (void *)ptr;
 		p->ast.idxs = (void *)ALIGN_UP(ptr + tags_len, alignof(size_t));
+		p->ast.starts = (void *)ALIGN_UP(ptr + tags_len + idxs_len,
+						 alignof(size_t));
 		p->ast.nodes =
-			(void *)ALIGN_UP(ptr + tags_len + idxs_len,
+			(void *)ALIGN_UP(ptr + tags_len + idxs_len + starts_len,
 					 alignof(union starlark_AstNode));
+		if (old_cap != 0) {
+			memmove(p->ast.nodes, ptr + old_nodes,
+				old_cap * sizeof(p->ast.nodes[0]));
+			memmove(p->ast.starts, ptr + old_starts,
+				old_cap * sizeof(p->ast.starts[0]));
+			memmove(p->ast.idxs, ptr + old_idxs,
+				old_cap * sizeof(p->ast.idxs[0]));
+		}
 		p->ast_cap = cap;
 	}
 
-	p->ast.tags[p->ast_len] = tag;
-	p->ast.idxs[p->ast_len] = p->ast_len;
-	p->ast.nodes[p->ast_len] = node;
+	const uint32_t result = p->ast_len;
+	p->ast.tags[result] = tag;
+	p->ast.idxs[result] = result;
+	p->ast.starts[result] = start;
+	p->ast.nodes[result] = node;
 	p->ast_len += 1;
+	return result;
 }
 
 // TODO: eventually have a different length and capacity for the nodes, since
 // not every AST node has a value. Currently we allocate enough room for a node
 // regardless of whether the node we're adding has a value.
-static void new_node(struct starlark_Parser *in, const enum starlark_AstTag tag)
+static uint32_t new_node(struct starlark_Parser *in,
+			 const enum starlark_AstTag tag, const size_t start)
+{
+	return new_node_with_value(in, tag, start, (union starlark_AstNode){ 0 });
+}
+
+// Makes sure there's room for one more element in an array of 32-bit node
+// indices.
+// Returns false if we couldn't allocate enough memory.
+static bool ensure_index(struct starlark_Parser *p, const size_t len,
+			 size_t *cap, uint32_t **ptr)
+{
+	if (len < *cap) {
+		return true;
+	}
+
+	if (*cap >= STARLARK_NODE_NONE / 2) {
+		p->ctx->err = STARLARK_ERROR_TOOBIG;
+		return false;
+	}
+
+	const size_t new_cap = (*cap + 16) * 2;
+	uint32_t *new_ptr = realloc(*ptr, new_cap * sizeof(uint32_t));
+	if (new_ptr == NULL) {
+		p->ctx->err = STARLARK_ERROR_OOM;
+		return false;
+	}
+
+	*ptr = new_ptr;
+	*cap = new_cap;
+	return true;
+}
+
+// Pushes a child whose parent hasn't been parsed yet.
+static void scratch_push(struct starlark_Parser *p, const uint32_t node)
 {
-	new_node_with_value(in, tag, (union starlark_AstNode){ 0 });
+	if (p->ctx->err ||
+	    !ensure_index(p, p->scratch_len, &p->scratch_cap, &p->scratch)) {
+		return;
+	}
+
+	p->scratch[p->scratch_len] = node;
+	p->scratch_len += 1;
 }
 
-// Returns the string of the token at in->idx + 1
-static char *quoted_token_string(struct starlark_Parser *in)
+// Moves the children pushed since the scratch array had length from into the
+// extra array, where they belong to a node.
+// Returns where they start in the extra array.
+static uint32_t scratch_pop(struct starlark_Parser *p, const size_t from)
 {
-	size_t i = in->idx + 1;
-	int len = in->l->toks.ends[i] - in->l->toks.starts[i];
-	char *result =
-		format("'%.*s'", len, &in->ctx->src[in->l->toks.starts[i]]);
-	if (result == NULL) {
-		panic("format null");
+	assert(from <= p->scratch_len);
+
+	const uint32_t result = p->extra_len;
+	for (size_t i = from; i < p->scratch_len; i += 1) {
+		if (p->ctx->err || !ensure_index(p, p->extra_len,
+						 &p->extra_cap, &p->extra)) {
+			break;
+		}
+
+		p->extra[p->extra_len] = p->scratch[i];
+		p->extra_len += 1;
 	}
 
+	p->scratch_len = from;
 	return result;
 }
 
+// Adds a node with the children pushed since the scratch array had length
+// from, which is stored in its as_list.
+static uint32_t new_list_node(struct starlark_Parser *p,
+			      const enum starlark_AstTag tag,
+			      const size_t start, const size_t from)
+{
+	union starlark_AstNode node = { 0 };
+	node.as_list.len = p->scratch_len - from;
+	node.as_list.start = scratch_pop(p, from);
+	return new_node_with_value(p, tag, start, node);
+}
+
 static char *token_string(struct starlark_Parser *p)
 {
 	size_t i = p->idx + 1;
@@ -120,17 +214,202 @@ static char *token_string(struct starlark_Parser *p)
 	return result;
 }
 
+// Skips the newlines and comments inside brackets, which don't end a
+// statement.
+static void skip_ignored(struct starlark_Parser *p)
+{
+	if (p->depth == 0) {
+		return;
+	}
+
+	while (p->idx + 1 < p->l->toks_len) {
+		const enum starlark_TokenTag tag = p->l->toks.tags[p->idx + 1];
+		if (tag != STARLARK_TOKEN_NEWLINE &&
+		    tag != STARLARK_TOKEN_COMMENT) {
+			break;
+		}
+
+		p->idx += 1;
+	}
+}
+
+static bool at_eof(struct starlark_Parser *p)
+{
+	skip_ignored(p);
+	return p->idx + 1 >= p->l->toks_len;
+}
+
+// Returns the tag of the next token. A comment always runs until the end of
+// its line, so it ends a statement just like a newline does. The end of the
+// file looks like a newline too.
 static enum starlark_TokenTag peek_tag(struct starlark_Parser *in)
 {
-	return in->l->toks.tags[in->idx + 1];
+	if (at_eof(in)) {
+		return STARLARK_TOKEN_NEWLINE;
+	}
+
+	const enum starlark_TokenTag result = in->l->toks.tags[in->idx + 1];
+	if (result == STARLARK_TOKEN_COMMENT) {
+		return STARLARK_TOKEN_NEWLINE;
+	}
+
+	return result;
 }
 
 static size_t peek_start(struct starlark_Parser *in)
 {
+	if (at_eof(in)) {
+		return in->ctx->src_len;
+	}
+
 	return in->l->toks.starts[in->idx + 1];
 }
 
-// returns the number of digits were valid.
+static size_t peek_len(struct starlark_Parser *in)
+{
+	if (at_eof(in)) {
+		return 0;
+	}
+
+	return in->l->toks.ends[in->idx + 1] - in->l->toks.starts[in->idx + 1];
+}
+
+static void advance(struct starlark_Parser *p)
+{
+	if (!at_eof(p)) {
+		p->idx += 1;
+	}
+}
+
+// Returns true if the next token is the keyword given.
+static bool peek_keyword(struct starlark_Parser *p, const char *keyword)
+{
+	if (peek_tag(p) != STARLARK_TOKEN_IDENT_OR_KEYWORD) {
+		return false;
+	}
+
+	const size_t len = strlen(keyword);
+	return peek_len(p) == len &&
+	       memcmp(&p->ctx->src[peek_start(p)], keyword, len) == 0;
+}
+
+// Returns the tag of the token after the next one, ignoring newlines inside
+// brackets.
+static enum starlark_TokenTag peek2_tag(struct starlark_Parser *p)
+{
+	skip_ignored(p);
+	size_t i = p->idx + 2;
+	while (p->depth != 0 && i < p->l->toks_len &&
+	       (p->l->toks.tags[i] == STARLARK_TOKEN_NEWLINE ||
+		p->l->toks.tags[i] == STARLARK_TOKEN_COMMENT)) {
+		i += 1;
+	}
+
+	if (i >= p->l->toks_len) {
+		return STARLARK_TOKEN_NEWLINE;
+	}
+
+	return p->l->toks.tags[i];
+}
+
+// Returns the column the next token starts at, which is its indentation if
+// it's the first on its line.
+static size_t peek_column(struct starlark_Parser *p)
+{
+	const size_t start = peek_start(p);
+	size_t line = start;
+	while (line > 0 && p->ctx->src[line - 1] != UTF8_NEWLINE) {
+		line -= 1;
+	}
+
+	return start - line;
+}
+
+// Reports a syntax error at the next token, unless one has already been
+// reported in this statement.
+// Returns an error node.
+static uint32_t syntax_error(struct starlark_Parser *p,
+			     enum starlark_ErrorCode code)
+{
+	const size_t start = peek_start(p);
+	if (!p->recovering && !p->ctx->err) {
+		if (at_eof(p)) {
+			code = STARLARK_ERRORCODE_UNEXPECTED_EOF;
+		} else if (code == STARLARK_ERRORCODE_UNEXPECTED_TOKEN &&
+			   peek_tag(p) == STARLARK_TOKEN_NEWLINE) {
+			code = STARLARK_ERRORCODE_UNEXPECTED_NEWLINE;
+		}
+
+		struct starlark_Error err = {
+			.code = code,
+			.start = start,
+			.arg.span.start = start,
+			.arg.span.len = peek_len(p),
+		};
+		if (!err_append(p->ctx, err)) {
+			p->ctx->err = STARLARK_ERROR_OOM;
+		}
+	}
+
+	p->recovering = true;
+	return new_node(p, STARLARK_NODE_ERROR, start);
+}
+
+// Reports a syntax error about the node given.
+static void node_error(struct starlark_Parser *p,
+		       const enum starlark_ErrorCode code, const uint32_t node,
+		       const size_t len)
+{
+	if (p->recovering || p->ctx->err || node == STARLARK_NODE_NONE) {
+		return;
+	}
+
+	struct starlark_Error err = {
+		.code = code,
+		.start = p->ast.starts[node],
+		.arg.span.start = p->ast.starts[node],
+		.arg.span.len = len,
+	};
+	if (!err_append(p->ctx, err)) {
+		p->ctx->err = STARLARK_ERROR_OOM;
+	}
+
+	p->recovering = true;
+}
+
+// Consumes the next token if it has the tag given, and reports an error
+// otherwise.
+// Returns false if the token wasn't there.
+static bool expect(struct starlark_Parser *p, const enum starlark_TokenTag tag)
+{
+	if (peek_tag(p) != tag) {
+		(void)syntax_error(p, STARLARK_ERRORCODE_UNEXPECTED_TOKEN);
+		return false;
+	}
+
+	advance(p);
+	return true;
+}
+
+// Consumes the keyword given, or reports an error if it isn't next.
+static bool expect_keyword(struct starlark_Parser *p, const char *keyword)
+{
+	if (!peek_keyword(p, keyword)) {
+		(void)syntax_error(p, STARLARK_ERRORCODE_UNEXPECTED_TOKEN);
+		return false;
+	}
+
+	advance(p);
+	return true;
+}
+
+// Whether parsing should stop, either because an error was found in this
+// statement or because we ran out of memory.
+static bool failed(struct starlark_Parser *p)
+{
+	return p->recovering || p->ctx->err != 0;
+}
+
 size_t check_number_string_run(const char *str, const int base)
 {
 	size_t result = 0;
@@ -161,342 +440,188 @@ size_t check_number_string_run(const char *str, const int base)
 	return result;
 }
 
-#define SINGLE_CHARACTER_ESCAPE(escape_char, output)                   \
-	if (escape == (escape_char)) {                                 \
-		str[i] = (output);                                     \
-		char *ptr = &str[i + 1];                               \
-		memmove(ptr, ptr + 1, (result.len - (i + 1)) - 1 + 1); \
-		result.len -= 1;                                       \
-		continue;                                              \
-	}                                                              \
-	(void)escape
+// Records an invalid escape sequence in a string literal, at offset i of the
+// token.
+static void escape_error(struct starlark_Parser *p,
+			 const enum starlark_ErrorCode code, const size_t i,
+			 const uint8_t escape)
+{
+	struct starlark_Error err = {
+		.code = code,
+		.start = peek_start(p) + i,
+	};
+
+	err.arg.c = escape;
+	if (!err_append(p->ctx, err)) {
+		p->ctx->err = STARLARK_ERROR_OOM;
+	}
+}
+
+// Returns the value of the count hex digits starting at str, or UINT32_MAX if
+// any of them isn't a hex digit.
+static uint32_t parse_hex_digits(const char *str, const size_t count)
+{
+	uint32_t result = 0;
+	for (size_t i = 0; i < count; i += 1) {
+		if (!is_hexdigit(str[i])) {
+			return UINT32_MAX;
+		}
+
+		result = result * 16 + char_tohex(str[i]);
+	}
+
+	return result;
+}
+
+// The escapes which stand for a single character, and the character each one
+// stands for.
+static const char single_escapes[] = u8"abfnrtv\\\"'";
+static const char single_values[] = "\a\b\f\n\r\t\v\\\"'";
 
-// TODO: evaluate escape sequences
+// Removes the prefix and quotes from str, which is the text of the string
+// token being parsed, and evaluates its escape sequences in place.
+// Returns a string with a NULL ptr if the string has an invalid escape, which
+// has been reported.
 static struct starlark_String parse_string_escapes(struct starlark_Parser *p,
 						   char *str)
 {
 	struct starlark_String result = {
 		.ptr = str,
-		.len = strlen(str),
 	};
 
-	// First decide if it's a byte string, raw string, both, or none.
-	bool bytes = false;
+	const size_t len = strlen(str);
+	size_t i = 0;
 	bool raw = false;
-
-	char *ptr = str;
-	while (starlark_isalpha(ptr[0])) {
-		if (ptr[0] == u8"b"[0]) {
-			bytes = true;
-			memmove(ptr, ptr + 1, strlen(ptr));
-			ptr += 1;
-			result.len -= 1;
-			continue;
-		}
-
-		if (ptr[0] == u8"r"[0]) {
-			raw = true;
-			memmove(ptr, ptr + 1, strlen(ptr));
-			ptr += 1;
-			result.len -= 1;
-			continue;
-		}
-
-		panic("unrecognized string prefix: %c", ptr[0]);
-	}
-
-	// Then remove the quotes at the beginning and end.
-	uint8_t quote_char = str[0];
-	ptr = str;
-	while (ptr[0] == quote_char) {
-		memmove(ptr, ptr + 1, strlen(ptr));
-		result.len -= 1;
+	while (str[i] == u8"b"[0] || str[i] == u8"r"[0]) {
+		raw = raw || str[i] == u8"r"[0];
+		i += 1;
 	}
 
-	ptr = &str[result.len - 1];
-	while (ptr[0] == quote_char) {
-		ptr[0] = '\0';
-		result.len -= 1;
-		ptr -= 1;
+	// The lexer only makes string tokens which are properly closed, so
+	// the same quotes are at both ends.
+	const char quote = str[i];
+	size_t quotes = 1;
+	if (len - i >= 6 && str[i + 1] == quote && str[i + 2] == quote) {
+		quotes = 3;
 	}
 
-	// Finally, evaluate escape sequences
+	const size_t end = len - quotes;
+	i += quotes;
 
-	if (raw) {
-		goto finished_escape_sequences;
-	}
-	for (size_t i = 0; i < result.len; i += 1) {
+	// Every escape sequence is at least as long as what it stands for, so
+	// the result can be written over the text it's read from.
+	size_t out = 0;
+	while (i < end) {
 		if (str[i] != u8"\\"[0]) {
+			str[out] = str[i];
+			out += 1;
+			i += 1;
 			continue;
 		}
 
-		uint8_t escape = result.ptr[i + 1];
-		printf("escape = '%c'\n", escape);
-
-		SINGLE_CHARACTER_ESCAPE(u8"a"[0], 0x07);
-		SINGLE_CHARACTER_ESCAPE(u8"b"[0], 0x08);
-		SINGLE_CHARACTER_ESCAPE(u8"f"[0], 0x0c);
-		SINGLE_CHARACTER_ESCAPE(u8"n"[0], 0x0a);
-		SINGLE_CHARACTER_ESCAPE(u8"r"[0], 0x0d);
-		SINGLE_CHARACTER_ESCAPE(u8"t"[0], 0x09);
-		SINGLE_CHARACTER_ESCAPE(u8"v"[0], 0x0b);
-		SINGLE_CHARACTER_ESCAPE(u8"\\"[0], UTF8_BACKSLASH);
-		SINGLE_CHARACTER_ESCAPE(u8"\""[0], UTF8_DOUBLEQUOTE);
-		SINGLE_CHARACTER_ESCAPE(u8"'"[0], UTF8_SINGLEQUOTE);
-
-		if (starlark_isdigit(escape)) {
-			puts("octal escape");
-			// octal escape
-			uint8_t value = 0;
-			size_t j = 0;
-			for (; j < 3 && i + 1 + j < result.len; j += 1) {
-				if (!starlark_isdigit(str[i + 1 + j])) {
-					break;
-				}
-
-				if (str[i + 1 + j] >= u8"8"[0]) {
-					struct starlark_Error err = {
-						.code = STARLARK_ERRORCODE_INVALID_ESCAPE,
-						.start = p->idx + i,
-					};
-
-					err.msg = format("'%c'", escape);
-					if (err.msg == NULL ||
-					    !err_append(p->ctx, err)) {
-						p->ctx->err =
-							STARLARK_ERROR_OOM;
-						return result;
-					}
+		// A backslash in a raw string is kept, along with whatever it
+		// escapes, such as a quote which would have ended the string.
+		if (raw) {
+			const size_t n = MIN(2, end - i);
+			memmove(&str[out], &str[i], n);
+			out += n;
+			i += n;
+			continue;
+		}
 
-					result.ptr = NULL;
-					return result;
-				}
+		const uint8_t escape = i + 1 < end ? str[i + 1] : 0;
+		const char *single = NULL;
+		if (escape != 0) {
+			single = strchr(single_escapes, escape);
+		}
 
-				value +=
-					(str[i + 1 + j] - u8"0"[0]) * pow(8, j);
-			}
+		if (single != NULL) {
+			str[out] = single_values[single - single_escapes];
+			out += 1;
+			i += 2;
+			continue;
+		}
 
-			str[i] = value;
-			char *ptr = &str[i + 1];
-			memmove(ptr, ptr + j, (result.len - (i + 1)) - j + 1);
-			result.len -= j;
+		// An escaped newline is left out entirely.
+		if (escape == UTF8_NEWLINE) {
+			i += 2;
 			continue;
 		}
 
-		if (escape == u8"x"[0]) {
-			puts("hex escape");
-			// hex escape
-			if (i + 3 >= result.len ||
-			    !is_hexdigit(result.ptr[i + 2]) ||
-			    !is_hexdigit(result.ptr[i + 3])) {
-				struct starlark_Error err = {
-					.code = STARLARK_ERRORCODE_INVALID_ESCAPE,
-					.start = p->idx + i,
-				};
-
-				err.msg = format("'%c'", escape);
-				if (err.msg == NULL ||
-				    !err_append(p->ctx, err)) {
-					p->ctx->err = STARLARK_ERROR_OOM;
-					result.ptr = NULL;
-					return result;
+		if (escape >= u8"0"[0] && escape <= u8"7"[0]) {
+			// Up to three octal digits.
+			uint32_t value = 0;
+			size_t j = 1;
+			for (; j <= 3 && i + j < end; j += 1) {
+				const char digit = str[i + j];
+				if (digit < u8"0"[0] || digit > u8"7"[0]) {
+					break;
 				}
 
-				result.ptr = NULL;
-				return result;
+				value = value * 8 + (digit - u8"0"[0]);
 			}
 
-			char *endptr = NULL;
-			errno = 0;
-			str[i] = strtoul(&str[i + 2], &endptr, 16) & 0xff;
-			if (errno != 0) {
-				struct starlark_Error err = {
-					.code = STARLARK_ERRORCODE_INVALID_ESCAPE,
-					.start = p->idx + i,
-				};
-
-				err.msg = format("'%c'", escape);
-				if (err.msg == NULL ||
-				    !err_append(p->ctx, err)) {
-					p->ctx->err = STARLARK_ERROR_OOM;
-					result.ptr = NULL;
-					return result;
-				}
-
+			if (value > 0xff) {
+				escape_error(p, STARLARK_ERRORCODE_INVALID_ESCAPE,
+					     i, escape);
 				result.ptr = NULL;
 				return result;
 			}
 
-			char *ptr = &str[i + 1];
-			memmove(ptr, ptr + 3, (result.len - (i + 1)) - 3 + 1);
-			result.len -= 3;
+			str[out] = (char)value;
+			out += 1;
+			i += j;
 			continue;
 		}
 
-		if (escape == u8"U"[0]) {
-			puts("big u");
-			// big unicode escape
-			if (i + 9 >= result.len ||
-			    !is_hexdigit(result.ptr[i + 2]) ||
-			    !is_hexdigit(result.ptr[i + 3]) ||
-			    !is_hexdigit(result.ptr[i + 4]) ||
-			    !is_hexdigit(result.ptr[i + 5]) ||
-			    !is_hexdigit(result.ptr[i + 6]) ||
-			    !is_hexdigit(result.ptr[i + 7]) ||
-			    !is_hexdigit(result.ptr[i + 8]) ||
-			    !is_hexdigit(result.ptr[i + 9])) {
-				puts("err");
-				struct starlark_Error err = {
-					.code = STARLARK_ERRORCODE_INVALID_ESCAPE,
-					.start = p->idx + i,
-				};
-
-				err.msg = format(
-					"unicode escape must be in the form "
-					"\\uXXXX or \\UXXXXXXXX, where the Xs "
-					"are a valid Unicode codepoint");
-				if (err.msg == NULL ||
-				    !err_append(p->ctx, err)) {
-					p->ctx->err = STARLARK_ERROR_OOM;
-					result.ptr = NULL;
-					return result;
-				}
-
-				result.ptr = NULL;
-				return result;
-			}
-
-			char *tmp = format("%.*s", 8, &str[i + 2]);
-			char *endptr = NULL;
-			errno = 0;
-			uint32_t codepoint = strtoull(tmp, &endptr, 16);
-			free(tmp);
-			if (errno != 0 || !utf8_codepoint_valid(codepoint)) {
-				struct starlark_Error err = {
-					.code = STARLARK_ERRORCODE_INVALID_ESCAPE,
-					.start = p->idx + i,
-				};
-
-				err.msg = format(
-					"unicode escape must be in the form "
-					"\\uXXXX or \\UXXXXXXXX, where the Xs "
-					"are a valid Unicode codepoint");
-				if (err.msg == NULL ||
-				    !err_append(p->ctx, err)) {
-					p->ctx->err = STARLARK_ERROR_OOM;
-					result.ptr = NULL;
-					return result;
-				}
-
+		if (escape == u8"x"[0]) {
+			const uint32_t value = end - i >= 4 ?
+						       parse_hex_digits(&str[i + 2], 2) :
+						       UINT32_MAX;
+			if (value == UINT32_MAX) {
+				escape_error(p, STARLARK_ERRORCODE_INVALID_ESCAPE,
+					     i, escape);
 				result.ptr = NULL;
 				return result;
 			}
 
-			utf8_codepoint_encode(codepoint, result.len - i,
-					      (uint8_t *)&str[i]);
-
-			size_t len = utf8_codepoint_size(codepoint);
-			size_t size_to_remove = 10 - len;
-			char *ptr = &str[i + len + 1];
-			memmove(ptr, ptr + size_to_remove,
-				(result.len - (i + 1)) - size_to_remove + 1);
-			result.len -= size_to_remove;
-			printf("next: %c\n", str[i]);
+			str[out] = (char)value;
+			out += 1;
+			i += 4;
 			continue;
 		}
 
-		if (escape == u8"u"[0]) {
-			puts("small u");
-			// small unicode escape
-			if (i + 5 >= result.len ||
-			    !is_hexdigit(result.ptr[i + 2]) ||
-			    !is_hexdigit(result.ptr[i + 3]) ||
-			    !is_hexdigit(result.ptr[i + 4]) ||
-			    !is_hexdigit(result.ptr[i + 5])) {
-				struct starlark_Error err = {
-					.code = STARLARK_ERRORCODE_INVALID_ESCAPE,
-					.start = p->idx + i,
-				};
-
-				err.msg = format(
-					"unicode escape must be in the form "
-					"\\uXXXX or \\UXXXXXXXX, where the Xs "
-					"are a valid Unicode codepoint");
-				if (err.msg == NULL ||
-				    !err_append(p->ctx, err)) {
-					p->ctx->err = STARLARK_ERROR_OOM;
-					result.ptr = NULL;
-					return result;
-				}
-
-				result.ptr = NULL;
-				return result;
+		if (escape == u8"u"[0] || escape == u8"U"[0]) {
+			const size_t digits = escape == u8"u"[0] ? 4 : 8;
+			uint32_t codepoint = UINT32_MAX;
+			if (end - i >= 2 + digits) {
+				codepoint = parse_hex_digits(&str[i + 2], digits);
 			}
 
-			char *tmp = format("%.*s", 4, &str[i + 2]);
-			char *endptr = NULL;
-			errno = 0;
-			uint32_t codepoint = strtoull(tmp, &endptr, 16);
-			free(tmp);
-			if (errno != 0 || !utf8_codepoint_valid(codepoint)) {
-				struct starlark_Error err = {
-					.code = STARLARK_ERRORCODE_INVALID_ESCAPE,
-					.start = p->idx + i,
-				};
-
-				err.msg = format(
-					"unicode escape must be in the form "
-					"\\uXXXX or \\UXXXXXXXX, where the Xs "
-					"are a valid Unicode codepoint");
-				if (err.msg == NULL ||
-				    !err_append(p->ctx, err)) {
-					p->ctx->err = STARLARK_ERROR_OOM;
-					result.ptr = NULL;
-					return result;
-				}
-
+			if (codepoint == UINT32_MAX ||
+			    !utf8_codepoint_valid(codepoint)) {
+				escape_error(
+					p,
+					STARLARK_ERRORCODE_INVALID_UNICODE_ESCAPE,
+					i, escape);
 				result.ptr = NULL;
 				return result;
 			}
 
-			utf8_codepoint_encode(codepoint, result.len - i,
-					      (uint8_t *)&str[i]);
-
-			size_t len = utf8_codepoint_size(codepoint);
-			size_t size_to_remove = 6 - len;
-			char *ptr = &str[i + len + 1];
-			memmove(ptr, ptr + size_to_remove,
-				(result.len - (i + 1)) - size_to_remove + 1);
-			result.len -= size_to_remove;
-			continue;
-		}
-
-		if (escape == UTF8_NEWLINE) {
-			// escaped newline
-			char *ptr = &str[i];
-			memmove(ptr, ptr + 2, (result.len - (i + 1)) - 2 + 1);
-			result.len -= 2;
-			i -= 1;
+			utf8_codepoint_encode(codepoint, 2 + digits,
+					      (uint8_t *)&str[out]);
+			out += utf8_codepoint_size(codepoint);
+			i += 2 + digits;
 			continue;
 		}
 
-		struct starlark_Error err = {
-			.code = STARLARK_ERRORCODE_INVALID_ESCAPE,
-			.start = p->idx + i,
-		};
-
-		err.msg = format("'%c'", escape);
-		if (err.msg == NULL || !err_append(p->ctx, err)) {
-			p->ctx->err = STARLARK_ERROR_OOM;
-			result.ptr = NULL;
-			return result;
-		}
-
+		escape_error(p, STARLARK_ERRORCODE_INVALID_ESCAPE, i, escape);
 		result.ptr = NULL;
 		return result;
 	}
-finished_escape_sequences:
 
+	str[out] = '\0';
+	result.len = out;
 	return result;
 }
 
@@ -520,10 +645,13 @@ static double parse_float(struct starlark_Parser *in, char *str)
 			code = STARLARK_ERRORCODE_FLOAT_TOO_BIG;
 		}
 
+		size_t i = in->idx + 1;
 		struct starlark_Error err = {
 			.code = code,
-			.msg = token_string(in),
 			.start = in->l->toks.starts[in->idx],
+			.arg.span.start = in->l->toks.starts[i],
+			.arg.span.len =
+				in->l->toks.ends[i] - in->l->toks.starts[i],
 		};
 
 		if (!err_append(in->ctx, err)) {
@@ -543,7 +671,7 @@ static struct starlark_Int *parse_int(struct starlark_Parser *in, char *str)
 
 	int base = 10;
 
-	if (strncmp(ptr, u8"0x", 2) == 0 || strncmp(ptr, u8"0x", 2) == 0) {
+	if (strncmp(ptr, u8"0x", 2) == 0 || strncmp(ptr, u8"0X", 2) == 0) {
 		base = 16;
 		str += 2;
 		ptr = str;
@@ -565,107 +693,1354 @@ static struct starlark_Int *parse_int(struct starlark_Parser *in, char *str)
 		      "in parse_operand");
 	}
 
-	struct starlark_Int *result = Int_from_str(str, base);
-	if (result == NULL) {
-		in->ctx->err = STARLARK_ERROR_OOM;
+	struct starlark_Int *result = NULL;
+	const int ret = Int_from_str(str, base, &result);
+	if (ret == STARLARK_ERRORCODE_INT_INVALID) {
+		size_t i = in->idx + 1;
+		struct starlark_Error err = {
+			.code = STARLARK_ERRORCODE_INT_INVALID,
+			.start = in->l->toks.starts[i],
+			.arg.span.start = in->l->toks.starts[i],
+			.arg.span.len =
+				in->l->toks.ends[i] - in->l->toks.starts[i],
+		};
+
+		if (!err_append(in->ctx, err)) {
+			in->ctx->err = STARLARK_ERROR_OOM;
+		}
+
+		return NULL;
+	}
+
+	if (ret != 0) {
+		in->ctx->err = ret;
 		return NULL;
 	}
 
 	return result;
 }
 
-// Operand = identifier
-//         | int | float | string | bytes
-//         | ListExpr | ListComp
-//         | DictExpr | DictComp
-//         | '(' [Expression [',']] ')'
-//         .
-// returns true
-static void parse_operand(struct starlark_Parser *in)
-{
-	if (in->ctx->err != 0) {
-		return;
-	}
 
-	union starlark_AstNode node = { 0 };
-	switch (peek_tag(in)) {
-	case STARLARK_TOKEN_IDENT_OR_KEYWORD:
-		node.as_identifier.str = token_string(in);
-		new_node_with_value(in, STARLARK_NODE_IDENTIFIER, node);
-		in->idx += 1;
-		break;
-	case STARLARK_TOKEN_NUMBER: {
-		char *str = token_string(in);
-		if (strchr(str, u8"."[0]) != NULL ||
-		    ((strncmp(str, u8"0x", 2) != 0 &&
-		      strncmp(str, u8"0X", 2) != 0) &&
-		     strpbrk(str, u8"eE") != NULL)) {
-			node.as_float = parse_float(in, str);
-			new_node_with_value(in, STARLARK_NODE_FLOAT, node);
-			free(str);
-			in->idx += 1;
-			break;
-		}
+// Keywords, and words reserved for future use, none of which can be used as a
+// name.
+static const char *const keywords[] = {
+	u8"and",    u8"as",	  u8"assert", u8"async",    u8"await",
+	u8"break",  u8"class",	  u8"continue", u8"def",    u8"del",
+	u8"elif",   u8"else",	  u8"except", u8"finally",  u8"for",
+	u8"from",   u8"global",	  u8"if",     u8"import",   u8"in",
+	u8"is",	    u8"lambda",	  u8"load",   u8"nonlocal", u8"not",
+	u8"or",	    u8"pass",	  u8"raise",  u8"return",   u8"try",
+	u8"while",  u8"with",	  u8"yield",
+};
 
-		node.as_int = parse_int(in, str);
-		if (node.as_int == NULL) {
-			new_node(in, STARLARK_NODE_ERROR);
-			free(str);
-			in->idx += 1;
-			return;
+static bool peek_is_keyword(struct starlark_Parser *p)
+{
+	for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i += 1) {
+		if (peek_keyword(p, keywords[i])) {
+			return true;
 		}
-		new_node_with_value(in, STARLARK_NODE_INT, node);
-		free(str);
-		in->idx += 1;
-		break;
 	}
-	case STARLARK_TOKEN_STRING: {
-		char *tmp = token_string(in);
-		node.as_str = parse_string_escapes(in, tmp);
-		if (node.as_str.ptr == NULL) {
-			free(tmp);
-			new_node(in, STARLARK_NODE_ERROR);
-			in->idx += 1;
-			return;
-		}
 
-		new_node_with_value(in, STARLARK_NODE_STRING, node);
-		in->idx += 1;
-		break;
-	}
+	return false;
+}
+
+// Returns true if the next token can start an expression.
+static bool peek_expression(struct starlark_Parser *p)
+{
+	switch (peek_tag(p)) {
+	case STARLARK_TOKEN_IDENT_OR_KEYWORD:
+		return !peek_is_keyword(p) || peek_keyword(p, u8"not") ||
+		       peek_keyword(p, u8"lambda");
+	case STARLARK_TOKEN_NUMBER:
+	case STARLARK_TOKEN_STRING:
+	case STARLARK_TOKEN_LPAREN:
+	case STARLARK_TOKEN_LBRACKET:
+	case STARLARK_TOKEN_LBRACE:
+	case STARLARK_TOKEN_PLUS:
+	case STARLARK_TOKEN_MINUS:
+	case STARLARK_TOKEN_BITNOT:
+		return true;
 	default:
-		unimplemented();
+		return false;
 	}
 }
 
-static enum parse_status status(struct starlark_Parser *p)
+// Adds the next token, which must be a name, to the strpool.
+// Returns its handle, or -1 if the next token isn't a name.
+static int64_t parse_name(struct starlark_Parser *p)
 {
-	if (p->ctx->err != 0) {
-		return PARSE_DONE;
+	if (peek_tag(p) != STARLARK_TOKEN_IDENT_OR_KEYWORD ||
+	    peek_is_keyword(p)) {
+		(void)syntax_error(p, STARLARK_ERRORCODE_EXPECTED_IDENT);
+		return -1;
 	}
 
-	if (p->idx + 1 >= p->l->toks_len) {
-		return PARSE_DONE;
+	int64_t result = strpool_add(&p->ctx->strpool, peek_len(p),
+				     (const char *)&p->ctx->src[peek_start(p)]);
+	if (result < 0) {
+		p->ctx->err = STARLARK_ERROR_OOM;
+		return -1;
 	}
 
-	return PARSE_NOT_DONE;
+	advance(p);
+	return result;
 }
 
-static void parse_file(struct starlark_Parser *p)
+static uint32_t parse_identifier(struct starlark_Parser *p)
 {
-	if (p->ctx->err != 0) {
-		return;
+	const size_t start = peek_start(p);
+	union starlark_AstNode node = { 0 };
+	node.as_identifier.name = parse_name(p);
+	if (node.as_identifier.name < 0) {
+		return new_node(p, STARLARK_NODE_ERROR, start);
 	}
 
-	while (status(p) != PARSE_DONE) {
-		switch (peek_tag(p)) {
-		case STARLARK_TOKEN_NEWLINE:
-			p->idx += 1;
+	return new_node_with_value(p, STARLARK_NODE_IDENTIFIER, start, node);
+}
+
+static uint32_t parse_test(struct starlark_Parser *p);
+static uint32_t parse_test_nocond(struct starlark_Parser *p);
+static uint32_t parse_expression(struct starlark_Parser *p);
+static uint32_t parse_primary(struct starlark_Parser *p);
+static void parse_statements(struct starlark_Parser *p, const size_t indent,
+			     const size_t outer);
+
+// CompClause = 'for' LoopVariables 'in' Test | 'if' Test .
+//
+// Parses the clauses of a comprehension whose body has already been parsed.
+static uint32_t parse_comprehension(struct starlark_Parser *p,
+				    const enum starlark_AstTag tag,
+				    const size_t start, const uint32_t body)
+{
+	const size_t from = p->scratch_len;
+	while (!failed(p)) {
+		const size_t clause_start = peek_start(p);
+		union starlark_AstNode clause = { 0 };
+		if (peek_keyword(p, u8"for")) {
+			advance(p);
+			clause.as_for.vars = parse_primary(p);
+			if (peek_tag(p) == STARLARK_TOKEN_COMMA) {
+				const size_t vars_from = p->scratch_len;
+				scratch_push(p, clause.as_for.vars);
+				while (peek_tag(p) == STARLARK_TOKEN_COMMA &&
+				       !failed(p)) {
+					advance(p);
+					if (peek_keyword(p, u8"in")) {
+						break;
+					}
+
+					scratch_push(p, parse_primary(p));
+				}
+
+				clause.as_for.vars = new_list_node(
+					p, STARLARK_NODE_TUPLE, clause_start,
+					vars_from);
+			}
+
+			(void)expect_keyword(p, u8"in");
+			clause.as_for.iterable = parse_test_nocond(p);
+			clause.as_for.body = STARLARK_NODE_NONE;
+			scratch_push(p, new_node_with_value(
+						p, STARLARK_NODE_COMP_FOR,
+						clause_start, clause));
+		} else if (peek_keyword(p, u8"if")) {
+			advance(p);
+			clause.as_unary.operand = parse_test_nocond(p);
+			scratch_push(p, new_node_with_value(
+						p, STARLARK_NODE_COMP_IF,
+						clause_start, clause));
+		} else {
+			break;
+		}
+	}
+
+	union starlark_AstNode node = { 0 };
+	node.as_comp.body = body;
+	node.as_comp.clauses_len = p->scratch_len - from;
+	node.as_comp.clauses = scratch_pop(p, from);
+	return new_node_with_value(p, tag, start, node);
+}
+
+// '(' [Expression [',']] ')'
+static uint32_t parse_paren(struct starlark_Parser *p)
+{
+	const size_t start = peek_start(p);
+	const size_t from = p->scratch_len;
+	advance(p);
+	p->depth += 1;
+
+	uint32_t result = STARLARK_NODE_NONE;
+	if (peek_tag(p) == STARLARK_TOKEN_RPAREN) {
+		result = new_list_node(p, STARLARK_NODE_TUPLE, start, from);
+	} else {
+		result = parse_test(p);
+		if (peek_tag(p) == STARLARK_TOKEN_COMMA) {
+			scratch_push(p, result);
+			while (peek_tag(p) == STARLARK_TOKEN_COMMA &&
+			       !failed(p)) {
+				advance(p);
+				if (peek_tag(p) == STARLARK_TOKEN_RPAREN) {
+					break;
+				}
+
+				scratch_push(p, parse_test(p));
+			}
+
+			result = new_list_node(p, STARLARK_NODE_TUPLE, start,
+					       from);
+		}
+	}
+
+	(void)expect(p, STARLARK_TOKEN_RPAREN);
+	p->depth -= 1;
+	return result;
+}
+
+// ListExpr = '[' [Expression [',']] ']' .
+// ListComp = '[' Test {CompClause} ']'.
+static uint32_t parse_list(struct starlark_Parser *p)
+{
+	const size_t start = peek_start(p);
+	const size_t from = p->scratch_len;
+	advance(p);
+	p->depth += 1;
+
+	uint32_t result = STARLARK_NODE_NONE;
+	if (peek_tag(p) == STARLARK_TOKEN_RBRACKET) {
+		result = new_list_node(p, STARLARK_NODE_LIST, start, from);
+	} else {
+		const uint32_t first = parse_test(p);
+		if (peek_keyword(p, u8"for")) {
+			result = parse_comprehension(p, STARLARK_NODE_LIST_COMP,
+						     start, first);
+		} else {
+			scratch_push(p, first);
+			while (peek_tag(p) == STARLARK_TOKEN_COMMA &&
+			       !failed(p)) {
+				advance(p);
+				if (peek_tag(p) == STARLARK_TOKEN_RBRACKET) {
+					break;
+				}
+
+				scratch_push(p, parse_test(p));
+			}
+
+			result = new_list_node(p, STARLARK_NODE_LIST, start,
+					       from);
+		}
+	}
+
+	(void)expect(p, STARLARK_TOKEN_RBRACKET);
+	p->depth -= 1;
+	return result;
+}
+
+// Entry = Test ':' Test .
+static uint32_t parse_dict_entry(struct starlark_Parser *p)
+{
+	const size_t start = peek_start(p);
+	union starlark_AstNode node = { 0 };
+	node.as_binary.lhs = parse_test(p);
+	(void)expect(p, STARLARK_TOKEN_COLON);
+	node.as_binary.rhs = parse_test(p);
+	return new_node_with_value(p, STARLARK_NODE_DICT_ENTRY, start, node);
+}
+
+// DictExpr = '{' [Entries [',']] '}' .
+// DictComp = '{' Entry {CompClause} '}' .
+static uint32_t parse_dict(struct starlark_Parser *p)
+{
+	const size_t start = peek_start(p);
+	const size_t from = p->scratch_len;
+	advance(p);
+	p->depth += 1;
+
+	uint32_t result = STARLARK_NODE_NONE;
+	if (peek_tag(p) == STARLARK_TOKEN_RBRACE) {
+		result = new_list_node(p, STARLARK_NODE_DICT, start, from);
+	} else {
+		const uint32_t first = parse_dict_entry(p);
+		if (peek_keyword(p, u8"for")) {
+			result = parse_comprehension(p, STARLARK_NODE_DICT_COMP,
+						     start, first);
+		} else {
+			scratch_push(p, first);
+			while (peek_tag(p) == STARLARK_TOKEN_COMMA &&
+			       !failed(p)) {
+				advance(p);
+				if (peek_tag(p) == STARLARK_TOKEN_RBRACE) {
+					break;
+				}
+
+				scratch_push(p, parse_dict_entry(p));
+			}
+
+			result = new_list_node(p, STARLARK_NODE_DICT, start,
+					       from);
+		}
+	}
+
+	(void)expect(p, STARLARK_TOKEN_RBRACE);
+	p->depth -= 1;
+	return result;
+}
+
+// Operand = identifier
+//         | int | float | string | bytes
+//         | ListExpr | ListComp
+//         | DictExpr | DictComp
+//         | '(' [Expression [',']] ')'
+//         .
+static uint32_t parse_operand(struct starlark_Parser *in)
+{
+	if (failed(in)) {
+		return STARLARK_NODE_NONE;
+	}
+
+	const size_t start = peek_start(in);
+	union starlark_AstNode node = { 0 };
+	switch (peek_tag(in)) {
+	case STARLARK_TOKEN_IDENT_OR_KEYWORD:
+		return parse_identifier(in);
+	case STARLARK_TOKEN_NUMBER: {
+		char *str = token_string(in);
+		if (strchr(str, u8"."[0]) != NULL ||
+		    ((strncmp(str, u8"0x", 2) != 0 &&
+		      strncmp(str, u8"0X", 2) != 0) &&
+		     strpbrk(str, u8"eE") != NULL)) {
+			node.as_float = parse_float(in, str);
+			free(str);
+			in->idx += 1;
+			return new_node_with_value(in, STARLARK_NODE_FLOAT,
+						   start, node);
+		}
+
+		node.as_int = parse_int(in, str);
+		free(str);
+		in->idx += 1;
+		if (node.as_int == NULL) {
+			return new_node(in, STARLARK_NODE_ERROR, start);
+		}
+
+		const uint32_t result = new_node_with_value(
+			in, STARLARK_NODE_INT, start, node);
+		if (result == STARLARK_NODE_NONE) {
+			Int_destroy(node.as_int);
+		}
+
+		return result;
+	}
+	case STARLARK_TOKEN_STRING: {
+		char *tmp = token_string(in);
+		if (tmp == NULL) {
+			in->ctx->err = STARLARK_ERROR_OOM;
+			return STARLARK_NODE_NONE;
+		}
+
+		node.as_str = parse_string_escapes(in, tmp);
+		in->idx += 1;
+		if (node.as_str.ptr == NULL) {
+			free(tmp);
+			in->recovering = true;
+			return new_node(in, STARLARK_NODE_ERROR, start);
+		}
+
+		const uint32_t result = new_node_with_value(
+			in, STARLARK_NODE_STRING, start, node);
+		if (result == STARLARK_NODE_NONE) {
+			free(tmp);
+		}
+
+		return result;
+	}
+	case STARLARK_TOKEN_LPAREN:
+		return parse_paren(in);
+	case STARLARK_TOKEN_LBRACKET:
+		return parse_list(in);
+	case STARLARK_TOKEN_LBRACE:
+		return parse_dict(in);
+	case STARLARK_TOKEN_ERROR:
+		// The lexer has already reported this.
+		in->recovering = true;
+		in->idx += 1;
+		return new_node(in, STARLARK_NODE_ERROR, start);
+	default:
+		return syntax_error(in, STARLARK_ERRORCODE_UNEXPECTED_TOKEN);
+	}
+}
+
+// Reports an error if the arguments of a call, pushed since the scratch array
+// had length from, aren't in the order positional, named, *args, **kwargs.
+// Named arguments may also follow *args.
+static void check_args(struct starlark_Parser *p, const size_t from)
+{
+	enum {
+		SEEN_POSITIONAL,
+		SEEN_NAMED,
+		SEEN_STAR,
+		SEEN_STARSTAR,
+	} seen = SEEN_POSITIONAL;
+
+	for (size_t i = from; i < p->scratch_len; i += 1) {
+		const uint32_t arg = p->scratch[i];
+		bool ok = true;
+		switch (p->ast.tags[arg]) {
+		case STARLARK_NODE_ARG_NAMED:
+			ok = seen != SEEN_STARSTAR;
+			seen = MAX(seen, SEEN_NAMED);
+			break;
+		case STARLARK_NODE_ARG_STAR:
+			ok = seen < SEEN_STAR;
+			seen = SEEN_STAR;
+			break;
+		case STARLARK_NODE_ARG_STARSTAR:
+			ok = seen < SEEN_STARSTAR;
+			seen = SEEN_STARSTAR;
+			break;
+		default:
+			ok = seen == SEEN_POSITIONAL;
+			break;
+		}
+
+		if (!ok) {
+			node_error(p, STARLARK_ERRORCODE_ARG_ORDER, arg, 0);
+			return;
+		}
+	}
+}
+
+// CallSuffix = '(' [Arguments [',']] ')' .
+// Arguments  = Argument {',' Argument} .
+// Argument   = Test | identifier '=' Test | '*' Test | '**' Test .
+static uint32_t parse_call(struct starlark_Parser *p, const uint32_t fn)
+{
+	const size_t start = peek_start(p);
+	const size_t from = p->scratch_len;
+	advance(p);
+	p->depth += 1;
+
+	while (peek_tag(p) != STARLARK_TOKEN_RPAREN && !failed(p)) {
+		const size_t arg_start = peek_start(p);
+		union starlark_AstNode arg = { 0 };
+		uint32_t result = STARLARK_NODE_NONE;
+		if (peek_tag(p) == STARLARK_TOKEN_MUL) {
+			advance(p);
+			arg.as_unary.operand = parse_test(p);
+			result = new_node_with_value(p, STARLARK_NODE_ARG_STAR,
+						     arg_start, arg);
+		} else if (peek_tag(p) == STARLARK_TOKEN_EXP) {
+			advance(p);
+			arg.as_unary.operand = parse_test(p);
+			result = new_node_with_value(
+				p, STARLARK_NODE_ARG_STARSTAR, arg_start, arg);
+		} else if (peek_tag(p) == STARLARK_TOKEN_IDENT_OR_KEYWORD &&
+			   peek2_tag(p) == STARLARK_TOKEN_ASSIGN) {
+			arg.as_named.name = parse_name(p);
+			advance(p);
+			arg.as_named.value = parse_test(p);
+			result = new_node_with_value(p, STARLARK_NODE_ARG_NAMED,
+						     arg_start, arg);
+		} else {
+			result = parse_test(p);
+		}
+
+		scratch_push(p, result);
+		if (peek_tag(p) != STARLARK_TOKEN_COMMA) {
+			break;
+		}
+
+		advance(p);
+	}
+
+	check_args(p, from);
+	union starlark_AstNode node = { 0 };
+	node.as_call.fn = fn;
+	node.as_call.args_len = p->scratch_len - from;
+	node.as_call.args = scratch_pop(p, from);
+	(void)expect(p, STARLARK_TOKEN_RPAREN);
+	p->depth -= 1;
+	return new_node_with_value(p, STARLARK_NODE_CALL, start, node);
+}
+
+// SliceSuffix = '[' [Expression] ':' [Test] [':' [Test]] ']'
+//             | '[' Expression ']'
+//             .
+static uint32_t parse_index(struct starlark_Parser *p, const uint32_t operand)
+{
+	const size_t start = peek_start(p);
+	advance(p);
+	p->depth += 1;
+
+	union starlark_AstNode node = { 0 };
+	uint32_t lo = STARLARK_NODE_NONE;
+	if (peek_tag(p) != STARLARK_TOKEN_COLON) {
+		lo = parse_expression(p);
+	}
+
+	enum starlark_AstTag tag = STARLARK_NODE_INDEX;
+	if (peek_tag(p) == STARLARK_TOKEN_RBRACKET &&
+	    lo != STARLARK_NODE_NONE) {
+		node.as_binary.lhs = operand;
+		node.as_binary.rhs = lo;
+	} else {
+		tag = STARLARK_NODE_SLICE;
+		node.as_slice.operand = operand;
+		node.as_slice.lo = lo;
+		node.as_slice.hi = STARLARK_NODE_NONE;
+		node.as_slice.step = STARLARK_NODE_NONE;
+		(void)expect(p, STARLARK_TOKEN_COLON);
+		if (peek_tag(p) != STARLARK_TOKEN_COLON &&
+		    peek_tag(p) != STARLARK_TOKEN_RBRACKET) {
+			node.as_slice.hi = parse_test(p);
+		}
+
+		if (peek_tag(p) == STARLARK_TOKEN_COLON) {
+			advance(p);
+			if (peek_tag(p) != STARLARK_TOKEN_RBRACKET) {
+				node.as_slice.step = parse_test(p);
+			}
+		}
+	}
+
+	(void)expect(p, STARLARK_TOKEN_RBRACKET);
+	p->depth -= 1;
+	return new_node_with_value(p, tag, start, node);
+}
+
+// PrimaryExpr = Operand
+//             | PrimaryExpr DotSuffix
+//             | PrimaryExpr CallSuffix
+//             | PrimaryExpr SliceSuffix
+//             .
+static uint32_t parse_primary(struct starlark_Parser *p)
+{
+	uint32_t result = parse_operand(p);
+	while (!failed(p)) {
+		switch (peek_tag(p)) {
+		case STARLARK_TOKEN_DOT: {
+			const size_t start = peek_start(p);
+			advance(p);
+			union starlark_AstNode node = { 0 };
+			node.as_dot.operand = result;
+			node.as_dot.name = parse_name(p);
+			result = new_node_with_value(p, STARLARK_NODE_DOT,
+						     start, node);
+			break;
+		}
+		case STARLARK_TOKEN_LPAREN:
+			result = parse_call(p, result);
+			break;
+		case STARLARK_TOKEN_LBRACKET:
+			result = parse_index(p, result);
 			break;
 		default:
-			parse_operand(p);
+			return result;
+		}
+	}
+
+	return result;
+}
+
+// UnaryExpr = '+' PrimaryExpr | '-' PrimaryExpr | '~' PrimaryExpr .
+static uint32_t parse_unary(struct starlark_Parser *p)
+{
+	union starlark_AstNode node = { 0 };
+	switch (peek_tag(p)) {
+	case STARLARK_TOKEN_PLUS:
+		node.as_unary.op = STARLARK_OP_ADD;
+		break;
+	case STARLARK_TOKEN_MINUS:
+		node.as_unary.op = STARLARK_OP_SUB;
+		break;
+	case STARLARK_TOKEN_BITNOT:
+		node.as_unary.op = STARLARK_OP_BITNOT;
+		break;
+	default:
+		return parse_primary(p);
+	}
+
+	const size_t start = peek_start(p);
+	advance(p);
+	node.as_unary.operand = parse_unary(p);
+	return new_node_with_value(p, STARLARK_NODE_UNARY, start, node);
+}
+
+// How tightly each binary operator binds, from loosest to tightest.
+enum precedence {
+	PREC_NONE = 0,
+	PREC_OR,
+	PREC_AND,
+	PREC_NOT,
+	PREC_COMPARE,
+	PREC_BITOR,
+	PREC_XOR,
+	PREC_BITAND,
+	PREC_SHIFT,
+	PREC_ADD,
+	PREC_MUL,
+};
+
+// Returns the precedence of the binary operator in the next tokens, storing
+// the operator in *op and the number of tokens it spans in *len. Returns
+// PREC_NONE if the next token isn't a binary operator.
+static enum precedence peek_binary_op(struct starlark_Parser *p,
+				      enum starlark_Op *op, size_t *len)
+{
+	*len = 1;
+	switch (peek_tag(p)) {
+	case STARLARK_TOKEN_PLUS:
+		*op = STARLARK_OP_ADD;
+		return PREC_ADD;
+	case STARLARK_TOKEN_MINUS:
+		*op = STARLARK_OP_SUB;
+		return PREC_ADD;
+	case STARLARK_TOKEN_MUL:
+		*op = STARLARK_OP_MUL;
+		return PREC_MUL;
+	case STARLARK_TOKEN_DIV:
+		*op = STARLARK_OP_DIV;
+		return PREC_MUL;
+	case STARLARK_TOKEN_DIVINT:
+		// '//=' is lexed as '//' followed by '='.
+		if (peek2_tag(p) == STARLARK_TOKEN_ASSIGN) {
+			return PREC_NONE;
+		}
+
+		*op = STARLARK_OP_FLOORDIV;
+		return PREC_MUL;
+	case STARLARK_TOKEN_MOD:
+		*op = STARLARK_OP_MOD;
+		return PREC_MUL;
+	case STARLARK_TOKEN_BITAND:
+		*op = STARLARK_OP_BITAND;
+		return PREC_BITAND;
+	case STARLARK_TOKEN_BITOR:
+		*op = STARLARK_OP_BITOR;
+		return PREC_BITOR;
+	case STARLARK_TOKEN_XOR:
+		*op = STARLARK_OP_XOR;
+		return PREC_XOR;
+	case STARLARK_TOKEN_LSHIFT:
+		*op = STARLARK_OP_LSHIFT;
+		return PREC_SHIFT;
+	case STARLARK_TOKEN_RSHIFT:
+		*op = STARLARK_OP_RSHIFT;
+		return PREC_SHIFT;
+	case STARLARK_TOKEN_EQ:
+		*op = STARLARK_OP_EQ;
+		return PREC_COMPARE;
+	case STARLARK_TOKEN_NOTEQ:
+		*op = STARLARK_OP_NOTEQ;
+		return PREC_COMPARE;
+	case STARLARK_TOKEN_LESS:
+		*op = STARLARK_OP_LESS;
+		return PREC_COMPARE;
+	case STARLARK_TOKEN_LEQ:
+		*op = STARLARK_OP_LEQ;
+		return PREC_COMPARE;
+	case STARLARK_TOKEN_GREATER:
+		*op = STARLARK_OP_GREATER;
+		return PREC_COMPARE;
+	case STARLARK_TOKEN_GEQ:
+		*op = STARLARK_OP_GEQ;
+		return PREC_COMPARE;
+	case STARLARK_TOKEN_IDENT_OR_KEYWORD:
+		break;
+	default:
+		return PREC_NONE;
+	}
+
+	if (peek_keyword(p, u8"or")) {
+		*op = STARLARK_OP_OR;
+		return PREC_OR;
+	} else if (peek_keyword(p, u8"and")) {
+		*op = STARLARK_OP_AND;
+		return PREC_AND;
+	} else if (peek_keyword(p, u8"in")) {
+		*op = STARLARK_OP_IN;
+		return PREC_COMPARE;
+	} else if (peek_keyword(p, u8"not")) {
+		// 'not in' is the only binary operator starting with 'not'.
+		const size_t i = p->idx + 2;
+		if (i < p->l->toks_len &&
+		    p->l->toks.tags[i] == STARLARK_TOKEN_IDENT_OR_KEYWORD &&
+		    p->l->toks.ends[i] - p->l->toks.starts[i] == 2 &&
+		    memcmp(&p->ctx->src[p->l->toks.starts[i]], u8"in", 2) ==
+			    0) {
+			*op = STARLARK_OP_NOT_IN;
+			*len = 2;
+			return PREC_COMPARE;
+		}
+	}
+
+	return PREC_NONE;
+}
+
+// BinaryExpr = Test {Binop Test} .
+//
+// Parses the operators binding at least as tightly as min.
+static uint32_t parse_binary(struct starlark_Parser *p,
+			     const enum precedence min)
+{
+	uint32_t result = STARLARK_NODE_NONE;
+	if (min <= PREC_NOT && peek_keyword(p, u8"not")) {
+		const size_t start = peek_start(p);
+		advance(p);
+		union starlark_AstNode node = { 0 };
+		node.as_unary.op = STARLARK_OP_NOT;
+		node.as_unary.operand = parse_binary(p, PREC_NOT);
+		result = new_node_with_value(p, STARLARK_NODE_UNARY, start,
+					     node);
+	} else {
+		result = parse_unary(p);
+	}
+
+	while (!failed(p)) {
+		enum starlark_Op op = 0;
+		size_t len = 0;
+		const enum precedence prec = peek_binary_op(p, &op, &len);
+		if (prec == PREC_NONE || prec < min) {
+			break;
+		}
+
+		const size_t start = peek_start(p);
+		for (size_t i = 0; i < len; i += 1) {
+			advance(p);
+		}
+
+		union starlark_AstNode node = { 0 };
+		node.as_binary.op = op;
+		node.as_binary.lhs = result;
+		node.as_binary.rhs = parse_binary(p, prec + 1);
+		result = new_node_with_value(p, STARLARK_NODE_BINARY, start,
+					     node);
+
+		// Comparisons don't associate, so 'a < b < c' isn't allowed.
+		if (prec == PREC_COMPARE && !failed(p) &&
+		    peek_binary_op(p, &op, &len) == PREC_COMPARE) {
+			(void)syntax_error(
+				p, STARLARK_ERRORCODE_CHAINED_COMPARISON);
+		}
+	}
+
+	return result;
+}
+
+// Parameters = Parameter {',' Parameter}.
+// Parameter  = identifier | identifier '=' Test | '*' | '*' identifier
+//            | '**' identifier
+//            .
+//
+// Parses parameters until the token end, storing their number in *len.
+// Returns where they start in the extra array.
+static uint32_t parse_params(struct starlark_Parser *p,
+			     const enum starlark_TokenTag end, uint32_t *len)
+{
+	const size_t from = p->scratch_len;
+	while (peek_tag(p) != end && !failed(p)) {
+		const size_t start = peek_start(p);
+		union starlark_AstNode node = { 0 };
+		enum starlark_AstTag tag = STARLARK_NODE_PARAM;
+		if (peek_tag(p) == STARLARK_TOKEN_MUL) {
+			advance(p);
+			tag = STARLARK_NODE_PARAM_STAR;
+			node.as_unary.operand = STARLARK_NODE_NONE;
+			if (peek_tag(p) == STARLARK_TOKEN_IDENT_OR_KEYWORD) {
+				node.as_unary.operand = parse_identifier(p);
+			}
+		} else if (peek_tag(p) == STARLARK_TOKEN_EXP) {
+			advance(p);
+			tag = STARLARK_NODE_PARAM_STARSTAR;
+			node.as_unary.operand = parse_identifier(p);
+		} else {
+			node.as_binary.lhs = parse_identifier(p);
+			node.as_binary.rhs = STARLARK_NODE_NONE;
+			if (peek_tag(p) == STARLARK_TOKEN_ASSIGN) {
+				advance(p);
+				node.as_binary.rhs = parse_test(p);
+			}
+		}
+
+		scratch_push(p, new_node_with_value(p, tag, start, node));
+		if (peek_tag(p) != STARLARK_TOKEN_COMMA) {
+			break;
+		}
+
+		advance(p);
+	}
+
+	*len = p->scratch_len - from;
+	return scratch_pop(p, from);
+}
+
+// LambdaExpr = 'lambda' [Parameters] ':' Test .
+static uint32_t parse_lambda(struct starlark_Parser *p, const bool nocond)
+{
+	const size_t start = peek_start(p);
+	advance(p);
+
+	union starlark_AstNode node = { 0 };
+	node.as_func.params =
+		parse_params(p, STARLARK_TOKEN_COLON, &node.as_func.params_len);
+	(void)expect(p, STARLARK_TOKEN_COLON);
+	node.as_func.body = nocond ? parse_test_nocond(p) : parse_test(p);
+	return new_node_with_value(p, STARLARK_NODE_LAMBDA, start, node);
+}
+
+// Test = IfExpr | PrimaryExpr | UnaryExpr | BinaryExpr | LambdaExpr .
+// IfExpr = Test 'if' Test 'else' Test .
+static uint32_t parse_test(struct starlark_Parser *p)
+{
+	if (peek_keyword(p, u8"lambda")) {
+		return parse_lambda(p, false);
+	}
+
+	const uint32_t result = parse_binary(p, PREC_OR);
+	if (failed(p) || !peek_keyword(p, u8"if")) {
+		return result;
+	}
+
+	const size_t start = peek_start(p);
+	advance(p);
+	union starlark_AstNode node = { 0 };
+	node.as_cond.then = result;
+	node.as_cond.cond = parse_binary(p, PREC_OR);
+	(void)expect_keyword(p, u8"else");
+	node.as_cond.otherwise = parse_test(p);
+	return new_node_with_value(p, STARLARK_NODE_COND, start, node);
+}
+
+// A Test without a conditional expression, which is used where an 'if' would
+// start the next clause of a comprehension instead.
+static uint32_t parse_test_nocond(struct starlark_Parser *p)
+{
+	if (peek_keyword(p, u8"lambda")) {
+		return parse_lambda(p, true);
+	}
+
+	return parse_binary(p, PREC_OR);
+}
+
+// Expression = Test {',' Test} .
+static uint32_t parse_expression(struct starlark_Parser *p)
+{
+	const size_t start = peek_start(p);
+	const uint32_t first = parse_test(p);
+	if (peek_tag(p) != STARLARK_TOKEN_COMMA || failed(p)) {
+		return first;
+	}
+
+	const size_t from = p->scratch_len;
+	scratch_push(p, first);
+	while (peek_tag(p) == STARLARK_TOKEN_COMMA && !failed(p)) {
+		advance(p);
+		if (!peek_expression(p)) {
+			break;
+		}
+
+		scratch_push(p, parse_test(p));
+	}
+
+	return new_list_node(p, STARLARK_NODE_TUPLE, start, from);
+}
+
+// Reports an error unless node can be assigned to. Tuples and lists can be
+// assigned to if each of their elements can, unless only a single target is
+// allowed.
+static void check_target(struct starlark_Parser *p, const uint32_t node,
+			 const bool single)
+{
+	if (failed(p) || node == STARLARK_NODE_NONE) {
+		return;
+	}
+
+	switch (p->ast.tags[node]) {
+	case STARLARK_NODE_IDENTIFIER:
+	case STARLARK_NODE_DOT:
+	case STARLARK_NODE_INDEX:
+		return;
+	case STARLARK_NODE_TUPLE:
+	case STARLARK_NODE_LIST: {
+		if (single) {
+			break;
+		}
+
+		const size_t idx = p->ast.idxs[node];
+		const union starlark_AstNode n = p->ast.nodes[idx];
+		for (uint32_t i = 0; i < n.as_list.len; i += 1) {
+			check_target(p, p->extra[n.as_list.start + i], false);
+		}
+		return;
+	}
+	default:
+		break;
+	}
+
+	node_error(p, STARLARK_ERRORCODE_INVALID_TARGET, node, 0);
+}
+
+// Parses the vars of a for loop or comprehension.
+// LoopVariables = PrimaryExpr {',' PrimaryExpr} .
+static uint32_t parse_loop_vars(struct starlark_Parser *p)
+{
+	const size_t start = peek_start(p);
+	uint32_t result = parse_primary(p);
+	if (peek_tag(p) == STARLARK_TOKEN_COMMA) {
+		const size_t from = p->scratch_len;
+		scratch_push(p, result);
+		while (peek_tag(p) == STARLARK_TOKEN_COMMA && !failed(p)) {
+			advance(p);
+			if (peek_keyword(p, u8"in")) {
+				break;
+			}
+
+			scratch_push(p, parse_primary(p));
+		}
+
+		result = new_list_node(p, STARLARK_NODE_TUPLE, start, from);
+	}
+
+	check_target(p, result, false);
+	return result;
+}
+
+// Returns the operator of the augmented assignment in the next tokens, storing
+// the number of tokens in *len, or returns false if there isn't one.
+static bool peek_aug_assign(struct starlark_Parser *p, enum starlark_Op *op,
+			    size_t *len)
+{
+	*len = 1;
+	switch (peek_tag(p)) {
+	case STARLARK_TOKEN_PLUSEQ:
+		*op = STARLARK_OP_ADD;
+		return true;
+	case STARLARK_TOKEN_MINUSEQ:
+		*op = STARLARK_OP_SUB;
+		return true;
+	case STARLARK_TOKEN_MULEQ:
+		*op = STARLARK_OP_MUL;
+		return true;
+	case STARLARK_TOKEN_DIVEQ:
+		*op = STARLARK_OP_DIV;
+		return true;
+	case STARLARK_TOKEN_MODEQ:
+		*op = STARLARK_OP_MOD;
+		return true;
+	case STARLARK_TOKEN_BITANDEQ:
+		*op = STARLARK_OP_BITAND;
+		return true;
+	case STARLARK_TOKEN_BITOREQ:
+		*op = STARLARK_OP_BITOR;
+		return true;
+	case STARLARK_TOKEN_XOREQ:
+		*op = STARLARK_OP_XOR;
+		return true;
+	case STARLARK_TOKEN_LSHIFTEQ:
+		*op = STARLARK_OP_LSHIFT;
+		return true;
+	case STARLARK_TOKEN_RSHIFTEQ:
+		*op = STARLARK_OP_RSHIFT;
+		return true;
+	case STARLARK_TOKEN_DIVINT:
+		if (peek2_tag(p) != STARLARK_TOKEN_ASSIGN) {
+			return false;
+		}
+
+		*op = STARLARK_OP_FLOORDIV;
+		*len = 2;
+		return true;
+	default:
+		return false;
+	}
+}
+
+// LoadStmt = 'load' '(' string {',' [identifier '='] string} [','] ')' .
+static uint32_t parse_load(struct starlark_Parser *p)
+{
+	const size_t start = peek_start(p);
+	advance(p);
+	(void)expect(p, STARLARK_TOKEN_LPAREN);
+	p->depth += 1;
+
+	union starlark_AstNode node = { 0 };
+	node.as_load.module = STARLARK_NODE_NONE;
+	if (peek_tag(p) != STARLARK_TOKEN_STRING) {
+		(void)syntax_error(p, STARLARK_ERRORCODE_UNEXPECTED_TOKEN);
+	} else {
+		node.as_load.module = parse_operand(p);
+	}
+
+	const size_t from = p->scratch_len;
+	while (peek_tag(p) == STARLARK_TOKEN_COMMA && !failed(p)) {
+		advance(p);
+		if (peek_tag(p) == STARLARK_TOKEN_RPAREN) {
+			break;
+		}
+
+		const size_t binding_start = peek_start(p);
+		union starlark_AstNode binding = { 0 };
+		if (peek_tag(p) == STARLARK_TOKEN_IDENT_OR_KEYWORD) {
+			binding.as_binary.lhs = parse_identifier(p);
+			(void)expect(p, STARLARK_TOKEN_ASSIGN);
+			if (peek_tag(p) != STARLARK_TOKEN_STRING) {
+				(void)syntax_error(
+					p, STARLARK_ERRORCODE_UNEXPECTED_TOKEN);
+				break;
+			}
+
+			binding.as_binary.rhs = parse_operand(p);
+		} else if (peek_tag(p) == STARLARK_TOKEN_STRING) {
+			// The name is bound to the same name in this file.
+			binding.as_binary.rhs = parse_operand(p);
+			if (failed(p)) {
+				break;
+			}
+
+			const size_t idx = p->ast.idxs[binding.as_binary.rhs];
+			const struct starlark_String name =
+				p->ast.nodes[idx].as_str;
+			union starlark_AstNode ident = { 0 };
+			ident.as_identifier.name = strpool_add(
+				&p->ctx->strpool, name.len, name.ptr);
+			if (ident.as_identifier.name < 0) {
+				p->ctx->err = STARLARK_ERROR_OOM;
+				break;
+			}
+
+			binding.as_binary.lhs = new_node_with_value(
+				p, STARLARK_NODE_IDENTIFIER, binding_start,
+				ident);
+		} else {
+			(void)syntax_error(p,
+					   STARLARK_ERRORCODE_UNEXPECTED_TOKEN);
+			break;
+		}
+
+		scratch_push(p, new_node_with_value(p,
+						    STARLARK_NODE_LOAD_BINDING,
+						    binding_start, binding));
+	}
+
+	// Loading a module without binding anything from it is pointless.
+	if (p->scratch_len == from && !failed(p)) {
+		(void)syntax_error(p, STARLARK_ERRORCODE_UNEXPECTED_TOKEN);
+	}
+
+	node.as_load.bindings_len = p->scratch_len - from;
+	node.as_load.bindings = scratch_pop(p, from);
+	(void)expect(p, STARLARK_TOKEN_RPAREN);
+	p->depth -= 1;
+	return new_node_with_value(p, STARLARK_NODE_LOAD, start, node);
+}
+
+// SmallStmt = ReturnStmt
+//           | BreakStmt | ContinueStmt | PassStmt
+//           | AssignStmt
+//           | ExprStmt
+//           | LoadStmt
+//           .
+static uint32_t parse_small_statement(struct starlark_Parser *p)
+{
+	const size_t start = peek_start(p);
+	union starlark_AstNode node = { 0 };
+	if (peek_keyword(p, u8"return")) {
+		advance(p);
+		node.as_unary.operand = STARLARK_NODE_NONE;
+		if (peek_tag(p) != STARLARK_TOKEN_NEWLINE &&
+		    peek_tag(p) != STARLARK_TOKEN_SEMICOLON) {
+			node.as_unary.operand = parse_expression(p);
+		}
+
+		return new_node_with_value(p, STARLARK_NODE_RETURN, start,
+					   node);
+	} else if (peek_keyword(p, u8"break")) {
+		advance(p);
+		return new_node(p, STARLARK_NODE_BREAK, start);
+	} else if (peek_keyword(p, u8"continue")) {
+		advance(p);
+		return new_node(p, STARLARK_NODE_CONTINUE, start);
+	} else if (peek_keyword(p, u8"pass")) {
+		advance(p);
+		return new_node(p, STARLARK_NODE_PASS, start);
+	} else if (peek_keyword(p, u8"load")) {
+		return parse_load(p);
+	}
+
+	const uint32_t lhs = parse_expression(p);
+	if (failed(p)) {
+		return lhs;
+	}
+
+	enum starlark_Op op = 0;
+	size_t len = 0;
+	if (peek_tag(p) == STARLARK_TOKEN_ASSIGN) {
+		check_target(p, lhs, false);
+		advance(p);
+		node.as_binary.lhs = lhs;
+		node.as_binary.rhs = parse_expression(p);
+		return new_node_with_value(p, STARLARK_NODE_ASSIGN, start,
+					   node);
+	} else if (peek_aug_assign(p, &op, &len)) {
+		check_target(p, lhs, true);
+		for (size_t i = 0; i < len; i += 1) {
+			advance(p);
+		}
+
+		node.as_binary.op = op;
+		node.as_binary.lhs = lhs;
+		node.as_binary.rhs = parse_expression(p);
+		return new_node_with_value(p, STARLARK_NODE_AUG_ASSIGN, start,
+					   node);
+	}
+
+	node.as_unary.operand = lhs;
+	return new_node_with_value(p, STARLARK_NODE_EXPR_STMT, start, node);
+}
+
+// Finishes a statement by consuming the newline after it. If there was an
+// error in the statement, the rest of its line is skipped, along with every
+// node pushed to the scratch array since it had length from.
+static void end_statement(struct starlark_Parser *p, const size_t from)
+{
+	if (p->recovering) {
+		p->depth = 0;
+		while (!at_eof(p) && peek_tag(p) != STARLARK_TOKEN_NEWLINE) {
+			advance(p);
+		}
+
+		p->scratch_len = from;
+		p->recovering = false;
+	}
+
+	if (peek_tag(p) == STARLARK_TOKEN_NEWLINE) {
+		advance(p);
+	}
+}
+
+static void skip_newlines(struct starlark_Parser *p)
+{
+	while (!at_eof(p) && peek_tag(p) == STARLARK_TOKEN_NEWLINE) {
+		advance(p);
+	}
+}
+
+// Skips a statement whose first line had an error, along with every line
+// indented further than it.
+static void skip_statement(struct starlark_Parser *p, const size_t indent,
+			   const size_t from)
+{
+	end_statement(p, from);
+	for (;;) {
+		skip_newlines(p);
+		if (at_eof(p) || peek_column(p) <= indent) {
+			return;
+		}
+
+		p->recovering = true;
+		end_statement(p, from);
+	}
+}
+
+// SimpleStmt = SmallStmt {';' SmallStmt} [';'] '\n' .
+//
+// Pushes each of the statements to the scratch array.
+static void parse_simple_statement(struct starlark_Parser *p)
+{
+	const size_t from = p->scratch_len;
+	for (;;) {
+		scratch_push(p, parse_small_statement(p));
+		if (failed(p) || peek_tag(p) != STARLARK_TOKEN_SEMICOLON) {
+			break;
+		}
+
+		advance(p);
+		if (peek_tag(p) == STARLARK_TOKEN_NEWLINE) {
+			break;
+		}
+	}
+
+	if (!failed(p) && peek_tag(p) != STARLARK_TOKEN_NEWLINE) {
+		(void)syntax_error(p, STARLARK_ERRORCODE_UNEXPECTED_TOKEN);
+	}
+
+	end_statement(p, from);
+}
+
+// Suite = [newline indent {Statement} outdent] | SimpleStmt .
+//
+// Parses the body of a compound statement indented by indent.
+static uint32_t parse_suite(struct starlark_Parser *p, const size_t indent)
+{
+	const size_t start = peek_start(p);
+	const size_t from = p->scratch_len;
+	if (peek_tag(p) != STARLARK_TOKEN_NEWLINE) {
+		parse_simple_statement(p);
+		return new_list_node(p, STARLARK_NODE_BLOCK, start, from);
+	}
+
+	skip_newlines(p);
+	if (at_eof(p) || peek_column(p) <= indent) {
+		(void)syntax_error(p, STARLARK_ERRORCODE_EXPECTED_INDENT);
+		p->recovering = false;
+		return new_list_node(p, STARLARK_NODE_BLOCK, start, from);
+	}
+
+	parse_statements(p, peek_column(p), indent);
+	return new_list_node(p, STARLARK_NODE_BLOCK, start, from);
+}
+
+// IfStmt = 'if' Test ':' Suite {'elif' Test ':' Suite} ['else' ':' Suite] .
+//
+// Also parses each elif, as an if statement in the else branch of the one
+// before it.
+static uint32_t parse_if(struct starlark_Parser *p, const size_t indent)
+{
+	const size_t start = peek_start(p);
+	const size_t from = p->scratch_len;
+	advance(p);
+
+	union starlark_AstNode node = { 0 };
+	node.as_cond.cond = parse_test(p);
+	(void)expect(p, STARLARK_TOKEN_COLON);
+	if (failed(p)) {
+		skip_statement(p, indent, from);
+		return STARLARK_NODE_NONE;
+	}
+
+	node.as_cond.then = parse_suite(p, indent);
+	node.as_cond.otherwise = STARLARK_NODE_NONE;
+	skip_newlines(p);
+	if (!at_eof(p) && peek_column(p) == indent) {
+		if (peek_keyword(p, u8"elif")) {
+			node.as_cond.otherwise = parse_if(p, indent);
+		} else if (peek_keyword(p, u8"else")) {
+			advance(p);
+			if (expect(p, STARLARK_TOKEN_COLON)) {
+				node.as_cond.otherwise = parse_suite(p, indent);
+			} else {
+				skip_statement(p, indent, p->scratch_len);
+			}
+		}
+	}
+
+	return new_node_with_value(p, STARLARK_NODE_IF, start, node);
+}
+
+// ForStmt = 'for' LoopVariables 'in' Expression ':' Suite .
+static uint32_t parse_for(struct starlark_Parser *p, const size_t indent)
+{
+	const size_t start = peek_start(p);
+	const size_t from = p->scratch_len;
+	advance(p);
+
+	union starlark_AstNode node = { 0 };
+	node.as_for.vars = parse_loop_vars(p);
+	(void)expect_keyword(p, u8"in");
+	node.as_for.iterable = parse_expression(p);
+	(void)expect(p, STARLARK_TOKEN_COLON);
+	if (failed(p)) {
+		skip_statement(p, indent, from);
+		return STARLARK_NODE_NONE;
+	}
+
+	node.as_for.body = parse_suite(p, indent);
+	return new_node_with_value(p, STARLARK_NODE_FOR, start, node);
+}
+
+// DefStmt = 'def' identifier '(' [Parameters [',']] ')' ':' Suite .
+static uint32_t parse_def(struct starlark_Parser *p, const size_t indent)
+{
+	const size_t start = peek_start(p);
+	const size_t from = p->scratch_len;
+	advance(p);
+
+	union starlark_AstNode node = { 0 };
+	node.as_binary.lhs = parse_identifier(p);
+	(void)expect(p, STARLARK_TOKEN_LPAREN);
+	p->depth += 1;
+
+	union starlark_AstNode func = { 0 };
+	func.as_func.params = parse_params(p, STARLARK_TOKEN_RPAREN,
+					   &func.as_func.params_len);
+	(void)expect(p, STARLARK_TOKEN_RPAREN);
+	p->depth -= 1;
+	(void)expect(p, STARLARK_TOKEN_COLON);
+	if (failed(p)) {
+		skip_statement(p, indent, from);
+		return STARLARK_NODE_NONE;
+	}
+
+	func.as_func.body = parse_suite(p, indent);
+	node.as_binary.rhs =
+		new_node_with_value(p, STARLARK_NODE_FUNCTION, start, func);
+	return new_node_with_value(p, STARLARK_NODE_DEF, start, node);
+}
+
+// Statement = DefStmt | IfStmt | ForStmt | SimpleStmt .
+//
+// Pushes the statements parsed to the scratch array.
+static void parse_statement(struct starlark_Parser *p, const size_t indent)
+{
+	uint32_t result = STARLARK_NODE_NONE;
+	if (peek_keyword(p, u8"def")) {
+		result = parse_def(p, indent);
+	} else if (peek_keyword(p, u8"if")) {
+		result = parse_if(p, indent);
+	} else if (peek_keyword(p, u8"for")) {
+		result = parse_for(p, indent);
+	} else {
+		parse_simple_statement(p);
+		return;
+	}
+
+	if (result != STARLARK_NODE_NONE) {
+		scratch_push(p, result);
+	}
+}
+
+// Parses statements indented by exactly indent, pushing them to the scratch
+// array, until one is indented by less. outer is the indentation of the
+// enclosing block.
+static void parse_statements(struct starlark_Parser *p, const size_t indent,
+			     const size_t outer)
+{
+	for (;;) {
+		skip_newlines(p);
+		if (at_eof(p) || p->ctx->err) {
+			return;
+		}
+
+		const size_t column = peek_column(p);
+		if (column < indent && column <= outer) {
+			return;
+		}
+
+		if (column != indent) {
+			enum starlark_ErrorCode code =
+				STARLARK_ERRORCODE_UNEXPECTED_INDENT;
+			if (column < indent) {
+				code = STARLARK_ERRORCODE_INCONSISTENT_DEDENT;
+			}
+
+			(void)syntax_error(p, code);
+			skip_statement(p, column, p->scratch_len);
+			continue;
 		}
+
+		parse_statement(p, indent);
+	}
+}
+
+// File = {Statement | newline} eof .
+static void parse_file(struct starlark_Parser *p)
+{
+	if (p->ctx->err != 0) {
+		return;
 	}
+
+	const size_t from = p->scratch_len;
+	parse_statements(p, 0, 0);
+	p->root = new_list_node(p, STARLARK_NODE_BLOCK, 0, from);
 }
 
 int starlark_parse_tokens(struct starlark_Context *ctx,
@@ -675,24 +2050,25 @@ int starlark_parse_tokens(struct starlark_Context *ctx,
 	assert(l != NULL);
 	assert(out != NULL);
 
-	if (l->toks_len == 0) {
-		*out = (struct starlark_Parser){
-			.ctx = ctx,
-			.l = l,
-		};
-		return 0;
-	}
-
+	// Reuse whatever arrays out already has, so that a parser which was
+	// reset doesn't need to allocate them again.
 	struct starlark_Parser p = {
 		.ctx = ctx,
 		.l = l,
 		.idx = SIZE_MAX,
+		.root = STARLARK_NODE_NONE,
+		.ast = out->ast,
+		.ast_cap = out->ast_cap,
+		.extra = out->extra,
+		.extra_cap = out->extra_cap,
+		.scratch = out->scratch,
+		.scratch_cap = out->scratch_cap,
 	};
 
 	parse_file(&p);
 
 	if (ctx->err != 0) {
-		out->l = NULL;
+		*out = (struct starlark_Parser){ 0 };
 		starlark_Parser_finish(&p);
 		return ctx->err;
 	}
@@ -708,38 +2084,108 @@ int starlark_parse(struct starlark_Context *ctx, const char *name,
 	assert(ctx != NULL);
 	assert(out != NULL);
 
-	struct starlark_Lexer l = { 0 };
-	int ret = starlark_lex(ctx, name, src_len, src, &l);
-
-	if (ret != 0) {
-		return ret;
+	struct starlark_Scratch *s = Scratch_get(ctx);
+	if (s == NULL) {
+		ctx->err = STARLARK_ERROR_OOM;
+		return ctx->err;
 	}
 
-	ret = starlark_parse_tokens(ctx, &l, out);
-	starlark_Lexer_finish(&l);
+	starlark_Lexer_reset(&s->lexer);
+	int ret = starlark_lex(ctx, name, src_len, src, &s->lexer);
 	if (ret != 0) {
 		return ret;
 	}
 
-	return 0;
+	return starlark_parse_tokens(ctx, &s->lexer, out);
 }
 
+static const char *Op_strs[] = {
+	[STARLARK_OP_ADD] = "+",      [STARLARK_OP_SUB] = "-",
+	[STARLARK_OP_MUL] = "*",      [STARLARK_OP_DIV] = "/",
+	[STARLARK_OP_FLOORDIV] = "//", [STARLARK_OP_MOD] = "%",
+	[STARLARK_OP_BITAND] = "&",   [STARLARK_OP_BITOR] = "|",
+	[STARLARK_OP_XOR] = "^",      [STARLARK_OP_LSHIFT] = "<<",
+	[STARLARK_OP_RSHIFT] = ">>",  [STARLARK_OP_EQ] = "==",
+	[STARLARK_OP_NOTEQ] = "!=",   [STARLARK_OP_LESS] = "<",
+	[STARLARK_OP_LEQ] = "<=",     [STARLARK_OP_GREATER] = ">",
+	[STARLARK_OP_GEQ] = ">=",     [STARLARK_OP_IN] = "in",
+	[STARLARK_OP_NOT_IN] = "not in", [STARLARK_OP_AND] = "and",
+	[STARLARK_OP_OR] = "or",      [STARLARK_OP_NOT] = "not",
+	[STARLARK_OP_BITNOT] = "~",
+};
+
+static const char *Scope_strs[] = {
+	[STARLARK_SCOPE_UNRESOLVED] = "unresolved",
+	[STARLARK_SCOPE_LOCAL] = "local",
+	[STARLARK_SCOPE_CELL] = "cell",
+	[STARLARK_SCOPE_FREE] = "free",
+	[STARLARK_SCOPE_GLOBAL] = "global",
+	[STARLARK_SCOPE_BUILTIN] = "builtin",
+};
+
+static const char *AstTag_strs[] = {
+	[STARLARK_NODE_TUPLE] = "TUPLE",
+	[STARLARK_NODE_LIST] = "LIST",
+	[STARLARK_NODE_DICT] = "DICT",
+	[STARLARK_NODE_DICT_ENTRY] = "ENTRY",
+	[STARLARK_NODE_LIST_COMP] = "LIST_COMP",
+	[STARLARK_NODE_DICT_COMP] = "DICT_COMP",
+	[STARLARK_NODE_COMP_FOR] = "COMP_FOR",
+	[STARLARK_NODE_COMP_IF] = "COMP_IF",
+	[STARLARK_NODE_UNARY] = "UNARY:",
+	[STARLARK_NODE_BINARY] = "BINARY:",
+	[STARLARK_NODE_COND] = "COND",
+	[STARLARK_NODE_LAMBDA] = "LAMBDA",
+	[STARLARK_NODE_CALL] = "CALL",
+	[STARLARK_NODE_ARG_NAMED] = "ARG_NAMED:",
+	[STARLARK_NODE_ARG_STAR] = "ARG_STAR",
+	[STARLARK_NODE_ARG_STARSTAR] = "ARG_STARSTAR",
+	[STARLARK_NODE_DOT] = "DOT:",
+	[STARLARK_NODE_INDEX] = "INDEX",
+	[STARLARK_NODE_SLICE] = "SLICE",
+	[STARLARK_NODE_EXPR_STMT] = "EXPR_STMT",
+	[STARLARK_NODE_ASSIGN] = "ASSIGN",
+	[STARLARK_NODE_AUG_ASSIGN] = "AUG_ASSIGN:",
+	[STARLARK_NODE_DEF] = "DEF",
+	[STARLARK_NODE_FUNCTION] = "FUNCTION",
+	[STARLARK_NODE_PARAM] = "PARAM",
+	[STARLARK_NODE_PARAM_STAR] = "PARAM_STAR",
+	[STARLARK_NODE_PARAM_STARSTAR] = "PARAM_STARSTAR",
+	[STARLARK_NODE_IF] = "IF",
+	[STARLARK_NODE_FOR] = "FOR",
+	[STARLARK_NODE_RETURN] = "RETURN",
+	[STARLARK_NODE_BREAK] = "BREAK",
+	[STARLARK_NODE_CONTINUE] = "CONTINUE",
+	[STARLARK_NODE_PASS] = "PASS",
+	[STARLARK_NODE_LOAD] = "LOAD",
+	[STARLARK_NODE_LOAD_BINDING] = "BINDING",
+	[STARLARK_NODE_BLOCK] = "BLOCK",
+};
+
 void starlark_node_dump(struct starlark_Parser *in,
 			const struct starlark_Node n, FILE *f)
 {
+	const union starlark_AstNode node = in->ast.nodes[n.idx];
 	switch (n.tag) {
 	case STARLARK_NODE_ERROR:
 		fprintf(f, "ERROR\n");
 		break;
 	case STARLARK_NODE_IDENTIFIER:
-		fprintf(f, "IDENTIFIER: %s\n",
-			in->ast.nodes[n.idx].as_identifier.str);
+		fprintf(f, "IDENTIFIER: %s",
+			strpool_get(&in->ctx->strpool,
+				    node.as_identifier.name));
+		if (node.as_identifier.scope != STARLARK_SCOPE_UNRESOLVED) {
+			fprintf(f, " (%s %" PRIu32 ")",
+				Scope_strs[node.as_identifier.scope],
+				node.as_identifier.index);
+		}
+		fprintf(f, "\n");
 		break;
 	case STARLARK_NODE_OPERAND:
 		fprintf(f, "OPERAND:    ");
 		break;
 	case STARLARK_NODE_INT: {
-		char *str = Int_to_str(in->ast.nodes[n.idx].as_int, 10);
+		char *str = Int_to_str(node.as_int, 10);
 		if (str == NULL) {
 			fprintf(f,
 				"INT:        (error retrieving INT value)\n");
@@ -750,64 +2196,240 @@ void starlark_node_dump(struct starlark_Parser *in,
 		break;
 	}
 	case STARLARK_NODE_FLOAT:
-		fprintf(f, "FLOAT:      %g\n", in->ast.nodes[n.idx].as_float);
+		fprintf(f, "FLOAT:      %g\n", node.as_float);
 		break;
 	case STARLARK_NODE_STRING:
-		fprintf(f, "STRING:     '%.*s'\n",
-			(int)in->ast.nodes[in->idx].as_str.len,
-			in->ast.nodes[n.idx].as_str.ptr);
+		fprintf(f, "STRING:     '%.*s'\n", (int)node.as_str.len,
+			node.as_str.ptr);
+		break;
+	case STARLARK_NODE_UNARY:
+		fprintf(f, "%-12s%s\n", AstTag_strs[n.tag],
+			Op_strs[node.as_unary.op]);
+		break;
+	case STARLARK_NODE_BINARY:
+		fprintf(f, "%-12s%s\n", AstTag_strs[n.tag],
+			Op_strs[node.as_binary.op]);
+		break;
+	case STARLARK_NODE_AUG_ASSIGN:
+		fprintf(f, "%-12s%s=\n", AstTag_strs[n.tag],
+			Op_strs[node.as_binary.op]);
+		break;
+	case STARLARK_NODE_ARG_NAMED:
+		fprintf(f, "%-12s%s\n", AstTag_strs[n.tag],
+			strpool_get(&in->ctx->strpool, node.as_named.name));
+		break;
+	case STARLARK_NODE_DOT:
+		fprintf(f, "%-12s%s\n", AstTag_strs[n.tag],
+			strpool_get(&in->ctx->strpool, node.as_dot.name));
 		break;
 	default:
-		fprintf(f, "UNKNOWN TAG: (node type %u)\n", n.tag);
+		if (n.tag < sizeof(AstTag_strs) / sizeof(AstTag_strs[0]) &&
+		    AstTag_strs[n.tag] != NULL) {
+			fprintf(f, "%s\n", AstTag_strs[n.tag]);
+		} else {
+			fprintf(f, "UNKNOWN TAG: (node type %u)\n", n.tag);
+		}
 		break;
 	}
 }
 
-void starlark_Parser_finish(struct starlark_Parser *in)
+static void tree_dump(struct starlark_Parser *in, const uint32_t idx,
+		      const int depth, FILE *f);
+
+static void list_dump(struct starlark_Parser *in, const uint32_t start,
+		      const uint32_t len, const int depth, FILE *f)
 {
-	if (in == NULL) {
+	for (uint32_t i = 0; i < len; i += 1) {
+		tree_dump(in, in->extra[start + i], depth, f);
+	}
+}
+
+// Dumps the node at idx and its children, each indented one level further than
+// its parent.
+static void tree_dump(struct starlark_Parser *in, const uint32_t idx,
+		      const int depth, FILE *f)
+{
+	const enum starlark_AstTag tag = in->ast.tags[idx];
+	const union starlark_AstNode node = in->ast.nodes[in->ast.idxs[idx]];
+
+	// Statements which are just an expression are shown as the
+	// expression.
+	if (tag == STARLARK_NODE_EXPR_STMT) {
+		tree_dump(in, node.as_unary.operand, depth, f);
 		return;
 	}
 
+	fprintf(f, "%*s", depth * 2, "");
+	struct starlark_Node n = {
+		.idx = in->ast.idxs[idx],
+		.tag = tag,
+	};
+	starlark_node_dump(in, n, f);
+
+	uint32_t children[4] = {
+		STARLARK_NODE_NONE,
+		STARLARK_NODE_NONE,
+		STARLARK_NODE_NONE,
+		STARLARK_NODE_NONE,
+	};
+	switch (tag) {
+	case STARLARK_NODE_TUPLE:
+	case STARLARK_NODE_LIST:
+	case STARLARK_NODE_DICT:
+	case STARLARK_NODE_BLOCK:
+		list_dump(in, node.as_list.start, node.as_list.len, depth + 1,
+			  f);
+		return;
+	case STARLARK_NODE_LIST_COMP:
+	case STARLARK_NODE_DICT_COMP:
+		tree_dump(in, node.as_comp.body, depth + 1, f);
+		list_dump(in, node.as_comp.clauses, node.as_comp.clauses_len,
+			  depth + 1, f);
+		return;
+	case STARLARK_NODE_CALL:
+		tree_dump(in, node.as_call.fn, depth + 1, f);
+		list_dump(in, node.as_call.args, node.as_call.args_len,
+			  depth + 1, f);
+		return;
+	case STARLARK_NODE_LAMBDA:
+	case STARLARK_NODE_FUNCTION:
+		list_dump(in, node.as_func.params, node.as_func.params_len,
+			  depth + 1, f);
+		tree_dump(in, node.as_func.body, depth + 1, f);
+		return;
+	case STARLARK_NODE_LOAD:
+		tree_dump(in, node.as_load.module, depth + 1, f);
+		list_dump(in, node.as_load.bindings, node.as_load.bindings_len,
+			  depth + 1, f);
+		return;
+	case STARLARK_NODE_UNARY:
+	case STARLARK_NODE_COMP_IF:
+	case STARLARK_NODE_ARG_STAR:
+	case STARLARK_NODE_ARG_STARSTAR:
+	case STARLARK_NODE_PARAM_STAR:
+	case STARLARK_NODE_PARAM_STARSTAR:
+	case STARLARK_NODE_RETURN:
+		children[0] = node.as_unary.operand;
+		break;
+	case STARLARK_NODE_BINARY:
+	case STARLARK_NODE_DICT_ENTRY:
+	case STARLARK_NODE_INDEX:
+	case STARLARK_NODE_ASSIGN:
+	case STARLARK_NODE_AUG_ASSIGN:
+	case STARLARK_NODE_DEF:
+	case STARLARK_NODE_PARAM:
+	case STARLARK_NODE_LOAD_BINDING:
+		children[0] = node.as_binary.lhs;
+		children[1] = node.as_binary.rhs;
+		break;
+	case STARLARK_NODE_COND:
+	case STARLARK_NODE_IF:
+		children[0] = node.as_cond.cond;
+		children[1] = node.as_cond.then;
+		children[2] = node.as_cond.otherwise;
+		break;
+	case STARLARK_NODE_FOR:
+	case STARLARK_NODE_COMP_FOR:
+		children[0] = node.as_for.vars;
+		children[1] = node.as_for.iterable;
+		children[2] = node.as_for.body;
+		break;
+	case STARLARK_NODE_ARG_NAMED:
+		children[0] = node.as_named.value;
+		break;
+	case STARLARK_NODE_DOT:
+		children[0] = node.as_dot.operand;
+		break;
+	case STARLARK_NODE_SLICE:
+		// A missing part of a slice is shown, so that it's clear which
+		// part each child is.
+		tree_dump(in, node.as_slice.operand, depth + 1, f);
+		const uint32_t parts[] = {
+			node.as_slice.lo,
+			node.as_slice.hi,
+			node.as_slice.step,
+		};
+		for (size_t i = 0; i < 3; i += 1) {
+			if (parts[i] == STARLARK_NODE_NONE) {
+				fprintf(f, "%*sNONE\n", (depth + 1) * 2, "");
+			} else {
+				tree_dump(in, parts[i], depth + 1, f);
+			}
+		}
+		return;
+	default:
+		return;
+	}
+
+	for (size_t i = 0; i < 4; i += 1) {
+		if (children[i] != STARLARK_NODE_NONE) {
+			tree_dump(in, children[i], depth + 1, f);
+		}
+	}
+}
+
+// Frees whatever each node in the ast owns.
+static void free_nodes(struct starlark_Parser *in)
+{
 	for (size_t i = 0; i < in->ast_len; i += 1) {
 		switch (in->ast.tags[i]) {
-		case STARLARK_NODE_ERROR:
-			break;
-		case STARLARK_NODE_IDENTIFIER:
-			free(in->ast.nodes[in->ast.idxs[i]].as_identifier.str);
-			break;
-		case STARLARK_NODE_FLOAT:
-			break;
 		case STARLARK_NODE_INT:
 			Int_destroy(in->ast.nodes[in->ast.idxs[i]].as_int);
 			break;
 		case STARLARK_NODE_STRING:
 			free(in->ast.nodes[in->ast.idxs[i]].as_str.ptr);
 			break;
-		default: {
-			struct starlark_Node n = {
-				.idx = in->ast.idxs[i],
-				.tag = in->ast.tags[i],
-			};
-			fprintf(stderr, "don't know how to free node type!\n");
-			starlark_node_dump(in, n, stderr);
-			unimplemented();
-		}
+		default:
+			break;
 		}
 	}
+}
+
+void starlark_Parser_reset(struct starlark_Parser *in)
+{
+	assert(in != NULL);
+
+	free_nodes(in);
+	in->ctx = NULL;
+	in->l = NULL;
+	in->idx = SIZE_MAX;
+	in->depth = 0;
+	in->recovering = false;
+	in->root = STARLARK_NODE_NONE;
+	in->ast_len = 0;
+	in->extra_len = 0;
+	in->scratch_len = 0;
+}
 
+void starlark_Parser_finish(struct starlark_Parser *in)
+{
+	if (in == NULL) {
+		return;
+	}
+
+	free_nodes(in);
 	free(in->ast.tags);
+	free(in->extra);
+	free(in->scratch);
+	in->ast.tags = NULL;
+	in->ast_len = 0;
+	in->ast_cap = 0;
+	in->extra = NULL;
+	in->extra_len = 0;
+	in->extra_cap = 0;
+	in->scratch = NULL;
+	in->scratch_len = 0;
+	in->scratch_cap = 0;
 }
 
 void starlark_ast_dump(struct starlark_Parser *in, FILE *f)
 {
-	// TODO: traverse AST instead of doing this
-	for (size_t i = 0; i < in->ast_len; i += 1) {
-		struct starlark_Node n = {
-			.idx = in->ast.idxs[i],
-			.tag = in->ast.tags[i],
-		};
-
-		starlark_node_dump(in, n, f);
+	if (in->ast_len == 0 || in->root == STARLARK_NODE_NONE) {
+		return;
 	}
+
+	// The file's block isn't shown, only the statements in it.
+	const size_t idx = in->ast.idxs[in->root];
+	const union starlark_AstNode root = in->ast.nodes[idx];
+	list_dump(in, root.as_list.start, root.as_list.len, 0, f);
 }
@@ -0,0 +1,960 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "starlark/resolve.h"
+#include "starlark/builtins.h"
+#include "starlark/common.h"
+#include "starlark/parse.h"
+#include "starlark/strpool.h"
+#include "starlark/util.h"
+#include "util/common.h"
+
+// A name bound in a function or comprehension which is being resolved.
+struct binding {
+	int64_t name;
+	// Which of the active functions the name is a local of.
+	size_t level;
+	uint32_t index;
+	// Whether a nested function refers to the name, making it a cell.
+	bool captured;
+};
+
+// A function whose body is being resolved.
+struct active {
+	uint32_t function;
+	uint32_t node;
+	uint32_t locals_len;
+	// Where this function's part of each of the resolver's stacks starts.
+	size_t bindings_start;
+	size_t uses_start;
+	size_t cells_start;
+
+	size_t frees_len;
+	size_t frees_cap;
+	struct starlark_FreeVar *frees;
+
+	// The name of each of the locals_len locals.
+	size_t local_names_cap;
+	int64_t *local_names;
+};
+
+struct resolver {
+	struct starlark_Context *ctx;
+	struct starlark_Parser *p;
+	struct starlark_Resolver *out;
+
+	// The strpool handle of each builtin's name.
+	int64_t builtins[BUILTIN_COUNT];
+
+	// An open-addressed table mapping the name of each global to its slot
+	// plus one, so that an empty slot is 0. Always a power of two long.
+	size_t table_cap;
+	uint32_t *table;
+
+	// The names bound in each of the blocks being resolved, innermost
+	// last.
+	size_t bindings_len;
+	size_t bindings_cap;
+	struct binding *bindings;
+	// Where the innermost block's bindings start.
+	size_t block_start;
+
+	// The identifiers resolved to locals in each active function. If a
+	// local turns out to be captured later on, they're changed to refer
+	// to its cell instead.
+	size_t uses_len;
+	size_t uses_cap;
+	uint32_t *uses;
+
+	// The captured locals of each active function.
+	size_t cells_len;
+	size_t cells_cap;
+	uint32_t *cells;
+
+	size_t active_len;
+	size_t active_cap;
+	struct active *active;
+
+	// How many loops, blocks and comprehensions the node being resolved
+	// is inside of, within the innermost function.
+	size_t loops;
+	size_t blocks;
+	size_t comprehensions;
+};
+
+// Returns ptr, an array of cap elements of size bytes each, grown to have room
+// for more than len of them.
+// Returns NULL if we couldn't allocate enough memory, leaving ptr as it was.
+static void *grow(struct resolver *r, void *ptr, size_t *cap, const size_t len,
+		  const size_t size)
+{
+	if (len < *cap) {
+		return ptr;
+	}
+
+	if (*cap >= UINT32_MAX / 2) {
+		r->ctx->err = STARLARK_ERROR_TOOBIG;
+		return NULL;
+	}
+
+	const size_t new_cap = MAX((*cap + 16) * 2, len + 1);
+	void *result = realloc(ptr, new_cap * size);
+	if (result == NULL) {
+		r->ctx->err = STARLARK_ERROR_OOM;
+		return NULL;
+	}
+
+	*cap = new_cap;
+	return result;
+}
+
+static union starlark_AstNode *node_at(struct resolver *r, const uint32_t node)
+{
+	return &r->p->ast.nodes[r->p->ast.idxs[node]];
+}
+
+static enum starlark_AstTag tag_at(struct resolver *r, const uint32_t node)
+{
+	return r->p->ast.tags[node];
+}
+
+static uint32_t child(struct resolver *r, const uint32_t start,
+		      const uint32_t i)
+{
+	return r->p->extra[start + i];
+}
+
+// Reports an error about node. len is the length of the source quoted in the
+// error message, if it has one.
+static void report(struct resolver *r, const enum starlark_ErrorCode code,
+		   const uint32_t node, const size_t len)
+{
+	const size_t start = r->p->ast.starts[node];
+	struct starlark_Error err = {
+		.code = code,
+		.start = start,
+		.arg.span.start = start,
+		.arg.span.len = len,
+	};
+	if (!err_append(r->ctx, err)) {
+		r->ctx->err = STARLARK_ERROR_OOM;
+	}
+}
+
+static struct active *innermost(struct resolver *r)
+{
+	return &r->active[r->active_len - 1];
+}
+
+// Returns the entry of the globals table for name, which is 0 if it isn't a
+// global.
+static uint32_t *global_entry(struct resolver *r, const int64_t name)
+{
+	const size_t mask = r->table_cap - 1;
+	// Handles are offsets into the strpool, so they need mixing up before
+	// their low bits can be used.
+	size_t i = ((uint64_t)name * UINT64_C(0x9e3779b97f4a7c15)) >> 32;
+	for (i &= mask;; i = (i + 1) & mask) {
+		const uint32_t entry = r->table[i];
+		if (entry == 0 || r->out->globals[entry - 1] == name) {
+			return &r->table[i];
+		}
+	}
+}
+
+// Doubles the size of the globals table.
+// Returns false if we couldn't allocate enough memory.
+static bool table_grow(struct resolver *r)
+{
+	const size_t cap = r->table_cap == 0 ? 64 : r->table_cap * 2;
+	uint32_t *table = calloc(cap, sizeof(table[0]));
+	if (table == NULL) {
+		r->ctx->err = STARLARK_ERROR_OOM;
+		return false;
+	}
+
+	free(r->table);
+	r->table = table;
+	r->table_cap = cap;
+	for (size_t i = 0; i < r->out->globals_len; i += 1) {
+		*global_entry(r, r->out->globals[i]) = i + 1;
+	}
+
+	return true;
+}
+
+// Binds name in the module's table of globals, unless it already is.
+static void add_global(struct resolver *r, const int64_t name)
+{
+	struct starlark_Resolver *out = r->out;
+	if ((out->globals_len + 1) * 4 > r->table_cap * 3 && !table_grow(r)) {
+		return;
+	}
+
+	uint32_t *entry = global_entry(r, name);
+	if (*entry != 0) {
+		return;
+	}
+
+	int64_t *globals = grow(r, out->globals, &out->globals_cap,
+				out->globals_len, sizeof(out->globals[0]));
+	if (globals == NULL) {
+		return;
+	}
+
+	out->globals = globals;
+	out->globals[out->globals_len] = name;
+	out->globals_len += 1;
+	*entry = out->globals_len;
+}
+
+// Returns the binding of name in the innermost block, or NULL if it isn't
+// bound there.
+static struct binding *find_in_block(struct resolver *r, const int64_t name)
+{
+	for (size_t i = r->block_start; i < r->bindings_len; i += 1) {
+		if (r->bindings[i].name == name) {
+			return &r->bindings[i];
+		}
+	}
+
+	return NULL;
+}
+
+// Binds name to a new local of the innermost function, in the innermost
+// block, unless it already is.
+static void bind_local(struct resolver *r, const int64_t name)
+{
+	if (find_in_block(r, name) != NULL) {
+		return;
+	}
+
+	struct binding *bindings = grow(r, r->bindings, &r->bindings_cap,
+					r->bindings_len, sizeof(bindings[0]));
+	if (bindings == NULL) {
+		return;
+	}
+
+	struct active *a = innermost(r);
+	r->bindings = bindings;
+	int64_t *names = grow(r, a->local_names, &a->local_names_cap,
+			      a->locals_len, sizeof(names[0]));
+	if (names == NULL) {
+		return;
+	}
+
+	a->local_names = names;
+	a->local_names[a->locals_len] = name;
+	r->bindings[r->bindings_len] = (struct binding){
+		.name = name,
+		.level = r->active_len - 1,
+		.index = a->locals_len,
+	};
+	r->bindings_len += 1;
+	a->locals_len += 1;
+}
+
+// Binds the name of the identifier node in the innermost block. Names assigned
+// at the top level of the module are globals, and everything else is a local.
+static void bind(struct resolver *r, const uint32_t node)
+{
+	const int64_t name = node_at(r, node)->as_identifier.name;
+	if (r->active_len == 1 && r->comprehensions == 0) {
+		add_global(r, name);
+	} else {
+		bind_local(r, name);
+	}
+}
+
+// Binds every identifier assigned to by the target node.
+static void bind_targets(struct resolver *r, const uint32_t node)
+{
+	const union starlark_AstNode *n = node_at(r, node);
+	switch (tag_at(r, node)) {
+	case STARLARK_NODE_IDENTIFIER:
+		bind(r, node);
+		break;
+	case STARLARK_NODE_TUPLE:
+	case STARLARK_NODE_LIST:
+		for (uint32_t i = 0; i < n->as_list.len; i += 1) {
+			bind_targets(r, child(r, n->as_list.start, i));
+		}
+		break;
+	default:
+		// Assigning to an attribute or index doesn't bind anything.
+		break;
+	}
+}
+
+// Binds every name assigned to anywhere in a block of statements, not counting
+// nested functions and comprehensions, which have their own blocks. A name is
+// local to the whole block, even before it's assigned to.
+static void bind_block(struct resolver *r, const uint32_t node)
+{
+	if (node == STARLARK_NODE_NONE) {
+		return;
+	}
+
+	const union starlark_AstNode *n = node_at(r, node);
+	switch (tag_at(r, node)) {
+	case STARLARK_NODE_BLOCK:
+		for (uint32_t i = 0; i < n->as_list.len; i += 1) {
+			bind_block(r, child(r, n->as_list.start, i));
+		}
+		break;
+	case STARLARK_NODE_ASSIGN:
+	case STARLARK_NODE_AUG_ASSIGN:
+		bind_targets(r, n->as_binary.lhs);
+		break;
+	case STARLARK_NODE_FOR:
+		bind_targets(r, n->as_for.vars);
+		bind_block(r, n->as_for.body);
+		break;
+	case STARLARK_NODE_IF:
+		bind_block(r, n->as_cond.then);
+		bind_block(r, n->as_cond.otherwise);
+		break;
+	case STARLARK_NODE_DEF:
+		bind(r, n->as_binary.lhs);
+		break;
+	case STARLARK_NODE_LOAD:
+		for (uint32_t i = 0; i < n->as_load.bindings_len; i += 1) {
+			const uint32_t b = child(r, n->as_load.bindings, i);
+			bind(r, node_at(r, b)->as_binary.lhs);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+// Removes the bindings of the innermost block, which starts at start,
+// remembering which of them are cells.
+static void pop_block(struct resolver *r, const size_t start)
+{
+	for (size_t i = start; i < r->bindings_len; i += 1) {
+		if (!r->bindings[i].captured) {
+			continue;
+		}
+
+		uint32_t *cells = grow(r, r->cells, &r->cells_cap,
+				       r->cells_len, sizeof(cells[0]));
+		if (cells == NULL) {
+			return;
+		}
+
+		r->cells = cells;
+		r->cells[r->cells_len] = r->bindings[i].index;
+		r->cells_len += 1;
+	}
+
+	r->bindings_len = start;
+}
+
+// Returns the index of name among the free variables of a, adding it with the
+// scope and index it has in the enclosing function if it isn't there yet.
+static uint32_t add_free(struct resolver *r, struct active *a,
+			 const int64_t name, const enum starlark_Scope scope,
+			 const uint32_t index)
+{
+	for (size_t i = 0; i < a->frees_len; i += 1) {
+		if (a->frees[i].name == name) {
+			return i;
+		}
+	}
+
+	struct starlark_FreeVar *frees = grow(r, a->frees, &a->frees_cap,
+					      a->frees_len, sizeof(frees[0]));
+	if (frees == NULL) {
+		return 0;
+	}
+
+	a->frees = frees;
+	a->frees[a->frees_len] = (struct starlark_FreeVar){
+		.name = name,
+		.scope = scope,
+		.index = index,
+	};
+	a->frees_len += 1;
+	return a->frees_len - 1;
+}
+
+// Makes the local bound by b available to the innermost function, through a
+// free variable in each function between them.
+// Returns the index of the free variable in the innermost function.
+static uint32_t capture(struct resolver *r, struct binding *b)
+{
+	b->captured = true;
+	enum starlark_Scope scope = STARLARK_SCOPE_CELL;
+	uint32_t index = b->index;
+	for (size_t level = b->level + 1; level < r->active_len; level += 1) {
+		index = add_free(r, &r->active[level], b->name, scope, index);
+		scope = STARLARK_SCOPE_FREE;
+	}
+
+	return index;
+}
+
+// Binds the identifier node to the innermost binding of its name.
+static void resolve_name(struct resolver *r, const uint32_t node)
+{
+	union starlark_AstNode *n = node_at(r, node);
+	const int64_t name = n->as_identifier.name;
+	for (size_t i = r->bindings_len; i > 0; i -= 1) {
+		struct binding *b = &r->bindings[i - 1];
+		if (b->name != name) {
+			continue;
+		}
+
+		if (b->level != r->active_len - 1) {
+			n->as_identifier.scope = STARLARK_SCOPE_FREE;
+			n->as_identifier.index = capture(r, b);
+			return;
+		}
+
+		uint32_t *uses = grow(r, r->uses, &r->uses_cap, r->uses_len,
+				      sizeof(uses[0]));
+		if (uses == NULL) {
+			return;
+		}
+
+		r->uses = uses;
+		r->uses[r->uses_len] = node;
+		r->uses_len += 1;
+		n->as_identifier.scope = STARLARK_SCOPE_LOCAL;
+		n->as_identifier.index = b->index;
+		return;
+	}
+
+	const uint32_t global = r->table_cap != 0 ? *global_entry(r, name) : 0;
+	if (global != 0) {
+		n->as_identifier.scope = STARLARK_SCOPE_GLOBAL;
+		n->as_identifier.index = global - 1;
+		return;
+	}
+
+	for (uint32_t i = 0; i < BUILTIN_COUNT; i += 1) {
+		if (r->builtins[i] == name) {
+			n->as_identifier.scope = STARLARK_SCOPE_BUILTIN;
+			n->as_identifier.index = i;
+			return;
+		}
+	}
+
+	report(r, STARLARK_ERRORCODE_UNDEFINED_NAME, node,
+	       strlen(strpool_get(&r->ctx->strpool, name)));
+}
+
+// Starts resolving the body of the function node, which is STARLARK_NODE_NONE
+// for the module's top level.
+// Returns false if we couldn't allocate enough memory.
+static bool start_function(struct resolver *r, const uint32_t node)
+{
+	struct starlark_Resolver *out = r->out;
+	struct starlark_ResolvedFunction *functions =
+		grow(r, out->functions, &out->functions_cap,
+		     out->functions_len, sizeof(functions[0]));
+	if (functions == NULL) {
+		return false;
+	}
+
+	out->functions = functions;
+	struct active *active = grow(r, r->active, &r->active_cap,
+				     r->active_len, sizeof(active[0]));
+	if (active == NULL) {
+		return false;
+	}
+
+	r->active = active;
+	r->active[r->active_len] = (struct active){
+		.function = out->functions_len,
+		.node = node,
+		.bindings_start = r->bindings_len,
+		.uses_start = r->uses_len,
+		.cells_start = r->cells_len,
+	};
+	r->active_len += 1;
+	out->functions[out->functions_len] = (struct starlark_ResolvedFunction){
+		.node = node,
+	};
+	out->functions_len += 1;
+	r->block_start = r->bindings_len;
+	return true;
+}
+
+// Finishes resolving the innermost function, storing what was found out about
+// it.
+static void finish_function(struct resolver *r)
+{
+	struct active *a = innermost(r);
+	struct starlark_Resolver *out = r->out;
+	pop_block(r, a->bindings_start);
+
+	// Now that every nested function has been resolved, the locals which
+	// any of them captured are known, so the uses of those locals can be
+	// changed to refer to their cells.
+	bool *is_cell = calloc(MAX(a->locals_len, 1), sizeof(bool));
+	if (is_cell == NULL) {
+		r->ctx->err = STARLARK_ERROR_OOM;
+	} else {
+		for (size_t i = a->cells_start; i < r->cells_len; i += 1) {
+			is_cell[r->cells[i]] = true;
+		}
+
+		for (size_t i = a->uses_start; i < r->uses_len; i += 1) {
+			union starlark_AstNode *n = node_at(r, r->uses[i]);
+			if (is_cell[n->as_identifier.index]) {
+				n->as_identifier.scope = STARLARK_SCOPE_CELL;
+			}
+		}
+
+		free(is_cell);
+	}
+
+	struct starlark_ResolvedFunction *f = &out->functions[a->function];
+	f->locals_len = a->locals_len;
+	f->locals_start = out->local_names_len;
+	f->frees_start = out->frees_len;
+	f->frees_len = a->frees_len;
+	f->cells_start = out->cells_len;
+	f->cells_len = r->cells_len - a->cells_start;
+
+	struct starlark_FreeVar *frees = grow(r, out->frees, &out->frees_cap,
+					      out->frees_len + a->frees_len,
+					      sizeof(frees[0]));
+	uint32_t *cells = grow(r, out->cells, &out->cells_cap,
+			       out->cells_len + f->cells_len,
+			       sizeof(cells[0]));
+	int64_t *names = grow(r, out->local_names, &out->local_names_cap,
+			      out->local_names_len + a->locals_len,
+			      sizeof(names[0]));
+	if (frees != NULL) {
+		out->frees = frees;
+	}
+	if (cells != NULL) {
+		out->cells = cells;
+	}
+	if (names != NULL) {
+		out->local_names = names;
+	}
+
+	if (frees != NULL && a->frees_len != 0) {
+		memcpy(&out->frees[out->frees_len], a->frees,
+		       a->frees_len * sizeof(a->frees[0]));
+		out->frees_len += a->frees_len;
+	}
+
+	if (cells != NULL && f->cells_len != 0) {
+		memcpy(&out->cells[out->cells_len], &r->cells[a->cells_start],
+		       f->cells_len * sizeof(r->cells[0]));
+		out->cells_len += f->cells_len;
+	}
+
+	if (names != NULL && a->locals_len != 0) {
+		memcpy(&out->local_names[out->local_names_len],
+		       a->local_names,
+		       a->locals_len * sizeof(a->local_names[0]));
+		out->local_names_len += a->locals_len;
+	}
+
+	free(a->frees);
+	free(a->local_names);
+	r->uses_len = a->uses_start;
+	r->cells_len = a->cells_start;
+	r->active_len -= 1;
+}
+
+static void resolve_expr(struct resolver *r, const uint32_t node);
+static void resolve_stmt(struct resolver *r, const uint32_t node);
+
+static void resolve_list(struct resolver *r, const uint32_t start,
+			 const uint32_t len)
+{
+	for (uint32_t i = 0; i < len; i += 1) {
+		resolve_expr(r, child(r, start, i));
+	}
+}
+
+// Reports an error unless the parameters are required ones, then optional
+// ones, then *args or a bare *, then **kwargs. The parameters after * can be
+// either required or optional, since they can only be passed by name, but a
+// bare * must be followed by at least one of them.
+static void check_params(struct resolver *r, const uint32_t params,
+			 const uint32_t len)
+{
+	enum {
+		SEEN_REQUIRED,
+		SEEN_OPTIONAL,
+		SEEN_STAR,
+		SEEN_STARSTAR,
+	} seen = SEEN_REQUIRED;
+
+	for (uint32_t i = 0; i < len; i += 1) {
+		const uint32_t param = child(r, params, i);
+		const union starlark_AstNode *n = node_at(r, param);
+		bool ok = true;
+		switch (tag_at(r, param)) {
+		case STARLARK_NODE_PARAM_STAR:
+			ok = seen < SEEN_STAR;
+			if (n->as_unary.operand == STARLARK_NODE_NONE) {
+				ok = ok && i + 1 < len &&
+				     tag_at(r, child(r, params, i + 1)) ==
+					     STARLARK_NODE_PARAM;
+			}
+			seen = SEEN_STAR;
+			break;
+		case STARLARK_NODE_PARAM_STARSTAR:
+			ok = seen < SEEN_STARSTAR;
+			seen = SEEN_STARSTAR;
+			break;
+		default:
+			if (seen == SEEN_STARSTAR) {
+				ok = false;
+			} else if (n->as_binary.rhs != STARLARK_NODE_NONE) {
+				seen = MAX(seen, SEEN_OPTIONAL);
+			} else {
+				ok = seen != SEEN_OPTIONAL;
+			}
+			break;
+		}
+
+		if (!ok) {
+			report(r, STARLARK_ERRORCODE_PARAM_ORDER, param, 0);
+			return;
+		}
+	}
+}
+
+// Resolves a STARLARK_NODE_FUNCTION or STARLARK_NODE_LAMBDA. The default
+// values of its parameters are resolved in the enclosing block, and everything
+// else in the function's own block.
+static void resolve_function(struct resolver *r, const uint32_t node)
+{
+	union starlark_AstNode *n = node_at(r, node);
+	const uint32_t params = n->as_func.params;
+	const uint32_t params_len = n->as_func.params_len;
+	for (uint32_t i = 0; i < params_len; i += 1) {
+		const uint32_t param = child(r, params, i);
+		if (tag_at(r, param) == STARLARK_NODE_PARAM &&
+		    node_at(r, param)->as_binary.rhs != STARLARK_NODE_NONE) {
+			resolve_expr(r, node_at(r, param)->as_binary.rhs);
+		}
+	}
+
+	check_params(r, params, params_len);
+
+	const size_t block_start = r->block_start;
+	const size_t loops = r->loops;
+	const size_t blocks = r->blocks;
+	const size_t comprehensions = r->comprehensions;
+	if (!start_function(r, node)) {
+		return;
+	}
+
+	n->as_func.function = innermost(r)->function;
+	r->loops = 0;
+	r->blocks = 0;
+	r->comprehensions = 0;
+
+	// The named parameters are the first locals, in order, followed by
+	// *args and then **kwargs, which is the order a call fills them in.
+	const enum starlark_AstTag kinds[] = {
+		STARLARK_NODE_PARAM,
+		STARLARK_NODE_PARAM_STAR,
+		STARLARK_NODE_PARAM_STARSTAR,
+	};
+	for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k += 1) {
+		for (uint32_t i = 0; i < params_len; i += 1) {
+			const uint32_t param = child(r, params, i);
+			if (tag_at(r, param) != kinds[k]) {
+				continue;
+			}
+
+			const union starlark_AstNode *p = node_at(r, param);
+			const uint32_t ident = kinds[k] == STARLARK_NODE_PARAM ?
+						       p->as_binary.lhs :
+						       p->as_unary.operand;
+			if (ident == STARLARK_NODE_NONE) {
+				continue;
+			}
+
+			const int64_t name =
+				node_at(r, ident)->as_identifier.name;
+			if (find_in_block(r, name) != NULL) {
+				report(r, STARLARK_ERRORCODE_DUPLICATE_PARAM,
+				       ident,
+				       strlen(strpool_get(&r->ctx->strpool,
+							  name)));
+			}
+
+			bind_local(r, name);
+			resolve_name(r, ident);
+		}
+	}
+
+	if (tag_at(r, node) == STARLARK_NODE_LAMBDA) {
+		resolve_expr(r, n->as_func.body);
+	} else {
+		bind_block(r, n->as_func.body);
+		resolve_stmt(r, n->as_func.body);
+	}
+
+	finish_function(r);
+	r->block_start = block_start;
+	r->loops = loops;
+	r->blocks = blocks;
+	r->comprehensions = comprehensions;
+}
+
+// Resolves a list or dict comprehension, whose loop variables are bound in a
+// block of their own.
+static void resolve_comprehension(struct resolver *r, const uint32_t node)
+{
+	const union starlark_AstNode n = *node_at(r, node);
+
+	// The first iterable is evaluated before any of the comprehension's
+	// variables are bound.
+	const uint32_t first = child(r, n.as_comp.clauses, 0);
+	resolve_expr(r, node_at(r, first)->as_for.iterable);
+
+	const size_t block_start = r->block_start;
+	r->block_start = r->bindings_len;
+	r->comprehensions += 1;
+	for (uint32_t i = 0; i < n.as_comp.clauses_len; i += 1) {
+		const uint32_t clause = child(r, n.as_comp.clauses, i);
+		const union starlark_AstNode c = *node_at(r, clause);
+		if (tag_at(r, clause) == STARLARK_NODE_COMP_IF) {
+			resolve_expr(r, c.as_unary.operand);
+			continue;
+		}
+
+		if (i != 0) {
+			resolve_expr(r, c.as_for.iterable);
+		}
+
+		bind_targets(r, c.as_for.vars);
+		resolve_expr(r, c.as_for.vars);
+	}
+
+	resolve_expr(r, n.as_comp.body);
+	pop_block(r, r->block_start);
+	r->block_start = block_start;
+	r->comprehensions -= 1;
+}
+
+static void resolve_expr(struct resolver *r, const uint32_t node)
+{
+	if (node == STARLARK_NODE_NONE || r->ctx->err) {
+		return;
+	}
+
+	const union starlark_AstNode n = *node_at(r, node);
+	switch (tag_at(r, node)) {
+	case STARLARK_NODE_IDENTIFIER:
+		resolve_name(r, node);
+		break;
+	case STARLARK_NODE_TUPLE:
+	case STARLARK_NODE_LIST:
+	case STARLARK_NODE_DICT:
+		resolve_list(r, n.as_list.start, n.as_list.len);
+		break;
+	case STARLARK_NODE_DICT_ENTRY:
+	case STARLARK_NODE_BINARY:
+	case STARLARK_NODE_INDEX:
+		resolve_expr(r, n.as_binary.lhs);
+		resolve_expr(r, n.as_binary.rhs);
+		break;
+	case STARLARK_NODE_LIST_COMP:
+	case STARLARK_NODE_DICT_COMP:
+		resolve_comprehension(r, node);
+		break;
+	case STARLARK_NODE_UNARY:
+	case STARLARK_NODE_ARG_STAR:
+	case STARLARK_NODE_ARG_STARSTAR:
+		resolve_expr(r, n.as_unary.operand);
+		break;
+	case STARLARK_NODE_COND:
+		resolve_expr(r, n.as_cond.cond);
+		resolve_expr(r, n.as_cond.then);
+		resolve_expr(r, n.as_cond.otherwise);
+		break;
+	case STARLARK_NODE_LAMBDA:
+		resolve_function(r, node);
+		break;
+	case STARLARK_NODE_CALL:
+		resolve_expr(r, n.as_call.fn);
+		resolve_list(r, n.as_call.args, n.as_call.args_len);
+		break;
+	case STARLARK_NODE_ARG_NAMED:
+		resolve_expr(r, n.as_named.value);
+		break;
+	case STARLARK_NODE_DOT:
+		resolve_expr(r, n.as_dot.operand);
+		break;
+	case STARLARK_NODE_SLICE:
+		resolve_expr(r, n.as_slice.operand);
+		resolve_expr(r, n.as_slice.lo);
+		resolve_expr(r, n.as_slice.hi);
+		resolve_expr(r, n.as_slice.step);
+		break;
+	default:
+		// Literals don't refer to any names.
+		break;
+	}
+}
+
+static void resolve_stmt(struct resolver *r, const uint32_t node)
+{
+	if (node == STARLARK_NODE_NONE || r->ctx->err) {
+		return;
+	}
+
+	const union starlark_AstNode n = *node_at(r, node);
+	switch (tag_at(r, node)) {
+	case STARLARK_NODE_BLOCK:
+		for (uint32_t i = 0; i < n.as_list.len; i += 1) {
+			resolve_stmt(r, child(r, n.as_list.start, i));
+		}
+		break;
+	case STARLARK_NODE_EXPR_STMT:
+		resolve_expr(r, n.as_unary.operand);
+		break;
+	case STARLARK_NODE_ASSIGN:
+		resolve_expr(r, n.as_binary.rhs);
+		resolve_expr(r, n.as_binary.lhs);
+		break;
+	case STARLARK_NODE_AUG_ASSIGN:
+		resolve_expr(r, n.as_binary.lhs);
+		resolve_expr(r, n.as_binary.rhs);
+		break;
+	case STARLARK_NODE_DEF:
+		resolve_expr(r, n.as_binary.lhs);
+		resolve_function(r, n.as_binary.rhs);
+		break;
+	case STARLARK_NODE_IF:
+		resolve_expr(r, n.as_cond.cond);
+		r->blocks += 1;
+		resolve_stmt(r, n.as_cond.then);
+		resolve_stmt(r, n.as_cond.otherwise);
+		r->blocks -= 1;
+		break;
+	case STARLARK_NODE_FOR:
+		resolve_expr(r, n.as_for.iterable);
+		resolve_expr(r, n.as_for.vars);
+		r->blocks += 1;
+		r->loops += 1;
+		resolve_stmt(r, n.as_for.body);
+		r->loops -= 1;
+		r->blocks -= 1;
+		break;
+	case STARLARK_NODE_RETURN:
+		if (innermost(r)->node == STARLARK_NODE_NONE) {
+			report(r, STARLARK_ERRORCODE_RETURN_OUTSIDE_FUNCTION,
+			       node, 0);
+		}
+
+		resolve_expr(r, n.as_unary.operand);
+		break;
+	case STARLARK_NODE_BREAK:
+		if (r->loops == 0) {
+			report(r, STARLARK_ERRORCODE_OUTSIDE_LOOP, node,
+			       strlen(u8"break"));
+		}
+		break;
+	case STARLARK_NODE_CONTINUE:
+		if (r->loops == 0) {
+			report(r, STARLARK_ERRORCODE_OUTSIDE_LOOP, node,
+			       strlen(u8"continue"));
+		}
+		break;
+	case STARLARK_NODE_LOAD:
+		if (r->active_len != 1 || r->blocks != 0) {
+			report(r, STARLARK_ERRORCODE_LOAD_NOT_AT_TOP, node, 0);
+		}
+
+		for (uint32_t i = 0; i < n.as_load.bindings_len; i += 1) {
+			const uint32_t b = child(r, n.as_load.bindings, i);
+			resolve_expr(r, node_at(r, b)->as_binary.lhs);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+int resolve(struct starlark_Context *ctx, struct starlark_Parser *p,
+	    struct starlark_Resolver *out)
+{
+	assert(ctx != NULL);
+	assert(p != NULL);
+	assert(out != NULL);
+
+	struct resolver r = {
+		.ctx = ctx,
+		.p = p,
+		.out = out,
+	};
+
+	for (size_t i = 0; i < BUILTIN_COUNT; i += 1) {
+		r.builtins[i] = strpool_add(&ctx->strpool,
+					    strlen(Builtin_names[i]),
+					    Builtin_names[i]);
+		if (r.builtins[i] < 0) {
+			ctx->err = STARLARK_ERROR_OOM;
+			return ctx->err;
+		}
+	}
+
+	if (start_function(&r, STARLARK_NODE_NONE) && table_grow(&r)) {
+		bind_block(&r, p->root);
+		resolve_stmt(&r, p->root);
+		finish_function(&r);
+	}
+
+	// If resolving stopped early, some functions are still active.
+	for (size_t i = 0; i < r.active_len; i += 1) {
+		free(r.active[i].frees);
+		free(r.active[i].local_names);
+	}
+
+	free(r.table);
+	free(r.bindings);
+	free(r.uses);
+	free(r.cells);
+	free(r.active);
+	if (ctx->err != 0) {
+		Resolver_reset(out);
+		return ctx->err;
+	}
+
+	return 0;
+}
+
+void Resolver_reset(struct starlark_Resolver *r)
+{
+	assert(r != NULL);
+
+	r->functions_len = 0;
+	r->frees_len = 0;
+	r->local_names_len = 0;
+	r->cells_len = 0;
+	r->globals_len = 0;
+}
+
+void Resolver_finish(struct starlark_Resolver *r)
+{
+	if (r == NULL) {
+		return;
+	}
+
+	free(r->functions);
+	free(r->frees);
+	free(r->local_names);
+	free(r->cells);
+	free(r->globals);
+	*r = (struct starlark_Resolver){ 0 };
+}
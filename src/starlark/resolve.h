@@ -0,0 +1,95 @@
+#ifndef STARLARK_RESOLVE_H
+#define STARLARK_RESOLVE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "starlark/common.h"
+#include "starlark/parse.h"
+
+// The resolver binds every identifier in an ast to the slot holding it, so
+// that variables are found by index at runtime instead of by name. Following
+// the spec's rules for name binding, a name is bound to
+//
+//   - a local of the innermost function or comprehension assigning to it
+//     anywhere in its body, which is a slot in the function's frame. The top
+//     level of the module is a function too, whose locals are the variables of
+//     comprehensions outside of any function.
+//   - a free variable, if it's a local of an enclosing function. The local is
+//     then a cell shared between the two functions.
+//   - a global, if it's assigned to at the top level of the module, which is a
+//     slot in the module's table of globals.
+//   - a builtin, which is a slot in the fixed table in builtins.h.
+//
+// The scope and slot are stored in the as_identifier of each identifier.
+
+// A variable of an enclosing function which a function refers to. It's found
+// in the enclosing function's frame if scope is STARLARK_SCOPE_CELL, and in the
+// enclosing function's own free variables if it's STARLARK_SCOPE_FREE.
+struct starlark_FreeVar {
+	int64_t name;
+	enum starlark_Scope scope;
+	uint32_t index;
+};
+
+// What the resolver found out about a function, which is needed to lay out its
+// frame.
+struct starlark_ResolvedFunction {
+	// The STARLARK_NODE_FUNCTION or STARLARK_NODE_LAMBDA, or
+	// STARLARK_NODE_NONE for the top level of the module.
+	uint32_t node;
+	// The number of slots in the function's frame. The named parameters
+	// come first, in order, then *args and **kwargs if the function has
+	// them, followed by the rest of the locals.
+	uint32_t locals_len;
+	// The name of each local starts at local_names[locals_start].
+	uint32_t locals_start;
+	// The function's free variables start at frees[frees_start].
+	uint32_t frees_start;
+	uint32_t frees_len;
+	// The indices of the locals which hold cells start at
+	// cells[cells_start].
+	uint32_t cells_start;
+	uint32_t cells_len;
+};
+
+struct starlark_Resolver {
+	// Every function in the module, in the order their definitions start.
+	// The module's top level is function 0.
+	size_t functions_len;
+	size_t functions_cap;
+	struct starlark_ResolvedFunction *functions;
+
+	size_t frees_len;
+	size_t frees_cap;
+	struct starlark_FreeVar *frees;
+
+	// The name of each local, as a handle into the context's strpool.
+	size_t local_names_len;
+	size_t local_names_cap;
+	int64_t *local_names;
+
+	size_t cells_len;
+	size_t cells_cap;
+	uint32_t *cells;
+
+	// The name of each global, as a handle into the context's strpool.
+	size_t globals_len;
+	size_t globals_cap;
+	int64_t *globals;
+};
+
+// Resolves every identifier in the ast of p, which must have been parsed
+// without errors, storing what it found about each function in out.
+// out must either be zeroed or have been passed to Resolver_reset.
+// Returns 0 on success, or a negative STARLARK_ERROR_* code. Errors in the
+// program, such as a name which isn't defined, are appended to ctx's errors.
+int resolve(struct starlark_Context *ctx, struct starlark_Parser *p,
+	    struct starlark_Resolver *out);
+
+// Clears out so it can be passed to resolve again, keeping its memory.
+void Resolver_reset(struct starlark_Resolver *r);
+
+void Resolver_finish(struct starlark_Resolver *r);
+
+#endif // STARLARK_RESOLVE_H
@@ -0,0 +1,38 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "starlark/scratch.h"
+
+struct starlark_Scratch *Scratch_get(struct starlark_Context *ctx)
+{
+	assert(ctx != NULL);
+
+	if (ctx->scratch == NULL) {
+		ctx->scratch = calloc(1, sizeof(*ctx->scratch));
+	}
+
+	return ctx->scratch;
+}
+
+void Scratch_reset(struct starlark_Scratch *s)
+{
+	assert(s != NULL);
+
+	starlark_Lexer_reset(&s->lexer);
+	starlark_Parser_reset(&s->parser);
+	Resolver_reset(&s->resolver);
+}
+
+void Scratch_destroy(struct starlark_Scratch *s)
+{
+	if (s == NULL) {
+		return;
+	}
+
+	starlark_Parser_finish(&s->parser);
+	starlark_Lexer_finish(&s->lexer);
+	Resolver_finish(&s->resolver);
+	CompileScratch_finish(&s->compiler);
+	free(s);
+}
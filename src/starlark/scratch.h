@@ -0,0 +1,29 @@
+#ifndef STARLARK_SCRATCH_H
+#define STARLARK_SCRATCH_H
+
+#include "starlark/common.h"
+#include "starlark/compile.h"
+#include "starlark/lex.h"
+#include "starlark/parse.h"
+#include "starlark/resolve.h"
+
+// What a context reads and compiles each program with. None of it is needed
+// once the program has been compiled, but it's kept in the context between
+// programs so that the memory it holds is reused rather than allocated again.
+struct starlark_Scratch {
+	struct starlark_Lexer lexer;
+	struct starlark_Parser parser;
+	struct starlark_Resolver resolver;
+	struct starlark_CompileScratch compiler;
+};
+
+// Returns the scratch of ctx, making it the first time.
+// Returns NULL if we couldn't allocate enough memory.
+struct starlark_Scratch *Scratch_get(struct starlark_Context *ctx);
+
+// Forgets the program s was last used for, keeping its memory.
+void Scratch_reset(struct starlark_Scratch *s);
+
+void Scratch_destroy(struct starlark_Scratch *s);
+
+#endif // STARLARK_SCRATCH_H
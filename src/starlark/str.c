@@ -0,0 +1,411 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "starlark/str.h"
+#include "starlark/common.h"
+#include "starlark/value.h"
+#include "util/common.h"
+#include "util/fnv-1a.h"
+#include "utf8/utf8.h"
+
+enum {
+	// Every byte is below 0x80. Only meaningful with STR_ASCII_CHECKED.
+	STR_ASCII = 1 << 0,
+	// Whether the string is ASCII is known.
+	STR_ASCII_CHECKED = 1 << 1,
+	// hash holds the string's hash.
+	STR_HASHED = 1 << 2,
+	// codepoints holds the number of codepoints in the string.
+	STR_COUNTED = 1 << 3,
+	// The string is a view of part of another string's bytes.
+	STR_VIEW = 1 << 4,
+	// The string's bytes are in a separate buffer with room to grow, see
+	// Str_append.
+	STR_BUFFER = 1 << 5,
+};
+
+// The smallest buffer Str_append allocates.
+#define MIN_BUFFER_CAP 64
+
+// Substrings shorter than this fraction of their parent are copied instead of
+// being made into views, so that a small view can't keep a much bigger string
+// alive.
+#define VIEW_MIN_FRACTION 4
+
+struct starlark_Str {
+	struct starlark_Object obj;
+	uint32_t flags;
+	size_t len;
+	uint64_t hash;
+	size_t codepoints;
+	union {
+		// The string's bytes, followed by a '\0'. Strings longer than
+		// STR_SMALL_LEN bytes are allocated with room for more.
+		char bytes[STR_SMALL_LEN + 1];
+		// Views point into the bytes of parent, which they hold a
+		// reference to. The parent is never a view itself.
+		struct {
+			struct starlark_Str *parent;
+			const char *data;
+		} view;
+		// Buffers have room for cap bytes, of which the first len are
+		// used.
+		struct {
+			char *ptr;
+			size_t cap;
+		} buffer;
+	};
+};
+
+static const char *data(const struct starlark_Str *s)
+{
+	if (s->flags & STR_VIEW) {
+		return s->view.data;
+	} else if (s->flags & STR_BUFFER) {
+		return s->buffer.ptr;
+	}
+
+	return s->bytes;
+}
+
+static bool all_ascii(const size_t len, const char *bytes)
+{
+	uint8_t seen = 0;
+	for (size_t i = 0; i < len; i += 1) {
+		seen |= (uint8_t)bytes[i];
+	}
+
+	return seen < 0x80;
+}
+
+// Returns true if s is known to be ASCII, without checking it.
+static bool known_ascii(const struct starlark_Str *s)
+{
+	const uint32_t ascii = STR_ASCII_CHECKED | STR_ASCII;
+	return (s->flags & ascii) == ascii;
+}
+
+// Returns the flags of a string made by joining a and b. Everything cached
+// about them is lost, except that the result is ASCII if both are.
+static uint32_t joined_flags(const struct starlark_Str *a,
+			     const struct starlark_Str *b)
+{
+	if (known_ascii(a) && known_ascii(b)) {
+		return STR_ASCII_CHECKED | STR_ASCII;
+	}
+
+	return 0;
+}
+
+// Returns a new string with room for len bytes, which the caller fills in.
+// Returns NULL if we couldn't allocate enough memory.
+static struct starlark_Str *alloc_flat(const size_t len)
+{
+	size_t size = sizeof(struct starlark_Str);
+	if (len > STR_SMALL_LEN) {
+		if (len > SIZE_MAX - size) {
+			return NULL;
+		}
+
+		size += len - STR_SMALL_LEN;
+	}
+
+	struct starlark_Str *result = malloc(size);
+	if (result == NULL) {
+		return NULL;
+	}
+
+	*result = (struct starlark_Str){
+		.obj = {
+			.type = STARLARK_TYPE_STRING,
+			.refs = 1,
+		},
+		.len = len,
+	};
+	result->bytes[len] = '\0';
+	return result;
+}
+
+struct starlark_Str *Str_create(const size_t len, const char *bytes)
+{
+	assert(bytes != NULL || len == 0);
+
+	struct starlark_Str *result = alloc_flat(len);
+	if (result == NULL) {
+		return NULL;
+	}
+
+	result->flags = STR_ASCII_CHECKED |
+			(all_ascii(len, bytes) ? STR_ASCII : 0);
+	if (len != 0) {
+		memcpy(result->bytes, bytes, len);
+	}
+
+	return result;
+}
+
+struct starlark_Str *Str_slice(struct starlark_Str *s, const size_t start,
+			       const size_t len)
+{
+	assert(s != NULL);
+	assert(start <= s->len && len <= s->len - start);
+
+	if (start == 0 && len == s->len) {
+		s->obj.refs += 1;
+		return s;
+	}
+
+	// Short strings fit in the header, so a view wouldn't save anything.
+	if (len <= STR_SMALL_LEN || len < s->len / VIEW_MIN_FRACTION) {
+		return Str_create(len, data(s) + start);
+	}
+
+	struct starlark_Str *result = malloc(sizeof(*result));
+	if (result == NULL) {
+		return NULL;
+	}
+
+	// Every substring of an ASCII string is ASCII. Otherwise, it's checked
+	// when it's first needed.
+	uint32_t flags = STR_VIEW;
+	if (known_ascii(s)) {
+		flags |= STR_ASCII_CHECKED | STR_ASCII;
+	}
+
+	struct starlark_Str *parent = s;
+	if (s->flags & STR_VIEW) {
+		parent = s->view.parent;
+	}
+
+	parent->obj.refs += 1;
+	*result = (struct starlark_Str){
+		.obj = {
+			.type = STARLARK_TYPE_STRING,
+			.refs = 1,
+		},
+		.flags = flags,
+		.len = len,
+		.view = {
+			.parent = parent,
+			.data = data(s) + start,
+		},
+	};
+	return result;
+}
+
+struct starlark_Str *Str_append(struct starlark_Str *a,
+				const struct starlark_Str *b)
+{
+	assert(a != NULL);
+	assert(b != NULL);
+
+	if (a->len > SIZE_MAX - b->len) {
+		Value_release(Value_object(&a->obj));
+		return NULL;
+	}
+
+	// Nothing else can see a, so its buffer can be written to, unless it's
+	// also b, whose bytes would move if the buffer grew.
+	const bool owned = a->obj.refs == 1 && (a->flags & STR_BUFFER) &&
+			   a != b;
+	const size_t len = a->len + b->len;
+	if (owned && len <= a->buffer.cap) {
+		memcpy(a->buffer.ptr + a->len, data(b), b->len);
+		a->flags = STR_BUFFER | joined_flags(a, b);
+		a->len = len;
+		return a;
+	}
+
+	size_t cap = MAX(len, MIN_BUFFER_CAP);
+	if (cap <= SIZE_MAX / 2) {
+		cap *= 2;
+	}
+
+	struct starlark_Str *result = NULL;
+	if (owned) {
+		char *ptr = realloc(a->buffer.ptr, cap);
+		if (ptr == NULL) {
+			Value_release(Value_object(&a->obj));
+			return NULL;
+		}
+
+		a->buffer.ptr = ptr;
+		a->buffer.cap = cap;
+		result = a;
+	} else {
+		result = malloc(sizeof(*result));
+		char *ptr = malloc(cap);
+		if (result == NULL || ptr == NULL) {
+			free(result);
+			free(ptr);
+			Value_release(Value_object(&a->obj));
+			return NULL;
+		}
+
+		*result = (struct starlark_Str){
+			.obj = {
+				.type = STARLARK_TYPE_STRING,
+				.refs = 1,
+			},
+			.len = a->len,
+			.buffer = {
+				.ptr = ptr,
+				.cap = cap,
+			},
+		};
+		memcpy(ptr, data(a), a->len);
+	}
+
+	memcpy(result->buffer.ptr + result->len, data(b), b->len);
+	result->flags = STR_BUFFER | joined_flags(a, b);
+	result->len = len;
+	if (result != a) {
+		Value_release(Value_object(&a->obj));
+	}
+
+	return result;
+}
+
+struct starlark_Str *Str_join(const struct starlark_Str *sep, const size_t n,
+			      const struct starlark_Str *const *parts)
+{
+	assert(sep != NULL);
+	assert(parts != NULL || n == 0);
+
+	size_t len = 0;
+	bool ascii = n < 2 || known_ascii(sep);
+	for (size_t i = 0; i < n; i += 1) {
+		const size_t part_len = parts[i]->len + (i != 0 ? sep->len : 0);
+		if (len > SIZE_MAX - part_len) {
+			return NULL;
+		}
+
+		len += part_len;
+		ascii = ascii && known_ascii(parts[i]);
+	}
+
+	struct starlark_Str *result = alloc_flat(len);
+	if (result == NULL) {
+		return NULL;
+	}
+
+	char *out = result->bytes;
+	for (size_t i = 0; i < n; i += 1) {
+		if (i != 0) {
+			memcpy(out, data(sep), sep->len);
+			out += sep->len;
+		}
+
+		memcpy(out, data(parts[i]), parts[i]->len);
+		out += parts[i]->len;
+	}
+
+	result->flags = ascii ? STR_ASCII_CHECKED | STR_ASCII : 0;
+	return result;
+}
+
+void Str_destroy(struct starlark_Str *s)
+{
+	if (s == NULL) {
+		return;
+	}
+
+	if (s->flags & STR_VIEW) {
+		Value_release(Value_object(&s->view.parent->obj));
+	} else if (s->flags & STR_BUFFER) {
+		free(s->buffer.ptr);
+	}
+
+	free(s);
+}
+
+size_t Str_len(const struct starlark_Str *s)
+{
+	assert(s != NULL);
+	return s->len;
+}
+
+const char *Str_data(const struct starlark_Str *s)
+{
+	assert(s != NULL);
+	return data(s);
+}
+
+bool Str_is_ascii(struct starlark_Str *s)
+{
+	assert(s != NULL);
+
+	if (!(s->flags & STR_ASCII_CHECKED)) {
+		s->flags |= STR_ASCII_CHECKED |
+			    (all_ascii(s->len, data(s)) ? STR_ASCII : 0);
+	}
+
+	return (s->flags & STR_ASCII) != 0;
+}
+
+size_t Str_codepoints(struct starlark_Str *s)
+{
+	assert(s != NULL);
+
+	if (Str_is_ascii(s)) {
+		return s->len;
+	}
+
+	if (s->flags & STR_COUNTED) {
+		return s->codepoints;
+	}
+
+	// Counting the bytes which aren't continuation bytes would only work
+	// for valid UTF-8. A byte which can't be decoded is skipped on its own,
+	// the same as everywhere else strings are decoded.
+	const uint8_t *bytes = (const uint8_t *)data(s);
+	size_t count = 0;
+	for (size_t i = 0; i < s->len; count += 1) {
+		size_t size = 0;
+		utf8_codepoint_decode(s->len, bytes, i, &size);
+		i += size;
+	}
+
+	s->codepoints = count;
+	s->flags |= STR_COUNTED;
+	return count;
+}
+
+uint64_t Str_hash(struct starlark_Str *s)
+{
+	assert(s != NULL);
+
+	if (s->flags & STR_HASHED) {
+		return s->hash;
+	}
+
+	s->hash = fnv_1a(s->len, (const uint8_t *)data(s));
+	s->flags |= STR_HASHED;
+	return s->hash;
+}
+
+bool Str_equal(struct starlark_Str *a, struct starlark_Str *b)
+{
+	assert(a != NULL);
+	assert(b != NULL);
+
+	if (a == b) {
+		return true;
+	}
+
+	if (a->len != b->len) {
+		return false;
+	}
+
+	// Only compare hashes which have already been computed, since
+	// computing them reads every byte anyway.
+	if ((a->flags & b->flags & STR_HASHED) && a->hash != b->hash) {
+		return false;
+	}
+
+	return memcmp(data(a), data(b), a->len) == 0;
+}
@@ -0,0 +1,76 @@
+#ifndef STARLARK_STR_H
+#define STARLARK_STR_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "starlark/common.h"
+
+// A starlark string, which is an immutable sequence of bytes, usually UTF-8.
+//
+// A string remembers its length, whether every byte is ASCII, and once they've
+// been asked for, its hash and the number of codepoints in it, so none of them
+// need the bytes to be scanned again.
+//
+// The bytes are stored in the same allocation as the string itself. Strings of
+// up to STR_SMALL_LEN bytes fit in the fixed size part of the string.
+// Substrings can instead be views of their parent's bytes, see Str_slice, and
+// strings built by appending keep their bytes in a growable buffer, see
+// Str_append.
+//
+// Every starlark_Str starts with a starlark_Object header, so a pointer to one
+// can be stored in a starlark_Value.
+
+#define STR_SMALL_LEN 15
+
+// Returns a new string holding a copy of the first len bytes of bytes.
+// Returns NULL if we couldn't allocate enough memory.
+struct starlark_Str *Str_create(const size_t len, const char *bytes);
+
+// Returns the len bytes of s starting at byte start, which must be within s.
+// The result might share s's bytes, keeping s alive until the result is
+// destroyed. Short substrings, and ones much shorter than s, are copied instead
+// so that they don't keep a lot of unused memory alive.
+// Returns NULL if we couldn't allocate enough memory.
+struct starlark_Str *Str_slice(struct starlark_Str *s, const size_t start,
+			       const size_t len);
+
+// Returns a string holding a followed by b, taking ownership of the caller's
+// reference to a. If that's the only reference to a, a is extended in place
+// when it has room, and otherwise moved to a buffer with room to spare, so
+// that building a string by appending to it repeatedly takes linear time.
+// Returns NULL if we couldn't allocate enough memory, in which case a is
+// released.
+struct starlark_Str *Str_append(struct starlark_Str *a,
+				const struct starlark_Str *b);
+
+// Returns the n strings in parts joined together, with sep between each of
+// them. The result is allocated once, at its final size.
+// Returns NULL if we couldn't allocate enough memory.
+struct starlark_Str *Str_join(const struct starlark_Str *sep, const size_t n,
+			      const struct starlark_Str *const *parts);
+
+void Str_destroy(struct starlark_Str *s);
+
+// Returns the length of s in bytes.
+size_t Str_len(const struct starlark_Str *s);
+
+// Returns the bytes of s. They aren't necessarily followed by a '\0', since s
+// might be a view of part of another string.
+const char *Str_data(const struct starlark_Str *s);
+
+// Returns true if every byte in s is below 0x80, in which case indexing s by
+// codepoints is the same as indexing it by bytes.
+bool Str_is_ascii(struct starlark_Str *s);
+
+// Returns the number of codepoints in s. Bytes which aren't part of a valid
+// UTF-8 sequence count as a codepoint each.
+size_t Str_codepoints(struct starlark_Str *s);
+
+// Returns the FNV-1a hash of s's bytes.
+uint64_t Str_hash(struct starlark_Str *s);
+
+// Returns true if a and b contain the same bytes.
+bool Str_equal(struct starlark_Str *a, struct starlark_Str *b);
+
+#endif // STARLARK_STR_H
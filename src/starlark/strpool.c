@@ -12,38 +12,113 @@
 #include "util/common.h"
 #include "util/panic.h"
 
-static bool strpool_ensure(struct starlark_Strpool *s, const size_t handles,
-			   const size_t bytes)
+// The number of slots in the table of a new strpool. Always a power of two.
+#define INITIAL_SLOTS 64
+// The number of bytes in the buffer of a new strpool.
+#define INITIAL_BYTES 1024
+
+// Allocates the table of s with room for cap slots, which are all empty.
+// Returns false if we couldn't allocate enough memory.
+static bool table_alloc(struct starlark_Strpool *s, const size_t cap)
 {
-	assert(s != NULL);
+	// hashes, handles and lens are all 8 bytes wide, so they share an
+	// allocation without any padding between them.
+	if (cap > SIZE_MAX / 3 / sizeof(int64_t)) {
+		return false;
+	}
 
-	if (bytes < s->buffer.cap) {
-		return true;
+	uint8_t *memory = calloc(cap, 3 * sizeof(int64_t));
+	if (memory == NULL) {
+		return false;
 	}
 
-	size_t new_cap = MAX(handles, s->table.cap);
+	s->table.hashes = (void *)memory;
+	s->table.handles = (void *)(memory + cap * sizeof(int64_t));
+	s->table.lens = (void *)(memory + 2 * cap * sizeof(int64_t));
+	s->table.cap = cap;
+	return true;
+}
 
-	size_t hashes_len = new_cap * sizeof(s->table.hashes[0]);
-	size_t handles_len = new_cap * sizeof(s->table.handles[0]);
-	size_t buffer_len = bytes * sizeof(s->buffer.ptr[0]);
+// Returns the slot holding the string, or the empty slot it would be inserted
+// into. A slot is empty when its handle is 0, since the empty string is never
+// stored in the table.
+static size_t find(const struct starlark_Strpool *s, const int64_t hash,
+		   const size_t len, const char *str)
+{
+	const size_t mask = s->table.cap - 1;
+	size_t i = (uint64_t)hash & mask;
+	for (;;) {
+		const int64_t handle = s->table.handles[i];
+		if (handle == 0) {
+			return i;
+		}
+
+		if (s->table.hashes[i] == hash && s->table.lens[i] == len &&
+		    memcmp(&s->buffer.ptr[handle], str, len) == 0) {
+			return i;
+		}
 
-	if (new_cap > INT64_MAX || buffer_len > INT64_MAX) {
+		i = (i + 1) & mask;
+	}
+}
+
+// Doubles the number of slots in the table, moving every string into its new
+// slot.
+// Returns false if we couldn't allocate enough memory.
+static bool table_grow(struct starlark_Strpool *s)
+{
+	struct starlark_Strpool old = *s;
+	if (s->table.cap > SIZE_MAX / 2 || !table_alloc(s, s->table.cap * 2)) {
+		*s = old;
 		return false;
 	}
 
-	uint8_t *memory =
-		realloc(s->table.hashes, hashes_len + handles_len + buffer_len);
-	if (memory == NULL) {
+	for (size_t i = 0; i < old.table.cap; i += 1) {
+		if (old.table.handles[i] == 0) {
+			continue;
+		}
+
+		// Every string is distinct, so only an empty slot is needed.
+		const size_t mask = s->table.cap - 1;
+		size_t slot = (uint64_t)old.table.hashes[i] & mask;
+		while (s->table.handles[slot] != 0) {
+			slot = (slot + 1) & mask;
+		}
+
+		s->table.hashes[slot] = old.table.hashes[i];
+		s->table.handles[slot] = old.table.handles[i];
+		s->table.lens[slot] = old.table.lens[i];
+	}
+
+	free(old.table.hashes);
+	return true;
+}
+
+// Makes sure the buffer has room for bytes more bytes.
+// Returns false if we couldn't allocate enough memory.
+static bool buffer_ensure(struct starlark_Strpool *s, const size_t bytes)
+{
+	if (bytes > INT64_MAX - s->buffer.len) {
 		return false;
 	}
 
-	s->table.hashes = (void *)memory;
-	s->table.handles = (void *)(memory + hashes_len);
-	s->buffer.ptr = (void *)(memory + hashes_len + handles_len);
+	const size_t needed = s->buffer.len + bytes;
+	if (needed <= s->buffer.cap) {
+		return true;
+	}
+
+	size_t cap = s->buffer.cap;
+	while (cap < needed) {
+		cap = cap > SIZE_MAX / 2 ? needed : cap * 2;
+	}
 
-	s->table.cap = new_cap;
-	s->buffer.cap = bytes;
+	char *ptr = realloc(s->buffer.ptr, cap);
+	if (ptr == NULL) {
+		return false;
+	}
 
+	s->buffer.ptr = ptr;
+	s->buffer.cap = cap;
 	return true;
 }
 
@@ -51,23 +126,19 @@ bool strpool_init(struct starlark_Strpool *s)
 {
 	assert(s != NULL);
 
-	size_t hashes_len = 100 * sizeof(s->table.hashes[0]);
-	size_t handles_len = 100 * sizeof(s->table.handles[0]);
-	size_t buffer_len = 100 * sizeof(s->buffer.ptr[0]);
-
-	uint8_t *memory = malloc(hashes_len + handles_len + buffer_len);
-	if (memory == NULL) {
+	*s = (struct starlark_Strpool){ 0 };
+	if (!table_alloc(s, INITIAL_SLOTS)) {
 		return false;
 	}
 
-	s->table.hashes = (void *)memory;
-	s->table.handles = (void *)(memory + hashes_len);
-	s->buffer.ptr = (void *)(memory + hashes_len + handles_len);
+	s->buffer.ptr = malloc(INITIAL_BYTES);
+	if (s->buffer.ptr == NULL) {
+		strpool_finish(s);
+		return false;
+	}
 
-	s->table.len = 0;
-	s->table.cap = 100;
 	s->buffer.len = 1;
-	s->buffer.cap = 100;
+	s->buffer.cap = INITIAL_BYTES;
 	s->buffer.ptr[0] = '\0';
 
 	return true;
@@ -77,68 +148,71 @@ int64_t strpool_add(struct starlark_Strpool *s, const size_t len,
 		    const char *str)
 {
 	assert(s != NULL);
+	assert(str != NULL || len == 0);
+
+	if (len == 0) {
+		return 0;
+	}
+
 	int64_t hash = 0;
-	uint64_t tmp = fnv_1a_str(str);
+	uint64_t tmp = fnv_1a(len, (const uint8_t *)str);
 	memcpy(&hash, &tmp, sizeof(int64_t));
 
-	// printf("adding '%.*s' to the pool\n", (int)len, str);
+	size_t slot = find(s, hash, len, str);
+	if (s->table.handles[slot] != 0) {
+		return s->table.handles[slot];
+	}
 
-	for (size_t i = 0; i < s->table.len; i += 1) {
-		if (hash == s->table.hashes[i]) {
-			return s->table.handles[i];
+	// Keep at most 3/4 of the slots full, so that probes stay short.
+	if ((s->table.len + 1) * 4 > s->table.cap * 3) {
+		if (!table_grow(s)) {
+			return -1;
 		}
-	}
 
-	if (s->buffer.len + len < s->buffer.len) {
-		return -1;
+		slot = find(s, hash, len, str);
 	}
 
-	if (!strpool_ensure(s, s->table.len + 1, s->buffer.len + len + 1)) {
+	if (len == SIZE_MAX || !buffer_ensure(s, len + 1)) {
 		return -1;
 	}
 
 	int64_t result = s->buffer.len;
-
-	s->table.hashes[s->table.len] = hash;
-	s->table.handles[s->table.len] = result;
-	memcpy(&s->buffer.ptr[s->buffer.len], str, len + 1);
+	memcpy(&s->buffer.ptr[s->buffer.len], str, len);
+	s->buffer.ptr[s->buffer.len + len] = '\0';
 	s->buffer.len += len + 1;
-	s->table.len += 1;
 
-	// printf("returning handle %" PRId64 "\n", result);
+	s->table.hashes[slot] = hash;
+	s->table.handles[slot] = result;
+	s->table.lens[slot] = len;
+	s->table.len += 1;
 
 	return result;
 }
 
-static bool is_in_strpool(struct starlark_Strpool *s, const int64_t handle)
+const char *strpool_get(struct starlark_Strpool *s, const int64_t handle)
 {
-	for (size_t i = 0; i < s->table.len; i += 1) {
-		if (s->table.handles[i] != handle) {
-			continue;
-		}
+	assert(s != NULL);
+	assert(handle >= 0);
 
-		return true;
+	if ((uint64_t)handle >= s->buffer.len) {
+		return NULL;
 	}
 
-	return false;
+	return &s->buffer.ptr[handle];
 }
 
-const char *strpool_get(struct starlark_Strpool *s, const int64_t handle)
+void strpool_reset(struct starlark_Strpool *s)
 {
 	assert(s != NULL);
-	assert(handle >= 0);
 
-	// printf("retrieving handle %" PRId64 "\n", handle);
-
-	if (handle == 0) {
-		return &s->buffer.ptr[0];
-	}
-
-	if (!is_in_strpool(s, handle)) {
-		panic("handle %" PRId64 " is not in strpool", handle);
+	if (s->buffer.ptr == NULL) {
+		return;
 	}
 
-	return &s->buffer.ptr[handle];
+	memset(s->table.handles, 0, s->table.cap * sizeof(s->table.handles[0]));
+	s->table.len = 0;
+	s->buffer.len = 1;
+	s->buffer.ptr[0] = '\0';
 }
 
 void strpool_finish(struct starlark_Strpool *s)
@@ -148,4 +222,6 @@ void strpool_finish(struct starlark_Strpool *s)
 	}
 
 	free(s->table.hashes);
+	free(s->buffer.ptr);
+	*s = (struct starlark_Strpool){ 0 };
 }
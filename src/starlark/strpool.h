@@ -6,11 +6,15 @@
 
 #include "starlark/common.h"
 
-// Initializes the strpool with enough space for 100 handles.
+// Initializes an empty strpool.
 // Returns false if we couldn't allocate enough memory.
 bool strpool_init(struct starlark_Strpool *s);
 
-// Returns either a positive handle, or a negative error code.
+// Adds the first len bytes of str to the strpool, unless it's already there.
+// Adding the same string again returns the same handle, so two strings in the
+// pool are equal exactly when their handles are. The empty string's handle is
+// always 0.
+// Returns either a non-negative handle, or a negative error code.
 int64_t strpool_add(struct starlark_Strpool *s, const size_t len,
 		    const char *str);
 
@@ -18,6 +22,11 @@ int64_t strpool_add(struct starlark_Strpool *s, const size_t len,
 // invalid.
 const char *strpool_get(struct starlark_Strpool *s, const int64_t handle);
 
+// Removes every string from the strpool, keeping the memory allocated for
+// them so that it can be reused. Every handle previously returned becomes
+// invalid.
+void strpool_reset(struct starlark_Strpool *s);
+
 void strpool_finish(struct starlark_Strpool *s);
 
 #endif // UTIL_STRPOOL_H
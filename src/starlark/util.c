@@ -2,13 +2,15 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <assert.h>
 #include <string.h>
+#include <assert.h>
 #include <stdalign.h>
+#include <stdarg.h>
 
 #include "starlark/common.h"
 #include "starlark/strpool.h"
 #include "util/common.h"
+#include "util/fmt.h"
 #include "utf8/utf8.h"
 
 bool err_append(struct starlark_Context *in, const struct starlark_Error err)
@@ -23,14 +25,26 @@ bool err_append(struct starlark_Context *in, const struct starlark_Error err)
 		if (cap >= UINT16_MAX) {
 			cap = UINT16_MAX;
 		}
+		// The arrays after the first one move when the capacity
+		// changes, so remember where they were.
+		const size_t old_cap = in->errs_cap;
+		size_t old_starts = 0;
+		size_t old_args = 0;
+		if (old_cap != 0) {
+			old_starts = (uint8_t *)in->errs.starts -
+				     (uint8_t *)in->errs.codes;
+			old_args = (uint8_t *)in->errs.args -
+				   (uint8_t *)in->errs.codes;
+		}
+
 		size_t codes_len = cap * sizeof(in->errs.codes[0]);
 		size_t starts_len = cap * sizeof(in->errs.starts[0]);
-		size_t msgs_len = cap * sizeof(in->errs.msgs[0]);
-		uint8_t *ptr =
-			realloc(in->errs.codes,
-				codes_len + starts_len + msgs_len +
-					alignof(enum starlark_ErrorCode) +
-					alignof(size_t) + alignof(int64_t));
+		size_t args_len = cap * sizeof(in->errs.args[0]);
+		uint8_t *ptr = realloc(in->errs.codes,
+				       codes_len + starts_len + args_len +
+					       alignof(enum starlark_ErrorCode) +
+					       alignof(size_t) +
+					       alignof(union starlark_ErrorArg));
 		if (ptr == NULL) {
 			return false;
 		}
@@ -38,31 +52,42 @@ bool err_append(struct starlark_Context *in, const struct starlark_Error err)
 		in->errs.codes = (void *)ptr;
 		in->errs.starts =
 			(void *)ALIGN_UP(ptr + codes_len, alignof(size_t));
-		in->errs.msgs = (void *)ALIGN_UP(ptr + codes_len + starts_len,
-						 alignof(int64_t));
-		in->errs_cap = cap;
-	}
-
-	int64_t handle = 0;
-	if (err.msg != NULL) {
-		handle = strpool_add(&in->strpool, strlen(err.msg), err.msg);
-		if (handle < 0) {
-			return false;
+		in->errs.args =
+			(void *)ALIGN_UP(ptr + codes_len + starts_len,
+					 alignof(union starlark_ErrorArg));
+		if (old_cap != 0) {
+			memmove(in->errs.args, ptr + old_args,
+				old_cap * sizeof(in->errs.args[0]));
+			memmove(in->errs.starts, ptr + old_starts,
+				old_cap * sizeof(in->errs.starts[0]));
 		}
-
-		free((char *)err.msg);
+		in->errs_cap = cap;
 	}
 
-	// printf("len = %zu\n", in->errs_len);
-	fflush(stdout);
-
 	in->errs.codes[in->errs_len] = err.code;
 	in->errs.starts[in->errs_len] = err.start;
-	in->errs.msgs[in->errs_len] = handle;
+	in->errs.args[in->errs_len] = err.arg;
 	in->errs_len += 1;
 	return true;
 }
 
+int64_t err_string(struct starlark_Context *ctx, const char *fmt, ...)
+{
+	assert(ctx != NULL);
+
+	va_list ap;
+	va_start(ap, fmt);
+	char *str = vformat(fmt, ap);
+	va_end(ap);
+	if (str == NULL) {
+		return 0;
+	}
+
+	const int64_t result = strpool_add(&ctx->strpool, strlen(str), str);
+	free(str);
+	return result < 0 ? 0 : result;
+}
+
 bool starlark_isspace(const uint32_t c)
 {
 	return c == (uint8_t)u8" "[0] || c == (uint8_t)u8"\t"[0] ||
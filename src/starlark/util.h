@@ -7,6 +7,11 @@
 
 bool err_append(struct starlark_Context *in, const struct starlark_Error err);
 
+// Adds the printf style string fmt to ctx's strpool, for use as the argument of
+// an error.
+// Returns its handle, or 0, which is the empty string, on failure.
+int64_t err_string(struct starlark_Context *ctx, const char *fmt, ...);
+
 bool starlark_isspace(const uint32_t c);
 bool starlark_isbytes(const uint32_t c);
 bool starlark_isalpha(const uint32_t c);
@@ -0,0 +1,1126 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "starlark/value.h"
+#include "starlark/common.h"
+#include "starlark/dict.h"
+#include "starlark/function.h"
+#include "starlark/int.h"
+#include "starlark/list.h"
+#include "starlark/str.h"
+#include "util/common.h"
+#include "util/panic.h"
+
+struct Float {
+	struct starlark_Object obj;
+	double value;
+};
+
+enum starlark_Type Value_type(const struct starlark_Value v)
+{
+	if (Value_is_object(v)) {
+		return Value_as_object(v)->type;
+	}
+
+	switch (v.bits & VALUE_TAG_MASK) {
+	case VALUE_TAG_INT:
+		return STARLARK_TYPE_INT;
+	case VALUE_TAG_SPECIAL:
+		if (Value_is_none(v)) {
+			return STARLARK_TYPE_NONE;
+		}
+
+		return STARLARK_TYPE_BOOL;
+	default:
+		panic("invalid value tag %u",
+		      (unsigned)(v.bits & VALUE_TAG_MASK));
+	}
+}
+
+const char *Value_type_name(const struct starlark_Value v)
+{
+	switch (Value_type(v)) {
+	case STARLARK_TYPE_NONE:
+		return u8"NoneType";
+	case STARLARK_TYPE_BOOL:
+		return u8"bool";
+	case STARLARK_TYPE_INT:
+		return u8"int";
+	case STARLARK_TYPE_FLOAT:
+		return u8"float";
+	case STARLARK_TYPE_STRING:
+		return u8"string";
+	case STARLARK_TYPE_DICT:
+		return u8"dict";
+	case STARLARK_TYPE_LIST:
+		return u8"list";
+	case STARLARK_TYPE_TUPLE:
+		return u8"tuple";
+	case STARLARK_TYPE_RANGE:
+		return u8"range";
+	case STARLARK_TYPE_FUNCTION:
+		return u8"function";
+	case STARLARK_TYPE_BUILTIN:
+		return u8"builtin_function_or_method";
+	case STARLARK_TYPE_CELL:
+		return u8"cell";
+	case STARLARK_TYPE_ITERATOR:
+		return u8"iterator";
+	}
+
+	panic("invalid value type %d", Value_type(v));
+}
+
+struct starlark_Value Value_from_Int(struct starlark_Int *i)
+{
+	if (i == NULL) {
+		return VALUE_NONE;
+	}
+
+	int64_t small = 0;
+	if (Int_to_i64(i, &small) && small >= INT60_MIN && small <= INT60_MAX) {
+		Int_destroy(i);
+		return Value_small_int(small);
+	}
+
+	return Value_object((struct starlark_Object *)i);
+}
+
+struct starlark_Int *Value_to_Int(const struct starlark_Value v)
+{
+	assert(Value_type(v) == STARLARK_TYPE_INT);
+
+	if (Value_is_object(v)) {
+		return Int_copy((struct starlark_Int *)Value_as_object(v));
+	}
+
+	struct starlark_Int *result = Int_create();
+	if (result == NULL) {
+		return NULL;
+	}
+
+	if (Int_set_i64(result, Value_as_small_int(v)) != 0) {
+		Int_destroy(result);
+		return NULL;
+	}
+
+	return result;
+}
+
+struct starlark_Value Value_float(const double f)
+{
+	struct Float *result = malloc(sizeof(*result));
+	if (result == NULL) {
+		return VALUE_NONE;
+	}
+
+	result->obj = (struct starlark_Object){
+		.type = STARLARK_TYPE_FLOAT,
+		.refs = 1,
+	};
+	result->value = f;
+	return Value_object(&result->obj);
+}
+
+double Value_as_float(const struct starlark_Value v)
+{
+	assert(Value_type(v) == STARLARK_TYPE_FLOAT);
+	return ((struct Float *)Value_as_object(v))->value;
+}
+
+struct starlark_Value Value_str(const size_t len, const char *bytes)
+{
+	struct starlark_Str *result = Str_create(len, bytes);
+	if (result == NULL) {
+		return VALUE_NONE;
+	}
+
+	return Value_object((struct starlark_Object *)result);
+}
+
+bool Value_truth(const struct starlark_Value v)
+{
+	if (Value_is_small_int(v)) {
+		return Value_as_small_int(v) != 0;
+	}
+
+	if (!Value_is_object(v)) {
+		return v.bits == VALUE_TRUE.bits;
+	}
+
+	switch (Value_as_object(v)->type) {
+	case STARLARK_TYPE_INT:
+		// Ints are only stored on the heap when they don't fit in 60
+		// bits, so they can't be 0.
+		return true;
+	case STARLARK_TYPE_FLOAT:
+		return Value_as_float(v) != 0.0;
+	case STARLARK_TYPE_STRING:
+		return Str_len((struct starlark_Str *)Value_as_object(v)) != 0;
+	case STARLARK_TYPE_DICT:
+		return Dict_len((struct starlark_Dict *)Value_as_object(v)) != 0;
+	case STARLARK_TYPE_LIST:
+		return ((struct starlark_List *)Value_as_object(v))->len != 0;
+	case STARLARK_TYPE_TUPLE:
+		return ((struct starlark_Tuple *)Value_as_object(v))->len != 0;
+	case STARLARK_TYPE_RANGE:
+		return Range_len((struct starlark_Range *)Value_as_object(v)) !=
+		       0;
+	default:
+		return true;
+	}
+}
+
+// Scrambles the bits of x, so that values which only differ in a few bits
+// don't have similar hashes.
+static uint64_t mix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= UINT64_C(0xbf58476d1ce4e5b9);
+	x ^= x >> 27;
+	x *= UINT64_C(0x94d049bb133111eb);
+	x ^= x >> 31;
+	return x;
+}
+
+// Hashes a whole number from the low 64 bits of its magnitude, its sign, and
+// the number of bits in its magnitude. Ints and floats which are equal have
+// the same parts, however they're stored.
+static uint64_t hash_whole(const uint64_t low, const bool negative,
+			   const size_t bit_len)
+{
+	uint64_t x = low;
+	if (negative) {
+		x ^= UINT64_C(0x9e3779b97f4a7c15);
+	}
+
+	// Only numbers which don't fit in 64 bits can have the same low bits.
+	if (bit_len > 64) {
+		x ^= mix(bit_len);
+	}
+
+	return mix(x);
+}
+
+static uint64_t hash_float(const double f)
+{
+	if (!isfinite(f) || f != trunc(f)) {
+		uint64_t bits = 0;
+		memcpy(&bits, &f, sizeof(bits));
+		return mix(bits);
+	}
+
+	int exp = 0;
+	const double fraction = frexp(fabs(f), &exp);
+	uint64_t low = 0;
+	if (exp <= 64) {
+		low = (uint64_t)fabs(f);
+	} else if (exp - 53 < 64) {
+		// The fraction has 53 bits, shifted up by exp - 53.
+		low = (uint64_t)ldexp(fraction, 53) << (exp - 53);
+	}
+
+	return hash_whole(low, f < 0, (size_t)exp);
+}
+
+bool Value_hash(const struct starlark_Value v, uint64_t *out)
+{
+	assert(out != NULL);
+
+	if (Value_is_small_int(v)) {
+		const int64_t i = Value_as_small_int(v);
+		const uint64_t magnitude = i < 0 ? -(uint64_t)i : (uint64_t)i;
+		*out = hash_whole(magnitude, i < 0, 0);
+		return true;
+	}
+
+	if (!Value_is_object(v)) {
+		// None and bools are equal only when their bits are.
+		*out = mix(v.bits);
+		return true;
+	}
+
+	switch (Value_as_object(v)->type) {
+	case STARLARK_TYPE_INT: {
+		const struct starlark_Int *i =
+			(struct starlark_Int *)Value_as_object(v);
+		*out = hash_whole(Int_low_u64(i), Int_sign(i) < 0,
+				  Int_bit_len(i));
+		return true;
+	}
+	case STARLARK_TYPE_FLOAT:
+		*out = hash_float(Value_as_float(v));
+		return true;
+	case STARLARK_TYPE_STRING:
+		*out = Str_hash((struct starlark_Str *)Value_as_object(v));
+		return true;
+	case STARLARK_TYPE_TUPLE: {
+		// Tuples are only hashable if everything in them is.
+		const struct starlark_Tuple *t =
+			(struct starlark_Tuple *)Value_as_object(v);
+		uint64_t h = mix(t->len);
+		for (size_t i = 0; i < t->len; i += 1) {
+			uint64_t item = 0;
+			if (!Value_hash(t->items[i], &item)) {
+				return false;
+			}
+
+			h = mix(h ^ item) + i;
+		}
+
+		*out = h;
+		return true;
+	}
+	case STARLARK_TYPE_FUNCTION:
+	case STARLARK_TYPE_BUILTIN:
+		// Functions are only equal to themselves.
+		*out = mix(v.bits);
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Returns true if the int i is equal to the float f.
+static bool int_equal_float(const struct starlark_Value i, const double f)
+{
+	if (!isfinite(f) || f != trunc(f)) {
+		return false;
+	}
+
+	if (Value_is_small_int(i)) {
+		// Every small int fits in 60 bits, so any float outside that
+		// range can't be equal, and converting the rest is exact.
+		if (fabs(f) > (double)INT60_MAX) {
+			return false;
+		}
+
+		return Value_as_small_int(i) == (int64_t)f;
+	}
+
+	return Int_eq_double((struct starlark_Int *)Value_as_object(i), f);
+}
+
+// Lists and tuples which are nested deeper than this are compared as unequal,
+// since they probably contain themselves.
+#define MAX_DEPTH 64
+
+static bool equal(const struct starlark_Value a, const struct starlark_Value b,
+		  const int depth);
+
+static bool items_equal(const struct starlark_Value a,
+			const struct starlark_Value b, const int depth)
+{
+	const struct starlark_Value *x = NULL;
+	const struct starlark_Value *y = NULL;
+	size_t x_len = 0;
+	size_t y_len = 0;
+	Value_items(a, &x, &x_len);
+	Value_items(b, &y, &y_len);
+	if (x_len != y_len || depth >= MAX_DEPTH) {
+		return false;
+	}
+
+	for (size_t i = 0; i < x_len; i += 1) {
+		if (!equal(x[i], y[i], depth + 1)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Ranges are equal if they hold the same sequence of ints, however they were
+// written.
+static bool range_equal(const struct starlark_Range *a,
+			const struct starlark_Range *b)
+{
+	const size_t len = Range_len(a);
+	if (len != Range_len(b)) {
+		return false;
+	}
+
+	return len == 0 ||
+	       (a->start == b->start && (len == 1 || a->step == b->step));
+}
+
+bool Value_equal(const struct starlark_Value a, const struct starlark_Value b)
+{
+	return equal(a, b, 0);
+}
+
+static bool equal(const struct starlark_Value a, const struct starlark_Value b,
+		  const int depth)
+{
+	if (a.bits == b.bits) {
+		return true;
+	}
+
+	const enum starlark_Type ta = Value_type(a);
+	const enum starlark_Type tb = Value_type(b);
+	if (ta == STARLARK_TYPE_INT && tb == STARLARK_TYPE_INT) {
+		// Small ints are equal only when their bits are, and are never
+		// equal to a heap int.
+		if (!Value_is_object(a) || !Value_is_object(b)) {
+			return false;
+		}
+
+		return Value_int_cmp(a, b) == 0;
+	}
+
+	if (ta == STARLARK_TYPE_FLOAT && tb == STARLARK_TYPE_FLOAT) {
+		const double x = Value_as_float(a);
+		const double y = Value_as_float(b);
+		// Starlark considers every NaN equal to each other.
+		return x == y || (isnan(x) && isnan(y));
+	}
+
+	if (ta == STARLARK_TYPE_INT && tb == STARLARK_TYPE_FLOAT) {
+		return int_equal_float(a, Value_as_float(b));
+	}
+
+	if (ta == STARLARK_TYPE_FLOAT && tb == STARLARK_TYPE_INT) {
+		return int_equal_float(b, Value_as_float(a));
+	}
+
+	if (ta == STARLARK_TYPE_STRING && tb == STARLARK_TYPE_STRING) {
+		return Str_equal((struct starlark_Str *)Value_as_object(a),
+				 (struct starlark_Str *)Value_as_object(b));
+	}
+
+	if (ta == STARLARK_TYPE_DICT && tb == STARLARK_TYPE_DICT) {
+		return Dict_equal((struct starlark_Dict *)Value_as_object(a),
+				  (struct starlark_Dict *)Value_as_object(b));
+	}
+
+	if (ta != tb) {
+		return false;
+	}
+
+	if (ta == STARLARK_TYPE_LIST || ta == STARLARK_TYPE_TUPLE) {
+		return items_equal(a, b, depth);
+	}
+
+	if (ta == STARLARK_TYPE_RANGE) {
+		return range_equal((struct starlark_Range *)Value_as_object(a),
+				   (struct starlark_Range *)Value_as_object(b));
+	}
+
+	return false;
+}
+
+void Value_retain(const struct starlark_Value v)
+{
+	if (!Value_is_object(v)) {
+		return;
+	}
+
+	Value_as_object(v)->refs += 1;
+}
+
+void Value_release(const struct starlark_Value v)
+{
+	if (!Value_is_object(v)) {
+		return;
+	}
+
+	struct starlark_Object *o = Value_as_object(v);
+	assert(o->refs > 0);
+	o->refs -= 1;
+	if (o->refs != 0) {
+		return;
+	}
+
+	switch (o->type) {
+	case STARLARK_TYPE_INT:
+		Int_destroy((struct starlark_Int *)o);
+		break;
+	case STARLARK_TYPE_FLOAT:
+		free(o);
+		break;
+	case STARLARK_TYPE_STRING:
+		Str_destroy((struct starlark_Str *)o);
+		break;
+	case STARLARK_TYPE_DICT:
+		Dict_destroy((struct starlark_Dict *)o);
+		break;
+	case STARLARK_TYPE_LIST:
+		List_destroy((struct starlark_List *)o);
+		break;
+	case STARLARK_TYPE_TUPLE:
+		Tuple_destroy((struct starlark_Tuple *)o);
+		break;
+	case STARLARK_TYPE_RANGE:
+		free(o);
+		break;
+	case STARLARK_TYPE_FUNCTION:
+		Function_destroy((struct starlark_Function *)o);
+		break;
+	case STARLARK_TYPE_BUILTIN:
+		Builtin_destroy((struct starlark_Builtin *)o);
+		break;
+	case STARLARK_TYPE_CELL:
+		Cell_destroy((struct starlark_Cell *)o);
+		break;
+	case STARLARK_TYPE_ITERATOR:
+		Iterator_destroy((struct starlark_Iterator *)o);
+		break;
+	default:
+		panic("don't know how to free value of type %d", o->type);
+	}
+}
+
+// The largest shift count allowed by <<. Anything bigger is almost certainly a
+// mistake, and would need an enormous amount of memory.
+#define MAX_SHIFT 512
+
+static bool fits_small(const int64_t i)
+{
+	return i >= INT60_MIN && i <= INT60_MAX;
+}
+
+// Returns v as a starlark_Int. If v is stored inline, a new int is created and
+// stored in *tmp, which the caller must destroy.
+// Returns NULL on failure.
+static const struct starlark_Int *borrow_Int(const struct starlark_Value v,
+					     struct starlark_Int **tmp)
+{
+	if (Value_is_object(v)) {
+		return (struct starlark_Int *)Value_as_object(v);
+	}
+
+	*tmp = Value_to_Int(v);
+	return *tmp;
+}
+
+typedef int (*Int_binop)(const struct starlark_Int *a,
+			 const struct starlark_Int *b, struct starlark_Int *c);
+
+// Computes a op b with heap ints, for when the result might not fit inline.
+static int bigint_binop(const struct starlark_Value a,
+			const struct starlark_Value b, Int_binop op,
+			struct starlark_Value *out)
+{
+	struct starlark_Int *tmp_a = NULL;
+	struct starlark_Int *tmp_b = NULL;
+	struct starlark_Int *c = Int_create();
+	const struct starlark_Int *x = borrow_Int(a, &tmp_a);
+	const struct starlark_Int *y = borrow_Int(b, &tmp_b);
+
+	int result = STARLARK_ERROR_OOM;
+	if (c != NULL && x != NULL && y != NULL) {
+		result = op(x, y, c);
+	}
+
+	Int_destroy(tmp_a);
+	Int_destroy(tmp_b);
+	if (result != 0) {
+		Int_destroy(c);
+		return result;
+	}
+
+	*out = Value_from_Int(c);
+	return 0;
+}
+
+int Value_from_i64(const int64_t i, struct starlark_Value *out)
+{
+	if (fits_small(i)) {
+		*out = Value_small_int(i);
+		return 0;
+	}
+
+	struct starlark_Int *c = Int_create();
+	if (c == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	if (Int_set_i64(c, i) != 0) {
+		Int_destroy(c);
+		return STARLARK_ERROR_OOM;
+	}
+
+	*out = Value_from_Int(c);
+	return 0;
+}
+
+static bool both_small(const struct starlark_Value a,
+		       const struct starlark_Value b)
+{
+	return Value_is_small_int(a) && Value_is_small_int(b);
+}
+
+int Value_int_add(const struct starlark_Value a, const struct starlark_Value b,
+		  struct starlark_Value *out)
+{
+	if (both_small(a, b)) {
+		// Two 60-bit numbers can't overflow 64 bits.
+		const int64_t c = Value_as_small_int(a) + Value_as_small_int(b);
+		return Value_from_i64(c, out);
+	}
+
+	return bigint_binop(a, b, Int_add, out);
+}
+
+int Value_int_sub(const struct starlark_Value a, const struct starlark_Value b,
+		  struct starlark_Value *out)
+{
+	if (both_small(a, b)) {
+		const int64_t c = Value_as_small_int(a) - Value_as_small_int(b);
+		return Value_from_i64(c, out);
+	}
+
+	return bigint_binop(a, b, Int_sub, out);
+}
+
+int Value_int_mul(const struct starlark_Value a, const struct starlark_Value b,
+		  struct starlark_Value *out)
+{
+	int64_t c = 0;
+	if (both_small(a, b) &&
+	    !__builtin_mul_overflow(Value_as_small_int(a),
+				    Value_as_small_int(b), &c)) {
+		return Value_from_i64(c, out);
+	}
+
+	return bigint_binop(a, b, Int_mul, out);
+}
+
+static int Int_floordiv(const struct starlark_Int *a,
+			const struct starlark_Int *b, struct starlark_Int *c)
+{
+	return Int_divmod(a, b, c, NULL);
+}
+
+static int Int_mod(const struct starlark_Int *a, const struct starlark_Int *b,
+		   struct starlark_Int *c)
+{
+	return Int_divmod(a, b, NULL, c);
+}
+
+int Value_int_floordiv(const struct starlark_Value a,
+		       const struct starlark_Value b,
+		       struct starlark_Value *out)
+{
+	if (!Value_truth(b)) {
+		return STARLARK_ERRORCODE_DIVISION_BY_ZERO;
+	}
+
+	if (both_small(a, b)) {
+		const int64_t x = Value_as_small_int(a);
+		const int64_t y = Value_as_small_int(b);
+		int64_t q = x / y;
+		if (x % y != 0 && (x < 0) != (y < 0)) {
+			q -= 1;
+		}
+
+		// INT60_MIN // -1 doesn't fit in 60 bits.
+		return Value_from_i64(q, out);
+	}
+
+	return bigint_binop(a, b, Int_floordiv, out);
+}
+
+int Value_int_mod(const struct starlark_Value a, const struct starlark_Value b,
+		  struct starlark_Value *out)
+{
+	if (!Value_truth(b)) {
+		return STARLARK_ERRORCODE_DIVISION_BY_ZERO;
+	}
+
+	if (both_small(a, b)) {
+		const int64_t y = Value_as_small_int(b);
+		int64_t r = Value_as_small_int(a) % y;
+		if (r != 0 && (r < 0) != (y < 0)) {
+			r += y;
+		}
+
+		*out = Value_small_int(r);
+		return 0;
+	}
+
+	return bigint_binop(a, b, Int_mod, out);
+}
+
+typedef int (*Int_shift)(const struct starlark_Int *a, const uint32_t b,
+			 struct starlark_Int *c);
+
+static int bigint_shift(const struct starlark_Value a, const uint32_t b,
+			Int_shift op, struct starlark_Value *out)
+{
+	struct starlark_Int *tmp = NULL;
+	struct starlark_Int *c = Int_create();
+	const struct starlark_Int *x = borrow_Int(a, &tmp);
+	int ret = STARLARK_ERROR_OOM;
+	if (c != NULL && x != NULL) {
+		ret = op(x, b, c);
+	}
+
+	Int_destroy(tmp);
+	if (ret != 0) {
+		Int_destroy(c);
+		return ret;
+	}
+
+	*out = Value_from_Int(c);
+	return 0;
+}
+
+int Value_int_lshift(const struct starlark_Value a,
+		     const struct starlark_Value b, struct starlark_Value *out)
+{
+	if (Value_int_cmp(b, Value_small_int(0)) < 0) {
+		return STARLARK_ERRORCODE_NEGATIVE_SHIFT;
+	}
+
+	if (!Value_is_small_int(b) || Value_as_small_int(b) >= MAX_SHIFT) {
+		return STARLARK_ERRORCODE_SHIFT_TOO_BIG;
+	}
+
+	const int64_t count = Value_as_small_int(b);
+	int64_t c = 0;
+	if (Value_is_small_int(a) && count < 63 &&
+	    !__builtin_mul_overflow(Value_as_small_int(a), INT64_C(1) << count,
+				    &c)) {
+		return Value_from_i64(c, out);
+	}
+
+	return bigint_shift(a, (uint32_t)count, Int_lshift, out);
+}
+
+int Value_int_rshift(const struct starlark_Value a,
+		     const struct starlark_Value b, struct starlark_Value *out)
+{
+	if (Value_int_cmp(b, Value_small_int(0)) < 0) {
+		return STARLARK_ERRORCODE_NEGATIVE_SHIFT;
+	}
+
+	if (Value_is_small_int(a)) {
+		const int64_t x = Value_as_small_int(a);
+		if (!Value_is_small_int(b) || Value_as_small_int(b) >= 63) {
+			*out = Value_small_int(x < 0 ? -1 : 0);
+		} else {
+			*out = Value_small_int(x >> Value_as_small_int(b));
+		}
+
+		return 0;
+	}
+
+	if (!Value_is_small_int(b) || Value_as_small_int(b) > UINT32_MAX) {
+		*out = Value_small_int(Value_int_cmp(a, Value_small_int(0)) < 0 ?
+					       -1 :
+					       0);
+		return 0;
+	}
+
+	return bigint_shift(a, (uint32_t)Value_as_small_int(b), Int_rshift,
+			    out);
+}
+
+int Value_int_and(const struct starlark_Value a, const struct starlark_Value b,
+		  struct starlark_Value *out)
+{
+	if (both_small(a, b)) {
+		*out = Value_small_int(Value_as_small_int(a) &
+				       Value_as_small_int(b));
+		return 0;
+	}
+
+	return bigint_binop(a, b, Int_and, out);
+}
+
+int Value_int_or(const struct starlark_Value a, const struct starlark_Value b,
+		 struct starlark_Value *out)
+{
+	if (both_small(a, b)) {
+		*out = Value_small_int(Value_as_small_int(a) |
+				       Value_as_small_int(b));
+		return 0;
+	}
+
+	return bigint_binop(a, b, Int_or, out);
+}
+
+int Value_int_xor(const struct starlark_Value a, const struct starlark_Value b,
+		  struct starlark_Value *out)
+{
+	if (both_small(a, b)) {
+		*out = Value_small_int(Value_as_small_int(a) ^
+				       Value_as_small_int(b));
+		return 0;
+	}
+
+	return bigint_binop(a, b, Int_xor, out);
+}
+
+static int bigint_unop(const struct starlark_Value a,
+		       int (*op)(const struct starlark_Int *a,
+				 struct starlark_Int *c),
+		       struct starlark_Value *out)
+{
+	struct starlark_Int *c = Int_create();
+	if (c == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	if (op((struct starlark_Int *)Value_as_object(a), c) != 0) {
+		Int_destroy(c);
+		return STARLARK_ERROR_OOM;
+	}
+
+	*out = Value_from_Int(c);
+	return 0;
+}
+
+int Value_int_neg(const struct starlark_Value a, struct starlark_Value *out)
+{
+	if (Value_is_small_int(a)) {
+		// -INT60_MIN doesn't fit in 60 bits.
+		return Value_from_i64(-Value_as_small_int(a), out);
+	}
+
+	return bigint_unop(a, Int_neg, out);
+}
+
+int Value_int_not(const struct starlark_Value a, struct starlark_Value *out)
+{
+	if (Value_is_small_int(a)) {
+		*out = Value_small_int(~Value_as_small_int(a));
+		return 0;
+	}
+
+	return bigint_unop(a, Int_not, out);
+}
+
+int Value_int_cmp(const struct starlark_Value a, const struct starlark_Value b)
+{
+	if (both_small(a, b)) {
+		const int64_t x = Value_as_small_int(a);
+		const int64_t y = Value_as_small_int(b);
+		return (x > y) - (x < y);
+	}
+
+	// Heap ints never fit in 60 bits, so an inline int is always between
+	// the negative and positive heap ints.
+	if (Value_is_small_int(a)) {
+		return -Int_sign((struct starlark_Int *)Value_as_object(b));
+	}
+
+	if (Value_is_small_int(b)) {
+		return Int_sign((struct starlark_Int *)Value_as_object(a));
+	}
+
+	return Int_cmp((struct starlark_Int *)Value_as_object(a),
+		       (struct starlark_Int *)Value_as_object(b));
+}
+
+// A growable buffer which values are printed into, so that str() can make a
+// string of what would be printed. Once an allocation fails, nothing else is
+// written to it and oom is set.
+struct buf {
+	size_t len;
+	size_t cap;
+	char *ptr;
+	bool oom;
+};
+
+static void buf_write(struct buf *b, const size_t len, const char *s)
+{
+	// Nothing has been allocated yet when the first write is empty, and
+	// memcpy can't be given a null pointer even to copy nothing.
+	if (b->oom || len == 0) {
+		return;
+	}
+
+	if (len > b->cap - b->len) {
+		size_t cap = MAX(b->cap * 2, 64);
+		while (cap - b->len < len) {
+			cap *= 2;
+		}
+
+		char *ptr = realloc(b->ptr, cap);
+		if (ptr == NULL) {
+			b->oom = true;
+			return;
+		}
+
+		b->ptr = ptr;
+		b->cap = cap;
+	}
+
+	memcpy(b->ptr + b->len, s, len);
+	b->len += len;
+}
+
+static void buf_puts(struct buf *b, const char *s)
+{
+	buf_write(b, strlen(s), s);
+}
+
+// Writes x with the fewest digits which still read back as x. Like Python,
+// exponents are only used for numbers below 1e-4 or at least 1e16.
+static void float_dump(const double x, struct buf *b)
+{
+	if (isnan(x)) {
+		buf_puts(b, "nan");
+		return;
+	}
+
+	if (isinf(x)) {
+		buf_puts(b, x < 0 ? "-inf" : "+inf");
+		return;
+	}
+
+	char buf[32] = { 0 };
+	int precision = 1;
+	for (; precision <= 17; precision += 1) {
+		snprintf(buf, sizeof(buf), "%.*e", precision - 1, x);
+		if (strtod(buf, NULL) == x) {
+			break;
+		}
+	}
+
+	const int exp = atoi(strchr(buf, 'e') + 1);
+	if (exp < -4 || exp >= 16) {
+		buf_puts(b, buf);
+		return;
+	}
+
+	snprintf(buf, sizeof(buf), "%.*f", MAX(precision - 1 - exp, 1), x);
+	buf_puts(b, buf);
+}
+
+// Writes the first len bytes of str as a quoted starlark string literal.
+static void string_repr(const size_t len, const char *str, struct buf *b)
+{
+	buf_puts(b, "\"");
+	for (size_t i = 0; i < len; i += 1) {
+		const char c = str[i];
+		switch (c) {
+		case '"':
+			buf_puts(b, "\\\"");
+			break;
+		case '\\':
+			buf_puts(b, "\\\\");
+			break;
+		case '\n':
+			buf_puts(b, "\\n");
+			break;
+		case '\r':
+			buf_puts(b, "\\r");
+			break;
+		case '\t':
+			buf_puts(b, "\\t");
+			break;
+		default:
+			if ((unsigned char)c < 0x20 || c == 0x7f) {
+				char hex[8] = { 0 };
+				snprintf(hex, sizeof(hex), "\\x%02x",
+					 (unsigned char)c);
+				buf_puts(b, hex);
+			} else {
+				buf_write(b, 1, &c);
+			}
+		}
+	}
+	buf_puts(b, "\"");
+}
+
+static void dump(const struct starlark_Value v, const bool repr,
+		 const int depth, struct buf *b);
+
+// Writes the n values in items separated by commas.
+static void items_dump(const size_t n, const struct starlark_Value *items,
+		       const int depth, struct buf *b)
+{
+	for (size_t i = 0; i < n; i += 1) {
+		if (i != 0) {
+			buf_puts(b, ", ");
+		}
+
+		dump(items[i], true, depth + 1, b);
+	}
+}
+
+// Writes v as the starlark str() function would, or as repr() would if repr is
+// true. They only differ for strings, which repr() quotes.
+static void dump(const struct starlark_Value v, const bool repr,
+		 const int depth, struct buf *b)
+{
+	char num[64] = { 0 };
+	if (depth >= MAX_DEPTH) {
+		buf_puts(b, "...");
+		return;
+	}
+
+	switch (Value_type(v)) {
+	case STARLARK_TYPE_NONE:
+		buf_puts(b, "None");
+		break;
+	case STARLARK_TYPE_BOOL:
+		buf_puts(b, v.bits == VALUE_TRUE.bits ? "True" : "False");
+		break;
+	case STARLARK_TYPE_INT: {
+		if (Value_is_small_int(v)) {
+			snprintf(num, sizeof(num), "%" PRId64,
+				 Value_as_small_int(v));
+			buf_puts(b, num);
+			break;
+		}
+
+		char *str = Int_to_str((struct starlark_Int *)Value_as_object(v),
+				       10);
+		if (str == NULL) {
+			buf_puts(b, "(error retrieving INT value)");
+		} else {
+			buf_puts(b, str);
+		}
+		free(str);
+		break;
+	}
+	case STARLARK_TYPE_FLOAT:
+		float_dump(Value_as_float(v), b);
+		break;
+	case STARLARK_TYPE_STRING: {
+		const struct starlark_Str *str =
+			(struct starlark_Str *)Value_as_object(v);
+		if (repr) {
+			string_repr(Str_len(str), Str_data(str), b);
+		} else {
+			buf_write(b, Str_len(str), Str_data(str));
+		}
+		break;
+	}
+	case STARLARK_TYPE_DICT: {
+		const struct starlark_Dict *d =
+			(struct starlark_Dict *)Value_as_object(v);
+		size_t pos = 0;
+		struct starlark_Value key = { 0 };
+		struct starlark_Value value = { 0 };
+		bool first = true;
+		buf_puts(b, "{");
+		while (Dict_next(d, &pos, &key, &value)) {
+			if (!first) {
+				buf_puts(b, ", ");
+			}
+
+			first = false;
+			dump(key, true, depth + 1, b);
+			buf_puts(b, ": ");
+			dump(value, true, depth + 1, b);
+		}
+		buf_puts(b, "}");
+		break;
+	}
+	case STARLARK_TYPE_LIST: {
+		const struct starlark_List *l = (void *)Value_as_object(v);
+		buf_puts(b, "[");
+		items_dump(l->len, l->items, depth, b);
+		buf_puts(b, "]");
+		break;
+	}
+	case STARLARK_TYPE_TUPLE: {
+		const struct starlark_Tuple *t = (void *)Value_as_object(v);
+		buf_puts(b, "(");
+		items_dump(t->len, t->items, depth, b);
+		buf_puts(b, t->len == 1 ? ",)" : ")");
+		break;
+	}
+	case STARLARK_TYPE_RANGE: {
+		const struct starlark_Range *r = (void *)Value_as_object(v);
+		if (r->step != 1) {
+			snprintf(num, sizeof(num),
+				 "range(%" PRId64 ", %" PRId64 ", %" PRId64 ")",
+				 r->start, r->stop, r->step);
+		} else if (r->start != 0) {
+			snprintf(num, sizeof(num),
+				 "range(%" PRId64 ", %" PRId64 ")", r->start,
+				 r->stop);
+		} else {
+			snprintf(num, sizeof(num), "range(%" PRId64 ")",
+				 r->stop);
+		}
+		buf_puts(b, num);
+		break;
+	}
+	case STARLARK_TYPE_FUNCTION:
+		buf_puts(b, "<function ");
+		buf_puts(b, Function_name(v));
+		buf_puts(b, ">");
+		break;
+	case STARLARK_TYPE_BUILTIN: {
+		const struct starlark_Builtin *fn = (void *)Value_as_object(v);
+		buf_puts(b, "<built-in ");
+		buf_puts(b, Value_is_none(fn->self) ? "function " : "method ");
+		buf_puts(b, fn->name);
+		if (!Value_is_none(fn->self)) {
+			buf_puts(b, " of ");
+			buf_puts(b, Value_type_name(fn->self));
+			buf_puts(b, " value");
+		}
+		buf_puts(b, ">");
+		break;
+	}
+	case STARLARK_TYPE_CELL:
+	case STARLARK_TYPE_ITERATOR:
+		buf_puts(b, "<");
+		buf_puts(b, Value_type_name(v));
+		buf_puts(b, ">");
+		break;
+	}
+}
+
+static void dump_to(const struct starlark_Value v, const bool repr, FILE *f)
+{
+	struct buf b = { 0 };
+	dump(v, repr, 0, &b);
+	if (b.len != 0) {
+		fwrite(b.ptr, 1, b.len, f);
+	}
+
+	if (b.oom) {
+		fputs("(out of memory)", f);
+	}
+
+	free(b.ptr);
+}
+
+void Value_dump(const struct starlark_Value v, FILE *f)
+{
+	assert(f != NULL);
+
+	dump_to(v, false, f);
+}
+
+void Value_repr(const struct starlark_Value v, FILE *f)
+{
+	assert(f != NULL);
+
+	dump_to(v, true, f);
+}
+
+struct starlark_Value Value_to_str(const struct starlark_Value v,
+				   const bool repr)
+{
+	if (!repr && Value_type(v) == STARLARK_TYPE_STRING) {
+		Value_retain(v);
+		return v;
+	}
+
+	struct buf b = { 0 };
+	dump(v, repr, 0, &b);
+	struct starlark_Value result = VALUE_NONE;
+	if (!b.oom) {
+		result = Value_str(b.len, b.ptr);
+	}
+
+	free(b.ptr);
+	return result;
+}
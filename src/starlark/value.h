@@ -0,0 +1,216 @@
+#ifndef STARLARK_VALUE_H
+#define STARLARK_VALUE_H
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "starlark/common.h"
+#include "starlark/int.h"
+
+// The type of a starlark value, as seen by starlark code.
+enum starlark_Type {
+	STARLARK_TYPE_NONE = 0,
+	STARLARK_TYPE_BOOL,
+	STARLARK_TYPE_INT,
+	STARLARK_TYPE_FLOAT,
+	STARLARK_TYPE_STRING,
+	STARLARK_TYPE_DICT,
+	STARLARK_TYPE_LIST,
+	STARLARK_TYPE_TUPLE,
+	STARLARK_TYPE_RANGE,
+	STARLARK_TYPE_FUNCTION,
+	STARLARK_TYPE_BUILTIN,
+
+	// Objects which the interpreter uses internally, and which starlark code
+	// never sees.
+	STARLARK_TYPE_CELL,
+	STARLARK_TYPE_ITERATOR,
+};
+
+// Every value which doesn't fit in a starlark_Value is allocated on the heap,
+// and starts with this header.
+struct starlark_Object {
+	enum starlark_Type type;
+	uint32_t refs;
+};
+
+// A starlark value, packed into a single word.
+//
+// The low 4 bits say what the rest of the word holds:
+//
+//   xxx0 - a pointer to a starlark_Object. Objects are at least 8 byte
+//          aligned, so the low 3 bits of a pointer are always 0.
+//   0001 - an int between INT60_MIN and INT60_MAX, in the high 60 bits.
+//   0011 - None, False or True, in the high 60 bits.
+//
+// This means ints which fit in 60 bits, None and bools never need to be
+// allocated.
+struct starlark_Value {
+	uint64_t bits;
+};
+
+#define VALUE_TAG_BITS 4
+#define VALUE_TAG_MASK UINT64_C(0xf)
+#define VALUE_TAG_INT UINT64_C(0x1)
+#define VALUE_TAG_SPECIAL UINT64_C(0x3)
+
+#define VALUE_NONE ((struct starlark_Value){ (0 << 4) | VALUE_TAG_SPECIAL })
+#define VALUE_FALSE ((struct starlark_Value){ (1 << 4) | VALUE_TAG_SPECIAL })
+#define VALUE_TRUE ((struct starlark_Value){ (2 << 4) | VALUE_TAG_SPECIAL })
+
+static inline bool Value_is_object(const struct starlark_Value v)
+{
+	return (v.bits & 1) == 0;
+}
+
+static inline bool Value_is_small_int(const struct starlark_Value v)
+{
+	return (v.bits & VALUE_TAG_MASK) == VALUE_TAG_INT;
+}
+
+static inline bool Value_is_none(const struct starlark_Value v)
+{
+	return v.bits == VALUE_NONE.bits;
+}
+
+static inline bool Value_is_bool(const struct starlark_Value v)
+{
+	return v.bits == VALUE_FALSE.bits || v.bits == VALUE_TRUE.bits;
+}
+
+static inline struct starlark_Value Value_bool(const bool b)
+{
+	return b ? VALUE_TRUE : VALUE_FALSE;
+}
+
+// i must be between INT60_MIN and INT60_MAX.
+static inline struct starlark_Value Value_small_int(const int64_t i)
+{
+	assert(i >= INT60_MIN && i <= INT60_MAX);
+	return (struct starlark_Value){
+		((uint64_t)i << VALUE_TAG_BITS) | VALUE_TAG_INT,
+	};
+}
+
+static inline int64_t Value_as_small_int(const struct starlark_Value v)
+{
+	assert(Value_is_small_int(v));
+	// Relies on >> of a negative number being an arithmetic shift, which
+	// every compiler we support does.
+	return (int64_t)v.bits >> VALUE_TAG_BITS;
+}
+
+static inline struct starlark_Value Value_object(struct starlark_Object *o)
+{
+	assert(o != NULL);
+	assert(((uintptr_t)o & 7) == 0);
+	return (struct starlark_Value){ (uintptr_t)o };
+}
+
+static inline struct starlark_Object *Value_as_object(
+	const struct starlark_Value v)
+{
+	assert(Value_is_object(v));
+	return (struct starlark_Object *)(uintptr_t)v.bits;
+}
+
+enum starlark_Type Value_type(const struct starlark_Value v);
+
+// Returns the name of v's type, as the starlark type() function would.
+const char *Value_type_name(const struct starlark_Value v);
+
+// Returns i as a value, taking ownership of it. If i fits in 60 bits it's
+// stored inline and destroyed. Returns VALUE_NONE if i is NULL.
+struct starlark_Value Value_from_Int(struct starlark_Int *i);
+
+// Stores i in *out, which is only allocated on the heap if it doesn't fit in 60
+// bits.
+// Returns 0 on success, or STARLARK_ERROR_OOM.
+int Value_from_i64(const int64_t i, struct starlark_Value *out);
+
+// Returns the int stored in v, converting it to a heap int if it's stored
+// inline. v must be an int. The caller owns the result.
+// Returns NULL on failure.
+struct starlark_Int *Value_to_Int(const struct starlark_Value v);
+
+// The Value_int_* functions implement starlark's int operators. a and b must
+// be ints. Ints which fit in 60 bits are handled inline, and only become heap
+// ints when the result doesn't fit.
+//
+// Each returns 0 on success, STARLARK_ERROR_OOM if we couldn't allocate enough
+// memory, or a positive starlark_ErrorCode if starlark doesn't allow the
+// operation, such as dividing by zero. *out is only written on success.
+
+int Value_int_add(const struct starlark_Value a, const struct starlark_Value b,
+		  struct starlark_Value *out);
+int Value_int_sub(const struct starlark_Value a, const struct starlark_Value b,
+		  struct starlark_Value *out);
+int Value_int_mul(const struct starlark_Value a, const struct starlark_Value b,
+		  struct starlark_Value *out);
+// Rounds towards negative infinity.
+int Value_int_floordiv(const struct starlark_Value a,
+		       const struct starlark_Value b,
+		       struct starlark_Value *out);
+// The result has the same sign as b.
+int Value_int_mod(const struct starlark_Value a, const struct starlark_Value b,
+		  struct starlark_Value *out);
+int Value_int_lshift(const struct starlark_Value a,
+		     const struct starlark_Value b, struct starlark_Value *out);
+int Value_int_rshift(const struct starlark_Value a,
+		     const struct starlark_Value b, struct starlark_Value *out);
+int Value_int_and(const struct starlark_Value a, const struct starlark_Value b,
+		  struct starlark_Value *out);
+int Value_int_or(const struct starlark_Value a, const struct starlark_Value b,
+		 struct starlark_Value *out);
+int Value_int_xor(const struct starlark_Value a, const struct starlark_Value b,
+		  struct starlark_Value *out);
+int Value_int_neg(const struct starlark_Value a, struct starlark_Value *out);
+int Value_int_not(const struct starlark_Value a, struct starlark_Value *out);
+
+// Returns a negative number if a < b, 0 if a == b and a positive number if
+// a > b. a and b must be ints.
+int Value_int_cmp(const struct starlark_Value a, const struct starlark_Value b);
+
+// Returns a heap allocated float.
+// Returns VALUE_NONE if we couldn't allocate enough memory.
+struct starlark_Value Value_float(const double f);
+
+double Value_as_float(const struct starlark_Value v);
+
+// Returns a heap allocated string holding a copy of the first len bytes of
+// bytes.
+// Returns VALUE_NONE if we couldn't allocate enough memory.
+struct starlark_Value Value_str(const size_t len, const char *bytes);
+
+// Computes the hash of v, which is the same for any two values which are equal,
+// such as 1 and 1.0.
+// Returns false if v's type can't be hashed.
+bool Value_hash(const struct starlark_Value v, uint64_t *out);
+
+// Returns true if a == b in starlark.
+bool Value_equal(const struct starlark_Value a, const struct starlark_Value b);
+
+// Returns the truth value of v, as the starlark bool() function would.
+bool Value_truth(const struct starlark_Value v);
+
+// Adds a reference to v. Does nothing for inline values.
+void Value_retain(const struct starlark_Value v);
+
+// Drops a reference to v, freeing it once nothing refers to it.
+void Value_release(const struct starlark_Value v);
+
+// Prints v as the starlark str() function would.
+void Value_dump(const struct starlark_Value v, FILE *f);
+
+// Prints v as the starlark repr() function would, which quotes strings.
+void Value_repr(const struct starlark_Value v, FILE *f);
+
+// Returns v as a string value, as the starlark str() function would, or as
+// repr() would if repr is true.
+// Returns VALUE_NONE if we couldn't allocate enough memory.
+struct starlark_Value Value_to_str(const struct starlark_Value v,
+				   const bool repr);
+
+#endif // STARLARK_VALUE_H
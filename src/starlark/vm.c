@@ -0,0 +1,2170 @@
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "starlark/vm.h"
+#include "starlark/builtins.h"
+#include "starlark/common.h"
+#include "starlark/compile.h"
+#include "starlark/dict.h"
+#include "starlark/function.h"
+#include "starlark/int.h"
+#include "starlark/jit.h"
+#include "starlark/list.h"
+#include "starlark/ops.h"
+#include "starlark/parse.h"
+#include "starlark/resolve.h"
+#include "starlark/scratch.h"
+#include "starlark/str.h"
+#include "starlark/strpool.h"
+#include "starlark/util.h"
+#include "starlark/value.h"
+#include "util/common.h"
+#include "util/io.h"
+
+// GCC and Clang can jump straight from one instruction to the next through a
+// table of label addresses, which gives each instruction its own indirect
+// branch for the branch predictor to learn, instead of sharing the one at the
+// top of a switch. Other compilers fall back to the switch.
+#if defined(__GNUC__)
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+
+#if CLARK_OPCODE_PAIRS
+// How many times each instruction ran right after each other one, indexed by
+// the first of them, across every program run so far.
+static uint64_t opcode_pairs[OP_COUNT][OP_COUNT];
+#endif
+
+bool Vm_init(struct starlark_Vm *vm, struct starlark_Context *ctx)
+{
+	assert(vm != NULL);
+	assert(ctx != NULL);
+
+	*vm = (struct starlark_Vm){
+		.ctx = ctx,
+		.slots = malloc(VM_SLOTS_CAP * sizeof(vm->slots[0])),
+	};
+	return vm->slots != NULL;
+}
+
+void Vm_finish(struct starlark_Vm *vm)
+{
+	if (vm == NULL) {
+		return;
+	}
+
+	free(vm->slots);
+	*vm = (struct starlark_Vm){ 0 };
+}
+
+// Returns a frame of len slots, which is taken from the preallocated slots if
+// it fits, every one of them unbound.
+// Returns NULL if we couldn't allocate enough memory.
+static struct starlark_Value *frame_push(struct starlark_Vm *vm,
+					 const size_t len)
+{
+	struct starlark_Value *result = NULL;
+	if (len <= VM_SLOTS_CAP - vm->slots_len) {
+		result = &vm->slots[vm->slots_len];
+		vm->slots_len += len;
+	} else {
+		result = malloc(MAX(len, 1) * sizeof(result[0]));
+		if (result == NULL) {
+			return NULL;
+		}
+	}
+
+	for (size_t i = 0; i < len; i += 1) {
+		result[i] = VALUE_UNBOUND;
+	}
+
+	return result;
+}
+
+// Releases the first used slots of a frame returned by frame_push.
+static void frame_pop(struct starlark_Vm *vm, struct starlark_Value *frame,
+		      const size_t len, const size_t used)
+{
+	for (size_t i = 0; i < used; i += 1) {
+		Value_release(frame[i]);
+	}
+
+	if (vm->slots_len >= len && frame == &vm->slots[vm->slots_len - len]) {
+		vm->slots_len -= len;
+	} else {
+		free(frame);
+	}
+}
+
+// Describes the error code which the instruction at ip failed with, given its
+// operands, which are still on the stack below sp.
+// Returns a handle into the context's strpool, or 0 if there's nothing to add
+// to the error's message.
+static int64_t describe(struct starlark_Vm *vm,
+			const struct starlark_Module *m,
+			const struct starlark_Code *code, const uint8_t *ip,
+			const struct starlark_Value *sp, const int err)
+{
+	struct starlark_Context *ctx = vm->ctx;
+	const uint8_t *pc = ip + 1;
+	const uint32_t arg = Opcode_has_arg[ip[0]] ? varint_read(&pc) : 0;
+	const uint8_t op = Opcode_base[ip[0]] != OP_NOP ? Opcode_base[ip[0]] :
+							    ip[0];
+	switch (err) {
+	case STARLARK_ERRORCODE_UNSUPPORTED_BINARY:
+		if (op == OP_INPLACE_ADD) {
+			return err_string(ctx, "%s += %s",
+					  Value_type_name(sp[-2]),
+					  Value_type_name(sp[-1]));
+		}
+
+		if (op < OP_ADD || op > OP_NOT_IN) {
+			return 0;
+		}
+
+		return err_string(ctx, "%s %s %s", Value_type_name(sp[-2]),
+				  Op_symbol(op - OP_ADD),
+				  Value_type_name(sp[-1]));
+	case STARLARK_ERRORCODE_UNSUPPORTED_UNARY:
+		return err_string(ctx, "%s%s",
+				  op == OP_PLUS ? "+" :
+				  op == OP_NEG	? "-" :
+						  "~",
+				  Value_type_name(sp[-1]));
+	case STARLARK_ERRORCODE_UNBOUND_GLOBAL:
+		return m->program.globals[arg];
+	case STARLARK_ERRORCODE_UNBOUND_LOCAL:
+		return op == OP_LOAD_FREE ? code->frees[arg].name :
+					    code->local_names[arg];
+	case STARLARK_ERRORCODE_NOT_ITERABLE:
+		return err_string(ctx, "%s", Value_type_name(sp[-1]));
+	case STARLARK_ERRORCODE_NOT_INDEXABLE:
+		return err_string(ctx, "%s",
+				  Value_type_name(op == OP_SLICE ? sp[-4] :
+						  op == OP_SET_INDEX ? sp[-3] :
+								       sp[-2]));
+	case STARLARK_ERRORCODE_INDEX_OUT_OF_RANGE: {
+		const struct starlark_Value x =
+			op == OP_SET_INDEX ? sp[-3] : sp[-2];
+		const struct starlark_Value key =
+			op == OP_SET_INDEX ? sp[-2] : sp[-1];
+		size_t len = 0;
+		if ((op != OP_INDEX && op != OP_SET_INDEX) ||
+		    !Value_len(x, &len) || !Value_is_small_int(key)) {
+			return 0;
+		}
+
+		return err_string(ctx, "index %lld, length %zu",
+				  (long long)Value_as_small_int(key), len);
+	}
+	case STARLARK_ERRORCODE_INVALID_ARG:
+		if (op == OP_INDEX || op == OP_SET_INDEX) {
+			const struct starlark_Value key =
+				op == OP_SET_INDEX ? sp[-2] : sp[-1];
+			return err_string(ctx, "index: got %s, want int",
+					  Value_type_name(key));
+		}
+
+		if (op == OP_SLICE) {
+			return err_string(ctx, "slice indices must be ints or "
+					       "None, and the step nonzero");
+		}
+
+		if (op == OP_MOD) {
+			return err_string(ctx, "format string doesn't match "
+					       "its arguments");
+		}
+
+		return 0;
+	case STARLARK_ERRORCODE_NO_ATTR: {
+		uint32_t index = arg;
+		struct starlark_Value x = op == OP_SET_ATTR ? sp[-2] : sp[-1];
+		if (ip[0] == OP_CALL_METHOD) {
+			index = METHOD_NAME(arg);
+			x = sp[-1 - (int64_t)CALL_POSITIONAL(arg) -
+			       2 * (int64_t)CALL_NAMED(arg)];
+		}
+
+		const char *name =
+			strpool_get(&ctx->strpool, code->names[index]);
+		return err_string(ctx, "%s has no .%s field or method",
+				  Value_type_name(x), name);
+	}
+	default:
+		return 0;
+	}
+}
+
+// Appends the error ret, which the instruction at ip failed with, to the
+// context's errors, unless it's a negative STARLARK_ERROR_* code or has already
+// been reported.
+// Returns ret, or STARLARK_ERROR_OOM if we couldn't append it.
+static int report(struct starlark_Vm *vm, const struct starlark_Module *m,
+		  const struct starlark_Code *code, const uint8_t *ip,
+		  const struct starlark_Value *sp, int ret)
+{
+	if (ret <= 0 || vm->reported) {
+		return ret;
+	}
+
+	int64_t detail = vm->detail;
+	if (detail == 0) {
+		detail = describe(vm, m, code, ip, sp, ret);
+	}
+
+	// An OP_CALL_METHOD which doesn't find its method reports it where
+	// the attribute is, which is the position of the byte after it.
+	const bool attr = ip[0] == OP_CALL_METHOD &&
+			  ret == STARLARK_ERRORCODE_NO_ATTR;
+	const struct starlark_Error err = {
+		.code = ret,
+		.start = Code_position(code, (size_t)(ip - code->code) + attr),
+		.arg.str = detail,
+	};
+	if (!err_append(vm->ctx, err)) {
+		ret = STARLARK_ERROR_OOM;
+	}
+
+	vm->reported = true;
+	vm->detail = 0;
+	return ret;
+}
+
+static int execute(struct starlark_Vm *vm, struct starlark_Module *m,
+		   const struct starlark_Code *code,
+		   struct starlark_Value *frees, struct starlark_Value *frame,
+		   struct starlark_Value *out);
+
+// Stores the local of the named parameter called name in *out.
+// Returns false if there isn't a parameter called name.
+static bool find_param(const struct starlark_Code *code,
+		       const struct starlark_Value name, uint32_t *out)
+{
+	for (uint32_t i = 0; i < code->params_len; i += 1) {
+		if (Value_equal(code->param_names[i], name)) {
+			*out = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static int64_t quote_str(struct starlark_Context *ctx,
+			 const struct starlark_Value s)
+{
+	const struct starlark_Str *str =
+		(const struct starlark_Str *)Value_as_object(s);
+	return err_string(ctx, "%.*s", (int)Str_len(str), Str_data(str));
+}
+
+// Binds the arguments of a call to fn to the parameters in frame.
+static int bind_args(struct starlark_Vm *vm, struct starlark_Function *fn,
+		     struct starlark_Value *frame, const size_t len,
+		     const struct starlark_Value *args, const size_t named_len,
+		     const struct starlark_Value *named)
+{
+	const struct starlark_Code *code = fn->code;
+	const uint32_t positional = code->params_len - code->kwonly_len;
+	for (size_t i = 0; i < MIN(len, positional); i += 1) {
+		frame[i] = args[i];
+		Value_retain(args[i]);
+	}
+
+	uint32_t next = code->params_len;
+	if (code->varargs) {
+		const size_t extra = len > positional ? len - positional : 0;
+		struct starlark_Tuple *t = Tuple_create(extra);
+		if (t == NULL) {
+			return STARLARK_ERROR_OOM;
+		}
+
+		for (size_t i = 0; i < extra; i += 1) {
+			t->items[i] = args[positional + i];
+			Value_retain(t->items[i]);
+		}
+
+		frame[next] = Value_object(&t->obj);
+		next += 1;
+	} else if (len > positional) {
+		vm->detail = err_string(vm->ctx,
+					"%s: got %zu arguments, want at most "
+					"%" PRIu32,
+					Function_name(Value_object(&fn->obj)),
+					len, positional);
+		return STARLARK_ERRORCODE_ARGS;
+	}
+
+	struct starlark_Dict *kwargs = NULL;
+	if (code->kwargs) {
+		kwargs = Dict_create();
+		if (kwargs == NULL) {
+			return STARLARK_ERROR_OOM;
+		}
+
+		frame[next] = Value_object((struct starlark_Object *)kwargs);
+	}
+
+	for (size_t i = 0; i < named_len; i += 1) {
+		const struct starlark_Value name = named[2 * i];
+		const struct starlark_Value value = named[2 * i + 1];
+		uint32_t j = 0;
+		struct starlark_Value old = { 0 };
+		int ret = 0;
+		if (find_param(code, name, &j)) {
+			if (frame[j].bits != VALUE_UNBOUND.bits) {
+				vm->detail = quote_str(vm->ctx, name);
+				return STARLARK_ERRORCODE_DUPLICATE_KWARG;
+			}
+
+			frame[j] = value;
+			Value_retain(value);
+		} else if (kwargs == NULL) {
+			vm->detail = quote_str(vm->ctx, name);
+			return STARLARK_ERRORCODE_UNEXPECTED_KWARG;
+		} else if ((ret = Dict_get(kwargs, name, &old)) == 0) {
+			vm->detail = quote_str(vm->ctx, name);
+			return STARLARK_ERRORCODE_DUPLICATE_KWARG;
+		} else if (ret != STARLARK_ERRORCODE_KEY_NOT_FOUND ||
+			   (ret = Dict_set(kwargs, name, value)) != 0) {
+			return ret;
+		}
+	}
+
+	for (uint32_t i = 0; i < code->params_len; i += 1) {
+		if (frame[i].bits != VALUE_UNBOUND.bits) {
+			continue;
+		}
+
+		if (code->defaults[i] == UINT32_MAX) {
+			vm->detail = quote_str(vm->ctx, code->param_names[i]);
+			return STARLARK_ERRORCODE_MISSING_ARG;
+		}
+
+		frame[i] = fn->values[code->defaults[i]];
+		Value_retain(frame[i]);
+	}
+
+	return 0;
+}
+
+// Puts each local which a nested function refers to into a cell.
+static int make_cells(const struct starlark_Code *code,
+		      struct starlark_Value *frame)
+{
+	for (uint32_t i = 0; i < code->cells_len; i += 1) {
+		struct starlark_Value *local = &frame[code->cells[i]];
+		struct starlark_Cell *cell = Cell_create(*local);
+		if (cell == NULL) {
+			return STARLARK_ERROR_OOM;
+		}
+
+		Value_release(*local);
+		*local = Value_object(&cell->obj);
+	}
+
+	return 0;
+}
+
+static int call_function(struct starlark_Vm *vm, struct starlark_Function *fn,
+			 const size_t len, const struct starlark_Value *args,
+			 const size_t named_len,
+			 const struct starlark_Value *named,
+			 struct starlark_Value *out)
+{
+	const struct starlark_Code *code = fn->code;
+	struct starlark_Module *m = fn->module;
+	const size_t index = (size_t)(code - m->program.codes);
+	if (vm->depth >= VM_MAX_DEPTH) {
+		return STARLARK_ERRORCODE_STACK_OVERFLOW;
+	}
+
+	if (m->running[index]) {
+		vm->detail = code->name;
+		return STARLARK_ERRORCODE_RECURSION;
+	}
+
+	const size_t frame_len = Vm_frame_len(code);
+	struct starlark_Value *frame = frame_push(vm, frame_len);
+	if (frame == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	int ret = bind_args(vm, fn, frame, len, args, named_len, named);
+	if (ret == 0) {
+		ret = make_cells(code, frame);
+	}
+
+	if (ret != 0) {
+		frame_pop(vm, frame, frame_len, code->locals_len);
+		return ret;
+	}
+
+	m->running[index] = true;
+	vm->depth += 1;
+	ret = execute(vm, m, code, &fn->values[fn->defaults_len], frame, out);
+	vm->depth -= 1;
+	m->running[index] = false;
+	frame_pop(vm, frame, frame_len, 0);
+	return ret;
+}
+
+int Vm_call(struct starlark_Vm *vm, const struct starlark_Value fn,
+	    const size_t len, const struct starlark_Value *args,
+	    const size_t named_len, const struct starlark_Value *named,
+	    struct starlark_Value *out)
+{
+	assert(vm != NULL);
+	assert(out != NULL);
+
+	switch (Value_type(fn)) {
+	case STARLARK_TYPE_BUILTIN: {
+		const struct starlark_Builtin *b =
+			(struct starlark_Builtin *)Value_as_object(fn);
+		const struct starlark_Args a = {
+			.self = b->self,
+			.len = len,
+			.args = args,
+			.named_len = named_len,
+			.named = named,
+		};
+		return b->fn(vm, &a, out);
+	}
+	case STARLARK_TYPE_FUNCTION: {
+		struct starlark_Function *f =
+			(struct starlark_Function *)Value_as_object(fn);
+		return call_function(vm, f, len, args, named_len, named, out);
+	}
+	default:
+		vm->detail = err_string(vm->ctx, "%s", Value_type_name(fn));
+		return STARLARK_ERRORCODE_NOT_CALLABLE;
+	}
+}
+
+// Calls fn with the arguments of an OP_CALL which has *args or **kwargs, which
+// are spread into the positional and named arguments before it.
+static int call_spread(struct starlark_Vm *vm,
+		       const struct starlark_Value *base,
+		       const uint32_t positional, const uint32_t named,
+		       const uint32_t flags, struct starlark_Value *out)
+{
+	const struct starlark_Value *rest = &base[1 + positional + 2 * named];
+	struct starlark_Value varargs = VALUE_NONE;
+	const struct starlark_Value *extra = NULL;
+	size_t extra_len = 0;
+	int ret = 0;
+	if (flags & CALL_VARARGS) {
+		ret = List_from_iterable(*rest, &varargs);
+		if (ret == STARLARK_ERRORCODE_NOT_ITERABLE) {
+			vm->detail = err_string(vm->ctx,
+						"argument after * must be "
+						"iterable, not %s",
+						Value_type_name(*rest));
+			return STARLARK_ERRORCODE_INVALID_ARG;
+		}
+
+		if (ret != 0) {
+			return ret;
+		}
+
+		Value_items(varargs, &extra, &extra_len);
+		rest += 1;
+	}
+
+	struct starlark_Dict *kwargs = NULL;
+	if (flags & CALL_KWARGS) {
+		if (Value_type(*rest) != STARLARK_TYPE_DICT) {
+			Value_release(varargs);
+			vm->detail = err_string(vm->ctx,
+						"argument after ** must be a "
+						"dict, not %s",
+						Value_type_name(*rest));
+			return STARLARK_ERRORCODE_INVALID_ARG;
+		}
+
+		kwargs = (struct starlark_Dict *)Value_as_object(*rest);
+	}
+
+	// Every argument is retained, since the function being called might
+	// change the list or dict they came from.
+	const size_t args_len = positional + extra_len;
+	const size_t named_len = named + (kwargs ? Dict_len(kwargs) : 0);
+	struct starlark_Value *args =
+		malloc(MAX(args_len + 2 * named_len, 1) * sizeof(args[0]));
+	if (args == NULL) {
+		Value_release(varargs);
+		return STARLARK_ERROR_OOM;
+	}
+
+	size_t n = 0;
+	for (size_t i = 0; i < positional; i += 1) {
+		args[n++] = base[1 + i];
+	}
+
+	for (size_t i = 0; i < extra_len; i += 1) {
+		args[n++] = extra[i];
+	}
+
+	for (size_t i = 0; i < 2 * named; i += 1) {
+		args[n++] = base[1 + positional + i];
+	}
+
+	size_t pos = 0;
+	while (kwargs != NULL &&
+	       Dict_next(kwargs, &pos, &args[n], &args[n + 1])) {
+		if (Value_type(args[n]) != STARLARK_TYPE_STRING) {
+			ret = STARLARK_ERRORCODE_INVALID_ARG;
+			vm->detail = err_string(vm->ctx,
+						"keywords must be strings, "
+						"not %s",
+						Value_type_name(args[n]));
+			break;
+		}
+
+		n += 2;
+	}
+
+	for (size_t i = 0; i < n; i += 1) {
+		Value_retain(args[i]);
+	}
+
+	if (ret == 0) {
+		ret = Vm_call(vm, base[0], args_len, args, named_len,
+			      &args[args_len], out);
+	}
+
+	for (size_t i = 0; i < n; i += 1) {
+		Value_release(args[i]);
+	}
+
+	free(args);
+	Value_release(varargs);
+	return ret;
+}
+
+// Returns the method called names[index] of x, for the OP_ATTR or
+// OP_CALL_METHOD whose inline cache is attr_caches[index], or NULL if x doesn't
+// have one. Only a miss in the cache looks the method up by name, and then
+// remembers it in place of the oldest entry.
+static const struct starlark_Method *cached_method(
+	struct starlark_Vm *vm, const struct starlark_Code *code,
+	const uint32_t index, const struct starlark_Value x)
+{
+	struct starlark_AttrCache *cache = &code->attr_caches[index];
+	const uint8_t type = (uint8_t)Value_type(x);
+	for (size_t i = 0; i < ATTR_CACHE_WAYS; i += 1) {
+		if (cache->types[i] == type) {
+			return cache->methods[i];
+		}
+	}
+
+	const struct starlark_Method *m = Builtin_method(
+		type, strpool_get(&vm->ctx->strpool, code->names[index]));
+	if (m == NULL) {
+		return NULL;
+	}
+
+	for (size_t i = ATTR_CACHE_WAYS - 1; i > 0; i -= 1) {
+		cache->types[i] = cache->types[i - 1];
+		cache->methods[i] = cache->methods[i - 1];
+	}
+
+	cache->types[0] = type;
+	cache->methods[0] = m;
+	return m;
+}
+
+int Vm_call_method(struct starlark_Vm *vm, const struct starlark_Code *code,
+		   struct starlark_Value *sp, const uint32_t arg)
+{
+	assert(vm != NULL);
+	assert(code != NULL);
+
+	const uint32_t positional = CALL_POSITIONAL(arg);
+	const uint32_t named = CALL_NAMED(arg);
+	struct starlark_Value *base = sp - (1 + positional + 2 * named);
+	const struct starlark_Method *m =
+		cached_method(vm, code, METHOD_NAME(arg), base[0]);
+	if (m == NULL) {
+		return STARLARK_ERRORCODE_NO_ATTR;
+	}
+
+	const struct starlark_Args a = {
+		.self = base[0],
+		.len = positional,
+		.args = &base[1],
+		.named_len = named,
+		.named = &base[1 + positional],
+	};
+	struct starlark_Value result = { 0 };
+	const int ret = m->fn(vm, &a, &result);
+	if (ret != 0) {
+		return ret;
+	}
+
+	while (sp > base) {
+		sp -= 1;
+		Value_release(*sp);
+	}
+
+	base[0] = result;
+	return 0;
+}
+
+// Replaces the value v with its n elements in reverse order, so the first is on
+// top of the stack.
+static int unpack(struct starlark_Vm *vm, struct starlark_Value *sp,
+		  const uint32_t n)
+{
+	const struct starlark_Value v = sp[-1];
+	struct starlark_Value list = VALUE_NONE;
+	const struct starlark_Value *items = NULL;
+	size_t len = 0;
+	if (!Value_items(v, &items, &len)) {
+		int ret = List_from_iterable(v, &list);
+		if (ret != 0) {
+			return ret;
+		}
+
+		Value_items(list, &items, &len);
+	}
+
+	if (len != n) {
+		Value_release(list);
+		vm->detail = err_string(vm->ctx,
+					"got %zu values, want %" PRIu32, len,
+					n);
+		return STARLARK_ERRORCODE_UNPACK_COUNT;
+	}
+
+	for (size_t i = 0; i < len; i += 1) {
+		Value_retain(items[len - 1 - i]);
+		sp[-1 + (ptrdiff_t)i] = items[len - 1 - i];
+	}
+
+	// v might be the only thing keeping its elements alive, so it's only
+	// released once they've been retained.
+	Value_release(v);
+	Value_release(list);
+	return 0;
+}
+
+// Appends the elements of the list or tuple y to the list x, as x += y does.
+static int list_extend(struct starlark_List *x, const struct starlark_Value y)
+{
+	const struct starlark_Value *items = NULL;
+	size_t len = 0;
+	Value_items(y, &items, &len);
+	if (x->iterators != 0) {
+		return STARLARK_ERRORCODE_MUTATED_DURING_ITERATION;
+	}
+
+	int ret = List_reserve(x, len);
+	if (ret != 0) {
+		return ret;
+	}
+
+	// Reserving room moves x's items, which are y's if x += x.
+	Value_items(y, &items, &len);
+	for (size_t i = 0; i < len; i += 1) {
+		x->items[x->len + i] = items[i];
+		Value_retain(items[i]);
+	}
+
+	x->len += len;
+	return 0;
+}
+
+// Drops the reference which a local holds to the string x, when pc is the
+// instruction which stores over that local with the sum x is about to be part
+// of, as s += t and s = s + t compile to. That leaves the operand stack with
+// the only reference to x when nothing else refers to it, so that Str_append
+// can extend it in place rather than copying it on every iteration.
+static void move_from_local(struct starlark_Value *frame, const uint8_t *pc,
+			    const struct starlark_Value x)
+{
+	if (*pc != OP_STORE_LOCAL || Value_type(x) != STARLARK_TYPE_STRING) {
+		return;
+	}
+
+	pc += 1;
+	const uint32_t local = varint_read(&pc);
+	if (frame[local].bits == x.bits) {
+		Value_release(frame[local]);
+		frame[local] = VALUE_NONE;
+	}
+}
+
+// Returns the value which the source r of a register instruction names, which
+// is borrowed.
+static inline struct starlark_Value reg(const struct starlark_Code *code,
+					const struct starlark_Value *frame,
+					const uint32_t r)
+{
+	return r < code->locals_len ? frame[r] :
+				      code->constants[r - code->locals_len];
+}
+
+// The instructions are run from a single function, so that pc and sp can live
+// in registers for its whole length. Each instruction leaves its operands on
+// the stack until it has succeeded, so that when one fails the error path can
+// describe them and then release everything left in the frame.
+//
+// Running starts from the instruction at pc, with the stack ending at sp,
+// which is the start of the code and an empty stack except when carrying on
+// from where machine code deoptimized.
+static int run(struct starlark_Vm *vm, struct starlark_Module *m,
+	       const struct starlark_Code *code, struct starlark_Value *frees,
+	       struct starlark_Value *frame, struct starlark_Value *sp,
+	       const uint8_t *pc, struct starlark_Value *out)
+{
+#if VM_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+	static const void *const targets[OP_COUNT] = {
+		[OP_NOP] = &&op_NOP,
+		[OP_POP] = &&op_POP,
+		[OP_DUP] = &&op_DUP,
+		[OP_DUP2] = &&op_DUP2,
+		[OP_EXCH] = &&op_EXCH,
+		[OP_NONE] = &&op_NONE,
+		[OP_TRUE] = &&op_TRUE,
+		[OP_FALSE] = &&op_FALSE,
+		[OP_CONSTANT] = &&op_CONSTANT,
+		[OP_LOAD_LOCAL] = &&op_LOAD_LOCAL,
+		[OP_STORE_LOCAL] = &&op_STORE_LOCAL,
+		[OP_LOAD_CELL] = &&op_LOAD_CELL,
+		[OP_STORE_CELL] = &&op_STORE_CELL,
+		[OP_LOAD_FREE] = &&op_LOAD_FREE,
+		[OP_LOAD_GLOBAL] = &&op_LOAD_GLOBAL,
+		[OP_STORE_GLOBAL] = &&op_STORE_GLOBAL,
+		[OP_LOAD_BUILTIN] = &&op_LOAD_BUILTIN,
+		[OP_ADD] = &&op_ADD,
+		[OP_SUB] = &&op_SUB,
+		[OP_MUL] = &&binary,
+		[OP_DIV] = &&binary,
+		[OP_FLOORDIV] = &&binary,
+		[OP_MOD] = &&binary,
+		[OP_BITAND] = &&binary,
+		[OP_BITOR] = &&binary,
+		[OP_XOR] = &&binary,
+		[OP_LSHIFT] = &&binary,
+		[OP_RSHIFT] = &&binary,
+		[OP_EQ] = &&op_EQ,
+		[OP_NOTEQ] = &&op_NOTEQ,
+		[OP_LESS] = &&op_LESS,
+		[OP_LEQ] = &&op_LEQ,
+		[OP_GREATER] = &&op_GREATER,
+		[OP_GEQ] = &&op_GEQ,
+		[OP_IN] = &&binary,
+		[OP_NOT_IN] = &&binary,
+		[OP_INPLACE_ADD] = &&op_INPLACE_ADD,
+		[OP_PLUS] = &&unary,
+		[OP_NEG] = &&unary,
+		[OP_BITNOT] = &&unary,
+		[OP_NOT] = &&op_NOT,
+		[OP_JUMP] = &&op_JUMP,
+		[OP_JUMP_IF_FALSE] = &&op_JUMP_IF_FALSE,
+		[OP_JUMP_IF_TRUE] = &&op_JUMP_IF_TRUE,
+		[OP_JUMP_IF_FALSE_OR_POP] = &&op_JUMP_IF_FALSE_OR_POP,
+		[OP_JUMP_IF_TRUE_OR_POP] = &&op_JUMP_IF_TRUE_OR_POP,
+		[OP_ITER] = &&op_ITER,
+		[OP_FOR_ITER] = &&op_FOR_ITER,
+		[OP_MAKE_TUPLE] = &&op_MAKE_TUPLE,
+		[OP_MAKE_LIST] = &&op_MAKE_LIST,
+		[OP_MAKE_DICT] = &&op_MAKE_DICT,
+		[OP_LIST_APPEND] = &&op_LIST_APPEND,
+		[OP_DICT_SET] = &&op_DICT_SET,
+		[OP_RESERVE] = &&op_RESERVE,
+		[OP_UNPACK] = &&op_UNPACK,
+		[OP_INDEX] = &&op_INDEX,
+		[OP_SET_INDEX] = &&op_SET_INDEX,
+		[OP_SLICE] = &&op_SLICE,
+		[OP_ATTR] = &&op_ATTR,
+		[OP_SET_ATTR] = &&op_SET_ATTR,
+		[OP_CALL] = &&op_CALL,
+		[OP_MAKE_FUNCTION] = &&op_MAKE_FUNCTION,
+		[OP_LOAD] = &&op_LOAD,
+		[OP_RETURN] = &&op_RETURN,
+		[OP_ADD_CONSTANT] = &&op_ADD_CONSTANT,
+		[OP_SUB_CONSTANT] = &&op_SUB_CONSTANT,
+		[OP_INDEX_CONSTANT] = &&op_INDEX_CONSTANT,
+		[OP_JUMP_UNLESS_EQ] = &&op_JUMP_UNLESS_EQ,
+		[OP_JUMP_UNLESS_NOTEQ] = &&op_JUMP_UNLESS_NOTEQ,
+		[OP_JUMP_UNLESS_LESS] = &&op_JUMP_UNLESS_LESS,
+		[OP_JUMP_UNLESS_LEQ] = &&op_JUMP_UNLESS_LEQ,
+		[OP_JUMP_UNLESS_GREATER] = &&op_JUMP_UNLESS_GREATER,
+		[OP_JUMP_UNLESS_GEQ] = &&op_JUMP_UNLESS_GEQ,
+		[OP_CALL_METHOD] = &&op_CALL_METHOD,
+		[OP_MOVE] = &&op_MOVE,
+		[OP_ADD_REG] = &&op_ADD_REG,
+		[OP_SUB_REG] = &&op_SUB_REG,
+		[OP_MUL_REG] = &&binary_reg,
+		[OP_DIV_REG] = &&binary_reg,
+		[OP_FLOORDIV_REG] = &&binary_reg,
+		[OP_MOD_REG] = &&binary_reg,
+		[OP_BITAND_REG] = &&binary_reg,
+		[OP_BITOR_REG] = &&binary_reg,
+		[OP_XOR_REG] = &&binary_reg,
+		[OP_LSHIFT_REG] = &&binary_reg,
+		[OP_RSHIFT_REG] = &&binary_reg,
+		[OP_EQ_REG] = &&op_EQ_REG,
+		[OP_NOTEQ_REG] = &&op_NOTEQ_REG,
+		[OP_LESS_REG] = &&op_LESS_REG,
+		[OP_LEQ_REG] = &&op_LEQ_REG,
+		[OP_GREATER_REG] = &&op_GREATER_REG,
+		[OP_GEQ_REG] = &&op_GEQ_REG,
+		[OP_IN_REG] = &&binary_reg,
+		[OP_NOT_IN_REG] = &&binary_reg,
+		[OP_INPLACE_ADD_REG] = &&op_INPLACE_ADD_REG,
+		[OP_JUMP_UNLESS_EQ_REG] = &&op_JUMP_UNLESS_EQ_REG,
+		[OP_JUMP_UNLESS_NOTEQ_REG] = &&op_JUMP_UNLESS_NOTEQ_REG,
+		[OP_JUMP_UNLESS_LESS_REG] = &&op_JUMP_UNLESS_LESS_REG,
+		[OP_JUMP_UNLESS_LEQ_REG] = &&op_JUMP_UNLESS_LEQ_REG,
+		[OP_JUMP_UNLESS_GREATER_REG] = &&op_JUMP_UNLESS_GREATER_REG,
+		[OP_JUMP_UNLESS_GEQ_REG] = &&op_JUMP_UNLESS_GEQ_REG,
+	};
+#define TARGET(op) op_##op:
+#define DISPATCH()                    \
+	do {                          \
+		COUNT_PAIR();         \
+		ip = pc;              \
+		goto *targets[*pc++]; \
+	} while (0)
+#else
+#define TARGET(op) case OP_##op:
+#define DISPATCH() goto dispatch
+#endif
+
+// Counts the instruction at ip being followed by the one at pc, except on the
+// way into the loop, when there's nothing before it yet.
+#if CLARK_OPCODE_PAIRS
+#define COUNT_PAIR() (opcode_pairs[*ip][*pc] += ip != pc)
+#else
+#define COUNT_PAIR() ((void)0)
+#endif
+
+#define ARG() varint_read(&pc)
+#define PUSH(v) (*sp++ = (v))
+#define REG() reg(code, frame, ARG())
+
+	struct starlark_Value *globals = m->globals;
+	// The start of the instruction being run, which errors are reported at.
+	const uint8_t *ip = pc;
+	uint32_t arg = 0;
+	int ret = 0;
+
+#if VM_COMPUTED_GOTO
+	DISPATCH();
+#else
+dispatch:
+	COUNT_PAIR();
+	ip = pc;
+	switch ((enum Opcode)*pc++) {
+#endif
+
+	TARGET(NOP)
+	{
+		DISPATCH();
+	}
+
+	TARGET(POP)
+	{
+		sp -= 1;
+		Value_release(*sp);
+		DISPATCH();
+	}
+
+	TARGET(DUP)
+	{
+		Value_retain(sp[-1]);
+		sp[0] = sp[-1];
+		sp += 1;
+		DISPATCH();
+	}
+
+	TARGET(DUP2)
+	{
+		Value_retain(sp[-2]);
+		Value_retain(sp[-1]);
+		sp[0] = sp[-2];
+		sp[1] = sp[-1];
+		sp += 2;
+		DISPATCH();
+	}
+
+	TARGET(EXCH)
+	{
+		const struct starlark_Value v = sp[-1];
+		sp[-1] = sp[-2];
+		sp[-2] = v;
+		DISPATCH();
+	}
+
+	TARGET(NONE)
+	{
+		PUSH(VALUE_NONE);
+		DISPATCH();
+	}
+
+	TARGET(TRUE)
+	{
+		PUSH(VALUE_TRUE);
+		DISPATCH();
+	}
+
+	TARGET(FALSE)
+	{
+		PUSH(VALUE_FALSE);
+		DISPATCH();
+	}
+
+	TARGET(CONSTANT)
+	{
+		const struct starlark_Value v = code->constants[ARG()];
+		Value_retain(v);
+		PUSH(v);
+		DISPATCH();
+	}
+
+	TARGET(LOAD_LOCAL)
+	{
+		const struct starlark_Value v = frame[ARG()];
+		if (v.bits == VALUE_UNBOUND.bits) {
+			ret = STARLARK_ERRORCODE_UNBOUND_LOCAL;
+			goto error;
+		}
+
+		Value_retain(v);
+		PUSH(v);
+		DISPATCH();
+	}
+
+	TARGET(STORE_LOCAL)
+	{
+		struct starlark_Value *local = &frame[ARG()];
+		const struct starlark_Value old = *local;
+		sp -= 1;
+		*local = *sp;
+		Value_release(old);
+		DISPATCH();
+	}
+
+	TARGET(LOAD_CELL)
+	{
+		const struct starlark_Cell *cell =
+			(struct starlark_Cell *)Value_as_object(frame[ARG()]);
+		if (cell->value.bits == VALUE_UNBOUND.bits) {
+			ret = STARLARK_ERRORCODE_UNBOUND_LOCAL;
+			goto error;
+		}
+
+		Value_retain(cell->value);
+		PUSH(cell->value);
+		DISPATCH();
+	}
+
+	TARGET(STORE_CELL)
+	{
+		struct starlark_Cell *cell =
+			(struct starlark_Cell *)Value_as_object(frame[ARG()]);
+		const struct starlark_Value old = cell->value;
+		sp -= 1;
+		cell->value = *sp;
+		Value_release(old);
+		DISPATCH();
+	}
+
+	TARGET(LOAD_FREE)
+	{
+		const struct starlark_Cell *cell =
+			(struct starlark_Cell *)Value_as_object(frees[ARG()]);
+		if (cell->value.bits == VALUE_UNBOUND.bits) {
+			ret = STARLARK_ERRORCODE_UNBOUND_LOCAL;
+			goto error;
+		}
+
+		Value_retain(cell->value);
+		PUSH(cell->value);
+		DISPATCH();
+	}
+
+	TARGET(LOAD_GLOBAL)
+	{
+		const struct starlark_Value v = globals[ARG()];
+		if (v.bits == VALUE_UNBOUND.bits) {
+			ret = STARLARK_ERRORCODE_UNBOUND_GLOBAL;
+			goto error;
+		}
+
+		Value_retain(v);
+		PUSH(v);
+		DISPATCH();
+	}
+
+	TARGET(STORE_GLOBAL)
+	{
+		struct starlark_Value *global = &globals[ARG()];
+		const struct starlark_Value old = *global;
+		sp -= 1;
+		*global = *sp;
+		Value_release(old);
+		DISPATCH();
+	}
+
+	TARGET(LOAD_BUILTIN)
+	{
+		PUSH(Builtin_value(ARG()));
+		DISPATCH();
+	}
+
+	// Arithmetic and comparisons on two small ints are done inline, since
+	// they're by far the most common operands. Everything else goes
+	// through Value_binary.
+
+#define INT_ARITH(op, expr)                                                   \
+	TARGET(op)                                                            \
+	{                                                                     \
+		const struct starlark_Value a = sp[-2];                       \
+		const struct starlark_Value b = sp[-1];                       \
+		if (Value_is_small_int(a) && Value_is_small_int(b)) {         \
+			const int64_t c = Value_as_small_int(a)               \
+				expr Value_as_small_int(b);                   \
+			if (c >= INT60_MIN && c <= INT60_MAX) {               \
+				sp[-2] = Value_small_int(c);                  \
+				sp -= 1;                                      \
+				DISPATCH();                                   \
+			}                                                     \
+		}                                                             \
+                                                                              \
+		goto binary;                                                  \
+	}
+
+#define INT_COMPARE(op, expr)                                                 \
+	TARGET(op)                                                            \
+	{                                                                     \
+		const struct starlark_Value a = sp[-2];                       \
+		const struct starlark_Value b = sp[-1];                       \
+		if (Value_is_small_int(a) && Value_is_small_int(b)) {         \
+			const bool c = Value_as_small_int(a)                  \
+				expr Value_as_small_int(b);                   \
+			sp[-2] = Value_bool(c);                               \
+			sp -= 1;                                              \
+			DISPATCH();                                           \
+		}                                                             \
+                                                                              \
+		goto binary;                                                  \
+	}
+
+	INT_ARITH(ADD, +)
+	INT_ARITH(SUB, -)
+	INT_COMPARE(EQ, ==)
+	INT_COMPARE(NOTEQ, !=)
+	INT_COMPARE(LESS, <)
+	INT_COMPARE(LEQ, <=)
+	INT_COMPARE(GREATER, >)
+	INT_COMPARE(GEQ, >=)
+
+#undef INT_ARITH
+#undef INT_COMPARE
+
+#if !VM_COMPUTED_GOTO
+	case OP_MUL:
+	case OP_DIV:
+	case OP_FLOORDIV:
+	case OP_MOD:
+	case OP_BITAND:
+	case OP_BITOR:
+	case OP_XOR:
+	case OP_LSHIFT:
+	case OP_RSHIFT:
+	case OP_IN:
+	case OP_NOT_IN:
+#endif
+	binary:
+	{
+		// x += y is x + y for everything but lists.
+		enum starlark_Op op = STARLARK_OP_ADD;
+		if (*ip != OP_INPLACE_ADD) {
+			op = (enum starlark_Op)(*ip - OP_ADD);
+		}
+		struct starlark_Value result = { 0 };
+		if (op == STARLARK_OP_ADD) {
+			move_from_local(frame, pc, sp[-2]);
+			ret = Value_add_move(&sp[-2], sp[-1], &result);
+		} else {
+			ret = Value_binary(op, sp[-2], sp[-1], &result);
+		}
+
+		if (ret != 0) {
+			goto error;
+		}
+
+		Value_release(sp[-2]);
+		Value_release(sp[-1]);
+		sp[-2] = result;
+		sp -= 1;
+		DISPATCH();
+	}
+
+	TARGET(INPLACE_ADD)
+	{
+		const struct starlark_Value a = sp[-2];
+		const struct starlark_Value b = sp[-1];
+		if (Value_type(a) != STARLARK_TYPE_LIST ||
+		    (Value_type(b) != STARLARK_TYPE_LIST &&
+		     Value_type(b) != STARLARK_TYPE_TUPLE)) {
+			goto binary;
+		}
+
+		struct starlark_List *l =
+			(struct starlark_List *)Value_as_object(a);
+		ret = list_extend(l, b);
+		if (ret != 0) {
+			goto error;
+		}
+
+		Value_release(b);
+		sp -= 1;
+		DISPATCH();
+	}
+
+#if !VM_COMPUTED_GOTO
+	case OP_PLUS:
+	case OP_NEG:
+	case OP_BITNOT:
+#else
+	unary:
+#endif
+	{
+		const enum starlark_Op op = *ip == OP_PLUS ? STARLARK_OP_ADD :
+					    *ip == OP_NEG  ? STARLARK_OP_SUB :
+							     STARLARK_OP_BITNOT;
+		struct starlark_Value result = { 0 };
+		ret = Value_unary(op, sp[-1], &result);
+		if (ret != 0) {
+			goto error;
+		}
+
+		Value_release(sp[-1]);
+		sp[-1] = result;
+		DISPATCH();
+	}
+
+	TARGET(NOT)
+	{
+		const bool truth = Value_truth(sp[-1]);
+		Value_release(sp[-1]);
+		sp[-1] = Value_bool(!truth);
+		DISPATCH();
+	}
+
+	TARGET(JUMP)
+	{
+		pc = &code->code[ARG()];
+		DISPATCH();
+	}
+
+	TARGET(JUMP_IF_FALSE)
+	{
+		arg = ARG();
+		sp -= 1;
+		const bool truth = Value_truth(*sp);
+		Value_release(*sp);
+		if (!truth) {
+			pc = &code->code[arg];
+		}
+
+		DISPATCH();
+	}
+
+	TARGET(JUMP_IF_TRUE)
+	{
+		arg = ARG();
+		sp -= 1;
+		const bool truth = Value_truth(*sp);
+		Value_release(*sp);
+		if (truth) {
+			pc = &code->code[arg];
+		}
+
+		DISPATCH();
+	}
+
+	TARGET(JUMP_IF_FALSE_OR_POP)
+	{
+		arg = ARG();
+		if (!Value_truth(sp[-1])) {
+			pc = &code->code[arg];
+		} else {
+			sp -= 1;
+			Value_release(*sp);
+		}
+
+		DISPATCH();
+	}
+
+	TARGET(JUMP_IF_TRUE_OR_POP)
+	{
+		arg = ARG();
+		if (Value_truth(sp[-1])) {
+			pc = &code->code[arg];
+		} else {
+			sp -= 1;
+			Value_release(*sp);
+		}
+
+		DISPATCH();
+	}
+
+	TARGET(ITER)
+	{
+		struct starlark_Iterator *it =
+			(struct starlark_Iterator *)&frame[Vm_iterator_slot(
+				code, ARG())];
+		ret = Iterator_init(it, sp[-1]);
+		if (ret != 0) {
+			goto error;
+		}
+
+		Value_release(sp[-1]);
+		sp[-1] = Value_object(&it->obj);
+		DISPATCH();
+	}
+
+	// Lists, tuples and ranges of small ints are stepped over here, and
+	// everything else by Iterator_next.
+	TARGET(FOR_ITER)
+	{
+		arg = ARG();
+		struct starlark_Iterator *it =
+			(struct starlark_Iterator *)Value_as_object(sp[-1]);
+		if (it->pos < it->len) {
+			if (it->kind == ITERATOR_ITEMS) {
+				const struct starlark_Value v =
+					it->items[it->pos];
+				it->pos += 1;
+				Value_retain(v);
+				PUSH(v);
+				DISPATCH();
+			}
+
+			const int64_t i = it->next;
+			if (it->kind == ITERATOR_RANGE && i >= INT60_MIN &&
+			    i <= INT60_MAX) {
+				it->next = (int64_t)((uint64_t)i +
+						     (uint64_t)it->step);
+				it->pos += 1;
+				PUSH(Value_small_int(i));
+				DISPATCH();
+			}
+		}
+
+		ret = Iterator_next(it, sp);
+		if (ret == 1) {
+			sp += 1;
+			ret = 0;
+			DISPATCH();
+		}
+
+		if (ret != 0) {
+			goto error;
+		}
+
+		sp -= 1;
+		Value_release(*sp);
+		pc = &code->code[arg];
+		DISPATCH();
+	}
+
+	TARGET(MAKE_TUPLE)
+	{
+		arg = ARG();
+		struct starlark_Tuple *t = Tuple_create(arg);
+		if (t == NULL) {
+			ret = STARLARK_ERROR_OOM;
+			goto error;
+		}
+
+		sp -= arg;
+		for (uint32_t i = 0; i < arg; i += 1) {
+			t->items[i] = sp[i];
+		}
+
+		PUSH(Value_object(&t->obj));
+		DISPATCH();
+	}
+
+	TARGET(MAKE_LIST)
+	{
+		arg = ARG();
+		struct starlark_List *l = List_create(arg);
+		if (l == NULL) {
+			ret = STARLARK_ERROR_OOM;
+			goto error;
+		}
+
+		sp -= arg;
+		for (uint32_t i = 0; i < arg; i += 1) {
+			l->items[i] = sp[i];
+		}
+
+		l->len = arg;
+		PUSH(Value_object(&l->obj));
+		DISPATCH();
+	}
+
+	TARGET(MAKE_DICT)
+	{
+		arg = ARG();
+		struct starlark_Dict *d = Dict_create();
+		if (d == NULL) {
+			ret = STARLARK_ERROR_OOM;
+			goto error;
+		}
+
+		const struct starlark_Value *entries = sp - 2 * arg;
+		for (uint32_t i = 0; i < arg && ret == 0; i += 1) {
+			ret = Dict_set(d, entries[2 * i], entries[2 * i + 1]);
+		}
+
+		if (ret != 0) {
+			Dict_destroy(d);
+			goto error;
+		}
+
+		for (uint32_t i = 0; i < 2 * arg; i += 1) {
+			sp -= 1;
+			Value_release(*sp);
+		}
+
+		PUSH(Value_object((struct starlark_Object *)d));
+		DISPATCH();
+	}
+
+	TARGET(LIST_APPEND)
+	{
+		// The list is below the value and the iterators of the
+		// comprehension's loops. Nothing else can see the list until
+		// it's finished, so nothing can be iterating over it, and while
+		// it has room the value can be moved straight into it.
+		const ptrdiff_t depth = 2 + (ptrdiff_t)ARG();
+		struct starlark_List *l =
+			(struct starlark_List *)Value_as_object(sp[-depth]);
+		if (l->len < l->cap) {
+			sp -= 1;
+			l->items[l->len] = *sp;
+			l->len += 1;
+			DISPATCH();
+		}
+
+		ret = List_append(l, sp[-1]);
+		if (ret != 0) {
+			goto error;
+		}
+
+		sp -= 1;
+		Value_release(*sp);
+		DISPATCH();
+	}
+
+	TARGET(DICT_SET)
+	{
+		const ptrdiff_t depth = 3 + (ptrdiff_t)ARG();
+		struct starlark_Dict *d =
+			(struct starlark_Dict *)Value_as_object(sp[-depth]);
+		ret = Dict_set(d, sp[-2], sp[-1]);
+		if (ret != 0) {
+			goto error;
+		}
+
+		Value_release(sp[-2]);
+		Value_release(sp[-1]);
+		sp -= 2;
+		DISPATCH();
+	}
+
+	// The room is only ever a guess at how much will be needed, so if
+	// there isn't enough memory for it the entries are added one at a
+	// time instead.
+	TARGET(RESERVE)
+	{
+		const struct starlark_Iterator *it =
+			(struct starlark_Iterator *)Value_as_object(sp[-1]);
+		const size_t len = Iterator_len(it);
+		if (Value_type(sp[-2]) == STARLARK_TYPE_LIST) {
+			(void)List_reserve(
+				(struct starlark_List *)Value_as_object(sp[-2]),
+				len);
+		} else {
+			(void)Dict_reserve(
+				(struct starlark_Dict *)Value_as_object(sp[-2]),
+				len);
+		}
+
+		DISPATCH();
+	}
+
+	TARGET(UNPACK)
+	{
+		arg = ARG();
+		ret = unpack(vm, sp, arg);
+		if (ret != 0) {
+			goto error;
+		}
+
+		sp += arg - 1;
+		DISPATCH();
+	}
+
+	TARGET(INDEX)
+	{
+		struct starlark_Value result = { 0 };
+		ret = Value_index(sp[-2], sp[-1], &result);
+		if (ret != 0) {
+			goto error;
+		}
+
+		Value_release(sp[-2]);
+		Value_release(sp[-1]);
+		sp[-2] = result;
+		sp -= 1;
+		DISPATCH();
+	}
+
+	TARGET(SET_INDEX)
+	{
+		ret = Value_set_index(sp[-3], sp[-2], sp[-1]);
+		if (ret != 0) {
+			goto error;
+		}
+
+		for (int i = 0; i < 3; i += 1) {
+			sp -= 1;
+			Value_release(*sp);
+		}
+
+		DISPATCH();
+	}
+
+	TARGET(SLICE)
+	{
+		struct starlark_Value result = { 0 };
+		ret = Value_slice(sp[-4], sp[-3], sp[-2], sp[-1], &result);
+		if (ret != 0) {
+			goto error;
+		}
+
+		for (int i = 0; i < 4; i += 1) {
+			sp -= 1;
+			Value_release(*sp);
+		}
+
+		PUSH(result);
+		DISPATCH();
+	}
+
+	TARGET(ATTR)
+	{
+		arg = ARG();
+		const struct starlark_Method *m =
+			cached_method(vm, code, arg, sp[-1]);
+		if (m == NULL) {
+			ret = STARLARK_ERRORCODE_NO_ATTR;
+			goto error;
+		}
+
+		struct starlark_Value result = { 0 };
+		ret = Builtin_bind(m, sp[-1], &result);
+		if (ret != 0) {
+			goto error;
+		}
+
+		Value_release(sp[-1]);
+		sp[-1] = result;
+		DISPATCH();
+	}
+
+	TARGET(SET_ATTR)
+	{
+		// None of the builtin types have fields which can be set.
+		ret = STARLARK_ERRORCODE_NO_ATTR;
+		goto error;
+	}
+
+	TARGET(CALL)
+	{
+		arg = ARG();
+		const uint32_t positional = CALL_POSITIONAL(arg);
+		const uint32_t named = CALL_NAMED(arg);
+		const uint32_t flags = arg >> 16;
+		const uint32_t len = 1 + positional + 2 * named +
+				     !!(flags & CALL_VARARGS) +
+				     !!(flags & CALL_KWARGS);
+		struct starlark_Value *base = sp - len;
+		struct starlark_Value result = { 0 };
+		if (flags == 0) {
+			ret = Vm_call(vm, base[0], positional, &base[1], named,
+				      &base[1 + positional], &result);
+		} else {
+			ret = call_spread(vm, base, positional, named, flags,
+					  &result);
+		}
+
+		if (ret != 0) {
+			goto error;
+		}
+
+		while (sp > base) {
+			sp -= 1;
+			Value_release(*sp);
+		}
+
+		PUSH(result);
+		DISPATCH();
+	}
+
+	TARGET(CALL_METHOD)
+	{
+		arg = ARG();
+		ret = Vm_call_method(vm, code, sp, arg);
+		if (ret != 0) {
+			goto error;
+		}
+
+		sp -= CALL_POSITIONAL(arg) + 2 * CALL_NAMED(arg);
+		DISPATCH();
+	}
+
+	TARGET(MAKE_FUNCTION)
+	{
+		const struct starlark_Code *fcode = &m->program.codes[ARG()];
+		struct starlark_Function *fn = Function_create(m, fcode);
+		if (fn == NULL) {
+			ret = STARLARK_ERROR_OOM;
+			goto error;
+		}
+
+		sp -= fcode->defaults_len;
+		for (uint32_t i = 0; i < fcode->defaults_len; i += 1) {
+			fn->values[i] = sp[i];
+		}
+
+		for (uint32_t i = 0; i < fcode->frees_len; i += 1) {
+			const struct starlark_FreeVar fv = fcode->frees[i];
+			const struct starlark_Value cell =
+				fv.scope == STARLARK_SCOPE_CELL ?
+					frame[fv.index] :
+					frees[fv.index];
+			Value_retain(cell);
+			fn->values[fcode->defaults_len + i] = cell;
+		}
+
+		PUSH(Value_object(&fn->obj));
+		DISPATCH();
+	}
+
+	TARGET(LOAD)
+	{
+		ret = STARLARK_ERRORCODE_LOAD_UNSUPPORTED;
+		goto error;
+	}
+
+	TARGET(RETURN)
+	{
+		sp -= 1;
+		*out = *sp;
+		goto done;
+	}
+
+	// The superinstructions fused by the peephole optimizer. One which
+	// fails pushes back the operands of the instruction it reports errors
+	// as, so that the error is described the same way.
+
+#define ARITH_CONSTANT(op, sop, expr)                                         \
+	TARGET(op)                                                            \
+	{                                                                     \
+		const struct starlark_Value a = sp[-1];                       \
+		const struct starlark_Value b = code->constants[ARG()];       \
+		if (Value_is_small_int(a) && Value_is_small_int(b)) {         \
+			const int64_t c = Value_as_small_int(a)               \
+				expr Value_as_small_int(b);                   \
+			if (c >= INT60_MIN && c <= INT60_MAX) {               \
+				sp[-1] = Value_small_int(c);                  \
+				DISPATCH();                                   \
+			}                                                     \
+		}                                                             \
+                                                                              \
+		struct starlark_Value result = { 0 };                         \
+		if (sop == STARLARK_OP_ADD) {                                 \
+			move_from_local(frame, pc, a);                        \
+			ret = Value_add_move(&sp[-1], b, &result);            \
+		} else {                                                      \
+			ret = Value_binary(sop, a, b, &result);               \
+		}                                                             \
+                                                                              \
+		if (ret != 0) {                                               \
+			Value_retain(b);                                      \
+			PUSH(b);                                              \
+			goto error;                                           \
+		}                                                             \
+                                                                              \
+		Value_release(sp[-1]);                                        \
+		sp[-1] = result;                                              \
+		DISPATCH();                                                   \
+	}
+
+#define COMPARE_JUMP(op, sop, expr)                                           \
+	TARGET(op)                                                            \
+	{                                                                     \
+		arg = ARG();                                                  \
+		const struct starlark_Value a = sp[-2];                       \
+		const struct starlark_Value b = sp[-1];                       \
+		bool truth = false;                                           \
+		if (Value_is_small_int(a) && Value_is_small_int(b)) {         \
+			truth = Value_as_small_int(a)                         \
+				expr Value_as_small_int(b);                   \
+		} else {                                                      \
+			struct starlark_Value result = { 0 };                 \
+			ret = Value_binary(sop, a, b, &result);               \
+			if (ret != 0) {                                       \
+				goto error;                                   \
+			}                                                     \
+                                                                              \
+			truth = Value_truth(result);                          \
+			Value_release(result);                                \
+			Value_release(a);                                     \
+			Value_release(b);                                     \
+		}                                                             \
+                                                                              \
+		sp -= 2;                                                      \
+		if (!truth) {                                                 \
+			pc = &code->code[arg];                                \
+		}                                                             \
+                                                                              \
+		DISPATCH();                                                   \
+	}
+
+	ARITH_CONSTANT(ADD_CONSTANT, STARLARK_OP_ADD, +)
+	ARITH_CONSTANT(SUB_CONSTANT, STARLARK_OP_SUB, -)
+	COMPARE_JUMP(JUMP_UNLESS_EQ, STARLARK_OP_EQ, ==)
+	COMPARE_JUMP(JUMP_UNLESS_NOTEQ, STARLARK_OP_NOTEQ, !=)
+	COMPARE_JUMP(JUMP_UNLESS_LESS, STARLARK_OP_LESS, <)
+	COMPARE_JUMP(JUMP_UNLESS_LEQ, STARLARK_OP_LEQ, <=)
+	COMPARE_JUMP(JUMP_UNLESS_GREATER, STARLARK_OP_GREATER, >)
+	COMPARE_JUMP(JUMP_UNLESS_GEQ, STARLARK_OP_GEQ, >=)
+
+#undef ARITH_CONSTANT
+#undef COMPARE_JUMP
+
+	TARGET(INDEX_CONSTANT)
+	{
+		const struct starlark_Value key = code->constants[ARG()];
+		struct starlark_Value result = { 0 };
+		ret = Value_index(sp[-1], key, &result);
+		if (ret != 0) {
+			Value_retain(key);
+			PUSH(key);
+			goto error;
+		}
+
+		Value_release(sp[-1]);
+		sp[-1] = result;
+		DISPATCH();
+	}
+
+	// The register instructions, which store their result with REG_STORE.
+
+#define REG_STORE(d, v)                                                       \
+	do {                                                                  \
+		const struct starlark_Value v_ = (v);                         \
+		if ((d) < code->locals_len) {                                 \
+			const struct starlark_Value old = frame[(d)];         \
+			frame[(d)] = v_;                                      \
+			Value_release(old);                                   \
+		} else {                                                      \
+			PUSH(v_);                                             \
+		}                                                             \
+	} while (0)
+
+	TARGET(MOVE)
+	{
+		arg = ARG();
+		const struct starlark_Value v = REG();
+		Value_retain(v);
+		REG_STORE(arg, v);
+		DISPATCH();
+	}
+
+#define INT_ARITH_REG(op, expr)                                               \
+	TARGET(op)                                                            \
+	{                                                                     \
+		arg = ARG();                                                  \
+		const struct starlark_Value a = REG();                        \
+		const struct starlark_Value b = REG();                        \
+		if (Value_is_small_int(a) && Value_is_small_int(b)) {         \
+			const int64_t c = Value_as_small_int(a)               \
+				expr Value_as_small_int(b);                   \
+			if (c >= INT60_MIN && c <= INT60_MAX) {               \
+				REG_STORE(arg, Value_small_int(c));           \
+				DISPATCH();                                   \
+			}                                                     \
+		}                                                             \
+                                                                              \
+		goto binary_reg;                                              \
+	}
+
+#define INT_COMPARE_REG(op, expr)                                             \
+	TARGET(op)                                                            \
+	{                                                                     \
+		arg = ARG();                                                  \
+		const struct starlark_Value a = REG();                        \
+		const struct starlark_Value b = REG();                        \
+		if (Value_is_small_int(a) && Value_is_small_int(b)) {         \
+			REG_STORE(arg, Value_bool(Value_as_small_int(a)       \
+					  expr Value_as_small_int(b)));       \
+			DISPATCH();                                           \
+		}                                                             \
+                                                                              \
+		goto binary_reg;                                              \
+	}
+
+	INT_ARITH_REG(ADD_REG, +)
+	INT_ARITH_REG(SUB_REG, -)
+	INT_ARITH_REG(INPLACE_ADD_REG, +)
+	INT_COMPARE_REG(EQ_REG, ==)
+	INT_COMPARE_REG(NOTEQ_REG, !=)
+	INT_COMPARE_REG(LESS_REG, <)
+	INT_COMPARE_REG(LEQ_REG, <=)
+	INT_COMPARE_REG(GREATER_REG, >)
+	INT_COMPARE_REG(GEQ_REG, >=)
+
+#undef INT_ARITH_REG
+#undef INT_COMPARE_REG
+
+#if !VM_COMPUTED_GOTO
+	case OP_MUL_REG:
+	case OP_DIV_REG:
+	case OP_FLOORDIV_REG:
+	case OP_MOD_REG:
+	case OP_BITAND_REG:
+	case OP_BITOR_REG:
+	case OP_XOR_REG:
+	case OP_LSHIFT_REG:
+	case OP_RSHIFT_REG:
+	case OP_IN_REG:
+	case OP_NOT_IN_REG:
+#endif
+	binary_reg:
+	{
+		// The fast paths above have already read the operands, so
+		// they're read again from the start of the instruction.
+		pc = ip + 1;
+		arg = ARG();
+		const uint32_t src = ARG();
+		struct starlark_Value a = reg(code, frame, src);
+		const struct starlark_Value b = REG();
+		const uint8_t base = Opcode_base[*ip];
+		struct starlark_Value result = { 0 };
+		if (base == OP_INPLACE_ADD &&
+		    Value_type(a) == STARLARK_TYPE_LIST &&
+		    (Value_type(b) == STARLARK_TYPE_LIST ||
+		     Value_type(b) == STARLARK_TYPE_TUPLE)) {
+			struct starlark_List *l =
+				(struct starlark_List *)Value_as_object(a);
+			ret = list_extend(l, b);
+			result = a;
+			if (ret == 0) {
+				Value_retain(a);
+			}
+		} else {
+			enum starlark_Op op = STARLARK_OP_ADD;
+			if (base != OP_INPLACE_ADD) {
+				op = (enum starlark_Op)(base - OP_ADD);
+			}
+
+			if (op == STARLARK_OP_ADD && src == arg &&
+			    src < code->locals_len &&
+			    Value_type(a) == STARLARK_TYPE_STRING) {
+				// s += t stores over s, so s is moved out of
+				// its local for Str_append to extend in place.
+				frame[src] = VALUE_NONE;
+				ret = Value_add_move(&a, b, &result);
+				frame[src] = a;
+			} else {
+				ret = Value_binary(op, a, b, &result);
+			}
+		}
+
+		if (ret != 0) {
+			Value_retain(a);
+			Value_retain(b);
+			PUSH(a);
+			PUSH(b);
+			goto error;
+		}
+
+		REG_STORE(arg, result);
+		DISPATCH();
+	}
+
+#define COMPARE_JUMP_REG(op, sop, expr)                                       \
+	TARGET(op)                                                            \
+	{                                                                     \
+		arg = ARG();                                                  \
+		const struct starlark_Value a = REG();                        \
+		const struct starlark_Value b = REG();                        \
+		bool truth = false;                                           \
+		if (Value_is_small_int(a) && Value_is_small_int(b)) {         \
+			truth = Value_as_small_int(a)                         \
+				expr Value_as_small_int(b);                   \
+		} else {                                                      \
+			struct starlark_Value result = { 0 };                 \
+			ret = Value_binary(sop, a, b, &result);               \
+			if (ret != 0) {                                       \
+				Value_retain(a);                              \
+				Value_retain(b);                              \
+				PUSH(a);                                      \
+				PUSH(b);                                      \
+				goto error;                                   \
+			}                                                     \
+                                                                              \
+			truth = Value_truth(result);                          \
+			Value_release(result);                                \
+		}                                                             \
+                                                                              \
+		if (!truth) {                                                 \
+			pc = &code->code[arg];                                \
+		}                                                             \
+                                                                              \
+		DISPATCH();                                                   \
+	}
+
+	COMPARE_JUMP_REG(JUMP_UNLESS_EQ_REG, STARLARK_OP_EQ, ==)
+	COMPARE_JUMP_REG(JUMP_UNLESS_NOTEQ_REG, STARLARK_OP_NOTEQ, !=)
+	COMPARE_JUMP_REG(JUMP_UNLESS_LESS_REG, STARLARK_OP_LESS, <)
+	COMPARE_JUMP_REG(JUMP_UNLESS_LEQ_REG, STARLARK_OP_LEQ, <=)
+	COMPARE_JUMP_REG(JUMP_UNLESS_GREATER_REG, STARLARK_OP_GREATER, >)
+	COMPARE_JUMP_REG(JUMP_UNLESS_GEQ_REG, STARLARK_OP_GEQ, >=)
+
+#undef COMPARE_JUMP_REG
+#undef REG_STORE
+
+#if !VM_COMPUTED_GOTO
+	case OP_COUNT:
+		break;
+	}
+
+	assert(false && "invalid opcode");
+#endif
+
+#undef TARGET
+#undef DISPATCH
+#undef COUNT_PAIR
+#undef ARG
+#undef PUSH
+#undef REG
+
+	// Every error leaves the loop here, out of the way of the
+	// instructions.
+error:
+	ret = report(vm, m, code, ip, sp, ret);
+
+done:
+	while (sp > frame) {
+		sp -= 1;
+		Value_release(*sp);
+	}
+
+	return ret;
+}
+#if VM_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
+
+// Runs code in frame, as machine code if the JIT has compiled it, and in the
+// interpreter otherwise or from wherever the machine code deoptimized.
+static int execute(struct starlark_Vm *vm, struct starlark_Module *m,
+		   const struct starlark_Code *code,
+		   struct starlark_Value *frees, struct starlark_Value *frame,
+		   struct starlark_Value *out)
+{
+	struct starlark_Value *sp = &frame[code->locals_len];
+	const JitEntry entry = Jit_entry(vm->ctx, m, code);
+	if (entry == NULL) {
+		return run(vm, m, code, frees, frame, sp, code->code, out);
+	}
+
+	struct JitFrame f = {
+		.vm = vm,
+		.frame = frame,
+		.sp = sp,
+		.out = out,
+	};
+	int ret = 0;
+	switch (entry(&f)) {
+	case JIT_RETURN:
+		break;
+	case JIT_DEOPT:
+		Jit_deopted(code);
+		return run(vm, m, code, frees, frame, f.sp, &code->code[f.pc],
+			   out);
+	case JIT_ERROR:
+		ret = report(vm, m, code, &code->code[f.pc], f.sp, f.ret);
+		break;
+	}
+
+	sp = f.sp;
+	while (sp > frame) {
+		sp -= 1;
+		Value_release(*sp);
+	}
+
+	return ret;
+}
+
+int Vm_run_module(struct starlark_Vm *vm, struct starlark_Module *m)
+{
+	assert(vm != NULL);
+	assert(m != NULL);
+
+	const struct starlark_Code *code = &m->program.codes[0];
+	const size_t frame_len = Vm_frame_len(code);
+	struct starlark_Value *frame = frame_push(vm, frame_len);
+	if (frame == NULL) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	struct starlark_Value result = VALUE_NONE;
+	m->running[0] = true;
+	int ret = execute(vm, m, code, NULL, frame, &result);
+	m->running[0] = false;
+	frame_pop(vm, frame, frame_len, 0);
+	Value_release(result);
+	vm->reported = false;
+	vm->detail = 0;
+	return ret;
+}
+
+// Copies the bound globals of m into ctx->globals, by name.
+static int export_globals(struct starlark_Context *ctx,
+			  const struct starlark_Module *m)
+{
+	if (ctx->globals == NULL) {
+		ctx->globals = Dict_create();
+		if (ctx->globals == NULL) {
+			return STARLARK_ERROR_OOM;
+		}
+	}
+
+	for (size_t i = 0; i < m->program.globals_len; i += 1) {
+		if (m->globals[i].bits == VALUE_UNBOUND.bits) {
+			continue;
+		}
+
+		const char *name = strpool_get(&ctx->strpool,
+					       m->program.globals[i]);
+		const struct starlark_Value key = Value_str(strlen(name), name);
+		if (Value_is_none(key)) {
+			return STARLARK_ERROR_OOM;
+		}
+
+		const int ret = Dict_set(ctx->globals, key, m->globals[i]);
+		Value_release(key);
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+// Adds m to the modules ctx keeps alive.
+static bool add_module(struct starlark_Context *ctx, struct starlark_Module *m)
+{
+	if (ctx->modules_len == ctx->modules_cap) {
+		const size_t cap = (ctx->modules_cap + 4) * 2;
+		struct starlark_Module **modules =
+			realloc(ctx->modules, cap * sizeof(modules[0]));
+		if (modules == NULL) {
+			return false;
+		}
+
+		ctx->modules = modules;
+		ctx->modules_cap = cap;
+	}
+
+	ctx->modules[ctx->modules_len] = m;
+	ctx->modules_len += 1;
+	return true;
+}
+
+// Compiles and runs src. If file isn't NULL, src is its contents, and the
+// module takes ownership of it so that errors can still quote the source.
+static int exec(struct starlark_Context *ctx, const char *name,
+		const size_t src_len, const uint8_t *src,
+		struct MappedFile *file)
+{
+	const size_t errs_start = ctx->errs_len;
+	struct starlark_Scratch *s = Scratch_get(ctx);
+	if (s == NULL) {
+		if (file != NULL) {
+			mapfile_finish(file);
+		}
+
+		return STARLARK_ERROR_OOM;
+	}
+
+	// The parser and resolver are only needed until the program is
+	// compiled, after which they're reset for the next one.
+	struct starlark_Program prog = { 0 };
+	int ret = starlark_parse(ctx, name, src_len, src, &s->parser);
+	if (ret == 0 && ctx->errs_len == errs_start) {
+		ret = resolve(ctx, &s->parser, &s->resolver);
+	}
+
+	if (ret == 0 && ctx->errs_len == errs_start) {
+		ret = compile(ctx, &s->parser, &s->resolver, &s->compiler,
+			      &prog);
+	}
+
+	Scratch_reset(s);
+
+	struct starlark_Module *m = NULL;
+	if (ret == 0) {
+		m = Module_create(ctx, &prog);
+	}
+
+	if (m == NULL || !add_module(ctx, m)) {
+		Module_destroy(m);
+		Program_finish(&prog);
+		if (file != NULL) {
+			mapfile_finish(file);
+		}
+
+		return ret != 0 ? ret : STARLARK_ERROR_OOM;
+	}
+
+	if (file != NULL) {
+		m->has_file = true;
+		m->file = *file;
+	}
+
+	if (ctx->errs_len != errs_start) {
+		return ctx->errs.codes[errs_start];
+	}
+
+	struct starlark_Vm vm = { 0 };
+	if (!Vm_init(&vm, ctx)) {
+		return STARLARK_ERROR_OOM;
+	}
+
+	ret = Vm_run_module(&vm, m);
+	Vm_finish(&vm);
+	if (ret < 0) {
+		return ret;
+	}
+
+	const int export = export_globals(ctx, m);
+	return export != 0 ? export : ret;
+}
+
+int starlark_exec(struct starlark_Context *ctx, const char *name,
+		  const size_t src_len, const uint8_t *src)
+{
+	assert(ctx != NULL);
+	assert(name != NULL);
+	assert(src != NULL);
+
+	return exec(ctx, name, src_len, src, NULL);
+}
+
+int starlark_execfile(struct starlark_Context *ctx, const char *filename)
+{
+	assert(ctx != NULL);
+	assert(filename != NULL);
+
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL) {
+		return STARLARK_ERROR_IO;
+	}
+
+	struct MappedFile file = { 0 };
+	const bool ok = mapfile(f, &file);
+	const int saved = errno;
+	fclose(f);
+	if (!ok) {
+		errno = saved;
+		return STARLARK_ERROR_IO;
+	}
+
+	return exec(ctx, filename, file.len, file.ptr, &file);
+}
+
+#if CLARK_OPCODE_PAIRS
+struct pair {
+	uint64_t count;
+	uint8_t first;
+	uint8_t second;
+};
+
+static int pair_compare(const void *a, const void *b)
+{
+	const struct pair *x = a;
+	const struct pair *y = b;
+	return (x->count < y->count) - (x->count > y->count);
+}
+#endif
+
+void starlark_opcode_pairs_dump(FILE *f)
+{
+	assert(f != NULL);
+
+#if CLARK_OPCODE_PAIRS
+	struct pair *pairs = malloc(OP_COUNT * OP_COUNT * sizeof(pairs[0]));
+	if (pairs == NULL) {
+		fprintf(f, "out of memory\n");
+		return;
+	}
+
+	size_t len = 0;
+	uint64_t total = 0;
+	for (size_t i = 0; i < OP_COUNT; i += 1) {
+		for (size_t j = 0; j < OP_COUNT; j += 1) {
+			if (opcode_pairs[i][j] == 0) {
+				continue;
+			}
+
+			pairs[len] = (struct pair){
+				.count = opcode_pairs[i][j],
+				.first = (uint8_t)i,
+				.second = (uint8_t)j,
+			};
+			len += 1;
+			total += opcode_pairs[i][j];
+		}
+	}
+
+	qsort(pairs, len, sizeof(pairs[0]), pair_compare);
+	for (size_t i = 0; i < len; i += 1) {
+		fprintf(f, "%12" PRIu64 " %6.2f%%  %s %s\n", pairs[i].count,
+			100.0 * (double)pairs[i].count / (double)total,
+			Opcode_names[pairs[i].first],
+			Opcode_names[pairs[i].second]);
+	}
+
+	free(pairs);
+#else
+	fprintf(f, "opcode pairs aren't counted in this build, reconfigure "
+		   "with -Dopcode-pairs=true\n");
+#endif
+}
@@ -0,0 +1,89 @@
+#ifndef STARLARK_VM_H
+#define STARLARK_VM_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "starlark/common.h"
+#include "starlark/compile.h"
+#include "starlark/function.h"
+#include "starlark/list.h"
+#include "starlark/value.h"
+
+// The interpreter, which runs the bytecode described in compile.h.
+//
+// Each call to a starlark function runs in its own frame, which holds the
+// function's locals followed by its operand stack, and then the iterators of
+// its loops, so that looping never has to allocate one. Frames are taken from
+// a single preallocated array of slots while they fit in it.
+
+// The most calls which can be running at once.
+#define VM_MAX_DEPTH 1000
+
+// The number of slots preallocated for frames.
+#define VM_SLOTS_CAP 65536
+
+// Returns the number of slots in a frame for code.
+static inline size_t Vm_frame_len(const struct starlark_Code *code)
+{
+	return (size_t)code->locals_len + code->max_stack +
+	       (size_t)code->loops_len * ITERATOR_SLOTS;
+}
+
+// Returns the index of the first of the slots in a frame for code which hold
+// the iterator of a loop inside depth other loops.
+static inline size_t Vm_iterator_slot(const struct starlark_Code *code,
+				      const uint32_t depth)
+{
+	return (size_t)code->locals_len + code->max_stack +
+	       (size_t)depth * ITERATOR_SLOTS;
+}
+
+struct starlark_Vm {
+	struct starlark_Context *ctx;
+
+	size_t slots_len;
+	struct starlark_Value *slots;
+
+	uint32_t depth;
+
+	// Set once the error being returned has been appended to ctx's
+	// errors, so that the calls it's returned through don't add it again.
+	bool reported;
+	// The argument of the error being returned, as a handle into ctx's
+	// strpool, or 0 if the instruction it happened in should describe it.
+	int64_t detail;
+};
+
+// Returns false if we couldn't allocate enough memory.
+bool Vm_init(struct starlark_Vm *vm, struct starlark_Context *ctx);
+
+void Vm_finish(struct starlark_Vm *vm);
+
+// Runs the top level of m.
+// Returns 0 on success, a negative STARLARK_ERROR_* code, or the positive code
+// of the error which stopped the program, which has been appended to the
+// context's errors.
+int Vm_run_module(struct starlark_Vm *vm, struct starlark_Module *m);
+
+// Calls fn with len positional arguments, and named_len named ones given as
+// pairs of a string name and a value, storing its result in *out. The
+// arguments are borrowed.
+// Returns 0 on success, a negative STARLARK_ERROR_* code, or a positive
+// starlark_ErrorCode. Unless vm->reported is set, the error still has to be
+// reported, and vm->detail describes it.
+int Vm_call(struct starlark_Vm *vm, const struct starlark_Value fn,
+	    const size_t len, const struct starlark_Value *args,
+	    const size_t named_len, const struct starlark_Value *named,
+	    struct starlark_Value *out);
+
+// Calls the method of the OP_CALL_METHOD in code with operand arg, whose
+// receiver and arguments are on the stack below sp, replacing them with its
+// result.
+// Returns 0 on success, a negative STARLARK_ERROR_* code, or a positive
+// starlark_ErrorCode, which leaves the stack as it was and has to be reported
+// like Vm_call's.
+int Vm_call_method(struct starlark_Vm *vm, const struct starlark_Code *code,
+		   struct starlark_Value *sp, const uint32_t arg);
+
+#endif // STARLARK_VM_H
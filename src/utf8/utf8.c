@@ -243,7 +243,7 @@ uint32_t utf8_codepoint_decode(const size_t str_len, const uint8_t *str,
 	uint32_t result = 0;
 	int state = 0;
 	*size = 0;
-	for (size_t i = 0; i < str_len; i += 1) {
+	for (size_t i = 0; i < str_len - current; i += 1) {
 		state = utf8_state_advance(state, &result, ptr[i]);
 		*size += 1;
 		if (state == UTF8_REJECT || state == UTF8_ACCEPT) {
@@ -9,6 +9,15 @@
 #include "util/diff.h"
 #include "util/common.h"
 #include "util/lineno.h"
+#include "util/panic.h"
+
+static void diff_index(struct LineIndex *idx, const size_t len,
+		       const uint8_t *buf)
+{
+	if (!lineindex_init(idx, len, buf)) {
+		panic("diff: couldn't allocate line index");
+	}
+}
 
 bool diff(const size_t a_len, const uint8_t *a, const size_t b_len,
 	  const uint8_t *b, size_t *out)
@@ -17,33 +26,38 @@ bool diff(const size_t a_len, const uint8_t *a, const size_t b_len,
 	assert(b != NULL);
 	assert(out != NULL);
 
-	size_t a_lines = lineno(a_len, a, a_len - 1, NULL);
-	size_t b_lines = lineno(b_len, b, b_len - 1, NULL);
+	struct LineIndex a_idx = { 0 };
+	struct LineIndex b_idx = { 0 };
+	diff_index(&a_idx, a_len, a);
+	diff_index(&b_idx, b_len, b);
+
+	size_t a_lines = lineindex_lineno(&a_idx, a_len - 1, NULL);
+	size_t b_lines = lineindex_lineno(&b_idx, b_len - 1, NULL);
 
+	bool result = true;
 	if (a_lines != b_lines) {
 		*out = MIN(a_lines, b_lines) + 1;
-		return false;
+		result = false;
+		goto done;
 	}
 
-	for (size_t i = 0; i < MAX(a_lines, b_lines); i += 1) {
-		char *a_line = get_line(a_len, a, i);
-		char *b_line = get_line(b_len, b, i);
-		size_t a_linelen = strlen(a_line);
-		size_t b_linelen = strlen(b_line);
-		for (size_t j = 0; j < MAX(a_linelen, b_linelen); j += 1) {
-			if (a[j] != b[j]) {
-				*out = j;
-				free(a_line);
-				free(b_line);
-				return false;
-			}
+	for (size_t i = 1; i <= a_lines; i += 1) {
+		const uint8_t *a_line = NULL;
+		const uint8_t *b_line = NULL;
+		size_t a_linelen = lineindex_line(&a_idx, i, &a_line);
+		size_t b_linelen = lineindex_line(&b_idx, i, &b_line);
+		if (a_linelen != b_linelen ||
+		    memcmp(a_line, b_line, a_linelen) != 0) {
+			*out = i;
+			result = false;
+			goto done;
 		}
-
-		free(a_line);
-		free(b_line);
 	}
 
-	return true;
+done:
+	lineindex_finish(&a_idx);
+	lineindex_finish(&b_idx);
+	return result;
 }
 
 void diff_fwrite(FILE *f, const size_t a_len, const uint8_t *a,
@@ -53,23 +67,30 @@ void diff_fwrite(FILE *f, const size_t a_len, const uint8_t *a,
 	assert(b != NULL);
 	assert(f != NULL);
 
-	size_t a_lines = lineno(a_len, a, a_len - 1, NULL);
-	size_t b_lines = lineno(b_len, b, b_len - 1, NULL);
+	struct LineIndex a_idx = { 0 };
+	struct LineIndex b_idx = { 0 };
+	diff_index(&a_idx, a_len, a);
+	diff_index(&b_idx, b_len, b);
+
+	size_t a_lines = lineindex_lineno(&a_idx, a_len - 1, NULL);
+	size_t b_lines = lineindex_lineno(&b_idx, b_len - 1, NULL);
 
 	if (a_lines != b_lines) {
 		fprintf(f,
 			"output has %zu lines when %zu lines were expected\n",
 			a_lines, b_lines);
 		fprintf(f, "output:\n%.*s", (int)a_len, a);
-		return;
-	}
+	} else {
+		const uint8_t *l1 = NULL;
+		const uint8_t *l2 = NULL;
+		int l1_len = (int)lineindex_line(&a_idx, i, &l1);
+		int l2_len = (int)lineindex_line(&b_idx, i, &l2);
 
-	char *l1 = get_line(a_len, a, a_lines);
-	char *l2 = get_line(b_len, b, a_lines);
+		fprintf(f, "output differs at line %zu\n", i);
+		fprintf(f, "output:   %.*s\n", l1_len, l1);
+		fprintf(f, "expected: %.*s\n", l2_len, l2);
+	}
 
-	fprintf(f, "output differs at line %zu\n", i);
-	fprintf(f, "output:   %s\n", l1);
-	fprintf(f, "expected: %s\n", l2);
-	free(l1);
-	free(l2);
+	lineindex_finish(&a_idx);
+	lineindex_finish(&b_idx);
 }
@@ -3,7 +3,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-static char *vformat(const char *fmt, va_list args)
+#include "util/fmt.h"
+
+char *vformat(const char *fmt, va_list args)
 {
 	// The v*printf functions destroy the va_list after use.
 	// So I have to copy the va_list for the second call or we segfault.
@@ -1,6 +1,12 @@
 #ifndef UTIL_FMT_H
 #define UTIL_FMT_H
+#include <stdarg.h>
 
+// Returns a heap allocated string formatted as printf would.
+// Returns NULL on failure.
 char *format(const char *fmt, ...);
 
+// Like format, but taking a va_list.
+char *vformat(const char *fmt, va_list args);
+
 #endif // UTIL_FMT_H
@@ -1,28 +1,50 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CLARK_HAVE_MMAP 1
+#endif
+
 #include "util/io.h"
 
-uint8_t *readfull(FILE *f)
+// The size of the first read when we don't know how big f is.
+#define READ_CHUNK (64 * 1024)
+
+uint8_t *readfull(FILE *f, size_t *len)
 {
-	uint8_t *result = calloc(2, 1);
+	size_t cap = READ_CHUNK;
+	size_t i = 0;
+	uint8_t *result = malloc(cap + 1);
 	if (result == NULL) {
-		return result;
+		return NULL;
 	}
 
-	int c = 0;
-	size_t i = 0;
 	for (;;) {
-		c = fgetc(f);
-		if (c == EOF) {
+		i += fread(&result[i], 1, cap - i, f);
+		if (i < cap) {
+			if (ferror(f)) {
+				free(result);
+				return NULL;
+			}
 			break;
 		}
-		result[i] = c & 0xff;
-		result[i + 1] = '\0';
-		i += 1;
-		void *ptr = realloc(result, i + 2);
+
+		if (cap > (SIZE_MAX - 1) / 2) {
+			free(result);
+			errno = EFBIG;
+			return NULL;
+		}
+
+		cap *= 2;
+		void *ptr = realloc(result, cap + 1);
 		if (ptr == NULL) {
 			free(result);
 			return NULL;
@@ -30,5 +52,95 @@ uint8_t *readfull(FILE *f)
 		result = ptr;
 	}
 
+	result[i] = '\0';
+	if (len != NULL) {
+		*len = i;
+	}
 	return result;
 }
+
+#ifdef CLARK_HAVE_MMAP
+// Maps f read-only if it's a regular file read from the beginning. Returns
+// false without setting errno if f can't be mapped, so the caller can fall
+// back to reading it.
+static bool try_mmap(FILE *f, struct MappedFile *out, bool *failed)
+{
+	int fd = fileno(f);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+	    ftell(f) != 0) {
+		return false;
+	}
+
+	if ((uintmax_t)st.st_size > SIZE_MAX) {
+		errno = EFBIG;
+		*failed = true;
+		return false;
+	}
+
+	// mmap doesn't accept a length of 0.
+	if (st.st_size == 0) {
+		return false;
+	}
+
+	void *ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (ptr == MAP_FAILED) {
+		return false;
+	}
+
+	// The lexer reads the source front to back.
+	(void)posix_madvise(ptr, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+	*out = (struct MappedFile){
+		.len = st.st_size,
+		.ptr = ptr,
+		.mapped = true,
+	};
+	return true;
+}
+#endif // CLARK_HAVE_MMAP
+
+bool mapfile(FILE *f, struct MappedFile *out)
+{
+#ifdef CLARK_HAVE_MMAP
+	bool failed = false;
+	if (try_mmap(f, out, &failed)) {
+		return true;
+	}
+
+	if (failed) {
+		return false;
+	}
+#endif // CLARK_HAVE_MMAP
+
+	size_t len = 0;
+	uint8_t *ptr = readfull(f, &len);
+	if (ptr == NULL) {
+		return false;
+	}
+
+	*out = (struct MappedFile){
+		.len = len,
+		.ptr = ptr,
+		.mapped = false,
+	};
+	return true;
+}
+
+void mapfile_finish(struct MappedFile *m)
+{
+	if (m == NULL) {
+		return;
+	}
+
+#ifdef CLARK_HAVE_MMAP
+	if (m->mapped) {
+		(void)munmap((void *)m->ptr, m->len);
+		*m = (struct MappedFile){ 0 };
+		return;
+	}
+#endif // CLARK_HAVE_MMAP
+
+	free((void *)m->ptr);
+	*m = (struct MappedFile){ 0 };
+}
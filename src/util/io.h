@@ -1,10 +1,28 @@
 #ifndef UTIL_IO_H
 #define UTIL_IO_H
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
-// Reads all of f into a heap allocated buffer.
+// The contents of a file, either mapped read-only into memory or read into a
+// heap allocated buffer.
+struct MappedFile {
+	size_t len;
+	const uint8_t *ptr;
+	bool mapped;
+};
+
+// Reads all of f into a heap allocated buffer and puts its length in len.
+// The buffer is followed by a NUL byte which isn't counted in len.
 // Returns NULL on failure.
-uint8_t *readfull(FILE *f);
+uint8_t *readfull(FILE *f, size_t *len);
+
+// Maps the rest of f into memory if it's a regular file, otherwise reads it
+// with readfull. f can be closed once this returns.
+// Returns false on failure, with errno set.
+bool mapfile(FILE *f, struct MappedFile *out);
+
+void mapfile_finish(struct MappedFile *m);
 
 #endif // UTIL_IO_H
@@ -1,11 +1,135 @@
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
+#include "util/common.h"
 #include "util/lineno.h"
 
+#define ONES (UINT64_C(0x0101010101010101))
+#define HIGHS (UINT64_C(0x8080808080808080))
+#define LOWS (UINT64_C(0x7f7f7f7f7f7f7f7f))
+
+// Counts the newlines in buf eight bytes at a time.
+static size_t count_newlines(const size_t buf_len, const uint8_t *buf)
+{
+	size_t result = 0;
+	size_t i = 0;
+	for (; i + 8 <= buf_len; i += 8) {
+		uint64_t word = 0;
+		memcpy(&word, &buf[i], sizeof(word));
+
+		// Every byte which was a newline becomes 0, then gets its high
+		// bit set. The carry can't cross bytes, since the high bit of
+		// each byte is cleared before the add.
+		word ^= ONES * u8"\n"[0];
+		word = ~(((word & LOWS) + LOWS) | word) & HIGHS;
+
+		// Move each high bit to the bottom of its byte, then sum all
+		// the bytes into the top byte.
+		result += ((word >> 7) * ONES) >> 56;
+	}
+
+	for (; i < buf_len; i += 1) {
+		result += buf[i] == u8"\n"[0];
+	}
+
+	return result;
+}
+
+bool lineindex_init(struct LineIndex *idx, const size_t buf_len,
+		    const uint8_t *buf)
+{
+	assert(idx != NULL);
+	assert(buf != NULL || buf_len == 0);
+
+	*idx = (struct LineIndex){
+		.buf_len = buf_len,
+		.buf = buf,
+	};
+
+	const size_t count = count_newlines(buf_len, buf);
+	if (count == 0) {
+		return true;
+	}
+
+	if (count > SIZE_MAX / sizeof(idx->newlines[0])) {
+		return false;
+	}
+
+	idx->newlines = malloc(count * sizeof(idx->newlines[0]));
+	if (idx->newlines == NULL) {
+		return false;
+	}
+
+	const uint8_t *ptr = buf;
+	const uint8_t *end = buf + buf_len;
+	for (size_t i = 0; i < count; i += 1) {
+		ptr = memchr(ptr, u8"\n"[0], end - ptr);
+		assert(ptr != NULL);
+		idx->newlines[i] = ptr - buf;
+		ptr += 1;
+	}
+
+	idx->newlines_len = count;
+	return true;
+}
+
+size_t lineindex_lineno(const struct LineIndex *idx, const size_t pos,
+			size_t *line_pos)
+{
+	assert(idx != NULL);
+
+	// Find how many newlines come before pos.
+	size_t lo = 0;
+	size_t hi = idx->newlines_len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (idx->newlines[mid] < pos) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (line_pos != NULL) {
+		size_t line_start = lo == 0 ? 0 : idx->newlines[lo - 1] + 1;
+		*line_pos = pos - line_start + 1;
+	}
+	return lo + 1;
+}
+
+size_t lineindex_line(const struct LineIndex *idx, const size_t line,
+		      const uint8_t **out)
+{
+	assert(idx != NULL);
+	assert(out != NULL);
+
+	*out = idx->buf;
+	if (line == 0 || line > idx->newlines_len + 1) {
+		return 0;
+	}
+
+	size_t start = line == 1 ? 0 : idx->newlines[line - 2] + 1;
+	size_t end = line <= idx->newlines_len ? idx->newlines[line - 1] :
+						 idx->buf_len;
+	*out = &idx->buf[start];
+	return end - start;
+}
+
+void lineindex_finish(struct LineIndex *idx)
+{
+	if (idx == NULL) {
+		return;
+	}
+
+	free(idx->newlines);
+	idx->newlines = NULL;
+	idx->newlines_len = 0;
+}
+
 // puts the line position in line_pos if line_pos != NULL.
 size_t lineno(const size_t buf_len, const uint8_t *buf, const size_t pos,
 	      size_t *line_pos)
@@ -14,20 +138,22 @@ size_t lineno(const size_t buf_len, const uint8_t *buf, const size_t pos,
 
 	size_t line = 1;
 	size_t line_start = 0;
-	for (size_t i = 0; i < buf_len; i += 1) {
-		if (i == pos) {
+	const uint8_t *ptr = buf;
+	const uint8_t *end = buf + MIN(buf_len, pos);
+	// TODO: is this just \n or \r\n on windows?
+	while (ptr < end) {
+		ptr = memchr(ptr, u8"\n"[0], end - ptr);
+		if (ptr == NULL) {
 			break;
 		}
-		// TODO: is this just \n or \r\n on windows?
-		if (buf[i] == u8"\n"[0]) {
-			line_start = i;
-			line += 1;
-			continue;
-		}
+
+		ptr += 1;
+		line_start = ptr - buf;
+		line += 1;
 	}
 
 	if (line_pos != NULL) {
-		*line_pos = pos + 1 - line_start;
+		*line_pos = pos - line_start + 1;
 	}
 	return line;
 }
@@ -35,41 +161,38 @@ size_t lineno(const size_t buf_len, const uint8_t *buf, const size_t pos,
 char *get_line_frompos(const size_t buf_len, const uint8_t *buf,
 		       const size_t pos)
 {
-	return get_line(buf_len, buf,
-			lineno(buf_len, buf, lineno(buf_len, buf, pos, NULL),
-			       NULL));
+	return get_line(buf_len, buf, lineno(buf_len, buf, pos, NULL));
 }
 
 char *get_line(const size_t buf_len, const uint8_t *buf, const size_t line)
 {
 	assert(buf != NULL);
 	size_t current = 1;
-	const size_t linepos = line;
+	const uint8_t *ptr = buf;
+	const uint8_t *end = buf + buf_len;
 
-	for (size_t i = 0; i < buf_len; i += 1) {
-		if (buf[i] == u8"\n"[0]) {
-			current += 1;
-			continue;
+	while (current < line && ptr < end) {
+		ptr = memchr(ptr, u8"\n"[0], end - ptr);
+		if (ptr == NULL) {
+			ptr = end;
+			break;
 		}
 
-		if (current != linepos) {
-			continue;
-		}
+		ptr += 1;
+		current += 1;
+	}
 
-		const size_t line_start = i;
-		size_t line_len = 0;
-		for (size_t j = i + 1; j < buf_len; j += 1) {
-			if (buf[j] == u8"\n"[0]) {
-				break;
-			}
-			line_len += 1;
-		}
+	size_t line_len = 0;
+	if (current == line) {
+		const uint8_t *nl = memchr(ptr, u8"\n"[0], end - ptr);
+		line_len = (nl == NULL ? end : nl) - ptr;
+	}
 
-		char *result = calloc(line_len + 2, 1);
-		memcpy(result, &buf[line_start], line_len + 1);
-		return result;
+	char *result = calloc(line_len + 1, 1);
+	if (result == NULL) {
+		return NULL;
 	}
 
-	char *result = calloc(1, 1);
+	memcpy(result, ptr, line_len);
 	return result;
 }
@@ -1,9 +1,41 @@
 #ifndef UTIL_LINENO_H
 #define UTIL_LINENO_H
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
-// puts the line position in line_pos if line_pos != NULL.
+// The positions of every newline in a buffer, so that line numbers can be
+// found with a binary search instead of rescanning the buffer.
+struct LineIndex {
+	size_t buf_len;
+	const uint8_t *buf;
+
+	size_t newlines_len;
+	size_t *newlines;
+};
+
+// Builds the index for the first buf_len bytes of buf. buf must outlive the
+// index.
+// Returns false if we couldn't allocate enough memory.
+bool lineindex_init(struct LineIndex *idx, const size_t buf_len,
+		    const uint8_t *buf);
+
+// Returns the line which contains pos, the same as lineno().
+// puts the column of pos within its line, counting from 1, in line_pos if
+// line_pos != NULL.
+size_t lineindex_lineno(const struct LineIndex *idx, const size_t pos,
+			size_t *line_pos);
+
+// Returns the number of bytes in the given line, not including the newline,
+// and points *out at its first byte. Lines start at 1. Lines which don't
+// exist are empty.
+size_t lineindex_line(const struct LineIndex *idx, const size_t line,
+		      const uint8_t **out);
+
+void lineindex_finish(struct LineIndex *idx);
+
+// puts the column of pos within its line, counting from 1, in line_pos if
+// line_pos != NULL.
 size_t lineno(const size_t buf_len, const uint8_t *buf, const size_t pos,
 	      size_t *line_pos);
 
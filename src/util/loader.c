@@ -0,0 +1,765 @@
+#if defined(__linux__)
+// For statx and O_CLOEXEC.
+#define _GNU_SOURCE
+#else
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if CLARK_HAVE_IO_URING
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif // CLARK_HAVE_IO_URING
+
+#if CLARK_HAVE_PTHREADS
+#include <pthread.h>
+#endif // CLARK_HAVE_PTHREADS
+
+#include "util/common.h"
+#include "util/io.h"
+#include "util/loader.h"
+
+// The number of files being read at the same time.
+#define MAX_ACTIVE 64
+
+// The size of the first read of a file whose size we don't know.
+#define UNKNOWN_SIZE_READ (64 * 1024)
+
+#define POOL_THREADS 8
+
+// Reads a single file with mapfile.
+static int load_one(const char *path, struct MappedFile *out)
+{
+	errno = 0;
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		return errno != 0 ? errno : EIO;
+	}
+
+	errno = 0;
+	bool ok = mapfile(f, out);
+	int err = errno != 0 ? errno : EIO;
+	fclose(f);
+	if (!ok) {
+		*out = (struct MappedFile){ 0 };
+		return err;
+	}
+
+	return 0;
+}
+
+#if CLARK_HAVE_IO_URING
+enum uring_op {
+	URING_OPEN = 0,
+	URING_STATX,
+	URING_READ,
+	URING_CLOSE,
+};
+
+struct uring {
+	int fd;
+
+	unsigned sq_entries;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	// Entries are added at tail, which is only published to the kernel
+	// once they've been filled in.
+	unsigned tail;
+	// The number of entries added since the last io_uring_enter.
+	unsigned sq_pending;
+
+	unsigned cq_entries;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	// Operations submitted whose completion hasn't been reaped yet.
+	unsigned inflight;
+
+	void *sq_ptr;
+	size_t sq_size;
+	void *cq_ptr;
+	size_t cq_size;
+	size_t sqes_size;
+};
+
+// A file being read through the ring.
+struct uring_file {
+	int fd;
+	int err;
+	// The open and statx which haven't completed yet.
+	uint8_t waiting;
+	struct statx stx;
+	bool size_known;
+	size_t cap;
+	size_t len;
+	uint8_t *buf;
+};
+
+static bool uring_supports(int fd)
+{
+	const size_t size = sizeof(struct io_uring_probe) +
+			    256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe = calloc(1, size);
+	if (probe == NULL) {
+		return false;
+	}
+
+	bool result = syscall(__NR_io_uring_register, fd,
+			      IORING_REGISTER_PROBE, probe, 256) == 0;
+	const uint8_t ops[] = {
+		IORING_OP_OPENAT,
+		IORING_OP_STATX,
+		IORING_OP_READ,
+		IORING_OP_CLOSE,
+	};
+	for (size_t i = 0; result && i < sizeof(ops); i += 1) {
+		result = ops[i] <= probe->last_op &&
+			 (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+	}
+
+	free(probe);
+	return result;
+}
+
+static void uring_finish(struct uring *r)
+{
+	if (r->sqes != NULL) {
+		munmap(r->sqes, r->sqes_size);
+	}
+	if (r->cq_ptr != NULL && r->cq_ptr != r->sq_ptr) {
+		munmap(r->cq_ptr, r->cq_size);
+	}
+	if (r->sq_ptr != NULL) {
+		munmap(r->sq_ptr, r->sq_size);
+	}
+	close(r->fd);
+}
+
+// Returns false if io_uring isn't available, or doesn't support the
+// operations we need.
+static bool uring_init(struct uring *r, const unsigned entries)
+{
+	*r = (struct uring){ .fd = -1 };
+
+	struct io_uring_params p = { 0 };
+	long fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (fd < 0) {
+		return false;
+	}
+	r->fd = fd;
+
+	if (!uring_supports(r->fd)) {
+		close(r->fd);
+		return false;
+	}
+
+	r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_size = p.cq_off.cqes +
+		     p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->sq_size = MAX(r->sq_size, r->cq_size);
+		r->cq_size = r->sq_size;
+	}
+
+	r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED) {
+		r->sq_ptr = NULL;
+		uring_finish(r);
+		return false;
+	}
+
+	r->cq_ptr = r->sq_ptr;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_POPULATE, r->fd,
+				 IORING_OFF_CQ_RING);
+		if (r->cq_ptr == MAP_FAILED) {
+			r->cq_ptr = NULL;
+			uring_finish(r);
+			return false;
+		}
+	}
+
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		r->sqes = NULL;
+		uring_finish(r);
+		return false;
+	}
+
+	uint8_t *sq = r->sq_ptr;
+	r->sq_entries = p.sq_entries;
+	r->sq_head = (unsigned *)(sq + p.sq_off.head);
+	r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)(sq + p.sq_off.array);
+	r->tail = *r->sq_tail;
+
+	uint8_t *cq = r->cq_ptr;
+	r->cq_entries = p.cq_entries;
+	r->cq_head = (unsigned *)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	return true;
+}
+
+// Submits everything queued so far, and waits for at least wait
+// completions. Returns 0 or an errno value.
+static int uring_enter(struct uring *r, const unsigned wait)
+{
+	atomic_store_explicit((_Atomic unsigned *)r->sq_tail, r->tail,
+			      memory_order_release);
+	for (;;) {
+		long ret = syscall(__NR_io_uring_enter, r->fd, r->sq_pending,
+				   wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0,
+				   NULL, 0);
+		if (ret >= 0) {
+			r->sq_pending -= MIN((unsigned)ret, r->sq_pending);
+			return 0;
+		}
+
+		if (errno != EINTR) {
+			return errno;
+		}
+	}
+}
+
+// Returns the number of entries which can be added to the submission queue.
+static unsigned uring_sq_space(struct uring *r)
+{
+	unsigned head = atomic_load_explicit((_Atomic unsigned *)r->sq_head,
+					     memory_order_acquire);
+	return r->sq_entries - (r->tail - head);
+}
+
+// Returns an empty submission queue entry, or NULL if the ring is full.
+static struct io_uring_sqe *uring_sqe(struct uring *r, const size_t i,
+				      const enum uring_op op)
+{
+	// Every submission needs room in the completion queue too.
+	if (r->inflight >= r->cq_entries) {
+		return NULL;
+	}
+
+	if (uring_sq_space(r) == 0) {
+		return NULL;
+	}
+
+	unsigned idx = r->tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = ((uint64_t)i << 2) | op;
+	r->sq_array[idx] = idx;
+	r->tail += 1;
+	r->sq_pending += 1;
+	r->inflight += 1;
+	return sqe;
+}
+
+// Gets a submission queue entry, submitting what's queued to make room if
+// needed. Returns NULL on failure.
+static struct io_uring_sqe *uring_sqe_wait(struct uring *r, const size_t i,
+					   const enum uring_op op)
+{
+	struct io_uring_sqe *sqe = uring_sqe(r, i, op);
+	if (sqe == NULL && r->inflight < r->cq_entries &&
+	    uring_enter(r, 0) == 0) {
+		sqe = uring_sqe(r, i, op);
+	}
+
+	return sqe;
+}
+
+static bool uring_queue_read(struct uring *r, struct uring_file *file,
+			     const size_t i)
+{
+	struct io_uring_sqe *sqe = uring_sqe_wait(r, i, URING_READ);
+	if (sqe == NULL) {
+		return false;
+	}
+
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = file->fd;
+	sqe->addr = (uintptr_t)&file->buf[file->len];
+	sqe->len = MIN(file->cap - file->len, (size_t)1 << 30);
+	sqe->off = file->len;
+	return true;
+}
+
+// Closes the file's descriptor, if it has one. The result isn't waited on.
+static void uring_queue_close(struct uring *r, struct uring_file *file,
+			      const size_t i)
+{
+	if (file->fd < 0) {
+		return;
+	}
+
+	struct io_uring_sqe *sqe = uring_sqe_wait(r, i, URING_CLOSE);
+	if (sqe == NULL) {
+		close(file->fd);
+	} else {
+		sqe->opcode = IORING_OP_CLOSE;
+		sqe->fd = file->fd;
+	}
+	file->fd = -1;
+}
+
+// Starts reading a file once it's been opened and its size is known.
+// Returns false if the file is finished, either because it's empty or
+// because of an error.
+static bool uring_start_read(struct uring *r, struct uring_file *file,
+			     const size_t i)
+{
+	if (file->err != 0) {
+		return false;
+	}
+
+	// Files in /proc claim to be empty whatever they hold, so a size of
+	// 0 is treated as unknown too. A regular file which really is empty
+	// then just takes one read to find its end.
+	file->size_known = S_ISREG(file->stx.stx_mode) &&
+			   file->stx.stx_size != 0;
+	if (file->size_known && file->stx.stx_size > SIZE_MAX - 1) {
+		file->err = EFBIG;
+		return false;
+	}
+
+	file->cap = file->size_known ? file->stx.stx_size : UNKNOWN_SIZE_READ;
+	file->buf = malloc(file->cap + 1);
+	if (file->buf == NULL) {
+		file->err = ENOMEM;
+		return false;
+	}
+
+	if (file->cap == 0) {
+		return false;
+	}
+
+	if (!uring_queue_read(r, file, i)) {
+		file->err = EAGAIN;
+		return false;
+	}
+
+	return true;
+}
+
+// Handles the result of a read. Returns false if the file is finished.
+static bool uring_continue_read(struct uring *r, struct uring_file *file,
+				const size_t i, const int res)
+{
+	if (res < 0) {
+		file->err = -res;
+		return false;
+	}
+
+	if (res == 0) {
+		return false;
+	}
+
+	file->len += res;
+	if (file->len == file->cap) {
+		if (file->size_known) {
+			return false;
+		}
+
+		if (file->cap > (SIZE_MAX - 1) / 2) {
+			file->err = EFBIG;
+			return false;
+		}
+
+		uint8_t *ptr = realloc(file->buf, file->cap * 2 + 1);
+		if (ptr == NULL) {
+			file->err = ENOMEM;
+			return false;
+		}
+		file->buf = ptr;
+		file->cap *= 2;
+	}
+
+	if (!uring_queue_read(r, file, i)) {
+		file->err = EAGAIN;
+		return false;
+	}
+
+	return true;
+}
+
+static void uring_file_done(struct uring *r, struct uring_file *file,
+			    const size_t i,
+			    void (*done)(void *data, const size_t i,
+					 const int err, struct MappedFile file),
+			    void *data)
+{
+	uring_queue_close(r, file, i);
+
+	struct MappedFile result = { 0 };
+	if (file->err == 0) {
+		file->buf[file->len] = '\0';
+		result = (struct MappedFile){
+			.len = file->len,
+			.ptr = file->buf,
+			.mapped = false,
+		};
+	} else {
+		free(file->buf);
+	}
+	file->buf = NULL;
+
+	done(data, i, file->err, result);
+}
+
+static bool uring_queue_open(struct uring *r, struct uring_file *file,
+			     const size_t i, const char *path)
+{
+	*file = (struct uring_file){ .fd = -1, .waiting = 2 };
+
+	// Both the open and the statx go by the path, so they don't need to
+	// wait on each other. Make sure there's room for both first, so that
+	// the open is never queued without its statx. If there isn't, the
+	// caller tries again once some of what's in flight has completed.
+	if (r->inflight + 2 > r->cq_entries) {
+		return false;
+	}
+
+	if (uring_sq_space(r) < 2 &&
+	    (uring_enter(r, 0) != 0 || uring_sq_space(r) < 2)) {
+		return false;
+	}
+
+	struct io_uring_sqe *open = uring_sqe(r, i, URING_OPEN);
+	struct io_uring_sqe *stat = uring_sqe(r, i, URING_STATX);
+	assert(open != NULL && stat != NULL);
+	open->opcode = IORING_OP_OPENAT;
+	open->fd = AT_FDCWD;
+	open->addr = (uintptr_t)path;
+	open->open_flags = O_RDONLY | O_CLOEXEC;
+
+	stat->opcode = IORING_OP_STATX;
+	stat->fd = AT_FDCWD;
+	stat->addr = (uintptr_t)path;
+	stat->len = STATX_TYPE | STATX_SIZE;
+	stat->off = (uintptr_t)&file->stx;
+	return true;
+}
+
+// Returns 0, or an errno value if the ring stopped working. Any files not
+// yet reported are then left for the caller to load another way.
+static int uring_load(struct uring *r, const size_t paths_len,
+		      const char *const *paths, bool *reported,
+		      void (*done)(void *data, const size_t i, const int err,
+				   struct MappedFile file),
+		      void *data)
+{
+	// The files being read. A file's slot is chosen when it's opened, and
+	// user_data holds the index of the path, so we also keep which slot
+	// each path is using.
+	struct uring_file *files = calloc(MAX_ACTIVE, sizeof(files[0]));
+	size_t *slots = calloc(paths_len, sizeof(slots[0]));
+	size_t *free_slots = calloc(MAX_ACTIVE, sizeof(free_slots[0]));
+	if (files == NULL || slots == NULL || free_slots == NULL) {
+		free(files);
+		free(slots);
+		free(free_slots);
+		return ENOMEM;
+	}
+
+	size_t free_len = MAX_ACTIVE;
+	for (size_t i = 0; i < MAX_ACTIVE; i += 1) {
+		free_slots[i] = MAX_ACTIVE - 1 - i;
+	}
+
+	int result = 0;
+	size_t next = 0;
+	size_t finished = 0;
+	while (finished < paths_len) {
+		while (next < paths_len && free_len > 0) {
+			size_t slot = free_slots[free_len - 1];
+			if (!uring_queue_open(r, &files[slot], next,
+					      paths[next])) {
+				break;
+			}
+			free_len -= 1;
+			slots[next] = slot;
+			next += 1;
+		}
+
+		result = uring_enter(r, 1);
+		if (result != 0) {
+			break;
+		}
+
+		unsigned head = *r->cq_head;
+		unsigned tail = atomic_load_explicit(
+			(_Atomic unsigned *)r->cq_tail, memory_order_acquire);
+		for (; head != tail; head += 1) {
+			struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+			const size_t i = cqe->user_data >> 2;
+			const enum uring_op op = cqe->user_data & 3;
+			const int res = cqe->res;
+			r->inflight -= 1;
+
+			if (op == URING_CLOSE) {
+				continue;
+			}
+
+			struct uring_file *file = &files[slots[i]];
+			bool reading = false;
+			switch (op) {
+			case URING_OPEN:
+				if (res < 0) {
+					file->err = -res;
+				} else {
+					file->fd = res;
+				}
+				file->waiting -= 1;
+				if (file->waiting != 0) {
+					continue;
+				}
+				reading = uring_start_read(r, file, i);
+				break;
+			case URING_STATX:
+				if (res < 0 && file->err == 0) {
+					file->err = -res;
+				}
+				file->waiting -= 1;
+				if (file->waiting != 0) {
+					continue;
+				}
+				reading = uring_start_read(r, file, i);
+				break;
+			case URING_READ:
+				reading = uring_continue_read(r, file, i, res);
+				break;
+			case URING_CLOSE:
+				break;
+			}
+
+			if (reading) {
+				continue;
+			}
+
+			uring_file_done(r, file, i, done, data);
+			reported[i] = true;
+			free_slots[free_len] = slots[i];
+			free_len += 1;
+			finished += 1;
+		}
+		atomic_store_explicit((_Atomic unsigned *)r->cq_head, head,
+				      memory_order_release);
+	}
+
+	// Let the remaining closes finish before the ring goes away.
+	//
+	// If the ring stopped working, the files still being read are left
+	// for the caller to load again. Their buffers are deliberately leaked,
+	// since the kernel may still be writing into them, and so is files,
+	// which holds the struct statx that a pending statx writes to.
+	if (result == 0) {
+		(void)uring_enter(r, 0);
+		free(files);
+	}
+
+	free(slots);
+	free(free_slots);
+	return result;
+}
+#endif // CLARK_HAVE_IO_URING
+
+#if CLARK_HAVE_PTHREADS
+struct pool {
+	const char *const *paths;
+	size_t paths_len;
+	bool *reported;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	// The next path for a worker to load.
+	size_t next;
+	// The paths which have been loaded but not reported, in the order
+	// they finished.
+	size_t loaded_len;
+	size_t *loaded;
+	int *errs;
+	struct MappedFile *results;
+};
+
+static void *pool_worker(void *arg)
+{
+	struct pool *p = arg;
+	for (;;) {
+		pthread_mutex_lock(&p->lock);
+		size_t i = p->next;
+		while (i < p->paths_len && p->reported[i]) {
+			i += 1;
+		}
+		p->next = i + 1;
+		pthread_mutex_unlock(&p->lock);
+		if (i >= p->paths_len) {
+			return NULL;
+		}
+
+		struct MappedFile file = { 0 };
+		int err = load_one(p->paths[i], &file);
+
+		pthread_mutex_lock(&p->lock);
+		p->errs[i] = err;
+		p->results[i] = file;
+		p->loaded[p->loaded_len] = i;
+		p->loaded_len += 1;
+		pthread_cond_signal(&p->cond);
+		pthread_mutex_unlock(&p->lock);
+	}
+}
+
+// Loads every path not yet reported with a pool of threads. Returns false if
+// the pool couldn't be started.
+static bool pool_load(const size_t paths_len, const char *const *paths,
+		      bool *reported,
+		      void (*done)(void *data, const size_t i, const int err,
+				   struct MappedFile file),
+		      void *data)
+{
+	struct pool p = {
+		.paths = paths,
+		.paths_len = paths_len,
+		.reported = reported,
+		.loaded = calloc(paths_len, sizeof(p.loaded[0])),
+		.errs = calloc(paths_len, sizeof(p.errs[0])),
+		.results = calloc(paths_len, sizeof(p.results[0])),
+	};
+	size_t remaining = 0;
+	for (size_t i = 0; i < paths_len; i += 1) {
+		remaining += !reported[i];
+	}
+
+	pthread_t threads[POOL_THREADS];
+	size_t threads_len = 0;
+	bool ok = p.loaded != NULL && p.errs != NULL && p.results != NULL &&
+		  pthread_mutex_init(&p.lock, NULL) == 0;
+	if (ok && pthread_cond_init(&p.cond, NULL) != 0) {
+		pthread_mutex_destroy(&p.lock);
+		ok = false;
+	}
+	if (!ok) {
+		free(p.loaded);
+		free(p.errs);
+		free(p.results);
+		return false;
+	}
+
+	for (; threads_len < MIN(remaining, POOL_THREADS); threads_len += 1) {
+		if (pthread_create(&threads[threads_len], NULL, pool_worker,
+				   &p) != 0) {
+			break;
+		}
+	}
+
+	// With no threads, do the work on this one.
+	if (threads_len == 0) {
+		(void)pool_worker(&p);
+	}
+
+	size_t reported_len = 0;
+	pthread_mutex_lock(&p.lock);
+	while (reported_len < remaining) {
+		while (reported_len == p.loaded_len) {
+			pthread_cond_wait(&p.cond, &p.lock);
+		}
+
+		size_t i = p.loaded[reported_len];
+		reported_len += 1;
+
+		// Don't hold the lock while the callback runs.
+		pthread_mutex_unlock(&p.lock);
+		reported[i] = true;
+		done(data, i, p.errs[i], p.results[i]);
+		pthread_mutex_lock(&p.lock);
+	}
+	pthread_mutex_unlock(&p.lock);
+
+	for (size_t i = 0; i < threads_len; i += 1) {
+		pthread_join(threads[i], NULL);
+	}
+
+	pthread_cond_destroy(&p.cond);
+	pthread_mutex_destroy(&p.lock);
+	free(p.loaded);
+	free(p.errs);
+	free(p.results);
+	return true;
+}
+#endif // CLARK_HAVE_PTHREADS
+
+bool loadfiles(const size_t paths_len, const char *const *paths,
+	       void (*done)(void *data, const size_t i, const int err,
+			    struct MappedFile file),
+	       void *data)
+{
+	assert(paths != NULL || paths_len == 0);
+	assert(done != NULL);
+
+	if (paths_len == 0) {
+		return true;
+	}
+
+	bool *reported = calloc(paths_len, sizeof(reported[0]));
+	if (reported == NULL) {
+		return false;
+	}
+
+#if CLARK_HAVE_IO_URING
+	struct uring r;
+	if (uring_init(&r, MAX_ACTIVE * 2)) {
+		int err = uring_load(&r, paths_len, paths, reported, done,
+				     data);
+		uring_finish(&r);
+		if (err == 0) {
+			free(reported);
+			return true;
+		}
+	}
+#endif // CLARK_HAVE_IO_URING
+
+#if CLARK_HAVE_PTHREADS
+	if (pool_load(paths_len, paths, reported, done, data)) {
+		free(reported);
+		return true;
+	}
+#endif // CLARK_HAVE_PTHREADS
+
+	for (size_t i = 0; i < paths_len; i += 1) {
+		if (reported[i]) {
+			continue;
+		}
+
+		struct MappedFile file = { 0 };
+		int err = load_one(paths[i], &file);
+		reported[i] = true;
+		done(data, i, err, file);
+	}
+
+	free(reported);
+	return true;
+}
@@ -0,0 +1,26 @@
+#ifndef UTIL_LOADER_H
+#define UTIL_LOADER_H
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "util/io.h"
+
+// Reads every file in paths, with as many reads in flight at once as
+// possible. On Linux the opens, stats and reads are submitted in batches
+// through io_uring; otherwise they're spread over a small pool of threads.
+//
+// done is called once for each path as soon as that file has been read,
+// always on the calling thread, in the order the files finish loading rather
+// than the order of paths. i is the index of the path. On success err is 0
+// and file holds the contents of the file, which done takes ownership of and
+// must free with mapfile_finish. Otherwise err is an errno value and file is
+// empty.
+//
+// Returns false if the loader itself couldn't be set up, in which case done
+// has not been called for any path.
+bool loadfiles(const size_t paths_len, const char *const *paths,
+	       void (*done)(void *data, const size_t i, const int err,
+			    struct MappedFile file),
+	       void *data);
+
+#endif // UTIL_LOADER_H
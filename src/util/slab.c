@@ -0,0 +1,189 @@
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/common.h"
+#include "util/slab.h"
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+// Stored at the start of every chunk.
+struct SlabChunk {
+	struct SlabChunk *next;
+	// The slab which allocated this chunk, which objects in it are freed
+	// to.
+	struct Slab *owner;
+	uint32_t tag;
+};
+
+// Objects start after the header, at an offset which keeps them aligned.
+#define CHUNK_HEADER_SIZE 32
+static_assert(sizeof(struct SlabChunk) <= CHUNK_HEADER_SIZE,
+	      "struct SlabChunk doesn't fit in CHUNK_HEADER_SIZE");
+
+static void *chunk_alloc(void)
+{
+#if defined(_WIN32)
+	return _aligned_malloc(SLAB_CHUNK_SIZE, SLAB_CHUNK_SIZE);
+#else
+	return aligned_alloc(SLAB_CHUNK_SIZE, SLAB_CHUNK_SIZE);
+#endif
+}
+
+static void chunk_free(void *chunk)
+{
+#if defined(_WIN32)
+	_aligned_free(chunk);
+#else
+	free(chunk);
+#endif
+}
+
+// Returns the chunk which holds ptr.
+static struct SlabChunk *chunk_of(const void *ptr)
+{
+	return (void *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_CHUNK_SIZE - 1));
+}
+
+// Moves the objects of the given class which were freed through other slabs
+// onto s's free list.
+static void take_remote(struct Slab *s, const size_t class)
+{
+	void *ptr = atomic_exchange_explicit(&s->remote[class], NULL,
+					     memory_order_acquire);
+	while (ptr != NULL) {
+		void *next = NULL;
+		memcpy(&next, ptr, sizeof(void *));
+		memcpy(ptr, &s->free[class], sizeof(void *));
+		s->free[class] = ptr;
+		s->used -= 1;
+		ptr = next;
+	}
+}
+
+// Returns the size class for objects of the given size.
+static size_t size_class(const size_t size)
+{
+	assert(size <= SLAB_MAX_SIZE);
+
+	size_t class = 0;
+	while ((SLAB_MIN_SIZE << class) < size) {
+		class += 1;
+	}
+
+	return class;
+}
+
+void *slab_alloc(struct Slab *s, const size_t size)
+{
+	assert(s != NULL);
+
+	const size_t class = size_class(size);
+	if (s->free[class] == NULL &&
+	    atomic_load_explicit(&s->remote[class], memory_order_relaxed) !=
+		    NULL) {
+		take_remote(s, class);
+	}
+
+	void *result = s->free[class];
+	if (result != NULL) {
+		memcpy(&s->free[class], result, sizeof(void *));
+		s->used += 1;
+		return result;
+	}
+
+	const size_t object_size = SLAB_MIN_SIZE << class;
+	if (s->next[class] == NULL ||
+	    (size_t)(s->end[class] - s->next[class]) < object_size) {
+		struct SlabChunk *chunk = chunk_alloc();
+		if (chunk == NULL) {
+			return NULL;
+		}
+
+		*chunk = (struct SlabChunk){
+			.next = s->chunks,
+			.owner = s,
+			.tag = s->tag,
+		};
+		s->chunks = chunk;
+
+		uint8_t *start = (uint8_t *)chunk;
+		s->next[class] = start + MAX(CHUNK_HEADER_SIZE, object_size);
+		s->end[class] = start + SLAB_CHUNK_SIZE;
+	}
+
+	result = s->next[class];
+	s->next[class] += object_size;
+	s->used += 1;
+	return result;
+}
+
+void slab_free(struct Slab *s, void *ptr, const size_t size)
+{
+	assert(s != NULL);
+
+	if (ptr == NULL) {
+		return;
+	}
+
+	const size_t class = size_class(size);
+	struct Slab *owner = chunk_of(ptr)->owner;
+	if (owner != s) {
+		// The owner may be allocating on another thread, so ptr is
+		// pushed onto its remote list, which only it takes from.
+		void *head = atomic_load_explicit(&owner->remote[class],
+						  memory_order_relaxed);
+		do {
+			memcpy(ptr, &head, sizeof(void *));
+		} while (!atomic_compare_exchange_weak_explicit(
+			&owner->remote[class], &head, ptr, memory_order_release,
+			memory_order_relaxed));
+		return;
+	}
+
+	memcpy(ptr, &s->free[class], sizeof(void *));
+	s->free[class] = ptr;
+	s->used -= 1;
+}
+
+uint32_t slab_tag(const void *ptr)
+{
+	assert(ptr != NULL);
+
+	return chunk_of(ptr)->tag;
+}
+
+void slab_finish(struct Slab *s)
+{
+	if (s == NULL) {
+		return;
+	}
+
+	struct SlabChunk *chunk = s->chunks;
+	while (chunk != NULL) {
+		struct SlabChunk *next = chunk->next;
+		chunk_free(chunk);
+		chunk = next;
+	}
+
+	*s = (struct Slab){ .tag = s->tag };
+}
+
+void slab_trim(struct Slab *s)
+{
+	assert(s != NULL);
+
+	for (size_t class = 0; class < SLAB_CLASSES; class += 1) {
+		take_remote(s, class);
+	}
+
+	if (s->used == 0) {
+		slab_finish(s);
+	}
+}
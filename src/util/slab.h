@@ -0,0 +1,67 @@
+#ifndef UTIL_SLAB_H
+#define UTIL_SLAB_H
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The size of each chunk a slab carves objects out of. Chunks are aligned to
+// their size, so the chunk holding any object can be found from its address.
+#define SLAB_CHUNK_SIZE (64 * 1024)
+
+// Objects are rounded up to a power of two between SLAB_MIN_SIZE and
+// SLAB_MAX_SIZE bytes.
+#define SLAB_MIN_SHIFT 4
+#define SLAB_CLASSES 8
+#define SLAB_MIN_SIZE ((size_t)1 << SLAB_MIN_SHIFT)
+#define SLAB_MAX_SIZE ((size_t)1 << (SLAB_MIN_SHIFT + SLAB_CLASSES - 1))
+
+struct SlabChunk;
+
+// An allocator for small objects which are allocated and freed often. Each
+// size class has its own chunks, and freed objects are kept on a free list for
+// their class instead of being returned to malloc. The size of an object must
+// be given again when it's freed, so objects don't need a header.
+//
+// A slab is meant to be used by one thread. Objects can still be freed on
+// other threads, through another slab, in which case they're handed back to
+// the slab which allocated them, which must outlive them. Its memory is only
+// released by slab_finish, or by slab_trim once nothing allocated from it is
+// still in use.
+struct Slab {
+	// Stored in every chunk this slab allocates, see slab_tag.
+	uint32_t tag;
+	// The number of objects allocated from this slab, less the number
+	// which have been handed back to it.
+	size_t used;
+
+	void *free[SLAB_CLASSES];
+	// Objects of each class freed through other slabs, which are moved onto
+	// free once this slab runs out of objects of that class or is trimmed.
+	_Atomic(void *) remote[SLAB_CLASSES];
+	uint8_t *next[SLAB_CLASSES];
+	uint8_t *end[SLAB_CLASSES];
+	struct SlabChunk *chunks;
+};
+
+// Returns an object of at least size bytes, which must be at most
+// SLAB_MAX_SIZE, aligned to at least 16 bytes.
+// Returns NULL if we couldn't allocate enough memory.
+void *slab_alloc(struct Slab *s, const size_t size);
+
+// Frees ptr, which was allocated from a slab with the same size. s is the
+// slab of the thread freeing it, which puts it on its free list if it
+// allocated ptr. Otherwise ptr is handed back to the slab it came from, which
+// mustn't have been finished, and may be in use on another thread.
+void slab_free(struct Slab *s, void *ptr, const size_t size);
+
+// Returns the tag of the slab which allocated ptr.
+uint32_t slab_tag(const void *ptr);
+
+// Frees every chunk s has allocated, including any objects still in use.
+void slab_finish(struct Slab *s);
+
+// Frees every chunk s has allocated if none of its objects are in use, so that
+// memory which is only needed while objects are being made isn't kept forever.
+void slab_trim(struct Slab *s);
+
+#endif // UTIL_SLAB_H
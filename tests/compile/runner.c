@@ -0,0 +1,122 @@
+#include <stdint.h>
+#include <assert.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "starlark/common.h"
+#include "starlark/lex.h"
+#include "starlark/parse.h"
+#include "starlark/resolve.h"
+#include "starlark/compile.h"
+#include "util/common.h"
+#include "util/panic.h"
+#include "util/io.h"
+#include "util/lineno.h"
+#include "util/diff.h"
+#include "../lib.h"
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: runner file.txt [key=value...]\n");
+		return EXIT_FAILURE;
+	}
+
+	errno = 0;
+	FILE *f = fopen(argv[1], "rb");
+	if (f == NULL) {
+		panic("error reading file '%s': %s", argv[1], strerror(errno));
+	}
+	struct MappedFile input = { 0 };
+	if (!mapfile(f, &input)) {
+		panic("error reading file '%s': %s", argv[1], strerror(errno));
+	}
+	fclose(f);
+	assert(input.len < SIZE_MAX);
+
+	// Initializing Starlark
+
+	struct starlark_Lexer l = { 0 };
+	struct starlark_Context ctx = { 0 };
+	configure(&ctx, argc, argv);
+	int ret = starlark_lex(&ctx, "<stdin>", input.len, input.ptr, &l);
+	if (ret != 0) {
+		panic("starlark_lex returned: %d", ret);
+	}
+
+	struct starlark_Parser p = { 0 };
+	ret = starlark_parse_tokens(&ctx, &l, &p);
+	if (ret != 0) {
+		panic("starlark_parse_tokens returned: %d", ret);
+	}
+
+	struct starlark_Resolver r = { 0 };
+	ret = resolve(&ctx, &p, &r);
+	if (ret != 0) {
+		panic("resolve returned: %d", ret);
+	}
+
+	struct starlark_CompileScratch scratch = { 0 };
+	struct starlark_Program prog = { 0 };
+	ret = compile(&ctx, &p, &r, &scratch, &prog);
+	if (ret != 0) {
+		panic("compile returned: %d", ret);
+	}
+
+	// Dump the bytecode and errors into tmpfile, then read into a buffer.
+
+	errno = 0;
+	f = tmpfile();
+	if (f == NULL) {
+		panic("couldn't make a tempfile: %s", strerror(errno));
+	}
+
+	Program_dump(&ctx, &prog, f);
+	starlark_errors_dump(&ctx, f);
+
+	fseek(f, 0, SEEK_SET);
+	size_t tok_len = 0;
+	uint8_t *tok_buf = readfull(f, &tok_len);
+
+	if (tok_buf == NULL) {
+		panic("error reading temp file: %s", strerror(errno));
+	}
+	fclose(f);
+
+	f = open_with_suffix(argv[1], ".expect", "rb");
+	size_t expect_len = 0;
+	uint8_t *expect_buf = readfull(f, &expect_len);
+
+	if (expect_buf == NULL) {
+		panic("error reading file '%s': %s", argv[1], strerror(errno));
+	}
+	fclose(f);
+
+	// Diff
+
+	assert(tok_len < SIZE_MAX);
+	assert(expect_len < SIZE_MAX);
+
+	size_t diff_idx = 0;
+	int status = EXIT_SUCCESS;
+	if (!diff(tok_len, tok_buf, expect_len, expect_buf, &diff_idx)) {
+		diff_fwrite(stderr, tok_len, tok_buf, expect_len, expect_buf,
+			    diff_idx);
+		status = EXIT_FAILURE;
+	}
+
+	mapfile_finish(&input);
+	free(expect_buf);
+	free(tok_buf);
+	Program_finish(&prog);
+	CompileScratch_finish(&scratch);
+	Resolver_finish(&r);
+	starlark_Parser_finish(&p);
+	starlark_Lexer_finish(&l);
+	starlark_Context_finish(&ctx);
+
+	return status;
+}
@@ -0,0 +1,119 @@
+#include <stdint.h>
+#include <assert.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "starlark/common.h"
+#include "util/common.h"
+#include "util/panic.h"
+#include "util/io.h"
+#include "util/diff.h"
+#include "../lib.h"
+
+// Returns the length of the program at the start of src, which is ended by a
+// line holding only "---", or the end of src. *next is set to where the
+// program after it starts.
+static size_t program_len(const size_t src_len, const uint8_t *src,
+			  size_t *next)
+{
+	const char sep[] = "\n---\n";
+	const size_t sep_len = sizeof(sep) - 1;
+	for (size_t i = 0; i + sep_len <= src_len; i += 1) {
+		if (memcmp(&src[i], sep, sep_len) == 0) {
+			*next = i + sep_len;
+			return i + 1;
+		}
+	}
+
+	*next = src_len;
+	return src_len;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: runner file.txt [key=value...]\n");
+		return EXIT_FAILURE;
+	}
+
+	errno = 0;
+	FILE *f = fopen(argv[1], "rb");
+	if (f == NULL) {
+		panic("error reading file '%s': %s", argv[1], strerror(errno));
+	}
+	struct MappedFile input = { 0 };
+	if (!mapfile(f, &input)) {
+		panic("error reading file '%s': %s", argv[1], strerror(errno));
+	}
+	fclose(f);
+	assert(input.len < SIZE_MAX);
+
+	// Run each program in the file in its own context, sending what it
+	// prints and its errors to a tmpfile, then read that into a buffer.
+
+	errno = 0;
+	f = tmpfile();
+	if (f == NULL) {
+		panic("couldn't make a tempfile: %s", strerror(errno));
+	}
+
+	for (size_t start = 0; start < input.len;) {
+		const uint8_t *src = &input.ptr[start];
+		size_t next = 0;
+		const size_t len = program_len(input.len - start, src, &next);
+		struct starlark_Context ctx = { 0 };
+		ctx.out = f;
+		configure(&ctx, argc, argv);
+		int ret = starlark_exec(&ctx, "<stdin>", len, src);
+		if (ret < 0) {
+			panic("starlark_exec returned: %d", ret);
+		}
+
+		starlark_errors_dump(&ctx, f);
+		starlark_Context_finish(&ctx);
+		start += next;
+		if (start < input.len) {
+			fputs("---\n", f);
+		}
+	}
+
+	fseek(f, 0, SEEK_SET);
+	size_t out_len = 0;
+	uint8_t *out_buf = readfull(f, &out_len);
+
+	if (out_buf == NULL) {
+		panic("error reading temp file: %s", strerror(errno));
+	}
+	fclose(f);
+
+	f = open_with_suffix(argv[1], ".expect", "rb");
+	size_t expect_len = 0;
+	uint8_t *expect_buf = readfull(f, &expect_len);
+
+	if (expect_buf == NULL) {
+		panic("error reading file '%s': %s", argv[1], strerror(errno));
+	}
+	fclose(f);
+
+	// Diff
+
+	assert(out_len < SIZE_MAX);
+	assert(expect_len < SIZE_MAX);
+
+	size_t diff_idx = 0;
+	int status = EXIT_SUCCESS;
+	if (!diff(out_len, out_buf, expect_len, expect_buf, &diff_idx)) {
+		diff_fwrite(stderr, out_len, out_buf, expect_len, expect_buf,
+			    diff_idx);
+		status = EXIT_FAILURE;
+	}
+
+	mapfile_finish(&input);
+	free(expect_buf);
+	free(out_buf);
+
+	return status;
+}
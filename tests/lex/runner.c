@@ -27,20 +27,18 @@ int main(int argc, char **argv)
 	if (f == NULL) {
 		panic("error reading file '%s': %s", argv[1], strerror(errno));
 	}
-	uint8_t *input_buf = readfull(f);
-
-	if (ferror(f)) {
+	struct MappedFile input = { 0 };
+	if (!mapfile(f, &input)) {
 		panic("error reading file '%s': %s", argv[1], strerror(errno));
 	}
 	fclose(f);
-	size_t input_len = strlen((const char *)input_buf);
-	assert(input_len < SIZE_MAX);
+	assert(input.len < SIZE_MAX);
 
 	// Initializing Starlark
 
 	struct starlark_Lexer l = { 0 };
 	struct starlark_Context ctx = { 0 };
-	int ret = starlark_lex(&ctx, "<stdin>", input_len, input_buf, &l);
+	int ret = starlark_lex(&ctx, "<stdin>", input.len, input.ptr, &l);
 	if (ret != 0) {
 		panic("starlark_lex returned: %d", ret);
 	}
@@ -57,22 +55,22 @@ int main(int argc, char **argv)
 	starlark_errors_dump(&ctx, f);
 
 	fseek(f, 0, SEEK_SET);
-	uint8_t *tok_buf = readfull(f);
+	size_t tok_len = 0;
+	uint8_t *tok_buf = readfull(f, &tok_len);
 
-	if (ferror(f)) {
+	if (tok_buf == NULL) {
 		panic("error reading temp file: %s", strerror(errno));
 	}
 	fclose(f);
-	size_t tok_len = strlen((const char *)tok_buf);
 
 	f = open_with_suffix(argv[1], ".expect", "rb");
-	uint8_t *expect_buf = readfull(f);
+	size_t expect_len = 0;
+	uint8_t *expect_buf = readfull(f, &expect_len);
 
-	if (ferror(f)) {
+	if (expect_buf == NULL) {
 		panic("error reading file '%s': %s", argv[1], strerror(errno));
 	}
 	fclose(f);
-	size_t expect_len = strlen((const char *)expect_buf);
 
 	// Diff
 
@@ -87,7 +85,7 @@ int main(int argc, char **argv)
 		status = EXIT_FAILURE;
 	}
 
-	free(input_buf);
+	mapfile_finish(&input);
 	free(expect_buf);
 	free(tok_buf);
 	starlark_Lexer_finish(&l);
@@ -5,12 +5,13 @@
 #include <stdlib.h>
 #include <errno.h>
 
+#include "starlark/common.h"
 #include "util/panic.h"
 
 extern int errno;
 
-static FILE *open_with_suffix(const char *filename, const char *suffix,
-			      const char *mode)
+static inline FILE *open_with_suffix(const char *filename,
+				     const char *suffix, const char *mode)
 {
 	errno = 0;
 	char *tmp = calloc(strlen(filename) + strlen(suffix) + 1, 1);
@@ -32,4 +33,31 @@ static FILE *open_with_suffix(const char *filename, const char *suffix,
 	return result;
 }
 
+// Sets each configuration key given as a "key=value" argument after the file
+// being tested on ctx.
+static inline void configure(struct starlark_Context *ctx, int argc,
+			     char **argv)
+{
+	for (int i = 2; i < argc; i += 1) {
+		char *eq = strchr(argv[i], '=');
+		if (eq == NULL) {
+			panic("expected key=value, got '%s'", argv[i]);
+		}
+
+		*eq = '\0';
+		if (starlark_config_set(ctx, argv[i], eq + 1) != 0) {
+			panic("couldn't set '%s' to '%s'", argv[i], eq + 1);
+		}
+		*eq = '=';
+	}
+}
+
+// Fails the test unless cond holds, saying which check it was.
+#define expect(cond)                                                          \
+	do {                                                                  \
+		if (!(cond)) {                                                \
+			panic("expected %s", #cond);                          \
+		}                                                             \
+	} while (0)
+
 #endif // TESTS_LIB_H
@@ -0,0 +1,426 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "starlark/common.h"
+#include "starlark/dict.h"
+#include "starlark/int.h"
+#include "starlark/value.h"
+#include "util/panic.h"
+#include "../lib.h"
+
+// Dicts are checked against a model which keeps every key it has ever been
+// given in the order it was first inserted, or reinserted after a delete.
+
+static uint64_t state = 0x2545f4914f6cdd1du;
+
+static uint64_t next(void)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+struct model {
+	size_t keys;
+	// Where each key is in order, or -1 if it isn't in the dict.
+	int64_t *pos;
+	// The value each key is mapped to.
+	int64_t *values;
+
+	size_t len;
+	size_t order_len;
+	size_t order_cap;
+	// Keys in the order they were inserted. Deleted keys are left as -1.
+	int64_t *order;
+};
+
+static void model_init(struct model *m, const size_t keys)
+{
+	*m = (struct model){
+		.keys = keys,
+		.pos = malloc(keys * sizeof(m->pos[0])),
+		.values = calloc(keys, sizeof(m->values[0])),
+	};
+	if (m->pos == NULL || m->values == NULL) {
+		panic("out of memory");
+	}
+
+	for (size_t k = 0; k < keys; k += 1) {
+		m->pos[k] = -1;
+	}
+}
+
+static void model_finish(struct model *m)
+{
+	free(m->pos);
+	free(m->values);
+	free(m->order);
+}
+
+// Returns the key numbered k. Keys are a mix of small ints, heap ints and
+// strings, so that they hash and compare differently.
+static struct starlark_Value key(const size_t k)
+{
+	struct starlark_Value result = VALUE_NONE;
+	switch (k % 3) {
+	case 0:
+		result = Value_small_int((int64_t)k);
+		break;
+	case 1: {
+		char buf[32];
+		const int len = snprintf(buf, sizeof(buf), "key %zu", k);
+		result = Value_str((size_t)len, buf);
+		expect(!Value_is_none(result));
+		break;
+	}
+	default:
+		expect(Value_from_i64(INT60_MAX + (int64_t)k, &result) == 0);
+		break;
+	}
+
+	return result;
+}
+
+static void set(struct model *m, struct starlark_Dict *d, const size_t k,
+		const int64_t value)
+{
+	const struct starlark_Value kv = key(k);
+	expect(Dict_set(d, kv, Value_small_int(value)) == 0);
+	Value_release(kv);
+
+	m->values[k] = value;
+	if (m->pos[k] >= 0) {
+		return;
+	}
+
+	if (m->order_len == m->order_cap) {
+		m->order_cap = m->order_cap == 0 ? 64 : m->order_cap * 2;
+		m->order = realloc(m->order, m->order_cap * sizeof(m->order[0]));
+		if (m->order == NULL) {
+			panic("out of memory");
+		}
+	}
+
+	m->pos[k] = (int64_t)m->order_len;
+	m->order[m->order_len] = (int64_t)k;
+	m->order_len += 1;
+	m->len += 1;
+}
+
+static void delete(struct model *m, struct starlark_Dict *d, const size_t k)
+{
+	const struct starlark_Value kv = key(k);
+	const int err = Dict_delete(d, kv);
+	Value_release(kv);
+	if (m->pos[k] < 0) {
+		expect(err == STARLARK_ERRORCODE_KEY_NOT_FOUND);
+		return;
+	}
+
+	expect(err == 0);
+	m->order[m->pos[k]] = -1;
+	m->pos[k] = -1;
+	m->len -= 1;
+}
+
+// Checks that d holds exactly what m does, in the same order.
+static void check(const struct model *m, const struct starlark_Dict *d)
+{
+	expect(Dict_len(d) == m->len);
+
+	size_t pos = 0;
+	size_t i = 0;
+	struct starlark_Value k = VALUE_NONE;
+	struct starlark_Value v = VALUE_NONE;
+	while (Dict_next(d, &pos, &k, &v)) {
+		while (i < m->order_len && m->order[i] < 0) {
+			i += 1;
+		}
+		expect(i < m->order_len);
+
+		const struct starlark_Value want = key((size_t)m->order[i]);
+		expect(Value_equal(k, want));
+		Value_release(want);
+		expect(v.bits == Value_small_int(m->values[m->order[i]]).bits);
+		i += 1;
+	}
+	while (i < m->order_len && m->order[i] < 0) {
+		i += 1;
+	}
+	expect(i == m->order_len);
+
+	for (size_t j = 0; j < m->keys; j += 1) {
+		const struct starlark_Value kv = key(j);
+		struct starlark_Value got = VALUE_NONE;
+		const int err = Dict_get(d, kv, &got);
+		Value_release(kv);
+		if (m->pos[j] < 0) {
+			expect(err == STARLARK_ERRORCODE_KEY_NOT_FOUND);
+		} else {
+			expect(err == 0);
+			expect(got.bits == Value_small_int(m->values[j]).bits);
+		}
+	}
+}
+
+// Inserts, replaces and deletes keys at random, checking d against the model
+// every so often.
+static void churn(struct model *m, struct starlark_Dict *d, const size_t ops,
+		  const size_t every)
+{
+	for (size_t i = 0; i < ops; i += 1) {
+		const uint64_t r = next();
+		const size_t k = (size_t)(r >> 16) % m->keys;
+		if (r % 8 < 5) {
+			set(m, d, k, (int64_t)i);
+		} else {
+			delete(m, d, k);
+		}
+
+		if (i % every == 0) {
+			check(m, d);
+		}
+	}
+
+	check(m, d);
+}
+
+// A dict grows one key at a time from empty, keeping its order through every
+// resize.
+static void test_growth(void)
+{
+	struct starlark_Dict *d = Dict_create();
+	expect(d != NULL);
+	struct model m = { 0 };
+	model_init(&m, 80);
+
+	check(&m, d);
+	for (size_t k = 0; k < m.keys; k += 1) {
+		set(&m, d, k, (int64_t)k);
+		check(&m, d);
+	}
+
+	// Replacing a key keeps its place.
+	set(&m, d, 0, -1);
+	set(&m, d, 40, -2);
+	check(&m, d);
+
+	// Deleting a key and inserting it again moves it to the end.
+	delete(&m, d, 0);
+	delete(&m, d, 0);
+	delete(&m, d, 41);
+	set(&m, d, 0, -3);
+	check(&m, d);
+
+	Dict_destroy(d);
+	model_finish(&m);
+}
+
+static void test_churn(void)
+{
+	struct starlark_Dict *d = Dict_create();
+	expect(d != NULL);
+	struct model m = { 0 };
+	model_init(&m, 60);
+	churn(&m, d, 20000, 97);
+
+	// Emptying a dict and filling it again in another order.
+	for (size_t k = 0; k < m.keys; k += 1) {
+		delete(&m, d, k);
+	}
+	check(&m, d);
+	for (size_t k = m.keys; k > 0; k -= 1) {
+		set(&m, d, k - 1, (int64_t)k);
+	}
+	check(&m, d);
+
+	// A cleared dict has no keys, but can be used again.
+	Dict_clear(d);
+	model_finish(&m);
+	model_init(&m, 60);
+	check(&m, d);
+	churn(&m, d, 2000, 97);
+
+	Dict_destroy(d);
+	model_finish(&m);
+}
+
+static void test_reserve(void)
+{
+	struct starlark_Dict *d = Dict_create();
+	expect(d != NULL);
+	struct model m = { 0 };
+	model_init(&m, 80);
+
+	expect(Dict_reserve(d, 0) == 0);
+	check(&m, d);
+	expect(Dict_reserve(d, 50) == 0);
+	for (size_t k = 0; k < 50; k += 1) {
+		set(&m, d, k, (int64_t)k);
+	}
+	check(&m, d);
+
+	// Reserving room in a dict with deleted entries keeps every key.
+	for (size_t k = 0; k < 50; k += 2) {
+		delete(&m, d, k);
+	}
+	expect(Dict_reserve(d, 30) == 0);
+	check(&m, d);
+	for (size_t k = 50; k < 80; k += 1) {
+		set(&m, d, k, (int64_t)k);
+	}
+	check(&m, d);
+
+	Dict_destroy(d);
+	model_finish(&m);
+}
+
+// Returns whether a dict with len keys is about to outgrow its index, or just
+// has. The index switches to a swiss table at 256 slots, and its slots widen
+// at 256 and 65536.
+static bool near_resize(const size_t len)
+{
+	for (size_t bits = 3; bits < 20; bits += 1) {
+		const size_t slots = (size_t)1 << bits;
+		const size_t cap = bits < 8 ? slots / 3 * 2 : slots / 8 * 7;
+		if (len + 1 >= cap && len <= cap + 1) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Large dicts index their entries with a swiss table, whose slots get wider as
+// the dict grows.
+static void test_large(void)
+{
+	struct starlark_Dict *d = Dict_create();
+	expect(d != NULL);
+	struct model m = { 0 };
+	model_init(&m, 70000);
+
+	for (size_t k = 0; k < m.keys; k += 1) {
+		set(&m, d, k, (int64_t)k);
+		if (near_resize(m.len)) {
+			check(&m, d);
+		}
+	}
+	check(&m, d);
+
+	// Deleting most keys leaves the table full of deleted slots, which
+	// lookups have to probe past and inserts can reuse.
+	churn(&m, d, 300000, 30011);
+	for (size_t k = 0; k < m.keys; k += 1) {
+		if (k % 16 != 0) {
+			delete(&m, d, k);
+		}
+	}
+	check(&m, d);
+	churn(&m, d, 100000, 30011);
+
+	// Shrinking back down past where the index switched.
+	for (size_t k = 0; k < m.keys; k += 1) {
+		if (k >= 50) {
+			delete(&m, d, k);
+		}
+	}
+	check(&m, d);
+	for (size_t k = 0; k < 300; k += 1) {
+		set(&m, d, k, -(int64_t)k);
+	}
+	check(&m, d);
+
+	Dict_destroy(d);
+	model_finish(&m);
+
+	// A dict which reserves room first goes straight to a large index.
+	d = Dict_create();
+	expect(d != NULL);
+	model_init(&m, 5000);
+	expect(Dict_reserve(d, m.keys) == 0);
+	for (size_t k = 0; k < m.keys; k += 1) {
+		set(&m, d, k, (int64_t)k);
+	}
+	check(&m, d);
+
+	// And one which reserves room while it's small moves its keys over.
+	Dict_clear(d);
+	model_finish(&m);
+	model_init(&m, 5000);
+	for (size_t k = 0; k < 40; k += 1) {
+		set(&m, d, k, (int64_t)k);
+	}
+	expect(Dict_reserve(d, 4000) == 0);
+	check(&m, d);
+	churn(&m, d, 20000, 4999);
+
+	Dict_destroy(d);
+	model_finish(&m);
+}
+
+static void test_keys(void)
+{
+	struct starlark_Dict *d = Dict_create();
+	expect(d != NULL);
+
+	// Equal keys of different types are the same key.
+	expect(Dict_set(d, Value_small_int(3), Value_small_int(1)) == 0);
+	const struct starlark_Value three = Value_float(3.0);
+	expect(!Value_is_none(three));
+	struct starlark_Value got = VALUE_NONE;
+	expect(Dict_get(d, three, &got) == 0);
+	expect(got.bits == Value_small_int(1).bits);
+	expect(Dict_set(d, three, Value_small_int(2)) == 0);
+	expect(Dict_len(d) == 1);
+	expect(Dict_get(d, Value_small_int(3), &got) == 0);
+	expect(got.bits == Value_small_int(2).bits);
+	Value_release(three);
+
+	// A dict can't be a key.
+	struct starlark_Dict *other = Dict_create();
+	expect(other != NULL);
+	const struct starlark_Value unhashable =
+		Value_object((struct starlark_Object *)other);
+	expect(Dict_set(d, unhashable, VALUE_NONE) ==
+	       STARLARK_ERRORCODE_UNHASHABLE);
+	expect(Dict_get(d, unhashable, &got) == STARLARK_ERRORCODE_UNHASHABLE);
+	expect(Dict_delete(d, unhashable) == STARLARK_ERRORCODE_UNHASHABLE);
+	Dict_destroy(other);
+
+	// Nothing can be changed while the dict is being iterated over, but
+	// it can still be read.
+	Dict_start_iterating(d);
+	Dict_start_iterating(d);
+	expect(Dict_iterating(d));
+	expect(Dict_set(d, Value_small_int(4), VALUE_NONE) ==
+	       STARLARK_ERRORCODE_MUTATED_DURING_ITERATION);
+	expect(Dict_set(d, Value_small_int(3), VALUE_NONE) ==
+	       STARLARK_ERRORCODE_MUTATED_DURING_ITERATION);
+	expect(Dict_delete(d, Value_small_int(3)) ==
+	       STARLARK_ERRORCODE_MUTATED_DURING_ITERATION);
+	expect(Dict_get(d, Value_small_int(3), &got) == 0);
+	Dict_stop_iterating(d);
+	expect(Dict_iterating(d));
+	Dict_stop_iterating(d);
+	expect(!Dict_iterating(d));
+	expect(Dict_delete(d, Value_small_int(3)) == 0);
+	expect(Dict_len(d) == 0);
+
+	Dict_destroy(d);
+}
+
+int main(void)
+{
+	test_growth();
+	test_churn();
+	test_reserve();
+	test_large();
+	test_keys();
+	Int_trim();
+	return EXIT_SUCCESS;
+}
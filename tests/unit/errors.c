@@ -0,0 +1,143 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "starlark/common.h"
+#include "starlark/lex.h"
+#include "starlark/util.h"
+#include "util/io.h"
+#include "util/panic.h"
+#include "../lib.h"
+
+// Enough errors that the error arrays have to grow many times, moving the
+// starts and args along with the codes each time.
+#define ERRORS 5000
+
+// Returns what starlark_errors_dump prints for ctx.
+static char *errors_text(struct starlark_Context *ctx)
+{
+	FILE *f = tmpfile();
+	if (f == NULL) {
+		panic("couldn't create a temporary file");
+	}
+
+	starlark_errors_dump(ctx, f);
+	rewind(f);
+	size_t len = 0;
+	uint8_t *result = readfull(f, &len);
+	fclose(f);
+	if (result == NULL) {
+		panic("couldn't read the temporary file");
+	}
+
+	return (char *)result;
+}
+
+// Errors in the source don't stop lexing. They're recorded as they're found,
+// and only turned into text when they're printed.
+static void test_lex_errors(void)
+{
+	const size_t len = 2 * ERRORS;
+	uint8_t *src = malloc(len);
+	if (src == NULL) {
+		panic("out of memory");
+	}
+
+	for (size_t i = 0; i < ERRORS; i += 1) {
+		src[2 * i] = i % 2 == 0 ? '$' : '`';
+		src[2 * i + 1] = ' ';
+	}
+
+	struct starlark_Context ctx = { 0 };
+	struct starlark_Lexer l = { 0 };
+	expect(starlark_lex(&ctx, "many", len, src, &l) == 0);
+	expect(ctx.errs_len == ERRORS);
+	for (size_t i = 0; i < ERRORS; i += 1) {
+		expect(ctx.errs.codes[i] ==
+		       STARLARK_ERRORCODE_UNEXPECTED_SYMBOL);
+		expect(ctx.errs.starts[i] == 2 * i);
+		expect(ctx.errs.args[i].span.start == 2 * i);
+		expect(ctx.errs.args[i].span.len == 1);
+	}
+
+	char *text = errors_text(&ctx);
+	const char *want = "many:1:1: unexpected symbol: '$'\n"
+			   "many:1:3: unexpected symbol: '`'\n"
+			   "many:1:5: unexpected symbol: '$'\n";
+	expect(strncmp(text, want, strlen(want)) == 0);
+	expect(strstr(text, "many:1:9999: unexpected symbol: '`'\n") != NULL);
+	free(text);
+
+	starlark_Lexer_finish(&l);
+	starlark_Context_finish(&ctx);
+	free(src);
+}
+
+// Each kind of argument is rendered from the record, at the line and column
+// of its start.
+static void test_error_args(void)
+{
+	const char src[] = "a\n\"\\q\"\nb + c\n";
+	struct starlark_Context ctx = { 0 };
+	struct starlark_Lexer l = { 0 };
+	expect(starlark_lex(&ctx, "args", sizeof(src) - 1,
+			    (const uint8_t *)src, &l) == 0);
+	expect(ctx.errs_len == 0);
+
+	const struct starlark_Error errs[] = {
+		{
+			.code = STARLARK_ERRORCODE_INVALID_ESCAPE,
+			.start = 3,
+			.arg.c = 'q',
+		},
+		{
+			.code = STARLARK_ERRORCODE_UNSUPPORTED_BINARY,
+			.start = 9,
+			.arg.str = err_string(&ctx, "%s + %s", "int",
+					      "string"),
+		},
+		{
+			.code = STARLARK_ERRORCODE_UNEXPECTED_SYMBOL,
+			.start = 0,
+			.arg.span = { .start = 7, .len = 5 },
+		},
+	};
+	for (size_t i = 0; i < sizeof(errs) / sizeof(errs[0]); i += 1) {
+		expect(err_append(&ctx, errs[i]));
+	}
+	expect(ctx.errs_len == 3);
+
+	char *text = errors_text(&ctx);
+	expect(strcmp(text, "args:2:2: invalid escape: 'q'\n"
+			    "args:3:3: unsupported binary operation: "
+			    "int + string\n"
+			    "args:1:1: unexpected symbol: 'b + c'\n") == 0);
+	free(text);
+
+	starlark_Lexer_finish(&l);
+	starlark_Context_finish(&ctx);
+}
+
+// A file which can't be read is an I/O error of the interpreter, not an error
+// in the program, and errno says why.
+static void test_execfile_missing(void)
+{
+	struct starlark_Context ctx = { 0 };
+	errno = 0;
+	expect(starlark_execfile(&ctx, "does/not/exist.star") ==
+	       STARLARK_ERROR_IO);
+	expect(errno == ENOENT);
+	expect(ctx.errs_len == 0);
+	starlark_Context_finish(&ctx);
+}
+
+int main(void)
+{
+	test_lex_errors();
+	test_error_args();
+	test_execfile_missing();
+	return EXIT_SUCCESS;
+}
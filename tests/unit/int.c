@@ -0,0 +1,346 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "starlark/int.h"
+#include "util/panic.h"
+#include "../lib.h"
+
+// The Int_* functions are checked against __int128 arithmetic for operands
+// which fit in an int64_t, and against identities for operands which don't,
+// so that either bigint library can be checked the same way.
+
+#define PAIRS 20000
+
+__extension__ typedef __int128 i128;
+__extension__ typedef unsigned __int128 u128;
+
+static uint64_t state = 88172645463325252u;
+
+static uint64_t next(void)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+// Returns a random int64_t, with a random number of bits so that small
+// magnitudes come up as often as large ones.
+static int64_t random_i64(void)
+{
+	static const int64_t edges[] = {
+		0, 1, -1, INT60_MAX, INT60_MIN, INT32_MAX, INT32_MIN,
+		INT64_MAX, INT64_MAX - 1, INT64_MIN, INT64_MIN + 1,
+	};
+
+	const uint64_t r = next();
+	if (r % 8 == 0) {
+		return edges[(r >> 8) % (sizeof(edges) / sizeof(edges[0]))];
+	}
+
+	return (int64_t)next() >> (r >> 8) % 64;
+}
+
+static char *i128_str(i128 v, char *buf)
+{
+	char digits[48];
+	size_t len = 0;
+	const bool neg = v < 0;
+	u128 magnitude = neg ? -(u128)v : (u128)v;
+	do {
+		digits[len] = (char)('0' + magnitude % 10);
+		magnitude /= 10;
+		len += 1;
+	} while (magnitude != 0);
+
+	char *ptr = buf;
+	if (neg) {
+		*ptr++ = '-';
+	}
+	while (len != 0) {
+		len -= 1;
+		*ptr++ = digits[len];
+	}
+	*ptr = '\0';
+	return buf;
+}
+
+static struct starlark_Int *make(const int64_t v)
+{
+	struct starlark_Int *result = Int_create();
+	expect(result != NULL);
+	expect(Int_set_i64(result, v) == 0);
+	return result;
+}
+
+static void expect_value(const struct starlark_Int *i, const i128 want)
+{
+	char buf[48];
+	char *got = Int_to_str(i, 10);
+	expect(got != NULL);
+	expect(strcmp(got, i128_str(want, buf)) == 0);
+	free(got);
+}
+
+static int sign(const i128 v)
+{
+	return (v > 0) - (v < 0);
+}
+
+static size_t bit_len(const i128 v)
+{
+	u128 magnitude = v < 0 ? -(u128)v : (u128)v;
+	size_t result = 0;
+	while (magnitude != 0) {
+		magnitude >>= 1;
+		result += 1;
+	}
+
+	return result;
+}
+
+// Checks everything which only takes one int.
+static void check_one(const int64_t x)
+{
+	struct starlark_Int *a = make(x);
+	struct starlark_Int *c = Int_create();
+	expect(c != NULL);
+
+	expect_value(a, x);
+	expect(Int_sign(a) == sign(x));
+	expect(Int_is_zero(a) == (x == 0));
+	expect(Int_bit_len(a) == bit_len(x));
+	expect(Int_low_u64(a) == (x < 0 ? -(uint64_t)x : (uint64_t)x));
+
+	int64_t back = 0;
+	expect(Int_to_i64(a, &back) == (x != INT64_MIN));
+	expect(x == INT64_MIN || back == x);
+
+	struct starlark_Int *copy = Int_copy(a);
+	expect(copy != NULL && copy != a);
+	expect(Int_cmp(copy, a) == 0);
+	Int_destroy(copy);
+
+	expect(Int_neg(a, c) == 0);
+	expect_value(c, -(i128)x);
+	expect(Int_not(a, c) == 0);
+	expect_value(c, -(i128)x - 1);
+	expect(Int_add_u32(a, UINT32_MAX, c) == 0);
+	expect_value(c, (i128)x + UINT32_MAX);
+
+	for (uint32_t s = 0; s < 64; s += 1) {
+		expect(Int_lshift(a, s, c) == 0);
+		expect_value(c, (i128)x * ((i128)1 << s));
+	}
+	for (uint32_t s = 0; s < 70; s += 1) {
+		expect(Int_rshift(a, s, c) == 0);
+		expect_value(c, (i128)x >> s);
+	}
+
+	if (x > -(INT64_C(1) << 53) && x < INT64_C(1) << 53) {
+		expect(Int_eq_double(a, (double)x));
+		expect(!Int_eq_double(a, (double)x + 1));
+	}
+
+	Int_destroy(a);
+	Int_destroy(c);
+}
+
+static void check_pair(const int64_t x, const int64_t y)
+{
+	struct starlark_Int *a = make(x);
+	struct starlark_Int *b = make(y);
+	struct starlark_Int *c = Int_create();
+	struct starlark_Int *d = Int_create();
+	expect(c != NULL && d != NULL);
+	const i128 wx = x;
+	const i128 wy = y;
+
+	expect(Int_add(a, b, c) == 0);
+	expect_value(c, wx + wy);
+	expect(Int_sub(a, b, c) == 0);
+	expect_value(c, wx - wy);
+	expect(Int_mul(a, b, c) == 0);
+	expect_value(c, wx * wy);
+	expect(Int_and(a, b, c) == 0);
+	expect_value(c, wx & wy);
+	expect(Int_or(a, b, c) == 0);
+	expect_value(c, wx | wy);
+	expect(Int_xor(a, b, c) == 0);
+	expect_value(c, wx ^ wy);
+	expect(sign(Int_cmp(a, b)) == sign(wx - wy));
+
+	if (y != 0) {
+		// C rounds towards zero, and starlark towards negative
+		// infinity.
+		i128 q = wx / wy;
+		i128 r = wx % wy;
+		if (r != 0 && (r < 0) != (wy < 0)) {
+			q -= 1;
+			r += wy;
+		}
+
+		expect(Int_divmod(a, b, c, d) == 0);
+		expect_value(c, q);
+		expect_value(d, r);
+		expect(Int_divmod(a, b, c, NULL) == 0);
+		expect_value(c, q);
+		expect(Int_divmod(a, b, NULL, d) == 0);
+		expect_value(d, r);
+	}
+
+	Int_destroy(a);
+	Int_destroy(b);
+	Int_destroy(c);
+	Int_destroy(d);
+}
+
+// Returns a random int with up to digits decimal digits.
+static struct starlark_Int *random_big(const size_t digits)
+{
+	char buf[1024];
+	expect(digits + 2 <= sizeof(buf));
+	size_t len = 0;
+	if (next() % 2 == 0) {
+		buf[len++] = '-';
+	}
+
+	const size_t n = 1 + next() % digits;
+	for (size_t i = 0; i < n; i += 1) {
+		buf[len++] = (char)('0' + next() % 10);
+	}
+	buf[len] = '\0';
+
+	struct starlark_Int *result = NULL;
+	expect(Int_from_str(buf, 10, &result) == 0);
+	return result;
+}
+
+// Ints too big for __int128 are checked against each other instead.
+static void check_big(void)
+{
+	struct starlark_Int *c = Int_create();
+	struct starlark_Int *d = Int_create();
+	struct starlark_Int *e = Int_create();
+	struct starlark_Int *f = Int_create();
+	struct starlark_Int *zero = Int_create();
+	expect(c != NULL && d != NULL && e != NULL && f != NULL);
+	expect(zero != NULL);
+
+	for (size_t i = 0; i < 500; i += 1) {
+		struct starlark_Int *a = random_big(600);
+		struct starlark_Int *b = random_big(300);
+		if (Int_is_zero(b)) {
+			Int_destroy(b);
+			b = make(7);
+		}
+
+		// (a + b) - b == a, and (a * b) // b == a exactly.
+		expect(Int_add(a, b, c) == 0);
+		expect(Int_sub(c, b, d) == 0);
+		expect(Int_cmp(d, a) == 0);
+		expect(Int_mul(a, b, c) == 0);
+		expect(Int_divmod(c, b, d, e) == 0);
+		expect(Int_cmp(d, a) == 0);
+		expect(Int_is_zero(e));
+
+		// a == (a // b) * b + a % b, where a % b has b's sign and is
+		// smaller than it.
+		expect(Int_divmod(a, b, c, d) == 0);
+		expect(Int_is_zero(d) || Int_sign(d) == Int_sign(b));
+		expect(Int_mul(c, b, e) == 0);
+		expect(Int_add(e, d, c) == 0);
+		expect(Int_cmp(c, a) == 0);
+		if (Int_sign(b) > 0) {
+			expect(Int_cmp(d, b) < 0);
+		} else {
+			expect(Int_cmp(d, b) > 0);
+		}
+
+		// a ^ b ^ b == a, a & b == ~(~a | ~b), and a << n >> n == a.
+		expect(Int_xor(a, b, c) == 0);
+		expect(Int_xor(c, b, d) == 0);
+		expect(Int_cmp(d, a) == 0);
+		expect(Int_and(a, b, c) == 0);
+		expect(Int_not(a, d) == 0);
+		expect(Int_not(b, e) == 0);
+		expect(Int_or(d, e, f) == 0);
+		expect(Int_not(f, e) == 0);
+		expect(Int_cmp(c, e) == 0);
+		const uint32_t n = (uint32_t)(next() % 300);
+		expect(Int_lshift(a, n, c) == 0);
+		expect(Int_rshift(c, n, d) == 0);
+		expect(Int_cmp(d, a) == 0);
+
+		// a + ~a == -1, and a + -a == 0.
+		expect(Int_not(a, c) == 0);
+		expect(Int_add(a, c, d) == 0);
+		expect(Int_add_u32(d, 1, e) == 0);
+		expect(Int_is_zero(e));
+		expect(Int_neg(a, c) == 0);
+		expect(Int_add(a, c, d) == 0);
+		expect(Int_cmp(d, zero) == 0);
+
+		// Printing and parsing again gives the same int.
+		char *str = Int_to_str(a, 10);
+		expect(str != NULL);
+		struct starlark_Int *again = NULL;
+		expect(Int_from_str(str, 10, &again) == 0);
+		expect(Int_cmp(again, a) == 0);
+		Int_destroy(again);
+		free(str);
+
+		Int_destroy(a);
+		Int_destroy(b);
+	}
+
+	Int_destroy(c);
+	Int_destroy(d);
+	Int_destroy(e);
+	Int_destroy(f);
+	Int_destroy(zero);
+}
+
+static void check_pow(void)
+{
+	struct starlark_Int *c = Int_create();
+	expect(c != NULL);
+	const int64_t bases[] = { 0, 1, -1, 2, -3, 7 };
+	for (size_t i = 0; i < sizeof(bases) / sizeof(bases[0]); i += 1) {
+		struct starlark_Int *a = make(bases[i]);
+		i128 want = 1;
+		for (uint32_t e = 0; e < 40; e += 1) {
+			expect(Int_pow_u32(a, e, c) == 0);
+			expect_value(c, want);
+			want *= bases[i];
+		}
+		Int_destroy(a);
+	}
+	Int_destroy(c);
+}
+
+int main(void)
+{
+	for (size_t i = 0; i < PAIRS; i += 1) {
+		const int64_t x = random_i64();
+		check_one(x);
+		check_pair(x, random_i64());
+	}
+
+	check_big();
+	check_pow();
+
+	struct starlark_Int *invalid = NULL;
+	expect(Int_from_str("12a", 10, &invalid) ==
+	       STARLARK_ERRORCODE_INT_INVALID);
+	expect(Int_from_str("", 16, &invalid) ==
+	       STARLARK_ERRORCODE_INT_INVALID);
+	expect(Int_from_str("-", 10, &invalid) ==
+	       STARLARK_ERRORCODE_INT_INVALID);
+	expect(invalid == NULL);
+	Int_trim();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,117 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/lineno.h"
+#include "util/panic.h"
+#include "../lib.h"
+
+// Returns the number of lines in buf, counting the empty one after a final
+// newline.
+static size_t count_lines(const size_t buf_len, const uint8_t *buf)
+{
+	size_t result = 1;
+	for (size_t i = 0; i < buf_len; i += 1) {
+		result += buf[i] == '\n';
+	}
+
+	return result;
+}
+
+static void check(const size_t buf_len, const uint8_t *buf)
+{
+	struct LineIndex idx = { 0 };
+	expect(lineindex_init(&idx, buf_len, buf));
+
+	// Walk the buffer a byte at a time, going past the end too, where
+	// everything is on the last line. Columns count from 1 at the start of
+	// each line.
+	size_t want = 1;
+	size_t line_start = 0;
+	for (size_t pos = 0; pos <= buf_len + 2; pos += 1) {
+		if (pos != 0 && pos <= buf_len && buf[pos - 1] == '\n') {
+			want += 1;
+			line_start = pos;
+		}
+
+		size_t got_pos = 0;
+		expect(lineindex_lineno(&idx, pos, &got_pos) == want);
+		expect(got_pos == pos - line_start + 1);
+		expect(lineindex_lineno(&idx, pos, NULL) == want);
+		got_pos = 0;
+		expect(lineno(buf_len, buf, pos, &got_pos) == want);
+		expect(got_pos == pos - line_start + 1);
+	}
+
+	const size_t lines = count_lines(buf_len, buf);
+	size_t start = 0;
+	for (size_t line = 1; line <= lines; line += 1) {
+		const uint8_t *nl = memchr(&buf[start], '\n', buf_len - start);
+		const size_t want = nl == NULL ? buf_len - start :
+						 (size_t)(nl - &buf[start]);
+		const uint8_t *got = NULL;
+		expect(lineindex_line(&idx, line, &got) == want);
+		expect(got == &buf[start]);
+
+		char *copy = get_line(buf_len, buf, line);
+		expect(copy != NULL);
+		expect(strlen(copy) == want);
+		expect(memcmp(copy, &buf[start], want) == 0);
+		free(copy);
+		start += want + 1;
+	}
+
+	const uint8_t *got = NULL;
+	expect(lineindex_line(&idx, 0, &got) == 0);
+	expect(lineindex_line(&idx, lines + 1, &got) == 0);
+	lineindex_finish(&idx);
+}
+
+static void check_str(const char *s)
+{
+	check(strlen(s), (const uint8_t *)s);
+}
+
+// Fills buf with bytes of which about one in every is a newline, from a fixed
+// seed so that failures can be reproduced.
+static void fill(uint8_t *buf, const size_t len, const uint32_t every)
+{
+	uint32_t state = 12345;
+	for (size_t i = 0; i < len; i += 1) {
+		state = state * 1103515245 + 12345;
+		const uint32_t r = state >> 8;
+		buf[i] = r % every == 0 ? '\n' : (uint8_t)('a' + r % 26);
+	}
+}
+
+int main(void)
+{
+	check(0, (const uint8_t *)"");
+	check_str("\n");
+	check_str("abc");
+	check_str("a\nb");
+	check_str("a\nb\n");
+	check_str("\n\n\n");
+	check_str("x = 1\n\ndef f():\n    return x\n");
+
+	// Newlines at every offset within the eight byte words which are
+	// counted at once, lines longer than a word, and every length of the
+	// bytes left over after the last word.
+	const size_t len = 2000;
+	uint8_t *buf = malloc(len);
+	if (buf == NULL) {
+		panic("out of memory");
+	}
+
+	const uint32_t every[] = { 1, 2, 3, 7, 16, 33, 100, 1000 };
+	for (size_t i = 0; i < sizeof(every) / sizeof(every[0]); i += 1) {
+		fill(buf, len, every[i]);
+		for (size_t n = len - 16; n <= len; n += 1) {
+			check(n, buf);
+		}
+	}
+
+	free(buf);
+	return EXIT_SUCCESS;
+}
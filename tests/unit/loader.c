@@ -0,0 +1,121 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/io.h"
+#include "util/loader.h"
+#include "util/panic.h"
+#include "../lib.h"
+
+// Enough copies of one file to fill the ring several times over, so that
+// opens have to wait for room.
+#define COPIES 300
+
+struct loaded {
+	size_t paths_len;
+	const char *const *paths;
+	// How many times each path has been reported.
+	int *reports;
+	int *errs;
+	struct MappedFile *files;
+};
+
+static void file_loaded(void *data, const size_t i, const int err,
+			struct MappedFile file)
+{
+	struct loaded *l = data;
+	expect(i < l->paths_len);
+	l->reports[i] += 1;
+	l->errs[i] = err;
+	l->files[i] = file;
+}
+
+// Returns what reading path with stdio gives, for comparing the loader to.
+static uint8_t *read_path(const char *path, size_t *len)
+{
+	errno = 0;
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) {
+		panic("couldn't open file '%s': %s", path, strerror(errno));
+	}
+
+	uint8_t *result = readfull(f, len);
+	fclose(f);
+	if (result == NULL) {
+		panic("couldn't read file '%s'", path);
+	}
+
+	return result;
+}
+
+static void expect_contents(const struct loaded *l, const size_t i)
+{
+	size_t len = 0;
+	uint8_t *want = read_path(l->paths[i], &len);
+	expect(l->errs[i] == 0);
+	expect(l->files[i].len == len);
+	expect(len == 0 || memcmp(l->files[i].ptr, want, len) == 0);
+	free(want);
+}
+
+// Takes an empty file and one which isn't.
+int main(int argc, char **argv)
+{
+	if (argc != 3) {
+		panic("usage: %s EMPTY_FILE FILE", argv[0]);
+	}
+
+	const char *paths[COPIES + 3] = {
+		argv[1],
+		"this file doesn't exist",
+#if defined(__linux__)
+		// Its size is reported as 0, but it isn't empty.
+		"/proc/version",
+#else
+		argv[2],
+#endif
+	};
+	for (size_t i = 3; i < COPIES + 3; i += 1) {
+		paths[i] = argv[2];
+	}
+
+	const size_t paths_len = sizeof(paths) / sizeof(paths[0]);
+	struct loaded l = {
+		.paths_len = paths_len,
+		.paths = paths,
+		.reports = calloc(paths_len, sizeof(l.reports[0])),
+		.errs = calloc(paths_len, sizeof(l.errs[0])),
+		.files = calloc(paths_len, sizeof(l.files[0])),
+	};
+	if (l.reports == NULL || l.errs == NULL || l.files == NULL) {
+		panic("out of memory");
+	}
+
+	expect(loadfiles(paths_len, paths, file_loaded, &l));
+	for (size_t i = 0; i < paths_len; i += 1) {
+		expect(l.reports[i] == 1);
+	}
+
+	expect(l.errs[0] == 0);
+	expect(l.files[0].len == 0);
+	expect(l.errs[1] == ENOENT);
+	expect(l.files[1].len == 0);
+	expect_contents(&l, 2);
+	expect(l.files[2].len != 0);
+	for (size_t i = 3; i < paths_len; i += 1) {
+		expect_contents(&l, i);
+	}
+
+	for (size_t i = 0; i < paths_len; i += 1) {
+		mapfile_finish(&l.files[i]);
+	}
+
+	free(l.reports);
+	free(l.errs);
+	free(l.files);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,162 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "starlark/int.h"
+#include "util/panic.h"
+#include "../lib.h"
+
+// Ints are converted to and from text in pieces, splitting big numbers in half
+// around powers of the base. These check both directions against a digit at a
+// time conversion, for numbers on either side of every size where the pieces
+// change.
+
+// The most digits any number checked has.
+#define MAX_DIGITS 20000
+
+static const char digits[] = "0123456789abcdef";
+
+static uint64_t state = 0x9e3779b97f4a7c15u;
+
+static uint64_t next(void)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+// Returns the int the first len digits of str stand for in base, multiplying
+// in one digit at a time.
+static struct starlark_Int *slow_from_str(const char *str, const size_t len,
+					  const int base)
+{
+	struct starlark_Int *result = Int_create();
+	struct starlark_Int *scale = Int_create();
+	struct starlark_Int *tmp = Int_create();
+	expect(result != NULL && scale != NULL && tmp != NULL);
+	Int_set_u32(scale, (uint32_t)base);
+	for (size_t i = 0; i < len; i += 1) {
+		const char *digit = memchr(digits, str[i], (size_t)base);
+		expect(digit != NULL);
+		expect(Int_mul(result, scale, tmp) == 0);
+		expect(Int_add_u32(tmp, (uint32_t)(digit - digits), result) ==
+		       0);
+	}
+
+	Int_destroy(scale);
+	Int_destroy(tmp);
+	return result;
+}
+
+static const char *prefix(const int base)
+{
+	switch (base) {
+	case 2:
+		return "0b";
+	case 8:
+		return "0o";
+	case 16:
+		return "0x";
+	default:
+		return "";
+	}
+}
+
+// Converts the number written as str, which has len digits in base and may
+// start with zeros, both ways.
+static void check(char *str, const size_t len, const int base, const bool neg)
+{
+	str[len] = '\0';
+	struct starlark_Int *want = slow_from_str(str, len, base);
+	struct starlark_Int *tmp = Int_create();
+	expect(tmp != NULL);
+	if (neg) {
+		expect(Int_neg(want, tmp) == 0);
+		Int_destroy(want);
+		want = tmp;
+		tmp = Int_create();
+		expect(tmp != NULL);
+	}
+
+	char *input = malloc(len + 2);
+	expect(input != NULL);
+	input[0] = '-';
+	memcpy(&input[1], str, len + 1);
+	struct starlark_Int *got = NULL;
+	expect(Int_from_str(neg ? input : &input[1], base, &got) == 0);
+	expect(Int_cmp(got, want) == 0);
+
+	// The output has no leading zeros, and 0 is never negative.
+	size_t start = 0;
+	while (start + 1 < len && str[start] == '0') {
+		start += 1;
+	}
+	const bool zero = str[start] == '0';
+	const char *p = prefix(base);
+	const size_t want_len = (neg && !zero) + strlen(p) + len - start;
+	char *out = Int_to_str(want, base);
+	expect(out != NULL);
+	expect(strlen(out) == want_len);
+	const char *ptr = out;
+	if (neg && !zero) {
+		expect(*ptr == '-');
+		ptr += 1;
+	}
+	expect(strncmp(ptr, p, strlen(p)) == 0);
+	ptr += strlen(p);
+	// Only bases past 36 have different digits for each case.
+	expect(strcasecmp(ptr, &str[start]) == 0);
+
+	free(out);
+	free(input);
+	Int_destroy(got);
+	Int_destroy(want);
+	Int_destroy(tmp);
+}
+
+int main(void)
+{
+	static const int bases[] = { 2, 8, 10, 16 };
+	static const size_t lens[] = {
+		1, 2, 9, 18, 19, 20, 63, 64, 65, 100, 300, 1000, 1023, 1024,
+		1025, 3000, 7000, MAX_DIGITS,
+	};
+
+	char *str = malloc(MAX_DIGITS + 1);
+	expect(str != NULL);
+	for (size_t b = 0; b < sizeof(bases) / sizeof(bases[0]); b += 1) {
+		const int base = bases[b];
+		for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l += 1) {
+			const size_t len = lens[l];
+
+			// Random digits, which sometimes start with zeros.
+			for (size_t i = 0; i < len; i += 1) {
+				str[i] = digits[next() % (uint64_t)base];
+			}
+			check(str, len, base, false);
+			check(str, len, base, true);
+
+			// base ** len - 1, the biggest number with len digits.
+			memset(str, digits[base - 1], len);
+			check(str, len, base, next() % 2 == 0);
+
+			// base ** (len - 1), the smallest number with len
+			// digits.
+			memset(str, '0', len);
+			str[0] = '1';
+			check(str, len, base, next() % 2 == 0);
+
+			// All zeros, which is written as a single 0.
+			memset(str, '0', len);
+			check(str, len, base, true);
+		}
+	}
+
+	free(str);
+	Int_trim();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,234 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if CLARK_HAVE_PTHREADS
+#include <pthread.h>
+#endif // CLARK_HAVE_PTHREADS
+
+#include "starlark/common.h"
+#include "starlark/dict.h"
+#include "starlark/int.h"
+#include "starlark/lex.h"
+#include "starlark/parse.h"
+#include "starlark/scratch.h"
+#include "util/panic.h"
+#include "../lib.h"
+
+// Returns everything written to f since it was last rewound, and rewinds it.
+static char *take_text(FILE *f)
+{
+	fflush(f);
+	const long len = ftell(f);
+	rewind(f);
+	char *result = calloc((size_t)len + 1, 1);
+	if (result == NULL) {
+		panic("out of memory");
+	}
+
+	expect(fread(result, 1, (size_t)len, f) == (size_t)len);
+	rewind(f);
+	return result;
+}
+
+static int exec_str(struct starlark_Context *ctx, const char *name,
+		    const char *src)
+{
+	return starlark_exec(ctx, name, strlen(src), (const uint8_t *)src);
+}
+
+// A context which is reset runs the next program as though it were new, but
+// keeps the memory it had already allocated.
+static void test_context(void)
+{
+	FILE *out = tmpfile();
+	if (out == NULL) {
+		panic("couldn't create a temporary file");
+	}
+
+	struct starlark_Context ctx = { .out = out };
+	const int err = exec_str(&ctx, "first",
+				 "a = 1\n"
+				 "b = 'two'\n"
+				 "print(a)\n"
+				 "c = a + b\n");
+	expect(ctx.errs_len == 1);
+	expect(err > 0 && err == (int)ctx.errs.codes[0]);
+	expect(ctx.modules_len == 1);
+	expect(ctx.globals != NULL && Dict_len(ctx.globals) != 0);
+	char *text = take_text(out);
+	expect(strcmp(text, "1\n") == 0);
+	free(text);
+
+	const enum starlark_ErrorCode *codes = ctx.errs.codes;
+	const size_t errs_cap = ctx.errs_cap;
+	const char *strings = ctx.strpool.buffer.ptr;
+	const size_t strings_cap = ctx.strpool.buffer.cap;
+	const int64_t *hashes = ctx.strpool.table.hashes;
+	expect(codes != NULL && strings != NULL && hashes != NULL);
+
+	// The program has been compiled, so what it was read with is already
+	// empty, but still holds its memory.
+	const struct starlark_Scratch *scratch = ctx.scratch;
+	expect(scratch != NULL);
+	expect(scratch->lexer.toks_len == 0);
+	expect(scratch->parser.ast_len == 0);
+	expect(scratch->resolver.functions_len == 0);
+	expect(scratch->compiler.len == 1);
+	const enum starlark_TokenTag *tokens = scratch->lexer.toks.tags;
+	const enum starlark_AstTag *nodes = scratch->parser.ast.tags;
+	const struct function_arrays *arrays = scratch->compiler.arrays;
+	expect(tokens != NULL && nodes != NULL && arrays != NULL);
+
+	starlark_Context_reset(&ctx);
+	expect(ctx.err == 0);
+	expect(ctx.errs_len == 0);
+	expect(ctx.modules_len == 0);
+	expect(Dict_len(ctx.globals) == 0);
+	expect(ctx.strpool.table.len == 0);
+	expect(ctx.errs.codes == codes);
+	expect(ctx.errs_cap == errs_cap);
+	expect(ctx.strpool.buffer.ptr == strings);
+	expect(ctx.strpool.buffer.cap == strings_cap);
+	expect(ctx.strpool.table.hashes == hashes);
+	expect(ctx.out == out);
+	expect(ctx.scratch == scratch);
+
+	// Nothing from the first program is visible to the second, and its
+	// errors aren't reported again.
+	expect(exec_str(&ctx, "second",
+			"d = 4\n"
+			"print(d)\n") == 0);
+	expect(ctx.errs_len == 0);
+	expect(Dict_len(ctx.globals) == 1);
+	text = take_text(out);
+	expect(strcmp(text, "4\n") == 0);
+	free(text);
+	expect(ctx.scratch == scratch);
+	expect(scratch->lexer.toks.tags == tokens);
+	expect(scratch->parser.ast.tags == nodes);
+	expect(scratch->compiler.arrays == arrays);
+	expect(scratch->compiler.len == 1);
+
+	starlark_Context_reset(&ctx);
+	expect(exec_str(&ctx, "third", "print(a)\n") != 0);
+	expect(ctx.errs_len == 1);
+	expect(ctx.errs.codes == codes);
+	starlark_errors_dump(&ctx, out);
+	text = take_text(out);
+	expect(strncmp(text, "third:1:7: ", strlen("third:1:7: ")) == 0);
+	free(text);
+
+	starlark_Context_finish(&ctx);
+	expect(ctx.errs.codes == NULL);
+	expect(ctx.globals == NULL);
+	expect(ctx.scratch == NULL);
+	expect(ctx.strpool.buffer.ptr == NULL);
+	fclose(out);
+}
+
+#if CLARK_HAVE_PTHREADS
+// Finishes ctx on a thread other than the one which ran it, while this thread
+// has ints of its own in use.
+static void *finish_thread(void *data)
+{
+	struct starlark_Context *ctx = data;
+	struct starlark_Int *mine = Int_create();
+	expect(mine != NULL);
+	expect(Int_set_i64(mine, INT64_MAX) == 0);
+
+	starlark_Context_reset(ctx);
+	starlark_Context_finish(ctx);
+
+	int64_t got = 0;
+	expect(Int_to_i64(mine, &got) && got == INT64_MAX);
+	Int_destroy(mine);
+	Int_trim();
+	return NULL;
+}
+
+// The ints a program makes are freed wherever its context is finished, which
+// mustn't release the memory of ints still in use on that thread.
+static void test_other_thread(void)
+{
+	struct starlark_Context ctx = { 0 };
+	expect(exec_str(&ctx, "ints",
+			"n = 123456789012345678901234567890\n"
+			"a = [n + i for i in range(1000)]\n") == 0);
+
+	pthread_t thread;
+	expect(pthread_create(&thread, NULL, finish_thread, &ctx) == 0);
+	expect(pthread_join(thread, NULL) == 0);
+
+	struct starlark_Context again = { 0 };
+	expect(exec_str(&again, "again",
+			"n = 123456789012345678901234567890\n"
+			"a = [n * i for i in range(1000)]\n") == 0);
+	starlark_Context_finish(&again);
+}
+#endif // CLARK_HAVE_PTHREADS
+
+// The lexer and parser keep their arrays when they're reset, and parse the
+// next source into them.
+static void test_lexer_parser(void)
+{
+	const char big[] = "def f(x, y):\n"
+			   "    return [x + y, x * y, {'k': x}]\n"
+			   "z = f(1, 2)\n";
+	const char small[] = "w = 3\n";
+
+	struct starlark_Context ctx = { 0 };
+	struct starlark_Lexer l = { 0 };
+	struct starlark_Parser p = { 0 };
+	expect(starlark_lex(&ctx, "big", sizeof(big) - 1,
+			    (const uint8_t *)big, &l) == 0);
+	expect(starlark_parse_tokens(&ctx, &l, &p) == 0);
+	expect(ctx.errs_len == 0);
+	const size_t big_toks = l.toks_len;
+	const size_t big_ast = p.ast_len;
+	expect(big_toks != 0 && big_ast != 0);
+	const void *tags = l.toks.tags;
+	const void *nodes = p.ast.tags;
+
+	starlark_Parser_reset(&p);
+	starlark_Lexer_reset(&l);
+	starlark_Context_reset(&ctx);
+	expect(l.toks_len == 0);
+	expect(p.ast_len == 0);
+
+	expect(starlark_lex(&ctx, "small", sizeof(small) - 1,
+			    (const uint8_t *)small, &l) == 0);
+	expect(starlark_parse_tokens(&ctx, &l, &p) == 0);
+	expect(ctx.errs_len == 0);
+	expect(l.toks_len != 0 && l.toks_len < big_toks);
+	expect(p.ast_len != 0 && p.ast_len < big_ast);
+	expect((const void *)l.toks.tags == tags);
+	expect((const void *)p.ast.tags == nodes);
+
+	// Parsing the same source again gives the same tree.
+	starlark_Parser_reset(&p);
+	starlark_Lexer_reset(&l);
+	starlark_Context_reset(&ctx);
+	expect(starlark_lex(&ctx, "big", sizeof(big) - 1,
+			    (const uint8_t *)big, &l) == 0);
+	expect(starlark_parse_tokens(&ctx, &l, &p) == 0);
+	expect(l.toks_len == big_toks);
+	expect(p.ast_len == big_ast);
+
+	starlark_Parser_finish(&p);
+	starlark_Lexer_finish(&l);
+	starlark_Context_finish(&ctx);
+}
+
+int main(void)
+{
+	test_context();
+	test_lexer_parser();
+#if CLARK_HAVE_PTHREADS
+	test_other_thread();
+#endif // CLARK_HAVE_PTHREADS
+	return EXIT_SUCCESS;
+}
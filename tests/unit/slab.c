@@ -0,0 +1,160 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if CLARK_HAVE_PTHREADS
+#include <pthread.h>
+#endif // CLARK_HAVE_PTHREADS
+
+#include "util/slab.h"
+#include "util/panic.h"
+#include "../lib.h"
+
+// More objects of the smallest size than fit in one chunk.
+#define OBJECTS (2 * SLAB_CHUNK_SIZE / SLAB_MIN_SIZE)
+
+// An object freed through another slab goes back to the slab it came from,
+// and doesn't count against the one it was freed through.
+static void test_remote(void)
+{
+	struct Slab a = { .tag = 1 };
+	struct Slab b = { .tag = 2 };
+	void *x = slab_alloc(&a, 32);
+	void *y = slab_alloc(&a, 32);
+	void *z = slab_alloc(&b, 32);
+	expect(x != NULL && y != NULL && z != NULL);
+
+	slab_free(&b, x, 32);
+	expect(a.used == 2);
+	expect(b.used == 1);
+
+	// z is still in use, so trimming b mustn't release it.
+	slab_trim(&b);
+	expect(b.chunks != NULL);
+	expect(slab_alloc(&b, 32) != x);
+	slab_free(&b, z, 32);
+
+	// a takes x back once it has no other free objects of its size.
+	expect(slab_alloc(&a, 32) == x);
+	expect(a.used == 2);
+
+	slab_free(&a, x, 32);
+	slab_free(&b, y, 32);
+	slab_trim(&a);
+	expect(a.used == 0);
+	expect(a.chunks == NULL);
+	slab_finish(&b);
+}
+
+#if CLARK_HAVE_PTHREADS
+struct worker {
+	void **objects;
+	size_t len;
+};
+
+// Frees every object given through a slab of its own, while the thread which
+// allocated them keeps using their slab.
+static void *worker_run(void *data)
+{
+	struct worker *w = data;
+	struct Slab mine = { .tag = 2 };
+	void *kept = slab_alloc(&mine, 64);
+	expect(kept != NULL);
+	for (size_t i = 0; i < w->len; i += 1) {
+		slab_free(&mine, w->objects[i], 64);
+	}
+
+	// Only kept came from this slab, so it's still in use.
+	expect(mine.used == 1);
+	slab_trim(&mine);
+	expect(mine.chunks != NULL);
+	memset(kept, 0xff, 64);
+	slab_finish(&mine);
+	return NULL;
+}
+
+static void test_threads(void)
+{
+	struct Slab s = { .tag = 1 };
+	void **given = calloc(OBJECTS, sizeof(given[0]));
+	expect(given != NULL);
+	for (size_t i = 0; i < OBJECTS; i += 1) {
+		given[i] = slab_alloc(&s, 64);
+		expect(given[i] != NULL);
+	}
+
+	struct worker w = { .objects = given, .len = OBJECTS };
+	pthread_t thread;
+	expect(pthread_create(&thread, NULL, worker_run, &w) == 0);
+	for (size_t i = 0; i < OBJECTS; i += 1) {
+		void *x = slab_alloc(&s, 64);
+		expect(x != NULL);
+		slab_free(&s, x, 64);
+	}
+	expect(pthread_join(thread, NULL) == 0);
+
+	slab_trim(&s);
+	expect(s.used == 0);
+	expect(s.chunks == NULL);
+	free(given);
+}
+#endif // CLARK_HAVE_PTHREADS
+
+int main(void)
+{
+	struct Slab s = { .tag = 7 };
+	void **objects = calloc(OBJECTS, sizeof(objects[0]));
+	if (objects == NULL) {
+		panic("out of memory");
+	}
+
+	for (size_t i = 0; i < OBJECTS; i += 1) {
+		objects[i] = slab_alloc(&s, SLAB_MIN_SIZE);
+		expect(objects[i] != NULL);
+		expect((uintptr_t)objects[i] % 16 == 0);
+		expect(slab_tag(objects[i]) == 7);
+		memset(objects[i], 0xff, SLAB_MIN_SIZE);
+	}
+	expect(s.used == OBJECTS);
+
+	// A freed object is the next one handed out for its size class.
+	slab_free(&s, objects[3], SLAB_MIN_SIZE);
+	expect(slab_alloc(&s, SLAB_MIN_SIZE - 1) == objects[3]);
+
+	// The largest size class has its own chunks.
+	void *big = slab_alloc(&s, SLAB_MAX_SIZE);
+	expect(big != NULL);
+	expect(slab_tag(big) == 7);
+	expect(s.used == OBJECTS + 1);
+
+	// Nothing is released while any object is still in use.
+	for (size_t i = 0; i < OBJECTS; i += 1) {
+		slab_free(&s, objects[i], SLAB_MIN_SIZE);
+	}
+	slab_trim(&s);
+	expect(s.used == 1);
+	expect(s.chunks != NULL);
+
+	slab_free(&s, big, SLAB_MAX_SIZE);
+	slab_trim(&s);
+	expect(s.used == 0);
+	expect(s.chunks == NULL);
+	expect(s.tag == 7);
+
+	// The slab can be used again afterwards.
+	void *again = slab_alloc(&s, 100);
+	expect(again != NULL);
+	expect(slab_tag(again) == 7);
+	slab_finish(&s);
+	expect(s.chunks == NULL);
+
+	test_remote();
+#if CLARK_HAVE_PTHREADS
+	test_threads();
+#endif // CLARK_HAVE_PTHREADS
+
+	free(objects);
+	return EXIT_SUCCESS;
+}
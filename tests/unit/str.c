@@ -0,0 +1,388 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "starlark/str.h"
+#include "starlark/value.h"
+#include "util/panic.h"
+#include "../lib.h"
+
+// How many times a string is appended to, which is enough for its buffer to
+// have grown many times over.
+#define APPENDS 10000
+
+static struct starlark_Str *create(const char *bytes)
+{
+	struct starlark_Str *result = Str_create(strlen(bytes), bytes);
+	expect(result != NULL);
+	return result;
+}
+
+static uint32_t refs(const struct starlark_Str *s)
+{
+	return ((const struct starlark_Object *)s)->refs;
+}
+
+static void release(struct starlark_Str *s)
+{
+	Value_release(Value_object((struct starlark_Object *)s));
+}
+
+static void expect_bytes(const struct starlark_Str *s, const size_t len,
+			 const char *want)
+{
+	expect(Str_len(s) == len);
+	expect(len == 0 || memcmp(Str_data(s), want, len) == 0);
+}
+
+// Returns whether s's bytes are inside parent's.
+static bool shares(const struct starlark_Str *s,
+		   const struct starlark_Str *parent)
+{
+	const char *start = Str_data(parent);
+	return Str_data(s) >= start && Str_data(s) < start + Str_len(parent);
+}
+
+// The FNV-1a hash of str, a byte at a time.
+static uint64_t slow_hash(const size_t len, const char *str)
+{
+	uint64_t result = UINT64_C(14695981039346656037);
+	for (size_t i = 0; i < len; i += 1) {
+		result ^= (uint8_t)str[i];
+		result *= UINT64_C(1099511628211);
+	}
+
+	return result;
+}
+
+// Strings keep their bytes in the same allocation as themselves, however long
+// they are, and remember what they've worked out about them.
+static void test_create(void)
+{
+	char buf[300];
+	for (size_t i = 0; i < sizeof(buf); i += 1) {
+		buf[i] = (char)('a' + i % 26);
+	}
+
+	ptrdiff_t offset = 0;
+	for (size_t len = 0; len <= sizeof(buf); len += 1) {
+		struct starlark_Str *s = Str_create(len, buf);
+		expect(s != NULL);
+		expect(refs(s) == 1);
+		expect(Str_len(s) == len);
+		expect(len == 0 || memcmp(Str_data(s), buf, len) == 0);
+
+		// Short strings fit in the fixed size part, and longer ones
+		// continue past it.
+		const ptrdiff_t here = Str_data(s) - (const char *)s;
+		expect(len == 0 || here == offset);
+		offset = here;
+
+		expect(Str_is_ascii(s));
+		expect(Str_codepoints(s) == len);
+		expect(Str_hash(s) == slow_hash(len, buf));
+		expect(Str_hash(s) == slow_hash(len, buf));
+		release(s);
+	}
+
+	// A string of exactly STR_SMALL_LEN bytes, and one more.
+	struct starlark_Str *small = Str_create(STR_SMALL_LEN, buf);
+	struct starlark_Str *big = Str_create(STR_SMALL_LEN + 1, buf);
+	expect(small != NULL && big != NULL);
+	expect(!Str_equal(small, big));
+	release(small);
+	release(big);
+}
+
+static void test_utf8(void)
+{
+	static const struct {
+		const char *bytes;
+		bool ascii;
+		size_t codepoints;
+	} tests[] = {
+		{ "", true, 0 },
+		{ "plain", true, 5 },
+		{ "\x7f", true, 1 },
+		{ "caf\xc3\xa9", false, 4 },
+		{ "\xe2\x82\xac 5", false, 3 },
+		{ "\xf0\x9f\x98\x80", false, 1 },
+		// Each byte which isn't part of a valid sequence counts as
+		// one codepoint: a stray continuation byte, a sequence which
+		// is cut short, and a byte which never starts one.
+		{ "\x80", false, 1 },
+		{ "a\x80\x80z", false, 4 },
+		{ "\xe2\x82", false, 2 },
+		{ "\xe2\x82x", false, 3 },
+		{ "\xff\xfe", false, 2 },
+		{ "\xc0\xaf", false, 2 },
+	};
+
+	for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i += 1) {
+		struct starlark_Str *s = create(tests[i].bytes);
+		expect(Str_is_ascii(s) == tests[i].ascii);
+		expect(Str_codepoints(s) == tests[i].codepoints);
+		// Asking again gives the cached answer.
+		expect(Str_is_ascii(s) == tests[i].ascii);
+		expect(Str_codepoints(s) == tests[i].codepoints);
+		release(s);
+	}
+}
+
+static void test_equal(void)
+{
+	struct starlark_Str *a = create("the same bytes");
+	struct starlark_Str *b = create("the same bytes");
+	struct starlark_Str *c = create("the same bytez");
+	expect(Str_equal(a, a));
+	expect(Str_equal(a, b));
+	expect(!Str_equal(a, c));
+
+	// Comparing strings whose hashes are known is the same.
+	expect(Str_hash(a) == Str_hash(b));
+	expect(Str_hash(a) != Str_hash(c));
+	expect(Str_equal(a, b));
+	expect(!Str_equal(a, c));
+	release(a);
+	release(b);
+	release(c);
+}
+
+// Long substrings are views of their parent's bytes. Short ones, and ones much
+// shorter than their parent, are copies.
+static void test_slice(void)
+{
+	char buf[1000];
+	for (size_t i = 0; i < sizeof(buf); i += 1) {
+		buf[i] = (char)('A' + i % 26);
+	}
+
+	struct starlark_Str *parent = Str_create(sizeof(buf), buf);
+	expect(parent != NULL);
+
+	// The whole string is the string itself.
+	struct starlark_Str *whole = Str_slice(parent, 0, sizeof(buf));
+	expect(whole == parent);
+	expect(refs(parent) == 2);
+	release(whole);
+
+	static const struct {
+		size_t start;
+		size_t len;
+		bool view;
+	} tests[] = {
+		{ 0, 0, false },
+		{ 10, STR_SMALL_LEN, false },
+		{ 10, STR_SMALL_LEN + 1, false },
+		{ 999, 1, false },
+		// A quarter of the parent is the shortest view.
+		{ 100, sizeof(buf) / 4 - 1, false },
+		{ 100, sizeof(buf) / 4, true },
+		{ 0, sizeof(buf) - 1, true },
+		{ 1, sizeof(buf) - 1, true },
+		{ 500, 500, true },
+	};
+
+	for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i += 1) {
+		const size_t start = tests[i].start;
+		const size_t len = tests[i].len;
+		struct starlark_Str *s = Str_slice(parent, start, len);
+		expect(s != NULL && s != parent);
+		expect(refs(s) == 1);
+		expect_bytes(s, len, &buf[start]);
+		expect(Str_hash(s) == slow_hash(len, &buf[start]));
+		expect(Str_is_ascii(s));
+		expect(Str_codepoints(s) == len);
+		if (tests[i].view) {
+			expect(Str_data(s) == Str_data(parent) + start);
+			expect(refs(parent) == 2);
+		} else {
+			expect(len == 0 || !shares(s, parent));
+			expect(refs(parent) == 1);
+		}
+
+		release(s);
+		expect(refs(parent) == 1);
+	}
+
+	// A view of a view is a view of the original string, so a chain of
+	// them only keeps the one string alive.
+	struct starlark_Str *view = Str_slice(parent, 100, 800);
+	struct starlark_Str *inner = Str_slice(view, 100, 400);
+	expect(view != NULL && inner != NULL);
+	expect(Str_data(inner) == Str_data(parent) + 200);
+	expect(refs(parent) == 3);
+	expect(refs(view) == 1);
+	expect_bytes(inner, 400, &buf[200]);
+
+	// Views keep their parent alive after everything else lets it go.
+	release(parent);
+	release(view);
+	expect_bytes(inner, 400, &buf[200]);
+	struct starlark_Str *copy = Str_create(400, &buf[200]);
+	expect(copy != NULL);
+	expect(Str_equal(inner, copy));
+	expect(Str_hash(inner) == Str_hash(copy));
+	release(copy);
+	release(inner);
+}
+
+// Whether a view is ASCII is worked out from its own bytes, unless its parent
+// is already known to be ASCII.
+static void test_slice_utf8(void)
+{
+	char buf[64];
+	memset(buf, 'a', sizeof(buf));
+	memcpy(&buf[60], "\xc3\xa9", 2);
+
+	struct starlark_Str *s = Str_create(sizeof(buf), buf);
+	expect(s != NULL);
+	expect(!Str_is_ascii(s));
+	expect(Str_codepoints(s) == 63);
+
+	struct starlark_Str *ascii = Str_slice(s, 0, 40);
+	struct starlark_Str *utf8 = Str_slice(s, 30, 32);
+	struct starlark_Str *cut = Str_slice(s, 30, 31);
+	expect(ascii != NULL && utf8 != NULL && cut != NULL);
+	expect(Str_is_ascii(ascii));
+	expect(Str_codepoints(ascii) == 40);
+	expect(!Str_is_ascii(utf8));
+	expect(Str_codepoints(utf8) == 31);
+	expect(!Str_is_ascii(cut));
+	expect(Str_codepoints(cut) == 31);
+
+	release(ascii);
+	release(utf8);
+	release(cut);
+	release(s);
+}
+
+// A string nothing else refers to is appended to in place, and only moves
+// when its buffer is full, which happens less and less often as it grows.
+static void test_append(void)
+{
+	struct starlark_Str *piece = create("xy");
+	struct starlark_Str *s = create("start");
+	char *want = malloc(5 + 2 * APPENDS + 2);
+	expect(want != NULL);
+	memcpy(want, "start", 5);
+	size_t len = 5;
+
+	size_t moves = 0;
+	const char *bytes = NULL;
+	for (size_t i = 0; i < APPENDS; i += 1) {
+		struct starlark_Str *before = s;
+		s = Str_append(s, piece);
+		expect(s != NULL);
+		expect(refs(s) == 1);
+		// The first append moves s to a buffer.
+		expect(i == 0 || s == before);
+		memcpy(&want[len], "xy", 2);
+		len += 2;
+		if (Str_data(s) != bytes) {
+			moves += 1;
+			bytes = Str_data(s);
+		}
+
+		if (i % 1000 == 0) {
+			expect_bytes(s, len, want);
+			expect(Str_hash(s) == slow_hash(len, want));
+			expect(Str_is_ascii(s));
+		}
+	}
+	expect_bytes(s, len, want);
+	expect(moves < 20);
+
+	// What was worked out about s before an append doesn't carry over.
+	expect(Str_hash(s) == slow_hash(len, want));
+	expect(Str_codepoints(s) == len);
+	struct starlark_Str *e = create("\xc3\xa9");
+	s = Str_append(s, e);
+	expect(s != NULL);
+	memcpy(&want[len], "\xc3\xa9", 2);
+	len += 2;
+	expect_bytes(s, len, want);
+	expect(Str_hash(s) == slow_hash(len, want));
+	expect(!Str_is_ascii(s));
+	expect(Str_codepoints(s) == len - 1);
+	release(e);
+
+	// Appending nothing changes nothing.
+	struct starlark_Str *empty = create("");
+	struct starlark_Str *before = s;
+	s = Str_append(s, empty);
+	expect(s == before && Str_len(s) == len);
+	release(empty);
+
+	release(s);
+	release(piece);
+	free(want);
+}
+
+// A string anything else refers to is left as it was.
+static void test_append_shared(void)
+{
+	struct starlark_Str *piece = create("xy");
+	struct starlark_Str *s = Str_append(create("start"), piece);
+	expect(s != NULL);
+	Value_retain(Value_object((struct starlark_Object *)s));
+	expect(refs(s) == 2);
+
+	struct starlark_Str *longer = Str_append(s, piece);
+	expect(longer != NULL && longer != s);
+	expect(refs(s) == 1);
+	expect(refs(longer) == 1);
+	expect_bytes(s, 7, "startxy");
+	expect_bytes(longer, 9, "startxyxy");
+	release(longer);
+
+	// A string appended to itself is copied, since its bytes would move
+	// out from under it if its buffer grew.
+	struct starlark_Str *doubled = Str_append(s, s);
+	expect(doubled != NULL);
+	expect_bytes(doubled, 14, "startxystartxy");
+
+	// Views are copied to a buffer of their own, and let go of their
+	// parent.
+	char buf[100];
+	memset(buf, 'v', sizeof(buf));
+	struct starlark_Str *parent = Str_create(sizeof(buf), buf);
+	struct starlark_Str *view = Str_slice(parent, 0, 99);
+	expect(parent != NULL && view != NULL);
+	expect(refs(parent) == 2);
+	struct starlark_Str *appended = Str_append(view, doubled);
+	expect(appended != NULL);
+	expect(refs(parent) == 1);
+	expect(!shares(appended, parent));
+	expect(Str_len(appended) == 99 + 14);
+	expect(memcmp(Str_data(appended), buf, 99) == 0);
+	expect(memcmp(Str_data(appended) + 99, "startxystartxy", 14) == 0);
+
+	// And a view can be appended from.
+	view = Str_slice(parent, 1, 99);
+	expect(view != NULL);
+	appended = Str_append(appended, view);
+	expect(appended != NULL);
+	expect(Str_len(appended) == 99 + 14 + 99);
+	expect(memcmp(Str_data(appended) + 99 + 14, buf, 99) == 0);
+
+	release(view);
+	release(parent);
+	release(appended);
+	release(doubled);
+	release(piece);
+}
+
+int main(void)
+{
+	test_create();
+	test_utf8();
+	test_equal();
+	test_slice();
+	test_slice_utf8();
+	test_append();
+	test_append_shared();
+	return EXIT_SUCCESS;
+}
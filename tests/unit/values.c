@@ -0,0 +1,171 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "starlark/int.h"
+#include "starlark/value.h"
+#include "util/panic.h"
+#include "../lib.h"
+
+// Ints at and around the edges of what fits inline.
+static const int64_t small[] = {
+	0, 1, -1, 15, -16, INT60_MAX, INT60_MAX - 1, INT60_MIN, INT60_MIN + 1,
+};
+
+static const int64_t big[] = {
+	INT60_MAX + 1, INT60_MAX + 2, INT60_MIN - 1, INT60_MIN - 2,
+	INT64_MAX,     INT64_MIN,
+};
+
+static struct starlark_Value from_i64(const int64_t i)
+{
+	struct starlark_Value result = VALUE_NONE;
+	expect(Value_from_i64(i, &result) == 0);
+	return result;
+}
+
+// Checks that the int v is want, going through a heap int.
+static void expect_int(const struct starlark_Value v, const int64_t want)
+{
+	struct starlark_Int *i = Value_to_Int(v);
+	expect(i != NULL);
+	if (want == INT64_MIN) {
+		// Int_to_i64 doesn't handle the one int64_t whose magnitude
+		// needs 64 bits.
+		expect(Int_sign(i) < 0);
+		expect(Int_bit_len(i) == 64);
+		expect(Int_low_u64(i) == UINT64_C(1) << 63);
+	} else {
+		int64_t got = 0;
+		expect(Int_to_i64(i, &got));
+		expect(got == want);
+	}
+	Int_destroy(i);
+}
+
+static void test_small(void)
+{
+	for (size_t i = 0; i < sizeof(small) / sizeof(small[0]); i += 1) {
+		const struct starlark_Value v = Value_small_int(small[i]);
+		expect(Value_is_small_int(v));
+		expect(!Value_is_object(v));
+		expect(!Value_is_none(v) && !Value_is_bool(v));
+		expect(Value_type(v) == STARLARK_TYPE_INT);
+		expect(Value_as_small_int(v) == small[i]);
+		expect(from_i64(small[i]).bits == v.bits);
+		expect_int(v, small[i]);
+		expect(Value_equal(v, Value_small_int(small[i])));
+
+		// A heap int which fits is always stored inline instead.
+		const struct starlark_Value again = Value_from_Int(
+			Value_to_Int(v));
+		expect(again.bits == v.bits);
+	}
+
+	// None and the bools share the inline tag space with ints, but none
+	// of them is one.
+	const struct starlark_Value specials[] = {
+		VALUE_NONE,
+		VALUE_FALSE,
+		VALUE_TRUE,
+	};
+	for (size_t i = 0; i < sizeof(specials) / sizeof(specials[0]); i += 1) {
+		expect(!Value_is_small_int(specials[i]));
+		expect(!Value_is_object(specials[i]));
+		expect(Value_type(specials[i]) != STARLARK_TYPE_INT);
+	}
+	expect(!Value_equal(Value_small_int(0), VALUE_NONE));
+}
+
+static void test_big(void)
+{
+	for (size_t i = 0; i < sizeof(big) / sizeof(big[0]); i += 1) {
+		const struct starlark_Value v = from_i64(big[i]);
+		expect(Value_is_object(v));
+		expect(!Value_is_small_int(v));
+		expect(Value_type(v) == STARLARK_TYPE_INT);
+		expect_int(v, big[i]);
+
+		const struct starlark_Value same = from_i64(big[i]);
+		expect(same.bits != v.bits);
+		expect(Value_equal(v, same));
+		uint64_t h1 = 0;
+		uint64_t h2 = 0;
+		expect(Value_hash(v, &h1) && Value_hash(same, &h2));
+		expect(h1 == h2);
+		Value_release(same);
+		Value_release(v);
+	}
+}
+
+// Arithmetic which crosses the edge moves the result between the two forms.
+static void test_crossing(void)
+{
+	const struct starlark_Value one = Value_small_int(1);
+	const struct starlark_Value max = Value_small_int(INT60_MAX);
+	const struct starlark_Value min = Value_small_int(INT60_MIN);
+
+	struct starlark_Value up = VALUE_NONE;
+	expect(Value_int_add(max, one, &up) == 0);
+	expect(Value_is_object(up));
+	expect_int(up, INT60_MAX + 1);
+
+	struct starlark_Value down = VALUE_NONE;
+	expect(Value_int_sub(up, one, &down) == 0);
+	expect(down.bits == max.bits);
+	Value_release(up);
+
+	struct starlark_Value below = VALUE_NONE;
+	expect(Value_int_sub(min, one, &below) == 0);
+	expect(Value_is_object(below));
+	expect_int(below, INT60_MIN - 1);
+	Value_release(below);
+
+	// -INT60_MIN is one more than INT60_MAX, but ~INT60_MIN is INT60_MAX.
+	struct starlark_Value neg = VALUE_NONE;
+	expect(Value_int_neg(min, &neg) == 0);
+	expect(Value_is_object(neg));
+	expect_int(neg, INT60_MAX + 1);
+	Value_release(neg);
+
+	struct starlark_Value inverted = VALUE_NONE;
+	expect(Value_int_not(min, &inverted) == 0);
+	expect(inverted.bits == max.bits);
+
+	struct starlark_Value shifted = VALUE_NONE;
+	expect(Value_int_lshift(Value_small_int(INT60_MIN / 2), one,
+				&shifted) == 0);
+	expect(shifted.bits == min.bits);
+	expect(Value_int_lshift(max, one, &shifted) == 0);
+	expect(Value_is_object(shifted));
+	expect_int(shifted, INT60_MAX * 2);
+	Value_release(shifted);
+
+	struct starlark_Value product = VALUE_NONE;
+	expect(Value_int_mul(min, Value_small_int(-1), &product) == 0);
+	expect(Value_is_object(product));
+	expect_int(product, INT60_MAX + 1);
+	Value_release(product);
+
+	struct starlark_Value quotient = VALUE_NONE;
+	expect(Value_int_floordiv(min, Value_small_int(-1), &quotient) == 0);
+	expect(Value_is_object(quotient));
+	expect_int(quotient, INT60_MAX + 1);
+	Value_release(quotient);
+
+	expect(Value_int_cmp(max, min) > 0);
+	struct starlark_Value huge = from_i64(INT64_MAX);
+	expect(Value_int_cmp(max, huge) < 0);
+	expect(Value_int_cmp(huge, min) > 0);
+	Value_release(huge);
+}
+
+int main(void)
+{
+	test_small();
+	test_big();
+	test_crossing();
+	Int_trim();
+	return EXIT_SUCCESS;
+}